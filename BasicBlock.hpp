@@ -0,0 +1,128 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "DecodedInst.hpp"
+
+
+namespace WdRiscv
+{
+
+  template <typename URV>
+  class Hart;
+
+
+  /// Return true if the given instruction may be compiled to host code
+  /// in a run of pure operations of a translated block: The integer
+  /// register-to-register instructions supported by all the code
+  /// generators (WasmBlock, X86Block).
+  inline bool isCompilableInst(InstId id)
+  {
+    switch (id)
+      {
+      case InstId::lui:     case InstId::c_lui:
+      case InstId::addi:    case InstId::c_addi:   case InstId::c_li:
+      case InstId::c_addi16sp:                     case InstId::c_addi4spn:
+      case InstId::slti:    case InstId::sltiu:
+      case InstId::xori:    case InstId::ori:
+      case InstId::andi:    case InstId::c_andi:
+      case InstId::add:     case InstId::c_add:    case InstId::c_mv:
+      case InstId::sub:     case InstId::c_sub:
+      case InstId::sll:     case InstId::srl:      case InstId::sra:
+      case InstId::slt:     case InstId::sltu:
+      case InstId::xor_:    case InstId::c_xor:
+      case InstId::or_:     case InstId::c_or:
+      case InstId::and_:    case InstId::c_and:
+	return true;
+      default:
+	return false;
+      }
+  }
+
+
+  /// Model a basic block: a straight-line sequence of decoded
+  /// instructions starting at a given address and ending with a
+  /// control transfer (branch, jump, csr, trap related instruction)
+  /// or at a page boundary. A block keeps a pointer to up to two
+  /// successor blocks (fall-through and taken) so that the run loop
+  /// can chain from one block to the next without a hash lookup.
+  ///
+  /// A block executed often enough is translated into a list of hot
+  /// operations: direct pointers to the instruction handlers so that
+  /// the run loop bypasses the per-instruction dispatch and
+  /// book-keeping for instructions that cannot trap.
+  template <typename URV>
+  struct BasicBlock
+  {
+    /// Maximum number of instructions in a block.
+    static constexpr unsigned maxInsts = 64;
+
+    /// Instruction handler (a Hart::execXxx method or Hart::execute).
+    typedef void (Hart<URV>::*ExecFn)(const DecodedInst*);
+
+    /// Operation of a translated block.
+    struct HotOp
+    {
+      ExecFn fn = nullptr;               // Handler.
+      const DecodedInst* di = nullptr;   // Instruction (into insts).
+      URV nextPc = 0;     // Address following instruction(s) of op.
+      bool pure = false;  // No trap, no use of pc, no memory access.
+      bool fused = false; // Op covers a fused pair of instructions.
+      unsigned count = 1; // Instruction count of a pure op.
+      uintptr_t compiled = 0; // Compiled code of a run of pure insts.
+    };
+
+    /// Address of first instruction.
+    uint64_t address = 0;
+
+    /// Address following the last instruction of the block.
+    uint64_t endAddress = 0;
+
+    /// Code generations (see Memory::codeGeneration) of the pages of
+    /// the first and last bytes of the block when it was decoded. The
+    /// block is stale if either generation has changed since.
+    uint32_t codeGen[2] = { 0, 0 };
+
+    /// Decoded instructions of this block in program order.
+    std::vector<DecodedInst> insts;
+
+    /// Chained successors: successor block i starts at address
+    /// succAddr[i]. A null successor pointer means no chain.
+    uint64_t succAddr[2] = { 0, 0 };
+    BasicBlock* succ[2] = { nullptr, nullptr };
+
+    /// Number of times this block was entered before being
+    /// translated.
+    unsigned execCount = 0;
+
+    /// Number of times this block was entered since it was built.
+    /// Folded into the per-pc profile of the hart when the block is
+    /// discarded (see Hart::enablePcProfile).
+    uint64_t profileCount = 0;
+
+    /// True if all the instructions of this block were marked in the
+    /// coverage of the hart (see Hart::setCoverage).
+    bool covered = false;
+
+    /// Translated operations (empty if block is not hot yet).
+    std::vector<HotOp> hotOps;
+  };
+}
@@ -0,0 +1,205 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+// 
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+// 
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+// 
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <map>
+#include <cinttypes>
+#include "CallProfile.hpp"
+
+
+using namespace WdRiscv;
+
+
+void
+CallProfile::reset(uint64_t insts, uint64_t cycles)
+{
+  nodes_.assign(1, Node());
+  stack_.clear();
+  current_ = 0;
+  overflow_ = 0;
+  hasRoot_ = false;
+  lastInsts_ = insts;
+  lastCycles_ = cycles;
+}
+
+
+void
+CallProfile::call(uint64_t from, uint64_t target, uint64_t retAddr,
+		  uint64_t insts, uint64_t cycles)
+{
+  // Code running before the first call belongs to the function of the
+  // first caller.
+  if (not hasRoot_)
+    {
+      nodes_[0].addr = from;
+      hasRoot_ = true;
+    }
+
+  account(insts, cycles);
+
+  if (stack_.size() >= maxDepth)
+    {
+      ++overflow_;
+      return;
+    }
+
+  unsigned child = 0;
+  for (unsigned ix : nodes_[current_].children)
+    if (nodes_[ix].addr == target)
+      {
+	child = ix;
+	break;
+      }
+
+  if (child == 0)
+    {
+      child = nodes_.size();
+      nodes_[current_].children.push_back(child);
+      nodes_.emplace_back();
+      nodes_.back().addr = target;
+      nodes_.back().parent = current_;
+    }
+
+  ++nodes_[child].calls;
+  stack_.push_back(Frame{child, retAddr});
+  current_ = child;
+}
+
+
+void
+CallProfile::ret(uint64_t target, uint64_t insts, uint64_t cycles)
+{
+  if (overflow_)
+    {
+      --overflow_;
+      return;
+    }
+
+  for (size_t i = stack_.size(); i > 0; --i)
+    if (stack_[i-1].retAddr == target)
+      {
+	account(insts, cycles);
+	stack_.resize(i - 1);
+	current_ = stack_.empty() ? 0 : stack_.back().node;
+	return;
+      }
+}
+
+
+void
+CallProfile::sync(uint64_t insts, uint64_t cycles)
+{
+  account(insts, cycles);
+}
+
+
+void
+CallProfile::reportFunctions(FILE* file, const NameFn& nameOf) const
+{
+  struct Totals
+  {
+    uint64_t calls = 0;
+    uint64_t insts = 0, selfInsts = 0;
+    uint64_t cycles = 0, selfCycles = 0;
+  };
+
+  // Subtree totals: Children are created after their parent and have
+  // larger indices.
+  std::vector<uint64_t> treeInsts(nodes_.size()), treeCycles(nodes_.size());
+  for (size_t ix = nodes_.size(); ix > 0; --ix)
+    {
+      const Node& node = nodes_[ix-1];
+      treeInsts[ix-1] += node.selfInsts;
+      treeCycles[ix-1] += node.selfCycles;
+      if (ix > 1)
+	{
+	  treeInsts[node.parent] += treeInsts[ix-1];
+	  treeCycles[node.parent] += treeCycles[ix-1];
+	}
+    }
+
+  std::vector<std::string> names(nodes_.size());
+  for (size_t ix = 0; ix < nodes_.size(); ++ix)
+    names[ix] = nameOf(nodes_[ix].addr);
+
+  // Inclusive counts of a recursive function are those of its
+  // outermost activation: Walk the tree keeping the functions active
+  // on the current path.
+  std::map<std::string, Totals> funcs;
+  std::map<std::string, unsigned> active;
+  std::vector<std::pair<unsigned, bool>> work = { { 0, true } };
+  while (not work.empty())
+    {
+      auto [ix, enter] = work.back();
+      work.pop_back();
+      const Node& node = nodes_[ix];
+      const std::string& name = names[ix];
+      if (not enter)
+	{
+	  --active[name];
+	  continue;
+	}
+
+      Totals& totals = funcs[name];
+      totals.calls += node.calls;
+      totals.selfInsts += node.selfInsts;
+      totals.selfCycles += node.selfCycles;
+      if (active[name]++ == 0)
+	{
+	  totals.insts += treeInsts[ix];
+	  totals.cycles += treeCycles[ix];
+	}
+
+      work.emplace_back(ix, false);
+      for (unsigned child : node.children)
+	work.emplace_back(child, true);
+    }
+
+  std::vector<std::pair<std::string, Totals>> sorted(funcs.begin(),
+						     funcs.end());
+  std::stable_sort(sorted.begin(), sorted.end(),
+		   [] (const auto& a, const auto& b) {
+		     return a.second.insts > b.second.insts; });
+
+  fprintf(file, "#%11s %16s %16s %16s %16s  %s\n", "calls", "insts",
+	  "self-insts", "cycles", "self-cycles", "function");
+  for (const auto& [name, t] : sorted)
+    fprintf(file, "%12" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64
+	    " %16" PRIu64 "  %s\n", t.calls, t.insts, t.selfInsts, t.cycles,
+	    t.selfCycles, name.c_str());
+}
+
+
+void
+CallProfile::reportFolded(FILE* file, const NameFn& nameOf,
+			  bool samples) const
+{
+  // Path of each node: that of its parent (created before it) followed
+  // by its own name.
+  std::vector<std::string> paths(nodes_.size());
+  for (size_t ix = 0; ix < nodes_.size(); ++ix)
+    {
+      const Node& node = nodes_[ix];
+      std::string name = nameOf(node.addr);
+      paths[ix] = ix ? paths[node.parent] + ";" + name : name;
+      uint64_t count = samples ? node.samples : node.selfInsts;
+      if (count)
+	fprintf(file, "%s %" PRIu64 "\n", paths[ix].c_str(), count);
+    }
+}
@@ -0,0 +1,125 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+// 
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+// 
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+// 
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <functional>
+
+
+namespace WdRiscv
+{
+
+  /// Guest call graph profile built from a shadow call stack. The
+  /// hart reports the calls (jal/jalr writing a link register) and the
+  /// returns (jalr through a link register) of the target program.
+  /// Executed instructions and cycles are attributed to the node of
+  /// the call tree active when they execute: counts are updated only
+  /// at calls and returns which keeps the profile cheap.
+  class CallProfile
+  {
+  public:
+
+    /// Map an address to the name of the function containing it.
+    typedef std::function<std::string(uint64_t)> NameFn;
+
+    /// Maximum depth of the shadow call stack. Deeper calls are
+    /// attributed to the deepest tracked function.
+    static constexpr unsigned maxDepth = 4096;
+
+    /// Discard the profile. The given instruction and cycle counts are
+    /// those of the hart when profiling starts.
+    void reset(uint64_t insts, uint64_t cycles);
+
+    /// Record a call from address from to the given target returning
+    /// to retAddr. Insts and cycles are the counts of the hart
+    /// including the call instruction.
+    void call(uint64_t from, uint64_t target, uint64_t retAddr,
+	      uint64_t insts, uint64_t cycles);
+
+    /// Record a return to the given address. Returns not matching a
+    /// recorded call are ignored. A return matching a frame below the
+    /// top of the stack (longjmp) pops all the frames above it.
+    void ret(uint64_t target, uint64_t insts, uint64_t cycles);
+
+    /// Count a sample (see Hart::enableSampling) in the active node.
+    void sample()
+    { ++nodes_[current_].samples; }
+
+    /// Attribute the counts not yet attributed to the function active
+    /// when the given counts are reached. Done before reporting.
+    void sync(uint64_t insts, uint64_t cycles);
+
+    /// Print one line per function to the given file: call count,
+    /// inclusive and exclusive instruction counts, and inclusive and
+    /// exclusive cycle counts. Hottest (inclusive instructions) first.
+    void reportFunctions(FILE* file, const NameFn& nameOf) const;
+
+    /// Print the profile in the collapsed stack format of flamegraph
+    /// tools: One line per call path ("f1;f2;f3 count") holding the
+    /// instructions executed in the last function of the path or, if
+    /// samples is true, the samples taken in it.
+    void reportFolded(FILE* file, const NameFn& nameOf,
+		      bool samples = false) const;
+
+  private:
+
+    /// Node of the call tree: A function called from the function of
+    /// the parent node.
+    struct Node
+    {
+      uint64_t addr = 0;        // Function address (call target).
+      unsigned parent = 0;
+      uint64_t calls = 0;
+      uint64_t selfInsts = 0;   // Exclusive counts.
+      uint64_t selfCycles = 0;
+      uint64_t samples = 0;
+      std::vector<unsigned> children;
+    };
+
+    /// Entry of the shadow call stack.
+    struct Frame
+    {
+      unsigned node = 0;
+      uint64_t retAddr = 0;
+    };
+
+    /// Attribute the counts since the last call/return to the current
+    /// node.
+    void account(uint64_t insts, uint64_t cycles)
+    {
+      Node& node = nodes_[current_];
+      node.selfInsts += insts - lastInsts_;
+      node.selfCycles += cycles - lastCycles_;
+      lastInsts_ = insts;
+      lastCycles_ = cycles;
+    }
+
+    std::vector<Node> nodes_ = std::vector<Node>(1);  // Root first.
+    std::vector<Frame> stack_;
+    unsigned current_ = 0;     // Node of top frame (root if empty).
+    unsigned overflow_ = 0;    // Calls not pushed (see maxDepth).
+    bool hasRoot_ = false;     // True once the root address is known.
+    uint64_t lastInsts_ = 0;
+    uint64_t lastCycles_ = 0;
+  };
+}
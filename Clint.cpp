@@ -0,0 +1,101 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "Clint.hpp"
+
+
+using namespace WdRiscv;
+
+
+bool
+Clint::read(uint64_t addr, unsigned size, uint64_t mtime, uint64_t& value) const
+{
+  uint64_t offset = addr - base_;
+  if ((size != 4 and size != 8) or (offset & (size - 1)) != 0)
+    return false;
+
+  unsigned shift = (offset & 4) * 8;  // Upper half of 64-bit register.
+  uint64_t mask = size == 8 ? ~uint64_t(0) : 0xffffffff;
+  uint64_t reg = 0;
+
+  if (offset >= mtimeOffset and offset < mtimeOffset + 8)
+    reg = mtime;
+  else if (offset >= mtimecmpOffset and offset < mtimecmpOffset + 8*mtimecmp_.size())
+    reg = mtimecmp_.at((offset - mtimecmpOffset) / 8).load(std::memory_order_relaxed);
+  else if (offset < msipOffset + 4*msip_.size() and size == 4)
+    {
+      reg = msip_.at((offset - msipOffset) / 4).load(std::memory_order_relaxed);
+      shift = 0;
+    }
+  else
+    return false;
+
+  value = (reg >> shift) & mask;
+  return true;
+}
+
+
+bool
+Clint::write(uint64_t addr, unsigned size, uint64_t value)
+{
+  uint64_t offset = addr - base_;
+  if ((size != 4 and size != 8) or (offset & (size - 1)) != 0)
+    return false;
+
+  unsigned hartIx = 0;
+  if (offset >= mtimeOffset and offset < mtimeOffset + 8)
+    return true;  // Timer is the cycle count of the hart.
+
+  if (offset >= mtimecmpOffset and offset < mtimecmpOffset + 8*mtimecmp_.size())
+    {
+      hartIx = (offset - mtimecmpOffset) / 8;
+      auto& reg = mtimecmp_.at(hartIx);
+      if (size == 8)
+	reg.store(value, std::memory_order_relaxed);
+      else
+	{
+	  unsigned shift = (offset & 4) * 8;
+	  uint64_t mask = uint64_t(0xffffffff) << shift;
+	  uint64_t prev = reg.load(std::memory_order_relaxed);
+	  reg.store((prev & ~mask) | ((value << shift) & mask),
+		    std::memory_order_relaxed);
+	}
+    }
+  else if (offset < msipOffset + 4*msip_.size() and size == 4)
+    {
+      hartIx = (offset - msipOffset) / 4;
+      msip_.at(hartIx).store(value & 1, std::memory_order_relaxed);
+    }
+  else
+    return false;
+
+  // Have the hart re-evaluate its interrupts at its next check.
+  if (wake_.at(hartIx))
+    wake_.at(hartIx)->store(0, std::memory_order_release);
+  return true;
+}
+
+
+void
+Clint::reset()
+{
+  for (auto& msip : msip_)
+    msip.store(0, std::memory_order_relaxed);
+  for (auto& cmp : mtimecmp_)
+    cmp.store(~uint64_t(0), std::memory_order_relaxed);
+}
@@ -0,0 +1,106 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+
+namespace WdRiscv
+{
+
+  /// Core local interruptor (clint) shared by the harts: Memory mapped
+  /// machine software interrupt (msip) and timer compare (mtimecmp)
+  /// registers of each hart and the timer (mtime) at the usual
+  /// offsets from a base address. The timer of a hart is its cycle
+  /// count: A hart schedules the timer interrupt in its event queue
+  /// (see EventQueue.hpp) at the cycle count of its mtimecmp and no
+  /// polling is needed. Writing the registers of a hart wakes it up
+  /// (see attach) so that it re-evaluates its interrupts.
+  class Clint
+  {
+  public:
+
+    /// Offsets of the registers.
+    static constexpr uint64_t msipOffset = 0;
+    static constexpr uint64_t mtimecmpOffset = 0x4000;
+    static constexpr uint64_t mtimeOffset = 0xbff8;
+
+    /// Size of the address range of the registers.
+    static constexpr uint64_t size = 0x10000;
+
+    /// Define a clint at the given base address for the given number
+    /// of harts.
+    Clint(uint64_t base, unsigned hartCount)
+      : base_(base), msip_(hartCount), mtimecmp_(hartCount),
+	wake_(hartCount, nullptr)
+    {
+      for (auto& cmp : mtimecmp_)
+	cmp = ~uint64_t(0);
+    }
+
+    /// Return the base address.
+    uint64_t base() const
+    { return base_; }
+
+    /// Return true if the given address is in the range of the
+    /// registers.
+    bool contains(uint64_t addr) const
+    { return addr - base_ < size; }
+
+    /// Set the variable holding the time of the next event of the hart
+    /// with the given index: It is cleared when a register of the hart
+    /// is written.
+    void attach(unsigned hartIx, std::atomic<uint64_t>* nextEvent)
+    { wake_.at(hartIx) = nextEvent; }
+
+    /// Return the timer compare value of the hart with given index.
+    uint64_t mtimecmp(unsigned hartIx) const
+    { return mtimecmp_.at(hartIx).load(std::memory_order_relaxed); }
+
+    /// Return true if the software interrupt of the hart with the
+    /// given index is pending.
+    bool msip(unsigned hartIx) const
+    { return msip_.at(hartIx).load(std::memory_order_relaxed) & 1; }
+
+    /// Set value to the register of the given size (4 or 8 bytes) at
+    /// the given address. Mtime is the value of the timer for the
+    /// accessing hart. Return false if no register of that size is at
+    /// the address.
+    bool read(uint64_t addr, unsigned size, uint64_t mtime, uint64_t& value) const;
+
+    /// Write the register of the given size (4 or 8 bytes) at the given
+    /// address waking up its hart. Writes to mtime are ignored (the
+    /// timer is the cycle count). Return false if no register of that
+    /// size is at the address.
+    bool write(uint64_t addr, unsigned size, uint64_t value);
+
+    /// Reset the registers: No pending software interrupt and no timer
+    /// interrupt scheduled.
+    void reset();
+
+  private:
+
+    uint64_t base_ = 0;
+    std::vector<std::atomic<uint64_t>> msip_;
+    std::vector<std::atomic<uint64_t>> mtimecmp_;
+    std::vector<std::atomic<uint64_t>*> wake_;
+  };
+}
@@ -0,0 +1,171 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <bitset>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include "Coverage.hpp"
+
+
+using namespace WdRiscv;
+
+
+// Header line of coverage files.
+static const char coverageHeader[] = "# whisper coverage 1";
+
+
+bool
+Coverage::isExecuted(uint64_t addr) const
+{
+  const Chunk* c = findChunk(addr);
+  return c and getBit(c->exec, addr);
+}
+
+
+void
+Coverage::branchOutcomes(uint64_t addr, bool& taken, bool& notTaken) const
+{
+  const Chunk* c = findChunk(addr);
+  taken = c and getBit(c->taken, addr);
+  notTaken = c and getBit(c->notTaken, addr);
+}
+
+
+uint64_t
+Coverage::executedCount() const
+{
+  uint64_t count = 0;
+  for (const auto& kv : chunks_)
+    for (auto word : kv.second.exec)
+      count += std::bitset<64>(word).count();
+  return count;
+}
+
+
+void
+Coverage::merge(const Coverage& other)
+{
+  for (const auto& kv : other.chunks_)
+    {
+      Chunk& c = chunks_[kv.first];
+      const Chunk& o = kv.second;
+      for (unsigned i = 0; i < chunkWords; ++i)
+	{
+	  c.exec[i] |= o.exec[i];
+	  c.taken[i] |= o.taken[i];
+	  c.notTaken[i] |= o.notTaken[i];
+	}
+    }
+}
+
+
+// File format: A header line followed by one line per non-zero
+// 64-bit word of the bitmaps: A letter (x for executed, t for taken,
+// n for not-taken), the address of the halfword of bit 0 of the word
+// and the word, both in hexadecimal. Files may be concatenated.
+bool
+Coverage::save(const std::string& path) const
+{
+  FILE* file = fopen(path.c_str(), "w");
+  if (not file)
+    {
+      std::cerr << "Failed to open coverage file '" << path << "' for output\n";
+      return false;
+    }
+
+  // Sorted output: Files of identical runs compare equal.
+  std::map<uint64_t, const Chunk*> sorted;
+  for (const auto& kv : chunks_)
+    sorted[kv.first] = &kv.second;
+
+  fprintf(file, "%s\n", coverageHeader);
+  for (const auto& kv : sorted)
+    {
+      uint64_t base = kv.first << chunkShift;
+      const Chunk& c = *kv.second;
+      for (unsigned i = 0; i < chunkWords; ++i)
+	{
+	  uint64_t addr = base + uint64_t(i) * 128;
+	  if (c.exec[i])
+	    fprintf(file, "x %" PRIx64 " %" PRIx64 "\n", addr, c.exec[i]);
+	  if (c.taken[i])
+	    fprintf(file, "t %" PRIx64 " %" PRIx64 "\n", addr, c.taken[i]);
+	  if (c.notTaken[i])
+	    fprintf(file, "n %" PRIx64 " %" PRIx64 "\n", addr, c.notTaken[i]);
+	}
+    }
+
+  bool ok = not ferror(file);
+  if (fclose(file) != 0 or not ok)
+    {
+      std::cerr << "Failed to write coverage file '" << path << "'\n";
+      return false;
+    }
+  return true;
+}
+
+
+bool
+Coverage::load(const std::string& path)
+{
+  FILE* file = fopen(path.c_str(), "r");
+  if (not file)
+    {
+      std::cerr << "Failed to open coverage file '" << path << "' for input\n";
+      return false;
+    }
+
+  char line[256];
+  unsigned lineNum = 0;
+  bool ok = true;
+  while (ok and fgets(line, sizeof(line), file))
+    {
+      ++lineNum;
+      if (line[0] == '#' or line[0] == '\n')
+	{
+	  if (lineNum == 1 and strncmp(line, coverageHeader, strlen(coverageHeader)) != 0)
+	    {
+	      std::cerr << "File " << path << " is not a whisper coverage file\n";
+	      ok = false;
+	    }
+	  continue;
+	}
+
+      char kind = 0;
+      uint64_t addr = 0, word = 0;
+      if (sscanf(line, "%c %" SCNx64 " %" SCNx64, &kind, &addr, &word) != 3 or
+	  (addr & 127) != 0 or (kind != 'x' and kind != 't' and kind != 'n'))
+	{
+	  std::cerr << "File " << path << ", line " << lineNum
+		    << ": Invalid coverage data\n";
+	  ok = false;
+	  break;
+	}
+
+      Chunk& c = chunk(addr);
+      unsigned ix = (addr & ((1u << chunkShift) - 1)) / 128;
+      Bitmap& bits = kind == 'x' ? c.exec : (kind == 't' ? c.taken : c.notTaken);
+      bits[ix] |= word;
+    }
+
+  fclose(file);
+  return ok;
+}
@@ -0,0 +1,134 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+
+namespace WdRiscv
+{
+
+  /// Instruction and branch coverage: One executed bit per halfword
+  /// of code (the address of every instruction is a multiple of 2)
+  /// and, for conditional branches, a taken bit and a not-taken bit.
+  /// Bits are kept in bitmaps of 4 KB chunks of the address space
+  /// allocated on first use. Coverage of several runs (or of several
+  /// harts) is combined by or-ing the bitmaps (see merge and load).
+  class Coverage
+  {
+  public:
+
+    /// Log2 of the chunk size in bytes.
+    static constexpr unsigned chunkShift = 12;
+
+    Coverage() = default;
+
+    // Not copyable: The chunk cache points into the chunk map.
+    Coverage(const Coverage&) = delete;
+    Coverage& operator=(const Coverage&) = delete;
+
+    /// Mark the instruction at the given address as executed.
+    void markExecuted(uint64_t addr)
+    { setBit(chunk(addr).exec, addr); }
+
+    /// Record the outcome of the conditional branch at the given
+    /// address.
+    void markBranch(uint64_t addr, bool taken)
+    {
+      Chunk& c = chunk(addr);
+      setBit(taken ? c.taken : c.notTaken, addr);
+    }
+
+    /// Return true if the instruction at the given address was
+    /// executed.
+    bool isExecuted(uint64_t addr) const;
+
+    /// Set taken/notTaken to true if the branch at the given address
+    /// was taken/not-taken at least once.
+    void branchOutcomes(uint64_t addr, bool& taken, bool& notTaken) const;
+
+    /// Return the number of executed instruction addresses.
+    uint64_t executedCount() const;
+
+    /// Or the coverage of the other object into this one.
+    void merge(const Coverage& other);
+
+    /// Save the coverage to the given file. Return true on success
+    /// and false (after printing an error message) on failure.
+    bool save(const std::string& path) const;
+
+    /// Or the coverage saved in the given file (see save) into this
+    /// object. Return true on success and false (after printing an
+    /// error message) on failure.
+    bool load(const std::string& path);
+
+  private:
+
+    static constexpr unsigned chunkWords = (1u << chunkShift) / 2 / 64;
+
+    typedef std::array<uint64_t, chunkWords> Bitmap;
+
+    struct Chunk
+    {
+      Bitmap exec{};
+      Bitmap taken{};
+      Bitmap notTaken{};
+    };
+
+    static void setBit(Bitmap& bits, uint64_t addr)
+    {
+      unsigned ix = (addr & ((1u << chunkShift) - 1)) >> 1;
+      bits[ix >> 6] |= uint64_t(1) << (ix & 63);
+    }
+
+    static bool getBit(const Bitmap& bits, uint64_t addr)
+    {
+      unsigned ix = (addr & ((1u << chunkShift) - 1)) >> 1;
+      return (bits[ix >> 6] >> (ix & 63)) & 1;
+    }
+
+    /// Return the chunk of the given address creating it if needed.
+    /// Consecutive accesses are mostly in the same chunk: The last
+    /// one is cached.
+    Chunk& chunk(uint64_t addr)
+    {
+      uint64_t key = addr >> chunkShift;
+      if (key != lastKey_ or not last_)
+	{
+	  last_ = &chunks_[key];   // Stable: unordered_map is node based.
+	  lastKey_ = key;
+	}
+      return *last_;
+    }
+
+    /// Return the chunk of the given address or null if none.
+    const Chunk* findChunk(uint64_t addr) const
+    {
+      auto iter = chunks_.find(addr >> chunkShift);
+      return iter == chunks_.end() ? nullptr : &iter->second;
+    }
+
+    std::unordered_map<uint64_t, Chunk> chunks_;  // Indexed by addr >> chunkShift.
+    uint64_t lastKey_ = 0;
+    Chunk* last_ = nullptr;
+  };
+}
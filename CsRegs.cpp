@@ -38,6 +38,40 @@ CsRegs<URV>::CsRegs()
   defineUserRegs();
   defineDebugRegs();
   defineNonStandardRegs();
+
+  defineDispatch();
+
+  lastWrittenRegs_.reserve(regs_.size());
+}
+
+
+template <typename URV>
+void
+CsRegs<URV>::defineDispatch()
+{
+  dispatch_.assign(regs_.size(), 0);
+
+  auto setFlag = [this] (CsrNumber first, CsrNumber last, uint8_t flag) {
+		   for (size_t ix = size_t(first); ix <= size_t(last); ++ix)
+		     dispatch_.at(ix) |= flag;
+		 };
+
+  using Csrn = CsrNumber;
+
+  // Trigger registers are accessed through the selected trigger.
+  setFlag(Csrn::TDATA1, Csrn::TDATA3, SpecialRead | SpecialWrite);
+
+  // Registers with side effects on write (see write/poke).
+  for (auto csrn : { Csrn::FFLAGS, Csrn::FRM, Csrn::FCSR, Csrn::MRAC,
+		     Csrn::MSTATUS, Csrn::MDEAU, Csrn::MEIVT } )
+    setFlag(csrn, csrn, SpecialWrite);
+  setFlag(Csrn::MHPMEVENT3, Csrn::MHPMEVENT31, SpecialWrite);
+
+  // Performance counters (see PerfRegs::countEvent).
+  setFlag(Csrn::MHPMCOUNTER3, Csrn::MHPMCOUNTER31, PerfCounter);
+  setFlag(Csrn::MHPMCOUNTER3H, Csrn::MHPMCOUNTER31H, PerfCounter);
+  setFlag(Csrn::HPMCOUNTER3, Csrn::HPMCOUNTER31, PerfCounter);
+  setFlag(Csrn::HPMCOUNTER3H, Csrn::HPMCOUNTER31H, PerfCounter);
 }
 
 
@@ -128,8 +162,16 @@ CsRegs<URV>::read(CsrNumber number, PrivilegeMode mode,
   if (csr->isDebug() and not debugMode)
     return false;
 
-  if (number >= CsrNumber::TDATA1 and number <= CsrNumber::TDATA3)
-    return readTdata(number, mode, debugMode, value);
+  uint8_t flags = dispatch_[size_t(number)];
+  if (flags)
+    {
+      if (flags & SpecialRead)
+	return readTdata(number, mode, debugMode, value);
+
+      // Performance counters are updated lazily.
+      if (flags & PerfCounter)
+	mPerfRegs_.flush();
+    }
 
   value = csr->read();
   return true;
@@ -151,6 +193,18 @@ CsRegs<URV>::write(CsrNumber number, PrivilegeMode mode, bool debugMode,
   if (csr->isDebug() and not debugMode)
     return false;
 
+  uint8_t flags = dispatch_[size_t(number)];
+  if (flags == 0)
+    {
+      csr->write(value);
+      recordWrite(number);
+      return true;
+    }
+
+  // Pending counts precede the write of a performance counter.
+  if (flags & PerfCounter)
+    mPerfRegs_.flush();
+
   // fflags and frm are part of fcsr
   if (number == CsrNumber::FFLAGS or number == CsrNumber::FRM or
       number == CsrNumber::FCSR)
@@ -870,9 +924,13 @@ CsRegs<URV>::peek(CsrNumber number, URV& value) const
 
   bool debugMode = true;
 
-  if (number >= CsrNumber::TDATA1 and number <= CsrNumber::TDATA3)
+  uint8_t flags = dispatch_[size_t(number)];
+  if (flags & SpecialRead)
     return readTdata(number, PrivilegeMode::Machine, debugMode, value);
 
+  if (flags & PerfCounter)
+    mPerfRegs_.flush();
+
   value = csr->read();
   return true;
 }
@@ -886,6 +944,16 @@ CsRegs<URV>::poke(CsrNumber number, URV value)
   if (not csr)
     return false;
 
+  uint8_t flags = dispatch_[size_t(number)];
+  if (flags == 0)
+    {
+      csr->poke(value);
+      return true;
+    }
+
+  if (flags & PerfCounter)
+    mPerfRegs_.flush();
+
   // fflags and frm are parts of fcsr
   if (number == CsrNumber::FFLAGS or number == CsrNumber::FRM or number == CsrNumber::FCSR)
     {
@@ -23,6 +23,7 @@
 #include <unordered_map>
 #include <string>
 #include <functional>
+#include <memory>
 #include "Triggers.hpp"
 #include "PerfRegs.hpp"
 
@@ -523,26 +524,26 @@ namespace WdRiscv
     /// Register a pre-poke call back which will get invoked with CSR and
     /// poked value.
     void registerPrePoke(std::function<void(Csr<URV>&, URV&)> func)
-    { prePoke_.push_back(func); }
+    { hooks().prePoke.push_back(func); }
 
     /// Register a pre-write call back which will get invoked with
     /// CSR and written value.
     void registerPreWrite(std::function<void(Csr<URV>&, URV&)> func)
-    { preWrite_.push_back(func); }
+    { hooks().preWrite.push_back(func); }
 
     /// Register a post-poke call back which will get invoked with CSR and
     /// poked value.
     void registerPostPoke(std::function<void(Csr<URV>&, URV)> func)
-    { postPoke_.push_back(func); }
+    { hooks().postPoke.push_back(func); }
 
     /// Register a post-write call back which will get invoked with
     /// CSR and written value.
     void registerPostWrite(std::function<void(Csr<URV>&, URV)> func)
-    { postWrite_.push_back(func); }
+    { hooks().postWrite.push_back(func); }
 
     /// Register a post-reset call back.
     void registerPostReset(std::function<void(Csr<URV>&)> func)
-    { postReset_.push_back(func); }
+    { hooks().postReset.push_back(func); }
 
   protected:
 
@@ -561,8 +562,9 @@ namespace WdRiscv
     void reset()
     {
       *valuePtr_ = initialValue_;
-      for (auto func : postReset_)
-        func(*this);
+      if (hooks_)
+	for (const auto& func : hooks_->postReset)
+	  func(*this);
     }
 
     /// Configure.
@@ -623,14 +625,12 @@ namespace WdRiscv
 	  prev_ = *valuePtr_;
 	  hasPrev_ = true;
 	}
-      for (auto func : preWrite_)
-        func(*this, x);
-
-      URV newVal = (x & writeMask_) | (*valuePtr_ & ~writeMask_);
-      *valuePtr_ = newVal;
-
-      for (auto func : postWrite_)
-        func(*this, newVal);
+      if (hooks_)
+	{
+	  writeHooked(x);
+	  return;
+	}
+      *valuePtr_ = (x & writeMask_) | (*valuePtr_ & ~writeMask_);
     }
 
     /// Similar to the write method but using the poke mask instead of
@@ -639,14 +639,12 @@ namespace WdRiscv
     /// CSR instructions) bits of this register.
     void poke(URV x)
     {
-      for (auto func : prePoke_)
-        func(*this, x);
-
-      URV newVal = (x & pokeMask_) | (*valuePtr_ & ~pokeMask_);
-      *valuePtr_ = newVal;
-
-      for (auto func : postPoke_)
-        func(*this, newVal);
+      if (hooks_)
+	{
+	  pokeHooked(x);
+	  return;
+	}
+      *valuePtr_ = (x & pokeMask_) | (*valuePtr_ & ~pokeMask_);
     }
 
     /// Return the value of this register before last sequence of
@@ -662,6 +660,53 @@ namespace WdRiscv
 
   private:
 
+    /// Call-backs of a register. Few registers have call-backs: They
+    /// are allocated on first registration so that the write/poke of
+    /// a register without call-backs is a single masked store.
+    struct Hooks
+    {
+      std::vector<std::function<void(Csr<URV>&, URV)>> postPoke;
+      std::vector<std::function<void(Csr<URV>&, URV)>> postWrite;
+      std::vector<std::function<void(Csr<URV>&, URV&)>> prePoke;
+      std::vector<std::function<void(Csr<URV>&, URV&)>> preWrite;
+      std::vector<std::function<void(Csr<URV>&)>> postReset;
+    };
+
+    /// Return the call-backs of this register allocating them if
+    /// needed.
+    Hooks& hooks()
+    {
+      if (not hooks_)
+	hooks_ = std::make_unique<Hooks>();
+      return *hooks_;
+    }
+
+    /// Helper to write: Write with call-backs.
+    void writeHooked(URV x)
+    {
+      for (const auto& func : hooks_->preWrite)
+        func(*this, x);
+
+      URV newVal = (x & writeMask_) | (*valuePtr_ & ~writeMask_);
+      *valuePtr_ = newVal;
+
+      for (const auto& func : hooks_->postWrite)
+        func(*this, newVal);
+    }
+
+    /// Helper to poke: Poke with call-backs.
+    void pokeHooked(URV x)
+    {
+      for (const auto& func : hooks_->prePoke)
+        func(*this, x);
+
+      URV newVal = (x & pokeMask_) | (*valuePtr_ & ~pokeMask_);
+      *valuePtr_ = newVal;
+
+      for (const auto& func : hooks_->postPoke)
+        func(*this, newVal);
+    }
+
     std::string name_;
     unsigned number_ = 0;
     bool mandatory_ = false;   // True if mandated by architecture.
@@ -681,13 +726,7 @@ namespace WdRiscv
     URV writeMask_ = ~URV(0);
     URV pokeMask_ = ~URV(0);
 
-    std::vector<std::function<void(Csr<URV>&, URV)>> postPoke_;
-    std::vector<std::function<void(Csr<URV>&, URV)>> postWrite_;
-
-    std::vector<std::function<void(Csr<URV>&, URV&)>> prePoke_;
-    std::vector<std::function<void(Csr<URV>&, URV&)>> preWrite_;
-
-    std::vector<std::function<void(Csr<URV>&)>> postReset_;
+    std::unique_ptr<Hooks> hooks_;  // Null if no call-backs.
   };
 
 
@@ -880,6 +919,12 @@ namespace WdRiscv
     bool hasEnterDebugModeTripped() const
     { return triggers_.hasEnterDebugModeTripped(); }
 
+    /// Return true if a trigger with a start-trace or stop-trace
+    /// action tripped since the last call setting start to true if
+    /// the trace should start and false if it should stop.
+    bool takeTraceTriggerAction(bool& start)
+    { return triggers_.takeTraceAction(start); }
+
     /// Set value to the value of the given register returning true on
     /// success and false if number is out of bound.
     bool peek(CsrNumber number, URV& value) const;
@@ -951,6 +996,17 @@ namespace WdRiscv
     /// getLastWrittenRegs method.
     void recordWrite(CsrNumber num);
 
+    /// Flags of the per-CSR dispatch entries (see dispatch_).
+    enum DispatchFlag : uint8_t
+      {
+	SpecialRead = 1,   // Read needs more than a value load.
+	SpecialWrite = 2,  // Write needs more than a masked store.
+	PerfCounter = 4    // Value includes lazily updated event counts.
+      };
+
+    /// Define the dispatch entry of each CSR number.
+    void defineDispatch();
+
     /// Clear the remembered indices of the CSR register(s) written by
     /// the last instruction.
     void clearLastWrittenRegs()
@@ -980,6 +1036,16 @@ namespace WdRiscv
       triggers_.getLastWrittenTriggers(triggerNums);
     }
 
+    /// Return the numbers of the CSRs written by the last
+    /// instruction. Unlike getLastWrittenRegs, this does not copy.
+    const std::vector<CsrNumber>& lastWrittenRegs() const
+    { return lastWrittenRegs_; }
+
+    /// Fill the trigs vector with the indices of the triggers written
+    /// by the last instruction. The vector is cleared first.
+    void getLastWrittenTriggers(std::vector<unsigned>& trigs) const
+    { triggers_.getLastWrittenTriggers(trigs); }
+
     bool isInterruptEnabled() const
     { return interruptEnable_; }
 
@@ -1016,9 +1082,14 @@ namespace WdRiscv
 
     Triggers<URV> triggers_;
 
-    // Register written since most recent clearLastWrittenRegs
+    // Register written since most recent clearLastWrittenRegs. Room
+    // for all the CSRs is reserved so that recording never allocates.
     std::vector<CsrNumber> lastWrittenRegs_;
 
+    // Or-ed DispatchFlag values indexed by CSR number: A CSR without
+    // flags is read with a load and written with a masked store.
+    std::vector<uint8_t> dispatch_;
+
     // Counters implementing machine performance counters.
     PerfRegs mPerfRegs_;
 
@@ -33,6 +33,21 @@ namespace WdRiscv
   class Core;
 
 
+  /// Macro-op fusion kinds. A fused instruction is executed in one
+  /// step together with the instruction that follows it. Only pairs
+  /// that cannot take an exception are fused.
+  enum class FusedOp : uint8_t
+    {
+      None,
+      LuiAddi,     // lui rd, hi;  addi rd, rd, lo
+      LuiAddiw,    // lui rd, hi;  addiw rd, rd, lo
+      AuipcAddi,   // auipc rd, hi;  addi rd, rd, lo
+      AuipcJalr,   // auipc rd, hi;  jalr rd2, lo(rd)
+      SlliSrli,    // slli rd, rs, n;  srli rd, rd, m
+      SltBranch    // slt/sltu rd, rs1, rs2;  beqz/bnez rd, target
+    };
+
+
   /// Model a decoded instruction: instruction address, opcode, and
   /// operand fields. All instructions are assumed to have the form
   ///   inst op0, op1, op2, op3
@@ -52,14 +67,14 @@ namespace WdRiscv
     /// Default contructor: Define an invalid object.
     DecodedInst()
       : addr_(0), inst_(0), size_(0), entry_(nullptr),
-	op0_(0), op1_(0), op2_(0), op3_(0)
+	op0_(0), op1_(0), op2_(0), op3_(0), fused_(FusedOp::None)
     { values_[0] = values_[1] = values_[2] = values_[3] = 0; }
 
     /// Constructor.
     DecodedInst(uint64_t addr, uint32_t inst, const InstEntry* entry,
 		uint32_t op0, uint32_t op1, uint32_t op2, uint32_t op3)
       : addr_(addr), inst_(inst), size_(instructionSize(inst)), entry_(entry),
-	op0_(op0), op1_(op1), op2_(op2), op3_(op3)
+	op0_(op0), op1_(op1), op2_(op2), op3_(op3), fused_(FusedOp::None)
     { values_[0] = values_[1] = values_[2] = values_[3] = 0; }
 
     /// Return instruction size in bytes.
@@ -138,6 +153,21 @@ namespace WdRiscv
     void invalidate()
     { entry_ = nullptr; }
 
+    /// Return the macro-op fusion kind of this instruction and the one
+    /// following it. Return FusedOp::None if not fused.
+    FusedOp fusedOp() const
+    { return fused_; }
+
+    /// Return true if a breakpoint is set at the address of this
+    /// instruction (see Hart::addBreakpoint).
+    bool isBreakpoint() const
+    { return breakpoint_; }
+
+    /// Return true if the run stops when reaching the address of this
+    /// instruction (see Hart::setStopAddress).
+    bool isStopPoint() const
+    { return stopPoint_; }
+
     /// Return associated instruction table information.
     const InstEntry* instEntry() const
     { return entry_; }
@@ -201,6 +231,15 @@ namespace WdRiscv
     void setOp3(uint32_t op3)
     { op3_ = op3; }
 
+    void setFusedOp(FusedOp op)
+    { fused_ = op; }
+
+    void setBreakpoint(bool flag)
+    { breakpoint_ = flag; }
+
+    void setStopPoint(bool flag)
+    { stopPoint_ = flag; }
+
     void reset(uint64_t addr, uint32_t inst, const InstEntry* entry,
 	       uint32_t op0, uint32_t op1, uint32_t op2, uint32_t op3)
     {
@@ -209,6 +248,9 @@ namespace WdRiscv
       entry_ = entry;
       op0_ = op0; op1_ = op1; op2_ = op2; op3_ = op3;
       size_ = instructionSize(inst);
+      fused_ = FusedOp::None;
+      breakpoint_ = false;
+      stopPoint_ = false;
     }
 
   private:
@@ -221,6 +263,9 @@ namespace WdRiscv
     uint32_t op1_;    // 2nd operand (register number or immediate value)
     uint32_t op2_;    // 3rd operand (register number or immediate value)
     uint32_t op3_;    // 4th operand (typically a register number)
+    FusedOp fused_;   // Fusion with following instruction.
+    bool breakpoint_ = false;  // Breakpoint at address of instruction.
+    bool stopPoint_ = false;   // Stop address at address of instruction.
 
     uint64_t values_[4];  // Values of operands.
   };
@@ -0,0 +1,96 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+
+namespace WdRiscv
+{
+
+  /// Queue of events scheduled at given times. Times are in the unit
+  /// of the owner (the cycle count of a hart): The owner compares its
+  /// count with nextTime() and calls runDue once the time is reached.
+  /// Events of the same time run in the order they were scheduled. Used
+  /// for the timer of the clint (see Clint.hpp) and for device
+  /// interrupts scheduled at given cycle counts.
+  class EventQueue
+  {
+  public:
+
+    /// Action of an event. Receives the time at which it runs (at or
+    /// after the scheduled time).
+    typedef std::function<void(uint64_t now)> Action;
+
+    /// Schedule the given action at the given time.
+    void schedule(uint64_t time, Action action)
+    {
+      heap_.push_back(Event{time, seq_++, std::move(action)});
+      std::push_heap(heap_.begin(), heap_.end(), later);
+    }
+
+    /// Return the time of the earliest event or the largest time if
+    /// the queue is empty.
+    uint64_t nextTime() const
+    { return heap_.empty() ? ~uint64_t(0) : heap_.front().time; }
+
+    /// Run, in time order, the actions of the events scheduled at or
+    /// before the given time removing them from the queue. Actions may
+    /// schedule other events.
+    void runDue(uint64_t now)
+    {
+      while (not heap_.empty() and heap_.front().time <= now)
+	{
+	  std::pop_heap(heap_.begin(), heap_.end(), later);
+	  Action action = std::move(heap_.back().action);
+	  heap_.pop_back();
+	  action(now);
+	}
+    }
+
+    /// Remove all the events.
+    void clear()
+    { heap_.clear(); }
+
+    bool empty() const
+    { return heap_.empty(); }
+
+    size_t size() const
+    { return heap_.size(); }
+
+  private:
+
+    struct Event
+    {
+      uint64_t time = 0;
+      uint64_t seq = 0;   // Insertion rank: orders events of same time.
+      Action action;
+    };
+
+    /// Heap order: Earliest event at the front.
+    static bool later(const Event& a, const Event& b)
+    { return a.time != b.time ? a.time > b.time : a.seq > b.seq; }
+
+    std::vector<Event> heap_;
+    uint64_t seq_ = 0;
+  };
+}
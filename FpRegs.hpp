@@ -21,6 +21,7 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <cstring>
 #include <vector>
 #include <type_traits>
 #include <map>
@@ -198,11 +199,15 @@ namespace WdRiscv
       return *((uint64_t*) &regs_.at(i));
     }
 
-    /// Set FP register i to the given value.
+    /// Set FP register i to the given value. If the register file is
+    /// configured for single precision only (see setSingleOnly), keep
+    /// the least significant 32 bits of the value and NAN-box them.
     void pokeBits(unsigned i, uint64_t val)
     {
       if (sizeof(FRV) == 4)
 	*((uint32_t*) &regs_.at(i)) = val;
+      else if (singleOnly_)
+	*((uint64_t*) &regs_.at(i)) = (val & 0xffffffff) | boxMask;
       else
 	*((uint64_t*) &regs_.at(i)) = val;
     }
@@ -210,11 +215,29 @@ namespace WdRiscv
     /// Set value of ith register to the given value.
     void write(unsigned i, FRV value)
     {
-      originalValue_ = regs_.at(i);
-      regs_.at(i) = value;
+      originalValue_ = regs_[i];
+      regs_[i] = value;
       lastWrittenReg_ = i;
     }
 
+    /// Configure this register file for a hart with the F extension
+    /// but without the D extension if flag is true. In that
+    /// configuration the upper half of every 64-bit register holds
+    /// the NAN-box at all times and writeSingle only updates the
+    /// lower half. The peek/poke view of the registers is unchanged.
+    void setSingleOnly(bool flag)
+    {
+      singleOnly_ = flag and sizeof(FRV) == 8;
+      if (singleOnly_)
+	for (unsigned i = 0; i < regs_.size(); ++i)
+	  pokeBits(i, readBitsRaw(i));
+    }
+
+    /// Return true if this register file is configured for single
+    /// precision only (see setSingleOnly).
+    bool isSingleOnly() const
+    { return singleOnly_; }
+
     /// Read a single precision floating point number from the ith
     /// register.  If the register width is 64-bit, this will recover
     /// the least significant 32 bits (it assumes that the number in
@@ -272,16 +295,17 @@ namespace WdRiscv
     int getLastWrittenReg() const
     { return lastWrittenReg_; }
 
-    /// Set regIx and regValue to the index and previous value (before
-    /// write) of the last written register returning true on success
-    /// and false if no integer was written by the last executed
-    /// instruction (in which case regIx and regVal are left
+    /// Set regIx and regValue to the index and previous bit pattern
+    /// (before write) of the last written register returning true on
+    /// success and false if no register was written by the last
+    /// executed instruction (in which case regIx and regVal are left
     /// unmodified).
     bool getLastWrittenReg(unsigned& regIx, uint64_t& regValue) const
     {
       if (lastWrittenReg_ < 0) return false;
       regIx = lastWrittenReg_;
-      regValue = originalValue_;
+      regValue = 0;
+      memcpy(&regValue, &originalValue_, sizeof(originalValue_));
       return true;
     }
 
@@ -303,7 +327,10 @@ namespace WdRiscv
 
   private:
 
+    static constexpr uint64_t boxMask = uint64_t(~uint32_t(0)) << 32;
+
     std::vector<FRV> regs_;
+    bool singleOnly_ = false;  // True if F without D (see setSingleOnly).
     int lastWrittenReg_ = -1;  // Register accessed in most recent write.
     FRV originalValue_ = 0;    // Original value of last written reg.
     std::map<std::string, FpRegNumber> nameToNumber_;
@@ -335,9 +362,7 @@ namespace WdRiscv
   float
   FpRegs<double>::readSingle(unsigned i) const
   {
-    FpUnion u;
-    u.dp = regs_.at(i);
-    return u.sp.sp;
+    return reinterpret_cast<const FpUnion*>(&regs_[i])->sp.sp;
   }
 
 
@@ -346,6 +371,15 @@ namespace WdRiscv
   void
   FpRegs<double>::writeSingle(unsigned i, float x)
   {
+    if (singleOnly_)
+      {
+	// Upper half already holds the NAN-box: Update lower half only.
+	originalValue_ = regs_[i];
+	reinterpret_cast<FpUnion*>(&regs_[i])->sp.sp = x;
+	lastWrittenReg_ = i;
+	return;
+      }
+
     FpUnion u;
     u.sp.sp = x;
     u.sp.pad = ~uint32_t(0);  // Bit pattern for negative quiet NAN.
@@ -23,7 +23,10 @@
 #include <cmath>
 #include <map>
 #include <mutex>
+#include <thread>
+#include <type_traits>
 #include <boost/format.hpp>
+#include <nlohmann/json.hpp>
 
 // On pure 32-bit machines, use boost for 128-bit integer type.
 #if __x86_64__
@@ -50,6 +53,9 @@
 #include "instforms.hpp"
 #include "DecodedInst.hpp"
 #include "Hart.hpp"
+#include "WasmBlock.hpp"
+#include "X86Block.hpp"
+#include "SoftFloat.hpp"
 
 using namespace WdRiscv;
 
@@ -120,9 +126,14 @@ Hart<URV>::Hart(unsigned localHartId, Memory& memory, unsigned intRegCount)
   regionHasMemMappedRegs_.resize(16);
   regionHasLocalInstMem_.resize(16);
 
-  decodeCacheSize_ = 64*1024;
-  decodeCacheMask_ = 0xffff;
-  decodeCache_.resize(decodeCacheSize_);
+  // Decode cache is allocated on first use.
+  resizeDecodeCache(64*1024);
+
+  loadQueue_.setCapacity(maxLoadQueueSize_);
+
+#ifdef __EMSCRIPTEN__
+  configMmioWindow(mmioBase_, mmioSize_);
+#endif
 
   // Tie the retired instruction and cycle counter CSRs to variables
   // held in the hart.
@@ -200,6 +211,8 @@ Hart<URV>::reset(bool resetMemoryMappedRegs)
   clearPendingNmi();
 
   loadQueue_.clear();
+  flushBlockCache();
+  interruptEnablesChanged();
 
   pc_ = resetPc_;
   currPc_ = resetPc_;
@@ -242,6 +255,9 @@ Hart<URV>::reset(bool resetMemoryMappedRegs)
                       << "extension (bit 5) is not enabled -- ignored\n";
         }
 
+      // F without D: Registers hold single precision values only.
+      fpRegs_.setSingleOnly(rvf_ and not rvd_);
+
       if (not (value & (URV(1) << ('i' - 'a'))))
         std::cerr << "Bit 8 (i extension) is cleared in the MISA register "
                   << " but extension is mandatory -- assuming bit 8 set\n";
@@ -305,6 +321,495 @@ Hart<URV>::reset(bool resetMemoryMappedRegs)
 }
 
 
+template <typename URV>
+void
+Hart<URV>::captureState(Snapshot& snap)
+{
+  snap.intRegs = intRegs_.regs_;
+  snap.fpRegs = fpRegs_.regs_;
+
+  csRegs_.mPerfRegs_.flush();
+
+  snap.csrValues.resize(csRegs_.regs_.size());
+  for (size_t i = 0; i < csRegs_.regs_.size(); ++i)
+    {
+      const auto& csr = csRegs_.regs_[i];
+      snap.csrValues[i] = csr.valuePtr_ ? *csr.valuePtr_ : csr.value_;
+    }
+
+  snap.triggers = csRegs_.triggers_;
+  snap.eventOfCounter = csRegs_.mPerfRegs_.eventOfCounter_;
+  snap.countersOfEvent = csRegs_.mPerfRegs_.countersOfEvent_;
+  snap.interruptEnable = csRegs_.interruptEnable_;
+  snap.hasActiveTrigger = csRegs_.hasActiveTrigger_;
+  snap.hasActiveInstTrigger = csRegs_.hasActiveInstTrigger_;
+  snap.mdseacLocked = csRegs_.mdseacLocked_;
+
+  snap.pc = pc_;
+  snap.progBreak = progBreak_;
+  snap.privMode = privMode_;
+  snap.debugMode = debugMode_;
+  snap.debugStepMode = debugStepMode_;
+  snap.dcsrStepIe = dcsrStepIe_;
+  snap.dcsrStep = dcsrStep_;
+  snap.ebreakInstDebug = ebreakInstDebug_;
+  snap.nmiPending = nmiPending_;
+  snap.nmiCause = nmiCause_;
+  snap.hartStarted = hartStarted_;
+  snap.countersCsrOn = countersCsrOn_;
+  snap.prevCountersCsrOn = prevCountersCsrOn_;
+  snap.targetProgFinished = targetProgFinished_;
+  snap.instCounter = instCounter_;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::applyState(const Snapshot& snap)
+{
+  intRegs_.regs_ = snap.intRegs;
+  fpRegs_.regs_ = snap.fpRegs;
+
+  for (size_t i = 0; i < csRegs_.regs_.size() and i < snap.csrValues.size(); ++i)
+    {
+      auto& csr = csRegs_.regs_[i];
+      if (csr.valuePtr_)
+	*csr.valuePtr_ = snap.csrValues[i];
+      else
+	csr.value_ = snap.csrValues[i];
+    }
+
+  csRegs_.triggers_ = snap.triggers;
+  csRegs_.mPerfRegs_.eventOfCounter_ = snap.eventOfCounter;
+  csRegs_.mPerfRegs_.countersOfEvent_ = snap.countersOfEvent;
+  csRegs_.mPerfRegs_.discardPending();
+  csRegs_.interruptEnable_ = snap.interruptEnable;
+  csRegs_.hasActiveTrigger_ = snap.hasActiveTrigger;
+  csRegs_.hasActiveInstTrigger_ = snap.hasActiveInstTrigger;
+  csRegs_.mdseacLocked_ = snap.mdseacLocked;
+
+  pc_ = snap.pc;
+  currPc_ = snap.pc;
+  progBreak_ = snap.progBreak;
+  privMode_ = snap.privMode;
+  debugMode_ = snap.debugMode;
+  debugStepMode_ = snap.debugStepMode;
+  dcsrStepIe_ = snap.dcsrStepIe;
+  dcsrStep_ = snap.dcsrStep;
+  ebreakInstDebug_ = snap.ebreakInstDebug;
+  nmiPending_ = snap.nmiPending;
+  nmiCause_ = snap.nmiCause;
+  hartStarted_ = snap.hartStarted;
+  countersCsrOn_ = snap.countersCsrOn;
+  prevCountersCsrOn_ = snap.prevCountersCsrOn;
+  targetProgFinished_ = snap.targetProgFinished;
+  instCounter_ = snap.instCounter;
+
+  triggerTripped_ = false;
+  loadQueue_.clear();
+  interruptEnablesChanged();
+  clearTraceData();
+  updateStackChecker();
+}
+
+
+template <typename URV>
+void
+Hart<URV>::takeSnapshot()
+{
+  captureState(snapshot_);
+  memory_.takeSnapshot();
+  hasSnapshot_ = true;
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::restoreSnapshot(bool restoreMemory)
+{
+  if (not hasSnapshot_)
+    return false;
+
+  if (restoreMemory)
+    {
+      // Drop the decoded instructions of the restored pages. The
+      // basic blocks of those pages were invalidated by the memory.
+      std::vector<size_t> pages;
+      if (not memory_.restoreSnapshot(pages))
+	return false;
+      for (auto addr : pages)
+	if (addr <= ~URV(0))
+	  invalidateDecodeCache(URV(addr), memory_.pageSize());
+    }
+  else
+    {
+      // Memory restored by another hart: Pages are not known.
+      for (auto& entry : decodeCache_)
+	entry.invalidate();
+    }
+
+  applyState(snapshot_);
+  return true;
+}
+
+
+/// Write the bytes of the given trivially copyable value to the given
+/// stream.
+template <typename T>
+static void
+writeCheckpointValue(std::ostream& out, const T& value)
+{
+  static_assert(std::is_trivially_copyable<T>::value);
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+
+/// Write the size of the given vector and its elements.
+template <typename T>
+static void
+writeCheckpointVector(std::ostream& out, const std::vector<T>& vec)
+{
+  static_assert(std::is_trivially_copyable<T>::value);
+  writeCheckpointValue(out, uint64_t(vec.size()));
+  out.write(reinterpret_cast<const char*>(vec.data()), vec.size()*sizeof(T));
+}
+
+
+/// Read a value written by writeCheckpointValue. Return false on
+/// failure.
+template <typename T>
+static bool
+readCheckpointValue(std::istream& in, T& value)
+{
+  in.read(reinterpret_cast<char*>(&value), sizeof(value));
+  return bool(in);
+}
+
+
+/// Read a vector written by writeCheckpointVector. Return false on
+/// failure or if the vector size is not the expected one.
+template <typename T>
+static bool
+readCheckpointVector(std::istream& in, std::vector<T>& vec, size_t expected)
+{
+  uint64_t size = 0;
+  if (not readCheckpointValue(in, size) or size != expected)
+    return false;
+  vec.resize(size);
+  in.read(reinterpret_cast<char*>(vec.data()), size*sizeof(T));
+  return bool(in);
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::saveCheckpoint(std::ostream& out)
+{
+  Snapshot snap;
+  captureState(snap);
+
+  writeCheckpointValue(out, uint32_t(sizeof(URV)));
+  writeCheckpointVector(out, snap.intRegs);
+  writeCheckpointVector(out, snap.fpRegs);
+  writeCheckpointVector(out, snap.csrValues);
+
+  // Triggers: data registers only (the rest is configuration).
+  writeCheckpointValue(out, uint64_t(snap.triggers.size()));
+  for (size_t i = 0; i < snap.triggers.size(); ++i)
+    {
+      URV data1 = 0, data2 = 0, data3 = 0;
+      snap.triggers.peek(URV(i), data1, data2, data3);
+      writeCheckpointValue(out, data1);
+      writeCheckpointValue(out, data2);
+      writeCheckpointValue(out, data3);
+    }
+
+  writeCheckpointVector(out, snap.eventOfCounter);
+  writeCheckpointValue(out, uint64_t(snap.countersOfEvent.size()));
+  for (const auto& counters : snap.countersOfEvent)
+    writeCheckpointVector(out, counters);
+
+  bool flags[] = { snap.interruptEnable, snap.hasActiveTrigger,
+		   snap.hasActiveInstTrigger, snap.mdseacLocked,
+		   snap.debugMode, snap.debugStepMode, snap.dcsrStepIe,
+		   snap.dcsrStep, snap.ebreakInstDebug, snap.nmiPending,
+		   snap.hartStarted, snap.countersCsrOn,
+		   snap.prevCountersCsrOn, snap.targetProgFinished };
+  writeCheckpointValue(out, flags);
+
+  writeCheckpointValue(out, snap.pc);
+  writeCheckpointValue(out, snap.progBreak);
+  writeCheckpointValue(out, snap.privMode);
+  writeCheckpointValue(out, snap.nmiCause);
+  writeCheckpointValue(out, snap.instCounter);
+
+  return bool(out);
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::loadCheckpoint(std::istream& in)
+{
+  // Start from the current state for the parts that are
+  // configuration (e.g. the trigger masks).
+  Snapshot snap;
+  captureState(snap);
+
+  uint32_t urvSize = 0;
+  if (not readCheckpointValue(in, urvSize) or urvSize != sizeof(URV))
+    {
+      std::cerr << "Checkpoint register width does not match that of hart "
+		<< localHartId_ << '\n';
+      return false;
+    }
+
+  size_t intCount = snap.intRegs.size(), fpCount = snap.fpRegs.size();
+  size_t csrCount = snap.csrValues.size();
+  if (not readCheckpointVector(in, snap.intRegs, intCount) or
+      not readCheckpointVector(in, snap.fpRegs, fpCount) or
+      not readCheckpointVector(in, snap.csrValues, csrCount))
+    {
+      std::cerr << "Checkpoint registers do not match the configuration of "
+		<< "hart " << localHartId_ << '\n';
+      return false;
+    }
+
+  uint64_t triggerCount = 0;
+  if (not readCheckpointValue(in, triggerCount) or
+      triggerCount != snap.triggers.size())
+    {
+      std::cerr << "Checkpoint trigger count does not match the "
+		<< "configuration of hart " << localHartId_ << '\n';
+      return false;
+    }
+  for (size_t i = 0; i < triggerCount; ++i)
+    {
+      URV data1 = 0, data2 = 0, data3 = 0;
+      if (not readCheckpointValue(in, data1) or
+	  not readCheckpointValue(in, data2) or
+	  not readCheckpointValue(in, data3))
+	return false;
+      snap.triggers.poke(URV(i), data1, data2, data3);
+    }
+
+  size_t eventCount = snap.countersOfEvent.size();
+  uint64_t count = 0;
+  if (not readCheckpointVector(in, snap.eventOfCounter,
+			       snap.eventOfCounter.size()) or
+      not readCheckpointValue(in, count) or count != eventCount)
+    {
+      std::cerr << "Checkpoint performance counters do not match the "
+		<< "configuration of hart " << localHartId_ << '\n';
+      return false;
+    }
+  for (auto& counters : snap.countersOfEvent)
+    {
+      uint64_t size = 0;
+      if (not readCheckpointValue(in, size) or size > snap.eventOfCounter.size())
+	return false;
+      counters.resize(size);
+      in.read(reinterpret_cast<char*>(counters.data()),
+	      size*sizeof(unsigned));
+    }
+
+  bool flags[14];
+  if (not readCheckpointValue(in, flags) or
+      not readCheckpointValue(in, snap.pc) or
+      not readCheckpointValue(in, snap.progBreak) or
+      not readCheckpointValue(in, snap.privMode) or
+      not readCheckpointValue(in, snap.nmiCause) or
+      not readCheckpointValue(in, snap.instCounter))
+    {
+      std::cerr << "Truncated checkpoint for hart " << localHartId_ << '\n';
+      return false;
+    }
+
+  snap.interruptEnable = flags[0];
+  snap.hasActiveTrigger = flags[1];
+  snap.hasActiveInstTrigger = flags[2];
+  snap.mdseacLocked = flags[3];
+  snap.debugMode = flags[4];
+  snap.debugStepMode = flags[5];
+  snap.dcsrStepIe = flags[6];
+  snap.dcsrStep = flags[7];
+  snap.ebreakInstDebug = flags[8];
+  snap.nmiPending = flags[9];
+  snap.hartStarted = flags[10];
+  snap.countersCsrOn = flags[11];
+  snap.prevCountersCsrOn = flags[12];
+  snap.targetProgFinished = flags[13];
+
+  // Memory is replaced as a whole: Drop all decoded instructions.
+  for (auto& entry : decodeCache_)
+    entry.invalidate();
+
+  applyState(snap);
+  return true;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::saveUndoBase(UndoBase& base) const
+{
+  base.pc = pc_;
+  base.currPc = currPc_;
+  base.privMode = privMode_;
+  base.debugMode = debugMode_;
+  base.debugStepMode = debugStepMode_;
+  base.dcsrStepIe = dcsrStepIe_;
+  base.dcsrStep = dcsrStep_;
+  base.ebreakInstDebug = ebreakInstDebug_;
+  base.nmiPending = nmiPending_;
+  base.nmiCause = nmiCause_;
+  base.countersCsrOn = countersCsrOn_;
+  base.prevCountersCsrOn = prevCountersCsrOn_;
+  base.targetProgFinished = targetProgFinished_;
+  base.interruptEnable = csRegs_.interruptEnable_;
+  base.instCounter = instCounter_;
+  base.retiredInsts = retiredInsts_;
+  base.cycleCount = cycleCount_;
+  base.exceptionCount = exceptionCount_;
+  base.consecutiveIllegalCount = consecutiveIllegalCount_;
+  base.counterAtLastIllegal = counterAtLastIllegal_;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::restoreUndoBase(const UndoBase& base)
+{
+  pc_ = base.pc;
+  currPc_ = base.currPc;
+  privMode_ = base.privMode;
+  debugMode_ = base.debugMode;
+  debugStepMode_ = base.debugStepMode;
+  dcsrStepIe_ = base.dcsrStepIe;
+  dcsrStep_ = base.dcsrStep;
+  ebreakInstDebug_ = base.ebreakInstDebug;
+  nmiPending_ = base.nmiPending;
+  nmiCause_ = base.nmiCause;
+  countersCsrOn_ = base.countersCsrOn;
+  prevCountersCsrOn_ = base.prevCountersCsrOn;
+  targetProgFinished_ = base.targetProgFinished;
+  csRegs_.interruptEnable_ = base.interruptEnable;
+  instCounter_ = base.instCounter;
+  retiredInsts_ = base.retiredInsts;
+  cycleCount_ = base.cycleCount;
+  exceptionCount_ = base.exceptionCount;
+  consecutiveIllegalCount_ = base.consecutiveIllegalCount;
+  counterAtLastIllegal_ = base.counterAtLastIllegal;
+
+  triggerTripped_ = false;
+  interruptEnablesChanged();
+}
+
+
+template <typename URV>
+void
+Hart<URV>::beginUndoLog()
+{
+  endUndoLog();
+  undoMemMark_ = memory_.beginWriteJournal();
+  saveUndoBase(undoBase_);
+  clearTraceData();
+  undoLogActive_ = true;
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::rollbackUndoLog()
+{
+  if (not undoLogActive_)
+    return false;
+
+  undoEntries(0);
+  memory_.rollbackWriteJournal(undoMemMark_);
+  restoreUndoBase(undoBase_);
+  endUndoLog();
+
+  clearTraceData();
+  updateStackChecker();
+  return true;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::recordUndoEntries(bool withMemory)
+{
+  using Kind = typename UndoEntry::Kind;
+
+  unsigned regIx = 0;
+  URV oldValue = 0;
+  if (intRegs_.getLastWrittenReg(regIx, oldValue))
+    undoLog_.push_back({Kind::IntReg, 0, regIx, oldValue});
+
+  uint64_t oldFpBits = 0;
+  if (fpRegs_.getLastWrittenReg(regIx, oldFpBits))
+    undoLog_.push_back({Kind::FpReg, 0, regIx, oldFpBits});
+
+  for (auto csrn : csRegs_.lastWrittenRegs())
+    {
+      const Csr<URV>* csr = csRegs_.getImplementedCsr(csrn);
+      if (csr)
+	undoLog_.push_back({Kind::Csr, 0, uint64_t(csrn), csr->prevValue()});
+    }
+
+  if (not withMemory)
+    return;
+
+  size_t addr = 0;
+  uint64_t value = 0;
+  unsigned size = memory_.getLastWriteNewValue(localHartId_, addr, value);
+  if (size and memory_.getLastWriteOldValue(localHartId_, value))
+    undoLog_.push_back({Kind::Mem, size, addr, value});
+}
+
+
+template <typename URV>
+void
+Hart<URV>::undoEntries(size_t mark)
+{
+  using Kind = typename UndoEntry::Kind;
+
+  while (undoLog_.size() > mark)
+    {
+      const auto& entry = undoLog_.back();
+      switch (entry.kind)
+	{
+	case Kind::IntReg:
+	  intRegs_.poke(entry.addr, entry.value);
+	  break;
+
+	case Kind::FpReg:
+	  fpRegs_.pokeBits(entry.addr, entry.value);
+	  break;
+
+	case Kind::Csr:
+	  {
+	    // Previous value was legal: Bypass the write/poke masks.
+	    Csr<URV>* csr = csRegs_.getImplementedCsr(CsrNumber(entry.addr));
+	    if (csr)
+	      csr->pokeNoMask(entry.value);
+	  }
+	  break;
+
+	case Kind::Mem:
+	  {
+	    uint64_t value = entry.value;
+	    for (unsigned i = 0; i < entry.size; ++i, value >>= 8)
+	      pokeMemory(entry.addr + i, uint8_t(value));
+	  }
+	  break;
+	}
+      undoLog_.pop_back();
+    }
+}
+
+
 template <typename URV>
 bool
 Hart<URV>::loadHexFile(const std::string& file)
@@ -336,6 +841,9 @@ Hart<URV>::loadElfFile(const std::string& file, size_t& entryPoint)
   if (this->findElfSymbol("__global_pointer$", sym))
     this->pokeIntReg(RegGp, URV(sym.addr_));
 
+  if (decodeCacheFromElf_)
+    resizeDecodeCache(memory_.elfCodeSize() / 2);
+
   if (this->findElfSymbol("_end", sym))   // For newlib/linux emulation.
     this->setTargetProgramBreak(URV(sym.addr_));
   else
@@ -397,8 +905,6 @@ template <typename URV>
 bool
 Hart<URV>::pokeMemory(size_t addr, uint8_t val)
 {
-  std::lock_guard<std::mutex> lock(memory_.lrMutex_);
-
   memory_.invalidateOtherHartLr(localHartId_, addr, sizeof(val));
 
   if (memory_.pokeByte(addr, val))
@@ -415,8 +921,6 @@ template <typename URV>
 bool
 Hart<URV>::pokeMemory(size_t addr, uint16_t val)
 {
-  std::lock_guard<std::mutex> lock(memory_.lrMutex_);
-
   memory_.invalidateOtherHartLr(localHartId_, addr, sizeof(val));
 
   if (memory_.poke(addr, val))
@@ -437,8 +941,6 @@ Hart<URV>::pokeMemory(size_t addr, uint32_t val)
   // otherwise, there is no way for external driver to clear bits that
   // are read-only to this hart.
 
-  std::lock_guard<std::mutex> lock(memory_.lrMutex_);
-
   memory_.invalidateOtherHartLr(localHartId_, addr, sizeof(val));
 
   if (memory_.poke(addr, val))
@@ -455,8 +957,6 @@ template <typename URV>
 bool
 Hart<URV>::pokeMemory(size_t addr, uint64_t val)
 {
-  std::lock_guard<std::mutex> lock(memory_.lrMutex_);
-
   memory_.invalidateOtherHartLr(localHartId_, addr, sizeof(val));
 
   if (memory_.poke(addr, val))
@@ -469,6 +969,26 @@ Hart<URV>::pokeMemory(size_t addr, uint64_t val)
 }
 
 
+template <typename URV>
+bool
+Hart<URV>::pokeMemoryBlock(size_t addr, const uint8_t* data, size_t size)
+{
+  if (not memory_.pokeBlock(addr, data, size))
+    return false;
+
+  // Process in chunks whose size fits the per-store helpers.
+  const size_t chunk = size_t(1) << 30;
+  for (size_t offset = 0; offset < size; offset += chunk)
+    {
+      unsigned count = unsigned(std::min(chunk, size - offset));
+      memory_.invalidateOtherHartLr(localHartId_, addr + offset, count);
+      invalidateDecodeCache(URV(addr + offset), count);
+    }
+
+  return true;
+}
+
+
 template <typename URV>
 void
 Hart<URV>::setPendingNmi(NmiCause cause)
@@ -541,17 +1061,13 @@ Hart<URV>::putInLoadQueue(unsigned size, size_t addr, unsigned regIx,
       return;
     }
 
-  if (loadQueue_.size() >= maxLoadQueueSize_)
+  if (loadQueue_.full())
     {
       std::cerr << "At #" << instCounter_ << ": Load queue full.\n";
-      for (size_t i = 1; i < maxLoadQueueSize_; ++i)
-	loadQueue_[i-1] = loadQueue_[i];
-      loadQueue_[maxLoadQueueSize_-1] = LoadInfo(size, addr, regIx, data,
-						 isWide, instCounter_);
+      loadQueue_.pop_front();
     }
-  else
-    loadQueue_.push_back(LoadInfo(size, addr, regIx, data, isWide,
-				  instCounter_));
+  loadQueue_.push_back(LoadInfo(size, addr, regIx, data, isWide,
+				instCounter_));
 }
 
 
@@ -561,9 +1077,9 @@ Hart<URV>::invalidateInLoadQueue(unsigned regIx)
 {
   // Replace entry containing target register with x0 so that load exception
   // matching entry will not revert target register.
-  for (unsigned i = 0; i < loadQueue_.size(); ++i)
-    if (loadQueue_[i].regIx_ == regIx)
-      loadQueue_[i].makeInvalid();
+  for (uint64_t pos = loadQueue_.begin(); pos != loadQueue_.end(); ++pos)
+    if (loadQueue_.isLive(pos) and loadQueue_.at(pos).regIx_ == regIx)
+      loadQueue_.at(pos).makeInvalid();
 }
 
 
@@ -577,17 +1093,19 @@ Hart<URV>::removeFromLoadQueue(unsigned regIx)
   // Last (most recent) matching entry is removed. Subsequent entries
   // are invalidated.
   bool last = true;
-  size_t removeIx = loadQueue_.size();
-  for (size_t i = loadQueue_.size(); i > 0; --i)
+  uint64_t removePos = 0;
+  for (uint64_t pos = loadQueue_.end(); pos != loadQueue_.begin(); --pos)
     {
-      auto& entry = loadQueue_.at(i-1);
+      if (not loadQueue_.isLive(pos-1))
+        continue;
+      auto& entry = loadQueue_.at(pos-1);
       if (not entry.isValid())
         continue;
       if (entry.regIx_ == regIx)
         {
           if (last)
             {
-              removeIx = i-1;
+              removePos = pos-1;
               last = false;
             }
           else
@@ -595,8 +1113,8 @@ Hart<URV>::removeFromLoadQueue(unsigned regIx)
         }
     }
 
-  if (removeIx < loadQueue_.size())
-    loadQueue_.erase(loadQueue_.begin() + removeIx);
+  if (not last)
+    loadQueue_.remove(removePos);
 }
 
 
@@ -608,11 +1126,15 @@ Hart<URV>::execBeq(const DecodedInst* di)
   uint32_t rs1 = di->op0();
   uint32_t rs2 = di->op1();
   if (intRegs_.read(rs1) != intRegs_.read(rs2))
-    return;
+    {
+      coverBranch(false);
+      return;
+    }
   SRV offset(di->op2AsInt());
   pc_ = currPc_ + offset;
   pc_ = (pc_ >> 1) << 1;  // Clear least sig bit.
   lastBranchTaken_ = true;
+  coverBranch(true);
 }
 
 
@@ -622,10 +1144,14 @@ void
 Hart<URV>::execBne(const DecodedInst* di)
 {
   if (intRegs_.read(di->op0()) == intRegs_.read(di->op1()))
-    return;
+    {
+      coverBranch(false);
+      return;
+    }
   pc_ = currPc_ + SRV(di->op2AsInt());
   pc_ = (pc_ >> 1) << 1;  // Clear least sig bit.
   lastBranchTaken_ = true;
+  coverBranch(true);
 }
 
 
@@ -727,8 +1253,11 @@ Hart<URV>::applyLoadException(URV addr, unsigned tag, unsigned& matches)
   unsigned targetReg = 0;  // Register of 1st match.
   matches = 0;
   unsigned iMatches = 0;  // Invalid matching entries.
-  for (const LoadInfo& li : loadQueue_)
+  for (uint64_t pos = loadQueue_.begin(); pos != loadQueue_.end(); ++pos)
     {
+      if (not loadQueue_.isLive(pos))
+        continue;
+      const LoadInfo& li = loadQueue_.at(pos);
       if (matches and li.isValid() and targetReg == li.regIx_)
         hasYounger = true;
 
@@ -762,28 +1291,32 @@ Hart<URV>::applyLoadException(URV addr, unsigned tag, unsigned& matches)
   // target register (if multiple such entry, use oldest). Invalidate
   // all older entries with same target. Remove item from queue.
   // Update prev-data of 1st younger item with same target register.
-  size_t removeIx = loadQueue_.size();
-  for (size_t ix = 0; ix < loadQueue_.size(); ++ix)
+  bool remove = false;
+  uint64_t removePos = 0;
+  for (uint64_t pos = loadQueue_.begin(); pos != loadQueue_.end(); ++pos)
     {
-      auto& entry = loadQueue_.at(ix);
+      if (not loadQueue_.isLive(pos))
+        continue;
+      auto& entry = loadQueue_.at(pos);
       if (entry.tag_ == tag)
 	{
-	  removeIx = ix;
+	  remove = true;
+	  removePos = pos;
 	  if (not entry.isValid())
 	    continue;
 	}
       else
         continue;
 
-      removeIx = ix;
-
       URV prev = entry.prevData_;
 
       // Revert to oldest entry with same target reg. Invalidate older
       // entries with same target reg.
-      for (size_t ix2 = removeIx; ix2 > 0; --ix2)
+      for (uint64_t pos2 = removePos; pos2 != loadQueue_.begin(); --pos2)
         {
-          auto& entry2 = loadQueue_.at(ix2-1);
+          if (not loadQueue_.isLive(pos2-1))
+            continue;
+          auto& entry2 = loadQueue_.at(pos2-1);
           if (entry2.isValid() and entry2.regIx_ == entry.regIx_)
             {
               prev = entry2.prevData_;
@@ -803,9 +1336,11 @@ Hart<URV>::applyLoadException(URV addr, unsigned tag, unsigned& matches)
 	}
 
       // Update prev-data of 1st younger item with same target reg.
-      for (size_t ix2 = removeIx + 1; ix2 < loadQueue_.size(); ++ix2)
+      for (uint64_t pos2 = removePos + 1; pos2 != loadQueue_.end(); ++pos2)
         {
-          auto& entry2 = loadQueue_.at(ix2);
+          if (not loadQueue_.isLive(pos2))
+            continue;
+          auto& entry2 = loadQueue_.at(pos2);
            if (entry2.isValid() and entry2.regIx_ == entry.regIx_)
              {
               entry2.prevData_ = prev;
@@ -816,8 +1351,8 @@ Hart<URV>::applyLoadException(URV addr, unsigned tag, unsigned& matches)
       break;
     }
 
-  if (removeIx < loadQueue_.size())
-    loadQueue_.erase(loadQueue_.begin() + removeIx);
+  if (remove)
+    loadQueue_.remove(removePos);
 
   return true;
 }
@@ -835,15 +1370,16 @@ Hart<URV>::applyLoadFinished(URV addr, unsigned tag, unsigned& matches)
 
   // Count matching records.
   matches = 0;
-  size_t matchIx = 0;     // Index of matching entry.
-  size_t size = loadQueue_.size();
-  for (size_t i = 0; i < size; ++i)
+  uint64_t matchPos = 0;  // Position of matching entry.
+  for (uint64_t pos = loadQueue_.begin(); pos != loadQueue_.end(); ++pos)
     {
-      const LoadInfo& li = loadQueue_.at(i);
+      if (not loadQueue_.isLive(pos))
+        continue;
+      const LoadInfo& li = loadQueue_.at(pos);
       if (li.tag_ == tag)
 	{
 	  if (not matches)
-	    matchIx = i;
+	    matchPos = pos;
 	  matches++;
 	}
     }
@@ -861,35 +1397,39 @@ Hart<URV>::applyLoadFinished(URV addr, unsigned tag, unsigned& matches)
       std::cerr << " matches multiple intries in the load queue\n";
     }
 
-  LoadInfo& entry = loadQueue_.at(matchIx);
+  LoadInfo& entry = loadQueue_.at(matchPos);
 
   // Process entries in reverse order (start with oldest)
   // Mark all earlier entries with same target register as invalid.
   // Identify earliest previous value of target register.
   unsigned targetReg = entry.regIx_;
-  size_t prevIx = matchIx;
+  uint64_t prevPos = matchPos;
   uint64_t prev = entry.prevData_;  // Previous value of target reg.
-  for (size_t j = 0; j < matchIx; ++j)
+  for (uint64_t pos = loadQueue_.begin(); pos != matchPos; ++pos)
     {
-      LoadInfo& li = loadQueue_.at(j);
+      if (not loadQueue_.isLive(pos))
+        continue;
+      LoadInfo& li = loadQueue_.at(pos);
       if (not li.isValid())
         continue;
       if (li.regIx_ != targetReg)
         continue;
 
       li.makeInvalid();
-      if (j < prevIx)
+      if (pos < prevPos)
         {
-          prevIx = j;
+          prevPos = pos;
           prev = li.prevData_;
         }
     }
 
   // Update prev-data of 1st subsequent entry with same target.
   if (entry.isValid())
-    for (size_t j = matchIx + 1; j < size; ++j)
+    for (uint64_t pos = matchPos + 1; pos != loadQueue_.end(); ++pos)
       {
-	LoadInfo& li = loadQueue_.at(j);
+	if (not loadQueue_.isLive(pos))
+	  continue;
+	LoadInfo& li = loadQueue_.at(pos);
 	if (li.isValid() and li.regIx_ == targetReg)
 	  {
 	    // Preserve upper 32 bits if wide (64-bit) load.
@@ -901,19 +1441,7 @@ Hart<URV>::applyLoadFinished(URV addr, unsigned tag, unsigned& matches)
       }
 
   // Remove matching entry from queue.
-  size_t newSize = 0;
-  for (size_t i = 0; i < size; ++i)
-    {
-      auto& li = loadQueue_.at(i);
-      bool remove = i == matchIx;
-      if (remove)
-        continue;
-
-      if (newSize != i)
-        loadQueue_.at(newSize) = li;
-      newSize++;
-    }
-  loadQueue_.resize(newSize);
+  loadQueue_.remove(matchPos);
 
   return true;
 }
@@ -921,63 +1449,57 @@ Hart<URV>::applyLoadFinished(URV addr, unsigned tag, unsigned& matches)
 
 static
 void
-printUnsignedHisto(const char* tag, const std::vector<uint64_t>& histo,
+printUnsignedHisto(const char* tag, const uint64_t* histo,
                    FILE* file)
 {
-  if (histo.size() < 7)
-    return;
-
-  if (histo.at(0))
-    fprintf(file, "    %s  0          %" PRId64 "\n", tag, histo.at(0));
-  if (histo.at(1))
-    fprintf(file, "    %s  1          %" PRId64 "\n", tag, histo.at(1));
-  if (histo.at(2))
-    fprintf(file, "    %s  2          %" PRId64 "\n", tag, histo.at(2));
-  if (histo.at(3))
-    fprintf(file, "    %s  (2,   16]  %" PRId64 "\n", tag, histo.at(3));
-  if (histo.at(4))
-    fprintf(file, "    %s  (16,  1k]  %" PRId64 "\n", tag, histo.at(4));
-  if (histo.at(5))
-    fprintf(file, "    %s  (1k, 64k]  %" PRId64 "\n", tag, histo.at(5));
-  if (histo.at(6))
-    fprintf(file, "    %s  > 64k      %" PRId64 "\n", tag, histo.at(6));
+  if (histo[0])
+    fprintf(file, "    %s  0          %" PRId64 "\n", tag, histo[0]);
+  if (histo[1])
+    fprintf(file, "    %s  1          %" PRId64 "\n", tag, histo[1]);
+  if (histo[2])
+    fprintf(file, "    %s  2          %" PRId64 "\n", tag, histo[2]);
+  if (histo[3])
+    fprintf(file, "    %s  (2,   16]  %" PRId64 "\n", tag, histo[3]);
+  if (histo[4])
+    fprintf(file, "    %s  (16,  1k]  %" PRId64 "\n", tag, histo[4]);
+  if (histo[5])
+    fprintf(file, "    %s  (1k, 64k]  %" PRId64 "\n", tag, histo[5]);
+  if (histo[6])
+    fprintf(file, "    %s  > 64k      %" PRId64 "\n", tag, histo[6]);
 }
 
 
 static
 void
-printSignedHisto(const char* tag, const std::vector<uint64_t>& histo,
+printSignedHisto(const char* tag, const uint64_t* histo,
                  FILE* file)
 {
-  if (histo.size() < 13)
-    return;
-
-  if (histo.at(0))
-    fprintf(file, "    %s <= 64k      %" PRId64 "\n", tag, histo.at(0));
-  if (histo.at(1))
-    fprintf(file, "    %s (-64k, -1k] %" PRId64 "\n", tag, histo.at(1));
-  if (histo.at(2))
-    fprintf(file, "    %s (-1k,  -16] %" PRId64 "\n", tag, histo.at(2));
-  if (histo.at(3))
-    fprintf(file, "    %s (-16,   -3] %" PRId64 "\n", tag, histo.at(3));
-  if (histo.at(4))
-    fprintf(file, "    %s -2          %" PRId64 "\n", tag, histo.at(4));
-  if (histo.at(5))
-    fprintf(file, "    %s -1          %" PRId64 "\n", tag, histo.at(5));
-  if (histo.at(6))
-    fprintf(file, "    %s 0           %" PRId64 "\n", tag, histo.at(6));
-  if (histo.at(7))
-    fprintf(file, "    %s 1           %" PRId64 "\n", tag, histo.at(7));
-  if (histo.at(8))
-    fprintf(file, "    %s 2           %" PRId64 "\n", tag, histo.at(8));
-  if (histo.at(9))
-    fprintf(file, "    %s (2,     16] %" PRId64 "\n", tag, histo.at(9));
-  if (histo.at(10))
-    fprintf(file, "    %s (16,    1k] %" PRId64 "\n", tag, histo.at(10));
-  if (histo.at(11))                      
-    fprintf(file, "    %s (1k,   64k] %" PRId64 "\n", tag, histo.at(11));
-  if (histo.at(12))                      
-    fprintf(file, "    %s > 64k       %" PRId64 "\n", tag, histo.at(12));
+  if (histo[0])
+    fprintf(file, "    %s <= 64k      %" PRId64 "\n", tag, histo[0]);
+  if (histo[1])
+    fprintf(file, "    %s (-64k, -1k] %" PRId64 "\n", tag, histo[1]);
+  if (histo[2])
+    fprintf(file, "    %s (-1k,  -16] %" PRId64 "\n", tag, histo[2]);
+  if (histo[3])
+    fprintf(file, "    %s (-16,   -3] %" PRId64 "\n", tag, histo[3]);
+  if (histo[4])
+    fprintf(file, "    %s -2          %" PRId64 "\n", tag, histo[4]);
+  if (histo[5])
+    fprintf(file, "    %s -1          %" PRId64 "\n", tag, histo[5]);
+  if (histo[6])
+    fprintf(file, "    %s 0           %" PRId64 "\n", tag, histo[6]);
+  if (histo[7])
+    fprintf(file, "    %s 1           %" PRId64 "\n", tag, histo[7]);
+  if (histo[8])
+    fprintf(file, "    %s 2           %" PRId64 "\n", tag, histo[8]);
+  if (histo[9])
+    fprintf(file, "    %s (2,     16] %" PRId64 "\n", tag, histo[9]);
+  if (histo[10])
+    fprintf(file, "    %s (16,    1k] %" PRId64 "\n", tag, histo[10]);
+  if (histo[11])                      
+    fprintf(file, "    %s (1k,   64k] %" PRId64 "\n", tag, histo[11]);
+  if (histo[12])                      
+    fprintf(file, "    %s > 64k       %" PRId64 "\n", tag, histo[12]);
 }
 
 
@@ -986,22 +1508,18 @@ inline
 void
 Hart<URV>::reportInstructionFrequency(FILE* file) const
 {
-  struct CompareFreq
-  {
-    CompareFreq(const std::vector<InstProfile>& profileVec)
-      : profileVec(profileVec)
-    { }
+  typedef InstProfile IP;
 
-    bool operator()(size_t a, size_t b) const
-    { return profileVec.at(a).freq_ < profileVec.at(b).freq_; }
+  std::vector<uint64_t> freqs;
+  getInstructionFrequencies(freqs);
 
-    const std::vector<InstProfile>& profileVec;
-  };
-
-  std::vector<size_t> indices(instProfileVec_.size());
+  std::vector<size_t> indices(freqs.size());
   for (size_t i = 0; i < indices.size(); ++i)
     indices.at(i) = i;
-  std::sort(indices.begin(), indices.end(), CompareFreq(instProfileVec_));
+  std::sort(indices.begin(), indices.end(),
+	    [&freqs] (size_t a, size_t b) { return freqs[a] < freqs[b]; });
+
+  auto regCount = intRegCount();
 
   for (size_t i = 0; i < indices.size(); ++i)
     {
@@ -1009,85 +1527,536 @@ Hart<URV>::reportInstructionFrequency(FILE* file) const
       InstId id = InstId(ix);
 
       const InstEntry& entry = instTable_.getEntry(id);
-      const InstProfile& prof = instProfileVec_.at(ix);
-      uint64_t freq = prof.freq_;
+      const uint64_t* prof = instProfile_.record(id);
+      uint64_t freq = freqs.at(ix);
       if (not freq)
         continue;
 
       fprintf(file, "%s %" PRId64 "\n", entry.name().c_str(), freq);
 
-      auto regCount = intRegCount();
-
+      const uint64_t* rd = prof + IP::Rd;
       uint64_t count = 0;
-      for (auto n : prof.rd_) count += n;
+      for (unsigned i = 0; i < IP::regCount; ++i) count += rd[i];
       if (count)
         {
           fprintf(file, "  +rd");
           for (unsigned i = 0; i < regCount; ++i)
-            if (prof.rd_.at(i))
-              fprintf(file, " %d:%" PRId64, i, prof.rd_.at(i));
+            if (rd[i])
+              fprintf(file, " %d:%" PRId64, i, rd[i]);
           fprintf(file, "\n");
         }
 
+      const uint64_t* rs1 = prof + IP::Rs1;
       uint64_t count1 = 0;
-      for (auto n : prof.rs1_) count1 += n;
+      for (unsigned i = 0; i < IP::regCount; ++i) count1 += rs1[i];
       if (count1)
         {
           fprintf(file, "  +rs1");
           for (unsigned i = 0; i < regCount; ++i)
-            if (prof.rs1_.at(i))
-              fprintf(file, " %d:%" PRId64, i, prof.rs1_.at(i));
+            if (rs1[i])
+              fprintf(file, " %d:%" PRId64, i, rs1[i]);
           fprintf(file, "\n");
 
-          const auto& histo = prof.rs1Histo_;
+          const uint64_t* histo = prof + IP::Rs1Histo;
           if (entry.isUnsigned())
             printUnsignedHisto("+hist1", histo, file);
           else
             printSignedHisto("+hist1", histo, file);
         }
 
+      const uint64_t* rs2 = prof + IP::Rs2;
       uint64_t count2 = 0;
-      for (auto n : prof.rs2_) count2 += n;
+      for (unsigned i = 0; i < IP::regCount; ++i) count2 += rs2[i];
       if (count2)
         {
           fprintf(file, "  +rs2");
           for (unsigned i = 0; i < regCount; ++i)
-            if (prof.rs2_.at(i))
-              fprintf(file, " %d:%" PRId64, i, prof.rs2_.at(i));
+            if (rs2[i])
+              fprintf(file, " %d:%" PRId64, i, rs2[i]);
           fprintf(file, "\n");
 
-          const auto& histo = prof.rs2Histo_;
+          const uint64_t* histo = prof + IP::Rs2Histo;
           if (entry.isUnsigned())
             printUnsignedHisto("+hist2", histo, file);
           else
             printSignedHisto("+hist2", histo, file);
         }
 
-      if (prof.hasImm_)
+      if (prof[IP::HasImm])
         {
-          fprintf(file, "  +imm  min:%d max:%d\n", prof.minImm_, prof.maxImm_);
-          printSignedHisto("+hist ", prof.immHisto_, file);
+          fprintf(file, "  +imm  min:%d max:%d\n", int32_t(prof[IP::MinImm]),
+		  int32_t(prof[IP::MaxImm]));
+          printSignedHisto("+hist ", prof + IP::ImmHisto, file);
         }
     }
 }
 
 
 template <typename URV>
-bool
-Hart<URV>::misalignedAccessCausesException(URV addr, unsigned accessSize,
-					   SecondaryCause& secCause) const
+void
+Hart<URV>::getInstructionFrequencies(std::vector<uint64_t>& freqs) const
 {
-  size_t addr2 = addr + accessSize - 1;
+  freqs.resize(instProfile_.size());
+  for (size_t ix = 0; ix < freqs.size(); ++ix)
+    freqs.at(ix) = instProfile_.record(InstId(ix))[InstProfile::Freq];
 
-  // Crossing region boundary causes misaligned exception.
-  if (memory_.getRegionIndex(addr) != memory_.getRegionIndex(addr2))
-    {
-      secCause = SecondaryCause::STORE_MISAL_REGION_CROSS;
-      return true;
-    }
+  // Add the counts of the live blocks to block-collected counts.
+  if (blockInstFreq_)
+    for (const auto& kv : blockCache_)
+      {
+	const BasicBlock<URV>& bb = kv.second;
+	if (bb.profileCount)
+	  for (const auto& di : bb.insts)
+	    freqs.at(size_t(di.instEntry()->instId())) += bb.profileCount;
+      }
+}
 
-  // Misaligned access to a region with side effect causes misaligned
-  // exception.
+
+template <typename URV>
+void
+Hart<URV>::getStats(nlohmann::json& stats) const
+{
+  typedef InstProfile IP;
+
+  stats = nlohmann::json::object();
+  stats["hart"] = localHartId_;
+  stats["xlen"] = unsigned(8*sizeof(URV));
+  stats["instructions"] = instCounter_;
+  stats["retired"] = retiredInsts_;
+  stats["cycles"] = cycleCount_;
+  stats["exceptions"] = getExceptionCount();
+  stats["interrupts"] = getInterruptCount();
+  stats["traps"] = getTrapCount();
+  stats["runTime"] = runTime_;
+  stats["mips"] = runTime_ > 0 ? double(runInsts_) / runTime_ * 1e-6 : 0.0;
+
+  const PerfRegs& pregs = csRegs_.mPerfRegs_;
+  pregs.flush();
+  nlohmann::json counters = nlohmann::json::array();
+  for (size_t i = 0; i < pregs.eventOfCounter_.size(); ++i)
+    {
+      nlohmann::json counter;
+      counter["csr"] = "mhpmcounter" + std::to_string(i + 3);
+      counter["event"] = unsigned(pregs.eventOfCounter_.at(i));
+      counter["value"] = pregs.counters_.at(i);
+      counters.push_back(counter);
+    }
+  stats["perfCounters"] = counters;
+
+  if (not instFreq_)
+    return;
+
+  std::vector<uint64_t> freqs;
+  getInstructionFrequencies(freqs);
+
+  unsigned parts = instProfile_.parts();
+  auto regCount = intRegCount();
+
+  nlohmann::json profile = nlohmann::json::object();
+  for (size_t ix = 0; ix < freqs.size(); ++ix)
+    {
+      if (not freqs.at(ix))
+	continue;
+
+      InstId id = InstId(ix);
+      const uint64_t* prof = instProfile_.record(id);
+      nlohmann::json inst;
+      inst["count"] = freqs.at(ix);
+
+      if (parts & IP::Registers)
+	{
+	  inst["rd"] = std::vector<uint64_t>(prof + IP::Rd,
+					     prof + IP::Rd + regCount);
+	  inst["rs1"] = std::vector<uint64_t>(prof + IP::Rs1,
+					      prof + IP::Rs1 + regCount);
+	  inst["rs2"] = std::vector<uint64_t>(prof + IP::Rs2,
+					      prof + IP::Rs2 + regCount);
+	}
+
+      if (parts & IP::Values)
+	{
+	  unsigned size = instTable_.getEntry(id).isUnsigned() ? 7 : 13;
+	  inst["rs1Histo"] = std::vector<uint64_t>(prof + IP::Rs1Histo,
+						   prof + IP::Rs1Histo + size);
+	  inst["rs2Histo"] = std::vector<uint64_t>(prof + IP::Rs2Histo,
+						   prof + IP::Rs2Histo + size);
+	  if (prof[IP::HasImm])
+	    {
+	      inst["immMin"] = int64_t(prof[IP::MinImm]);
+	      inst["immMax"] = int64_t(prof[IP::MaxImm]);
+	      inst["immHisto"] = std::vector<uint64_t>(prof + IP::ImmHisto,
+						       prof + IP::ImmHisto +
+						       IP::histoSize);
+	    }
+	}
+
+      profile[instTable_.getEntry(id).name()] = inst;
+    }
+  stats["instProfile"] = profile;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::getPcProfile(std::map<URV, uint64_t>& counts) const
+{
+  for (const auto& [pc, count] : pcCounts_)
+    counts[pc] += count;
+
+  // Blocks count their executions whether or not profiling is on.
+  if (pcProfile_)
+    for (const auto& kv : blockCache_)
+      {
+	const BasicBlock<URV>& bb = kv.second;
+	if (bb.profileCount)
+	  for (const auto& di : bb.insts)
+	    counts[di.address()] += bb.profileCount;
+      }
+
+  // Drop the instructions of blocks left early that never executed.
+  for (auto iter = counts.begin(); iter != counts.end(); )
+    iter = iter->second ? std::next(iter) : counts.erase(iter);
+}
+
+
+/// Attribute instruction addresses to ELF functions caching the
+/// address range of the last function found: Consecutive addresses
+/// are mostly in the same function.
+template <typename URV>
+class FunctionFinder
+{
+public:
+
+  FunctionFinder(const Hart<URV>& hart)
+    : hart_(hart)
+  { }
+
+  /// Return the name of the function containing the given address or
+  /// "[unknown]" if no function contains it. Set offset to the offset
+  /// of the address in the function.
+  const std::string& find(URV addr, URV& offset)
+  {
+    if (addr < start_ or addr >= end_)
+      {
+	ElfSymbol sym;
+	if (hart_.findElfFunction(addr, name_, sym))
+	  {
+	    start_ = sym.addr_;
+	    end_ = sym.addr_ + sym.size_;
+	  }
+	else
+	  {
+	    name_ = "[unknown]";
+	    start_ = end_ = addr;
+	  }
+      }
+    offset = addr - start_;
+    return name_;
+  }
+
+private:
+
+  const Hart<URV>& hart_;
+  std::string name_;
+  URV start_ = 0, end_ = 0;
+};
+
+
+/// Return the name of the ELF function containing the given address
+/// or the address in hexadecimal if no function contains it.
+template <typename URV>
+static
+std::string
+functionName(const Hart<URV>& hart, URV addr)
+{
+  std::string name;
+  ElfSymbol sym;
+  if (hart.findElfFunction(addr, name, sym))
+    return name;
+  return (boost::format("0x%x") % addr).str();
+}
+
+
+/// Return the executed instruction count of each function of the
+/// given per-pc profile.
+template <typename URV>
+static
+std::map<std::string, uint64_t>
+functionProfile(const Hart<URV>& hart, const std::map<URV, uint64_t>& counts)
+{
+  std::map<std::string, uint64_t> funcCounts;
+  FunctionFinder<URV> finder(hart);
+  URV offset = 0;
+  for (const auto& [pc, count] : counts)
+    funcCounts[finder.find(pc, offset)] += count;
+  return funcCounts;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::reportPcProfile(FILE* file, unsigned topCount)
+{
+  std::map<URV, uint64_t> counts;
+  getPcProfile(counts);
+
+  uint64_t total = 0;
+  for (const auto& kv : counts)
+    total += kv.second;
+
+  fprintf(file, "# Hart %u: %" PRIu64 " executed instructions\n",
+	  localHartId_, total);
+  printPcCounts(file, counts, topCount);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::reportSamples(FILE* file, unsigned topCount)
+{
+  std::map<URV, uint64_t> counts(samplePcs_.begin(), samplePcs_.end());
+
+  uint64_t total = 0;
+  for (const auto& kv : counts)
+    total += kv.second;
+
+  fprintf(file, "# Hart %u: %" PRIu64 " samples, one per %" PRIu64
+	  " instructions on average\n", localHartId_, total, samplePeriod_);
+  printPcCounts(file, counts, topCount);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::reportSampleStacks(FILE* file)
+{
+  callProfile_.reportFolded(file, [this] (uint64_t addr) {
+			      return functionName(*this, URV(addr)); }, true);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::enableSampling(uint64_t period, bool stacks)
+{
+  samplePeriod_ = period;
+  samplePcs_.clear();
+  sampleStacks_ = period and stacks;
+  if (sampleStacks_ and not callGraph_)
+    enableCallProfile(true);
+  nextSample_ = period ? instCounter_ + period : ~uint64_t(0);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::takeSample(uint64_t count)
+{
+  ++samplePcs_[pc_];
+  if (sampleStacks_)
+    callProfile_.sample();
+
+  // Next sample in [period/2, 3*period/2) instructions (xorshift
+  // pseudo-random numbers).
+  sampleRand_ ^= sampleRand_ << 13;
+  sampleRand_ ^= sampleRand_ >> 7;
+  sampleRand_ ^= sampleRand_ << 17;
+  uint64_t interval = samplePeriod_ / 2 + sampleRand_ % samplePeriod_;
+  nextSample_ = count + std::max(interval, uint64_t(1));
+}
+
+
+template <typename URV>
+void
+Hart<URV>::printPcCounts(FILE* file, const std::map<URV, uint64_t>& counts,
+			 unsigned topCount)
+{
+  uint64_t total = 0;
+  for (const auto& kv : counts)
+    total += kv.second;
+  double scale = total ? 100.0 / double(total) : 0;
+
+  auto funcCounts = functionProfile(*this, counts);
+  std::vector<std::pair<std::string, uint64_t>> funcs(funcCounts.begin(),
+						       funcCounts.end());
+  std::stable_sort(funcs.begin(), funcs.end(),
+		   [] (const auto& a, const auto& b) {
+		     return a.second > b.second; });
+
+  fprintf(file, "\n# Functions\n#%15s %8s  %s\n", "count", "percent",
+	  "function");
+  for (const auto& [name, count] : funcs)
+    fprintf(file, "%16" PRIu64 " %7.2f%%  %s\n", count, double(count)*scale,
+	    name.c_str());
+
+  std::vector<std::pair<URV, uint64_t>> pcs(counts.begin(), counts.end());
+  std::stable_sort(pcs.begin(), pcs.end(),
+		   [] (const auto& a, const auto& b) {
+		     return a.second > b.second; });
+  if (pcs.size() > topCount)
+    pcs.resize(topCount);
+
+  fprintf(file, "\n# Hottest instructions\n#%15s %8s  %-18s %-24s %s\n",
+	  "count", "percent", "address", "function+offset", "instruction");
+
+  FunctionFinder<URV> finder(*this);
+  std::string text;
+  for (const auto& [pc, count] : pcs)
+    {
+      URV offset = 0;
+      std::string where = finder.find(pc, offset);
+      if (offset)
+	where += (boost::format("+0x%x") % offset).str();
+
+      uint32_t inst = 0;
+      text.clear();
+      if (readInst(pc, inst))
+	disassembleInst(inst, text);
+
+      fprintf(file, "%16" PRIu64 " %7.2f%%  0x%-16" PRIx64 " %-24s %s\n",
+	      count, double(count)*scale, uint64_t(pc), where.c_str(),
+	      text.c_str());
+    }
+}
+
+
+template <typename URV>
+void
+Hart<URV>::reportCallProfile(FILE* file)
+{
+  callProfile_.sync(retiredInsts_, cycleCount_);
+  fprintf(file, "# Hart %u\n", localHartId_);
+  callProfile_.reportFunctions(file, [this] (uint64_t addr) {
+				 return functionName(*this, URV(addr)); });
+}
+
+
+template <typename URV>
+void
+Hart<URV>::reportCallProfileFolded(FILE* file)
+{
+  callProfile_.sync(retiredInsts_, cycleCount_);
+  callProfile_.reportFolded(file, [this] (uint64_t addr) {
+			      return functionName(*this, URV(addr)); });
+}
+
+
+template <typename URV>
+void
+Hart<URV>::reportPcProfileFolded(FILE* file) const
+{
+  std::map<URV, uint64_t> counts;
+  getPcProfile(counts);
+
+  for (const auto& [name, count] : functionProfile(*this, counts))
+    fprintf(file, "%s %" PRIu64 "\n", name.c_str(), count);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::reportCoverage(FILE* file, const Coverage& coverage)
+{
+  /// Coverage counts of a function.
+  struct Counts
+  {
+    uint64_t insts = 0, executed = 0, branches = 0, taken = 0, notTaken = 0;
+
+    void add(const Counts& other)
+    {
+      insts += other.insts; executed += other.executed;
+      branches += other.branches; taken += other.taken;
+      notTaken += other.notTaken;
+    }
+  };
+
+  auto percent = [] (uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * double(part) / double(whole) : 0.0;
+  };
+
+  auto print = [file, &percent] (const std::string& name, const Counts& c) {
+    fprintf(file, "%-32s %8" PRIu64 " %8" PRIu64 " %6.1f%% %8" PRIu64
+	    " %8" PRIu64 " %8" PRIu64 " %6.1f%%\n", name.c_str(), c.insts,
+	    c.executed, percent(c.executed, c.insts), c.branches, c.taken,
+	    c.notTaken, percent(c.taken + c.notTaken, 2*c.branches));
+  };
+
+  // Functions of the code segments (other sized symbols are data).
+  const auto& segments = memory_.elfCodeSegments();
+  auto isCode = [&segments] (uint64_t addr) {
+    for (const auto& seg : segments)
+      if (addr >= seg.first and addr - seg.first < seg.second)
+	return true;
+    return false;
+  };
+
+  std::vector<std::pair<std::string, ElfSymbol>> funcs;
+  getElfFunctions(funcs);
+
+  fprintf(file, "# %" PRIu64 " executed instruction addresses\n",
+	  coverage.executedCount());
+  fprintf(file, "%-32s %8s %8s %7s %8s %8s %8s %7s\n", "# function", "insts",
+	  "executed", "", "branches", "taken", "nottaken", "");
+
+  Counts total;
+  DecodedInst di;
+  for (const auto& [name, sym] : funcs)
+    {
+      if (not isCode(sym.addr_))
+	continue;
+
+      Counts counts;
+      uint64_t end = sym.addr_ + sym.size_;
+      for (uint64_t addr = sym.addr_; addr < end; addr += di.instSize())
+	{
+	  uint16_t low = 0, high = 0;
+	  if (not peekMemory(addr, low))
+	    break;
+	  uint32_t inst = low;
+	  if ((low & 3) == 3)
+	    {
+	      if (not peekMemory(addr + 2, high))
+		break;
+	      inst |= uint32_t(high) << 16;
+	    }
+	  decode(URV(addr), inst, di);
+
+	  ++counts.insts;
+	  counts.executed += coverage.isExecuted(addr);
+	  if (di.instEntry()->isConditionalBranch())
+	    {
+	      bool taken = false, notTaken = false;
+	      coverage.branchOutcomes(addr, taken, notTaken);
+	      ++counts.branches;
+	      counts.taken += taken;
+	      counts.notTaken += notTaken;
+	    }
+	}
+
+      print(name, counts);
+      total.add(counts);
+    }
+
+  print("# total", total);
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::misalignedAccessCausesException(URV addr, unsigned accessSize,
+					   SecondaryCause& secCause) const
+{
+  size_t addr2 = addr + accessSize - 1;
+
+  // Crossing region boundary causes misaligned exception.
+  if (memory_.getRegionIndex(addr) != memory_.getRegionIndex(addr2))
+    {
+      secCause = SecondaryCause::STORE_MISAL_REGION_CROSS;
+      return true;
+    }
+
+  // Misaligned access to a region with side effect causes misaligned
+  // exception.
   if (not isIdempotentRegion(addr) or not isIdempotentRegion(addr2))
     {
       secCause = SecondaryCause::STORE_MISAL_IO;
@@ -1133,29 +2102,6 @@ Hart<URV>::effectiveAndBaseAddrMismatch(URV base, URV addr)
 }
 
 
-template <typename URV>
-bool
-Hart<URV>::checkStackLoad(URV addr, unsigned loadSize)
-{
-  URV low = addr;
-  URV high = addr + loadSize - 1;
-  URV spVal = intRegs_.read(RegSp);
-  bool ok = (high <= stackMax_ and low > spVal);
-  return ok;
-}
-
-
-template <typename URV>
-bool
-Hart<URV>::checkStackStore(URV addr, unsigned storeSize)
-{
-  URV low = addr;
-  URV high = addr + storeSize - 1;
-  bool ok = (high <= stackMax_ and low > stackMin_);
-  return ok;
-}
-
-
 template <typename URV>
 bool
 Hart<URV>::wideLoad(uint32_t rd, URV addr, unsigned ldSize)
@@ -1200,27 +2146,141 @@ Hart<URV>::wideLoad(uint32_t rd, URV addr, unsigned ldSize)
 
 #include <emscripten.h>
 
-EM_JS(int, jsReadMMIO, (int addr, int size), {
-	var value = mmio.load(addr, size);
-  return value;
-});
+// The JS devices (mmio, intController) live on the main browser
+// thread. In the build with threads (make PTHREADS=1) the harts run on
+// Web Workers and these calls are proxied (synchronously) to the main
+// thread; otherwise they are direct calls.
 
-EM_JS(int, jsExternalInterrupt, (), {
-	var value = intController.interrupt;
-  return value;
+static int
+jsReadMMIO(int addr, int size)
+{
+  return MAIN_THREAD_EM_ASM_INT({ return mmio.load($0, $1); }, addr, size);
+}
+
+static int
+jsExternalInterrupt()
+{
+  return MAIN_THREAD_EM_ASM_INT({ return intController.interrupt; });
+}
+
+static int
+jsInterruptEnabled()
+{
+  return MAIN_THREAD_EM_ASM_INT({ return intController.interruptEnabled; });
+}
+
+// Give the interrupt controller the heap address of the interrupt
+// pending flag of a hart: The controller sets the byte at that
+// address to 1 whenever the state of its interrupt lines changes (the
+// heap is a SharedArrayBuffer in the build with threads: the flag is
+// seen by the worker of the hart). Return 0 if the controller does
+// not support this in which case interrupts are polled before each
+// instruction.
+static int
+jsWatchInterruptFlag(int addr)
+{
+  return MAIN_THREAD_EM_ASM_INT({
+      if (typeof intController.watchPendingFlag !== 'function')
+        return 0;
+      intController.watchPendingFlag($0);
+      return 1;
+    }, addr);
+}
+
+static void
+jsWriteMMIO(int addr, int size, int value)
+{
+  MAIN_THREAD_EM_ASM({ mmio.store($0, $1, $2); }, addr, size, value);
+}
+
+// Instantiate the given wasm module (sharing the heap of this module)
+// and place its "run" function in the function table at the given
+// slot (a new slot if zero). Return the table index or 0 on failure.
+// Requires linking with -s ALLOW_TABLE_GROWTH=1. Runs on the thread
+// of the hart: each thread has its own function table.
+EM_JS(int, jsCompileWasmBlock, (const uint8_t* bytes, int size, int slot), {
+  try {
+    var code = HEAPU8.slice(bytes, bytes + size);
+    var inst = new WebAssembly.Instance(new WebAssembly.Module(code),
+                                        { env: { memory: wasmMemory } });
+    if (slot == 0) {
+      slot = wasmTable.length;
+      wasmTable.grow(1);
+    }
+    wasmTable.set(slot, inst.exports.run);
+    return slot;
+  } catch (e) {
+    return 0;
+  }
 });
 
-EM_JS(int, jsInterruptEnabled, (), {
-	var value = intController.interruptEnabled;
+// Give the MMIO devices the heap addresses of the MMIO window of a
+// hart (covering the simulated addresses [base, base + size)) and of
+// its side-effect map (one bit per 4-byte word of the window). Devices
+// read/write the registers without side effects directly in the
+// window and set the map bits of the registers that require a
+// mmio.load/mmio.store callback. Return 0 if the devices do not
+// support the window: every access then goes to the callbacks.
+static int
+jsMmioWindow(int window, int base, int size, int sideEffectMap)
+{
+  return MAIN_THREAD_EM_ASM_INT({
+      if (typeof mmio.setWindow !== 'function')
+        return 0;
+      mmio.setWindow($0, $1, $2, $3);
+      return 1;
+    }, window, base, size, sideEffectMap);
+}
+
+#endif
+
+
+template <typename URV>
+template <typename F>
+int64_t
+Hart<URV>::loggedInput(InputLog::Kind kind, F read)
+{
+  if (not inputLog_)
+    return read();
+
+  if (inputLog_->isReplaying())
+    {
+      const auto* rec = inputLog_->replay(localHartId_, kind, retiredInsts_);
+      return rec ? int64_t(rec->value) : read();
+    }
+
+  int64_t value = read();
+  inputLog_->record(localHartId_, kind, retiredInsts_, uint64_t(value));
   return value;
-});
+}
 
-EM_JS(void, jsWriteMMIO, (int addr, int size, int value), {
-	mmio.store(addr, size, value);
-});
 
+template <typename URV>
+bool
+Hart<URV>::configMmioWindow(URV base, URV size)
+{
+  if (size == 0 or (size & 3) != 0 or base + size < base)
+    {
+      std::cerr << "Error: Invalid MMIO window: address 0x" << std::hex
+		<< base << " size 0x" << size << std::dec << '\n';
+      return false;
+    }
+
+  mmioBase_ = base;
+  mmioSize_ = size;
+  mmioWindow_.assign(size, 0);
+
+  // Until the devices register them, all the words have side effects.
+  mmioSideEffect_.assign((size/4 + 63) / 64, ~uint64_t(0));
+
+#ifdef __EMSCRIPTEN__
+  jsMmioWindow(int(uintptr_t(mmioWindow_.data())), int(base), int(size),
+	       int(uintptr_t(mmioSideEffect_.data())));
 #endif
 
+  return true;
+}
+
 
 template <typename URV>
 ExceptionCause
@@ -1228,6 +2288,7 @@ Hart<URV>::determineLoadException(unsigned rs1, URV base, URV addr,
 				  unsigned ldSize,
 				  SecondaryCause& secCause)
 {
+  SELF_PROFILE_PHASE(MemCheck);
   secCause = SecondaryCause::NONE;
 
   // Misaligned load from io section triggers an exception. Crossing
@@ -1242,7 +2303,8 @@ Hart<URV>::determineLoadException(unsigned rs1, URV base, URV addr,
     }
 
   // Stack access
-  if (rs1 == RegSp and checkStackAccess_ and not checkStackLoad(addr, ldSize))
+  if (rs1 == RegSp and checkStackAccess_ and
+      not checkStackLoad(base, addr, ldSize))
     {
       secCause = SecondaryCause::LOAD_ACC_STACK_CHECK;
       return ExceptionCause::LOAD_ACC_FAULT;
@@ -1350,7 +2412,8 @@ Hart<URV>::load(uint32_t rd, uint32_t rs1, int32_t imm)
       // from standard input.
       if (conIoValid_ and addr == conIo_)
         {
-          int c = fgetc(stdin);
+          int c = int(loggedInput(InputLog::Kind::ConsoleIn,
+				  [] { return fgetc(stdin); }));
           SRV val = c;
           intRegs_.write(rd, val);
           return true;
@@ -1358,21 +2421,56 @@ Hart<URV>::load(uint32_t rd, uint32_t rs1, int32_t imm)
     }
   
 #ifdef __EMSCRIPTEN__
-  // MMIO for javascript
-  if(addr > 0xffff0000){
+  // MMIO for javascript: Registers without side effects are read from
+  // the MMIO window.
+  if(addr - mmioBase_ < mmioSize_){
     if (privMode_ == PrivilegeMode::User){
       initiateLoadException(ExceptionCause::LOAD_ACC_FAULT, addr, SecondaryCause::NONE);
       return false;
     }
-    int c = jsReadMMIO((int) addr, sizeof(LOAD_TYPE));
-    SRV val = c;
-    intRegs_.write(rd, val);
+    URV offset = addr - mmioBase_;
+    if (isMmioSideEffect(offset, sizeof(LOAD_TYPE))) {
+      int c = int(loggedInput(InputLog::Kind::Mmio, [addr] {
+			return jsReadMMIO((int) addr, sizeof(LOAD_TYPE)); }));
+      SRV val = c;
+      intRegs_.write(rd, val);
+      return true;
+    }
+    ULT uval = 0;
+    memcpy(&uval, mmioWindow_.data() + offset, sizeof(uval));
+    URV value;
+    if constexpr (std::is_same<ULT, LOAD_TYPE>::value)
+      value = uval;
+    else
+      value = SRV(LOAD_TYPE(uval)); // Sign extend.
+    intRegs_.write(rd, value);
     return true;
   }
 #endif
 
   unsigned ldSize = sizeof(LOAD_TYPE);
 
+  // Fast path: Aligned load from a plain memory page (within the
+  // stack window if checked).
+  if ((addr & (ldSize - 1)) == 0 and tlbHit(readTlb_, addr) and
+      isPlainAccess() and (rs1 != RegSp or not checkStackAccess_ or
+			   checkStackLoad(base, addr, ldSize)))
+    {
+      misalignedLdSt_ = false;
+      ULT uval = memory_.readUnchecked<ULT>(addr);
+      URV value;
+      if constexpr (std::is_same<ULT, LOAD_TYPE>::value)
+        value = uval;
+      else
+        value = SRV(LOAD_TYPE(uval)); // Sign extend.
+
+      if (loadQueueEnabled_)
+        putInLoadQueue(ldSize, addr, rd, peekIntReg(rd));
+
+      intRegs_.write(rd, value);
+      return true;
+    }
+
   auto secCause = SecondaryCause::NONE;
   auto cause = determineLoadException(rs1, base, addr, ldSize, secCause);
   if (cause != ExceptionCause::NONE)
@@ -1386,6 +2484,19 @@ Hart<URV>::load(uint32_t rd, uint32_t rs1, int32_t imm)
   if (wideLdSt_)
     return wideLoad(rd, addr, ldSize);
 
+  // Clint registers (never in the software TLB).
+  if (clint_ and clint_->contains(addr))
+    {
+      uint64_t val = 0;
+      if (not clint_->read(addr, ldSize, cycleCount_, val))
+	{
+	  initiateLoadException(ExceptionCause::LOAD_ACC_FAULT, addr, secCause);
+	  return false;
+	}
+      intRegs_.write(rd, SRV(LOAD_TYPE(val)));
+      return true;
+    }
+
   ULT uval = 0;
   if (memory_.read(addr, uval))
     {
@@ -1400,6 +2511,8 @@ Hart<URV>::load(uint32_t rd, uint32_t rs1, int32_t imm)
         putInLoadQueue(ldSize, addr, rd, peekIntReg(rd));
 
       intRegs_.write(rd, value);
+      tlbFill(readTlb_, addr);
+      checkWatch(addr, ldSize, false);
       return true;  // Success.
     }
 
@@ -1650,6 +2763,8 @@ inline
 bool
 Hart<URV>::fetchInst(URV addr, uint32_t& inst)
 {
+  SELF_PROFILE_PHASE(Fetch);
+
   if (forceFetchFail_)
     {
       forceFetchFail_ = false;
@@ -1724,9 +2839,42 @@ Hart<URV>::fetchInstPostTrigger(URV addr, uint32_t& inst, FILE* traceFile)
 }
 
 static std::mutex printInstTraceMutex;
-// This is set to false when user hits control-c to interrupt a long
-// run.
-static std::atomic<bool> userOk = true;
+// This is set to false to end the run of the hart executing in the
+// current thread (e.g. target program stopped when exceptions are
+// disabled). It is thread local so that independent simulations
+// running on different threads do not stop each other.
+static thread_local bool userOk = true;
+
+// Incremented when user hits control-c to interrupt a long run. A run
+// stops if this differs from its value at the start of the run: This
+// interrupts the runs of all the threads.
+static std::atomic<unsigned> kbdInterrupts = 0;
+static thread_local unsigned kbdInterruptsAtStart = 0;
+
+/// Return true if the run in the current thread should go on.
+static inline bool
+runOk()
+{
+  return userOk and kbdInterrupts == kbdInterruptsAtStart;
+}
+
+
+/// FP instructions leave the host rounding mode at the mode they
+/// used: Restore the default host mode at the end of a run.
+static inline void
+restoreHostRoundingMode()
+{
+  if (std::fegetround() != FE_TONEAREST)
+    std::fesetround(FE_TONEAREST);
+}
+
+
+template <typename URV>
+unsigned
+Hart<URV>::keyboardInterruptCount()
+{
+  return kbdInterrupts;
+}
 
 template <typename URV>
 void
@@ -1743,19 +2891,8 @@ Hart<URV>::illegalInst()
 
   if (consecutiveIllegalCount_ > 64)  // FIX: Make a parameter
     {
-#ifndef DISABLE_EXCEPTIONS
-      throw CoreException(CoreException::Stop,
-                          "64 consecutive illegal instructions",
-                          0, 0);
-#else
-    std::lock_guard<std::mutex> guard(printInstTraceMutex);
-    ++retiredInsts_;
-    std::cerr << ("Error: Failed ")
-        << "stop: " << "64 consecutive illegal instructions" << ": " << 0 << '\n';
-    setTargetProgramFinished(true);
-    userOk = false;
-    return;
-#endif
+      requestStop(CoreException::Stop, "64 consecutive illegal instructions");
+      return;
     }
 
   counterAtLastIllegal_ = retiredInsts_;
@@ -1829,9 +2966,9 @@ Hart<URV>::initiateFastInterrupt(InterruptCause cause, URV pcToSave)
 
   PerfRegs& pregs = csRegs_.mPerfRegs_;
   if (cause == InterruptCause::M_EXTERNAL)
-    pregs.updateCounters(EventNumber::ExternalInterrupt);
+    pregs.countEvent(EventNumber::ExternalInterrupt);
   else if (cause == InterruptCause::M_TIMER)
-    pregs.updateCounters(EventNumber::TimerInterrupt);
+    pregs.countEvent(EventNumber::TimerInterrupt);
 }
 
 
@@ -1859,9 +2996,9 @@ Hart<URV>::initiateInterrupt(InterruptCause cause, URV pc)
 
   PerfRegs& pregs = csRegs_.mPerfRegs_;
   if (cause == InterruptCause::M_EXTERNAL)
-    pregs.updateCounters(EventNumber::ExternalInterrupt);
+    pregs.countEvent(EventNumber::ExternalInterrupt);
   else if (cause == InterruptCause::M_TIMER)
-    pregs.updateCounters(EventNumber::TimerInterrupt);
+    pregs.countEvent(EventNumber::TimerInterrupt);
 }
 
 
@@ -1878,7 +3015,7 @@ Hart<URV>::initiateException(ExceptionCause cause, URV pc, URV info,
 
   PerfRegs& pregs = csRegs_.mPerfRegs_;
   if (enableCounters_ and countersCsrOn_)
-    pregs.updateCounters(EventNumber::Exception);
+    pregs.countEvent(EventNumber::Exception);
 }
 
 
@@ -1887,6 +3024,19 @@ void
 Hart<URV>::initiateTrap(bool interrupt, URV cause, URV pcToSave, URV info,
 			URV secCause)
 {
+  if (not observers_.empty())
+    {
+      ObserverEvent event;
+      event.kind = ObserverEvent::Kind::Trap;
+      event.tag = instCounter_;
+      event.pc = pcToSave;
+      event.address = cause;
+      if (interrupt)
+	event.address |= uint64_t(1) << 63;
+      event.value = info;
+      observerEvents_.push_back(event);
+    }
+
   enableWideLdStMode(false);  // Swerv specific feature.
 
   memory_.invalidateLr(localHartId_);
@@ -2209,6 +3359,7 @@ Hart<URV>::pokeCsr(CsrNumber csr, URV val)
   // sure modifiable value are changed.
   if (not csRegs_.poke(csr, val))
     return false;
+  interruptEnablesChanged();
 
   if (csr == CsrNumber::DCSR)
     {
@@ -2434,18 +3585,295 @@ void
 Hart<URV>::printInstTrace(const DecodedInst& di, uint64_t tag, std::string& tmp,
 			  FILE* out, bool interrupt)
 {
+  if (traceWriter_)
+    {
+      // Formatting and output are done by the writer thread.
+      TraceRecord& rec = traceWriter_->reserve(localHartId_);
+      collectTraceRecord(di, tag, interrupt, rec);
+      traceWriter_->commit(localHartId_);
+      return;
+    }
+
   // Serialize to avoid jumbled output.
   std::lock_guard<std::mutex> guard(printInstTraceMutex);
 
-  disassembleInst(di, tmp);
-  if (interrupt)
+  collectTraceRecord(di, tag, interrupt, traceRec_);
+
+  if (binaryTrace_)
+    {
+      binTraceBuf_.clear();
+      BinaryTrace::encode(traceRec_, binTraceState_, binTraceBuf_);
+      fwrite(binTraceBuf_.data(), binTraceBuf_.size(), 1, out);
+      return;
+    }
+
+  formatTraceRecord(di, traceRec_, tmp, out);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::printTraceRecord(const TraceRecord& rec, std::string& tmp, FILE* out)
+{
+  DecodedInst di;
+  decode(URV(rec.decodePc), rec.inst, di);
+  formatTraceRecord(di, rec, tmp, out);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::traceInst(uint32_t inst, uint64_t tag, std::string& tmp, FILE* out)
+{
+  SELF_PROFILE_PHASE(Trace);
+  DecodedInst di;
+  decode(pc_, inst, di);
+  traceInst(di, tag, tmp, out);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::enableFlightRecorder(unsigned count, const std::string& path)
+{
+  flightRing_.assign(count, FlightRecord());
+  flightNext_ = 0;
+  flightCount_ = 0;
+  flightPath_ = path;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::flightRecord(const DecodedInst& di, uint64_t tag)
+{
+  FlightRecord& rec = flightRing_[flightNext_];
+  if (++flightNext_ == flightRing_.size())
+    flightNext_ = 0;
+  ++flightCount_;
+
+  rec.tag = tag;
+  rec.pc = currPc_;
+  rec.inst = di.inst();
+
+  int reg = intRegs_.getLastWrittenReg();
+  int fpReg = fpRegs_.getLastWrittenReg();
+  rec.hasReg = reg > 0 or fpReg >= 0;
+  rec.fpReg = reg <= 0 and fpReg >= 0;
+  rec.reg = uint8_t(rec.fpReg ? fpReg : reg);
+  if (reg > 0)
+    rec.value = intRegs_.read(reg);
+  else if (fpReg >= 0)
+    rec.value = fpRegs_.readBitsRaw(fpReg);
+
+  size_t addr = 0;
+  uint64_t value = 0;
+  rec.isStore = memory_.getLastWriteNewValue(localHartId_, addr, value) > 0;
+  rec.isLoad = not rec.isStore and loadAddrValid_;
+  rec.memAddr = rec.isStore ? addr : loadAddr_;
+  rec.memValue = value;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::observeInst(const DecodedInst& di, uint64_t tag)
+{
+  ObserverEvent event;
+  event.tag = tag;
+  event.pc = currPc_;
+  event.inst = di.inst();
+
+  // The trap event of an instruction that took an exception was
+  // added by initiateTrap.
+  if (not hasException_)
+    {
+      event.kind = ObserverEvent::Kind::Retire;
+      observerEvents_.push_back(event);
+
+      const InstEntry* entry = di.instEntry();
+      size_t addr = 0;
+      uint64_t value = 0;
+      unsigned size = memory_.getLastWriteNewValue(localHartId_, addr, value);
+      if (loadAddrValid_ and entry->isLoad())
+	{
+	  event.kind = ObserverEvent::Kind::Load;
+	  event.address = loadAddr_;
+	  event.size = entry->loadSize();
+	  if (entry->ithOperandType(0) == OperandType::FpReg)
+	    event.value = fpRegs_.readBitsRaw(di.op0());
+	  else
+	    event.value = intRegs_.read(di.op0());
+	  observerEvents_.push_back(event);
+	}
+      if (size)
+	{
+	  event.kind = ObserverEvent::Kind::Store;
+	  event.address = addr;
+	  event.size = size;
+	  event.value = value;
+	  observerEvents_.push_back(event);
+	}
+    }
+
+  event.kind = ObserverEvent::Kind::CsrWrite;
+  event.size = 0;
+  for (CsrNumber csr : csRegs_.lastWrittenRegs())
+    {
+      URV value = 0;
+      peekCsr(csr, value);
+      event.address = unsigned(csr);
+      event.value = value;
+      observerEvents_.push_back(event);
+    }
+
+  constexpr size_t maxBatch = 1024;
+  if (pc_ != currPc_ + di.instSize() or observerEvents_.size() >= maxBatch)
+    flushObserverEvents();
+}
+
+
+template <typename URV>
+void
+Hart<URV>::flushObserverEvents()
+{
+  if (observerEvents_.empty())
+    return;
+  for (Observer* observer : observers_)
+    observer->events(localHartId_, observerEvents_.data(),
+		     observerEvents_.size());
+  observerEvents_.clear();
+}
+
+
+/// Serialize flight recorder dumps of different harts.
+static std::mutex flightDumpMutex;
+
+
+template <typename URV>
+void
+Hart<URV>::dumpFlightRecorder(const char* reason, FILE* out)
+{
+  if (flightRing_.empty())
+    return;
+
+  std::lock_guard<std::mutex> guard(flightDumpMutex);
+
+  FILE* file = out;
+  if (not file)
+    file = flightPath_.empty() ? stderr : fopen(flightPath_.c_str(), "a");
+  if (not file)
+    {
+      std::cerr << "Failed to open flight recorder file " << flightPath_
+		<< '\n';
+      return;
+    }
+
+  uint64_t count = std::min(flightCount_, uint64_t(flightRing_.size()));
+  fprintf(file, "# Flight recorder of hart %u: last %" PRIu64
+	  " instructions (%s)\n", localHartId_, count, reason);
+
+  size_t ix = count < flightRing_.size() ? 0 : flightNext_;
+  TraceRecord rec;
+  std::string tmp;
+  for (uint64_t i = 0; i < count; ++i)
+    {
+      const FlightRecord& fr = flightRing_.at(ix);
+      if (++ix == flightRing_.size())
+	ix = 0;
+
+      rec.tag = fr.tag;
+      rec.hartId = localHartId_;
+      rec.pc = rec.decodePc = fr.pc;
+      rec.inst = fr.inst;
+      rec.intReg = fr.hasReg and not fr.fpReg ? fr.reg : 0;
+      rec.intValue = fr.value;
+      rec.fpReg = fr.hasReg and fr.fpReg ? fr.reg : -1;
+      rec.fpValue = fr.value;
+      rec.hasLoadAddr = fr.isLoad;
+      rec.loadAddr = fr.memAddr;
+      rec.hasMem = fr.isStore;
+      rec.memAddr = fr.memAddr;
+      rec.memValue = fr.memValue;
+      printTraceRecord(rec, tmp, file);
+    }
+
+  if (file != out and file != stderr)
+    fclose(file);
+  else
+    fflush(file);
+}
+
+
+/// Serialize the branch trace events of harts sharing a file.
+static std::mutex branchTraceMutex;
+
+
+template <typename URV>
+void
+Hart<URV>::flushBranchTrace()
+{
+  if (branchBuf_.empty())
+    return;
+
+  std::lock_guard<std::mutex> guard(branchTraceMutex);
+  if (branchFile_)
+    fwrite(branchBuf_.data(), branchBuf_.size(), 1, branchFile_);
+  branchBuf_.clear();
+}
+
+
+template <typename URV>
+void
+Hart<URV>::collectTraceRecord(const DecodedInst& di, uint64_t tag,
+			      bool interrupt, TraceRecord& rec)
+{
+  rec.tag = tag;
+  rec.hartId = localHartId_;
+  rec.pc = currPc_;
+  rec.decodePc = di.address();
+  rec.inst = di.inst();
+  rec.interrupt = interrupt;
+  rec.hasLoadAddr = traceLoad_ and loadAddrValid_;
+  rec.loadAddr = loadAddr_;
+
+  // Integer register diff.
+  int reg = intRegs_.getLastWrittenReg();
+  rec.intReg = reg > 0 ? reg : 0;
+  rec.intValue = reg > 0 ? intRegs_.read(reg) : 0;
+
+  // Floating point register diff.
+  rec.fpReg = fpRegs_.getLastWrittenReg();
+  rec.fpValue = rec.fpReg >= 0 ? fpRegs_.readBitsRaw(rec.fpReg) : 0;
+
+  // CSR and trigger register diffs.
+  lastCsrValues(rec.csrs, false);
+
+  // Memory diff.
+  size_t address = 0;
+  uint64_t memValue = 0;
+  unsigned writeSize = memory_.getLastWriteNewValue(localHartId_, address, memValue);
+  rec.hasMem = writeSize > 0;
+  rec.memAddr = address;
+  rec.memValue = memValue;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::formatTraceRecord(const DecodedInst& di, const TraceRecord& rec,
+			     std::string& tmp, FILE* out)
+{
+  tmp = cachedDisassembly(di);
+  if (rec.interrupt)
     tmp += " (interrupted)";
 
-  if (traceLoad_ and loadAddrValid_)
+  if (rec.hasLoadAddr)
     {
-      std::ostringstream oss;
-      oss << "0x" << std::hex << loadAddr_;
-      tmp += " [" + oss.str() + "]";
+      char addrBuff[32];
+      snprintf(addrBuff, sizeof(addrBuff), " [0x%" PRIx64 "]",
+	       uint64_t(URV(rec.loadAddr)));
+      tmp += addrBuff;
     }
 
   char instBuff[128];
@@ -2454,96 +3882,44 @@ Hart<URV>::printInstTrace(const DecodedInst& di, uint64_t tag, std::string& tmp,
   else
     sprintf(instBuff, "%04x", di.inst() & 0xffff);
 
+  unsigned hartId = rec.hartId;
+  URV pc = rec.pc;
   bool pending = false;  // True if a printed line need to be terminated.
 
   // Process integer register diff.
-  int reg = intRegs_.getLastWrittenReg();
-  URV value = 0;
-  if (reg > 0)
+  if (rec.intReg > 0)
     {
-      value = intRegs_.read(reg);
-      formatInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, 'r', reg,
-			   value, tmp.c_str());
+      formatInstTrace<URV>(out, rec.tag, hartId, pc, instBuff, 'r', rec.intReg,
+			   URV(rec.intValue), tmp.c_str());
       pending = true;
     }
 
   // Process floating point register diff.
-  int fpReg = fpRegs_.getLastWrittenReg();
-  if (fpReg >= 0)
+  if (rec.fpReg >= 0)
     {
-      uint64_t val = fpRegs_.readBitsRaw(fpReg);
       if (pending) fprintf(out, "  +\n");
-      formatFpInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, fpReg,
-			     val, tmp.c_str());
+      formatFpInstTrace<URV>(out, rec.tag, hartId, pc, instBuff, rec.fpReg,
+			     rec.fpValue, tmp.c_str());
       pending = true;
     }
 
   // Process CSR diffs.
-  std::vector<CsrNumber> csrs;
-  std::vector<unsigned> triggers;
-  csRegs_.getLastWrittenRegs(csrs, triggers);
-
-  std::vector<bool> tdataChanged(3);
-
-  std::map<URV, URV> csrMap; // Map csr-number to its value.
-
-  for (CsrNumber csr : csrs)
-    {
-      bool debugMode = false;
-      if (not csRegs_.read(csr, PrivilegeMode::Machine, debugMode, value))
-	continue;
-
-      if (csr >= CsrNumber::TDATA1 and csr <= CsrNumber::TDATA3)
-        {
-          size_t ix = size_t(csr) - size_t(CsrNumber::TDATA1);
-          tdataChanged.at(ix) = true;
-          continue; // Debug triggers printed separately below
-        }
-      csrMap[URV(csr)] = value;
-    }
-
-  // Process trigger register diffs.
-  for (unsigned trigger : triggers)
-    {
-      URV data1(0), data2(0), data3(0);
-      if (not peekTrigger(trigger, data1, data2, data3))
-        continue;
-      if (tdataChanged.at(0))
-        {
-          URV ecsr = (trigger << 16) | URV(CsrNumber::TDATA1);
-          csrMap[ecsr] = data1;
-        }
-      if (tdataChanged.at(1))
-        {
-          URV ecsr = (trigger << 16) | URV(CsrNumber::TDATA2);
-          csrMap[ecsr] = data2;
-        }
-      if (tdataChanged.at(2))
-        {
-          URV ecsr = (trigger << 16) | URV(CsrNumber::TDATA3);
-          csrMap[ecsr] = data3;
-        }
-    }
-
-  for (const auto& [key, val] : csrMap)
+  for (const auto& [key, val] : rec.csrs)
     {
       if (pending) fprintf(out, "  +\n");
-      formatInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, 'c',
-			   key, val, tmp.c_str());
+      formatInstTrace<URV>(out, rec.tag, hartId, pc, instBuff, 'c',
+			   URV(key), URV(val), tmp.c_str());
       pending = true;
     }
 
   // Process memory diff.
-  size_t address = 0;
-  uint64_t memValue = 0;
-  unsigned writeSize = memory_.getLastWriteNewValue(localHartId_, address, memValue);
-  if (writeSize > 0)
+  if (rec.hasMem)
     {
       if (pending)
         fprintf(out, "  +\n");
 
-      formatInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, 'm',
-			   URV(address), URV(memValue), tmp.c_str());
+      formatInstTrace<URV>(out, rec.tag, hartId, pc, instBuff, 'm',
+			   URV(rec.memAddr), URV(rec.memValue), tmp.c_str());
       pending = true;
     }
 
@@ -2552,7 +3928,7 @@ Hart<URV>::printInstTrace(const DecodedInst& di, uint64_t tag, std::string& tmp,
   else
     {
       // No diffs: Generate an x0 record.
-      formatInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, 'r', 0, 0,
+      formatInstTrace<URV>(out, rec.tag, hartId, pc, instBuff, 'r', 0, 0,
 			  tmp.c_str());
       fprintf(out, "\n");
     }
@@ -2574,50 +3950,6 @@ Hart<URV>::undoForTrigger()
 }
 
 
-void
-addToSignedHistogram(std::vector<uint64_t>& histo, int64_t val)
-{
-  if (histo.size() < 13)
-    histo.resize(13);
-
-  if (val < 0)
-    {
-      if      (val <= -64*1024) histo.at(0)++;
-      else if (val <= -1024)    histo.at(1)++;
-      else if (val <= -16)      histo.at(2)++;
-      else if (val < -2)        histo.at(3)++;
-      else if (val == -2)       histo.at(4)++;
-      else if (val == -1)       histo.at(5)++;
-    }
-  else
-    {
-      if      (val == 0)       histo.at(6)++;
-      else if (val == 1)       histo.at(7)++;
-      else if (val == 2)       histo.at(8)++;
-      else if (val <= 16)      histo.at(9)++;
-      else if (val <= 1024)    histo.at(10)++;
-      else if (val <= 64*1024) histo.at(11)++;
-      else                     histo.at(12)++;
-    }
-}
-
-
-void
-addToUnsignedHistogram(std::vector<uint64_t>& histo, uint64_t val)
-{
-  if (histo.size() < 13)
-    histo.resize(13);
-
-  if      (val == 0)       histo.at(0)++;
-  else if (val == 1)       histo.at(1)++;
-  else if (val == 2)       histo.at(2)++;
-  else if (val <= 16)      histo.at(3)++;
-  else if (val <= 1024)    histo.at(4)++;
-  else if (val <= 64*1024) histo.at(5)++;
-  else                     histo.at(6)++;
-}
-
-
 /// Return true if given hart is in debug mode and the stop count bit of
 /// the DSCR register is set.
 template <typename URV>
@@ -2653,94 +3985,101 @@ Hart<URV>::updatePerformanceCounters(uint32_t inst, const InstEntry& info,
       id != InstId::c_ebreak)
     return;
 
+  // Counts are deferred (see PerfRegs::countEvent) except for CSR
+  // instructions which may write the counters they update.
   PerfRegs& pregs = csRegs_.mPerfRegs_;
-  pregs.updateCounters(EventNumber::InstCommited);
+  bool lazy = not info.isCsr();
+  auto count = [&pregs, lazy] (EventNumber event) {
+		 if (lazy)
+		   pregs.countEvent(event);
+		 else
+		   pregs.updateCounters(event);
+	       };
+
+  count(EventNumber::InstCommited);
 
   if (isCompressedInst(inst))
-    pregs.updateCounters(EventNumber::Inst16Commited);
+    count(EventNumber::Inst16Commited);
   else
-    pregs.updateCounters(EventNumber::Inst32Commited);
+    count(EventNumber::Inst32Commited);
 
   if ((currPc_ & 3) == 0)
-    pregs.updateCounters(EventNumber::InstAligned);
+    count(EventNumber::InstAligned);
 
   if (info.type() == InstType::Int)
     {
       if (id == InstId::ebreak or id == InstId::c_ebreak)
-        pregs.updateCounters(EventNumber::Ebreak);
+        count(EventNumber::Ebreak);
       else if (id == InstId::ecall)
-        pregs.updateCounters(EventNumber::Ecall);
+        count(EventNumber::Ecall);
       else if (id == InstId::fence)
-        pregs.updateCounters(EventNumber::Fence);
+        count(EventNumber::Fence);
       else if (id == InstId::fencei)
-        pregs.updateCounters(EventNumber::Fencei);
+        count(EventNumber::Fencei);
       else if (id == InstId::mret)
-        pregs.updateCounters(EventNumber::Mret);
+        count(EventNumber::Mret);
       else if (id != InstId::illegal)
-        pregs.updateCounters(EventNumber::Alu);
+        count(EventNumber::Alu);
     }
   else if (info.isMultiply())
     {
-      pregs.updateCounters(EventNumber::Mult);
+      count(EventNumber::Mult);
     }
   else if (info.isDivide())
     {
-      pregs.updateCounters(EventNumber::Div);
+      count(EventNumber::Div);
     }
   else if (info.isLoad())
     {
-      pregs.updateCounters(EventNumber::Load);
+      count(EventNumber::Load);
       if (misalignedLdSt_)
-	pregs.updateCounters(EventNumber::MisalignLoad);
+	count(EventNumber::MisalignLoad);
       if (isDataAddressExternal(loadAddr_))
-	pregs.updateCounters(EventNumber::BusLoad);
+	count(EventNumber::BusLoad);
     }
   else if (info.isStore())
     {
-      pregs.updateCounters(EventNumber::Store);
+      count(EventNumber::Store);
       if (misalignedLdSt_)
-	pregs.updateCounters(EventNumber::MisalignStore);
+	count(EventNumber::MisalignStore);
       size_t addr = 0;
       uint64_t value = 0;
       memory_.getLastWriteOldValue(addr, value);
       if (isDataAddressExternal(addr))
-	pregs.updateCounters(EventNumber::BusStore);
+	count(EventNumber::BusStore);
     }
   else if (info.type() == InstType::Zbb or info.type() == InstType::Zbs)
     {
-      pregs.updateCounters(EventNumber::Bitmanip);
+      count(EventNumber::Bitmanip);
     }
   else if (info.isAtomic())
     {
       if (id == InstId::lr_w or id == InstId::lr_d)
-        pregs.updateCounters(EventNumber::Lr);
+        count(EventNumber::Lr);
       else if (id == InstId::sc_w or id == InstId::sc_d)
-        pregs.updateCounters(EventNumber::Sc);
+        count(EventNumber::Sc);
       else
-        pregs.updateCounters(EventNumber::Atomic);
+        count(EventNumber::Atomic);
     }
   else if (info.isCsr() and not hasException_)
     {
       if ((id == InstId::csrrw or id == InstId::csrrwi))
         {
           if (op0 == 0)
-            pregs.updateCounters(EventNumber::CsrWrite);
+            count(EventNumber::CsrWrite);
           else
-            pregs.updateCounters(EventNumber::CsrReadWrite);
+            count(EventNumber::CsrReadWrite);
         }
       else
         {
           if (op1 == 0)
-            pregs.updateCounters(EventNumber::CsrRead);
+            count(EventNumber::CsrRead);
           else
-            pregs.updateCounters(EventNumber::CsrReadWrite);
+            count(EventNumber::CsrReadWrite);
         }
 
       // Counter modified by csr instruction is not updated.
-      std::vector<CsrNumber> csrs;
-      std::vector<unsigned> triggers;
-      csRegs_.getLastWrittenRegs(csrs, triggers);
-      for (auto& csr : csrs)
+      for (auto csr : csRegs_.lastWrittenRegs())
         if (pregs.isModified(unsigned(csr) - unsigned(CsrNumber::MHPMCOUNTER3)))
           {
             URV val;
@@ -2764,12 +4103,75 @@ Hart<URV>::updatePerformanceCounters(uint32_t inst, const InstEntry& info,
     }
   else if (info.isBranch())
     {
-      pregs.updateCounters(EventNumber::Branch);
+      count(EventNumber::Branch);
       if (lastBranchTaken_)
-        pregs.updateCounters(EventNumber::BranchTaken);
+        count(EventNumber::BranchTaken);
+    }
+
+  if (not lazy)
+    pregs.clearModified();
+}
+
+
+template <typename URV>
+void
+Hart<URV>::applyTimingModel(const DecodedInst& di)
+{
+  const InstEntry& info = *(di.instEntry());
+  bool count = enableCounters_ and prevCountersCsrOn_;
+  PerfRegs& pregs = csRegs_.mPerfRegs_;
+
+  uint64_t stall = timing_.extraCycles(unsigned(info.instId()));
+
+  CacheModel& icache = timing_.icache();
+  if (icache.enabled())
+    {
+      bool hit = icache.access(currPc_);
+      if (not hit)
+	stall += timing_.icacheMissPenalty();
+      if (count)
+	pregs.countEvent(hit? EventNumber::ICacheHits :
+			 EventNumber::ICacheMisses);
+    }
+
+  CacheModel& dcache = timing_.dcache();
+  if (dcache.enabled() and (info.isLoad() or info.isStore() or
+			    info.isAtomic()))
+    {
+      // The base register of a store is not modified by the store.
+      URV addr = loadAddr_;
+      if (not loadAddrValid_)
+	{
+	  addr = intRegs_.read(di.op1());
+	  if (info.isStore())
+	    addr += SRV(di.op2AsInt());
+	}
+      bool hit = dcache.access(addr);
+      if (not hit)
+	stall += timing_.dcacheMissPenalty();
+      if (count)
+	pregs.countEvent(hit? EventNumber::DCacheHits :
+			 EventNumber::DCacheMisses);
     }
 
-  pregs.clearModified();
+  BranchPredictorModel& predictor = timing_.predictor();
+  if (predictor.enabled() and info.isBranch())
+    {
+      bool correct = true;
+      if (info.isConditionalBranch())
+	correct = predictor.predictBranch(currPc_,
+					  pc_ != currPc_ + di.instSize());
+      else if (info.isBranchToRegister())
+	correct = predictor.predictJump(currPc_, pc_);
+      if (not correct)
+	{
+	  stall += timing_.mispredictPenalty();
+	  if (count)
+	    pregs.countEvent(EventNumber::BranchMiss);
+	}
+    }
+
+  cycleCount_ += stall;
 }
 
 
@@ -2790,15 +4192,25 @@ Hart<URV>::accumulateInstructionStats(const DecodedInst& di)
       id != InstId::c_ebreak)
     return;
 
+  if (timingModel_)
+    applyTimingModel(di);
+
   misalignedLdSt_ = false;
   lastBranchTaken_ = false;
 
   if (not instFreq_)
     return;
 
-  InstProfile& prof = instProfileVec_.at(size_t(id));
+  typedef InstProfile IP;
+  uint64_t* prof = instProfile_.record(id);
+
+  prof[IP::Freq]++;
+
+  unsigned parts = instProfile_.parts();
+  if (parts == IP::Opcodes)
+    return;
 
-  prof.freq_++;
+  bool regUse = parts & IP::Registers;
 
   bool hasRd = false;
 
@@ -2809,11 +4221,15 @@ Hart<URV>::accumulateInstructionStats(const DecodedInst& di)
     {
       hasRd = info.isIthOperandWrite(0);
       if (hasRd)
-        prof.rd_.at(di.op0())++;
+        {
+          if (regUse)
+            prof[IP::Rd + (di.op0() & 31)]++;
+        }
       else
         {
           rs1 = di.op0();
-          prof.rs1_.at(rs1)++;
+          if (regUse)
+            prof[IP::Rs1 + (rs1 & 31)]++;
           hasRs1 = true;
         }
     }
@@ -2826,13 +4242,15 @@ Hart<URV>::accumulateInstructionStats(const DecodedInst& di)
       if (hasRd)
         {
           rs1 = di.op1();
-          prof.rs1_.at(rs1)++;
+          if (regUse)
+            prof[IP::Rs1 + (rs1 & 31)]++;
           hasRs1 = true;
         }
       else
         {
           rs2 = di.op1();
-          prof.rs2_.at(rs2)++;
+          if (regUse)
+            prof[IP::Rs2 + (rs2 & 31)]++;
           hasRs2 = true;
         }
     }
@@ -2847,7 +4265,8 @@ Hart<URV>::accumulateInstructionStats(const DecodedInst& di)
       if (hasRd)
         {
           rs2 = di.op2();
-          prof.rs2_.at(rs2)++;
+          if (regUse)
+            prof[IP::Rs2 + (rs2 & 31)]++;
           hasRs2 = true;
         }
       else
@@ -2859,35 +4278,43 @@ Hart<URV>::accumulateInstructionStats(const DecodedInst& di)
       imm = di.op2();
     }
 
+  if (not (parts & IP::Values))
+    return;
+
   if (hasImm)
     {
-      prof.hasImm_ = true;
-
-      if (prof.freq_ == 1)
+      if (not prof[IP::HasImm])
         {
-          prof.minImm_ = prof.maxImm_ = imm;
+          prof[IP::HasImm] = 1;
+          prof[IP::MinImm] = prof[IP::MaxImm] = uint64_t(int64_t(imm));
         }
       else
         {
-          prof.minImm_ = std::min(prof.minImm_, imm);
-          prof.maxImm_ = std::max(prof.maxImm_, imm);
+          int64_t minImm = int64_t(prof[IP::MinImm]);
+          int64_t maxImm = int64_t(prof[IP::MaxImm]);
+          prof[IP::MinImm] = uint64_t(std::min(minImm, int64_t(imm)));
+          prof[IP::MaxImm] = uint64_t(std::max(maxImm, int64_t(imm)));
         }
-      addToSignedHistogram(prof.immHisto_, imm);
+      prof[IP::ImmHisto + IP::signedBucket(imm)]++;
     }
 
+  if (not hasRs1 and not hasRs2)
+    return;
+
   unsigned rd = unsigned(intRegCount() + 1);
   URV rdOrigVal = 0;
   intRegs_.getLastWrittenReg(rd, rdOrigVal);
 
+  bool isUnsigned = info.isUnsigned();
+
   if (hasRs1)
     {
       URV val1 = intRegs_.read(rs1);
       if (rs1 == rd)
         val1 = rdOrigVal;
-      if (info.isUnsigned())
-        addToUnsignedHistogram(prof.rs1Histo_, val1);
-      else
-        addToSignedHistogram(prof.rs1Histo_, SRV(val1));
+      unsigned bucket = ( isUnsigned ? IP::unsignedBucket(val1) :
+                          IP::signedBucket(SRV(val1)) );
+      prof[IP::Rs1Histo + bucket]++;
     }
 
   if (hasRs2)
@@ -2895,10 +4322,9 @@ Hart<URV>::accumulateInstructionStats(const DecodedInst& di)
       URV val2 = intRegs_.read(rs2);
       if (rs2 == rd)
         val2 = rdOrigVal;
-      if (info.isUnsigned())
-        addToUnsignedHistogram(prof.rs2Histo_, val2);
-      else
-        addToSignedHistogram(prof.rs2Histo_, SRV(val2));
+      unsigned bucket = ( isUnsigned ? IP::unsignedBucket(val2) :
+                          IP::signedBucket(SRV(val2)) );
+      prof[IP::Rs2Histo + bucket]++;
     }
 }
 
@@ -3025,10 +4451,196 @@ Hart<URV>::lastCsr(std::vector<CsrNumber>& csrs,
 }
 
 
+template <typename URV>
+bool
+Hart<URV>::addBreakpoint(URV addr)
+{
+  if (not breakpoints_.insert(addr).second)
+    return false;
+  invalidateBreakpoint(addr);
+  return true;
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::removeBreakpoint(URV addr)
+{
+  if (not breakpoints_.erase(addr))
+    return false;
+  invalidateBreakpoint(addr);
+  return true;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::setStopAddress(URV address)
+{
+  clearStopAddress();
+  stopAddr_ = address;
+  stopAddrValid_ = true;
+  invalidateBreakpoint(address);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::clearStopAddress()
+{
+  if (not stopAddrValid_)
+    return;
+  stopAddrValid_ = false;
+  invalidateBreakpoint(stopAddr_);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::invalidateBreakpoint(URV addr)
+{
+  // Decoded instructions are flagged when decoded: Drop the cached
+  // one and rebuild the basic blocks of its page.
+  if (not decodeCache_.empty())
+    {
+      auto& entry = decodeCache_[(addr >> 1) & decodeCacheMask_];
+      if (entry.address() == addr)
+	entry.invalidate();
+    }
+  memory_.bumpCodeGeneration(addr, addr, &codeEpochSeen_);
+  blockCacheDirty_ = true;
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::addWatchpoint(URV addr, unsigned size, WatchType type)
+{
+  if (size == 0)
+    return false;
+
+  Watchpoint wp;
+  wp.addr = addr;
+  wp.size = size;
+  wp.type = type;
+  watchpoints_.push_back(wp);
+  memory_.watchPages(addr, addr + size - 1, true);
+  return true;
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::removeWatchpoint(URV addr, unsigned size, WatchType type)
+{
+  for (auto iter = watchpoints_.begin(); iter != watchpoints_.end(); ++iter)
+    if (iter->addr == addr and iter->size == size and iter->type == type)
+      {
+	watchpoints_.erase(iter);
+	memory_.watchPages(addr, addr + size - 1, false);
+	return true;
+      }
+  return false;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::checkWatchpoints(URV addr, unsigned size, bool isStore)
+{
+  for (const auto& wp : watchpoints_)
+    {
+      if (addr + size <= wp.addr or wp.addr + wp.size <= addr)
+	continue;
+      if ((isStore and wp.type == WatchType::Read) or
+	  (not isStore and wp.type == WatchType::Write))
+	continue;
+
+      stopReason_ = StopReason::Watchpoint;
+      stopPointAddr_ = addr;
+      userOk = false;  // Stop run after current instruction.
+      return;
+    }
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::reportStopPoint() const
+{
+  const char* what = nullptr;
+  if (stopReason_ == StopReason::Breakpoint)
+    what = "Breakpoint";
+  else if (stopReason_ == StopReason::Watchpoint)
+    what = "Watchpoint";
+  else
+    return false;
+
+  std::cerr << "Stopped -- " << what << " at 0x" << std::hex
+	    << stopPointAddr_ << std::dec << '\n';
+  return true;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::lastCsrValues(std::vector<std::pair<uint64_t, uint64_t>>& changes,
+			 bool withDebug)
+{
+  changes.clear();
+
+  // Components of the triggers that changed (if any).
+  bool tdataChanged[3] = { false, false, false };
+
+  URV value = 0;
+  for (CsrNumber csr : csRegs_.lastWrittenRegs())
+    {
+      bool ok = false;
+      if (withDebug)
+	ok = peekCsr(csr, value);
+      else
+	{
+	  bool debugMode = false;
+	  ok = csRegs_.read(csr, PrivilegeMode::Machine, debugMode, value);
+	}
+      if (not ok)
+	continue;
+
+      if (csr >= CsrNumber::TDATA1 and csr <= CsrNumber::TDATA3)
+        {
+          size_t ix = size_t(csr) - size_t(CsrNumber::TDATA1);
+          tdataChanged[ix] = true;
+          continue; // Debug triggers collected separately below
+        }
+      changes.push_back(std::make_pair(uint64_t(csr), uint64_t(value)));
+    }
+
+  // Trigger register diffs.
+  csRegs_.getLastWrittenTriggers(lastTriggers_);
+  for (unsigned trigger : lastTriggers_)
+    {
+      URV data[3] = { 0, 0, 0 };
+      if (not peekTrigger(trigger, data[0], data[1], data[2]))
+        continue;
+      for (unsigned i = 0; i < 3; ++i)
+	if (tdataChanged[i])
+	  {
+	    uint64_t key = URV(CsrNumber::TDATA1) + i;
+	    changes.push_back(std::make_pair((uint64_t(trigger) << 16) | key,
+					     uint64_t(data[i])));
+	  }
+    }
+
+  // Recorded CSRs are distinct and trigger keys differ from CSR keys
+  // (tdata registers are excluded above): Sorting is enough.
+  std::sort(changes.begin(), changes.end());
+}
+
+
 template <typename URV>
 void
-Hart<URV>::lastMemory(std::vector<size_t>& addresses,
-		      std::vector<uint32_t>& words) const
+Hart<URV>::lastMemory(InlineVector<size_t, 2>& addresses,
+		      InlineVector<uint32_t, 2>& words) const
 {
   addresses.clear();
   words.clear();
@@ -3040,8 +4652,6 @@ Hart<URV>::lastMemory(std::vector<size_t>& addresses,
   if (not writeSize)
     return;
 
-  addresses.clear();
-  words.clear();
   addresses.push_back(address);
   words.push_back(uint32_t(value));
 
@@ -3064,6 +4674,8 @@ bool
 Hart<URV>::takeTriggerAction(FILE* traceFile, URV pc, URV info,
 			     uint64_t& counter, bool beforeTiming)
 {
+  SELF_PROFILE_PHASE(Triggers);
+
   // Check triggers configuration to determine action: take breakpoint
   // exception or enter debugger.
 
@@ -3087,13 +4699,13 @@ Hart<URV>::takeTriggerAction(FILE* traceFile, URV pc, URV info,
 	}
     }
 
-  if (beforeTiming and traceFile)
+  if (beforeTiming and recordsInsts(traceFile))
     {
       uint32_t inst = 0;
       readInst(currPc_, inst);
 
       std::string instStr;
-      printInstTrace(inst, counter, instStr, traceFile);
+      traceInst(inst, counter, instStr, traceFile);
     }
 
   return enteredDebug;
@@ -3139,47 +4751,183 @@ reportInstsPerSec(uint64_t instCount, double elapsed, bool keyboardInterrupt)
 static
 void keyboardInterruptHandler(int)
 {
-  userOk = false;
+  kbdInterrupts++;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::requestStop(CoreException::Type type, const char* message,
+		       uint64_t address, uint64_t value)
+{
+  if (stopPending_)
+    return;
+  pendingStop_ = CoreException(type, message, address, value);
+  stopPending_ = true;
+  setTargetProgramFinished(true);
+  userOk = false;  // Stop enclosing run loops.
 }
 
 
 template <typename URV>
 bool
-Hart<URV>::logStop(const CoreException& ce, uint64_t counter, FILE* traceFile)
+Hart<URV>::logStop(bool success)
 {
-  std::lock_guard<std::mutex> guard(stderrMutex);
+  if (not stopPending_)
+    return success;
+  stopPending_ = false;
 
-  bool success = false;
-  bool isRetired = false;
+  const CoreException& ce = pendingStop_;
+  std::lock_guard<std::mutex> guard(stderrMutex);
 
-  if (ce.type() == CoreException::Stop)
-    {
-      isRetired = true;
-      success = ce.value() == 1; // Anything besides 1 is a fail.
-      std::cerr << (success? "Successful " : "Error: Failed ")
-		<< "stop: " << ce.what() << ": " << ce.value() << "\n";
-      setTargetProgramFinished(true);
-    }
-  else if (ce.type() == CoreException::Exit)
+  if (ce.type() == CoreException::Exit)
     {
-      isRetired = true;
       std::cerr << "Target program exited with code " << std::dec << ce.value()
 		<< '\n';
-      setTargetProgramFinished(true);
       return ce.value() == 0;
     }
+
+  success = ce.value() == 1; // Anything besides 1 is a fail.
+  std::cerr << (success? "Successful " : "Error: Failed ")
+	    << "stop: " << ce.what() << ": " << ce.value() << "\n";
+  if (not success)
+    flightDumpReason_ = ce.what();
+  return success;
+}
+
+
+template <typename URV>
+unsigned
+Hart<URV>::runLoopFeatures(URV address, FILE* traceFile) const
+{
+  unsigned features = 0;
+  if (recordsInsts(traceFile))
+    features |= RunTrace;
+  if (enableTriggers_)
+    features |= RunTriggers;
+  if (enableCounters_ or timingModel_)
+    features |= RunCounters;
+  if (instFreq_)
+    features |= RunStats;
+  if (address != ~URV(0) or not breakpoints_.empty())
+    features |= RunStopAddr;  // Breakpoints are checked with stop address.
+  if (instCountLim_ != ~uint64_t(0))
+    features |= RunLimit;
+  return features;
+}
+
+
+template <typename URV>
+template<unsigned FEATURES>
+bool
+Hart<URV>::dispatchRunLoop(unsigned features, URV address, FILE* traceFile)
+{
+  if constexpr (FEATURES < RunAllFeatures)
+    {
+      if (features == FEATURES)
+	return untilAddressLoop<FEATURES>(address, traceFile);
+      return dispatchRunLoop<FEATURES + 1>(features, address, traceFile);
+    }
+  else
+    return untilAddressLoop<RunAllFeatures>(address, traceFile);
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::untilAddress(URV address, FILE* traceFile)
+{
+  // Resume after the stop of a previous breakpoint/watchpoint hit.
+  if (stopReason_ != StopReason::None)
+    {
+      stopReason_ = StopReason::None;
+      userOk = true;
+    }
+
+  if (decodeCache_.empty())
+    decodeCache_.resize(decodeCacheSize_);
+
+  if (branchFile_)
+    branchEvent(instCounter_, pc_, pc_, BranchEvent::Start);
+
+  bool success = true;
+  outputBuffering_ = true;
+  if (traceFile and traceWindow_)
+    success = windowedRun(address, traceFile);
   else
-    std::cerr << "Stopped -- unexpected exception\n";
+    {
+      unsigned features = runLoopFeatures(address, traceFile);
+      success = dispatchRunLoop<0>(features, address, traceFile);
+    }
+  outputBuffering_ = false;
+  flushTargetOutput();
+  flushObserverEvents();
+
+  if (branchFile_)
+    {
+      branchEvent(instCounter_, pc_, pc_, BranchEvent::Stop);
+      flushBranchTrace();
+    }
+
+  if (not flightRing_.empty())
+    {
+      if (flightDumpReason_)
+	dumpFlightRecorder(flightDumpReason_);
+      else if (kbdInterrupts != kbdInterruptsAtStart)
+	dumpFlightRecorder("keyboard interrupt");
+    }
+  flightDumpReason_ = nullptr;
+  restoreHostRoundingMode();
+
+  return success;
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::windowedRun(URV address, FILE* traceFile)
+{
+  uint64_t limit = instCountLim_;
+  bool success = true;
 
-  if (isRetired)
+  while (success and runOk() and not targetProgFinished_ and
+	 pc_ != address and instCounter_ < limit)
     {
-      retiredInsts_++;
-      if (traceFile)
+      if (not traceWindowOpen_)
+	{
+	  if (traceWindowDone_)
+	    {
+	      success = runUntraced(limit, address, ~URV(0));
+	      continue;
+	    }
+	  if (instCounter_ < traceFromInst_)
+	    {
+	      success = runUntraced(std::min(limit, traceFromInst_), address,
+				    ~URV(0));
+	      continue;
+	    }
+	  if (traceFromPc_ != ~URV(0) and pc_ != traceFromPc_)
+	    {
+	      success = runUntraced(limit, traceFromPc_, address);
+	      continue;
+	    }
+	  traceWindowOpen_ = true;
+	  traceWindowStart_ = instCounter_;
+	}
+
+      // Traced run loop: Stops at toPc (see untilAddressLoop) or at
+      // the toInst limit.
+      instCountLim_ = std::min(limit, traceToInst_);
+      unsigned features = runLoopFeatures(address, traceFile);
+      success = dispatchRunLoop<0>(features, address, traceFile);
+      instCountLim_ = limit;
+
+      bool atToPc = pc_ == traceToPc_ and instCounter_ != traceWindowStart_;
+      if (atToPc or instCounter_ >= traceToInst_)
 	{
-	  uint32_t inst = 0;
-	  readInst(currPc_, inst);
-	  std::string instStr;
-	  printInstTrace(inst, counter, instStr, traceFile);
+	  traceWindowOpen_ = false;
+	  traceWindowDone_ = ( traceFromPc_ == ~URV(0) or
+			       instCounter_ >= traceToInst_ );
 	}
     }
 
@@ -3189,22 +4937,92 @@ Hart<URV>::logStop(const CoreException& ce, uint64_t counter, FILE* traceFile)
 
 template <typename URV>
 bool
-Hart<URV>::untilAddress(URV address, FILE* traceFile)
+Hart<URV>::runUntraced(uint64_t limit, URV stop1, URV stop2)
+{
+  unsigned features = runLoopFeatures(~URV(0), nullptr) & ~RunLimit;
+  bool hasWideLdSt = csRegs_.getImplementedCsr(CsrNumber::MDBAC) != nullptr;
+  bool fast = ( (complexRunFeatures(~URV(0), nullptr) & ~RunLimit) == 0 and
+	       not enableGdb_ and not hasWideLdSt );
+
+  uint64_t prevLim = instCountLim_;
+  bool success = true;
+
+  auto done = [this, limit, stop1, stop2] () {
+    return ( not runOk() or targetProgFinished_ or instCounter_ >= limit or
+	     pc_ == stop1 or pc_ == stop2 );
+  };
+
+  while (success and not done())
+    {
+      unsigned steps = 1;
+      if (fast)
+	{
+	  // simpleRun stops exactly at the limit but does not enter a
+	  // block holding a stop address (other than the one of
+	  // setStopAddress): Step from there to the stop point.
+	  success = simpleRun(limit, stop1, stop2);
+	  steps = BasicBlock<URV>::maxInsts;
+	}
+      else if (stop2 == ~URV(0))
+	{
+	  // Run loop stops exactly at a single address.
+	  instCountLim_ = limit;
+	  unsigned stepFeatures = runLoopFeatures(stop1, nullptr);
+	  success = dispatchRunLoop<0>(stepFeatures, stop1, nullptr);
+	  instCountLim_ = prevLim;
+	  continue;
+	}
+
+      for (unsigned i = 0; i < steps and success and not done(); ++i)
+	{
+	  instCountLim_ = instCounter_ + 1;
+	  success = dispatchRunLoop<0>(features | RunLimit, ~URV(0), nullptr);
+	  instCountLim_ = prevLim;
+	}
+    }
+
+  return success;
+}
+
+
+template <typename URV>
+template<unsigned FEATURES>
+bool
+Hart<URV>::untilAddressLoop(URV address, FILE* traceFile)
 {
+  constexpr bool doTrace = FEATURES & RunTrace;
+  constexpr bool doTrig = FEATURES & RunTriggers;
+  constexpr bool doStats = FEATURES & (RunCounters | RunStats);
+  constexpr bool doStop = FEATURES & RunStopAddr;
+  constexpr bool doLimit = FEATURES & RunLimit;
+
+  SELF_PROFILE_PHASE(Execute);
+
   std::string instStr;
-  instStr.reserve(128);
+  if constexpr (doTrace)
+    instStr.reserve(128);
 
   // Need csr history when tracing or for triggers
-  bool trace = traceFile != nullptr or enableTriggers_;
+  constexpr bool trace = doTrace or doTrig;
   clearTraceData();
 
+  // Last-write info of memory is only consulted when tracing or
+  // collecting stats (triggers return early: keep it for them too).
+  trackLastWrite_ = trace or doStats;
+
   uint64_t counter = instCounter_;
   uint64_t limit = instCountLim_;
   bool success = true;
-  bool doStats = instFreq_ or enableCounters_;
+
+  // Other harts may write code held in our decode cache.
+  bool sharedCode = memory_.hartCount() > 1;
 
 #ifdef __EMSCRIPTEN__
   int simEnableInterrupt = jsInterruptEnabled();
+  bool replaying = inputLog_ and inputLog_->isReplaying();
+  bool pollInterrupts = ( simEnableInterrupt and
+			  (replaying or
+			   not jsWatchInterruptFlag(int(uintptr_t(&interruptPending_)))) );
 #endif
 
   if (enableGdb_)
@@ -3212,14 +5030,21 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 
   uint32_t inst = 0;
 
-  while (pc_ != address and counter < limit and userOk)
+  while ((not doStop or pc_ != address) and (not doLimit or counter < limit)
+	 and runOk())
   {
     inst = 0;
 
-#ifndef DISABLE_EXCEPTIONS
-    try
-#endif
-    {
+    // End of trace window (see windowedRun).
+    if (doTrace and pc_ == traceToPc_ and counter != traceWindowStart_)
+      break;
+
+    if (counter >= nextSample_)
+      takeSample(counter);
+
+    if (cycleCount_ >= nextEvent_.load(std::memory_order_relaxed))
+      processEvents(counter);
+
 	  currPc_ = pc_;
 
 	  loadAddrValid_ = false;
@@ -3228,12 +5053,17 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 
     
 #ifdef __EMSCRIPTEN__  
-    if(simEnableInterrupt){
+    // Interrupts are evaluated only when something may have changed.
+    if(simEnableInterrupt and interruptPending_){
+      interruptPending_ = pollInterrupts;
       InterruptCause cause;
       if (isInterruptPossible(cause))
       {
         initiateInterrupt(cause, pc_);
         ++cycleCount_;
+        if (branchFile_)
+          branchEvent(counter, currPc_, pc_, BranchEvent::Interrupt);
+        currPc_ = pc_;
       }
     }
 #endif
@@ -3241,41 +5071,83 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 	  ++counter;
 
 	  // Process pre-execute address trigger and fetch instruction.
-	  bool hasTrig = hasActiveInstTrigger();
-	  triggerTripped_ = hasTrig && instAddrTriggerHit(pc_,
-							  TriggerTiming::Before,
-							  isInterruptEnabled());
-	  // Fetch instruction.
-	  bool fetchOk = true;
-	  if (triggerTripped_)
+	  bool hasTrig = doTrig and hasActiveInstTrigger();
+	  if constexpr (doTrig)
+	    triggerTripped_ = hasTrig && instAddrTriggerHit(pc_,
+							    TriggerTiming::Before,
+							    isInterruptEnabled());
+	  // Without triggers, a decode cache hit makes the fetch
+	  // unnecessary: the instruction was fetched successfully at the
+	  // same address and the cache entry is invalidated on a write.
+	  // A fetch fault injected by the test-bench (see
+	  // postInstAccessFault) is raised by fetchInst: fetch then.
+	  if (sharedCode)
+	    checkCodeWrites();
+	  uint32_t ix = (pc_ >> 1) & decodeCacheMask_;
+	  DecodedInst* di = &decodeCache_[ix];
+	  bool cacheHit = di->isValid() and di->address() == pc_;
+	  SELF_PROFILE_COUNT(decodeHits, cacheHit);
+	  SELF_PROFILE_COUNT(decodeMisses, not cacheHit);
+
+	  if (doTrig or not cacheHit or forceFetchFail_)
 	    {
-	      if (not fetchInstPostTrigger(pc_, inst, traceFile))
+	      // Fetch instruction.
+	      bool fetchOk = true;
+	      if (doTrig and triggerTripped_)
+		{
+		  if (not fetchInstPostTrigger(pc_, inst, traceFile))
+		    {
+		      ++cycleCount_;
+		      if (branchFile_)
+			branchEvent(counter, currPc_, pc_,
+				    BranchEvent::Exception);
+		      continue;  // Next instruction in trap handler.
+		    }
+		}
+	      else
+		fetchOk = fetchInst(pc_, inst);
+	      if (not fetchOk)
 		{
 		  ++cycleCount_;
+		  if (doTrace)
+		    traceInst(inst, counter, instStr, traceFile);
+		  if (branchFile_)
+		    branchEvent(counter, currPc_, pc_, BranchEvent::Exception);
 		  continue;  // Next instruction in trap handler.
 		}
+
+	      // Process pre-execute opcode trigger.
+	      if (hasTrig and instOpcodeTriggerHit(inst, TriggerTiming::Before,
+						   isInterruptEnabled()))
+		triggerTripped_ = true;
+
+	      // Decode unless match in decode cache.
+	      if (not cacheHit)
+		{
+		  SELF_PROFILE_PHASE(Decode);
+		  decode(pc_, inst, *di);
+		  memory_.markCode(pc_, pc_ + di->instSize() - 1);
+		}
 	    }
-	  else
-	    fetchOk = fetchInst(pc_, inst);
-	  if (not fetchOk)
+
+	  // Stop before a breakpoint unless resuming from it.
+	  if (doStop and di->isBreakpoint() and counter - 1 != breakResume_)
 	    {
-	      ++cycleCount_;
-	      if (traceFile)
-		printInstTrace(inst, counter, instStr, traceFile);
-	      continue;  // Next instruction in trap handler.
+	      --counter;
+	      breakResume_ = counter;
+	      stopReason_ = StopReason::Breakpoint;
+	      stopPointAddr_ = pc_;
+	      if (not enableGdb_)
+		{
+		  userOk = false;  // Stop enclosing run loops.
+		  break;
+		}
+	      instCounter_ = counter;
+	      handleExceptionForGdb(*this);
+	      stopReason_ = StopReason::None;
+	      continue;
 	    }
 
-	  // Process pre-execute opcode trigger.
-	  if (hasTrig and instOpcodeTriggerHit(inst, TriggerTiming::Before,
-					       isInterruptEnabled()))
-	    triggerTripped_ = true;
-
-	  // Decode unless match in decode cache.
-	  uint32_t ix = (pc_ >> 1) & decodeCacheMask_;
-	  DecodedInst* di = &decodeCache_[ix];
-	  if (not di->isValid() or di->address() != pc_)
-	    decode(pc_, inst, *di);
-
 	  bool doingWide = wideLdSt_;
 
 	  // Execute.
@@ -3284,22 +5156,33 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 
 	  ++cycleCount_;
 
+	  // Start/stop-trace triggers gate the trace.
+	  bool traceStart = false;
+	  if (doTrig and csRegs_.takeTraceTriggerAction(traceStart))
+	    traceOn_ = traceStart;
+
 	  if (hasException_)
 	    {
-	      if (traceFile)
+	      if (doTrace)
 		{
-		  printInstTrace(*di, counter, instStr, traceFile);
+		  traceInst(*di, counter, instStr, traceFile);
 		  clearTraceData();
 		}
+	      if (branchFile_)
+		branchEvent(counter, currPc_, pc_, BranchEvent::Exception);
+	      if (pcProfile_)
+		++pcCounts_[currPc_];
 	      continue;
 	    }
 
-	  if (triggerTripped_)
+	  if (doTrig and triggerTripped_)
 	    {
 	      undoForTrigger();
 	      if (takeTriggerAction(traceFile, currPc_, currPc_,
 				    counter, true))
 		return true;
+	      if (branchFile_)
+		branchEvent(counter, currPc_, pc_, BranchEvent::Exception);
 	      continue;
 	    }
 
@@ -3310,33 +5193,43 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 	  if (doStats)
 	    accumulateInstructionStats(*di);
 
-	  bool icountHit = (enableTriggers_ and isInterruptEnabled() and
+	  if (branchFile_ and pc_ != currPc_ + di->instSize())
+	    branchEvent(counter, currPc_, pc_, BranchEvent::Jump);
+
+	  if (pcProfile_)
+	    ++pcCounts_[currPc_];
+
+	  if (coverage_)
+	    coverage_->markExecuted(currPc_);
+
+	  bool icountHit = (doTrig and isInterruptEnabled() and
 			    icountTriggerHit());
 
 	  if (trace)
 	    {
-	      if (traceFile)
-		printInstTrace(*di, counter, instStr, traceFile);
+	      if (doTrace)
+		traceInst(*di, counter, instStr, traceFile);
 	      clearTraceData();
 	    }
 
 	  if (icountHit)
 	    if (takeTriggerAction(traceFile, pc_, pc_, counter, false))
 	      return true;
-	}   
-#ifndef DISABLE_EXCEPTIONS
-  catch (const CoreException& ce)
-	{
-	  success = logStop(ce, counter, traceFile);
-	  break;
-	}
-#endif
+
+	  if (enableGdb_ and stopReason_ == StopReason::Watchpoint)
+	    {
+	      instCounter_ = counter;
+	      handleExceptionForGdb(*this);
+	      stopReason_ = StopReason::None;
+	      userOk = not stopPending_;
+	    }
   }
 
   // Update retired-instruction and cycle count registers.
   instCounter_ = counter;
+  trackLastWrite_ = true;
 
-  return success;
+  return logStop(success);
 }
 
 
@@ -3350,6 +5243,8 @@ Hart<URV>::runUntilAddress(URV address, FILE* traceFile)
   uint64_t limit = instCountLim_;
   uint64_t counter0 = instCounter_;
   userOk = true;
+  stopReason_ = StopReason::None;
+  kbdInterruptsAtStart = kbdInterrupts;
 
 #ifdef __MINGW64__
   __p_sig_fn_t oldAction = nullptr;
@@ -3369,7 +5264,9 @@ Hart<URV>::runUntilAddress(URV address, FILE* traceFile)
   sigaction(SIGINT, &oldAction, nullptr);
 #endif
 
-  if (instCounter_ == limit)
+  if (reportStopPoint())
+    ;
+  else if (instCounter_ == limit)
     std::cerr << "Stopped -- Reached instruction limit\n";
   else if (pc_ == address)
     std::cerr << "Stopped -- Reached end address\n";
@@ -3381,74 +5278,790 @@ Hart<URV>::runUntilAddress(URV address, FILE* traceFile)
                     double(t1.tv_usec - t0.tv_usec)*1e-6);
 
   uint64_t numInsts = instCounter_ - counter0;
+  runInsts_ += numInsts;
+  runTime_ += elapsed;
 
-  reportInstsPerSec(numInsts, elapsed, not userOk);
+  bool kbdInterrupt = kbdInterrupts != kbdInterruptsAtStart;
+  reportInstsPerSec(numInsts, elapsed, kbdInterrupt);
+#ifdef SELF_PROFILE
+  {
+    std::lock_guard<std::mutex> guard(stderrMutex);
+    selfProfile_.print(std::cerr, localHartId_);
+  }
+#endif
   return success;
 }
 
 
 template <typename URV>
 bool
-Hart<URV>::simpleRun()
+Hart<URV>::endsBasicBlock(const InstEntry& entry) const
 {
-  bool success = true;
-#ifdef __EMSCRIPTEN__
-  int simEnableInterrupt = jsInterruptEnabled();
+  if (entry.isBranch() or entry.isCsr())
+    return true;
+
+  switch (entry.instId())
+    {
+    case InstId::illegal:
+    case InstId::fence:
+    case InstId::fencei:
+    case InstId::ecall:
+    case InstId::ebreak:
+    case InstId::c_ebreak:
+    case InstId::mret:
+    case InstId::uret:
+    case InstId::sret:
+    case InstId::wfi:
+      return true;
+    default:
+      return false;
+    }
+}
+
+
+template <typename URV>
+void
+Hart<URV>::flushBlockCache()
+{
+  for (auto& kv : blockCache_)
+    clearBlock(kv.second);
+
+  blockCache_.clear();
+  blockCacheDirty_ = false;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::clearBlock(BasicBlock<URV>& bb)
+{
+  // Recycle the function table (or executable memory) slots of compiled
+  // code.
+  for (const auto& op : bb.hotOps)
+    if (op.compiled)
+      freeCompiled_.push_back(op.compiled);
+
+  if (pcProfile_ and bb.profileCount)
+    for (const auto& di : bb.insts)
+      pcCounts_[di.address()] += bb.profileCount;
+  if (blockInstFreq_ and bb.profileCount)
+    for (const auto& di : bb.insts)
+      instProfile_.record(di.instEntry()->instId())[InstProfile::Freq] +=
+	bb.profileCount;
+  bb.profileCount = 0;
+
+  bb.insts.clear();
+  bb.hotOps.clear();
+  bb.execCount = 0;
+  bb.covered = false;
+  bb.succAddr[0] = bb.succAddr[1] = 0;
+  bb.succ[0] = bb.succ[1] = nullptr;
+}
+
+
+template <typename URV>
+BasicBlock<URV>*
+Hart<URV>::getBasicBlock(URV addr)
+{
+  auto iter = blockCache_.find(addr);
+  if (iter != blockCache_.end() and not isBlockStale(iter->second))
+    {
+      SELF_PROFILE_COUNT(blockHits, 1);
+      return &iter->second;
+    }
+
+  SELF_PROFILE_PHASE(Decode);
+  SELF_PROFILE_COUNT(blockMisses, 1);
+
+  uint32_t inst = 0;
+  if (not fetchInst(addr, inst))
+    return nullptr;
+
+  // A stale block is rebuilt in place: blocks chained to it remain
+  // valid.
+  BasicBlock<URV>& bb = blockCache_[addr];
+  clearBlock(bb);
+  bb.address = addr;
+
+  // Decode till a block ending instruction, a page boundary, or a
+  // fetch failure. A failing fetch is not reported here: it will be
+  // reported when the pc reaches the failing address.
+  size_t pageIx = memory_.getPageIx(addr);
+  URV pc = addr;
+  while (true)
+    {
+      // Reuse the decoded instruction cache (filled by preDecode or
+      // by the untilAddress loop) when possible.
+      const DecodedInst* cached = nullptr;
+      if (not decodeCache_.empty())
+	{
+	  cached = &decodeCache_[(pc >> 1) & decodeCacheMask_];
+	  if (not cached->isValid() or cached->address() != pc or
+	      cached->inst() != inst)
+	    cached = nullptr;
+	}
+      bb.insts.emplace_back();
+      DecodedInst& di = bb.insts.back();
+      SELF_PROFILE_COUNT(decodeHits, cached != nullptr);
+      SELF_PROFILE_COUNT(decodeMisses, cached == nullptr);
+      if (cached)
+	di = *cached;
+      else
+	decode(pc, inst, di);
+
+      // A breakpoint instruction is alone in its block and a stop
+      // point starts its block: The block run loop checks both at
+      // block entry.
+      if ((di.isBreakpoint() or di.isStopPoint()) and bb.insts.size() > 1)
+	{
+	  bb.insts.pop_back();
+	  break;
+	}
+      pc += di.instSize();
+
+      if (di.isBreakpoint() or endsBasicBlock(*di.instEntry()) or
+	  bb.insts.size() >= BasicBlock<URV>::maxInsts or
+	  memory_.getPageIx(pc) != pageIx)
+	break;
+
+      if (forceFetchFail_ or not memory_.readInstWord(pc, inst))
+	{
+	  uint16_t half = 0;
+	  if (forceFetchFail_ or not memory_.readInstHalfWord(pc, half) or
+	      not isCompressedInst(half))
+	    break;
+	  inst = half;
+	}
+    }
+  bb.endAddress = pc;
+
+  if (fuseInsts_)
+    fuseBlockInsts(bb);
+
+  // Last instruction may straddle a page boundary.
+  memory_.markCode(addr, pc - 1);
+  bb.codeGen[0] = memory_.codeGeneration(addr);
+  bb.codeGen[1] = memory_.codeGeneration(pc - 1);
+
+  return &bb;
+}
+
+
+template <typename URV>
+FusedOp
+Hart<URV>::fusionKind(const DecodedInst& first,
+		      const DecodedInst& second) const
+{
+  uint32_t rd = first.op0();
+  if (rd == 0)
+    return FusedOp::None;
+
+  InstId id1 = first.instEntry()->instId();
+  InstId id2 = second.instEntry()->instId();
+
+  // Second instruction of the form: op rd, rd, imm
+  bool sameRd = second.op0() == rd and second.op1() == rd;
+
+  switch (id1)
+    {
+    case InstId::lui:
+    case InstId::c_lui:
+      if (sameRd and (id2 == InstId::addi or id2 == InstId::c_addi))
+	return FusedOp::LuiAddi;
+      if (sameRd and isRv64() and
+	  (id2 == InstId::addiw or id2 == InstId::c_addiw))
+	return FusedOp::LuiAddiw;
+      return FusedOp::None;
+
+    case InstId::auipc:
+      if (sameRd and (id2 == InstId::addi or id2 == InstId::c_addi))
+	return FusedOp::AuipcAddi;
+      if (second.op1() == rd and (id2 == InstId::jalr or id2 == InstId::c_jr or
+				  id2 == InstId::c_jalr))
+	return FusedOp::AuipcJalr;
+      return FusedOp::None;
+
+    case InstId::slli:
+    case InstId::c_slli:
+      {
+	// Out of bounds shift amounts are illegal: do not fuse those.
+	uint32_t maxShift = isRv64() ? 63 : 31;
+	if (sameRd and (id2 == InstId::srli or id2 == InstId::c_srli) and
+	    first.op2() <= maxShift and second.op2() <= maxShift)
+	  return FusedOp::SlliSrli;
+      }
+      return FusedOp::None;
+
+    case InstId::slt:
+    case InstId::sltu:
+      if (second.op0() == rd and second.op1() == 0 and
+	  (id2 == InstId::beq or id2 == InstId::bne or
+	   id2 == InstId::c_beqz or id2 == InstId::c_bnez))
+	return FusedOp::SltBranch;
+      return FusedOp::None;
+
+    default:
+      return FusedOp::None;
+    }
+}
+
+
+template <typename URV>
+void
+Hart<URV>::fuseBlockInsts(BasicBlock<URV>& bb)
+{
+  auto& insts = bb.insts;
+  for (size_t i = 0; i + 1 < insts.size(); ++i)
+    {
+      FusedOp op = fusionKind(insts.at(i), insts.at(i+1));
+      insts.at(i).setFusedOp(op);
+      if (op != FusedOp::None)
+	++i;  // Second instruction of a pair cannot start another.
+    }
+}
+
+
+template <typename URV>
+void
+Hart<URV>::executeFused(const DecodedInst* di)
+{
+  const DecodedInst* next = di + 1;
+  uint32_t rd = di->op0();
+
+  // First instruction (or both for the purely arithmetic pairs).
+  switch (di->fusedOp())
+    {
+    case FusedOp::LuiAddi:
+      intRegs_.write(rd, SRV(int32_t(di->op1())) + SRV(next->op2AsInt()));
+      break;
+
+    case FusedOp::LuiAddiw:
+      intRegs_.write(rd, SRV(int32_t(di->op1() + next->op2())));
+      break;
+
+    case FusedOp::AuipcAddi:
+      intRegs_.write(rd, currPc_ + SRV(int32_t(di->op1())) +
+		     SRV(next->op2AsInt()));
+      break;
+
+    case FusedOp::SlliSrli:
+      intRegs_.write(rd, (intRegs_.read(di->op1()) << di->op2()) >> next->op2());
+      break;
+
+    case FusedOp::AuipcJalr:
+      execAuipc(di);
+      break;
+
+    case FusedOp::SltBranch:
+      if (di->instEntry()->instId() == InstId::slt)
+	execSlt(di);
+      else
+	execSltu(di);
+      break;
+
+    case FusedOp::None:
+      assert(0);
+      break;
+    }
+
+  currPc_ = pc_;
+  pc_ += next->instSize();
+
+  // Second instruction of control transfer pairs.
+  if (di->fusedOp() == FusedOp::AuipcJalr)
+    execJalr(next);
+  else if (di->fusedOp() == FusedOp::SltBranch)
+    {
+      InstId id = next->instEntry()->instId();
+      if (id == InstId::beq or id == InstId::c_beqz)
+	execBeq(next);
+      else
+	execBne(next);
+    }
+}
+
+
+template <typename URV>
+typename BasicBlock<URV>::ExecFn
+Hart<URV>::hotHandler(InstId id, bool& pure) const
+{
+  typedef Hart<URV> H;
+
+  pure = true;
+  switch (id)
+    {
+    case InstId::lui:
+    case InstId::c_lui:      return &H::execLui;
+    case InstId::addi:
+    case InstId::c_addi:
+    case InstId::c_li:
+    case InstId::c_addi16sp:
+    case InstId::c_addi4spn: return &H::execAddi;
+    case InstId::slti:       return &H::execSlti;
+    case InstId::sltiu:      return &H::execSltiu;
+    case InstId::xori:       return &H::execXori;
+    case InstId::ori:        return &H::execOri;
+    case InstId::andi:
+    case InstId::c_andi:     return &H::execAndi;
+    case InstId::add:
+    case InstId::c_add:
+    case InstId::c_mv:       return &H::execAdd;
+    case InstId::sub:
+    case InstId::c_sub:      return &H::execSub;
+    case InstId::sll:        return &H::execSll;
+    case InstId::slt:        return &H::execSlt;
+    case InstId::sltu:       return &H::execSltu;
+    case InstId::xor_:
+    case InstId::c_xor:      return &H::execXor;
+    case InstId::srl:        return &H::execSrl;
+    case InstId::sra:        return &H::execSra;
+    case InstId::or_:
+    case InstId::c_or:       return &H::execOr;
+    case InstId::and_:
+    case InstId::c_and:      return &H::execAnd;
+    default:                 break;
+    }
+
+  pure = false;
+  switch (id)
+    {
+    case InstId::auipc:      return &H::execAuipc;
+    case InstId::jal:
+    case InstId::c_jal:
+    case InstId::c_j:        return &H::execJal;
+    case InstId::jalr:
+    case InstId::c_jr:
+    case InstId::c_jalr:     return &H::execJalr;
+    case InstId::beq:
+    case InstId::c_beqz:     return &H::execBeq;
+    case InstId::bne:
+    case InstId::c_bnez:     return &H::execBne;
+    case InstId::blt:        return &H::execBlt;
+    case InstId::bge:        return &H::execBge;
+    case InstId::bltu:       return &H::execBltu;
+    case InstId::bgeu:       return &H::execBgeu;
+    case InstId::lb:         return &H::execLb;
+    case InstId::lh:         return &H::execLh;
+    case InstId::lw:
+    case InstId::c_lw:
+    case InstId::c_lwsp:     return &H::execLw;
+    case InstId::lbu:        return &H::execLbu;
+    case InstId::lhu:        return &H::execLhu;
+    case InstId::sb:         return &H::execSb;
+    case InstId::sh:         return &H::execSh;
+    case InstId::sw:
+    case InstId::c_sw:
+    case InstId::c_swsp:     return &H::execSw;
+    default:                 return &H::execute;
+    }
+}
+
+
+template <typename URV>
+void
+Hart<URV>::translateBlock(BasicBlock<URV>& bb)
+{
+  auto& ops = bb.hotOps;
+  ops.clear();
+  ops.reserve(bb.insts.size());
+
+  const DecodedInst* end = bb.insts.data() + bb.insts.size();
+  for (const DecodedInst* di = bb.insts.data(); di < end; ++di)
+    {
+      typename BasicBlock<URV>::HotOp op;
+      op.di = di;
+      op.nextPc = di->address() + di->instSize();
+      if (di->fusedOp() != FusedOp::None)
+	{
+	  op.fn = &Hart<URV>::executeFused;
+	  op.fused = true;
+	  ++di;
+	  op.nextPc += di->instSize();
+	}
+      else
+	op.fn = hotHandler(di->instEntry()->instId(), op.pure);
+      ops.push_back(op);
+    }
+
+#if defined(__EMSCRIPTEN__) or defined(X86_BLOCKS)
+  compileHotOps(bb);
 #endif
+}
 
-#ifndef DISABLE_EXCEPTIONS
-  try
+
+template <typename URV>
+void
+Hart<URV>::compileHotOps(BasicBlock<URV>& bb)
+{
+  typedef typename BasicBlock<URV>::HotOp HotOp;
+
+  // Code generator of this build.
+#ifdef __EMSCRIPTEN__
+  typedef WasmBlock CodeBlock;
+  uint32_t regsAddr = uint32_t(uintptr_t(intRegs_.regs_.data()));
+#else
+  typedef X86Block CodeBlock;
+  uintptr_t regsAddr = uintptr_t(intRegs_.regs_.data());
 #endif
-  {
-    while (userOk)
+
+  // Only runs of this many or more pure instructions are worth the
+  // cost of calling out of the interpreter.
+  constexpr unsigned minRun = 3;
+
+  std::vector<HotOp> ops;
+  auto& orig = bb.hotOps;
+  for (size_t i = 0; i < orig.size(); )
     {
-      currPc_ = pc_;
+      size_t j = i;
+      while (j < orig.size() and orig.at(j).pure and
+	     CodeBlock::isSupported(orig.at(j).di->instEntry()->instId()))
+	j++;
+
+      if (j - i < minRun)
+	{
+	  ops.push_back(orig.at(i));
+	  i++;
+	  continue;
+	}
+
+      // A block missing an instruction of the run would silently skip
+      // it: Compile all of the run or nothing.
+      CodeBlock block(sizeof(URV) == 8, regsAddr);
+      bool complete = true;
+      for (size_t k = i; k < j and complete; ++k)
+	complete = block.add(*orig.at(k).di);
+
+      uintptr_t compiled = 0;
+      if (complete)
+	{
+#ifdef __EMSCRIPTEN__
+	  std::vector<uint8_t> module = block.module();
+	  int slot = 0;
+	  if (not freeCompiled_.empty())
+	    {
+	      slot = int(freeCompiled_.back());
+	      freeCompiled_.pop_back();
+	    }
+	  compiled = jsCompileWasmBlock(module.data(), int(module.size()), slot);
+#elif defined(X86_BLOCKS)
+	  uintptr_t slot = 0;
+	  if (not freeCompiled_.empty())
+	    {
+	      slot = freeCompiled_.back();
+	      freeCompiled_.pop_back();
+	    }
+	  compiled = X86Block::install(block.code(), slot);
+#endif
+	}
+
+      if (compiled == 0)
+	{
+	  // Compilation not available, incomplete or failed: keep
+	  // interpreting.
+	  ops.insert(ops.end(), orig.begin() + i, orig.begin() + j);
+	  i = j;
+	  continue;
+	}
+
+      HotOp op = orig.at(i);
+      op.count = unsigned(j - i);
+      op.compiled = compiled;
+      ops.push_back(op);
+      i = j;
+    }
+
+  orig.swap(ops);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::runHotBlock(const BasicBlock<URV>& bb)
+{
+  // Pure operations are executed without updating the pc or the
+  // instruction counts. Pending counts are committed before any
+  // non-pure operation so that traps and csr instructions observe
+  // exact values.
+  uint64_t pending = 0;
+
+  for (const auto& op : bb.hotOps)
+    {
+      if (op.pure)
+	{
+#if defined(__EMSCRIPTEN__) or defined(X86_BLOCKS)
+	  if (op.compiled)
+	    reinterpret_cast<void (*)()>(op.compiled)();
+	  else
+#endif
+	    (this->*op.fn)(op.di);
+	  pending += op.count;
+	  continue;
+	}
+
+      cycleCount_ += pending;
+      instCounter_ += pending;
+      retiredInsts_ += pending;
+      pending = 0;
+
+      currPc_ = op.di->address();
+      pc_ = currPc_ + op.di->instSize();
       ++cycleCount_;
       ++instCounter_;
       hasException_ = false;
 
+      (this->*op.fn)(op.di);
+
+      if (hasException_)
+	{
+	  if (branchFile_)
+	    branchEvent(instCounter_, currPc_, pc_, BranchEvent::Exception);
+	  if (pcProfile_ or blockInstFreq_)
+	    unprofileBlockTail(bb, op.di + 1);
+	  if (blockInstFreq_)
+	    unprofileInst(*op.di);
+	  return;
+	}
+
+      if (op.fused)
+	{
+	  ++cycleCount_;
+	  ++instCounter_;
+	  ++retiredInsts_;
+	}
+      ++retiredInsts_;
+
+      if (pc_ != op.nextPc or blockCacheDirty_ or not userOk)
+	{
+	  if (branchFile_ and pc_ != op.nextPc)
+	    branchEvent(instCounter_, currPc_, pc_, BranchEvent::Jump);
+	  if (pcProfile_ or blockInstFreq_)
+	    unprofileBlockTail(bb, op.di + (op.fused ? 2 : 1));
+	  return;
+	}
+    }
+
+  if (pending)
+    {
+      // Block ended with pure operations: pc was not updated.
+      cycleCount_ += pending;
+      instCounter_ += pending;
+      retiredInsts_ += pending;
+      pc_ = bb.endAddress;
+    }
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::simpleRun(uint64_t limit, URV stop1, URV stop2)
+{
+  SELF_PROFILE_PHASE(Execute);
+  bool success = true;
+  trackLastWrite_ = false;  // No trace: Skip last-write info of stores.
+#ifdef __EMSCRIPTEN__
+  int simEnableInterrupt = jsInterruptEnabled();
+  bool replaying = inputLog_ and inputLog_->isReplaying();
+  bool pollInterrupts = ( simEnableInterrupt and
+			  (replaying or
+			   not jsWatchInterruptFlag(int(uintptr_t(&interruptPending_)))) );
+#endif
+
+    BasicBlock<URV>* prev = nullptr;
+
+    while (runOk() and instCounter_ < limit)
+    {
 #ifdef __EMSCRIPTEN__  
-      if(simEnableInterrupt){
+      if(simEnableInterrupt and interruptPending_){
+        interruptPending_ = pollInterrupts;
         InterruptCause cause;
         if (isInterruptPossible(cause))
         {
+          URV from = pc_;
           initiateInterrupt(cause, pc_);
           ++cycleCount_;
+          if (branchFile_)
+            branchEvent(instCounter_, from, pc_, BranchEvent::Interrupt);
         }
       }
 #endif
 
-      // Fetch/decode unless match in decode cache.
-      uint32_t ix = (pc_ >> 1) & decodeCacheMask_;
-      DecodedInst* di = &decodeCache_[ix];
-      if (not di->isValid() or di->address() != pc_)
+      if (instCounter_ >= nextSample_)
+        takeSample(instCounter_);
+
+      if (cycleCount_ >= nextEvent_.load(std::memory_order_relaxed) and
+          processEvents(instCounter_))
+        prev = nullptr;
+
+      // A store into cached code ends the current block: Modified
+      // blocks are detected (and rebuilt) using the code generation
+      // of their pages.
+      blockCacheDirty_ = false;
+      if (blockCache_.size() >= maxBlockCount_)
         {
-          uint32_t inst = 0;
-          if (not fetchInst(pc_, inst))
-            continue;
-          decode(pc_, inst, *di);
+          flushBlockCache();
+          prev = nullptr;
         }
 
-      // Execute.
-      pc_ += di->instSize();
-      execute(di);
+      // Follow the chain from the previous block if possible.
+      // Otherwise, look up/build block in block cache.
+      BasicBlock<URV>* bb = nullptr;
+      if (prev)
+        {
+          if (prev->succ[0] and prev->succAddr[0] == pc_)
+            bb = prev->succ[0];
+          else if (prev->succ[1] and prev->succAddr[1] == pc_)
+            bb = prev->succ[1];
+          if (bb and isBlockStale(*bb))
+            bb = nullptr;
+          SELF_PROFILE_COUNT(blockHits, bb != nullptr);
+        }
 
-      if (not hasException_)
-        ++retiredInsts_;
-    }
-  }
-#ifndef DISABLE_EXCEPTIONS
-  catch (const CoreException& ce)
-    {
-      success = logStop(ce, 0, nullptr);
+      if (not bb)
+        {
+          currPc_ = pc_;
+          hasException_ = false;
+          bb = getBasicBlock(pc_);
+          if (not bb)
+            {
+              // Fetch failed: Exception was initiated.
+              ++cycleCount_;
+              ++instCounter_;
+              if (branchFile_)
+                branchEvent(instCounter_, currPc_, pc_, BranchEvent::Exception);
+              prev = nullptr;
+              continue;
+            }
+          if (prev)
+            {
+              unsigned slot = (prev->endAddress == pc_) ? 0 : 1;
+              prev->succAddr[slot] = pc_;
+              prev->succ[slot] = bb;
+            }
+        }
+
+      // Do not enter a block holding a stop address: The caller
+      // steps to it.
+      uint64_t size = bb->endAddress - bb->address;
+      if (stop1 - bb->address < size or stop2 - bb->address < size)
+        break;
+
+      // Stop before a breakpoint unless resuming from it.
+      if (bb->insts.front().isBreakpoint() and instCounter_ != breakResume_)
+        {
+          breakResume_ = instCounter_;
+          stopReason_ = StopReason::Breakpoint;
+          stopPointAddr_ = pc_;
+          userOk = false;
+          break;
+        }
+
+      prev = bb;
+      ++bb->profileCount;
+
+      // The block crossing the instruction count limit is executed up
+      // to the limit: The limit is exact and only checked per block.
+      const DecodedInst* end = bb->insts.data() + bb->insts.size();
+      const DecodedInst* stop = end;
+      if (limit - instCounter_ < bb->insts.size())
+        stop = bb->insts.data() + (limit - instCounter_);
+
+      // Translate block once it is hot (and covered: translated
+      // blocks do not record coverage).
+      if (bb->hotOps.empty() and hotBlocks_ and
+          ++bb->execCount >= hotBlockThreshold_ and
+          (not coverage_ or bb->covered))
+        translateBlock(*bb);
+
+      if (not bb->hotOps.empty() and stop == end)
+        {
+          runHotBlock(*bb);
+          continue;
+        }
+
+      // Execute block. Stop early if an instruction changes the
+      // sequential flow (trap), writes into a cached block, or stops
+      // the run.
+      const DecodedInst* di = bb->insts.data();
+      for ( ; di < stop; ++di)
+        {
+          currPc_ = pc_;
+          ++cycleCount_;
+          ++instCounter_;
+          hasException_ = false;
+
+          URV nextPc = pc_ + di->instSize();
+          pc_ = nextPc;
+
+          if (di->fusedOp() == FusedOp::None or di + 1 == stop)
+            {
+              execute(di);
+              if (hasException_)
+                {
+                  if (branchFile_)
+                    branchEvent(instCounter_, currPc_, pc_,
+                                BranchEvent::Exception);
+                  if (blockInstFreq_)
+                    unprofileInst(*di);
+                  break;
+                }
+              ++retiredInsts_;
+            }
+          else
+            {
+              // Fused pair: Neither instruction can take an exception.
+              executeFused(di);
+              ++di;
+              nextPc += di->instSize();
+              ++cycleCount_;
+              ++instCounter_;
+              retiredInsts_ += 2;
+            }
+
+          if (pc_ != nextPc or blockCacheDirty_ or not userOk)
+            {
+              if (branchFile_ and pc_ != nextPc)
+                branchEvent(instCounter_, currPc_, pc_, BranchEvent::Jump);
+              break;
+            }
+        }
+
+      // Instructions up to di executed (di took a trap or ended the
+      // block) or all those before stop.
+      const DecodedInst* last = di < stop ? di + (hasException_ ? 0 : 1) : stop;
+
+      if ((pcProfile_ or blockInstFreq_) and last < end)
+        unprofileBlockTail(*bb, di < stop ? di + 1 : stop);
+
+      if (coverage_ and not bb->covered)
+        {
+          for (const DecodedInst* p = bb->insts.data(); p < last; ++p)
+            coverage_->markExecuted(p->address());
+          bb->covered = last == end;
+        }
     }
-    else
+
+  trackLastWrite_ = true;
+  restoreHostRoundingMode();
+  return logStop(success);
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::gdbRun(URV address)
+{
+  handleExceptionForGdb(*this);
+
+  bool success = simpleRun(instCountLim_, address);
+  while (success and stopReason_ != StopReason::None and
+	 kbdInterrupts == kbdInterruptsAtStart)
     {
-      success = false;
-      std::cerr << "Stopped -- unexpected exception\n";
+      flushTargetOutput();
+      handleExceptionForGdb(*this);
+      stopReason_ = StopReason::None;
+      userOk = true;
+      success = simpleRun(instCountLim_, address);
     }
-  }
-#endif
 
   return success;
 }
@@ -3461,33 +6074,41 @@ bool
 Hart<URV>::run(FILE* file)
 {
   // If test has toHost defined then use that as the stopping criteria
-  // and ignore the stop address. Not having to check for the stop
-  // address gives us about an 10 percent boost in speed.
+  // and ignore the stop address.
+  URV address = ~URV(0);  // No-stop PC.
   if (stopAddrValid_ and not toHostValid_)
-    return runUntilAddress(stopAddr_, file);
+    address = stopAddr_;
 
   // To run fast, this method does not do much besides
   // straight-forward execution. If any option is turned on, we switch
-  // to runUntilAdress which supports all features.
+  // to runUntilAdress which uses a run loop specialized for the enabled
+  // options. The stop address and the instruction count limit are
+  // checked per basic block.
   bool hasWideLdSt = csRegs_.getImplementedCsr(CsrNumber::MDBAC) != nullptr;
-  bool complex = ( file or instCountLim_ < ~uint64_t(0) or instFreq_ or
-		   enableTriggers_ or enableCounters_ or enableGdb_ or
-		   hasWideLdSt );
+  bool complex = complexRunFeatures(address, file) != 0 or hasWideLdSt;
   if (complex)
-    return runUntilAddress(~URV(0), file); // ~URV(0): No-stop PC.
+    return runUntilAddress(address, file);
 
   uint64_t counter0 = instCounter_;
 
   struct timeval t0;
   gettimeofday(&t0, nullptr);
   userOk = true;
+  stopReason_ = StopReason::None;
+  kbdInterruptsAtStart = kbdInterrupts;
+
+  if (branchFile_)
+    branchEvent(instCounter_, pc_, pc_, BranchEvent::Start);
 
 #ifdef __MINGW64__
   __p_sig_fn_t oldAction = nullptr;
   __p_sig_fn_t newAction = keyboardInterruptHandler;
 
   oldAction = signal(SIGINT, newAction);
-  bool success = simpleRun();
+  outputBuffering_ = true;
+  bool success = ( enableGdb_ ? gdbRun(address) :
+		   simpleRun(instCountLim_, address) );
+  outputBuffering_ = false;
   signal(SIGINT, oldAction);
 #else
   struct sigaction oldAction;
@@ -3496,10 +6117,28 @@ Hart<URV>::run(FILE* file)
   newAction.sa_handler = keyboardInterruptHandler;
 
   sigaction(SIGINT, &newAction, &oldAction);
-  bool success = simpleRun();
+  outputBuffering_ = true;
+  bool success = ( enableGdb_ ? gdbRun(address) :
+		   simpleRun(instCountLim_, address) );
+  outputBuffering_ = false;
   sigaction(SIGINT, &oldAction, nullptr);
 #endif
 
+  flushTargetOutput();
+
+  if (branchFile_)
+    {
+      branchEvent(instCounter_, pc_, pc_, BranchEvent::Stop);
+      flushBranchTrace();
+    }
+
+  if (reportStopPoint())
+    ;
+  else if (instCounter_ == instCountLim_)
+    std::cerr << "Stopped -- Reached instruction limit\n";
+  else if (pc_ == address)
+    std::cerr << "Stopped -- Reached end address\n";
+
   // Simulator stats.
   struct timeval t1;
   gettimeofday(&t1, nullptr);
@@ -3507,11 +6146,166 @@ Hart<URV>::run(FILE* file)
                     double(t1.tv_usec - t0.tv_usec)*1e-6);
 
   uint64_t numInsts = instCounter_ - counter0;
-  reportInstsPerSec(numInsts, elapsed, not userOk);
+  runInsts_ += numInsts;
+  runTime_ += elapsed;
+  bool kbdInterrupt = kbdInterrupts != kbdInterruptsAtStart;
+  reportInstsPerSec(numInsts, elapsed, kbdInterrupt);
+#ifdef SELF_PROFILE
+  {
+    std::lock_guard<std::mutex> guard(stderrMutex);
+    selfProfile_.print(std::cerr, localHartId_);
+  }
+#endif
   return success;
 }
 
 
+template <typename URV>
+typename Hart<URV>::SliceStatus
+Hart<URV>::runSlice(uint64_t maxInsts, FILE* file)
+{
+  if (targetProgFinished_ or instCounter_ >= instCountLim_)
+    return SliceStatus::Stopped;
+
+  uint64_t limit = instCounter_ + std::min(maxInsts, ~instCounter_);
+  limit = std::min(limit, instCountLim_);
+
+  URV address = ~URV(0);
+  if (stopAddrValid_ and not toHostValid_)
+    address = stopAddr_;
+
+  userOk = true;
+  stopReason_ = StopReason::None;
+  kbdInterruptsAtStart = kbdInterrupts;
+
+  // Same choice of run loop as the run method. The slice budget is
+  // imposed on the untilAddress loop as an instruction count limit.
+  bool hasWideLdSt = csRegs_.getImplementedCsr(CsrNumber::MDBAC) != nullptr;
+  bool complex = ( complexRunFeatures(address, file) != 0 or enableGdb_ or
+		   hasWideLdSt );
+  bool success = true;
+  outputBuffering_ = true;
+  if (complex)
+    {
+      uint64_t prevLim = instCountLim_;
+      instCountLim_ = limit;
+      success = untilAddress(address, file);
+      instCountLim_ = prevLim;
+    }
+  else
+    {
+      if (branchFile_)
+	branchEvent(instCounter_, pc_, pc_, BranchEvent::Start);
+      success = simpleRun(limit, address);
+      if (branchFile_)
+	{
+	  branchEvent(instCounter_, pc_, pc_, BranchEvent::Stop);
+	  flushBranchTrace();
+	}
+    }
+  outputBuffering_ = false;
+
+  // Target output of the slice is delivered in one piece. In the
+  // browser build, so is the trace (see JsTraceStream).
+  flushTargetOutput();
+#ifdef __EMSCRIPTEN__
+  if (file)
+    fflush(file);
+#endif
+
+  if (not success)
+    return SliceStatus::Failed;
+
+  if (targetProgFinished_ or not runOk() or pc_ == address or
+      instCounter_ >= instCountLim_)
+    return SliceStatus::Stopped;
+
+  return SliceStatus::Yield;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::attachClint(Clint* clint, unsigned hartIx)
+{
+  clint_ = clint;
+  clintIx_ = hartIx;
+  if (clint)
+    clint->attach(hartIx, &nextEvent_);
+  eventInterrupts_ = clint or not events_.empty();
+  interruptEnablesChanged();
+}
+
+
+template <typename URV>
+void
+Hart<URV>::scheduleInterrupt(uint64_t cycle, InterruptCause cause, bool pending)
+{
+  events_.schedule(cycle, [this, cause, pending] (uint64_t) {
+		     URV mip = 0, bit = URV(1) << unsigned(cause);
+		     csRegs_.peek(CsrNumber::MIP, mip);
+		     csRegs_.poke(CsrNumber::MIP, pending ? mip | bit : mip & ~bit);
+		   });
+  eventInterrupts_ = true;
+  if (cycle < nextEvent_.load(std::memory_order_relaxed))
+    nextEvent_.store(cycle, std::memory_order_relaxed);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::runEvents()
+{
+  // A clint write by another hart from now on clears nextEvent_ and
+  // defeats the compare-exchange below: No wake up is lost.
+  nextEvent_.store(~uint64_t(0), std::memory_order_relaxed);
+
+  events_.runDue(cycleCount_);
+  uint64_t next = events_.nextTime();
+
+  if (clint_)
+    {
+      uint64_t cmp = clint_->mtimecmp(clintIx_);
+      bool timer = cycleCount_ >= cmp;
+      if (not timer)
+	next = std::min(next, cmp);
+
+      URV mip = 0;
+      csRegs_.peek(CsrNumber::MIP, mip);
+      URV timerBit = URV(1) << unsigned(InterruptCause::M_TIMER);
+      URV softBit = URV(1) << unsigned(InterruptCause::M_SOFTWARE);
+      URV newMip = mip & ~(timerBit | softBit);
+      if (timer)
+	newMip |= timerBit;
+      if (clint_->msip(clintIx_))
+	newMip |= softBit;
+      if (newMip != mip)
+	csRegs_.poke(CsrNumber::MIP, newMip);
+    }
+
+  uint64_t expected = ~uint64_t(0);
+  nextEvent_.compare_exchange_strong(expected, next, std::memory_order_acquire);
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::processEvents(uint64_t count)
+{
+  runEvents();
+
+  InterruptCause cause;
+  if (not isInterruptPossible(cause))
+    return false;
+
+  URV from = pc_;
+  initiateInterrupt(cause, pc_);
+  if (branchFile_)
+    branchEvent(count, from, pc_, BranchEvent::Interrupt);
+  return true;
+}
+
+
 template <typename URV>
 bool
 Hart<URV>::isInterruptPossible(InterruptCause& cause)
@@ -3536,9 +6330,21 @@ Hart<URV>::isInterruptPossible(InterruptCause& cause)
     {
 
 #ifdef __EMSCRIPTEN__
-      if((mie & (1 << unsigned(InterruptCause::M_EXTERNAL))) && jsExternalInterrupt()){
-        mip |= (1 << unsigned(InterruptCause::M_EXTERNAL));
-      }
+      if (mie & (1 << unsigned(InterruptCause::M_EXTERNAL)))
+        {
+          // A replayed run polls the interrupts before each instruction
+          // and finds the line high at the recorded counts.
+          bool high = false;
+          if (inputLog_ and inputLog_->isReplaying())
+            high = inputLog_->replayInterrupt(localHartId_, retiredInsts_);
+          else
+            high = jsExternalInterrupt();
+          if (high and inputLog_ and inputLog_->isRecording())
+            inputLog_->record(localHartId_, InputLog::Kind::Interrupt,
+                              retiredInsts_, 1);
+          if (high)
+            mip |= (1 << unsigned(InterruptCause::M_EXTERNAL));
+        }
 #endif
       if ((mie & mip) == 0)
         return false;  // Nothing enabled is pending.
@@ -3618,6 +6424,97 @@ Hart<URV>::processExternalInterrupt(FILE* traceFile, std::string& instStr)
 }
 
 
+template <typename URV>
+void
+Hart<URV>::setDecodeCacheSize(uint64_t size)
+{
+  decodeCacheFromElf_ = size == 0;
+  if (decodeCacheFromElf_)
+    size = memory_.elfCodeSize() / 2;
+  resizeDecodeCache(size);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::preDecode(unsigned threadCount)
+{
+  if (decodeCache_.empty())
+    decodeCache_.resize(decodeCacheSize_);
+
+  // Collect instruction addresses: Code is swept serially (only the
+  // first halfword of an instruction is needed to get its size).
+  std::vector<URV> addrs;
+  for (const auto& seg : memory_.elfCodeSegments())
+    {
+      size_t addr = seg.first, end = seg.first + seg.second;
+      addr = (addr + 1) & ~size_t(1);
+      uint16_t half = 0;
+      while (addr < end and memory_.readInstHalfWord(addr, half))
+	{
+	  addrs.push_back(URV(addr));
+	  addr += isCompressedInst(half) ? 2 : 4;
+	}
+      if (seg.second)
+	memory_.markCode(seg.first, end - 1);
+    }
+
+#ifdef __EMSCRIPTEN__
+  threadCount = 1;
+#endif
+  threadCount = std::max(threadCount, 1u);
+
+  // Thread i fills the ith slice of the cache. Within a slice, later
+  // addresses override earlier ones as in a serial fill.
+  auto work = [this, &addrs, threadCount] (unsigned ix) {
+    uint32_t sliceSize = (decodeCacheSize_ + threadCount - 1) / threadCount;
+    uint32_t low = ix*sliceSize, high = low + sliceSize;
+    for (URV addr : addrs)
+      {
+	uint32_t slot = (addr >> 1) & decodeCacheMask_;
+	if (slot < low or slot >= high)
+	  continue;
+	uint32_t inst = 0;
+	if (not memory_.readInstWord(addr, inst))
+	  {
+	    uint16_t half = 0;
+	    if (not memory_.readInstHalfWord(addr, half) or
+		not isCompressedInst(half))
+	      continue;
+	    inst = half;
+	  }
+	decode(addr, inst, decodeCache_[slot]);
+      }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < threadCount; ++i)
+    threads.emplace_back(work, i);
+  work(0);
+  for (auto& t : threads)
+    t.join();
+}
+
+
+template <typename URV>
+void
+Hart<URV>::resizeDecodeCache(uint64_t size)
+{
+  const uint64_t minSize = 1024, maxSize = uint64_t(4)*1024*1024;
+  size = std::min(std::max(size, minSize), maxSize);
+
+  uint32_t entries = minSize;
+  while (entries < size)
+    entries <<= 1;
+
+  decodeCacheSize_ = entries;
+  decodeCacheMask_ = entries - 1;
+
+  // Release current cache: Re-allocated (with new size) on demand.
+  std::vector<DecodedInst>().swap(decodeCache_);
+}
+
+
 template <typename URV>
 void
 Hart<URV>::invalidateDecodeCache(URV addr, unsigned storeSize)
@@ -3631,13 +6528,69 @@ Hart<URV>::invalidateDecodeCache(URV addr, unsigned storeSize)
   storeSize += 1;
   addr -= 1;
 
+  // Only stores into lines holding cached decoded instructions pay
+  // for the invalidation. Bumping the code generation of the written
+  // pages invalidates the basic blocks of all the harts.
+  URV first = (addr + 1 == 0) ? 0 : addr;
+  URV last = addr + storeSize - 1;
+  if (not memory_.isCodeWrite(first, last))
+    return;
+  memory_.bumpCodeGeneration(first, last, &codeEpochSeen_);
+  blockCacheDirty_ = true;
+  SELF_PROFILE_COUNT(codeWrites, 1);
+
+  if (decodeCache_.empty())
+    return;
+
   for (unsigned i = 0; i < storeSize; i += 2)
     {
       URV instAddr = (addr + i) >> 1;
       uint32_t cacheIx = instAddr & decodeCacheMask_;
       auto& entry = decodeCache_[cacheIx];
       if ((entry.address() >> 1) == instAddr)
-        entry.invalidate();
+        {
+          entry.invalidate();
+          SELF_PROFILE_COUNT(invalidations, 1);
+        }
+    }
+}
+
+
+template <typename URV>
+void
+Hart<URV>::syncDecodeCache()
+{
+  codeWritePages_.clear();
+  bool known = memory_.codeWritesSince(codeEpochSeen_, codeWritePages_);
+
+  // Basic blocks check the code generation of their pages on entry.
+  blockCacheDirty_ = true;
+  SELF_PROFILE_COUNT(cacheSyncs, 1);
+
+  if (decodeCache_.empty())
+    return;
+
+  if (not known)
+    {
+      for (auto& entry : decodeCache_)
+	entry.invalidate();
+      return;
+    }
+
+  size_t pageSize = memory_.pageSize();
+  for (size_t ix : codeWritePages_)
+    {
+      size_t pageAddr = ix * pageSize;
+      for (size_t offset = 0; offset < pageSize; offset += 2)
+	{
+	  URV instAddr = URV(pageAddr + offset) >> 1;
+	  auto& entry = decodeCache_[instAddr & decodeCacheMask_];
+	  if ((entry.address() >> 1) == instAddr)
+	    {
+	      entry.invalidate();
+	      SELF_PROFILE_COUNT(invalidations, 1);
+	    }
+	}
     }
 }
 
@@ -3646,15 +6599,24 @@ template <typename URV>
 void
 Hart<URV>::singleStep(FILE* traceFile)
 {
+  if (undoLogActive_)
+    {
+      // Record the previous values of the registers this instruction
+      // changes: memory is recorded by the memory write journal.
+      undoLogActive_ = false;
+      clearTraceData();
+      singleStep(traceFile);
+      recordUndoEntries(false);
+      undoLogActive_ = true;
+      return;
+    }
+
   std::string instStr;
 
   // Single step is mostly used for follow-me mode where we want to
   // know the changes after the execution of each instruction.
-  bool doStats = instFreq_ or enableCounters_;
+  bool doStats = instFreq_ or enableCounters_ or timingModel_;
 
-#ifndef DISABLE_EXCEPTIONS
-  try
-#endif
     {
       uint32_t inst = 0;
       currPc_ = pc_;
@@ -3666,6 +6628,9 @@ Hart<URV>::singleStep(FILE* traceFile)
 
       ++instCounter_;
 
+      if (cycleCount_ >= nextEvent_.load(std::memory_order_relaxed))
+        runEvents();
+
       if (processExternalInterrupt(traceFile, instStr))
         return;  // Next instruction in interrupt handler.
 
@@ -3689,8 +6654,7 @@ Hart<URV>::singleStep(FILE* traceFile)
       if (not fetchOk)
 	{
 	  ++cycleCount_;
-	  if (traceFile)
-	    printInstTrace(inst, instCounter_, instStr, traceFile);
+	  traceInst(inst, instCounter_, instStr, traceFile);
 	  if (dcsrStep_)
 	    enterDebugMode(DebugModeCause::STEP, pc_);
 	  return; // Next instruction in trap handler
@@ -3712,6 +6676,10 @@ Hart<URV>::singleStep(FILE* traceFile)
 
       ++cycleCount_;
 
+      bool traceStart = false;
+      if (csRegs_.takeTraceTriggerAction(traceStart))
+	traceOn_ = traceStart;
+
       // A ld/st must be seen within 2 steps of a forced access fault.
       if (forceAccessFail_ and (instCounter_ > forceAccessFailMark_ + 1))
 	{
@@ -3723,8 +6691,7 @@ Hart<URV>::singleStep(FILE* traceFile)
 	{
 	  if (doStats)
 	    accumulateInstructionStats(di);
-	  if (traceFile)
-	    printInstTrace(inst, instCounter_, instStr, traceFile);
+	  traceInst(inst, instCounter_, instStr, traceFile);
 	  if (dcsrStep_ and not ebreakInstDebug_)
 	    enterDebugMode(DebugModeCause::STEP, pc_);
 	  return;
@@ -3746,8 +6713,7 @@ Hart<URV>::singleStep(FILE* traceFile)
       if (doStats)
         accumulateInstructionStats(di);
 
-      if (traceFile)
-	printInstTrace(inst, instCounter_, instStr, traceFile);
+      traceInst(inst, instCounter_, instStr, traceFile);
 
       // If a register is used as a source by an instruction then any
       // pending load with same register as target is removed from the
@@ -3783,12 +6749,10 @@ Hart<URV>::singleStep(FILE* traceFile)
       if (dcsrStep_ and not ebreakInstDebug_)
         enterDebugMode(DebugModeCause::STEP, pc_);
     }
-#ifndef DISABLE_EXCEPTIONS
-  catch (const CoreException& ce)
-    {
-      logStop(ce, instCounter_, traceFile);
-    }
-#endif
+
+  // Report a stop of the target program. A stop pending after an
+  // early return (trigger hit) is reported by the next step.
+  logStop(true);
 }
 
 
@@ -3806,8 +6770,10 @@ template <typename URV>
 bool
 Hart<URV>::whatIfSingleStep(uint32_t inst, ChangeRecord& record)
 {
+  UndoBase base;
+  saveUndoBase(base);
+  size_t mark = undoLog_.size();
   uint64_t prevExceptionCount = exceptionCount_;
-  URV prevPc = pc_;
 
   clearTraceData();
   triggerTripped_ = false;
@@ -3828,10 +6794,8 @@ Hart<URV>::whatIfSingleStep(uint32_t inst, ChangeRecord& record)
     enterDebugMode(DebugModeCause::STEP, pc_);
 
   // Collect changes. Undo each collected change.
-  exceptionCount_ = prevExceptionCount;
+  collectAndUndoWhatIfChanges(mark, base, record);
 
-  collectAndUndoWhatIfChanges(prevPc, record);
-  
   return result;
 }
 
@@ -3840,10 +6804,14 @@ template <typename URV>
 bool
 Hart<URV>::whatIfSingleStep(URV whatIfPc, uint32_t inst, ChangeRecord& record)
 {
-  URV prevPc = pc_;
+  UndoBase base;
+  saveUndoBase(base);
+  size_t mark = undoLog_.size();
+
   pc_ = whatIfPc;
 
   // Note: triggers not yet supported.
+  clearTraceData();
   triggerTripped_ = false;
 
   // Fetch instruction. We don't care about what we fetch. Just checking
@@ -3853,13 +6821,13 @@ Hart<URV>::whatIfSingleStep(URV whatIfPc, uint32_t inst, ChangeRecord& record)
 
   if (not fetchOk)
     {
-      collectAndUndoWhatIfChanges(prevPc, record);
+      collectAndUndoWhatIfChanges(mark, base, record);
       return false;
     }
 
   bool res = whatIfSingleStep(inst, record);
 
-  pc_ = prevPc;
+  restoreUndoBase(base);
   return res;
 }
 
@@ -3869,8 +6837,10 @@ bool
 Hart<URV>::whatIfSingStep(const DecodedInst& di, ChangeRecord& record)
 {
   clearTraceData();
+  UndoBase base;
+  saveUndoBase(base);
+  size_t mark = undoLog_.size();
   uint64_t prevExceptionCount = exceptionCount_;
-  URV prevPc  = pc_, prevCurrPc = currPc_;
 
   currPc_ = pc_ = di.address();
 
@@ -3933,8 +6903,7 @@ Hart<URV>::whatIfSingStep(const DecodedInst& di, ChangeRecord& record)
   bool result = exceptionCount_ == prevExceptionCount;
 
   // Collect changes. Undo each collected change.
-  exceptionCount_ = prevExceptionCount;
-  collectAndUndoWhatIfChanges(prevPc, record);
+  collectAndUndoWhatIfChanges(mark, base, record);
 
   // Restore temporarily modified registers.
   for (unsigned i = 0; i < 4; ++i)
@@ -3958,79 +6927,61 @@ Hart<URV>::whatIfSingStep(const DecodedInst& di, ChangeRecord& record)
         }
     }
 
-  pc_ = prevPc;
-  currPc_ = prevCurrPc;
-
   return result;
 }
 
 
 template <typename URV>
 void
-Hart<URV>::collectAndUndoWhatIfChanges(URV prevPc, ChangeRecord& record)
+Hart<URV>::collectAndUndoWhatIfChanges(size_t mark, const UndoBase& base,
+				       ChangeRecord& record)
 {
-  record.clear();
+  using Kind = typename UndoEntry::Kind;
 
+  record.clear();
   record.newPc = pc_;
-  pc_ = prevPc;
-
-  unsigned regIx = 0;
-  URV oldValue = 0;
-  if (intRegs_.getLastWrittenReg(regIx, oldValue))
-    {
-      URV newValue = 0;
-      peekIntReg(regIx, newValue);
-      pokeIntReg(regIx, oldValue);
-
-      record.hasIntReg = true;
-      record.intRegIx = regIx;
-      record.intRegValue = newValue;
-    }
-
-  uint64_t oldFpValue = 0;
-  if (fpRegs_.getLastWrittenReg(regIx, oldFpValue))
-    {
-      uint64_t newFpValue = 0;
-      peekFpReg(regIx, newFpValue);
-      pokeFpReg(regIx, oldFpValue);
-
-      record.hasFpReg = true;
-      record.fpRegIx = regIx;
-      record.fpRegValue = newFpValue;
-    }
 
+  recordUndoEntries();
   record.memSize = memory_.getLastWriteNewValue(localHartId_, record.memAddr,
                                                 record.memValue);
 
-  size_t addr = 0;
-  uint64_t value = 0;
-  size_t byteCount = memory_.getLastWriteOldValue(addr, value);
-  for (size_t i = 0; i < byteCount; ++i)
+  for (size_t i = mark; i < undoLog_.size(); ++i)
     {
-      uint8_t byte = value & 0xff;
-      memory_.poke(addr, byte);
-      addr++;
-      value = value >> 8;
-    }
-
-  std::vector<CsrNumber> csrNums;
-  std::vector<unsigned> triggerNums;
-  csRegs_.getLastWrittenRegs(csrNums, triggerNums);
+      const auto& entry = undoLog_[i];
+      unsigned ix = entry.addr;
+      switch (entry.kind)
+	{
+	case Kind::IntReg:
+	  {
+	    URV newValue = 0;
+	    peekIntReg(ix, newValue);
+	    record.hasIntReg = true;
+	    record.intRegIx = ix;
+	    record.intRegValue = newValue;
+	  }
+	  break;
 
-  for (auto csrn : csrNums)
-    {
-      Csr<URV>* csr = csRegs_.getImplementedCsr(csrn);
-      if (not csr)
-        continue;
+	case Kind::FpReg:
+	  record.hasFpReg = true;
+	  record.fpRegIx = ix;
+	  peekFpReg(ix, record.fpRegValue);
+	  break;
 
-      URV newVal = csr->read();
-      URV oldVal = csr->prevValue();
-      csr->write(oldVal);
+	case Kind::Csr:
+	  {
+	    const Csr<URV>* csr = csRegs_.getImplementedCsr(CsrNumber(ix));
+	    record.csrIx.push_back(CsrNumber(ix));
+	    record.csrValue.push_back(csr->read());
+	  }
+	  break;
 
-      record.csrIx.push_back(csrn);
-      record.csrValue.push_back(newVal);
+	case Kind::Mem:
+	  break;
+	}
     }
 
+  undoEntries(mark);
+  restoreUndoBase(base);
   clearTraceData();
 }
 
@@ -4941,6 +7892,7 @@ Hart<URV>::execute(const DecodedInst* di)
   return;
 
  wfi:
+  execWfi(di);
   return;
 
  c_addi4spn:
@@ -5243,24 +8195,15 @@ Hart<URV>::execute(const DecodedInst* di)
 
 template <typename URV>
 void
-Hart<URV>::enableInstructionFrequency(bool b)
+Hart<URV>::enableInstructionFrequency(bool b, unsigned parts)
 {
+  // Fold the counts of the cached blocks collected so far.
+  flushBlockCache();
+
   instFreq_ = b;
+  blockInstFreq_ = b and parts == InstProfile::Opcodes;
   if (b)
-    {
-      instProfileVec_.resize(size_t(InstId::maxId) + 1);
-
-      auto regCount = intRegCount();
-      for (auto& inst : instProfileVec_)
-        {
-          inst.rd_.resize(regCount);
-          inst.rs1_.resize(regCount);
-          inst.rs2_.resize(regCount);
-          inst.rs1Histo_.resize(13);  // FIX: avoid magic 13
-          inst.rs2Histo_.resize(13);  // FIX: avoid magic 13
-          inst.immHisto_.resize(13);  // FIX: avoid magic 13
-        }
-    }
+    instProfile_.reset(size_t(InstId::maxId) + 1, parts);
 }
 
 
@@ -5367,12 +8310,14 @@ void
 Hart<URV>::execBlt(const DecodedInst* di)
 {
   SRV v1 = intRegs_.read(di->op0()),  v2 = intRegs_.read(di->op1());
-  if (v1 < v2)
+  bool taken = v1 < v2;
+  if (taken)
     {
       pc_ = currPc_ + SRV(di->op2AsInt());
       pc_ = (pc_ >> 1) << 1;  // Clear least sig bit.
       lastBranchTaken_ = true;
     }
+  coverBranch(taken);
 }
 
 
@@ -5381,12 +8326,14 @@ void
 Hart<URV>::execBltu(const DecodedInst* di)
 {
   URV v1 = intRegs_.read(di->op0()),  v2 = intRegs_.read(di->op1());
-  if (v1 < v2)
+  bool taken = v1 < v2;
+  if (taken)
     {
       pc_ = currPc_ + SRV(di->op2AsInt());
       pc_ = (pc_ >> 1) << 1;  // Clear least sig bit.
       lastBranchTaken_ = true;
     }
+  coverBranch(taken);
 }
 
 
@@ -5395,12 +8342,14 @@ void
 Hart<URV>::execBge(const DecodedInst* di)
 {
   SRV v1 = intRegs_.read(di->op0()),  v2 = intRegs_.read(di->op1());
-  if (v1 >= v2)
+  bool taken = v1 >= v2;
+  if (taken)
     {
       pc_ = currPc_ + SRV(di->op2AsInt());
       pc_ = (pc_ >> 1) << 1;  // Clear least sig bit.
       lastBranchTaken_ = true;
     }
+  coverBranch(taken);
 }
 
 
@@ -5409,12 +8358,14 @@ void
 Hart<URV>::execBgeu(const DecodedInst* di)
 {
   URV v1 = intRegs_.read(di->op0()),  v2 = intRegs_.read(di->op1());
-  if (v1 >= v2)
+  bool taken = v1 >= v2;
+  if (taken)
     {
       pc_ = currPc_ + SRV(di->op2AsInt());
       pc_ = (pc_ >> 1) << 1;  // Clear least sig bit.
       lastBranchTaken_ = true;
     }
+  coverBranch(taken);
 }
 
 
@@ -5427,6 +8378,24 @@ Hart<URV>::execJalr(const DecodedInst* di)
   pc_ = (pc_ >> 1) << 1;  // Clear least sig bit.
   intRegs_.write(di->op0(), temp);
   lastBranchTaken_ = true;
+
+  if (callGraph_)
+    callProfileJalr(di, temp);
+}
+
+
+template <typename URV>
+void
+Hart<URV>::callProfileJalr(const DecodedInst* di, URV retAddr)
+{
+  // Calls link through x1 or x5 (rd), returns jump through them (rs1).
+  auto isLink = [] (unsigned reg) {
+    return reg == IntRegNumber::RegRa or reg == IntRegNumber::RegT0; };
+
+  if (isLink(di->op0()))
+    callProfile_.call(currPc_, pc_, retAddr, retiredInsts_ + 1, cycleCount_);
+  else if (isLink(di->op1()))
+    callProfile_.ret(pc_, retiredInsts_ + 1, cycleCount_);
 }
 
 
@@ -5434,10 +8403,15 @@ template <typename URV>
 void
 Hart<URV>::execJal(const DecodedInst* di)
 {
+  URV retAddr = pc_;
   intRegs_.write(di->op0(), pc_);
   pc_ = currPc_ + SRV(int32_t(di->op1()));
   pc_ = (pc_ >> 1) << 1;  // Clear least sig bit.
   lastBranchTaken_ = true;
+
+  if (callGraph_ and (di->op0() == IntRegNumber::RegRa or
+		      di->op0() == IntRegNumber::RegT0))
+    callProfile_.call(currPc_, pc_, retAddr, retiredInsts_ + 1, cycleCount_);
 }
 
 
@@ -5657,7 +8631,8 @@ template <typename URV>
 void
 Hart<URV>::execFencei(const DecodedInst*)
 {
-  return;  // Currently a no-op.
+  // Make visible the code written by other harts.
+  checkCodeWrites();
 }
 
 
@@ -5736,9 +8711,13 @@ Hart<URV>::amoLoad32(uint32_t rs1, URV& value)
       return false;
     }
 
+  // A fault forced by the test-bench traps before any access.
   auto cause2 = SecondaryCause::NONE;
   if (forceAccessFail_)
-    initiateLoadException(ExceptionCause::STORE_ACC_FAULT, addr, cause2);
+    {
+      initiateLoadException(ExceptionCause::STORE_ACC_FAULT, addr, cause2);
+      return false;
+    }
 
   uint32_t uval = 0;
   if (memory_.read(addr, uval))
@@ -5773,6 +8752,14 @@ Hart<URV>::amoLoad64(uint32_t rs1, URV& value)
       return false;
     }
 
+  // A fault forced by the test-bench traps before any access.
+  if (forceAccessFail_)
+    {
+      auto cause2 = SecondaryCause::NONE;
+      initiateLoadException(ExceptionCause::STORE_ACC_FAULT, addr, cause2);
+      return false;
+    }
+
   uint64_t uval = 0;
   if (memory_.read(addr, uval))
     {
@@ -5786,6 +8773,118 @@ Hart<URV>::amoLoad64(uint32_t rs1, URV& value)
 }
 
 
+template <typename URV>
+template <typename LOAD_TYPE, typename OP>
+void
+Hart<URV>::amoExecute(const DecodedInst* di, OP op)
+{
+  // There is no double-word AMO in rv32.
+  if constexpr (sizeof(LOAD_TYPE) > sizeof(URV))
+    {
+      illegalInst();
+      return;
+    }
+
+  uint32_t rs1 = di->op1();
+  URV addr = intRegs_.read(rs1);
+  URV rs2Val = intRegs_.read(di->op2());
+
+  // With multiple harts, every AMO to plain memory is done with a
+  // host compare-and-swap on the backing storage whatever the state of
+  // the software TLB, of the triggers or of the wide accesses of the
+  // hart (forced access faults trap before any access): All the harts
+  // then use the same protocol for a given word. Other AMOs (memory
+  // mapped registers, watched pages, to-host) are serialized using the
+  // memory AMO mutex. A single hart needs neither.
+  bool multi = memory_.hartCount() > 1;
+  bool lockFree = multi and isAmoCasAddr(addr, sizeof(LOAD_TYPE));
+
+  std::unique_lock<std::mutex> lock(memory_.amoMutex_, std::defer_lock);
+  if (multi and not lockFree)
+    lock.lock();
+
+  URV loadedValue = 0;
+  bool loadOk = false;
+  if constexpr (sizeof(LOAD_TYPE) == 4)
+    loadOk = amoLoad32(rs1, loadedValue);
+  else
+    loadOk = amoLoad64(rs1, loadedValue);
+  if (not loadOk)
+    return;
+
+  // Sign extend loaded value to register width.
+  auto extend = [] (LOAD_TYPE x) -> URV {
+    return SRV(typename std::make_signed<LOAD_TYPE>::type(x)); };
+
+  URV rdVal = loadedValue;
+  bool storeOk = false;
+
+  if (lockFree)
+    {
+      // Store triggers (the access checks of the store were done by
+      // the load, except for the wide store checks below).
+      if (hasActiveTrigger())
+	{
+	  TriggerTiming timing = TriggerTiming::Before;
+	  bool isLd = false, ie = isInterruptEnabled();
+	  if (ldStAddrTriggerHit(addr, timing, isLd, ie))
+	    triggerTripped_ = true;
+	  if (ldStDataTriggerHit(LOAD_TYPE(op(rs2Val, rdVal)), timing, isLd, ie))
+	    triggerTripped_ = true;
+	  if (triggerTripped_)
+	    return;
+	}
+
+      unsigned stSize = sizeof(LOAD_TYPE);
+      if (wideLdSt_)
+	{
+	  // 64-bit store (see wideStore): The upper word comes from
+	  // MDBHD. Swap both words so that the other harts see the
+	  // same protocol.
+	  if ((addr & 7) or stSize != 4 or not isDataAddressExternal(addr))
+	    {
+	      auto secCause = SecondaryCause::STORE_ACC_64BIT;
+	      initiateStoreException(ExceptionCause::STORE_ACC_FAULT, addr,
+				     secCause);
+	      return;
+	    }
+	  uint64_t upper = 0;
+	  auto csr = csRegs_.getImplementedCsr(CsrNumber::MDBHD);
+	  if (csr)
+	    upper = uint32_t(csr->read());
+	  auto desired = [&] (uint64_t prev) -> uint64_t {
+	    return (upper << 32) | uint32_t(op(rs2Val, extend(LOAD_TYPE(prev)))); };
+	  uint64_t expected = 0;
+	  memory_.read(addr, expected);
+	  while (not memory_.compareExchange(localHartId_, addr, expected,
+					     desired(expected), trackLastWrite_))
+	    ;
+	  rdVal = extend(LOAD_TYPE(expected));
+	  stSize = 8;
+	}
+      else
+	{
+	  LOAD_TYPE expected = LOAD_TYPE(loadedValue);
+	  while (not memory_.compareExchange(localHartId_, addr, expected,
+					     LOAD_TYPE(op(rs2Val, extend(expected))),
+					     trackLastWrite_))
+	    ;
+	  rdVal = extend(expected);
+	}
+      misalignedLdSt_ = false;
+      memory_.invalidateOtherHartLr(localHartId_, addr, stSize);
+      invalidateDecodeCache(addr, stSize);
+      tlbFill(writeTlb_, addr);
+      storeOk = true;
+    }
+  else
+    storeOk = store<LOAD_TYPE>(rs1, addr, addr, LOAD_TYPE(op(rs2Val, rdVal)));
+
+  if (storeOk and not triggerTripped_)
+    intRegs_.write(di->op0(), rdVal);
+}
+
+
 template <typename URV>
 void
 Hart<URV>::execEcall(const DecodedInst*)
@@ -5795,15 +8894,9 @@ Hart<URV>::execEcall(const DecodedInst*)
 
   if (newlib_ or linux_)
     {
-      URV a0 = emulateSyscall();
+      SELF_PROFILE_PHASE(Syscall);
+      URV a0 = inputLog_ ? emulateLoggedSyscall() : emulateSyscall();
       intRegs_.write(RegA0, a0);
-      URV num = intRegs_.read(RegA7);
-#ifdef DISABLE_EXCEPTIONS
-      if(num == 93 || num == 94){
-        userOk = false;
-        std::lock_guard<std::mutex> guard(printInstTraceMutex);
-      }
-#endif
       return;
     }
 
@@ -5907,6 +9000,7 @@ Hart<URV>::execMret(const DecodedInst*)
       
   // Update privilege mode.
   privMode_ = savedMode;
+  interruptEnablesChanged();  // Interrupt enable restored.
 }
 
 
@@ -5966,6 +9060,7 @@ Hart<URV>::execSret(const DecodedInst*)
 
   // Update privilege mode.
   privMode_ = savedMode;
+  interruptEnablesChanged();  // Interrupt enable restored.
 }
 
 
@@ -6018,6 +9113,7 @@ Hart<URV>::execUret(const DecodedInst*)
       return;
     }
   pc_ = (epc >> 1) << 1;  // Restore pc clearing least sig bit.
+  interruptEnablesChanged();  // Interrupt enable restored.
 }
 
 
@@ -6025,7 +9121,17 @@ template <typename URV>
 void
 Hart<URV>::execWfi(const DecodedInst*)
 {
-  return;   // Currently implemented as a no-op.
+  // Without event driven interrupts, implemented as a no-op. With
+  // them, skip to the next event unless an interrupt is pending.
+  if (not eventInterrupts_)
+    return;
+
+  URV mip = 0, mie = 0;
+  csRegs_.peek(CsrNumber::MIP, mip);
+  csRegs_.peek(CsrNumber::MIE, mie);
+  uint64_t next = nextEvent_.load(std::memory_order_relaxed);
+  if ((mip & mie) == 0 and next != ~uint64_t(0) and next > cycleCount_)
+    cycleCount_ = next;
 }
 
 
@@ -6056,6 +9162,10 @@ Hart<URV>::updateStackChecker()
   csr = csRegs_.getImplementedCsr(CsrNumber::MSPCC);
   if (csr)
     checkStackAccess_ = csr->read() != 0;
+
+  // Stores are allowed in (stackMin_, stackMax_].
+  stackStoreLow_ = stackMin_ + 1;
+  stackStoreCount_ = stackMax_ > stackMin_ ? stackMax_ - stackMin_ : 0;
 }
 
 
@@ -6079,6 +9189,7 @@ Hart<URV>::doCsrWrite(CsrNumber csr, URV csrVal, unsigned intReg,
   // Update CSR and integer register.
   csRegs_.write(csr, privMode_, false /*debugMode*/, csrVal);
   intRegs_.write(intReg, intRegVal);
+  interruptEnablesChanged();  // Interrupt enables may have changed.
 
   if (csr == CsrNumber::DCSR)
     {
@@ -6312,6 +9423,7 @@ Hart<URV>::determineStoreException(unsigned rs1, URV base, URV addr,
 				   STORE_TYPE& storeVal,
 				   SecondaryCause& secCause)
 {
+  SELF_PROFILE_PHASE(MemCheck);
   unsigned stSize = sizeof(STORE_TYPE);
 
   // Misaligned store to io section causes an exception. Crossing
@@ -6386,8 +9498,6 @@ template <typename STORE_TYPE>
 bool
 Hart<URV>::store(unsigned rs1, URV base, URV addr, STORE_TYPE storeVal)
 {
-  std::lock_guard<std::mutex> lock(memory_.lrMutex_);
-
   // ld/st-address or instruction-address triggers have priority over
   // ld/st access or misaligned exceptions.
   bool hasTrig = hasActiveTrigger();
@@ -6397,41 +9507,77 @@ Hart<URV>::store(unsigned rs1, URV base, URV addr, STORE_TYPE storeVal)
     triggerTripped_ = true;
 
 #ifdef __EMSCRIPTEN__
-  // MMIO for javascript
-  if(addr > 0xffff0000){
+  // MMIO for javascript: Registers without side effects are written
+  // in the MMIO window.
+  if(addr - mmioBase_ < mmioSize_){
     if (privMode_ == PrivilegeMode::User){
       initiateStoreException(ExceptionCause::STORE_ACC_FAULT, addr, SecondaryCause::NONE);
       return false;
     }
-    jsWriteMMIO((int) addr, sizeof(STORE_TYPE), (int) storeVal);
+    URV offset = addr - mmioBase_;
+    if (isMmioSideEffect(offset, sizeof(STORE_TYPE)))
+      jsWriteMMIO((int) addr, sizeof(STORE_TYPE), (int) storeVal);
+    else
+      memcpy(mmioWindow_.data() + offset, &storeVal, sizeof(storeVal));
     return true;
   }
 #endif
 
-  // Determine if a store exception is possible.
-  STORE_TYPE maskedVal = storeVal;  // Masked store value.
+  unsigned stSize = sizeof(STORE_TYPE);
   auto secCause = SecondaryCause::NONE;
-  ExceptionCause cause = determineStoreException(rs1, base, addr,
-						 maskedVal, secCause);
-
-  // Consider store-data  trigger
-  if (hasTrig and cause == ExceptionCause::NONE)
-    if (ldStDataTriggerHit(maskedVal, timing, isLd, isInterruptEnabled()))
-      triggerTripped_ = true;
-  if (triggerTripped_)
-    return false;
+  bool written = false;
 
-  if (cause != ExceptionCause::NONE)
+  // Fast path: Aligned store into a plain memory page (within the
+  // stack window if checked).
+  if (not hasTrig and (addr & (stSize - 1)) == 0 and
+      tlbHit(writeTlb_, addr) and isPlainAccess() and
+      (rs1 != RegSp or not checkStackAccess_ or checkStackStore(addr, stSize)))
     {
-      initiateStoreException(cause, addr, secCause);
-      return false;
+      misalignedLdSt_ = false;
+      memory_.writeUnchecked(localHartId_, addr, storeVal, trackLastWrite_);
+      written = true;
     }
+  else
+    {
+      // Determine if a store exception is possible.
+      STORE_TYPE maskedVal = storeVal;  // Masked store value.
+      ExceptionCause cause = determineStoreException(rs1, base, addr,
+						     maskedVal, secCause);
 
-  unsigned stSize = sizeof(STORE_TYPE);
-  if (wideLdSt_)
-    return wideStore(addr, storeVal, stSize);
+      // Consider store-data  trigger
+      if (hasTrig and cause == ExceptionCause::NONE)
+	if (ldStDataTriggerHit(maskedVal, timing, isLd, isInterruptEnabled()))
+	  triggerTripped_ = true;
+      if (triggerTripped_)
+	return false;
+
+      if (cause != ExceptionCause::NONE)
+	{
+	  initiateStoreException(cause, addr, secCause);
+	  return false;
+	}
 
-  if (memory_.write(localHartId_, addr, storeVal))
+      if (wideLdSt_)
+	return wideStore(addr, storeVal, stSize);
+
+      // Clint registers (never in the software TLB).
+      if (clint_ and clint_->contains(addr))
+	{
+	  if (clint_->write(addr, stSize, uint64_t(storeVal)))
+	    return true;
+	  initiateStoreException(ExceptionCause::STORE_ACC_FAULT, addr, secCause);
+	  return false;
+	}
+
+      written = memory_.write(localHartId_, addr, storeVal, trackLastWrite_);
+      if (written)
+	{
+	  tlbFill(writeTlb_, addr);
+	  checkWatch(addr, stSize, true);
+	}
+    }
+
+  if (written)
     {
       memory_.invalidateOtherHartLr(localHartId_, addr, stSize);
 
@@ -6440,18 +9586,9 @@ Hart<URV>::store(unsigned rs1, URV base, URV addr, STORE_TYPE storeVal)
       // If we write to special location, end the simulation.
       if (toHostValid_ and addr == toHost_ and storeVal != 0)
         {
-#ifndef DISABLE_EXCEPTIONS
-          throw CoreException(CoreException::Stop, "write to to-host",
-                              toHost_, storeVal);
-#else
-          std::lock_guard<std::mutex> guard(printInstTraceMutex);
-          ++retiredInsts_;
-          std::cerr << (storeVal == 1? "Successful " : "Error: Failed ")
-              << "stop: " << "write to to-host" << ": " << storeVal << '\n';
-          setTargetProgramFinished(true);
-          userOk = false;
+          requestStop(CoreException::Stop, "write to to-host", toHost_,
+                      storeVal);
           return false;
-#endif
         }
 
       // If addr is special location, then write to console.
@@ -6460,7 +9597,7 @@ Hart<URV>::store(unsigned rs1, URV base, URV addr, STORE_TYPE storeVal)
           if (conIoValid_ and addr == conIo_)
             {
               if (consoleOut_)
-                fputc(storeVal, consoleOut_);
+                bufferConsoleOutput(char(storeVal));
               return true;
             }
         }
@@ -7043,55 +10180,260 @@ Hart<URV>::effectiveRoundingMode(RoundingMode instMode)
 }
 
 
+#ifdef SOFT_FLOAT
+
+// With SOFT_FLOAT, the FP instructions use the SoftFloat engine instead
+// of the host FP unit. These play the role of the host rounding mode
+// and exception flags (FpFlags bits).
+static thread_local RoundingMode softRoundingMode = RoundingMode::NearestEven;
+static thread_local unsigned softFpFlags = 0;
+
+/// Return the exception flags (FpFlags bits) raised since they were
+/// last cleared.
+static inline
+unsigned
+simulatorFpFlags()
+{
+  return softFpFlags;
+}
+
+#else
+
+/// Return the exception flags of the host (as FpFlags bits) raised
+/// since they were last cleared.
+static inline
+unsigned
+simulatorFpFlags()
+{
+  int hostFlags = fetestexcept(FE_ALL_EXCEPT);
+  if (hostFlags == 0)
+    return 0;
+
+  unsigned flags = 0;
+
+  if (hostFlags & FE_INEXACT)
+    flags |= unsigned(FpFlags::Inexact);
+
+  if (hostFlags & FE_UNDERFLOW)
+    flags |= unsigned(FpFlags::Underflow);
+
+  if (hostFlags & FE_OVERFLOW)
+    flags |= unsigned(FpFlags::Overflow);
+
+  if (hostFlags & FE_DIVBYZERO)
+    flags |= unsigned(FpFlags::DivByZero);
+
+  if (hostFlags & FE_INVALID)
+    flags |= unsigned(FpFlags::Invalid);
+
+  return flags;
+}
+
+#endif
+
+
 template <typename URV>
 void
 Hart<URV>::updateAccruedFpBits()
 {
+  unsigned flags = simulatorFpFlags();
+  if (flags == 0)
+    return;
+
   URV val = 0;
   if (csRegs_.read(CsrNumber::FCSR, PrivilegeMode::Machine, debugMode_, val))
     {
       URV prev = val;
+      val |= flags;
+      if (val != prev)
+        csRegs_.write(CsrNumber::FCSR, PrivilegeMode::Machine, debugMode_, val);
+    }
+}
 
-      int flags = fetestexcept(FE_ALL_EXCEPT);
-      
-      if (flags & FE_INEXACT)
-        val |= URV(FpFlags::Inexact);
 
-      if (flags & FE_UNDERFLOW)
-        val |= URV(FpFlags::Underflow);
+template <typename URV>
+void
+Hart<URV>::clearSimulatorFpFlags()
+{
+#ifdef SOFT_FLOAT
+  softFpFlags = 0;
+#else
+  // Clearing the host flags is slow (it rewrites the FP environment
+  // on x86). Like the accrued flags of FCSR, the host flags are
+  // sticky: They need clearing only if they hold a flag not already
+  // accrued in FCSR. Otherwise, or-ing them into FCSR after the
+  // instruction has the same effect.
+  unsigned flags = simulatorFpFlags();
+  if (flags == 0)
+    return;
 
-      if (flags & FE_OVERFLOW)
-        val |= URV(FpFlags::Overflow);
-      
-      if (flags & FE_DIVBYZERO)
-        val |= URV(FpFlags::DivByZero);
+  URV val = 0;
+  if (csRegs_.peek(CsrNumber::FCSR, val) and (flags & ~unsigned(val)) == 0)
+    return;
+
+  std::feclearexcept(FE_ALL_EXCEPT);
+#endif
+}
 
-      if (flags & FE_INVALID)
-        val |= URV(FpFlags::Invalid);
 
-      if (val != prev)
-        csRegs_.write(CsrNumber::FCSR, PrivilegeMode::Machine, debugMode_, val);
+/// Set the rounding mode of the machine running this simulator to
+/// the given RISCV mode. The mode is left in place after the
+/// instruction: Consecutive instructions with the same mode do not
+/// change the host mode (see restoreHostRoundingMode).
+static
+void
+setSimulatorRoundingMode(RoundingMode mode)
+{
+#ifdef SOFT_FLOAT
+  softRoundingMode = mode;
+#else
+  int previous = std::fegetround();
+  int next = previous;
+
+  if      (mode == RoundingMode::NearestEven) next = FE_TONEAREST;
+  else if (mode == RoundingMode::Zero)        next = FE_TOWARDZERO;
+  else if (mode == RoundingMode::Down)        next = FE_DOWNWARD;
+  else if (mode == RoundingMode::Up)          next = FE_UPWARD;
+  else if (mode == RoundingMode::NearestMax)  next = FE_TONEAREST;  
+
+  if (next != previous)
+    std::fesetround(next);
+#endif
+}
+
+
+/// Arithmetic of the FP instructions: Host FP unit using the rounding
+/// mode and flags set up by setSimulatorRoundingMode and
+/// clearSimulatorFpFlags, or SoftFloat with SOFT_FLOAT.
+template <typename FT>
+static inline
+FT
+fpAdd(FT a, FT b)
+{
+#ifdef SOFT_FLOAT
+  return SoftFloat::add(a, b, softRoundingMode, softFpFlags);
+#else
+  return a + b;
+#endif
+}
+
+
+template <typename FT>
+static inline
+FT
+fpSub(FT a, FT b)
+{
+#ifdef SOFT_FLOAT
+  return SoftFloat::sub(a, b, softRoundingMode, softFpFlags);
+#else
+  return a - b;
+#endif
+}
+
+
+template <typename FT>
+static inline
+FT
+fpMul(FT a, FT b)
+{
+#ifdef SOFT_FLOAT
+  return SoftFloat::mul(a, b, softRoundingMode, softFpFlags);
+#else
+  return a * b;
+#endif
+}
+
+
+template <typename FT>
+static inline
+FT
+fpDiv(FT a, FT b)
+{
+#ifdef SOFT_FLOAT
+  return SoftFloat::div(a, b, softRoundingMode, softFpFlags);
+#else
+  return a / b;
+#endif
+}
+
+
+template <typename FT>
+static inline
+FT
+fpSqrt(FT a)
+{
+#ifdef SOFT_FLOAT
+  return SoftFloat::sqrt(a, softRoundingMode, softFpFlags);
+#else
+  return std::sqrt(a);
+#endif
+}
+
+
+/// Convert double precision to single.
+static inline
+float
+fpToSingle(double x)
+{
+#ifdef SOFT_FLOAT
+  return SoftFloat::toSingle(x, softRoundingMode, softFpFlags);
+#else
+  return float(x);
+#endif
+}
+
+
+/// Convert single precision to double.
+static inline
+double
+fpToDouble(float x)
+{
+#ifdef SOFT_FLOAT
+  return SoftFloat::toDouble(x, softFpFlags);
+#else
+  return x;
+#endif
+}
+
+
+/// Convert integer to floating point type FT.
+template <typename FT, typename INT>
+static inline
+FT
+fpFromInt(INT x)
+{
+#ifdef SOFT_FLOAT
+  if constexpr (std::is_same<FT, float>::value)
+    {
+      if constexpr (std::is_signed<INT>::value)
+	return SoftFloat::i64ToSingle(x, softRoundingMode, softFpFlags);
+      else
+	return SoftFloat::u64ToSingle(x, softRoundingMode, softFpFlags);
+    }
+  else
+    {
+      if constexpr (std::is_signed<INT>::value)
+	return SoftFloat::i64ToDouble(x, softRoundingMode, softFpFlags);
+      else
+	return SoftFloat::u64ToDouble(x, softRoundingMode, softFpFlags);
     }
+#else
+  return FT(x);
+#endif
 }
 
 
-int
-setSimulatorRoundingMode(RoundingMode mode)
+#ifdef SOFT_FLOAT
+/// Convert floating point to an integer of the given width and
+/// signedness with the RISCV fcvt semantics (saturation, flags).
+template <typename FT>
+static inline
+uint64_t
+fpToInt(FT x, unsigned width, bool isSigned)
 {
-  int previous = std::fegetround();
-  int next = previous;
-
-  if      (mode == RoundingMode::NearestEven) next = FE_TONEAREST;
-  else if (mode == RoundingMode::Zero)        next = FE_TOWARDZERO;
-  else if (mode == RoundingMode::Down)        next = FE_DOWNWARD;
-  else if (mode == RoundingMode::Up)          next = FE_UPWARD;
-  else if (mode == RoundingMode::NearestMax)  next = FE_TONEAREST;  
-
-  if (next != previous)
-    std::fesetround(next);
-
-  return previous;
+  return SoftFloat::toInt(x, width, isSigned, softRoundingMode, softFpFlags);
 }
+#endif
 
 
 template <typename URV>
@@ -7146,6 +10488,7 @@ Hart<URV>::execFlw(const DecodedInst* di)
     {
       Uint32FloatUnion ufu(word);
       fpRegs_.writeSingle(rd, ufu.f);
+      checkWatch(addr, ldSize, false);
     }
   else
     {
@@ -7186,17 +10529,6 @@ Hart<URV>::execFsw(const DecodedInst* di)
 }
 
 
-/// Clear the floating point flags in the machine running this
-/// simulator. Do nothing in the simuated RISCV machine.
-inline
-void
-clearSimulatorFpFlags()
-{
-  // asm("fnclex");
-  std::feclearexcept(FE_ALL_EXCEPT);
-}
-
-
 /// Use fused mutiply-add to perform x*y + z.
 /// Set invalid to true if x and y are zero and infinity or
 /// vice versa since RISCV consider that as an invalid operation.
@@ -7204,7 +10536,11 @@ static
 float
 fusedMultiplyAdd(float x, float y, float z, bool& invalid)
 {
-#ifdef __FP_FAST_FMA
+#if defined(SOFT_FLOAT)
+  float res = SoftFloat::mulAdd(x, y, z, softRoundingMode, softFpFlags);
+  invalid = false;  // Invalid flag already in softFpFlags.
+  return res;
+#elif defined(__FP_FAST_FMA)
   float res = x*y + z;
 #else
   float res = std::fma(x, y, z);
@@ -7219,7 +10555,11 @@ static
 double
 fusedMultiplyAdd(double x, double y, double z, bool& invalid)
 {
-#ifdef __FP_FAST_FMA
+#if defined(SOFT_FLOAT)
+  double res = SoftFloat::mulAdd(x, y, z, softRoundingMode, softFpFlags);
+  invalid = false;  // Invalid flag already in softFpFlags.
+  return res;
+#elif defined(__FP_FAST_FMA)
   double res = x*y + z;
 #else
   double res = std::fma(x, y, z);
@@ -7247,7 +10587,7 @@ Hart<URV>::execFmadd_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   float f2 = fpRegs_.readSingle(di->op2());
@@ -7263,9 +10603,6 @@ Hart<URV>::execFmadd_s(const DecodedInst* di)
   updateAccruedFpBits();
   if (invalid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7287,7 +10624,7 @@ Hart<URV>::execFmsub_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   float f2 = fpRegs_.readSingle(di->op2());
@@ -7303,9 +10640,6 @@ Hart<URV>::execFmsub_s(const DecodedInst* di)
   updateAccruedFpBits();
   if (invalid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7327,7 +10661,7 @@ Hart<URV>::execFnmsub_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = -fpRegs_.readSingle(di->op1());
   float f2 = fpRegs_.readSingle(di->op2());
@@ -7343,9 +10677,6 @@ Hart<URV>::execFnmsub_s(const DecodedInst* di)
   updateAccruedFpBits();
   if (invalid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7367,7 +10698,7 @@ Hart<URV>::execFnmadd_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   // we want -(f[op1] * f[op2]) - f[op3]
 
@@ -7385,9 +10716,6 @@ Hart<URV>::execFnmadd_s(const DecodedInst* di)
   updateAccruedFpBits();
   if (invalid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7409,20 +10737,17 @@ Hart<URV>::execFadd_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   float f2 = fpRegs_.readSingle(di->op2());
-  float res = f1 + f2;
+  float res = fpAdd(f1, f2);
   if (std::isnan(res))
     res = std::numeric_limits<float>::quiet_NaN();
 
   fpRegs_.writeSingle(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7444,20 +10769,17 @@ Hart<URV>::execFsub_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   float f2 = fpRegs_.readSingle(di->op2());
-  float res = f1 - f2;
+  float res = fpSub(f1, f2);
   if (std::isnan(res))
     res = std::numeric_limits<float>::quiet_NaN();
 
   fpRegs_.writeSingle(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7478,21 +10800,18 @@ Hart<URV>::execFmul_s(const DecodedInst* di)
       return;
     }
 
-  std::feclearexcept(FE_ALL_EXCEPT);
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  clearSimulatorFpFlags();
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   float f2 = fpRegs_.readSingle(di->op2());
-  float res = f1 * f2;
+  float res = fpMul(f1, f2);
   if (std::isnan(res))
     res = std::numeric_limits<float>::quiet_NaN();
 
   fpRegs_.writeSingle(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7514,20 +10833,17 @@ Hart<URV>::execFdiv_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   float f2 = fpRegs_.readSingle(di->op2());
-  float res = f1 / f2;
+  float res = fpDiv(f1, f2);
   if (std::isnan(res))
     res = std::numeric_limits<float>::quiet_NaN();
 
   fpRegs_.writeSingle(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7548,20 +10864,17 @@ Hart<URV>::execFsqrt_s(const DecodedInst* di)
       return;
     }
 
-  std::feclearexcept(FE_ALL_EXCEPT);
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  clearSimulatorFpFlags();
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
-  float res = std::sqrt(f1);
+  float res = fpSqrt(f1);
   if (std::isnan(res))
     res = std::numeric_limits<float>::quiet_NaN();
 
   fpRegs_.writeSingle(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7721,6 +11034,7 @@ Hart<URV>::execFmax_s(const DecodedInst* di)
 }
 
 
+#ifndef SOFT_FLOAT
 /// Return sign bit (0 or 1) of given float. Works for all float
 /// values including NANs and INFINITYs.
 static
@@ -7741,6 +11055,7 @@ signOf(double d)
   Uint64DoubleUnion udu(d);
   return udu.u >> 63;
 }
+#endif
 
 
 template <typename URV>
@@ -7761,12 +11076,16 @@ Hart<URV>::execFcvt_w_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   SRV result = 0;
   bool valid = false;
 
+#ifdef SOFT_FLOAT
+  result = SRV(int32_t(fpToInt(f1, 32, true)));
+  valid = true;  // Invalid flag already in softFpFlags.
+#else
   int32_t minInt = int32_t(1) << 31;
   int32_t maxInt = (~uint32_t(0)) >> 1;
 
@@ -7788,15 +11107,13 @@ Hart<URV>::execFcvt_w_s(const DecodedInst* di)
 	  result = int32_t(std::lrintf(f1));
 	}
     }
+#endif
 
   intRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
   if (not valid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -7818,12 +11135,16 @@ Hart<URV>::execFcvt_wu_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   SRV result = 0;
   bool valid = false;
 
+#ifdef SOFT_FLOAT
+  result = SRV(int32_t(fpToInt(f1, 32, false)));
+  valid = true;  // Invalid flag already in softFpFlags.
+#else
   uint32_t maxInt = ~uint32_t(0);
 
   unsigned signBit = signOf(f1);
@@ -7852,15 +11173,13 @@ Hart<URV>::execFcvt_wu_s(const DecodedInst* di)
 	    }
 	}
     }
+#endif
 
   intRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
   if (not valid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8051,16 +11370,13 @@ Hart<URV>::execFcvt_s_w(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   int32_t i1 = intRegs_.read(di->op1());
-  float result = float(i1);
+  float result = fpFromInt<float>(i1);
   fpRegs_.writeSingle(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8082,16 +11398,13 @@ Hart<URV>::execFcvt_s_wu(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   uint32_t u1 = intRegs_.read(di->op1());
-  float result = float(u1);
+  float result = fpFromInt<float>(u1);
   fpRegs_.writeSingle(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8138,12 +11451,16 @@ Hart<uint64_t>::execFcvt_l_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   SRV result = 0;
   bool valid = false;
 
+#ifdef SOFT_FLOAT
+  result = fpToInt(f1, 64, true);
+  valid = true;  // Invalid flag already in softFpFlags.
+#else
   int64_t maxInt = (~uint64_t(0)) >> 1;
   int64_t minInt = int64_t(1) << 63;
 
@@ -8170,15 +11487,13 @@ Hart<uint64_t>::execFcvt_l_s(const DecodedInst* di)
 	  result = std::lrint(f1);
 	}
     }
+#endif
 
   intRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
   if (not valid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8208,12 +11523,16 @@ Hart<uint64_t>::execFcvt_lu_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
   uint64_t result = 0;
   bool valid = false;
 
+#ifdef SOFT_FLOAT
+  result = fpToInt(f1, 64, false);
+  valid = true;  // Invalid flag already in softFpFlags.
+#else
   uint64_t maxUint = ~uint64_t(0);
 
   unsigned signBit = signOf(f1);
@@ -8252,15 +11571,13 @@ Hart<uint64_t>::execFcvt_lu_s(const DecodedInst* di)
 	    }
 	}
     }
+#endif
 
   intRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
   if (not valid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8282,16 +11599,13 @@ Hart<URV>::execFcvt_s_l(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   SRV i1 = intRegs_.read(di->op1());
-  float result = float(i1);
+  float result = fpFromInt<float>(i1);
   fpRegs_.writeSingle(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8313,16 +11627,13 @@ Hart<URV>::execFcvt_s_lu(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   URV i1 = intRegs_.read(di->op1());
-  float result = float(i1);
+  float result = fpFromInt<float>(i1);
   fpRegs_.writeSingle(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8382,6 +11693,7 @@ Hart<URV>::execFld(const DecodedInst* di)
       UDU udu;
       udu.u = val64;
       fpRegs_.write(di->op0(), udu.d);
+      checkWatch(addr, sizeof(val64), false);
     }
   else
     {
@@ -8439,7 +11751,7 @@ Hart<URV>::execFmadd_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double f1 = fpRegs_.read(di->op1());
   double f2 = fpRegs_.read(di->op2());
@@ -8455,9 +11767,6 @@ Hart<URV>::execFmadd_d(const DecodedInst* di)
   updateAccruedFpBits();
   if (invalid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8479,7 +11788,7 @@ Hart<URV>::execFmsub_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double f1 = fpRegs_.read(di->op1());
   double f2 = fpRegs_.read(di->op2());
@@ -8496,9 +11805,6 @@ Hart<URV>::execFmsub_d(const DecodedInst* di)
   updateAccruedFpBits();
   if (invalid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8520,7 +11826,7 @@ Hart<URV>::execFnmsub_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double f1 = -fpRegs_.read(di->op1());
   double f2 = fpRegs_.read(di->op2());
@@ -8536,9 +11842,6 @@ Hart<URV>::execFnmsub_d(const DecodedInst* di)
   updateAccruedFpBits();
   if (invalid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8560,7 +11863,7 @@ Hart<URV>::execFnmadd_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   // we want -(f[op1] * f[op2]) - f[op3]
 
@@ -8578,9 +11881,6 @@ Hart<URV>::execFnmadd_d(const DecodedInst* di)
   updateAccruedFpBits();
   if (invalid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8602,20 +11902,17 @@ Hart<URV>::execFadd_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double d1 = fpRegs_.read(di->op1());
   double d2 = fpRegs_.read(di->op2());
-  double res = d1 + d2;
+  double res = fpAdd(d1, d2);
   if (std::isnan(res))
     res = std::numeric_limits<double>::quiet_NaN();
 
   fpRegs_.write(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8637,20 +11934,17 @@ Hart<URV>::execFsub_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double d1 = fpRegs_.read(di->op1());
   double d2 = fpRegs_.read(di->op2());
-  double res = d1 - d2;
+  double res = fpSub(d1, d2);
   if (std::isnan(res))
     res = std::numeric_limits<double>::quiet_NaN();
 
   fpRegs_.write(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8672,20 +11966,17 @@ Hart<URV>::execFmul_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double d1 = fpRegs_.read(di->op1());
   double d2 = fpRegs_.read(di->op2());
-  double res = d1 * d2;
+  double res = fpMul(d1, d2);
   if (std::isnan(res))
     res = std::numeric_limits<double>::quiet_NaN();
 
   fpRegs_.write(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8708,20 +11999,17 @@ Hart<URV>::execFdiv_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double d1 = fpRegs_.read(di->op1());
   double d2 = fpRegs_.read(di->op2());
-  double res = d1 / d2;
+  double res = fpDiv(d1, d2);
   if (std::isnan(res))
     res = std::numeric_limits<double>::quiet_NaN();
 
   fpRegs_.write(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8868,19 +12156,16 @@ Hart<URV>::execFcvt_d_s(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   float f1 = fpRegs_.readSingle(di->op1());
-  double result = f1;
+  double result = fpToDouble(f1);
   if (std::isnan(result))
     result = std::numeric_limits<double>::quiet_NaN();
 
   fpRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8902,19 +12187,16 @@ Hart<URV>::execFcvt_s_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double d1 = fpRegs_.read(di->op1());
-  float result = float(d1);
+  float result = fpToSingle(d1);
   if (std::isnan(result))
     result = std::numeric_limits<float>::quiet_NaN();
 
   fpRegs_.writeSingle(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -8936,19 +12218,16 @@ Hart<URV>::execFsqrt_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double d1 = fpRegs_.read(di->op1());
-  double res = std::sqrt(d1);
+  double res = fpSqrt(d1);
   if (std::isnan(res))
     res = std::numeric_limits<double>::quiet_NaN();
 
   fpRegs_.write(di->op0(), res);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -9045,12 +12324,16 @@ Hart<URV>::execFcvt_w_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double d1 = fpRegs_.read(di->op1());
   SRV result = 0;
   bool valid = false;
 
+#ifdef SOFT_FLOAT
+  result = SRV(int32_t(fpToInt(d1, 32, true)));
+  valid = true;  // Invalid flag already in softFpFlags.
+#else
   int32_t minInt = int32_t(1) << 31;
   int32_t maxInt = (~uint32_t(0)) >> 1;
 
@@ -9072,15 +12355,13 @@ Hart<URV>::execFcvt_w_d(const DecodedInst* di)
 	  result = SRV(int32_t(std::lrint(d1)));
 	}
     }
+#endif
 
   intRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
   if (not valid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -9103,12 +12384,16 @@ Hart<URV>::execFcvt_wu_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double d1 = fpRegs_.read(di->op1());
   SRV result = 0;
   bool valid = false;
 
+#ifdef SOFT_FLOAT
+  result = SRV(int32_t(fpToInt(d1, 32, false)));
+  valid = true;  // Invalid flag already in softFpFlags.
+#else
   unsigned signBit = signOf(d1);
   if (std::isinf(d1))
     result = signBit? 0 : ~URV(0);
@@ -9130,15 +12415,13 @@ Hart<URV>::execFcvt_wu_d(const DecodedInst* di)
 	    }
 	}
     }
+#endif
 
   intRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
   if (not valid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -9160,16 +12443,13 @@ Hart<URV>::execFcvt_d_w(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   int32_t i1 = intRegs_.read(di->op1());
   double result = i1;
   fpRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -9191,16 +12471,13 @@ Hart<URV>::execFcvt_d_wu(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   uint32_t i1 = intRegs_.read(di->op1());
   double result = i1;
   fpRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -9287,12 +12564,16 @@ Hart<uint64_t>::execFcvt_l_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double f1 = fpRegs_.read(di->op1());
   SRV result = 0;
   bool valid = false;
 
+#ifdef SOFT_FLOAT
+  result = fpToInt(f1, 64, true);
+  valid = true;  // Invalid flag already in softFpFlags.
+#else
   int64_t maxInt = (~uint64_t(0)) >> 1;
   int64_t minInt = int64_t(1) << 63;
 
@@ -9322,15 +12603,13 @@ Hart<uint64_t>::execFcvt_l_d(const DecodedInst* di)
 	  result = std::lrint(f1);
 	}
     }
+#endif
 
   intRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
   if (not valid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -9360,12 +12639,16 @@ Hart<uint64_t>::execFcvt_lu_d(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   double f1 = fpRegs_.read(di->op1());
   uint64_t result = 0;
   bool valid = false;
 
+#ifdef SOFT_FLOAT
+  result = fpToInt(f1, 64, false);
+  valid = true;  // Invalid flag already in softFpFlags.
+#else
   uint64_t maxUint = ~uint64_t(0);
 
   unsigned signBit = signOf(f1);
@@ -9404,15 +12687,13 @@ Hart<uint64_t>::execFcvt_lu_d(const DecodedInst* di)
 	    }
 	}
     }
+#endif
 
   intRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
   if (not valid)
     setInvalidInFcsr();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -9434,16 +12715,13 @@ Hart<URV>::execFcvt_d_l(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   SRV i1 = intRegs_.read(di->op1());
-  double result = double(i1);
+  double result = fpFromInt<double>(i1);
   fpRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -9465,16 +12743,13 @@ Hart<URV>::execFcvt_d_lu(const DecodedInst* di)
     }
 
   clearSimulatorFpFlags();
-  int prevMode = setSimulatorRoundingMode(riscvMode);
+  setSimulatorRoundingMode(riscvMode);
 
   URV i1 = intRegs_.read(di->op1());
-  double result = double(i1);
+  double result = fpFromInt<double>(i1);
   fpRegs_.write(di->op0(), result);
 
   updateAccruedFpBits();
-
-  if (std::fegetround() != prevMode)
-    std::fesetround(prevMode);
 }
 
 
@@ -9606,6 +12881,8 @@ Hart<URV>::loadReserve(uint32_t rd, uint32_t rs1)
 
   intRegs_.write(rd, value);
 
+  memory_.makeLr(localHartId_, addr, ldSize, uval);
+
   return true;
 }
 
@@ -9614,11 +12891,7 @@ template <typename URV>
 void
 Hart<URV>::execLr_w(const DecodedInst* di)
 {
-  if (not loadReserve<int32_t>(di->op0(), di->op1()))
-    return;
-
-  std::lock_guard<std::mutex> lock(memory_.lrMutex_);
-  memory_.makeLr(localHartId_, loadAddr_, 4 /*size*/);
+  loadReserve<int32_t>(di->op0(), di->op1());
 }
 
 
@@ -9680,25 +12953,38 @@ Hart<URV>::storeConditional(unsigned rs1, URV addr, STORE_TYPE storeVal)
   if (not memory_.hasLr(localHartId_, addr))
     return false;
 
-  if (memory_.write(localHartId_, addr, storeVal))
+  bool written = false;
+  if (memory_.hartCount() == 1)
+    written = memory_.write(localHartId_, addr, storeVal);
+  else if (not isAmoCasAddr(addr, sizeof(STORE_TYPE)))
+    {
+      // Same protocol as the AMOs to such memory.
+      std::lock_guard<std::mutex> lock(memory_.amoMutex_);
+      written = memory_.write(localHartId_, addr, storeVal);
+    }
+  else
+    {
+      // Other harts do not lock: Consume the reservation and replace
+      // the value loaded by the LR with a host compare-and-swap. This
+      // fails if another hart wrote the reserved bytes since the LR.
+      STORE_TYPE expected = STORE_TYPE(memory_.lrValue(localHartId_));
+      if (not memory_.consumeLr(localHartId_, addr))
+	return false;
+      if (not memory_.compareExchange(localHartId_, addr, expected, storeVal))
+	return false;
+      written = true;
+    }
+
+  if (written)
     {
       invalidateDecodeCache(addr, sizeof(STORE_TYPE));
 
       // If we write to special location, end the simulation.
       if (toHostValid_ and addr == toHost_ and storeVal != 0)
         {
-#ifndef DISABLE_EXCEPTIONS
-          throw CoreException(CoreException::Stop, "write to to-host",
-                              toHost_, storeVal);
-#else
-          std::lock_guard<std::mutex> guard(printInstTraceMutex);
-          ++retiredInsts_;
-          std::cerr << (storeVal == 1? "Successful " : "Error: Failed ")
-              << "stop: " << "write to to-host" << ": " << storeVal << '\n';
-          setTargetProgramFinished(true);
-          userOk = false;
+          requestStop(CoreException::Stop, "write to to-host", toHost_,
+                      storeVal);
           return false;
-#endif
         }
 
       return true;
@@ -9714,8 +13000,6 @@ template <typename URV>
 void
 Hart<URV>::execSc_w(const DecodedInst* di)
 {
-  std::lock_guard<std::mutex> lock(memory_.lrMutex_);
-
   uint32_t rs1 = di->op1();
   URV value = intRegs_.read(di->op2());
   URV addr = intRegs_.read(rs1);
@@ -9744,28 +13028,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoadd_w(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad32(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      // Sign extend least significant word of register value.
-      SRV rdVal = SRV(int32_t(loadedValue));
-
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val + rdVal;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, uint32_t(result));
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint32_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return rs2Val + rdVal; });
 }
 
 
@@ -9773,28 +13037,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoswap_w(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad32(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      // Sign extend least significant word of register value.
-      SRV rdVal = SRV(int32_t(loadedValue));
-
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, uint32_t(result));
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint32_t>(di, [] (URV rs2Val, URV) -> URV {
+      return rs2Val; });
 }
 
 
@@ -9802,28 +13046,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoxor_w(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad32(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      // Sign extend least significant word of register value.
-      SRV rdVal = SRV(int32_t(loadedValue));
-
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val ^ rdVal;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, uint32_t(result));
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint32_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return rs2Val ^ rdVal; });
 }
 
 
@@ -9831,28 +13055,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoor_w(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad32(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      // Sign extend least significant word of register value.
-      SRV rdVal = SRV(int32_t(loadedValue));
-
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val | rdVal;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, uint32_t(result));
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint32_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return rs2Val | rdVal; });
 }
 
 
@@ -9860,28 +13064,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoand_w(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad32(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      // Sign extend least significant word of register value.
-      SRV rdVal = SRV(int32_t(loadedValue));
-
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val & rdVal;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, uint32_t(result));
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint32_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return rs2Val & rdVal; });
 }
 
 
@@ -9889,29 +13073,8 @@ template <typename URV>
 void
 Hart<URV>::execAmomin_w(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad32(rs1, loadedValue);
-
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      // Sign extend least significant word of register value.
-      SRV rdVal = SRV(int32_t(loadedValue));
-
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = (SRV(rs2Val) < SRV(rdVal))? rs2Val : rdVal;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, uint32_t(result));
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint32_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return (SRV(rs2Val) < SRV(rdVal))? rs2Val : rdVal; });
 }
 
 
@@ -9919,30 +13082,8 @@ template <typename URV>
 void
 Hart<URV>::execAmominu_w(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad32(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      // Sign extend least significant word of register value.
-      SRV rdVal = SRV(int32_t(loadedValue));
-
-      URV rs2Val = intRegs_.read(di->op2());
-
-      uint32_t w1 = uint32_t(rs2Val), w2 = uint32_t(rdVal);
-      uint32_t result = (w1 < w2)? w1 : w2;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, uint32_t(result));
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint32_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return (uint32_t(rs2Val) < uint32_t(rdVal))? rs2Val : rdVal; });
 }
 
 
@@ -9950,28 +13091,8 @@ template <typename URV>
 void
 Hart<URV>::execAmomax_w(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad32(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      // Sign extend least significant word of register value.
-      SRV rdVal = SRV(int32_t(loadedValue));
-
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = (SRV(rs2Val) > SRV(rdVal))? rs2Val : rdVal;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, uint32_t(result));
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint32_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return (SRV(rs2Val) > SRV(rdVal))? rs2Val : rdVal; });
 }
 
 
@@ -9979,31 +13100,8 @@ template <typename URV>
 void
 Hart<URV>::execAmomaxu_w(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad32(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      // Sign extend least significant word of register value.
-      SRV rdVal = SRV(int32_t(loadedValue));
-
-      URV rs2Val = intRegs_.read(di->op2());
-
-      uint32_t w1 = uint32_t(rs2Val), w2 = uint32_t(rdVal);
-
-      URV result = (w1 > w2)? w1 : w2;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, uint32_t(result));
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint32_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return (uint32_t(rs2Val) > uint32_t(rdVal))? rs2Val : rdVal; });
 }
 
 
@@ -10011,11 +13109,7 @@ template <typename URV>
 void
 Hart<URV>::execLr_d(const DecodedInst* di)
 {
-  if (not loadReserve<int64_t>(di->op0(), di->op1()))
-    return;
-
-  std::lock_guard<std::mutex> lock(memory_.lrMutex_);
-  memory_.makeLr(localHartId_, loadAddr_, 8 /*size*/);
+  loadReserve<int64_t>(di->op0(), di->op1());
 }
 
 
@@ -10023,8 +13117,6 @@ template <typename URV>
 void
 Hart<URV>::execSc_d(const DecodedInst* di)
 {
-  std::lock_guard<std::mutex> lock(memory_.lrMutex_);
-
   uint32_t rs1 = di->op1();
   URV value = intRegs_.read(di->op2());
   URV addr = intRegs_.read(rs1);
@@ -10053,26 +13145,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoadd_d(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad64(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      URV rdVal = loadedValue;
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val + rdVal;
-
-      bool storeOk = store<uint32_t>(rs1, addr, addr, result);
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint64_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return rs2Val + rdVal; });
 }
 
 
@@ -10080,26 +13154,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoswap_d(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad64(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      URV rdVal = loadedValue;
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val;
-
-      bool storeOk = store<URV>(rs1, addr, addr, result);
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint64_t>(di, [] (URV rs2Val, URV) -> URV {
+      return rs2Val; });
 }
 
 
@@ -10107,26 +13163,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoxor_d(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad64(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      URV rdVal = loadedValue;
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val ^ rdVal;
-
-      bool storeOk = store<URV>(rs1, addr, addr, result);
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint64_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return rs2Val ^ rdVal; });
 }
 
 
@@ -10134,26 +13172,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoor_d(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad64(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      URV rdVal = loadedValue;
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val | rdVal;
-
-      bool storeOk = store<URV>(rs1, addr, addr, result);
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint64_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return rs2Val | rdVal; });
 }
 
 
@@ -10161,26 +13181,8 @@ template <typename URV>
 void
 Hart<URV>::execAmoand_d(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad64(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      URV rdVal = loadedValue;
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = rs2Val & rdVal;
-
-      bool storeOk = store<URV>(rs1, addr, addr, result);
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint64_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return rs2Val & rdVal; });
 }
 
 
@@ -10188,26 +13190,8 @@ template <typename URV>
 void
 Hart<URV>::execAmomin_d(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad64(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      URV rdVal = loadedValue;
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = (SRV(rs2Val) < SRV(rdVal))? rs2Val : rdVal;
-
-      bool storeOk = store<URV>(rs1, addr, addr, result);
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint64_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return (SRV(rs2Val) < SRV(rdVal))? rs2Val : rdVal; });
 }
 
 
@@ -10215,26 +13199,8 @@ template <typename URV>
 void
 Hart<URV>::execAmominu_d(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad64(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      URV rdVal = loadedValue;
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = (rs2Val < rdVal)? rs2Val : rdVal;
-
-      bool storeOk = store<URV>(rs1, addr, addr, result);
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint64_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return (rs2Val < rdVal)? rs2Val : rdVal; });
 }
 
 
@@ -10242,26 +13208,8 @@ template <typename URV>
 void
 Hart<URV>::execAmomax_d(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad64(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      URV rdVal = loadedValue;
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = (SRV(rs2Val) > SRV(rdVal))? rs2Val : rdVal;
-
-      bool storeOk = store<URV>(rs1, addr, addr, result);
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint64_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return (SRV(rs2Val) > SRV(rdVal))? rs2Val : rdVal; });
 }
 
 
@@ -10269,26 +13217,8 @@ template <typename URV>
 void
 Hart<URV>::execAmomaxu_d(const DecodedInst* di)
 {
-  // Lock mutex to serialize AMO instructions. Unlock automatically on
-  // exit from this scope.
-  std::lock_guard<std::mutex> lock(memory_.amoMutex_);
-
-  URV loadedValue = 0;
-  uint32_t rs1 = di->op1();
-  bool loadOk = amoLoad64(rs1, loadedValue);
-  if (loadOk)
-    {
-      URV addr = intRegs_.read(rs1);
-
-      URV rdVal = loadedValue;
-      URV rs2Val = intRegs_.read(di->op2());
-      URV result = (rs2Val > rdVal)? rs2Val : rdVal;
-
-      bool storeOk = store<URV>(rs1, addr, addr, result);
-
-      if (storeOk and not triggerTripped_)
-        intRegs_.write(di->op0(), rdVal);
-    }
+  amoExecute<uint64_t>(di, [] (URV rs2Val, URV rdVal) -> URV {
+      return (rs2Val > rdVal)? rs2Val : rdVal; });
 }
 
 
@@ -18,10 +18,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <vector>
 #include <iosfwd>
 #include <type_traits>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <nlohmann/json_fwd.hpp>
 #include "InstId.hpp"
 #include "InstEntry.hpp"
 #include "IntRegs.hpp"
@@ -30,12 +35,28 @@
 #include "Memory.hpp"
 #include "InstProfile.hpp"
 #include "DecodedInst.hpp"
+#include "BasicBlock.hpp"
+#include "InstTrace.hpp"
+#include "CallProfile.hpp"
+#include "TimingModel.hpp"
+#include "InlineVector.hpp"
+#include "RingQueue.hpp"
+#include "InputLog.hpp"
+#include "SelfProfile.hpp"
+#include "Observer.hpp"
+#include "Coverage.hpp"
+#include "EventQueue.hpp"
+#include "Clint.hpp"
 
 namespace WdRiscv
 {
 
-  /// Thrown by the simulator when a stop (store to to-host) is seen
-  /// or when the target program reaches the exit system call.
+  class Vfs;
+
+  /// Stop of the target program: Store to to-host, exit system call
+  /// or too many consecutive illegal instructions. Not thrown: The
+  /// hart records it (see Hart::requestStop) and its run loops stop
+  /// at the next block boundary and report it (see Hart::logStop).
   class CoreException : public std::exception
   {
   public:
@@ -294,6 +315,87 @@ namespace WdRiscv
     /// defined by defineResetPc (default is zero).
     void reset(bool resetMemoryMappedRegister = false);
 
+    /// Capture the state of this hart (integer/floating point
+    /// registers, CSRs, triggers, program counter, program break,
+    /// privilege and debug modes) and take a copy-on-write snapshot
+    /// of the memory (see Memory::takeSnapshot). Typically used after
+    /// loading a program so that it can be re-run from a clean state
+    /// with restoreSnapshot. In a multi-hart system, the memory is
+    /// shared: the snapshots of all the harts should be taken together.
+    void takeSnapshot();
+
+    /// Restore the state captured by the most recent takeSnapshot
+    /// copying back only the memory pages written since then. Return
+    /// false if no snapshot was taken. In a multi-hart system, restore
+    /// one hart with restoreMemory true and the others with false.
+    bool restoreSnapshot(bool restoreMemory = true);
+
+    /// Write the state captured by takeSnapshot (memory excepted) to
+    /// the given binary stream. Trigger and performance counter
+    /// configurations are not saved: A checkpoint is loaded in a hart
+    /// with the same configuration. Return true on success.
+    bool saveCheckpoint(std::ostream& out);
+
+    /// Restore the state written by saveCheckpoint from the given
+    /// stream dropping all decoded instructions (the memory is
+    /// loaded separately, see Memory::loadCheckpoint). Return true on
+    /// success. Print an error message and return false leaving the
+    /// hart unmodified if the checkpoint is truncated or does not
+    /// match the configuration of this hart.
+    bool loadCheckpoint(std::istream& in);
+
+    /// Save/load the memory part of a checkpoint (see
+    /// Memory::saveCheckpoint and Memory::loadCheckpoint). In a
+    /// multi-hart system the memory is shared: Save/load it once.
+    bool saveMemoryCheckpoint(std::ostream& out) const
+    { return memory_.saveCheckpoint(out); }
+
+    bool loadMemoryCheckpoint(const std::string& path, size_t offset)
+    { return memory_.loadCheckpoint(path, offset); }
+
+    /// Start recording in an undo log the previous values of the
+    /// integer/floating point registers and CSRs changed by each
+    /// instruction executed with singleStep and, through the memory
+    /// write journal (see Memory::beginWriteJournal), of all the
+    /// memory bytes written (including multiple writes by one
+    /// instruction and system call emulation buffers). Also capture
+    /// the program counter, privilege/debug modes and instruction
+    /// counters. Any number of instructions may then be executed
+    /// speculatively and undone with rollbackUndoLog in time
+    /// proportional to the number of changes. A previously active
+    /// undo log is discarded.
+    void beginUndoLog();
+
+    /// Undo, in reverse order, the changes recorded since the most
+    /// recent beginUndoLog and stop recording. Return false if no
+    /// undo log is active. Triggers, performance counters other than
+    /// mcycle/minstret, the load queue and load-reserve reservations
+    /// are not restored.
+    bool rollbackUndoLog();
+
+    /// Stop recording keeping the changes made since the most recent
+    /// beginUndoLog.
+    void endUndoLog()
+    {
+      if (undoLogActive_)
+	memory_.endWriteJournal();
+      undoLog_.clear();
+      undoLogActive_ = false;
+    }
+
+    /// Return true if an undo log is being recorded.
+    bool hasUndoLog() const
+    { return undoLogActive_; }
+
+    /// Return the number of changes recorded in the undo log
+    /// (register and CSR changes and memory writes).
+    size_t undoLogSize() const
+    {
+      if (not undoLogActive_)
+	return 0;
+      return undoLog_.size() + memory_.writeJournalSize() - undoMemMark_;
+    }
+
     /// Run fetch-decode-execute loop. If a stop address (see
     /// setStopAddress) is defined, stop when the program counter
     /// reaches that address. If a tohost address is defined (see
@@ -302,6 +404,57 @@ namespace WdRiscv
     /// file a record for each executed instruction.
     bool run(FILE* file = nullptr);
 
+    /// Outcome of a runSlice call.
+    enum class SliceStatus
+      {
+	Yield,    // Instruction budget exhausted: Program can continue.
+	Stopped,  // Program finished (to-host, exit, stop address, limit).
+	Failed    // Program stopped with an error.
+      };
+
+    /// Run fetch-decode-execute loop for up to maxInsts instructions
+    /// then return so that the caller (e.g. the event loop of a
+    /// browser) can schedule the next slice. Stop conditions are
+    /// those of the run method. When running without tracing or
+    /// counters, the budget is checked at basic block boundaries and
+    /// may be exceeded by less than the size of one block.
+    SliceStatus runSlice(uint64_t maxInsts, FILE* file = nullptr);
+
+    /// Return the number of keyboard interrupts (control-c) received
+    /// by the run methods so far. A keyboard interrupt stops the runs
+    /// of all the harts regardless of the threads running them.
+    static unsigned keyboardInterruptCount();
+
+    /// Make the target program see the given host file descriptor as
+    /// its standard file descriptor fd (0, 1 or 2) in emulated Linux
+    /// system calls. Return false if fd is not 0, 1 or 2.
+    bool redirectStdFd(unsigned fd, int hostFd)
+    {
+      if (fd > 2)
+	return false;
+      stdFds_[fd] = hostFd;
+      return true;
+    }
+
+    /// Return the host file descriptor corresponding to the given
+    /// target file descriptor (see redirectStdFd).
+    int hostFd(int fd) const
+    { return (fd >= 0 and fd <= 2) ? stdFds_[fd] : fd; }
+
+    /// Service the file related emulated system calls of the target
+    /// program (other than those of the standard streams 0, 1 and 2)
+    /// with the given in-memory file system instead of the host file
+    /// system. Null restores the host file system.
+    void setVfs(Vfs* vfs)
+    { vfs_ = vfs; }
+
+    /// Record the nondeterministic inputs of this hart (system call
+    /// results, console and MMIO reads, external interrupts) in the
+    /// given log or replay them from it (see InputLog). Null stops
+    /// recording/replaying.
+    void setInputLog(InputLog* log)
+    { inputLog_ = log; }
+
     /// Run one instruction at the current program counter. Update
     /// program counter. If file is non-null then print thereon
     /// tracing information related to the executed instruction.
@@ -340,13 +493,13 @@ namespace WdRiscv
     bool untilAddress(URV address, FILE* file = nullptr);
 
     /// Define the program counter value at which the run method will
-    /// stop.
-    void setStopAddress(URV address)
-    { stopAddr_ = address; stopAddrValid_ = true; }
+    /// stop. The instruction at that address is flagged when decoded
+    /// and starts its own basic block so that the block run loop stops
+    /// exactly there.
+    void setStopAddress(URV address);
 
     /// Undefine stop address (see setStopAddress).
-    void clearStopAddress()
-    { stopAddrValid_ = false; }
+    void clearStopAddress();
 
     /// Define the memory address corresponding to console io. Reading/writing
     /// a byte (lb/sb) from/to that address reads/writes a byte to/from
@@ -358,9 +511,39 @@ namespace WdRiscv
     void clearConsoleIo()
     { conIoValid_ = false; }
 
+    /// Attach the given clint (see Clint.hpp) to this hart which has
+    /// the given index among the harts of the clint: Loads/stores in
+    /// the address range of the clint access its registers and the
+    /// timer and software interrupts of the hart follow them. The run
+    /// loops take the interrupts driven by the event queue of the hart
+    /// (see scheduleInterrupt) at basic block boundaries.
+    void attachClint(Clint* clint, unsigned hartIx);
+
+    /// Schedule a change of the pending bit of the given interrupt in
+    /// the MIP CSR at the given cycle count: Set the bit if pending is
+    /// true and clear it otherwise. Used to model device interrupts.
+    void scheduleInterrupt(uint64_t cycle, InterruptCause cause, bool pending);
+
+    /// Define the address range of the memory mapped device registers
+    /// served by the JS devices in the Emscripten build (default:
+    /// 64KB at 0xffff0000). The registers live in a window of the
+    /// wasm heap: loads/stores of registers without side effects
+    /// access the window directly and only registers flagged by the
+    /// devices as side-effecting cause a JS callback. Return false if
+    /// the size is zero or not a multiple of 4 or if the range wraps
+    /// around.
+    bool configMmioWindow(URV base, URV size);
+
     /// Console output gets directed to given file.
-    void setConsoleOutput(FILE* out)
-    { consoleOut_ = out; }
+    void setConsoleOutput(FILE* out);
+
+    /// Write out the target program output held in the buffers of
+    /// the emulated write/writev system calls and of the console io
+    /// stores. Output is buffered only within the run methods and is
+    /// otherwise flushed on a newline if going to a terminal, on a
+    /// full buffer, before any other emulated system call (including
+    /// fsync and exit), and when a run stops.
+    void flushTargetOutput();
 
     /// If a console io memory mapped location is defined then put its
     /// address in address and return true; otherwise, return false
@@ -431,6 +614,11 @@ namespace WdRiscv
     bool findElfFunction(URV addr, std::string& name, ElfSymbol& value) const
     { return memory_.findElfFunction(addr, name, value); }
 
+    /// Set funcs to the name and address range of the ELF functions
+    /// in increasing address order.
+    void getElfFunctions(std::vector<std::pair<std::string, ElfSymbol>>& funcs) const
+    { memory_.getElfFunctions(funcs); }
+
     /// Print the ELF symbols on the given stream. Output format:
     /// <name> <value>
     void printElfSymbols(std::ostream& out) const
@@ -471,6 +659,26 @@ namespace WdRiscv
     /// Double word version of the above.
     bool pokeMemory(size_t address, uint64_t val);
 
+    /// Copy size bytes of memory starting at the given address to
+    /// data. Return true on success and false if some of the bytes
+    /// are out of bounds, not mapped or in a memory-mapped register
+    /// page (in which case data is not modified).
+    bool peekMemoryBlock(size_t address, uint8_t* data, size_t size) const
+    { return memory_.peekBlock(address, data, size); }
+
+    /// Copy size bytes from data to memory starting at the given
+    /// address. Return true on success and false, leaving memory
+    /// unmodified, if some of the bytes are out of bounds, not mapped
+    /// or in a memory-mapped register page. This is much faster than
+    /// poking the bytes one at a time (e.g. for loading a program
+    /// image through gdb).
+    bool pokeMemoryBlock(size_t address, const uint8_t* data, size_t size);
+
+    /// Fill the given vector with the address ranges of the mapped
+    /// memory (see Memory::getMappedRanges).
+    void getMappedRanges(std::vector<MappedRange>& ranges) const
+    { memory_.getMappedRanges(ranges); }
+
     /// Define value of program counter after a reset.
     void defineResetPc(URV addr)
     { resetPc_ = addr; }
@@ -527,11 +735,21 @@ namespace WdRiscv
     void lastCsr(std::vector<CsrNumber>& csrs,
 		 std::vector<unsigned>& triggers) const;
 
+    /// Support for tracing: Fill the changes vector with the (key,
+    /// value) pairs of the CSRs written by the last instruction in
+    /// ascending key order. The key of a CSR is its number. The key
+    /// of a trigger register is (trigger << 16) | csr-number. CSRs
+    /// accessible only in debug mode are included if withDebug is
+    /// true. The vector is cleared first and does not allocate once
+    /// it has grown to the largest change count.
+    void lastCsrValues(std::vector<std::pair<uint64_t, uint64_t>>& changes,
+		       bool withDebug);
+
     /// Support for tracing: Fill the addresses and words vectors with
     /// the addresses of the memory words modified by the last
     /// executed instruction and their corresponding values.
-    void lastMemory(std::vector<size_t>& addresses,
-		    std::vector<uint32_t>& words) const;
+    void lastMemory(InlineVector<size_t, 2>& addresses,
+		    InlineVector<uint32_t, 2>& words) const;
 
     /// Return data address of last executed load instruction.
     URV lastLoadAddress() const
@@ -611,6 +829,122 @@ namespace WdRiscv
     void setTraceLoad(bool flag)
     { traceLoad_ = flag; }
 
+    /// Write the instruction trace in the binary format (see
+    /// BinaryTrace) instead of text if flag is true. The caller is
+    /// responsible for the header of the trace file.
+    void setBinaryTrace(bool flag)
+    { binaryTrace_ = flag; binTraceState_ = BinaryTrace::HartState(); }
+
+    /// Hand the trace records of this hart to the given asynchronous
+    /// writer instead of writing them to the trace file passed to the
+    /// run methods. A null writer restores synchronous tracing.
+    void setTraceWriter(TraceWriter* writer)
+    { traceWriter_ = writer; }
+
+    /// Record the control flow of the run methods (taken branches,
+    /// jumps and traps) in the branch trace format (see BranchTrace)
+    /// to the given file which may be shared with other harts. A null
+    /// file disables the branch trace. The caller is responsible for
+    /// the header of the file.
+    void setBranchTrace(FILE* file)
+    { branchFile_ = file; branchState_ = BranchTrace::HartState(); }
+
+    /// Limit the instruction trace of the run methods to a window.
+    /// The window opens once fromInst instructions have executed and
+    /// the program counter is at fromPc. It closes once toInst
+    /// instructions have executed or when the program counter reaches
+    /// toPc. If fromPc is defined, the window opens again each time
+    /// the program counter reaches fromPc (until toInst). A pc of
+    /// ~URV(0) is undefined. Outside the window the hart runs in the
+    /// untraced run loop.
+    void setTraceWindow(uint64_t fromInst, uint64_t toInst, URV fromPc,
+			URV toPc)
+    {
+      traceWindow_ = true;
+      traceWindowOpen_ = traceWindowDone_ = false;
+      traceFromInst_ = fromInst; traceToInst_ = toInst;
+      traceFromPc_ = fromPc; traceToPc_ = toPc;
+    }
+
+    /// Keep the last count retired instructions (pc, opcode, written
+    /// register value, data address) in an in-memory circular buffer
+    /// dumped in the text trace format when the run fails, when it is
+    /// interrupted by control-c, or on demand (see dumpFlightRecorder).
+    /// The dump is appended to the given file (standard error if path
+    /// is empty). A count of zero disables the recorder. Like a trace
+    /// file, the recorder makes the run methods use the untilAddress
+    /// loop but the cost per instruction is much lower.
+    void enableFlightRecorder(unsigned count, const std::string& path);
+
+    /// Print the instructions held by the flight recorder, oldest
+    /// first, in the text trace format to the given file or, if out is
+    /// null, to the file of enableFlightRecorder. The dump starts
+    /// with a comment line holding the given reason.
+    void dumpFlightRecorder(const char* reason, FILE* out = nullptr);
+
+    /// Return true if the flight recorder is enabled.
+    bool hasFlightRecorder() const
+    { return not flightRing_.empty(); }
+
+    /// Add an observer of the instructions executed by this hart (see
+    /// Observer.hpp). A hart with observers runs with the tracing run
+    /// loop.
+    void addObserver(Observer* observer)
+    { observers_.push_back(observer); }
+
+    /// Deliver the pending observer events of this hart.
+    void flushObserverEvents();
+
+    /// Record the instruction and branch coverage of this hart in the
+    /// given object (see Coverage.hpp). Stop recording if null. The
+    /// fast run loop marks the executed instructions once per basic
+    /// block and translates a block only after it was covered whole.
+    void setCoverage(Coverage* coverage)
+    { flushBlockCache(); coverage_ = coverage; }
+
+    /// Print the coverage of the ELF functions to the given file: For
+    /// each function, the counts of instructions, of executed
+    /// instructions, of conditional branches and of branches taken and
+    /// not taken, followed by the totals. Instructions are counted by
+    /// decoding each function from its start.
+    void reportCoverage(FILE* file, const Coverage& coverage);
+
+    /// Print the self profile of this hart (time per run loop phase
+    /// and decode cache statistics, see SelfProfile.hpp) to the given
+    /// stream. Return false if the simulator was built without
+    /// SELF_PROFILE.
+    bool printSelfProfile(std::ostream& out) const
+    {
+#ifdef SELF_PROFILE
+      selfProfile_.print(out, localHartId_);
+      return true;
+#else
+      (void) out;
+      return false;
+#endif
+    }
+
+    /// Clear the self profile of this hart. No-op if the simulator was
+    /// built without SELF_PROFILE.
+    void resetSelfProfile()
+    {
+#ifdef SELF_PROFILE
+      selfProfile_.reset();
+#endif
+    }
+
+    /// Turn the instruction trace on or off. Debug triggers with a
+    /// start-trace or stop-trace action (see Trigger::Action) turn it
+    /// on or off when they trip. The trace is on by default.
+    void setTraceOn(bool flag)
+    { traceOn_ = flag; }
+
+    /// Print the text trace of the given record (decoded from a
+    /// binary trace) to the given file. The output is identical to
+    /// that of a text trace of the instruction. Tmp is a temporary
+    /// string (for performance).
+    void printTraceRecord(const TraceRecord& rec, std::string& tmp, FILE* out);
+
     /// Return count of traps (exceptions or interrupts) seen by this
     /// hart.
     uint64_t getTrapCount() const
@@ -657,10 +991,37 @@ namespace WdRiscv
 
     /// Set load queue size (used when load exceptions are enabled).
     void setLoadQueueSize(unsigned size)
-    { maxLoadQueueSize_ = size; }
+    {
+      maxLoadQueueSize_ = size;
+      loadQueue_.setCapacity(size);
+    }
 
-    /// Enable collection of instruction frequencies.
-    void enableInstructionFrequency(bool b);
+    /// Set the number of entries of the decoded instruction cache
+    /// used by the run loops (rounded up to a power of 2 and clamped
+    /// to a reasonable range). A size of zero requests sizing the
+    /// cache from the executable segments of the loaded ELF files:
+    /// one entry per halfword of code. The cache is allocated when
+    /// first used.
+    void setDecodeCacheSize(uint64_t size);
+
+    /// Return the number of entries of the decoded instruction cache.
+    uint32_t decodeCacheSize() const
+    { return decodeCacheSize_; }
+
+    /// Decode the instructions of the executable segments of the
+    /// loaded ELF files into the decoded instruction cache using the
+    /// given number of threads. Instructions are located by a linear
+    /// sweep of each segment. This should be called after the ISA is
+    /// configured and the program is loaded.
+    void preDecode(unsigned threadCount);
+
+    /// Enable collection of instruction frequencies. The parts of the
+    /// profile beyond the opcode counts are selected by or-ing
+    /// InstProfile::Part values. An opcode-only profile is collected
+    /// from the execution counts of the cached blocks and does not
+    /// slow down the run.
+    void enableInstructionFrequency(bool b,
+				    unsigned parts = InstProfile::AllParts);
 
     /// Enable expedited dispatch of external interrupt handler: Instead of
     /// setting pc to the external interrupt handler, we set it to the
@@ -713,6 +1074,108 @@ namespace WdRiscv
     /// Print collected instruction frequency to the given file.
     void reportInstructionFrequency(FILE* file) const;
 
+    /// Return the timing model of this hart for configuration. The
+    /// model is used once enabled (see enableTimingModel).
+    TimingModel& timingModel()
+    { return timing_; }
+
+    /// Enable/disable the timing model: The stall cycles of the
+    /// configured caches, branch predictor and instruction latencies
+    /// are added to the cycle count and the cache/misprediction events
+    /// are counted by the performance counters. When enabled, the run
+    /// uses the instrumented run loop (as with performance counters).
+    void enableTimingModel(bool flag)
+    { timingModel_ = flag; }
+
+    /// Set the latency in cycles of the instruction with the given
+    /// name in the timing model. Return false if there is no such
+    /// instruction.
+    bool configInstLatency(const std::string& name, unsigned cycles)
+    {
+      InstId id = instTable_.getEntry(name).instId();
+      if (id == InstId::illegal)
+	return false;
+      timing_.setLatency(unsigned(id), cycles);
+      return true;
+    }
+
+    /// Set the ith entry of the given vector to the execution count of
+    /// the instruction with id i in the collected instruction profile.
+    void getInstructionFrequencies(std::vector<uint64_t>& freqs) const;
+
+    /// Set the given JSON object to the statistics of this hart: the
+    /// instruction, cycle and trap counts, the time and rate of the
+    /// runs, the performance counters and the instruction profile (if
+    /// enabled). See --statsfile in the README for the layout.
+    void getStats(nlohmann::json& stats) const;
+
+    /// Enable/disable the per-pc execution profile. In the fast run
+    /// loop, counts are kept per basic block and expanded to the
+    /// instructions of the block when reported. An instruction taking
+    /// an exception counts as executed.
+    void enablePcProfile(bool flag)
+    { flushBlockCache(); pcProfile_ = flag; }
+
+    /// Return the execution count of each executed instruction
+    /// address in the given map.
+    void getPcProfile(std::map<URV, uint64_t>& counts) const;
+
+    /// Add the given execution counts to the per-pc profile of this
+    /// hart (e.g. the profiles of the samples of a sampled run).
+    void addPcProfile(const std::map<URV, uint64_t>& counts)
+    {
+      for (const auto& [pc, count] : counts)
+	pcCounts_[pc] += count;
+    }
+
+    /// Print the per-pc profile to the given file: Executed instruction
+    /// count of each ELF function (hottest first) followed by the
+    /// given number of hottest instruction addresses with their
+    /// function and disassembly.
+    void reportPcProfile(FILE* file, unsigned topCount);
+
+    /// Print the per-pc profile to the given file in the collapsed
+    /// stack format of flamegraph tools: One line per ELF function
+    /// holding the function name and its executed instruction count.
+    void reportPcProfileFolded(FILE* file) const;
+
+    /// Sample the program counter once every period executed
+    /// instructions on average: The interval between samples is drawn
+    /// at random in [period/2, 3*period/2) to avoid aliasing with the
+    /// loops of the program. The fast run loop checks for a due sample
+    /// at basic block boundaries: the sampled pc is then the start of
+    /// a block. If stacks is true, the call graph profile is enabled
+    /// (see enableCallProfile) and the samples are also counted per
+    /// call path. A period of zero disables sampling.
+    void enableSampling(uint64_t period, bool stacks);
+
+    /// Print the sampled pc counts to the given file: Sample count of
+    /// each ELF function (hottest first) followed by the given number
+    /// of most sampled addresses.
+    void reportSamples(FILE* file, unsigned topCount);
+
+    /// Print the sample count of each call path to the given file in
+    /// the collapsed stack format of flamegraph tools (requires
+    /// sampling with stacks).
+    void reportSampleStacks(FILE* file);
+
+    /// Enable/disable the guest call graph profile (see CallProfile).
+    /// Enabling discards the previous profile.
+    void enableCallProfile(bool flag)
+    {
+      callGraph_ = flag;
+      callProfile_.reset(retiredInsts_, cycleCount_);
+    }
+
+    /// Print the call count and the inclusive and exclusive
+    /// instruction and cycle counts of each function of the call graph
+    /// profile to the given file.
+    void reportCallProfile(FILE* file);
+
+    /// Print the call graph profile to the given file in the collapsed
+    /// stack format of flamegraph tools.
+    void reportCallProfileFolded(FILE* file);
+
     /// Reset trace data (items changed by the execution of an
     /// instruction.)
     void clearTraceData();
@@ -727,10 +1190,64 @@ namespace WdRiscv
     void enablePerformanceCounters(bool flag)
     { enableCounters_ = flag;  }
 
+    /// Enable/disable macro-op fusion of common instruction pairs
+    /// (e.g. lui/addi) in the fast run loop. Fusion never applies
+    /// when tracing, single stepping, or in server mode where each
+    /// instruction is executed individually.
+    void enableMacroOpFusion(bool flag)
+    { fuseInsts_ = flag; flushBlockCache(); }
+
+    /// Enable/disable the translation of hot basic blocks (blocks
+    /// executed frequently) by the fast run loop into direct calls to
+    /// the instruction handlers.
+    void enableHotBlocks(bool flag)
+    { hotBlocks_ = flag; flushBlockCache(); }
+
     /// Enable gdb-mode.
     void enableGdb(bool flag)
     { enableGdb_ = flag; }
 
+    /// Kinds of data watchpoints (as in the gdb Z2/Z3/Z4 packets).
+    enum class WatchType { Write, Read, Access };
+
+    /// Reason of the last stop of a run at a breakpoint/watchpoint.
+    enum class StopReason { None, Breakpoint, Watchpoint };
+
+    /// Set a breakpoint at the given instruction address: A run stops
+    /// before executing the instruction unless resuming from a stop at
+    /// that breakpoint.
+    /// The instruction is flagged when decoded so that breakpoints
+    /// cost nothing on other instructions. Return false if a
+    /// breakpoint is already set at the address.
+    bool addBreakpoint(URV addr);
+
+    /// Remove the breakpoint at the given address. Return false if
+    /// there is no such breakpoint.
+    bool removeBreakpoint(URV addr);
+
+    /// Set a watchpoint of the given type on the size bytes at the
+    /// given data address: A run stops after a load/store instruction
+    /// accessing any of those bytes. Only the loads/stores of the
+    /// pages holding watched bytes are checked. Return false if size
+    /// is zero.
+    bool addWatchpoint(URV addr, unsigned size, WatchType type);
+
+    /// Remove a watchpoint previously set with addWatchpoint. Return
+    /// false if there is no such watchpoint.
+    bool removeWatchpoint(URV addr, unsigned size, WatchType type);
+
+    /// Return the reason of the last stop of a run, setting addr to
+    /// the instruction address of a breakpoint or to the data address
+    /// of a watchpoint. Return StopReason::None if the last run did
+    /// not stop at a breakpoint or watchpoint.
+    StopReason stopReason(URV& addr) const
+    { addr = stopPointAddr_; return stopReason_; }
+
+    /// Print the breakpoint/watchpoint that stopped the last run (if
+    /// any) on the standard error stream. Return true if a stop was
+    /// reported.
+    bool reportStopPoint() const;
+
     /// Enable use of ABI register names (e.g. sp instead of x2) in
     /// instruction disassembly.
     void enableAbiNames(bool flag)
@@ -880,15 +1397,414 @@ namespace WdRiscv
   protected:
 
     /// Helper to run method: Run until toHost is written or until
-    /// exit is called.
-    bool simpleRun();
+    /// exit is called or until the instruction counter reaches the
+    /// given limit (checked at basic block boundaries, the block
+    /// crossing the limit is executed up to the limit). Also stop
+    /// before entering a block holding stop1 or stop2 (~URV(0) for
+    /// none): At stop1 or stop2 if it is the stop address (see
+    /// setStopAddress) which starts its own block.
+    bool simpleRun(uint64_t limit = ~uint64_t(0), URV stop1 = ~URV(0),
+		   URV stop2 = ~URV(0));
+
+    /// Helper to run method in gdb mode: Give control to gdb then run
+    /// the block loop (simpleRun) which stops before breakpoints and
+    /// after watchpoint hits, giving control back to gdb at each stop.
+    /// The run ends at the given stop address (~URV(0) for none).
+    bool gdbRun(URV address);
+
+    /// Helper to the run loops: Record the given executed instruction
+    /// in the flight recorder, if any, then print its trace to the
+    /// given file if file is non-null and the trace is on.
+    void traceInst(const DecodedInst& di, uint64_t tag, std::string& tmp,
+		   FILE* out)
+    {
+      SELF_PROFILE_PHASE(Trace);
+      if (not flightRing_.empty())
+	flightRecord(di, tag);
+      if (not observers_.empty())
+	observeInst(di, tag);
+      if (out and traceOn_)
+	printInstTrace(di, tag, tmp, out);
+    }
+
+    /// Similar to the above but decode the given instruction first.
+    void traceInst(uint32_t inst, uint64_t tag, std::string& tmp, FILE* out);
+
+    /// Return true if executed instructions are recorded: The given
+    /// trace file is non-null, or the flight recorder is on, or the
+    /// hart has observers.
+    bool recordsInsts(FILE* traceFile) const
+    { return traceFile or not flightRing_.empty() or not observers_.empty(); }
+
+    /// Helper to traceInst: Add the events of the given executed
+    /// instruction to the pending observer events delivering them at
+    /// the end of a basic block.
+    void observeInst(const DecodedInst& di, uint64_t tag);
+
+    /// Helper to the instructions and methods that may change the
+    /// interrupt enables: Have the run loops re-evaluate the pending
+    /// interrupts.
+    void interruptEnablesChanged()
+    {
+      interruptPending_ = true;
+      if (eventInterrupts_)
+	nextEvent_.store(0, std::memory_order_relaxed);
+    }
+
+    /// Helper to the run loops: Run the events due at the current cycle
+    /// count and update the interrupts of the clint in MIP. Schedule
+    /// the next check.
+    void runEvents();
+
+    /// Helper to the run loops: Run the due events (see runEvents) then
+    /// take the highest priority interrupt if possible. Count is the
+    /// instruction count (for the branch trace). Return true if an
+    /// interrupt was taken.
+    bool processEvents(uint64_t count);
+
+    /// Helper to the conditional branch instructions: Record the
+    /// outcome of the current branch if coverage is on.
+    void coverBranch(bool taken)
+    {
+      if (coverage_)
+	coverage_->markBranch(currPc_, taken);
+    }
+
+    /// Helper to the run loops: Record a pc sample and schedule the
+    /// next one. Count is the instruction count of the hart.
+    void takeSample(uint64_t count);
+
+    /// Helper to reportPcProfile and reportSamples: Print the sum of
+    /// the given per-pc counts of each ELF function followed by the
+    /// given number of addresses with the highest counts.
+    void printPcCounts(FILE* file, const std::map<URV, uint64_t>& counts,
+		       unsigned topCount);
+
+    /// Helper to execJalr: Record a call or a return in the call
+    /// graph profile. RetAddr is the address following the jalr.
+    void callProfileJalr(const DecodedInst* di, URV retAddr);
+
+    /// Helper to traceInst: Add the given instruction to the flight
+    /// recorder.
+    void flightRecord(const DecodedInst& di, uint64_t tag);
+
+    /// Helper to the run loops: Record a control flow event in the
+    /// branch trace. Tag is the instruction count at the event.
+    void branchEvent(uint64_t tag, URV from, URV to, BranchEvent::Kind kind)
+    {
+      BranchEvent event;
+      event.tag = tag; event.from = from; event.to = to;
+      event.hartId = localHartId_; event.kind = kind;
+      BranchTrace::encode(event, branchState_, branchBuf_);
+      if (branchBuf_.size() >= 64*1024)
+	flushBranchTrace();
+    }
+
+    /// Write the pending events of the branch trace to its file.
+    void flushBranchTrace();
+
+    /// Helper to untilAddress: Run until the given address tracing
+    /// only the instructions inside the trace window (see
+    /// setTraceWindow).
+    bool windowedRun(URV address, FILE* traceFile);
+
+    /// Helper to windowedRun: Run without tracing until the
+    /// instruction count reaches limit or the program counter reaches
+    /// stop1 or stop2 (~URV(0) for none). Use simpleRun if no other
+    /// run loop feature is enabled.
+    bool runUntraced(uint64_t limit, URV stop1, URV stop2);
+
+    /// Run loop features: untilAddress is specialized for each
+    /// combination of these so that a configuration only pays for the
+    /// checks it needs.
+    enum RunFeature : unsigned
+      {
+	RunTrace = 1,       // Trace file.
+	RunTriggers = 2,    // Debug triggers.
+	RunCounters = 4,    // Performance counters.
+	RunStats = 8,       // Instruction frequency/profile.
+	RunStopAddr = 16,   // Stop address.
+	RunLimit = 32,      // Instruction count limit.
+	RunAllFeatures = 63
+      };
+
+    /// Return the run loop features required to run until the given
+    /// address (~URV(0) for no stop address) with the given trace file
+    /// and the current hart configuration.
+    unsigned runLoopFeatures(URV address, FILE* traceFile) const;
+
+    /// Return the features of runLoopFeatures that the block run loop
+    /// (simpleRun) does not support. The opcode counts of an
+    /// opcode-only instruction profile are collected by that loop.
+    unsigned complexRunFeatures(URV address, FILE* traceFile) const
+    {
+      unsigned features = runLoopFeatures(address, traceFile);
+      if (blockInstFreq_)
+	features &= ~unsigned(RunStats);
+      // The block loop stops before breakpoints and at the stop
+      // address (see getBasicBlock) and at the exact instruction
+      // count limit.
+      if (address == ~URV(0) or (stopAddrValid_ and address == stopAddr_))
+	features &= ~unsigned(RunStopAddr);
+      features &= ~unsigned(RunLimit);
+      return features;
+    }
+
+    /// Helper to the load/store methods: Record a watchpoint stop if
+    /// the given access of size bytes at addr hits a watchpoint. The
+    /// run stops after the current instruction.
+    void checkWatchpoints(URV addr, unsigned size, bool isStore);
+
+    /// Helper to add/removeBreakpoint and set/clearStopAddress: Drop
+    /// the decoded instruction at the given address and the basic
+    /// blocks of its page so that they get decoded with the current
+    /// breakpoint and stop point flags.
+    void invalidateBreakpoint(URV addr);
+
+    /// Helper to the load/store methods: Same as checkWatchpoints but
+    /// only if the access falls in a watched page.
+    void checkWatch(URV addr, unsigned size, bool isStore)
+    {
+      if (memory_.isWatchedPage(addr) or
+	  memory_.isWatchedPage(addr + size - 1))
+	checkWatchpoints(addr, size, isStore);
+    }
+
+    /// Helper to untilAddress: Run loop specialized for the given
+    /// combination of RunFeature bits.
+    template<unsigned FEATURES>
+    bool untilAddressLoop(URV address, FILE* traceFile);
+
+    /// Helper to untilAddress: Call the instance of untilAddressLoop
+    /// matching the given features.
+    template<unsigned FEATURES>
+    bool dispatchRunLoop(unsigned features, URV address, FILE* traceFile);
+
+    /// Helper to simpleRun: Return the basic block starting at the
+    /// given address building it if it is not in the block cache.
+    /// Return nullptr if the first instruction of the block cannot be
+    /// fetched in which case an exception is initiated.
+    BasicBlock<URV>* getBasicBlock(URV addr);
+
+    /// Return true if given instruction must be the last one in a
+    /// basic block: it may change the pc, the privilege mode, or the
+    /// way subsequent instructions are decoded.
+    bool endsBasicBlock(const InstEntry& entry) const;
+
+    /// Discard all the blocks of the basic block cache.
+    void flushBlockCache();
+
+    /// Return true if the code of the given block was modified since
+    /// the block was decoded.
+    bool isBlockStale(const BasicBlock<URV>& bb) const
+    {
+      return ( memory_.codeGeneration(bb.address) != bb.codeGen[0] or
+	       memory_.codeGeneration(bb.endAddress - 1) != bb.codeGen[1] );
+    }
+
+    /// Clear the instructions, translation, and successors of the
+    /// given block recycling its compiled code.
+    void clearBlock(BasicBlock<URV>& bb);
+
+    /// Helper to the block run loops: Uncount from the per-pc profile
+    /// and from the block-collected opcode counts the instructions of
+    /// the given block starting at next that were not executed because
+    /// the block was left early (trap, stop). Counts are modulo 2^64:
+    /// the decrement cancels the increment of the block entry.
+    void unprofileBlockTail(const BasicBlock<URV>& bb, const DecodedInst* next)
+    {
+      const DecodedInst* end = bb.insts.data() + bb.insts.size();
+      for ( ; next < end; ++next)
+	{
+	  if (pcProfile_)
+	    --pcCounts_[next->address()];
+	  if (blockInstFreq_)
+	    unprofileInst(*next);
+	}
+    }
+
+    /// Uncount the given instruction from the block-collected opcode
+    /// counts: A trapping instruction does not count as executed.
+    void unprofileInst(const DecodedInst& di)
+    { --instProfile_.record(di.instEntry()->instId())[InstProfile::Freq]; }
+
+    /// Return the kind of macro-op fusion applicable to the given
+    /// consecutive instructions or FusedOp::None if they cannot be
+    /// fused.
+    FusedOp fusionKind(const DecodedInst& first,
+		       const DecodedInst& second) const;
+
+    /// Mark the fusible instruction pairs of the given block.
+    void fuseBlockInsts(BasicBlock<URV>& bb);
+
+    /// Execute the fused instruction pair starting with the given
+    /// instruction (the second instruction follows it in memory).
+    void executeFused(const DecodedInst* di);
+
+    /// Return the handler to use for the given instruction in a
+    /// translated block. Set pure to true if the instruction cannot
+    /// trap, does not use the pc, and does not access memory.
+    /// Instructions outside the integer subset (csr, fp, atomic ...)
+    /// use the interpreter (execute method).
+    typename BasicBlock<URV>::ExecFn hotHandler(InstId id, bool& pure) const;
+
+    /// Translate the given block into hot operations.
+    void translateBlock(BasicBlock<URV>& bb);
+
+    /// Execute the hot operations of the given translated block.
+    void runHotBlock(const BasicBlock<URV>& bb);
+
+    /// Replace runs of pure operations of the given translated block
+    /// by compiled functions: WebAssembly functions in the Emscripten
+    /// build and x86-64 host code on x86-64 hosts (see X86Block).
+    void compileHotOps(BasicBlock<URV>& bb);
+
+    /// Set the decode cache size to the given number of entries
+    /// (rounded up to a power of 2) releasing the current cache.
+    void resizeDecodeCache(uint64_t size);
+
+    /// Return true if a device register access of the given size at
+    /// the given MMIO window offset must go to the JS devices: the
+    /// accessed words are side-effecting or the access is not
+    /// contained in the window.
+    bool isMmioSideEffect(URV offset, unsigned size) const
+    {
+      if (offset + size > mmioSize_)
+	return true;
+      URV first = offset >> 2, last = (offset + size - 1) >> 2;
+      return ( ((mmioSideEffect_[first >> 6] >> (first & 63)) & 1) or
+	       ((mmioSideEffect_[last >> 6] >> (last & 63)) & 1) );
+    }
+
+    /// Return true if the page of the given address is recorded as
+    /// plain memory in the given software TLB (readTlb_ or writeTlb_).
+    /// Invalidate both TLBs if the memory page attributes changed
+    /// since they were filled.
+    bool tlbHit(const std::vector<size_t>& tlb, size_t addr)
+    {
+      if (tlbGen_ != memory_.attribGeneration())
+	{
+	  readTlb_.assign(tlbSize_, 0);
+	  writeTlb_.assign(tlbSize_, 0);
+	  tlbGen_ = memory_.attribGeneration();
+	  return false;
+	}
+      size_t page = memory_.getPageIx(addr);
+      return tlb[page & (tlbSize_ - 1)] == page + 1;
+    }
+
+    /// Record the page of the given address in the given software TLB
+    /// if it is plain memory (readable for the read TLB, writable for
+    /// the write TLB).
+    void tlbFill(std::vector<size_t>& tlb, size_t addr)
+    {
+      if (memory_.isPlainPage(addr, &tlb == &writeTlb_))
+	{
+	  size_t page = memory_.getPageIx(addr);
+	  tlb[page & (tlbSize_ - 1)] = page + 1;
+	}
+    }
+
+    /// Return true if an AMO or SC of the given size at the given
+    /// address is done with a host compare-and-swap when there are
+    /// several harts: The address is aligned in plain memory (see
+    /// Memory::isPlainPage) outside of the to-host location, the clint
+    /// and the MMIO window. The result depends only on the address and
+    /// the page attributes so that all the harts use the same protocol
+    /// for a given word: AMOs and SCs to other addresses hold the
+    /// memory AMO mutex.
+    bool isAmoCasAddr(URV addr, unsigned size) const
+    {
+      if ((addr & (size - 1)) != 0)
+	return false;
+      if (toHostValid_ and addr == toHost_)
+	return false;
+      if (clint_ and clint_->contains(addr))
+	return false;
+#ifdef __EMSCRIPTEN__
+      if (addr - mmioBase_ < mmioSize_)
+	return false;
+#endif
+      return memory_.isPlainPage(addr, true);
+    }
+
+    /// Return true if the access checks of loads/stores reduce to
+    /// page attribute checks and stack checks (see checkStackLoad and
+    /// checkStackStore): no region-prediction, wide or forced-failure
+    /// checks are active.
+    bool isPlainAccess() const
+    { return not (wideLdSt_ or eaCompatWithBase_ or forceAccessFail_); }
+
+    /// Return true if the access checks of loads/stores reduce to
+    /// page attribute checks for the given base register: no stack,
+    /// region-prediction, wide or forced-failure checks are active.
+    bool isPlainLdSt(unsigned rs1) const
+    { return isPlainAccess() and not (rs1 == RegSp and checkStackAccess_); }
 
     /// Helper to decode. Used for compressed instructions.
     const InstEntry& decode16(uint16_t inst, uint32_t& op0, uint32_t& op1,
 			      uint32_t& op2);
 
-    /// Helper to whatIfSingleStep.
-    void collectAndUndoWhatIfChanges(URV prevPc, ChangeRecord& record);
+    /// Scalar state of this hart restored by rollbackUndoLog.
+    struct UndoBase
+    {
+      URV pc = 0;
+      URV currPc = 0;
+      PrivilegeMode privMode = PrivilegeMode::Machine;
+      bool debugMode = false;
+      bool debugStepMode = false;
+      bool dcsrStepIe = false;
+      bool dcsrStep = false;
+      bool ebreakInstDebug = false;
+      bool nmiPending = false;
+      NmiCause nmiCause = NmiCause::UNKNOWN;
+      bool countersCsrOn = true;
+      bool prevCountersCsrOn = true;
+      bool targetProgFinished = false;
+      bool interruptEnable = false;
+      uint64_t instCounter = 0;
+      uint64_t retiredInsts = 0;
+      uint64_t cycleCount = 0;
+      uint64_t exceptionCount = 0;
+      uint64_t consecutiveIllegalCount = 0;
+      uint64_t counterAtLastIllegal = 0;
+    };
+
+    /// Previous value of a resource changed while recording an undo
+    /// log. For memory, addr/size are those of the write and value
+    /// holds the previous bytes in little-endian order.
+    struct UndoEntry
+    {
+      enum class Kind : uint8_t { IntReg, FpReg, Csr, Mem };
+
+      Kind kind = Kind::IntReg;
+      unsigned size = 0;
+      uint64_t addr = 0;    // Register/CSR number or memory address.
+      uint64_t value = 0;
+    };
+
+    /// Capture the scalar state restored by rollbackUndoLog.
+    void saveUndoBase(UndoBase& base) const;
+
+    /// Restore scalar state captured by saveUndoBase.
+    void restoreUndoBase(const UndoBase& base);
+
+    /// Append to the undo log the previous values of the resources
+    /// changed since the last clearTraceData. Memory is recorded
+    /// from the last-write info (single write) if withMemory is true:
+    /// an undo log records memory in the memory write journal.
+    void recordUndoEntries(bool withMemory = true);
+
+    /// Undo the undo log entries at and after the given index in
+    /// reverse order and remove them from the log.
+    void undoEntries(size_t mark);
+
+    /// Helper to whatIfSingleStep: Record in the undo log the changes
+    /// of the what-if instruction, copy their new values into the
+    /// given record, undo the changes (and the undo log entries
+    /// starting at mark) and restore the given scalar state.
+    void collectAndUndoWhatIfChanges(size_t mark, const UndoBase& base,
+				     ChangeRecord& record);
 
     /// Return the effective rounding mode for the currently executing
     /// floating point instruction.
@@ -897,6 +1813,11 @@ namespace WdRiscv
     /// Update the accrued floating point bits in the FCSR register.
     void updateAccruedFpBits();
 
+    /// Clear the floating point flags of the machine running this
+    /// simulator before an FP instruction unless they are all already
+    /// accrued in FCSR. Do nothing in the simulated RISCV machine.
+    void clearSimulatorFpFlags();
+
     /// Undo the effect of the last executed instruction given that
     /// that a trigger has tripped.
     void undoForTrigger();
@@ -959,11 +1880,11 @@ namespace WdRiscv
 					   SecondaryCause& secCause);
 
     /// Helper to execLr. Load type should be int32_t, or int64_t.
-    /// Return true if instruction is successful. Return false if an
-    /// exception occurs or a trigger is tripped.
+    /// Return true if instruction is successful making a reservation
+    /// for the loaded bytes. Return false if an exception occurs or a
+    /// trigger is tripped.
     template<typename LOAD_TYPE>
     bool loadReserve(uint32_t rd, uint32_t rs1);
-
     /// Helper to execSc. Store type should be uint32_t, or uint64_t.
     /// Return true if store is successful. Return false otherwise
     /// (exception or trigger or condition failed).
@@ -978,18 +1899,28 @@ namespace WdRiscv
     /// specfic.
     bool wideStore(URV addr, URV storeVal, unsigned storeSize);
 
-    /// Helper to load methods. Check loads performed with stack
-    /// pointer.  Return true if referenced bytes are all between the
-    /// stack bottom and the stack pointer value excluding the stack
-    /// pointer value.  Initiate an exception and return false
-    /// otherwise.
-    bool checkStackLoad(URV addr, unsigned loadSize);
+    /// Return true if the size bytes at addr are all within the count
+    /// bytes at low: A single range compare once the window is known.
+    static bool inStackWindow(URV addr, unsigned size, URV low, URV count)
+    { return count >= size and URV(addr - low) <= count - size; }
+
+    /// Helper to load methods. Check loads performed with the stack
+    /// pointer of value sp (the base register value of the load).
+    /// Return true if referenced bytes are all between the stack
+    /// bottom and the stack pointer value excluding the stack pointer
+    /// value and false otherwise.
+    bool checkStackLoad(URV sp, URV addr, unsigned loadSize) const
+    {
+      URV count = stackMax_ > sp ? stackMax_ - sp : 0;
+      return inStackWindow(addr, loadSize, sp + 1, count);
+    }
 
     /// Helper to store methods. Check stores performed with stack
     /// pointer. Return true if referenced bytes are all between the
     /// stack bottom and the stack top excluding the stack top and
-    /// false otherwise.
-    bool checkStackStore(URV addr, unsigned storeSize);
+    /// false otherwise. The window is computed by updateStackChecker.
+    bool checkStackStore(URV addr, unsigned storeSize) const
+    { return inStackWindow(addr, storeSize, stackStoreLow_, stackStoreCount_); }
 
     /// Helper to CSR instructions. Keep minstret and mcycle up to date.
     void preCsrInstruction(CsrNumber csr);
@@ -1008,30 +1939,45 @@ namespace WdRiscv
     /// has a hit on the given address and given timing
     /// (before/after). Set the hit bit of all the triggers that trip.
     bool ldStAddrTriggerHit(URV addr, TriggerTiming t, bool isLoad, bool ie)
-    { return csRegs_.ldStAddrTriggerHit(addr, t, isLoad, ie); }
+    {
+      SELF_PROFILE_PHASE(Triggers);
+      return csRegs_.ldStAddrTriggerHit(addr, t, isLoad, ie);
+    }
 
     /// Return true if one or more load-address/store-address trigger
     /// has a hit on the given data value and given timing
     /// (before/after). Set the hit bit of all the triggers that trip.
     bool ldStDataTriggerHit(URV value, TriggerTiming t, bool isLoad, bool ie)
-    { return csRegs_.ldStDataTriggerHit(value, t, isLoad, ie); }
+    {
+      SELF_PROFILE_PHASE(Triggers);
+      return csRegs_.ldStDataTriggerHit(value, t, isLoad, ie);
+    }
 
     /// Return true if one or more execution trigger has a hit on the
     /// given address and given timing (before/after). Set the hit bit
     /// of all the triggers that trip.
     bool instAddrTriggerHit(URV addr, TriggerTiming t, bool ie)
-    { return csRegs_.instAddrTriggerHit(addr, t, ie); }
+    {
+      SELF_PROFILE_PHASE(Triggers);
+      return csRegs_.instAddrTriggerHit(addr, t, ie);
+    }
 
     /// Return true if one or more execution trigger has a hit on the
     /// given opcode value and given timing (before/after). Set the
     /// hit bit of all the triggers that trip.
     bool instOpcodeTriggerHit(URV opcode, TriggerTiming t, bool ie)
-    { return csRegs_.instOpcodeTriggerHit(opcode, t, ie); }
+    {
+      SELF_PROFILE_PHASE(Triggers);
+      return csRegs_.instOpcodeTriggerHit(opcode, t, ie);
+    }
 
     /// Make all active icount triggers count down, return true if
     /// any of them counts down to zero.
     bool icountTriggerHit()
-    { return csRegs_.icountTriggerHit(isInterruptEnabled()); }
+    {
+      SELF_PROFILE_PHASE(Triggers);
+      return csRegs_.icountTriggerHit(isInterruptEnabled());
+    }
 
     /// Return true if this hart has one or more active debug
     /// triggers.
@@ -1043,6 +1989,11 @@ namespace WdRiscv
     bool hasActiveInstTrigger() const
     { return (enableTriggers_ and csRegs_.hasActiveInstTrigger()); }
 
+    /// Helper to accumulateInstructionStats: Add the stall cycles of
+    /// the given retired instruction computed by the timing model to
+    /// the cycle count and count the timing model events.
+    void applyTimingModel(const DecodedInst& di);
+
     /// Collect instruction stats (for instruction profile and/or
     /// performance monitors).
     void accumulateInstructionStats(const DecodedInst&);
@@ -1079,6 +2030,23 @@ namespace WdRiscv
     void printInstTrace(uint32_t instruction, uint64_t tag, std::string& tmp,
 			FILE* out, bool interrupt = false);
 
+    /// Collect in rec the state changes of the given instruction
+    /// (just executed) for the trace.
+    void collectTraceRecord(const DecodedInst& di, uint64_t tag,
+			    bool interrupt, TraceRecord& rec);
+
+    /// Print the text trace of the given record of the given
+    /// instruction.
+    void formatTraceRecord(const DecodedInst& di, const TraceRecord& rec,
+			   std::string& tmp, FILE* out);
+
+    /// Return the disassembly of the given decoded instruction from
+    /// the disassembly cache of the instruction trace, disassembling
+    /// it on a miss. An entry is reused only if its address,
+    /// instruction bits and decoded instruction match, so modified
+    /// code and changes of ISA are never served stale text.
+    const std::string& cachedDisassembly(const DecodedInst& di);
+
     /// Start a synchronous exceptions.
     void initiateException(ExceptionCause cause, URV pc, URV info,
 			   SecondaryCause secCause = SecondaryCause::NONE);
@@ -1112,11 +2080,6 @@ namespace WdRiscv
     /// modify pc_.
     void execute(const DecodedInst* di);
 
-    /// Helper to decode: Decode instructions associated with opcode
-    /// 1010011.
-    const InstEntry& decodeFp(uint32_t inst, uint32_t& op0, uint32_t& op1,
-			      uint32_t& op2, uint32_t& op3);
-
     /// Helper to disassembleInst32: Disassemble instructions
     /// associated with opcode 1010011.
     void disassembleFp(uint32_t inst, std::ostream& stream);
@@ -1152,6 +2115,48 @@ namespace WdRiscv
     /// Implement some newlib/Linux system calls in the simulator.
     URV emulateSyscall();
 
+    /// Helper to execEcall: Same as emulateSyscall but record the
+    /// results of the calls with nondeterministic results (host file
+    /// reads, times, gettimeofday) in the input log or replay them
+    /// from it.
+    URV emulateLoggedSyscall();
+
+    /// Return the value of the nondeterministic input of the given
+    /// kind obtained by calling read, recording it in the input log or
+    /// replaying it from the log (see setInputLog).
+    template <typename F>
+    int64_t loggedInput(InputLog::Kind kind, F read);
+
+    /// Helper to emulateSyscall: Emulate the given system call using
+    /// the in-memory file system (see setVfs). Set handled to false if
+    /// the call is not a file system call or if it refers to a
+    /// standard stream.
+    URV emulateVfsSyscall(URV num, bool& handled);
+
+    /// Return true if the emulated write/writev system calls buffer
+    /// their output to the given host file descriptor (see
+    /// flushTargetOutput). Only valid writable descriptors are
+    /// buffered so that write errors are reported by the call.
+    bool isOutputBuffered(int fd);
+
+    /// Append given data to the output buffer of the given host file
+    /// descriptor flushing as needed.
+    void bufferOutput(int fd, const char* data, size_t size);
+
+    /// Write given data to the given host file descriptor.
+    void writeOutput(int fd, const char* data, size_t size);
+
+    /// Append given byte to the console output buffer flushing as
+    /// needed.
+    void bufferConsoleOutput(char c)
+    {
+      consoleBuffer_.push_back(c);
+      outputPending_ = true;
+      if (not outputBuffering_ or (c == '\n' and consoleTty_) or
+	  consoleBuffer_.size() >= outBufferSize)
+	flushTargetOutput();
+    }
+
     /// Check address associated with an atomic memory operation (AMO)
     /// instruction. Return true if AMO accsess is allowed. Return false
     /// trigerring an exception if address is misaligned or if it is out
@@ -1170,10 +2175,30 @@ namespace WdRiscv
     /// place in which case val is not modified.
     bool amoLoad64(uint32_t rs1, URV& val);
 
+    /// Execute an AMO instruction: Load the memory operand of type
+    /// LOAD_TYPE (uint32_t or uint64_t) at the address in rs1, store
+    /// op(rs2-value, loaded-value) back and put the sign extended
+    /// loaded value in rd.
+    template <typename LOAD_TYPE, typename OP>
+    void amoExecute(const DecodedInst* di, OP op);
+
     /// Invalidate cache entries overlapping the bytes written by a
     /// store.
     void invalidateDecodeCache(URV addr, unsigned storeSize);
 
+    /// Invalidate the cached decoded instructions of the pages whose
+    /// code was written by other harts (see Memory::codeEpoch) since
+    /// the last call.
+    void syncDecodeCache();
+
+    /// Call syncDecodeCache if code was written since the last
+    /// synchronization.
+    void checkCodeWrites()
+    {
+      if (memory_.codeEpoch() != codeEpochSeen_)
+	syncDecodeCache();
+    }
+
     /// Update stack checker paramters after a write/poke to a CSR.
     void updateStackChecker();
 
@@ -1186,12 +2211,19 @@ namespace WdRiscv
     /// greater than XLEN-1 returning false; otherwise return true.
     bool checkShiftImmediate(URV imm);
 
-    /// Helper to the run mehtods: Log (on the standard error) the
-    /// cause of a stop signaled with an exception. Return true if
-    /// program finished successfully, return false otherwise.  If
-    /// traceFile is non-null, then trace the instruction that caused
-    /// the stop.
-    bool logStop(const CoreException& ce, uint64_t instCount, FILE* traceFile);
+    /// Record a stop of the target program and end the run: The
+    /// current instruction completes (and is traced) and the run
+    /// loops stop at their next check of runOk (at the latest at the
+    /// end of the current basic block) then report the stop (see
+    /// logStop). A stop already pending is kept.
+    void requestStop(CoreException::Type type, const char* message,
+		     uint64_t address = 0, uint64_t value = 0);
+
+    /// Helper to the run mehtods: If a stop is pending (see
+    /// requestStop), log its cause on the standard error, clear it and
+    /// return true if program finished successfully and false
+    /// otherwise. Return the given success if no stop is pending.
+    bool logStop(bool success);
 
     // rs1: index of source register (value range: 0 to 31)
     // rs2: index of source register (value range: 0 to 31)
@@ -1496,6 +2528,8 @@ namespace WdRiscv
     URV resetPc_ = 0;            // Pc to use on reset.
     URV stopAddr_ = 0;           // Pc at which to stop the simulator.
     bool stopAddrValid_ = false; // True if stopAddr_ is valid.
+    CoreException pendingStop_{CoreException::Stop};  // See requestStop.
+    bool stopPending_ = false;   // True if pendingStop_ is to be reported.
 
     URV toHost_ = 0;             // Writing to this stops the simulator.
     bool toHostValid_ = false;   // True if toHost_ is valid.
@@ -1507,6 +2541,83 @@ namespace WdRiscv
 
     URV nmiPc_ = 0;              // Non-maskable interrupt handler address.
     bool nmiPending_ = false;
+
+    // True if the pending interrupts must be re-evaluated by the
+    // run loop: Set by the interrupt controller (Emscripten build) and
+    // by instructions that may change the interrupt enables.
+    bool interruptPending_ = true;
+
+    // Events of the hart keyed on the cycle count (see
+    // scheduleInterrupt and attachClint). The run loops compare the
+    // cycle count with nextEvent_ which other harts clear (see
+    // Clint::write) to have this hart re-evaluate its interrupts.
+    EventQueue events_;
+    std::atomic<uint64_t> nextEvent_{~uint64_t(0)};
+    bool eventInterrupts_ = false;  // True if events drive interrupts.
+    Clint* clint_ = nullptr;
+    unsigned clintIx_ = 0;          // Index of this hart in clint.
+
+    // Software TLBs (direct mapped) of plain memory pages used by the
+    // load/store fast path. Entry i holds the page number plus 1 of a
+    // page mapping to i (0 if invalid).
+    static constexpr size_t tlbSize_ = 64;
+    std::vector<size_t> readTlb_ = std::vector<size_t>(tlbSize_);
+    std::vector<size_t> writeTlb_ = std::vector<size_t>(tlbSize_);
+    uint32_t tlbGen_ = 0;  // Memory attribute generation of TLBs.
+
+    // State captured by takeSnapshot.
+    struct Snapshot
+    {
+      std::vector<URV> intRegs;
+      std::vector<double> fpRegs;
+      std::vector<URV> csrValues;  // One per CSR (index is number).
+      Triggers<URV> triggers;
+      std::vector<EventNumber> eventOfCounter;
+      std::vector< std::vector<unsigned> > countersOfEvent;
+      bool interruptEnable = false;
+      bool hasActiveTrigger = false;
+      bool hasActiveInstTrigger = false;
+      bool mdseacLocked = false;
+
+      URV pc = 0;
+      URV progBreak = 0;
+      PrivilegeMode privMode = PrivilegeMode::Machine;
+      bool debugMode = false;
+      bool debugStepMode = false;
+      bool dcsrStepIe = false;
+      bool dcsrStep = false;
+      bool ebreakInstDebug = false;
+      bool nmiPending = false;
+      NmiCause nmiCause = NmiCause::UNKNOWN;
+      bool hartStarted = true;
+      bool countersCsrOn = true;
+      bool prevCountersCsrOn = true;
+      bool targetProgFinished = false;
+      uint64_t instCounter = 0;
+    };
+    Snapshot snapshot_;
+    bool hasSnapshot_ = false;
+
+    /// Copy the state of this hart (memory excepted) to/from snap.
+    void captureState(Snapshot& snap);
+    void applyState(const Snapshot& snap);
+
+    // Undo log (see beginUndoLog).
+    std::vector<UndoEntry> undoLog_;
+    UndoBase undoBase_;
+    size_t undoMemMark_ = 0;   // Memory write journal position.
+    bool undoLogActive_ = false;
+
+    // False while a run loop that never consults the last-write info
+    // of memory (no trace, no stats) is active: stores then skip the
+    // last-write bookkeeping.
+    bool trackLastWrite_ = true;
+
+    // MMIO window (see configMmioWindow).
+    URV mmioBase_ = 0xffff0000;
+    URV mmioSize_ = 0x10000;
+    std::vector<uint8_t> mmioWindow_;
+    std::vector<uint64_t> mmioSideEffect_;  // One bit per window word.
     NmiCause nmiCause_ = NmiCause::UNKNOWN;
     bool nmiEnabled_ = true;
 
@@ -1530,6 +2641,8 @@ namespace WdRiscv
     uint64_t instCountLim_ = ~uint64_t(0);
     uint64_t exceptionCount_ = 0;
     uint64_t interruptCount_ = 0;
+    uint64_t runInsts_ = 0;      // Instructions executed by timed runs.
+    double runTime_ = 0;         // Wall-clock seconds of timed runs.
     uint64_t consecutiveIllegalCount_ = 0;
     uint64_t counterAtLastIllegal_ = 0;
     bool forceAccessFail_ = false;  // Force load/store access fault.
@@ -1540,23 +2653,83 @@ namespace WdRiscv
     uint64_t forceAccessFailMark_ = 0; // Instruction at which forced fail is seen.
 
     bool instFreq_ = false;         // Collection instruction frequencies.
+    bool pcProfile_ = false;        // Collect per-pc execution counts.
+    bool blockInstFreq_ = false;    // Opcode counts from block counts.
+    bool timingModel_ = false;      // Apply timing model.
+    TimingModel timing_;
+    bool callGraph_ = false;        // Collect call graph profile.
+    CallProfile callProfile_;
+    uint64_t samplePeriod_ = 0;     // Mean instructions between samples.
+    uint64_t nextSample_ = ~uint64_t(0); // Count of next pc sample.
+    uint64_t sampleRand_ = 0x9e3779b97f4a7c15; // Sample interval generator.
+    bool sampleStacks_ = false;     // Count samples per call path.
+    std::unordered_map<URV, uint64_t> samplePcs_; // Sample count per pc.
+    std::unordered_map<URV, uint64_t> pcCounts_; // Per-pc counts of the
+                                    // untilAddress loop and of discarded
+                                    // basic blocks.
     bool enableCounters_ = false;   // Enable performance monitors.
+    bool fuseInsts_ = true;         // Enable macro-op fusion in simpleRun.
+    bool hotBlocks_ = true;         // Enable hot block translation.
+    std::vector<uintptr_t> freeCompiled_; // Reusable compiled code slots.
+    static constexpr unsigned hotBlockThreshold_ = 16;
     bool prevCountersCsrOn_ = true;
     bool countersCsrOn_ = true;     // True when counters CSR is set to 1.
     bool enableTriggers_ = false;   // Enable debug triggers.
     bool enableGdb_ = false;        // Enable gdb mode.
+
+    struct Watchpoint
+    {
+      URV addr = 0;
+      unsigned size = 0;
+      WatchType type = WatchType::Write;
+    };
+
+    std::unordered_set<URV> breakpoints_;    // Breakpoint addresses.
+    std::vector<Watchpoint> watchpoints_;
+    StopReason stopReason_ = StopReason::None;
+    URV stopPointAddr_ = 0;         // Address of last breakpoint/watchpoint.
+    uint64_t breakResume_ = ~uint64_t(0);  // Inst count at last breakpoint stop.
     bool abiNames_ = false;         // Use ABI register names when true.
     bool newlib_ = false;           // Enable newlib system calls.
     bool linux_ = false;            // ENable linux system calls.
     bool amoIllegalOutsideDccm_ = false;
 
     bool traceLoad_ = false;        // Trace addr of load inst if true.
+    bool binaryTrace_ = false;      // Binary instead of text trace if true.
+    TraceRecord traceRec_;          // Scratch for printInstTrace.
+    std::vector<unsigned> lastTriggers_;  // Scratch for lastCsrValues.
+    BinaryTrace::HartState binTraceState_;
+    std::vector<uint8_t> binTraceBuf_;
+    TraceWriter* traceWriter_ = nullptr;  // Asynchronous trace writer.
+    bool traceOn_ = true;           // Trace gated on (see setTraceOn).
+    bool traceWindow_ = false;      // Trace limited to a window.
+    bool traceWindowOpen_ = false;
+    bool traceWindowDone_ = false;  // Window will not open again.
+    uint64_t traceFromInst_ = 0;
+    uint64_t traceToInst_ = ~uint64_t(0);
+    uint64_t traceWindowStart_ = 0; // Inst count when window opened.
+    URV traceFromPc_ = ~URV(0);
+    URV traceToPc_ = ~URV(0);
+    std::vector<FlightRecord> flightRing_; // Flight recorder (empty if off).
+#ifdef SELF_PROFILE
+    mutable SelfProfile selfProfile_;
+#endif
+    std::vector<Observer*> observers_;            // Empty if none.
+    std::vector<ObserverEvent> observerEvents_;   // Pending events.
+    Coverage* coverage_ = nullptr;  // Instruction/branch coverage.
+    size_t flightNext_ = 0;         // Next slot of flight ring.
+    uint64_t flightCount_ = 0;      // Records added to flight ring.
+    std::string flightPath_;        // Flight recorder dump file.
+    const char* flightDumpReason_ = nullptr; // Run failure to dump for.
+    FILE* branchFile_ = nullptr;    // Branch trace file (null if off).
+    BranchTrace::HartState branchState_;
+    std::vector<uint8_t> branchBuf_; // Pending branch trace events.
     URV loadAddr_ = 0;              // Address of data of most recent load inst.
     bool loadAddrValid_ = false;    // True if loadAddr_ valid.
 
-    // We keep track of the last committed 8 loads so that we can
-    // revert in the case of an imprecise load exception.
-    std::vector<LoadInfo> loadQueue_;
+    // We keep track of the last committed maxLoadQueueSize_ loads so
+    // that we can revert in the case of an imprecise load exception.
+    RingQueue<LoadInfo> loadQueue_;
     unsigned maxLoadQueueSize_ = 16;
     bool loadQueueEnabled_ = false;
 
@@ -1572,11 +2745,29 @@ namespace WdRiscv
     bool useElfSymbols_ = true;
     unsigned mxlen_ = 8*sizeof(URV);
     FILE* consoleOut_ = nullptr;
+    int stdFds_[3] = { 0, 1, 2 };  // Host fds of target stdin/out/err.
+    Vfs* vfs_ = nullptr;           // In-memory file system (see setVfs).
+    InputLog* inputLog_ = nullptr; // Record/replay log (see setInputLog).
+
+    // Buffered target program output (see flushTargetOutput).
+    struct OutBuffer
+    {
+      bool tty = false;         // True if going to a terminal.
+      std::vector<char> data;
+    };
+    static constexpr size_t outBufferSize = 64*1024;
+    std::unordered_map<int, OutBuffer> outBuffers_;  // Indexed by host fd.
+    std::vector<char> consoleBuffer_;
+    bool consoleTty_ = false;     // True if console output is a terminal.
+    bool outputPending_ = false;  // True if some buffer is not empty.
+    bool outputBuffering_ = false;  // True while in a run loop.
 
     // Stack access control.
     bool checkStackAccess_ = false;
     URV stackMax_ = ~URV(0);
     URV stackMin_ = 0;
+    URV stackStoreLow_ = 1;             // Store window: stackMin_ + 1 and
+    URV stackStoreCount_ = ~URV(0);     // bytes up to stackMax_.
 
     bool wideLdSt_ = false;
 
@@ -1584,8 +2775,8 @@ namespace WdRiscv
     bool amoAq_ = false;
     bool amoRl_ = false;
 
-    InstTable instTable_;
-    std::vector<InstProfile> instProfileVec_; // Instruction frequency
+    const InstTable& instTable_ = InstTable::instance();
+    InstProfile instProfile_;       // Instruction frequency
 
     // Ith entry is true if ith region has iccm/dccm/pic.
     std::vector<bool> regionHasLocalMem_;
@@ -1606,6 +2797,27 @@ namespace WdRiscv
     std::vector<DecodedInst> decodeCache_;
     uint32_t decodeCacheSize_ = 0;
     uint32_t decodeCacheMask_ = 0;  // Derived from decodeCacheSize_
+    bool decodeCacheFromElf_ = false;  // Size cache from ELF code size.
+    uint64_t codeEpochSeen_ = 0;  // Memory code epoch decode cache is in sync with.
+    std::vector<size_t> codeWritePages_;  // Scratch for syncDecodeCache.
+
+    // Disassembly cache of the instruction trace (see
+    // cachedDisassembly): direct mapped by instruction address.
+    struct DisasEntry
+    {
+      uint64_t addr = 0;
+      uint32_t inst = 0;
+      const InstEntry* entry = nullptr;  // Null if entry is empty.
+      bool abiNames = false;
+      std::string text;
+    };
+    std::vector<DisasEntry> disasCache_;
+    static constexpr size_t disasCacheSize_ = 8*1024;
+
+    // Basic block cache (used by simpleRun) indexed by block address.
+    std::unordered_map<URV, BasicBlock<URV>> blockCache_;
+    bool blockCacheDirty_ = false;  // True if cached code was written.
+    static constexpr size_t maxBlockCount_ = 64*1024;
   };
 }
 
@@ -17,8 +17,13 @@
 //
 
 #include <nlohmann/json.hpp>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <unistd.h>
 #include "HartConfig.hpp"
 #include "Hart.hpp"
 
@@ -39,8 +44,92 @@ HartConfig::~HartConfig()
 }
 
 
+/// Header of a configuration cache file. It is followed by the CBOR
+/// encoding of the configuration.
+struct ConfigCacheHeader
+{
+  char magic[8] = { 'W', 'H', 'C', 'F', 'G', 'C', 'B', 'R' };
+  uint32_t version = 1;
+  uint32_t reserved = 0;
+  uint64_t hash = 0;       // Hash of the JSON text.
+  uint64_t size = 0;       // Size of the CBOR encoding.
+};
+
+
+/// Return the 64-bit FNV-1a hash of the given text.
+static uint64_t
+hashText(const std::string& text)
+{
+  uint64_t hash = 0xcbf29ce484222325;
+  for (unsigned char c : text)
+    {
+      hash ^= c;
+      hash *= 0x100000001b3;
+    }
+  return hash;
+}
+
+
 bool
-HartConfig::loadConfigFile(const std::string& filePath)
+HartConfig::loadCache(const std::string& path, uint64_t hash)
+{
+  FILE* file = fopen(path.c_str(), "rb");
+  if (not file)
+    return false;
+
+  ConfigCacheHeader expected, header;
+  std::vector<uint8_t> data;
+  bool ok = (fread(&header, sizeof(header), 1, file) == 1 and
+	     memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0 and
+	     header.version == expected.version and header.hash == hash);
+  if (ok)
+    {
+      data.resize(header.size);
+      ok = fread(data.data(), 1, data.size(), file) == data.size();
+    }
+  fclose(file);
+
+  if (not ok)
+    return false;
+
+  try
+    {
+      *config_ = nlohmann::json::from_cbor(data);
+    }
+  catch (...)
+    {
+      return false;
+    }
+  return true;
+}
+
+
+void
+HartConfig::saveCache(const std::string& path, uint64_t hash) const
+{
+  std::vector<uint8_t> data = nlohmann::json::to_cbor(*config_);
+
+  ConfigCacheHeader header;
+  header.hash = hash;
+  header.size = data.size();
+
+  // Write to a temporary file and rename so that concurrent runs
+  // never see a partial cache file.
+  std::string tmpPath = path + "." + std::to_string(getpid());
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (not file)
+    return;
+  bool ok = (fwrite(&header, sizeof(header), 1, file) == 1 and
+	     fwrite(data.data(), 1, data.size(), file) == data.size());
+  ok = fclose(file) == 0 and ok;
+  if (not ok or rename(tmpPath.c_str(), path.c_str()) != 0)
+    remove(tmpPath.c_str());
+}
+
+
+bool
+HartConfig::loadConfigFile(const std::string& filePath,
+			   const std::string& cacheDir)
 {
   std::ifstream ifs(filePath);
   if (not ifs.good())
@@ -50,9 +139,28 @@ HartConfig::loadConfigFile(const std::string& filePath)
       return false;
     }
 
+  std::string text, cachePath;
+  uint64_t hash = 0;
+  if (not cacheDir.empty())
+    {
+      std::ostringstream oss;
+      oss << ifs.rdbuf();
+      text = oss.str();
+      hash = hashText(text);
+
+      char name[32];
+      snprintf(name, sizeof(name), "/%016" PRIx64 ".cfg", hash);
+      cachePath = cacheDir + name;
+      if (loadCache(cachePath, hash))
+	return true;
+    }
+
   try
     {
-      ifs >> *config_;
+      if (cacheDir.empty())
+	ifs >> *config_;
+      else
+	*config_ = nlohmann::json::parse(text);
     }
   catch (std::exception& e)
     {
@@ -66,6 +174,9 @@ HartConfig::loadConfigFile(const std::string& filePath)
       return false;
     }
 
+  if (not cachePath.empty())
+    saveCache(cachePath, hash);
+
   return true;
 }
 
@@ -495,6 +606,118 @@ applyDccmConfig(Hart<URV>& hart, const nlohmann::json& config)
 }
 
 
+/// Apply the timing model cache configuration of the given tag
+/// (icache or dcache) of the given timing config object. Return true
+/// on success.
+template <typename URV>
+static
+bool
+applyCacheTimingConfig(Hart<URV>& hart, const nlohmann::json& timing,
+		       const std::string& tag)
+{
+  if (not timing.count(tag))
+    return true;
+
+  const auto& cache = timing.at(tag);
+  for (const auto& field : {"size", "line_size", "ways", "miss_penalty"})
+    if (not cache.count(field))
+      {
+	std::cerr << "Config file timing." << tag << " has no '" << field
+		  << "' entry\n";
+	return false;
+      }
+
+  std::string prefix = "timing." + tag + ".";
+  uint64_t size = getJsonUnsigned<uint64_t>(prefix + "size", cache.at("size"));
+  unsigned line = getJsonUnsigned<unsigned>(prefix + "line_size",
+					    cache.at("line_size"));
+  unsigned ways = getJsonUnsigned<unsigned>(prefix + "ways", cache.at("ways"));
+  unsigned penalty = getJsonUnsigned<unsigned>(prefix + "miss_penalty",
+					       cache.at("miss_penalty"));
+
+  TimingModel& model = hart.timingModel();
+  bool ok = ( tag == "icache" ?
+	      model.configICache(size, line, ways, penalty) :
+	      model.configDCache(size, line, ways, penalty) );
+  if (not ok)
+    std::cerr << "Invalid config file timing." << tag << ": line size and "
+	      << "set count (size/line_size/ways) must be powers of 2\n";
+  return ok;
+}
+
+
+/// Apply the timing model configuration (caches, branch predictor and
+/// instruction latencies) of the given config file. Enable the timing
+/// model if configured. Return true on success.
+template <typename URV>
+static
+bool
+applyTimingConfig(Hart<URV>& hart, const nlohmann::json& config)
+{
+  if (not config.count("timing"))
+    return true;  // Nothing to apply
+
+  const auto& timing = config.at("timing");
+  if (not timing.is_object())
+    {
+      std::cerr << "Invalid timing entry in config file (expecting an object)\n";
+      return false;
+    }
+
+  unsigned errors = 0;
+  if (not applyCacheTimingConfig(hart, timing, "icache"))
+    errors++;
+  if (not applyCacheTimingConfig(hart, timing, "dcache"))
+    errors++;
+
+  std::string tag = "branch_predictor";
+  if (timing.count(tag))
+    {
+      const auto& bp = timing.at(tag);
+      if (not bp.count("entries") or not bp.count("mispredict_penalty"))
+	{
+	  std::cerr << "Config file timing.branch_predictor must define "
+		    << "entries and mispredict_penalty\n";
+	  errors++;
+	}
+      else
+	{
+	  unsigned entries = getJsonUnsigned<unsigned>
+	    ("timing.branch_predictor.entries", bp.at("entries"));
+	  unsigned penalty = getJsonUnsigned<unsigned>
+	    ("timing.branch_predictor.mispredict_penalty",
+	     bp.at("mispredict_penalty"));
+	  if (not hart.timingModel().configBranchPredictor(entries, penalty))
+	    {
+	      std::cerr << "Invalid config file timing.branch_predictor: "
+			<< "entries must be a power of 2\n";
+	      errors++;
+	    }
+	}
+    }
+
+  tag = "latency";
+  if (timing.count(tag))
+    {
+      const auto& latency = timing.at(tag);
+      for (auto it = latency.begin(); it != latency.end(); ++it)
+	{
+	  unsigned cycles = getJsonUnsigned<unsigned>("timing.latency." +
+						      it.key(), it.value());
+	  if (not hart.configInstLatency(it.key(), cycles))
+	    {
+	      std::cerr << "Unknown instruction in config file "
+			<< "timing.latency: " << it.key() << '\n';
+	      errors++;
+	    }
+	}
+    }
+
+  hart.enableTimingModel(errors == 0);
+  return errors == 0;
+}
+
+
 template <typename URV>
 static
 bool
@@ -833,6 +1056,13 @@ HartConfig::applyConfig(Hart<URV>& hart, bool verbose) const
       hart.setLoadQueueSize(lqs);
     }
 
+  tag = "decode_cache_size";
+  if (config_ -> count(tag))
+    {
+      uint64_t size = getJsonUnsigned<uint64_t>(tag, config_ -> at(tag));
+      hart.setDecodeCacheSize(size);
+    }
+
   tag = "even_odd_trigger_chains";
   if (config_ -> count(tag))
     {
@@ -863,6 +1093,9 @@ HartConfig::applyConfig(Hart<URV>& hart, bool verbose) const
   if (not applyTriggerConfig(hart, *config_))
     errors++;
 
+  if (not applyTimingConfig(hart, *config_))
+    errors++;
+
   if (config_ -> count("memmap"))
     {
       const auto& memmap = config_ -> at("memmap");
@@ -872,6 +1105,27 @@ HartConfig::applyConfig(Hart<URV>& hart, bool verbose) const
 	  URV io = getJsonUnsigned<URV>("memmap.consoleio", memmap.at(tag));
 	  hart.setConsoleIo(io);
 	}
+
+      tag = "mmio";
+      if (memmap.count(tag))
+	{
+	  const auto& mmio = memmap.at(tag);
+	  if (not mmio.count("address") or not mmio.count("size"))
+	    {
+	      std::cerr << "Error: Config file memmap.mmio must define "
+			<< "address and size\n";
+	      errors++;
+	    }
+	  else
+	    {
+	      URV addr = getJsonUnsigned<URV>("memmap.mmio.address",
+					      mmio.at("address"));
+	      URV size = getJsonUnsigned<URV>("memmap.mmio.size",
+					      mmio.at("size"));
+	      if (not hart.configMmioWindow(addr, size))
+		errors++;
+	    }
+	}
     }
 
   return errors == 0;
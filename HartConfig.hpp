@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <nlohmann/json_fwd.hpp>
 
@@ -42,8 +43,13 @@ namespace WdRiscv
 
     /// Load given configuration file (JSON file) into this object.
     /// Return true on success and false if file cannot be opened or if the file
-    /// does not contain a valid JSON object.
-    bool loadConfigFile(const std::string& filePath);
+    /// does not contain a valid JSON object. If cacheDir is not empty,
+    /// the parsed configuration is kept there in binary (CBOR) form in
+    /// a file named after the hash of the JSON text: Subsequent loads
+    /// of the same text skip the JSON parsing. A cache file that
+    /// cannot be read or written is silently ignored.
+    bool loadConfigFile(const std::string& filePath,
+			const std::string& cacheDir = "");
 
     /// Apply the configurations in this object (as loaded by
     /// loadConfigFile) to the given hart. Return true on success and
@@ -85,6 +91,13 @@ namespace WdRiscv
     HartConfig(const HartConfig&) = delete;
     void operator= (const HartConfig&) = delete;
 
+    /// Load config_ from the given cache file. Return false if the
+    /// file is missing or does not hold the given hash.
+    bool loadCache(const std::string& path, uint64_t hash);
+
+    /// Save config_ to the given cache file.
+    void saveCache(const std::string& path, uint64_t hash) const;
+
     nlohmann::json* config_;
   };
 
@@ -0,0 +1,78 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+
+
+namespace WdRiscv
+{
+
+  /// Vector of at most N elements kept inside the object: Never
+  /// allocates. Used for the small per-instruction change lists of
+  /// the trace and server interfaces.
+  template <typename T, size_t N>
+  class InlineVector
+  {
+  public:
+
+    /// Append given item. Vector must not be full.
+    void push_back(const T& item)
+    {
+      assert(size_ < N);
+      items_[size_++] = item;
+    }
+
+    void clear()
+    { size_ = 0; }
+
+    size_t size() const
+    { return size_; }
+
+    bool empty() const
+    { return size_ == 0; }
+
+    static constexpr size_t capacity()
+    { return N; }
+
+    T& operator[](size_t ix)
+    { return items_[ix]; }
+
+    const T& operator[](size_t ix) const
+    { return items_[ix]; }
+
+    T* begin()
+    { return items_; }
+
+    T* end()
+    { return items_ + size_; }
+
+    const T* begin() const
+    { return items_; }
+
+    const T* end() const
+    { return items_ + size_; }
+
+  private:
+
+    T items_[N] = {};
+    size_t size_ = 0;
+  };
+}
@@ -0,0 +1,216 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cstring>
+
+#include "InputLog.hpp"
+
+
+using namespace WdRiscv;
+
+
+static const char inputLogMagic[8] = { 'W', 'H', 'I', 'N', 'P', 'L', 'G', '1' };
+
+
+InputLog::~InputLog()
+{
+  if (out_)
+    fclose(out_);
+}
+
+
+bool
+InputLog::openRecord(const std::string& path)
+{
+  out_ = fopen(path.c_str(), "wb");
+  if (not out_)
+    {
+      std::cerr << "Failed to open input log file '" << path
+		<< "' for output\n";
+      return false;
+    }
+  path_ = path;
+  fwrite(inputLogMagic, sizeof(inputLogMagic), 1, out_);
+  fflush(out_);
+  return true;
+}
+
+
+void
+InputLog::writeVarint(uint64_t value)
+{
+  uint8_t bytes[10];
+  unsigned n = 0;
+  do
+    {
+      uint8_t byte = value & 0x7f;
+      value >>= 7;
+      bytes[n++] = value ? byte | 0x80 : byte;
+    }
+  while (value);
+  fwrite(bytes, n, 1, out_);
+}
+
+
+/// Decode the unsigned LEB128 number at the given position of the
+/// given buffer advancing the position. Return false if the buffer
+/// ends before the number.
+static bool
+readVarint(const std::vector<uint8_t>& buffer, size_t& pos, uint64_t& value)
+{
+  value = 0;
+  for (unsigned shift = 0; pos < buffer.size() and shift < 64; shift += 7)
+    {
+      uint8_t byte = buffer[pos++];
+      value |= uint64_t(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0)
+	return true;
+    }
+  return false;
+}
+
+
+void
+InputLog::record(unsigned hart, Kind kind, uint64_t count, uint64_t value,
+		 const void* data, size_t size)
+{
+  if (not out_)
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (hart >= lastCount_.size())
+    lastCount_.resize(hart + 1);
+
+  // Records are flushed as they come: The recorded run may crash.
+  fputc(int(kind), out_);
+  writeVarint(hart);
+  writeVarint(count - lastCount_.at(hart));
+  writeVarint(value);
+  writeVarint(size);
+  if (size)
+    fwrite(data, size, 1, out_);
+  fflush(out_);
+
+  lastCount_.at(hart) = count;
+}
+
+
+bool
+InputLog::openReplay(const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (not in)
+    {
+      std::cerr << "Failed to open input log file '" << path << "'\n";
+      return false;
+    }
+
+  std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(in)),
+			      std::istreambuf_iterator<char>());
+  if (buffer.size() < sizeof(inputLogMagic) or
+      memcmp(buffer.data(), inputLogMagic, sizeof(inputLogMagic)) != 0)
+    {
+      std::cerr << "File '" << path << "' is not an input log file\n";
+      return false;
+    }
+
+  std::vector<uint64_t> lastCount;
+  size_t pos = sizeof(inputLogMagic);
+  while (pos < buffer.size())
+    {
+      Record rec;
+      uint8_t kind = buffer[pos++];
+      uint64_t hart = 0, delta = 0, size = 0;
+      bool ok = ( kind >= uint8_t(Kind::Syscall) and
+		  kind <= uint8_t(Kind::Interrupt) and
+		  readVarint(buffer, pos, hart) and hart < 1024 and
+		  readVarint(buffer, pos, delta) and
+		  readVarint(buffer, pos, rec.value) and
+		  readVarint(buffer, pos, size) and
+		  size <= buffer.size() - pos );
+      if (not ok)
+	{
+	  std::cerr << "Input log file '" << path << "' is truncated or "
+		    << "corrupt\n";
+	  return false;
+	}
+
+      if (hart >= records_.size())
+	{
+	  records_.resize(hart + 1);
+	  lastCount.resize(hart + 1);
+	}
+
+      rec.kind = Kind(kind);
+      rec.count = lastCount.at(hart) + delta;
+      rec.data.assign(buffer.begin() + pos, buffer.begin() + pos + size);
+      pos += size;
+
+      lastCount.at(hart) = rec.count;
+      records_.at(hart).push_back(std::move(rec));
+    }
+
+  next_.resize(records_.size());
+  path_ = path;
+  replaying_ = true;
+  return true;
+}
+
+
+const InputLog::Record*
+InputLog::replay(unsigned hart, Kind kind, uint64_t count)
+{
+  if (diverged_)
+    return nullptr;
+
+  if (hart < records_.size() and next_.at(hart) < records_.at(hart).size())
+    {
+      const Record& rec = records_.at(hart).at(next_.at(hart));
+      if (rec.kind == kind and rec.count == count)
+	{
+	  next_.at(hart)++;
+	  return &rec;
+	}
+    }
+
+  if (not diverged_.exchange(true))
+    std::cerr << "Warning: Hart " << hart << " diverged from the run recorded "
+	      << "in '" << path_ << "' at instruction " << count
+	      << ": inputs are no longer replayed\n";
+  return nullptr;
+}
+
+
+bool
+InputLog::replayInterrupt(unsigned hart, uint64_t count)
+{
+  if (diverged_ or hart >= records_.size() or
+      next_.at(hart) >= records_.at(hart).size())
+    return false;
+
+  const Record& rec = records_.at(hart).at(next_.at(hart));
+  if (rec.kind != Kind::Interrupt or rec.count != count)
+    return false;
+
+  next_.at(hart)++;
+  return true;
+}
@@ -0,0 +1,115 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace WdRiscv
+{
+
+  /// Log of the nondeterministic inputs of a run: results of the
+  /// system calls reading the host clock or host files (including
+  /// the standard input), console input reads, MMIO reads and
+  /// external interrupt arrivals. A run records its inputs and a
+  /// later run of the same program and configuration replays them to
+  /// reproduce the recorded run (e.g. with tracing on).
+  ///
+  /// Inputs are keyed by hart and by retired instruction count. The
+  /// file has an 8-byte magic followed by one record per input: kind
+  /// (one byte), hart, count delta (from the previous record of the
+  /// hart), value, data size and data bytes. Numbers are unsigned
+  /// LEB128 varints.
+  class InputLog
+  {
+  public:
+
+    enum class Kind : uint8_t
+      {
+	Syscall = 1,    // Value: result, data: memory written by the call.
+	ConsoleIn = 2,  // Value: character read from the console address.
+	Mmio = 3,       // Value: loaded value.
+	Interrupt = 4   // External interrupt line found high.
+      };
+
+    struct Record
+    {
+      Kind kind = Kind::Syscall;
+      uint64_t count = 0;
+      uint64_t value = 0;
+      std::vector<uint8_t> data;
+    };
+
+    InputLog() = default;
+
+    ~InputLog();
+
+    InputLog(const InputLog&) = delete;
+    InputLog& operator=(const InputLog&) = delete;
+
+    /// Create the given file and record the inputs therein. Return
+    /// true on success. Print an error message and return false on
+    /// failure.
+    bool openRecord(const std::string& path);
+
+    /// Load the records of the given file for replay. Return true on
+    /// success. Print an error message and return false on failure.
+    bool openReplay(const std::string& path);
+
+    bool isRecording() const
+    { return out_ != nullptr; }
+
+    bool isReplaying() const
+    { return replaying_; }
+
+    /// Append a record of the given kind to the inputs of the given
+    /// hart. Data, if any, is the memory written by the input.
+    void record(unsigned hart, Kind kind, uint64_t count, uint64_t value,
+		const void* data = nullptr, size_t size = 0);
+
+    /// Return the next record of the given hart consuming it if it
+    /// has the given kind and count. Otherwise, the replayed run has
+    /// diverged from the recorded one: Report the divergence (once)
+    /// and return null.
+    const Record* replay(unsigned hart, Kind kind, uint64_t count);
+
+    /// Return true and consume the next record of the given hart if
+    /// it is an interrupt arrival at the given count.
+    bool replayInterrupt(unsigned hart, uint64_t count);
+
+  private:
+
+    void writeVarint(uint64_t value);
+
+    FILE* out_ = nullptr;
+    std::string path_;
+    std::mutex mutex_;                 // Harts record from their threads.
+    std::vector<uint64_t> lastCount_;  // Per hart: count of last record.
+
+    bool replaying_ = false;
+    std::atomic<bool> diverged_ = false;
+    std::vector<std::vector<Record>> records_;  // Per hart.
+    std::vector<size_t> next_;                  // Per hart: next record.
+  };
+}
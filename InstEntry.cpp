@@ -16,7 +16,9 @@
 // this program. If not, see <https://www.gnu.org/licenses/>.
 //
 
+#include <algorithm>
 #include <cassert>
+#include <numeric>
 #include "InstEntry.hpp"
 
 using namespace WdRiscv;
@@ -44,6 +46,14 @@ InstEntry::InstEntry(std::string name, InstId id,
 }
 
 
+const InstTable&
+InstTable::instance()
+{
+  static const InstTable table;
+  return table;
+}
+
+
 InstTable::InstTable()
 {
   setupInstVec();
@@ -123,6 +133,136 @@ InstTable::InstTable()
   instVec_.at(size_t(InstId::jalr))   .setBranchToRegister(true);
   instVec_.at(size_t(InstId::c_jr))   .setBranchToRegister(true);
   instVec_.at(size_t(InstId::c_jalr)) .setBranchToRegister(true);
+
+  setupDecodeIndex();
+}
+
+
+void
+InstTable::setupDecodeIndex()
+{
+  using Scatter = InstDecode::Scatter;
+
+  for (const auto& entry : instVec_)
+    {
+      uint32_t code = entry.code();
+      if (entry.instId() == InstId::illegal or (code & 3) != 3)
+	continue;  // Compressed instructions are decoded by Hart::decode16.
+
+      InstDecode dec;
+      dec.entry = &entry;
+      dec.code = code;
+      dec.mask = entry.codeMask();
+
+      // Extensions checked at decode time.
+      uint32_t opcode = code & 0x7f, funct3 = (code >> 12) & 7;
+      uint32_t funct7 = code >> 25;
+      if (opcode == 0x53)                        // OP-FP
+	{
+	  dec.features = InstDecode::RvF;
+	  if (funct7 & 1)
+	    dec.features |= InstDecode::RvD;
+	}
+      else if (opcode == 0x2f)                   // AMO
+	{
+	  dec.features = InstDecode::RvA;
+	  if (funct3 == 3)
+	    dec.features |= InstDecode::Rv64;
+	}
+      else if (opcode == 0x33 and funct7 == 1)   // OP: mul/div
+	dec.features = InstDecode::RvM;
+      else if (opcode == 0x23 and funct3 == 3)   // sd
+	dec.features = InstDecode::Rv64;
+
+      for (unsigned i = 0; i < 4; ++i)
+	{
+	  OperandType type = entry.ithOperandType(i);
+	  uint32_t opMask = entry.ithOperandMask(i);
+	  if (type == OperandType::None or opMask == 0)
+	    continue;
+
+	  Scatter scatter = Scatter::None;
+	  if (type == OperandType::Imm)
+	    {
+	      if (opcode == 0x23 or opcode == 0x27)  scatter = Scatter::SImm;
+	      else if (opcode == 0x63)               scatter = Scatter::BImm;
+	      else if (opcode == 0x6f)               scatter = Scatter::JImm;
+	    }
+	  if (scatter != Scatter::None)
+	    {
+	      dec.scatter = scatter;
+	      dec.scatterIx = uint8_t(i);
+	      continue;
+	    }
+
+	  // Field: Shifted right arithmetically, so the I-form immediate
+	  // (only field including bit 31) is sign extended. Lui/auipc
+	  // immediates are not shifted.
+	  unsigned shift = __builtin_ctz(opMask);
+	  bool isSigned = type == OperandType::Imm and (opMask & 0x80000000);
+	  if (type == OperandType::Imm and (opcode == 0x37 or opcode == 0x17))
+	    shift = 0;
+	  dec.opMasks[i] = opMask;
+	  dec.shifts[i] = uint8_t(shift);
+	  dec.postMasks[i] = isSigned? ~uint32_t(0) : opMask >> shift;
+	}
+
+      decodeVec_.push_back(dec);
+    }
+
+  // Most specific code mask first.
+  std::vector<uint16_t> order(decodeVec_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this](uint16_t a, uint16_t b) {
+      return (__builtin_popcount(decodeVec_[a].mask) >
+	      __builtin_popcount(decodeVec_[b].mask)); });
+
+  // Append to decodeCands_ the candidates matching the given key
+  // bits and return the corresponding bucket.
+  auto addBucket = [this, &order](uint32_t keyBits, uint32_t keyMask) {
+    DecodeBucket bucket;
+    bucket.first = uint32_t(decodeCands_.size());
+    for (auto ix : order)
+      {
+	const InstDecode& dec = decodeVec_.at(ix);
+	uint32_t mask = dec.mask & keyMask;
+	if ((keyBits & mask) == (dec.code & mask))
+	  {
+	    decodeCands_.push_back(ix);
+	    bucket.count++;
+	  }
+      }
+    return bucket;
+  };
+
+  // First level: opcode and funct3. Buckets with more than 2
+  // candidates distinguished by funct7 are split on funct7.
+  buckets_.resize(256);
+  for (uint32_t key = 0; key < 256; ++key)
+    {
+      uint32_t keyBits = ((key & 0x1f) << 2) | 3 | ((key >> 5) << 12);
+      DecodeBucket bucket = addBucket(keyBits, 0x707f);
+
+      bool hasFunct7 = false;
+      for (unsigned i = 0; i < bucket.count; ++i)
+	{
+	  const InstDecode& dec = decodeVec_.at(decodeCands_.at(bucket.first + i));
+	  hasFunct7 = hasFunct7 or (dec.mask >> 25) != 0;
+	}
+
+      if (bucket.count <= 2 or not hasFunct7)
+	{
+	  buckets_.at(key) = bucket;
+	  continue;
+	}
+
+      decodeCands_.resize(bucket.first);
+      size_t first = buckets_.size();
+      for (uint32_t funct7 = 0; funct7 < 128; ++funct7)
+	buckets_.push_back(addBucket(keyBits | (funct7 << 25), 0xfe00707f));
+      buckets_.at(key).split = true;
+      buckets_.at(key).first = uint32_t(first);
+    }
 }
 
 
@@ -153,10 +293,11 @@ InstTable::setupInstVec()
   uint32_t rs1Mask = 0x1f << 15;
   uint32_t rs2Mask = 0x1f << 20;
   uint32_t rs3Mask = 0x1f << 27;
-  uint32_t immTop20 = 0xffff << 12;  // Immidiate: top 20 bits.
+  uint32_t immTop20 = 0xfffff << 12; // Immidiate: top 20 bits.
   uint32_t immTop12 = 0xfff << 20;   // Immidiate: top 12 bits.
   uint32_t immBeq = 0xfe000f80;
   uint32_t shamtMask = 0x01f00000;
+  uint32_t shamt7Mask = 0x07f00000;  // Shift amount: low 7 bits of imm.
 
   uint32_t low7Mask = 0x7f;                 // Opcode mask: lowest 7 bits
   uint32_t funct3Low7Mask = 0x707f;         // Funct3 and lowest 7 bits
@@ -312,23 +453,23 @@ InstTable::setupInstVec()
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::Imm, OperandMode::None, immTop12 },
 
-      { "slli", InstId::slli, 0x1013, top7Funct3Low7Mask,
+      { "slli", InstId::slli, 0x1013, 0xf800707f,
 	InstType::Int,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
-      { "srli", InstId::srli, 0x5013, top7Funct3Low7Mask,
+      { "srli", InstId::srli, 0x5013, 0xf800707f,
 	InstType::Int,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
-      { "srai", InstId::srai, 0x40005013, top7Funct3Low7Mask,
+      { "srai", InstId::srai, 0x40005013, 0xf800707f,
 	InstType::Int,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
       { "add", InstId::add, 0x0033, top7Funct3Low7Mask,
 	InstType::Int,
@@ -592,7 +733,7 @@ InstTable::setupInstVec()
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
       // Atomic
-      { "lr.w", InstId::lr_w, 0x1000202f, 0xf9f0707f,
+      { "lr.w", InstId::lr_w, 0x1000202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask },
@@ -603,62 +744,62 @@ InstTable::setupInstVec()
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoswap.w", InstId::amoswap_w, 0x0800202f, 0xf800070f,
+      { "amoswap.w", InstId::amoswap_w, 0x0800202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoadd.w", InstId::amoadd_w, 0x0000202f, 0xf800070f,
+      { "amoadd.w", InstId::amoadd_w, 0x0000202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoxor.w", InstId::amoxor_w, 0x2000202f, 0xf800070f,
+      { "amoxor.w", InstId::amoxor_w, 0x2000202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoand.w", InstId::amoand_w, 0x6000202f, 0xf800070f,
+      { "amoand.w", InstId::amoand_w, 0x6000202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoor.w", InstId::amoor_w, 0x4000202f, 0xf800070f,
+      { "amoor.w", InstId::amoor_w, 0x4000202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amomin.w", InstId::amomin_w, 0x8000202f, 0xf800070f,
+      { "amomin.w", InstId::amomin_w, 0x8000202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amomax.w", InstId::amomax_w, 0xa000202f, 0xf800070f,
+      { "amomax.w", InstId::amomax_w, 0xa000202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amominu.w", InstId::amominu_w, 0xc000202f, 0xf800070f,
+      { "amominu.w", InstId::amominu_w, 0xc000202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amomaxu.w", InstId::amomaxu_w, 0xe000202f, 0xf800070f,
+      { "amomaxu.w", InstId::amomaxu_w, 0xe000202f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
       // 64-bit atomic
-      { "lr.d", InstId::lr_d, 0x1000302f, 0xf9f0707f,
+      { "lr.d", InstId::lr_d, 0x1000302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask },
@@ -669,55 +810,55 @@ InstTable::setupInstVec()
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoswap.d", InstId::amoswap_d, 0x0800302f, 0xf800070f,
+      { "amoswap.d", InstId::amoswap_d, 0x0800302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoadd.d", InstId::amoadd_d, 0x0000302f, 0xf800070f,
+      { "amoadd.d", InstId::amoadd_d, 0x0000302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoxor.d", InstId::amoxor_d, 0x2000302f, 0xf800070f,
+      { "amoxor.d", InstId::amoxor_d, 0x2000302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoand.d", InstId::amoand_d, 0x6000302f, 0xf800070f,
+      { "amoand.d", InstId::amoand_d, 0x6000302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amoor.d", InstId::amoor_d, 0x4000302f, 0xf800070f,
+      { "amoor.d", InstId::amoor_d, 0x4000302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amomin.d", InstId::amomin_d, 0x8000302f, 0xf800070f,
+      { "amomin.d", InstId::amomin_d, 0x8000302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amomax.d", InstId::amomax_d, 0xa000302f, 0xf800070f,
+      { "amomax.d", InstId::amomax_d, 0xa000302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amominu.d", InstId::amominu_d, 0xc000302f, 0xf800070f,
+      { "amominu.d", InstId::amominu_d, 0xc000302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "amomaxu.d", InstId::amomaxu_d, 0xe000302f, 0xf800070f,
+      { "amomaxu.d", InstId::amomaxu_d, 0xe000302f, 0xf800707f,
 	InstType::Atomic,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
@@ -789,7 +930,7 @@ InstTable::setupInstVec()
 	OperandType::FpReg, OperandMode::Read, rs1Mask,
 	OperandType::FpReg, OperandMode::Read, rs2Mask },
 
-      { "fsqrt.s", InstId::fsqrt_s, 0x58000053, fsqrtMask,
+      { "fsqrt.s", InstId::fsqrt_s, 0x58000053, faddMask,
 	InstType::Fp,
 	OperandType::FpReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask },
@@ -834,7 +975,7 @@ InstTable::setupInstVec()
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask },
 
-      { "fmv.x.w", InstId::fmv_x_w, 0xe0900053, 0xfff1c07f,
+      { "fmv.x.w", InstId::fmv_x_w, 0xe0000053, 0xfff0707f,
 	InstType::Fp,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask },
@@ -857,7 +998,7 @@ InstTable::setupInstVec()
 	OperandType::FpReg, OperandMode::Read, rs1Mask,
 	OperandType::FpReg, OperandMode::Read, rs2Mask },
 
-      { "fclass.s", InstId::fclass_s, 0xe0001053, 0xfff1c07f,
+      { "fclass.s", InstId::fclass_s, 0xe0001053, 0xfff0707f,
 	InstType::Fp,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask },
@@ -872,7 +1013,7 @@ InstTable::setupInstVec()
 	OperandType::FpReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask },
 
-      { "fmv.w.x", InstId::fmv_w_x, 0xf0000053, 0xfff1c07f,
+      { "fmv.w.x", InstId::fmv_w_x, 0xf0000053, 0xfff0707f,
 	InstType::Fp,
 	OperandType::FpReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask },
@@ -957,13 +1098,13 @@ InstTable::setupInstVec()
 	OperandType::FpReg, OperandMode::Read, rs1Mask,
 	OperandType::FpReg, OperandMode::Read, rs2Mask },
 
-      { "fdiv.d", InstId::fdiv_d, 0x1b000053, faddMask,
+      { "fdiv.d", InstId::fdiv_d, 0x1a000053, faddMask,
 	InstType::Fp,
 	OperandType::FpReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask,
 	OperandType::FpReg, OperandMode::Read, rs2Mask },
 
-      { "fsqrt.d", InstId::fsqrt_d, 0x5b000053, fsqrtMask,
+      { "fsqrt.d", InstId::fsqrt_d, 0x5a000053, faddMask,
 	InstType::Fp,
 	OperandType::FpReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask },
@@ -986,13 +1127,13 @@ InstTable::setupInstVec()
 	OperandType::FpReg, OperandMode::Read, rs1Mask,
 	OperandType::FpReg, OperandMode::Read, rs2Mask },
 
-      { "fmin.d", InstId::fmin_d, 0x2b000053, top7Funct3Low7Mask,
+      { "fmin.d", InstId::fmin_d, 0x2a000053, top7Funct3Low7Mask,
 	InstType::Fp,
 	OperandType::FpReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask,
 	OperandType::FpReg, OperandMode::Read, rs2Mask },
 
-      { "fmax.d", InstId::fmax_d, 0x2b001053, top7Funct3Low7Mask,
+      { "fmax.d", InstId::fmax_d, 0x2a001053, top7Funct3Low7Mask,
 	InstType::Fp,
 	OperandType::FpReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask,
@@ -1026,12 +1167,12 @@ InstTable::setupInstVec()
 	OperandType::FpReg, OperandMode::Read, rs1Mask,
 	OperandType::FpReg, OperandMode::Read, rs2Mask },
 
-      { "fclass.d", InstId::fclass_d, 0xe2001053, 0xfff1c07f,
+      { "fclass.d", InstId::fclass_d, 0xe2001053, 0xfff0707f,
 	InstType::Fp,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask },
 
-      { "fcvt.w.d", InstId::fcvt_w_d, 0xf2000053, 0xfff1c07f,
+      { "fcvt.w.d", InstId::fcvt_w_d, 0xc2000053, fsqrtMask,
 	InstType::Fp,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::FpReg, OperandMode::Read, rs1Mask },
@@ -1077,16 +1218,16 @@ InstTable::setupInstVec()
 	OperandType::FpReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask },
 
-      { "fmv.d.x", InstId::fmv_d_x, 0xef000053, 0xfff0707f,
+      { "fmv.d.x", InstId::fmv_d_x, 0xf2000053, 0xfff0707f,
 	InstType::Fp,
 	OperandType::FpReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask },
 
       // Privileged
-      { "mret", InstId::mret, 0x30100073, 0xffffffff, InstType::Int },
-      { "uret", InstId::uret, 0x00100073, 0xffffffff, InstType::Int },
-      { "sret", InstId::sret, 0x10100073, 0xffffffff, InstType::Int },
-      { "wfi", InstId::wfi, 0x10280073, 0xffffffff, InstType::Int },
+      { "mret", InstId::mret, 0x30200073, 0xfff0707f, InstType::Int },
+      { "uret", InstId::uret, 0x00200073, 0xffffffff, InstType::Int },
+      { "sret", InstId::sret, 0x10200073, 0xfff0707f, InstType::Int },
+      { "wfi", InstId::wfi, 0x10500073, 0xfff0707f, InstType::Int },
 
       // Compressed insts. The operand bits are "swizzled" and the
       // operand masks are not used for obtaining operands. We set the
@@ -1360,17 +1501,17 @@ InstTable::setupInstVec()
 	OperandType::IntReg, OperandMode::Read, 0,
 	OperandType::Imm, OperandMode::None, 0 },
 
-      { "clz", InstId::clz, 0xc0001013, 0xfff0707f,
+      { "clz", InstId::clz, 0x60001013, 0xfff0707f,
 	InstType::Zbb,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask },
 
-      { "ctz", InstId::ctz, 0xc0101013, 0xfff0707f,
+      { "ctz", InstId::ctz, 0x60101013, 0xfff0707f,
 	InstType::Zbb,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask },
 
-      { "pcnt", InstId::pcnt, 0xc0201013, 0xfff0707f,
+      { "pcnt", InstId::pcnt, 0x60201013, 0xfff0707f,
 	InstType::Zbb,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask },
@@ -1409,13 +1550,13 @@ InstTable::setupInstVec()
 	InstType::Zbb,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
       { "sroi", InstId::sroi, 0x20005013, 0xf800707f,
 	InstType::Zbb,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
       { "min", InstId::min, 0x0a004033, top7Funct3Low7Mask,
 	InstType::Zbb,
@@ -1441,23 +1582,23 @@ InstTable::setupInstVec()
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "rol", InstId::rol, 0x60001023, top7Funct3Low7Mask,
+      { "rol", InstId::rol, 0x60001033, top7Funct3Low7Mask,
 	InstType::Zbb,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "ror", InstId::ror, 0x60005023, top7Funct3Low7Mask,
+      { "ror", InstId::ror, 0x60005033, top7Funct3Low7Mask,
 	InstType::Zbb,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "rori", InstId::rori, 0x60005023, 0xf800707f,
+      { "rori", InstId::rori, 0x60005013, 0xf800707f,
 	InstType::Zbb,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
       { "rev8", InstId::rev8, 0x41801013, 0xfff0707f,
 	InstType::Zbb,
@@ -1475,53 +1616,53 @@ InstTable::setupInstVec()
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "sbset", InstId::sbset, 0x24001023, top7Funct3Low7Mask,
+      { "sbset", InstId::sbset, 0x28001033, top7Funct3Low7Mask,
 	InstType::Zbs,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "sbclr", InstId::sbclr, 0x44001023, top7Funct3Low7Mask,
+      { "sbclr", InstId::sbclr, 0x48001033, top7Funct3Low7Mask,
 	InstType::Zbs,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "sbinv", InstId::sbinv, 0x64001023, top7Funct3Low7Mask,
+      { "sbinv", InstId::sbinv, 0x68001033, top7Funct3Low7Mask,
 	InstType::Zbs,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "sbext", InstId::sbext, 0x24005023, top7Funct3Low7Mask,
+      { "sbext", InstId::sbext, 0x48005033, top7Funct3Low7Mask,
 	InstType::Zbs,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
 	OperandType::IntReg, OperandMode::Read, rs2Mask },
 
-      { "sbseti", InstId::sbseti, 0x28001023, 0xf800707f,
+      { "sbseti", InstId::sbseti, 0x28001013, 0xf800707f,
 	InstType::Zbs,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
-      { "sbclri", InstId::sbclri, 0x48001023, 0xf800707f,
+      { "sbclri", InstId::sbclri, 0x48001013, 0xf800707f,
 	InstType::Zbs,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
-      { "sbinvi", InstId::sbinvi, 0x68001023, 0xf800707f,
+      { "sbinvi", InstId::sbinvi, 0x68001013, 0xf800707f,
 	InstType::Zbs,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
-      { "sbexti", InstId::sbexti, 0x48005023, 0xf800707f,
+      { "sbexti", InstId::sbexti, 0x48005013, 0xf800707f,
 	InstType::Zbs,
 	OperandType::IntReg, OperandMode::Write, rdMask,
 	OperandType::IntReg, OperandMode::Read, rs1Mask,
-	OperandType::Imm, OperandMode::None, shamtMask },
+	OperandType::Imm, OperandMode::None, shamt7Mask },
 
     };
 }
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <unordered_map>
@@ -282,12 +283,73 @@ namespace WdRiscv
   };
 
 
+  /// Decoding information of a 32-bit instruction generated by the
+  /// instruction table from the code and operand masks of an entry
+  /// (see InstTable::lookupDecode).
+  struct InstDecode
+  {
+    /// Extensions that must be enabled for the instruction to decode:
+    /// Those not checked here are checked at execution.
+    enum Feature : unsigned { RvF = 1, RvD = 2, RvA = 4, RvM = 8, Rv64 = 16 };
+
+    /// Immediate scattered over the instruction bits.
+    enum class Scatter : uint8_t { None, SImm, BImm, JImm };
+
+    /// Return the ith operand (0 to 3) of the given instruction: A
+    /// field of the instruction bits (sign extended if it includes
+    /// bit 31 and is a signed immediate), or a scattered immediate.
+    uint32_t operand(uint32_t inst, unsigned i) const
+    {
+      if (i == scatterIx)
+	return scattered(inst);
+      return uint32_t(int32_t(inst & opMasks[i]) >> shifts[i]) & postMasks[i];
+    }
+
+    /// Return the scattered immediate of the given instruction.
+    uint32_t scattered(uint32_t inst) const
+    {
+      switch (scatter)
+	{
+	case Scatter::None:
+	  return 0;
+	case Scatter::SImm:
+	  return (uint32_t(int32_t(inst & 0xfe000000) >> 20) |
+		  ((inst >> 7) & 0x1f));
+	case Scatter::BImm:
+	  return (uint32_t(int32_t(inst & 0x80000000) >> 19) |
+		  ((inst & 0x80) << 4) | ((inst >> 20) & 0x7e0) |
+		  ((inst >> 7) & 0x1e));
+	case Scatter::JImm:
+	  return (uint32_t(int32_t(inst & 0x80000000) >> 11) |
+		  (inst & 0xff000) | ((inst >> 9) & 0x800) |
+		  ((inst >> 20) & 0x7fe));
+	}
+      return 0;
+    }
+
+    const InstEntry* entry = nullptr;
+    uint32_t code = 0;
+    uint32_t mask = 0;
+    unsigned features = 0;               // Or of Feature values.
+    uint32_t opMasks[4] = { 0, 0, 0, 0 };
+    uint32_t postMasks[4] = { 0, 0, 0, 0 };  // Applied after the shift.
+    uint8_t shifts[4] = { 0, 0, 0, 0 };
+    uint8_t scatterIx = 4;               // Operand with scattered immediate.
+    Scatter scatter = Scatter::None;
+  };
+
+
   // Instruction table: Map an instruction id or an instruction name to
   // the opcode/operand information corresponding to that instruction.
+  // There is a single immutable instance per process (see instance)
+  // shared by all the harts.
   class InstTable
   {
   public:
-    InstTable();
+
+    // Return the process-wide instruction table. It is built on the
+    // first call (thread safe).
+    static const InstTable& instance();
 
     // Return the info corresponding to the given id or the info of the
     // illegal instruction if no such id.
@@ -303,14 +365,56 @@ namespace WdRiscv
     // Return true if given instance name is present in the table.
     bool hasInfo(const std::string& name) const;
 
+    // Return the decoding information of the given 32-bit instruction
+    // or null if the instruction matches no entry (illegal). The
+    // lookup is keyed on the opcode and funct3 bits and, for the
+    // crowded opcodes, on the funct7 bits.
+    const InstDecode* lookupDecode(uint32_t inst) const
+    {
+      unsigned key = ((inst >> 2) & 0x1f) | ((inst >> 7) & 0xe0);
+      const DecodeBucket* bucket = &buckets_[key];
+      if (bucket->split)
+	bucket = &buckets_[bucket->first + (inst >> 25)];
+      const uint16_t* cand = &decodeCands_[bucket->first];
+      for (unsigned i = 0; i < bucket->count; ++i)
+	{
+	  const InstDecode& dec = decodeVec_[cand[i]];
+	  if ((inst & dec.mask) == dec.code)
+	    return &dec;
+	}
+      return nullptr;
+    }
+
   private:
 
+    InstTable();
+
+    InstTable(const InstTable&) = delete;
+    void operator=(const InstTable&) = delete;
+
     // Helper to the constructor.
     void setupInstVec();
 
+    // Helper to the constructor: Generate the decode index from the
+    // code and operand masks of the 32-bit instructions.
+    void setupDecodeIndex();
+
+    // Range of candidates in decodeCands_. A split bucket has instead
+    // the index in buckets_ of its 128 sub-buckets (one per funct7).
+    struct DecodeBucket
+    {
+      uint32_t first = 0;
+      uint16_t count = 0;
+      bool split = false;
+    };
+
   private:
 
     std::vector<InstEntry> instVec_;
     std::unordered_map<std::string, InstId> instMap_;
+
+    std::vector<InstDecode> decodeVec_;    // One per 32-bit instruction.
+    std::vector<uint16_t> decodeCands_;    // Indices into decodeVec_.
+    std::vector<DecodeBucket> buckets_;    // Opcode/funct3 then funct7.
   };
 }
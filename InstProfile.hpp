@@ -26,30 +26,94 @@
 namespace WdRiscv
 {
 
-  struct InstProfile
+  /// Instruction profile (see Hart::enableInstructionFrequency): The
+  /// counters of all the instructions are kept in one contiguous
+  /// array holding one fixed size record per instruction id so that
+  /// the counters updated by an instruction are next to each other.
+  /// Only the counters of the enabled parts are updated.
+  class InstProfile
   {
-    InstId id_ = InstId::illegal;
-    uint64_t freq_ = 0;  // Number of times instruction was executed
+  public:
 
-    // One entry per integer register: Count of times register was used
-    // by instruction as rd.
-    std::vector<uint64_t> rd_;
+    /// Parts of the profile. Opcode counts are always collected.
+    enum Part : unsigned
+      {
+	Opcodes = 0,     // Execution count of each instruction.
+	Registers = 1,   // Register operand use.
+	Values = 2,      // Operand value and immediate histograms.
+	AllParts = 3
+      };
 
-    // One entry per integer register: Count of times register was
-    // used by instruction as rs1.
-    std::vector<uint64_t> rs1_;
+    static constexpr unsigned regCount = 32;
+    static constexpr unsigned histoSize = 13;
 
-    // One entry per integer register: Count of times register was
-    // used by instruction as rs2.
-    std::vector<uint64_t> rs2_;
+    /// Offsets of the counters in the record of an instruction. A
+    /// histogram of unsigned values uses the first 7 buckets.
+    enum Field : unsigned
+      {
+	Freq = 0,                        // Execution count.
+	HasImm = 1,                      // Non-zero if immediate seen.
+	MinImm = 2,                      // Minimum immediate (signed).
+	MaxImm = 3,                      // Maximum immediate (signed).
+	Rd = 4,                          // Use count of each reg as rd.
+	Rs1 = Rd + regCount,             // Use count of each reg as rs1.
+	Rs2 = Rs1 + regCount,            // Use count of each reg as rs2.
+	Rs1Histo = Rs2 + regCount,       // Histogram of rs1 values.
+	Rs2Histo = Rs1Histo + histoSize, // Histogram of rs2 values.
+	ImmHisto = Rs2Histo + histoSize, // Histogram of immediate values.
+	RecordSize = ImmHisto + histoSize
+      };
 
-    std::vector<uint64_t> rs1Histo_;  // rs1 value histogram.
-    std::vector<uint64_t> rs2Histo_;  // rs2 value histogram.
-    std::vector<uint64_t> immHisto_;  // Immediate value histogram.
+    /// Clear the profile and size it for the given number of
+    /// instruction ids collecting the given parts (or-ed Part values).
+    void reset(size_t idCount, unsigned parts)
+    {
+      parts_ = parts;
+      data_.assign(idCount * RecordSize, 0);
+    }
 
-    bool hasImm_ = false;
-    int32_t minImm_ = 0;  // Minimum immediate operand value.
-    int32_t maxImm_ = 0;  // Maximum immediate operand value.
+    /// Return the enabled parts.
+    unsigned parts() const
+    { return parts_; }
+
+    /// Return the number of instruction ids in this profile.
+    size_t size() const
+    { return data_.size() / RecordSize; }
+
+    /// Return the record of the given instruction id.
+    uint64_t* record(InstId id)
+    { return data_.data() + size_t(id) * RecordSize; }
+
+    const uint64_t* record(InstId id) const
+    { return data_.data() + size_t(id) * RecordSize; }
+
+    /// Return the histogram bucket of the given signed value: 0 for
+    /// <= -64k, 1 for (-64k, -1k], 2 for (-1k, -16], 3 for (-16, -3],
+    /// 4 to 8 for -2 to 2, 9 for (2, 16], 10 for (16, 1k], 11 for
+    /// (1k, 64k] and 12 for > 64k. Computed without branches.
+    static unsigned signedBucket(int64_t val)
+    {
+      return ( unsigned(val > -64*1024) + unsigned(val > -1024) +
+	       unsigned(val > -16) + unsigned(val >= -2) +
+	       unsigned(val >= -1) + unsigned(val >= 0) + unsigned(val >= 1) +
+	       unsigned(val >= 2) + unsigned(val > 2) + unsigned(val > 16) +
+	       unsigned(val > 1024) + unsigned(val > 64*1024) );
+    }
+
+    /// Return the histogram bucket of the given unsigned value: 0 to 2
+    /// for 0 to 2, 3 for (2, 16], 4 for (16, 1k], 5 for (1k, 64k] and
+    /// 6 for > 64k. Computed without branches.
+    static unsigned unsignedBucket(uint64_t val)
+    {
+      return ( unsigned(val >= 1) + unsigned(val >= 2) + unsigned(val > 2) +
+	       unsigned(val > 16) + unsigned(val > 1024) +
+	       unsigned(val > 64*1024) );
+    }
+
+  private:
+
+    std::vector<uint64_t> data_;
+    unsigned parts_ = AllParts;
   };
 }
 
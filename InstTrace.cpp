@@ -0,0 +1,613 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+// Needed for fopencookie.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <cstring>
+#include <chrono>
+#include "InstTrace.hpp"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#endif
+
+
+using namespace WdRiscv;
+
+
+namespace
+{
+  // File header: magic followed by the register width in a byte.
+  const char traceMagic[8] = { 'W', 'H', 'I', 'S', 'P', 'T', 'R', '1' };
+  const char branchMagic[8] = { 'W', 'H', 'I', 'S', 'P', 'B', 'R', '1' };
+
+  // Record flags.
+  enum : uint8_t
+    {
+      FlagInterrupt = 1, FlagLoadAddr = 2, FlagIntReg = 4, FlagFpReg = 8,
+      FlagMem = 0x10, FlagCsrs = 0x20, FlagPcJump = 0x40, FlagDecodePc = 0x80
+    };
+
+  void
+  putUleb(std::vector<uint8_t>& buffer, uint64_t value)
+  {
+    while (value >= 0x80)
+      {
+	buffer.push_back(uint8_t(value) | 0x80);
+	value >>= 7;
+      }
+    buffer.push_back(uint8_t(value));
+  }
+
+  // Signed values are zig-zag encoded: small magnitudes give small
+  // unsigned values.
+  void
+  putSleb(std::vector<uint8_t>& buffer, int64_t value)
+  {
+    putUleb(buffer, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+  }
+
+  bool
+  getUleb(FILE* in, uint64_t& value)
+  {
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+      {
+	int c = getc(in);
+	if (c == EOF)
+	  return false;
+	value |= uint64_t(c & 0x7f) << shift;
+	if ((c & 0x80) == 0)
+	  return true;
+      }
+    return false;
+  }
+
+  bool
+  getSleb(FILE* in, int64_t& value)
+  {
+    uint64_t u = 0;
+    if (not getUleb(in, u))
+      return false;
+    value = int64_t(u >> 1) ^ -int64_t(u & 1);
+    return true;
+  }
+}
+
+
+bool
+BinaryTrace::writeHeader(FILE* out, unsigned xlen)
+{
+  if (fwrite(traceMagic, sizeof(traceMagic), 1, out) != 1)
+    return false;
+  return putc(int(xlen), out) != EOF;
+}
+
+
+bool
+BinaryTrace::readHeader(FILE* in, unsigned& xlen)
+{
+  char magic[sizeof(traceMagic)];
+  if (fread(magic, sizeof(magic), 1, in) != 1)
+    return false;
+  if (memcmp(magic, traceMagic, sizeof(magic)) != 0)
+    return false;
+  int c = getc(in);
+  if (c != 32 and c != 64)
+    return false;
+  xlen = c;
+  return true;
+}
+
+
+void
+BinaryTrace::encode(const TraceRecord& rec, HartState& state,
+		    std::vector<uint8_t>& buffer)
+{
+  uint8_t flags = 0;
+  if (rec.interrupt)            flags |= FlagInterrupt;
+  if (rec.hasLoadAddr)          flags |= FlagLoadAddr;
+  if (rec.intReg > 0)           flags |= FlagIntReg;
+  if (rec.fpReg >= 0)           flags |= FlagFpReg;
+  if (rec.hasMem)               flags |= FlagMem;
+  if (not rec.csrs.empty())     flags |= FlagCsrs;
+  if (rec.pc != state.nextPc)   flags |= FlagPcJump;
+  if (rec.decodePc != rec.pc)   flags |= FlagDecodePc;
+
+  buffer.push_back(flags);
+  putUleb(buffer, rec.hartId);
+  putSleb(buffer, int64_t(rec.tag - state.tag - 1));
+
+  buffer.push_back(uint8_t(rec.inst));
+  buffer.push_back(uint8_t(rec.inst >> 8));
+  if (rec.instSize() == 4)
+    {
+      buffer.push_back(uint8_t(rec.inst >> 16));
+      buffer.push_back(uint8_t(rec.inst >> 24));
+    }
+
+  if (flags & FlagPcJump)
+    putSleb(buffer, int64_t(rec.pc - state.nextPc));
+  if (flags & FlagDecodePc)
+    putSleb(buffer, int64_t(rec.decodePc - rec.pc));
+  if (flags & FlagLoadAddr)
+    putUleb(buffer, rec.loadAddr);
+  if (flags & FlagIntReg)
+    {
+      buffer.push_back(uint8_t(rec.intReg));
+      putUleb(buffer, rec.intValue);
+    }
+  if (flags & FlagFpReg)
+    {
+      buffer.push_back(uint8_t(rec.fpReg));
+      putUleb(buffer, rec.fpValue);
+    }
+  if (flags & FlagCsrs)
+    {
+      putUleb(buffer, rec.csrs.size());
+      for (const auto& [key, value] : rec.csrs)
+	{
+	  putUleb(buffer, key);
+	  putUleb(buffer, value);
+	}
+    }
+  if (flags & FlagMem)
+    {
+      putUleb(buffer, rec.memAddr);
+      putUleb(buffer, rec.memValue);
+    }
+
+  state.tag = rec.tag;
+  state.nextPc = rec.pc + rec.instSize();
+}
+
+
+bool
+BinaryTrace::decode(FILE* in, std::vector<HartState>& states,
+		    TraceRecord& rec, bool& error)
+{
+  error = false;
+
+  int flags = getc(in);
+  if (flags == EOF)
+    return false;
+
+  error = true;  // Any failure from here on is a truncated record.
+
+  uint64_t hartId = 0;
+  int64_t delta = 0;
+  if (not getUleb(in, hartId) or hartId > 0xffff or not getSleb(in, delta))
+    return false;
+  if (hartId >= states.size())
+    states.resize(hartId + 1);
+  auto& state = states.at(hartId);
+
+  rec = TraceRecord();
+  rec.hartId = hartId;
+  rec.tag = state.tag + 1 + delta;
+
+  int b0 = getc(in), b1 = getc(in);
+  if (b0 == EOF or b1 == EOF)
+    return false;
+  rec.inst = uint32_t(b0) | (uint32_t(b1) << 8);
+  if (rec.instSize() == 4)
+    {
+      int b2 = getc(in), b3 = getc(in);
+      if (b2 == EOF or b3 == EOF)
+	return false;
+      rec.inst |= (uint32_t(b2) << 16) | (uint32_t(b3) << 24);
+    }
+
+  rec.pc = state.nextPc;
+  if (flags & FlagPcJump)
+    {
+      if (not getSleb(in, delta))
+	return false;
+      rec.pc += delta;
+    }
+  rec.decodePc = rec.pc;
+  if (flags & FlagDecodePc)
+    {
+      if (not getSleb(in, delta))
+	return false;
+      rec.decodePc += delta;
+    }
+
+  rec.interrupt = flags & FlagInterrupt;
+  rec.hasLoadAddr = flags & FlagLoadAddr;
+  if (rec.hasLoadAddr and not getUleb(in, rec.loadAddr))
+    return false;
+
+  if (flags & FlagIntReg)
+    {
+      int reg = getc(in);
+      if (reg == EOF or not getUleb(in, rec.intValue))
+	return false;
+      rec.intReg = reg;
+    }
+
+  if (flags & FlagFpReg)
+    {
+      int reg = getc(in);
+      if (reg == EOF or not getUleb(in, rec.fpValue))
+	return false;
+      rec.fpReg = reg;
+    }
+
+  if (flags & FlagCsrs)
+    {
+      uint64_t count = 0;
+      if (not getUleb(in, count) or count > 0x10000)
+	return false;
+      for (uint64_t i = 0; i < count; ++i)
+	{
+	  uint64_t key = 0, value = 0;
+	  if (not getUleb(in, key) or not getUleb(in, value))
+	    return false;
+	  rec.csrs.push_back(std::make_pair(key, value));
+	}
+    }
+
+  rec.hasMem = flags & FlagMem;
+  if (rec.hasMem)
+    if (not getUleb(in, rec.memAddr) or not getUleb(in, rec.memValue))
+      return false;
+
+  state.tag = rec.tag;
+  state.nextPc = rec.pc + rec.instSize();
+
+  error = false;
+  return true;
+}
+
+
+bool
+BranchTrace::writeHeader(FILE* out, unsigned xlen)
+{
+  if (fwrite(branchMagic, sizeof(branchMagic), 1, out) != 1)
+    return false;
+  return putc(int(xlen), out) != EOF;
+}
+
+
+bool
+BranchTrace::readHeader(FILE* in, unsigned& xlen)
+{
+  char magic[sizeof(branchMagic)];
+  if (fread(magic, sizeof(magic), 1, in) != 1)
+    return false;
+  if (memcmp(magic, branchMagic, sizeof(magic)) != 0)
+    return false;
+  int c = getc(in);
+  if (c != 32 and c != 64)
+    return false;
+  xlen = c;
+  return true;
+}
+
+
+void
+BranchTrace::encode(const BranchEvent& event, HartState& state,
+		    std::vector<uint8_t>& buffer)
+{
+  buffer.push_back(event.kind);
+  putUleb(buffer, event.hartId);
+  putUleb(buffer, event.tag - state.tag);
+  putSleb(buffer, int64_t(event.from - state.to));
+  putSleb(buffer, int64_t(event.to - event.from));
+
+  state.tag = event.tag;
+  state.to = event.to;
+}
+
+
+bool
+BranchTrace::decode(FILE* in, std::vector<HartState>& states,
+		    BranchEvent& event, bool& error)
+{
+  error = false;
+
+  int kind = getc(in);
+  if (kind == EOF)
+    return false;
+
+  error = true;  // Any failure from here on is a truncated record.
+  if (kind > BranchEvent::Stop)
+    return false;
+
+  uint64_t hartId = 0, tagDelta = 0;
+  int64_t fromDelta = 0, toDelta = 0;
+  if (not getUleb(in, hartId) or hartId > 0xffff or
+      not getUleb(in, tagDelta) or not getSleb(in, fromDelta) or
+      not getSleb(in, toDelta))
+    return false;
+  if (hartId >= states.size())
+    states.resize(hartId + 1);
+  auto& state = states.at(hartId);
+
+  event.kind = BranchEvent::Kind(kind);
+  event.hartId = hartId;
+  event.tag = state.tag + tagDelta;
+  event.from = state.to + fromDelta;
+  event.to = event.from + toDelta;
+
+  state.tag = event.tag;
+  state.to = event.to;
+
+  error = false;
+  return true;
+}
+
+
+TraceWriter::TraceWriter(FILE* out, unsigned hartCount, Formatter formatter)
+  : out_(out), formatter_(formatter), states_(hartCount)
+{
+  for (unsigned i = 0; i < hartCount; ++i)
+    {
+      rings_.push_back(std::make_unique<Ring>());
+      rings_.back()->slots.resize(ringSize);
+    }
+  thread_ = std::thread(&TraceWriter::run, this);
+}
+
+
+TraceWriter::~TraceWriter()
+{
+  stop_ = true;
+  thread_.join();
+  fflush(out_);
+}
+
+
+void
+TraceWriter::flush()
+{
+  for (auto& ring : rings_)
+    while (ring->head.load(std::memory_order_acquire) !=
+	   ring->tail.load(std::memory_order_acquire))
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  fflush(out_);
+}
+
+
+bool
+TraceWriter::writeOne()
+{
+  // Pick the pending record with the smallest tag.
+  Ring* oldest = nullptr;
+  for (auto& ring : rings_)
+    {
+      uint64_t head = ring->head.load(std::memory_order_relaxed);
+      if (head == ring->tail.load(std::memory_order_acquire))
+	continue;
+      if (not oldest or ring->slots[head & (ringSize - 1)].tag <
+	  oldest->slots[oldest->head.load(std::memory_order_relaxed) & (ringSize - 1)].tag)
+	oldest = ring.get();
+    }
+  if (not oldest)
+    return false;
+
+  uint64_t head = oldest->head.load(std::memory_order_relaxed);
+  const TraceRecord& rec = oldest->slots[head & (ringSize - 1)];
+  if (formatter_)
+    formatter_(rec, out_);
+  else
+    {
+      buffer_.clear();
+      BinaryTrace::encode(rec, states_.at(rec.hartId), buffer_);
+      fwrite(buffer_.data(), buffer_.size(), 1, out_);
+    }
+  oldest->head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+
+void
+TraceWriter::run()
+{
+  while (true)
+    {
+      if (writeOne())
+	continue;
+      if (stop_)
+	{
+	  // Drain records published before the stop request.
+	  while (writeOne())
+	    ;
+	  return;
+	}
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+
+bool
+CompressedFile::supported()
+{
+#ifdef HAVE_ZLIB
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool
+CompressedFile::isCompressedName(const std::string& path)
+{
+  return path.size() > 3 and path.compare(path.size() - 3, 3, ".gz") == 0;
+}
+
+
+#ifdef HAVE_ZLIB
+
+namespace
+{
+  ssize_t
+  gzCookieRead(void* cookie, char* buf, size_t size)
+  {
+    int count = gzread(static_cast<gzFile>(cookie), buf, unsigned(size));
+    return count < 0 ? -1 : count;
+  }
+
+  ssize_t
+  gzCookieWrite(void* cookie, const char* buf, size_t size)
+  {
+    if (size == 0)
+      return 0;
+    int count = gzwrite(static_cast<gzFile>(cookie), buf, unsigned(size));
+    return count <= 0 ? -1 : count;  // Zero is an error for gzwrite.
+  }
+
+  int
+  gzCookieClose(void* cookie)
+  {
+    return gzclose(static_cast<gzFile>(cookie)) == Z_OK ? 0 : EOF;
+  }
+
+  FILE*
+  gzStream(gzFile gz, const char* mode)
+  {
+    if (not gz)
+      return nullptr;
+
+    // Large buffers: Fewer calls into zlib.
+    gzbuffer(gz, 256*1024);
+
+    cookie_io_functions_t funcs = { gzCookieRead, gzCookieWrite, nullptr,
+				    gzCookieClose };
+    FILE* file = fopencookie(gz, mode, funcs);
+    if (not file)
+      gzclose(gz);
+    return file;
+  }
+}
+
+
+FILE*
+CompressedFile::openWrite(const std::string& path, int level)
+{
+  if (level < 1 or level > 9)
+    level = 1;
+  std::string mode = "wb" + std::to_string(level);
+  return gzStream(gzopen(path.c_str(), mode.c_str()), "w");
+}
+
+
+FILE*
+CompressedFile::openRead(const std::string& path)
+{
+  return gzStream(gzopen(path.c_str(), "rb"), "r");
+}
+
+#else
+
+FILE*
+CompressedFile::openWrite(const std::string&, int)
+{
+  return nullptr;
+}
+
+
+FILE*
+CompressedFile::openRead(const std::string& path)
+{
+  return fopen(path.c_str(), "rb");
+}
+
+#endif
+
+
+#ifdef __EMSCRIPTEN__
+
+namespace
+{
+  ssize_t
+  jsCookieWrite(void*, const char* buf, size_t size)
+  {
+    if (size == 0)
+      return 0;
+    // Proxied to the main thread in the build with threads: The JS
+    // side reads the chunk in place and must copy it if it keeps it.
+    MAIN_THREAD_EM_ASM({ syscall_emulator.trace(HEAPU8.subarray($0, $0 + $1)); },
+		       buf, size);
+    return ssize_t(size);
+  }
+
+  int
+  jsCookieClose(void* cookie)
+  {
+    delete static_cast<std::vector<char>*>(cookie);
+    return 0;
+  }
+}
+
+
+bool
+JsTraceStream::supported()
+{
+  return MAIN_THREAD_EM_ASM_INT({
+      return (typeof syscall_emulator !== 'undefined' &&
+	      typeof syscall_emulator.trace === 'function') ? 1 : 0;
+    });
+}
+
+
+FILE*
+JsTraceStream::open(size_t bufferSize)
+{
+  if (not supported())
+    return nullptr;
+
+  // The C library uses its default (small) buffer unless given one.
+  auto buffer = new std::vector<char>(bufferSize);
+  cookie_io_functions_t funcs = { nullptr, jsCookieWrite, nullptr,
+				  jsCookieClose };
+  FILE* file = fopencookie(buffer, "w", funcs);
+  if (not file)
+    {
+      delete buffer;
+      return nullptr;
+    }
+  setvbuf(file, buffer->data(), _IOFBF, buffer->size());
+  return file;
+}
+
+#else
+
+bool
+JsTraceStream::supported()
+{
+  return false;
+}
+
+
+FILE*
+JsTraceStream::open(size_t)
+{
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,308 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <string>
+
+
+namespace WdRiscv
+{
+
+  /// State changes of one traced instruction: The information of the
+  /// line(s) printed for the instruction in the text trace (see
+  /// Hart::printInstTrace).
+  struct TraceRecord
+  {
+    uint64_t tag = 0;          // Record tag (retired instruction count).
+    unsigned hartId = 0;
+    uint64_t pc = 0;           // Address of instruction.
+    uint64_t decodePc = 0;     // Address used to disassemble instruction.
+    uint32_t inst = 0;         // Instruction (upper half undefined if compressed).
+    bool interrupt = false;    // True if instruction was interrupted.
+    bool hasLoadAddr = false;  // True if load address is traced.
+    uint64_t loadAddr = 0;
+    unsigned intReg = 0;       // Written integer register (0 if none).
+    uint64_t intValue = 0;
+    int fpReg = -1;            // Written FP register (-1 if none).
+    uint64_t fpValue = 0;
+    bool hasMem = false;       // True if memory was written.
+    uint64_t memAddr = 0;
+    uint64_t memValue = 0;
+
+    /// Written CSRs in ascending order of key. The key of a trigger
+    /// register is (trigger << 16) | csr-number.
+    std::vector<std::pair<uint64_t, uint64_t>> csrs;
+
+    /// Return size in bytes of the instruction (2 if compressed).
+    unsigned instSize() const
+    { return (inst & 3) == 3 ? 4 : 2; }
+  };
+
+
+  /// Compact record of a retired instruction kept in the in-memory
+  /// circular buffer of the flight recorder of a hart (see
+  /// Hart::enableFlightRecorder). It holds the main items of the
+  /// text trace of the instruction: CSR changes are not kept.
+  struct FlightRecord
+  {
+    uint64_t tag = 0;          // Retired instruction count.
+    uint64_t pc = 0;           // Address of instruction.
+    uint64_t value = 0;        // Value of written register.
+    uint64_t memAddr = 0;      // Load/store data address.
+    uint64_t memValue = 0;     // Stored value.
+    uint32_t inst = 0;
+    uint8_t reg = 0;           // Written register.
+    bool hasReg = false;       // True if a register was written.
+    bool fpReg = false;        // True if written register is FP.
+    bool isLoad = false;       // True if memAddr is a load address.
+    bool isStore = false;      // True if memAddr/memValue were stored.
+  };
+
+
+  /// Binary instruction trace format: A file header followed by one
+  /// variable size record per traced instruction. A record holds a
+  /// flag byte, the hart id, the tag and pc as deltas from the
+  /// previous record of the same hart, the opcode and the changed
+  /// register/CSR/memory values. Integers are in LEB128 form.
+  class BinaryTrace
+  {
+  public:
+
+    /// Per-hart state needed to encode/decode deltas.
+    struct HartState
+    {
+      uint64_t tag = 0;
+      uint64_t nextPc = 0;
+    };
+
+    /// Write the header of a binary trace of harts with the given
+    /// register width (32 or 64) to the given file. Return true on
+    /// success.
+    static bool writeHeader(FILE* out, unsigned xlen);
+
+    /// Read the header of a binary trace from the given file setting
+    /// xlen to the register width of the traced harts. Return true on
+    /// success and false if file is not a binary trace.
+    static bool readHeader(FILE* in, unsigned& xlen);
+
+    /// Append the binary form of the given record to the given buffer
+    /// updating the given state of the record hart.
+    static void encode(const TraceRecord& rec, HartState& state,
+		       std::vector<uint8_t>& buffer);
+
+    /// Read the next record from the given file using/updating the
+    /// given per-hart states (resized as needed). Return true on
+    /// success. Return false at end of file or if file is corrupt in
+    /// which case error is set to true.
+    static bool decode(FILE* in, std::vector<HartState>& states,
+		       TraceRecord& rec, bool& error);
+  };
+
+
+  /// Control flow event of a branch trace: The instructions executed
+  /// since the previous event of the same hart (tags up to and
+  /// including tag) were sequential and the next instruction is at
+  /// the given target.
+  struct BranchEvent
+  {
+    enum Kind : uint8_t
+      {
+	Jump,       // Taken branch, jump or trap return at from.
+	Exception,  // Exception of instruction at from (tag).
+	Interrupt,  // Interrupt before instruction at from (tag + 1).
+	Start,      // Run starts at target: No preceding instructions.
+	Stop        // Run stops: Next instruction (if any) is at target.
+      };
+
+    uint64_t tag = 0;          // Instruction count at event.
+    uint64_t from = 0;         // Source address (see Kind).
+    uint64_t to = 0;           // Target address.
+    unsigned hartId = 0;
+    Kind kind = Jump;
+  };
+
+
+  /// Branch trace format: A file header followed by one variable size
+  /// record per control flow event. A record holds a kind byte, the
+  /// hart id, the tag as a delta from the previous event of the same
+  /// hart, the source as a delta from the previous target and the
+  /// target as a delta from the source. Integers are in LEB128 form.
+  /// Combined with the program, the events are enough to reconstruct
+  /// the executed instruction stream.
+  class BranchTrace
+  {
+  public:
+
+    /// Per-hart state needed to encode/decode deltas.
+    struct HartState
+    {
+      uint64_t tag = 0;
+      uint64_t to = 0;
+    };
+
+    /// Write the header of a branch trace of harts with the given
+    /// register width (32 or 64) to the given file. Return true on
+    /// success.
+    static bool writeHeader(FILE* out, unsigned xlen);
+
+    /// Read the header of a branch trace from the given file setting
+    /// xlen to the register width of the traced harts. Return true on
+    /// success and false if file is not a branch trace.
+    static bool readHeader(FILE* in, unsigned& xlen);
+
+    /// Append the binary form of the given event to the given buffer
+    /// updating the given state of the event hart.
+    static void encode(const BranchEvent& event, HartState& state,
+		       std::vector<uint8_t>& buffer);
+
+    /// Read the next event from the given file using/updating the
+    /// given per-hart states (resized as needed). Return true on
+    /// success. Return false at end of file or if file is corrupt in
+    /// which case error is set to true.
+    static bool decode(FILE* in, std::vector<HartState>& states,
+		       BranchEvent& event, bool& error);
+  };
+
+
+  /// Gzip compressed files behind a stdio stream so that the trace and
+  /// command-log writers work unchanged. Data is compressed by the
+  /// thread writing to the stream (the writer thread of an
+  /// asynchronous trace).
+  class CompressedFile
+  {
+  public:
+
+    /// Return true if this build supports compressed files.
+    static bool supported();
+
+    /// Return true if given file name has a compressed suffix (.gz).
+    static bool isCompressedName(const std::string& path);
+
+    /// Open the given file for writing compressed data using the given
+    /// compression level (1 to 9; 1 is fastest). Return the stream or
+    /// null on failure. Closing the stream completes the file.
+    static FILE* openWrite(const std::string& path, int level = 1);
+
+    /// Open the given file for reading decompressing its contents if it
+    /// is compressed. Return the stream or null on failure.
+    static FILE* openRead(const std::string& path);
+  };
+
+
+  /// Trace stream of the browser build (em++) handing its data to the
+  /// JS side (syscall_emulator.trace) in large chunks: The stream
+  /// buffer is in the heap (shared with the main thread in the build
+  /// with threads) and each flush of a full buffer, of a time slice
+  /// (see Hart::runSlice) or of the end of the run is a single call
+  /// rather than one call per line through the standard output.
+  class JsTraceStream
+  {
+  public:
+
+    /// Return true if the JS side accepts trace chunks. Always false
+    /// outside the browser build.
+    static bool supported();
+
+    /// Open a trace stream with the given buffer size. Return the
+    /// stream or null if not supported.
+    static FILE* open(size_t bufferSize = 1024*1024);
+  };
+
+
+  /// Asynchronous trace writer: Each hart appends its trace records
+  /// to its own single-producer single-consumer ring buffer without
+  /// locking. A background thread drains the rings, merging the
+  /// records of the harts in ascending tag order, formats them and
+  /// writes them to the trace file. Simulation stalls only if a ring
+  /// is full.
+  class TraceWriter
+  {
+  public:
+
+    /// Text formatter of a record (see Hart::printTraceRecord).
+    typedef std::function<void(const TraceRecord&, FILE*)> Formatter;
+
+    /// Constructor: Write the records of the given number of harts to
+    /// the given file. Records are written in the binary format (see
+    /// BinaryTrace) if formatter is empty and as text using the
+    /// formatter otherwise.
+    TraceWriter(FILE* out, unsigned hartCount, Formatter formatter);
+
+    /// Destructor: Write the pending records and stop the writer
+    /// thread.
+    ~TraceWriter();
+
+    /// Return the slot of the next record of the given hart waiting
+    /// for room if the ring of the hart is full. The record is
+    /// published by commit.
+    TraceRecord& reserve(unsigned hartId)
+    {
+      Ring& ring = *rings_[hartId];
+      uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+      while (tail - ring.head.load(std::memory_order_acquire) >= ringSize)
+	std::this_thread::yield();
+      return ring.slots[tail & (ringSize - 1)];
+    }
+
+    /// Publish the record obtained with reserve.
+    void commit(unsigned hartId)
+    {
+      Ring& ring = *rings_[hartId];
+      ring.tail.store(ring.tail.load(std::memory_order_relaxed) + 1,
+		      std::memory_order_release);
+    }
+
+    /// Wait till all the published records are written and flush the
+    /// trace file.
+    void flush();
+
+  private:
+
+    /// Body of writer thread.
+    void run();
+
+    /// Write the oldest pending record. Return false if there is none.
+    bool writeOne();
+
+    static constexpr uint64_t ringSize = 4096;  // Power of 2.
+
+    struct Ring
+    {
+      std::vector<TraceRecord> slots;
+      alignas(64) std::atomic<uint64_t> head{0};  // Consumed by writer.
+      alignas(64) std::atomic<uint64_t> tail{0};  // Produced by hart.
+    };
+
+    FILE* out_;
+    Formatter formatter_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+    std::vector<BinaryTrace::HartState> states_;
+    std::vector<uint8_t> buffer_;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+  };
+}
@@ -32,13 +32,20 @@ using namespace WdRiscv;
 
 #include <emscripten.h>
 
-EM_JS(const char *, readInteractiveCommand, (), {
+// Return the next command (allocated with malloc) of the JS console.
+// The console lives on the main browser thread: The call is proxied
+// to it in the build with threads (make PTHREADS=1).
+static const char*
+readInteractiveCommand()
+{
+  return reinterpret_cast<const char*>(intptr_t(MAIN_THREAD_EM_ASM_INT({
 	var jsString = getInteractiveCommand();
-  var lengthBytes = lengthBytesUTF8(jsString)+1;
-  var stringOnWasmHeap = _malloc(lengthBytes);
-  stringToUTF8(jsString, stringOnWasmHeap, lengthBytes);
-  return stringOnWasmHeap;
-});
+	var lengthBytes = lengthBytesUTF8(jsString)+1;
+	var stringOnWasmHeap = _malloc(lengthBytes);
+	stringToUTF8(jsString, stringOnWasmHeap, lengthBytes);
+	return stringOnWasmHeap;
+      })));
+}
 
 #endif
 
@@ -120,7 +127,88 @@ Interactive<URV>::untilCommand(Hart<URV>& hart, const std::string& line,
   if (not parseCmdLineNumber("address", tokens.at(1), addr))
     return false;
 
-  return hart.untilAddress(addr, traceFile);
+  bool ok = hart.untilAddress(addr, traceFile);
+  hart.reportStopPoint();
+  return ok;
+}
+
+
+template <typename URV>
+bool
+Interactive<URV>::breakCommand(Hart<URV>& hart, const std::string& line,
+			       const std::vector<std::string>& tokens)
+{
+  if (tokens.size() != 2)
+    {
+      std::cerr << "Invalid " << tokens.at(0) << " command: " << line << '\n';
+      std::cerr << "Expecting: " << tokens.at(0) << " address\n";
+      return false;
+    }
+
+  URV addr = 0;
+  if (not parseCmdLineNumber("address", tokens.at(1), addr))
+    return false;
+
+  if (tokens.at(0) == "break")
+    {
+      if (not hart.addBreakpoint(addr))
+	std::cerr << "Breakpoint already set at " << tokens.at(1) << '\n';
+      return true;
+    }
+
+  if (not hart.removeBreakpoint(addr))
+    {
+      std::cerr << "No breakpoint at " << tokens.at(1) << '\n';
+      return false;
+    }
+  return true;
+}
+
+
+template <typename URV>
+bool
+Interactive<URV>::watchCommand(Hart<URV>& hart, const std::string& line,
+			       const std::vector<std::string>& tokens)
+{
+  if (tokens.size() < 2 or tokens.size() > 4)
+    {
+      std::cerr << "Invalid " << tokens.at(0) << " command: " << line << '\n';
+      std::cerr << "Expecting: " << tokens.at(0) << " address [size] [r|w|a]\n";
+      return false;
+    }
+
+  URV addr = 0;
+  if (not parseCmdLineNumber("address", tokens.at(1), addr))
+    return false;
+
+  unsigned size = 4;
+  if (tokens.size() > 2 and not parseCmdLineNumber("size", tokens.at(2), size))
+    return false;
+
+  using WatchType = typename Hart<URV>::WatchType;
+  WatchType type = WatchType::Write;
+  if (tokens.size() > 3)
+    {
+      const std::string& tag = tokens.at(3);
+      if (tag == "r")
+	type = WatchType::Read;
+      else if (tag == "a")
+	type = WatchType::Access;
+      else if (tag != "w")
+	{
+	  std::cerr << "Invalid watch type: " << tag << " -- expecting r, w or a\n";
+	  return false;
+	}
+    }
+
+  bool ok = false;
+  if (tokens.at(0) == "watch")
+    ok = hart.addWatchpoint(addr, size, type);
+  else
+    ok = hart.removeWatchpoint(addr, size, type);
+  if (not ok)
+    std::cerr << "Failed to " << tokens.at(0) << ": " << line << '\n';
+  return ok;
 }
 
 
@@ -1065,6 +1153,13 @@ printInteractiveHelp()
   cout << "  Run until address or interrupted.\n\n";
   cout << "step [<n>]\n";
   cout << "  Execute n instructions (1 if n is missing).\n\n";
+  cout << "break <address>\n";
+  cout << "unbreak <address>\n";
+  cout << "  Set/clear a breakpoint: Run/until stop before the instruction at address.\n\n";
+  cout << "watch <address> [<size>] [r|w|a]\n";
+  cout << "unwatch <address> [<size>] [r|w|a]\n";
+  cout << "  Set/clear a data watchpoint on size bytes (default 4) at address:\n";
+  cout << "  Run/until stop after a write (w, default), read (r) or any access (a).\n\n";
   cout << "peek <res> <addr>\n";
   cout << "  Print value of resource res (one of r, f, c, m) and address addr.\n";
   cout << "  For memory (m) up to 2 addresses may be provided to define a range\n";
@@ -1095,11 +1190,23 @@ printInteractiveHelp()
   cout << "replay step n\n";
   cout << "  Execute consecutive commands from the replay file until n\n";
   cout << "  step commands are executed or the file is exhausted\n\n";
+  cout << "replay fast [n]\n";
+  cout << "  Same as replay n but parse the commands once into a compiled form and\n";
+  cout << "  run consecutive step commands in a single loop.\n\n";
   cout << "reset [<reset_pc>]\n";
   cout << "  Reset hart.  If reset_pc is given, then change the reset program\n";
   cout << "  counter to the given reset_pc before resetting the hart.\n\n";
   cout << "symbols\n";
   cout << "  List all the symbols in the loaded ELF file(s).\n\n";
+  cout << "flight\n";
+  cout << "  Print the instructions held by the flight recorder (see\n";
+  cout << "  --flightrecorder) in the trace format.\n\n";
+  cout << "undo begin|rollback|end\n";
+  cout << "  Start recording an undo log of the changes made by subsequent step\n";
+  cout << "  commands, undo the recorded changes, or keep them and stop recording.\n\n";
+  cout << "selfprofile [reset]\n";
+  cout << "  Print the self profile of the hart (time per simulator phase, decode\n";
+  cout << "  cache hits/misses) or clear it. Requires a build with SELF_PROFILE=1.\n\n";
   cout << "exception inst [<offset>]\n";
   cout << "  Take an instruction access fault on the subsequent step command. Given\n";
   cout << "  offset (defaults to zero) is added to the instruction PC to form the address\n";
@@ -1151,6 +1258,27 @@ Interactive<URV>::helpCommand(const std::vector<std::string>& tokens)
       return;
     }
 
+  if (tag == "break" or tag == "unbreak")
+    {
+      cout << "break <address>\n"
+	   << "unbreak <address>\n"
+	   << "  Set/clear a breakpoint. The run and until commands stop before\n"
+	   << "  executing the instruction at a breakpoint. Running again\n"
+	   << "  resumes with that instruction.\n";
+      return;
+    }
+
+  if (tag == "watch" or tag == "unwatch")
+    {
+      cout << "watch <address> [<size>] [r|w|a]\n"
+	   << "unwatch <address> [<size>] [r|w|a]\n"
+	   << "  Set/clear a watchpoint on the size bytes (default 4) at the given\n"
+	   << "  address. The run and until commands stop after an instruction\n"
+	   << "  writing (w, the default), reading (r) or accessing (a) any of\n"
+	   << "  those bytes. Unwatch arguments must match those of watch.\n";
+      return;
+    }
+
   if (tag == "step")
     {
       cout << "step [<n>]\n"
@@ -1235,7 +1363,12 @@ Interactive<URV>::helpCommand(const std::vector<std::string>& tokens)
 	   << "  replay file (defined by the replay_file command).\n"
 	   << "  With the keyword step, key-in on step commands in the replay\n"
 	   << "  file. With an integer number n, replay n commands (or n step\n"
-	   << "  commands if step keyword is present).\n";
+	   << "  commands if step keyword is present).\n"
+	   << "replay fast [<n>]\n"
+	   << "  Like replay [<n>] but the replay file commands are first parsed\n"
+	   << "  into a compiled form (register and CSR names resolved, numbers\n"
+	   << "  converted) and consecutive step commands are executed in a single\n"
+	   << "  loop. This is much faster for long command logs.\n";
       return;
     }
 
@@ -1259,16 +1392,16 @@ Interactive<URV>::helpCommand(const std::vector<std::string>& tokens)
 }
 
 
-/// Command line interpreter: Execute a command line.
-template <typename URV>
+/// Remove comments and leading/trailing white space from the given
+/// command line placing the result in line and its white space
+/// separated tokens in tokens. Return false if nothing is left.
+static
 bool
-Interactive<URV>::executeLine(unsigned& currentHartId,
-			      const std::string& inLine, FILE* traceFile,
-			      FILE* commandLog,
-			      std::ifstream& replayStream, bool& done)
+tokenizeCommandLine(const std::string& inLine, std::string& line,
+		    std::vector<std::string>& tokens)
 {
   // Remove comments (anything starting with #).
-  std::string line = inLine;
+  line = inLine;
   auto sharpIx = line.find_first_of('#');
   if (sharpIx != std::string::npos)
     line = line.substr(0, sharpIx);
@@ -1277,13 +1410,27 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
   boost::algorithm::trim_if(line, boost::is_any_of(" \t"));
 
   if (line.empty())
-    return true;
+    return false;
 
   // Break line into tokens.
-  std::vector<std::string> tokens;
+  tokens.clear();
   boost::split(tokens, line, boost::is_any_of(" \t"),
 	       boost::token_compress_on);
-  if (tokens.empty())
+  return not tokens.empty();
+}
+
+
+/// Command line interpreter: Execute a command line.
+template <typename URV>
+bool
+Interactive<URV>::executeLine(unsigned& currentHartId,
+			      const std::string& inLine, FILE* traceFile,
+			      FILE* commandLog,
+			      std::ifstream& replayStream, bool& done)
+{
+  std::string line;
+  std::vector<std::string> tokens;
+  if (not tokenizeCommandLine(inLine, line, tokens))
     return true;
 
   std::string outLine;   // Line to print on command log.
@@ -1335,6 +1482,24 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
       return true;
     }
 
+  if (command == "break" or command == "unbreak")
+    {
+      if (not breakCommand(hart, line, tokens))
+	return false;
+      if (commandLog)
+	fprintf(commandLog, "%s\n", outLine.c_str());
+      return true;
+    }
+
+  if (command == "watch" or command == "unwatch")
+    {
+      if (not watchCommand(hart, line, tokens))
+	return false;
+      if (commandLog)
+	fprintf(commandLog, "%s\n", outLine.c_str());
+      return true;
+    }
+
   if (command == "s" or command == "step")
     {
       if (hart.inDebugMode() and not hart.inDebugStepMode())
@@ -1445,6 +1610,34 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
       return true;
     }
 
+  if (command == "undo")
+    {
+      std::string action = tokens.size() == 2 ? tokens.at(1) : "";
+      bool ok = true;
+      if (action == "begin")
+	hart.beginUndoLog();
+      else if (action == "rollback")
+	ok = hart.rollbackUndoLog();
+      else if (action == "end" and hart.hasUndoLog())
+	hart.endUndoLog();
+      else if (action == "end")
+	ok = false;
+      else
+	{
+	  std::cerr << "Invalid undo command: " << line << '\n';
+	  std::cerr << "Expecting: undo begin|rollback|end\n";
+	  return false;
+	}
+      if (not ok)
+	{
+	  std::cerr << "No active undo log\n";
+	  return false;
+	}
+      if (commandLog)
+	fprintf(commandLog, "%s\n", outLine.c_str());
+      return true;
+    }
+
   if (command == "replay_file")
     {
       if (not replayFileCommand(line, tokens, replayStream))
@@ -1471,6 +1664,36 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
       return true;
     }
 
+  if (command == "flight")
+    {
+      if (not hart.hasFlightRecorder())
+	{
+	  std::cerr << "Flight recorder is not enabled (see --flightrecorder)\n";
+	  return false;
+	}
+      hart.dumpFlightRecorder("interactive request", stdout);
+      return true;
+    }
+
+  if (command == "selfprofile")
+    {
+      if (tokens.size() > 1 and tokens.at(1) != "reset")
+	{
+	  std::cerr << "Invalid selfprofile command: " << line << '\n';
+	  std::cerr << "Expecting: selfprofile [reset]\n";
+	  return false;
+	}
+      if (not hart.printSelfProfile(std::cout))
+	{
+	  std::cerr << "Self profile is not available (build with "
+		    << "SELF_PROFILE=1)\n";
+	  return false;
+	}
+      if (tokens.size() > 1)
+	hart.resetSelfProfile();
+      return true;
+    }
+
   if (command == "h" or command == "?" or command == "help")
     {
       helpCommand(tokens);
@@ -1482,6 +1705,327 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 }
 
 
+/// Quiet variant of parseCmdLineNumber: Return false without a
+/// diagnostic if numberStr does not represent a number of type TYPE.
+template <typename TYPE>
+static
+bool
+parseNumberQuiet(const std::string& numberStr, TYPE& number)
+{
+  if (numberStr.empty())
+    return false;
+  char* end = nullptr;
+  uint64_t value = strtoull(numberStr.c_str(), &end, 0);
+  number = static_cast<TYPE>(value);
+  return number == value and not (end and *end);
+}
+
+
+/// Check that given hart can be single stepped printing a diagnostic
+/// (same as that of the step command) if it cannot.
+template <typename URV>
+static
+bool
+canStepHart(Hart<URV>& hart)
+{
+  if (hart.inDebugMode() and not hart.inDebugStepMode())
+    {
+      std::cerr << "Error: Single step while in debug-halt mode\n";
+      return false;
+    }
+  if (not hart.isStarted())
+    {
+      std::cerr << "Cannot step a non-started hart: Consider writing "
+		<< "the mhartstart CSR\n";
+      return false;
+    }
+  return true;
+}
+
+
+template <typename URV>
+bool
+Interactive<URV>::compileReplayLine(unsigned currentHartId,
+				    const std::string& inLine, bool keepLog,
+				    std::vector<ReplayOp>& ops)
+{
+  std::string line;
+  std::vector<std::string> tokens;
+  if (not tokenizeCommandLine(inLine, line, tokens))
+    return true;
+
+  using Kind = typename ReplayOp::Kind;
+
+  ReplayOp op;
+  op.line = inLine;
+
+  const std::string& first = tokens.front();
+  if (first == "q" or first == "quit" or first == "replay" or
+      first == "replay_file")
+    {
+      ops.push_back(op);
+      return false;
+    }
+
+  // Malformed lines are kept as text and diagnosed when executed.
+  unsigned hartId = currentHartId;
+  bool error = false;
+  bool hasHart = getCommandHartId(tokens, hartId, error);
+  if (error or tokens.empty() or hartId >= harts_.size())
+    {
+      ops.push_back(op);
+      return true;
+    }
+
+  Hart<URV>& hart = *(harts_.at(hartId));
+  const std::string& command = tokens.front();
+  size_t count = tokens.size();
+  bool compiled = false;
+
+  if ((command == "s" or command == "step") and count <= 2)
+    {
+      op.kind = Kind::Step;
+      op.count = 1;
+      op.eachStep = count == 1;
+      compiled = count == 1 or parseNumberQuiet(tokens.at(1), op.count);
+    }
+  else if (command == "peek" and count == 2 and tokens.at(1) == "pc")
+    {
+      op.kind = Kind::PeekPc;
+      compiled = true;
+    }
+  else if (command == "peek" and count == 3 and tokens.at(2) != "all")
+    {
+      const std::string& resource = tokens.at(1);
+      const std::string& name = tokens.at(2);
+      if (resource == "r")
+	{
+	  op.kind = Kind::PeekInt;
+	  compiled = hart.findIntReg(name, op.number);
+	}
+      else if (resource == "f")
+	{
+	  op.kind = Kind::PeekFp;
+	  compiled = hart.findFpReg(name, op.number);
+	}
+      else if (resource == "c")
+	{
+	  op.kind = Kind::PeekCsr;
+	  auto csr = hart.findCsr(name);
+	  compiled = csr != nullptr;
+	  if (csr)
+	    op.number = unsigned(csr->getNumber());
+	}
+    }
+  else if (command == "poke" and count == 3 and tokens.at(1) == "pc")
+    {
+      op.kind = Kind::PokePc;
+      compiled = parseNumberQuiet(tokens.at(2), op.value);
+    }
+  else if (command == "poke" and count == 4)
+    {
+      const std::string& resource = tokens.at(1);
+      const std::string& name = tokens.at(2);
+      if (parseNumberQuiet(tokens.at(3), op.value))
+	{
+	  if (resource == "r")
+	    {
+	      op.kind = Kind::PokeInt;
+	      compiled = hart.findIntReg(name, op.number);
+	    }
+	  else if (resource == "f")
+	    {
+	      op.kind = Kind::PokeFp;
+	      compiled = hart.findFpReg(name, op.number);
+	    }
+	  else if (resource == "c")
+	    {
+	      op.kind = Kind::PokeCsr;
+	      auto csr = hart.findCsr(name);
+	      compiled = csr != nullptr;
+	      if (csr)
+		op.number = unsigned(csr->getNumber());
+	    }
+	  else if (resource == "m")
+	    {
+	      op.kind = Kind::PokeMem;
+	      compiled = parseNumberQuiet(name, op.addr);
+	    }
+	}
+    }
+
+  if (not compiled)
+    {
+      ops.push_back(ReplayOp());
+      ops.back().line = inLine;
+      return true;
+    }
+
+  op.hartId = hartId;
+  op.line.clear();
+  if (keepLog)
+    op.line = hasHart ? line : "hart=" + std::to_string(hartId) + " " + line;
+
+  if (op.kind == Kind::Step and op.eachStep and not ops.empty())
+    {
+      ReplayOp& prev = ops.back();
+      if (prev.kind == Kind::Step and prev.eachStep and
+	  prev.hartId == hartId and prev.line == op.line)
+	{
+	  prev.count++;
+	  return true;
+	}
+    }
+
+  ops.push_back(op);
+  return true;
+}
+
+
+template <typename URV>
+bool
+Interactive<URV>::executeReplayOps(const std::vector<ReplayOp>& ops,
+				   unsigned& currentHartId, FILE* traceFile,
+				   FILE* commandLog, std::ifstream& replayStream,
+				   bool& done)
+{
+  using Kind = typename ReplayOp::Kind;
+
+  auto hexForm = getHexForm<URV>(); // Format string for printing a hex val
+
+  for (const auto& op : ops)
+    {
+      if (done)
+	break;
+
+      if (op.kind == Kind::Line)
+	{
+	  if (not executeLine(currentHartId, op.line, traceFile, commandLog,
+			      replayStream, done))
+	    return false;
+	  continue;
+	}
+
+      Hart<URV>& hart = *(harts_.at(op.hartId));
+      URV val = 0;
+      uint64_t fpVal = 0;
+
+      switch (op.kind)
+	{
+	case Kind::Step:
+	  resetMemoryMappedRegs_ = true;
+	  if (op.eachStep)
+	    {
+	      // Coalesced step commands: Check and log each one.
+	      for (uint64_t i = 0; i < op.count; ++i)
+		{
+		  if (not canStepHart(hart))
+		    return false;
+		  hart.singleStep(traceFile);
+		  hart.clearTraceData();
+		  if (commandLog)
+		    fprintf(commandLog, "%s\n", op.line.c_str());
+		}
+	      continue;
+	    }
+	  if (not canStepHart(hart))
+	    return false;
+	  for (uint64_t i = 0; i < op.count; ++i)
+	    {
+	      hart.singleStep(traceFile);
+	      hart.clearTraceData();
+	    }
+	  break;
+
+	case Kind::PeekPc:
+	  std::cout << (boost::format(hexForm) % hart.peekPc()) << std::endl;
+	  break;
+
+	case Kind::PeekInt:
+	  if (not hart.peekIntReg(op.number, val))
+	    {
+	      std::cerr << "Failed to read integer register: x" << op.number
+			<< '\n';
+	      return false;
+	    }
+	  std::cout << (boost::format(hexForm) % val) << std::endl;
+	  break;
+
+	case Kind::PeekFp:
+	  if (not hart.isRvf())
+	    {
+	      std::cerr << "Floating point extension is no enabled\n";
+	      return false;
+	    }
+	  if (not hart.peekFpReg(op.number, fpVal))
+	    {
+	      std::cerr << "Failed to read fp register: f" << op.number << '\n';
+	      return false;
+	    }
+	  std::cout << (boost::format("0x%016x") % fpVal) << std::endl;
+	  break;
+
+	case Kind::PeekCsr:
+	  if (not hart.peekCsr(CsrNumber(op.number), val))
+	    {
+	      std::cerr << "Failed to read CSR: 0x" << std::hex << op.number
+			<< std::dec << '\n';
+	      return false;
+	    }
+	  std::cout << (boost::format(hexForm) % val) << std::endl;
+	  break;
+
+	case Kind::PokePc:
+	  hart.pokePc(op.value);
+	  break;
+
+	case Kind::PokeInt:
+	  if (not hart.pokeIntReg(op.number, op.value))
+	    {
+	      std::cerr << "Failed to write integer register x" << op.number
+			<< '\n';
+	      return false;
+	    }
+	  break;
+
+	case Kind::PokeFp:
+	  if (not hart.pokeFpReg(op.number, op.value))
+	    {
+	      std::cerr << "Failed to write FP register f" << op.number << '\n';
+	      return false;
+	    }
+	  break;
+
+	case Kind::PokeCsr:
+	  if (not hart.pokeCsr(CsrNumber(op.number), op.value))
+	    {
+	      std::cerr << "Failed to write CSR 0x" << std::hex << op.number
+			<< std::dec << '\n';
+	      return false;
+	    }
+	  break;
+
+	case Kind::PokeMem:
+	  if (not hart.pokeMemory(op.addr, op.value))
+	    {
+	      std::cerr << "Address out of bounds: 0x" << std::hex << op.addr
+			<< std::dec << '\n';
+	      return false;
+	    }
+	  break;
+
+	case Kind::Line:
+	  break;
+	}
+
+      if (commandLog)
+	fprintf(commandLog, "%s\n", op.line.c_str());
+    }
+
+  return true;
+}
+
+
 /// Interactive "replay" command.
 template <typename URV>
 bool
@@ -1494,6 +2038,42 @@ Interactive<URV>::replayCommand(unsigned& currentHartId,
   std::string replayLine;
   uint64_t maxCount = ~uint64_t(0);  // Unlimited
 
+  if (tokens.size() >= 2 and tokens.size() <= 3 and tokens.at(1) == "fast")
+    {
+      if (tokens.size() == 3)
+	if (not parseCmdLineNumber("command-count", tokens.at(2), maxCount))
+	  return false;
+
+      // Compile lines up to the next barrier (or end of file), then
+      // execute the compiled operations.
+      std::vector<ReplayOp> ops;
+      uint64_t count = 0;
+      bool more = true;
+      while (more and not done)
+	{
+	  ops.clear();
+	  bool barrier = false;
+	  while (not barrier and count < maxCount)
+	    {
+	      if (not std::getline(replayStream, replayLine))
+		{
+		  more = false;
+		  break;
+		}
+	      count++;
+	      barrier = not compileReplayLine(currentHartId, replayLine,
+					      commandLog != nullptr, ops);
+	    }
+	  if (count >= maxCount)
+	    more = false;
+
+	  if (not executeReplayOps(ops, currentHartId, traceFile, commandLog,
+				   replayStream, done))
+	    return false;
+	}
+      return true;
+    }
+
   if (tokens.size() <= 2)    // Either replay or replay n.
     {
       if (tokens.size() == 2)
@@ -1545,7 +2125,8 @@ Interactive<URV>::replayCommand(unsigned& currentHartId,
     }
 
   std::cerr << "Invalid command: " << line << '\n';
-  std::cerr << "Expecting: replay, replay <count>, or replay step <count>\n";
+  std::cerr << "Expecting: replay, replay <count>, replay step <count>, or "
+	    << "replay fast [<count>]\n";
   return false;    
 }
 
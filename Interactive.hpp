@@ -52,6 +52,16 @@ namespace WdRiscv
 		     const std::vector<std::string>& tokens,
 		     FILE* traceFile);
 
+    /// Helper to interact: "break" and "unbreak" commands. Set/clear
+    /// a breakpoint.
+    bool breakCommand(Hart<URV>&, const std::string& line,
+		      const std::vector<std::string>& tokens);
+
+    /// Helper to interact: "watch" and "unwatch" commands. Set/clear
+    /// a data watchpoint.
+    bool watchCommand(Hart<URV>&, const std::string& line,
+		      const std::vector<std::string>& tokens);
+
     /// Helper to interact: "step" command. Single step.
     bool stepCommand(Hart<URV>&, const std::string& line,
 		     const std::vector<std::string>& tokens, FILE* traceFile);
@@ -101,7 +111,9 @@ namespace WdRiscv
     void helpCommand(const std::vector<std::string>& tokens);
 
     /// Helper to interact: "replay" command. Replay one or more
-    /// commands from the replay file.
+    /// commands from the replay file. The "replay fast" variant
+    /// compiles the replay file commands (see ReplayOp) before
+    /// executing them.
     bool replayCommand(unsigned& currentHartId,
 		       const std::string& line,
 		       const std::vector<std::string>& tokens,
@@ -118,6 +130,40 @@ namespace WdRiscv
 
   private:
 
+    /// Compiled replay file command: Command line parsed once with
+    /// register/CSR names resolved to numbers. Lines that do not have
+    /// a compiled form are kept as text and go through executeLine.
+    struct ReplayOp
+    {
+      enum class Kind { Line, Step, PeekPc, PeekInt, PeekFp, PeekCsr,
+			PokePc, PokeInt, PokeFp, PokeCsr, PokeMem };
+
+      Kind kind = Kind::Line;
+      unsigned hartId = 0;
+      bool eachStep = false;  // Step: Count is that of coalesced "step" lines.
+      uint64_t count = 0;     // Step: Instruction count.
+      unsigned number = 0;    // Register or CSR number.
+      URV addr = 0;           // Memory address.
+      URV value = 0;          // Poke value.
+      std::string line;       // Command text (Line) or command log text.
+    };
+
+    /// Compile given replay file line appending to ops. Consecutive
+    /// single-step commands of the same hart are coalesced into one
+    /// operation. Keep the command log text of each operation if
+    /// keepLog is true. Return false if the line is a barrier (a
+    /// command such as quit or replay_file interacting with the replay
+    /// stream) that must be executed before compiling further lines.
+    bool compileReplayLine(unsigned currentHartId, const std::string& line,
+			   bool keepLog, std::vector<ReplayOp>& ops);
+
+    /// Execute given compiled replay operations. Return true on
+    /// success and false if an operation fails.
+    bool executeReplayOps(const std::vector<ReplayOp>& ops,
+			  unsigned& currentHartId, FILE* traceFile,
+			  FILE* commandLog, std::ifstream& replayStream,
+			  bool& done);
+
     std::vector< Hart<URV>* >& harts_;
 
     // Initial resets do not reset memory mapped registers.
@@ -16,14 +16,23 @@
 // this program. If not, see <https://www.gnu.org/licenses/>.
 //
 
+#include <algorithm>
+#include <array>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <iterator>
 #ifndef __MINGW64__
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 #include <elfio/elfio.hpp>
 #include "Memory.hpp"
@@ -31,6 +40,261 @@
 using namespace WdRiscv;
 
 
+namespace
+{
+  /// Read-only contents of a file: mapped into the host address space
+  /// when possible, read into a buffer otherwise.
+  class MappedFile
+  {
+  public:
+
+    /// Map the given file. Check valid() for success.
+    MappedFile(const std::string& path);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    void operator=(const MappedFile&) = delete;
+
+    bool valid() const
+    { return valid_; }
+
+    const uint8_t* data() const
+    { return data_; }
+
+    size_t size() const
+    { return size_; }
+
+  private:
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool valid_ = false;
+    bool mapped_ = false;
+    std::vector<uint8_t> buffer_;  // Used when mmap is not available.
+  };
+
+
+  /// Read-only view of an ELF file mapped into the host address
+  /// space. Segment and section contents are accessed in place: the
+  /// file is not copied into heap buffers (as ELFIO does) so that
+  /// loading a large image does not double peak memory. Header fields
+  /// are widened to their 64-bit form.
+  class ElfView
+  {
+  public:
+
+    struct Segment
+    {
+      uint32_t type = 0;
+      uint32_t flags = 0;
+      uint64_t vaddr = 0;
+      uint64_t fileSize = 0;
+      const uint8_t* data = nullptr;
+    };
+
+    struct Section
+    {
+      uint32_t type = 0;
+      uint32_t link = 0;
+      uint64_t size = 0;
+      const uint8_t* data = nullptr;
+    };
+
+    /// Map the given file and parse its headers. Check valid() for
+    /// success.
+    ElfView(const std::string& path);
+
+    ElfView(const ElfView&) = delete;
+    void operator=(const ElfView&) = delete;
+
+    /// Return true if the file was mapped and has an ELF identification.
+    bool valid() const
+    { return valid_; }
+
+    unsigned char elfClass() const
+    { return base_[EI_CLASS]; }
+
+    unsigned char encoding() const
+    { return base_[EI_DATA]; }
+
+    uint16_t machine() const
+    { return machine_; }
+
+    uint64_t entry() const
+    { return entry_; }
+
+    /// Segments and sections (empty if the file is not little-endian
+    /// or if its header tables are out of bounds).
+    const std::vector<Segment>& segments() const
+    { return segments_; }
+
+    const std::vector<Section>& sections() const
+    { return sections_; }
+
+  private:
+
+    template <typename Ehdr, typename Phdr, typename Shdr>
+    void parse();
+
+    /// Return true if the range [offset, offset + size) is within the
+    /// file.
+    bool inFile(uint64_t offset, uint64_t size) const
+    { return offset <= size_ and size <= size_ - offset; }
+
+    MappedFile file_;
+    const uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    bool valid_ = false;
+    uint16_t machine_ = 0;
+    uint64_t entry_ = 0;
+    std::vector<Segment> segments_;
+    std::vector<Section> sections_;
+  };
+}
+
+
+MappedFile::MappedFile(const std::string& path)
+{
+#ifndef __MINGW64__
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 and st.st_size > 0)
+    {
+      void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED)
+	{
+	  data_ = static_cast<const uint8_t*>(addr);
+	  size_ = st.st_size;
+	  mapped_ = true;
+	}
+    }
+  close(fd);
+#endif
+
+  if (not mapped_)
+    {
+      std::ifstream ifs(path, std::ios::binary);
+      if (not ifs)
+	return;
+      buffer_.assign(std::istreambuf_iterator<char>(ifs),
+		     std::istreambuf_iterator<char>());
+      data_ = buffer_.data();
+      size_ = buffer_.size();
+    }
+
+  valid_ = true;
+}
+
+
+MappedFile::~MappedFile()
+{
+#ifndef __MINGW64__
+  if (mapped_)
+    munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+}
+
+
+ElfView::ElfView(const std::string& path)
+  : file_(path), base_(file_.data()), size_(file_.size())
+{
+  if (size_ < EI_NIDENT or base_[EI_MAG0] != ELFMAG0 or
+      base_[EI_MAG1] != ELFMAG1 or base_[EI_MAG2] != ELFMAG2 or
+      base_[EI_MAG3] != ELFMAG3)
+    return;
+
+  unsigned char cls = elfClass();
+  if ((cls == ELFCLASS32 and size_ < sizeof(ELFIO::Elf32_Ehdr)) or
+      (cls == ELFCLASS64 and size_ < sizeof(ELFIO::Elf64_Ehdr)) or
+      (cls != ELFCLASS32 and cls != ELFCLASS64))
+    return;
+
+  valid_ = true;
+
+  if (cls == ELFCLASS32)
+    parse<ELFIO::Elf32_Ehdr, ELFIO::Elf32_Phdr, ELFIO::Elf32_Shdr>();
+  else
+    parse<ELFIO::Elf64_Ehdr, ELFIO::Elf64_Phdr, ELFIO::Elf64_Shdr>();
+}
+
+
+template <typename Ehdr, typename Phdr, typename Shdr>
+void
+ElfView::parse()
+{
+  Ehdr hdr;
+  memcpy(&hdr, base_, sizeof(hdr));
+  machine_ = hdr.e_machine;
+  entry_ = hdr.e_entry;
+
+  // Multi-byte fields are used as is: Only little-endian files (on a
+  // little-endian host) are supported.
+  if (encoding() != ELFDATA2LSB)
+    return;
+
+  if (hdr.e_phentsize == sizeof(Phdr) and
+      inFile(hdr.e_phoff, uint64_t(hdr.e_phnum) * sizeof(Phdr)))
+    for (unsigned i = 0; i < hdr.e_phnum; ++i)
+      {
+	Phdr ph;
+	memcpy(&ph, base_ + hdr.e_phoff + i*sizeof(Phdr), sizeof(ph));
+	Segment seg;
+	seg.type = ph.p_type;
+	seg.flags = ph.p_flags;
+	seg.vaddr = ph.p_vaddr;
+	seg.fileSize = ph.p_filesz;
+	if (inFile(ph.p_offset, ph.p_filesz))
+	  seg.data = base_ + ph.p_offset;
+	else
+	  seg.fileSize = 0;
+	segments_.push_back(seg);
+      }
+
+  if (hdr.e_shentsize == sizeof(Shdr) and
+      inFile(hdr.e_shoff, uint64_t(hdr.e_shnum) * sizeof(Shdr)))
+    for (unsigned i = 0; i < hdr.e_shnum; ++i)
+      {
+	Shdr sh;
+	memcpy(&sh, base_ + hdr.e_shoff + i*sizeof(Shdr), sizeof(sh));
+	Section sec;
+	sec.type = sh.sh_type;
+	sec.link = sh.sh_link;
+	if (sh.sh_type != SHT_NOBITS and inFile(sh.sh_offset, sh.sh_size))
+	  {
+	    sec.size = sh.sh_size;
+	    sec.data = base_ + sh.sh_offset;
+	  }
+	sections_.push_back(sec);
+      }
+}
+
+
+#ifdef MEM_SPARSE
+
+/// Allocate the given sparse storage directory (zero filled with room
+/// for the given number of chunk pointers) if not already allocated.
+/// Return the directory.
+static uint8_t**
+allocSparseDir(uint8_t**& dir, size_t chunkCount)
+{
+  if (not dir)
+    {
+      dir = static_cast<uint8_t**>(calloc(chunkCount, sizeof(uint8_t*)));
+      if (not dir)
+	{
+	  std::cerr << "Out of memory\n";
+	  exit(1);
+	}
+    }
+  return dir;
+}
+
+#endif
+
+
 Memory::Memory(size_t size, size_t pageSize, size_t regionSize)
   : size_(size), data_(nullptr), pageSize_(pageSize), reservations_(1), lastWriteData_(1)
 { 
@@ -105,6 +369,12 @@ Memory::Memory(size_t size, size_t pageSize, size_t regionSize)
   if (regionCount_ * regionSize_ < size_)
     regionCount_++;
 
+#ifdef MEM_SPARSE
+  data_ = nullptr;
+  sparseDir_.resize(((size_ - 1) >> sparseDirShift) + 1);
+  sparseWriteDir_.resize(sparseDir_.size());
+#else
+
 #ifndef __MINGW64__
   void* mem = mmap(nullptr, size_, PROT_READ | PROT_WRITE,
 		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
@@ -126,12 +396,19 @@ Memory::Memory(size_t size, size_t pageSize, size_t regionSize)
     }
 
   data_ = reinterpret_cast<uint8_t*>(mem);
+#endif
 
   // Mark all regions as non-configured.
   regionConfigured_.resize(regionCount_);
 
   attribs_.resize(pageCount_);
 
+  codeLines_.resize(pageCount_);
+  codeGen_.resize(pageCount_);
+  codeLineShift_ = 0;
+  while ((size_t(64) << codeLineShift_) < pageSize_)
+    codeLineShift_++;
+
   // Make whole memory as mapped, writable, allowing data and inst.
   // Some of the pages will be later reconfigured when the user
   // supplied configuration file is processed.
@@ -147,6 +424,21 @@ Memory::Memory(size_t size, size_t pageSize, size_t regionSize)
 
 Memory::~Memory()
 {
+#ifdef MEM_SPARSE
+  for (auto dir : sparseWriteDir_)
+    {
+      if (not dir)
+	continue;
+      for (size_t i = 0; i < sparseChunksPerDir; ++i)
+	free(dir[i]);
+      free(dir);
+    }
+  sparseWriteDir_.clear();
+  for (auto dir : sparseDir_)
+    free(dir);
+  sparseDir_.clear();
+#endif
+
   if (data_)
     {
 #ifndef __MINGW64__
@@ -159,8 +451,193 @@ Memory::~Memory()
 }
 
 
+/// Value of each hexadecimal digit character, -1 for other characters.
+static const std::array<int8_t, 256> hexDigitValue = [] {
+  std::array<int8_t, 256> table{};
+  for (auto& v : table)
+    v = -1;
+  for (int i = 0; i < 10; ++i)
+    table['0' + i] = int8_t(i);
+  for (int i = 0; i < 6; ++i)
+    table['a' + i] = table['A' + i] = int8_t(10 + i);
+  return table;
+}();
+
+
+/// Consecutive bytes of a hex file: size bytes starting at offset in
+/// the byte buffer of a chunk go to memory at address.
+struct HexRun
+{
+  size_t address = 0;
+  size_t offset = 0;
+  size_t size = 0;
+};
+
+
+/// Bytes and runs of a chunk (a sequence of lines) of a hex file.
+struct HexChunk
+{
+  const char* begin = nullptr;
+  const char* end = nullptr;
+  std::vector<HexRun> runs;
+  std::vector<uint8_t> bytes;
+  bool ok = false;
+};
+
+
+/// Parse the lines of the given chunk collecting its data into
+/// runs. Data before the first @address line of the chunk goes at
+/// address zero. Set chunk.ok to false if some line is not in the
+/// plain form: @address (at most 16 digits) optionally followed by a
+/// space and anything, or whitespace separated tokens of hexadecimal
+/// digits each of value at most 0xff and no trailing whitespace. Such
+/// lines are left to Memory::loadHexFileByToken which reports errors.
+static void
+parseHexChunk(HexChunk& chunk)
+{
+  const char* p = chunk.begin;
+  const char* end = chunk.end;
+  chunk.runs.push_back(HexRun());
+
+  auto isSpace = [] (char c) {
+    return c == ' ' or c == '\t' or c == '\r' or c == '\v' or c == '\f';
+  };
+
+  while (p < end)
+    {
+      const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+      if (not eol)
+	eol = end;
+
+      if (p == eol)
+	;  // Empty line.
+      else if (*p == '@')
+	{
+	  size_t address = 0;
+	  const char* q = p + 1;
+	  for ( ; q < eol and hexDigitValue[uint8_t(*q)] >= 0; ++q)
+	    address = (address << 4) | hexDigitValue[uint8_t(*q)];
+	  unsigned digits = q - p - 1;
+	  if (digits == 0 or digits > 16 or (q < eol and *q != ' '))
+	    return;
+	  HexRun run;
+	  run.address = address;
+	  run.offset = chunk.bytes.size();
+	  chunk.runs.push_back(run);
+	}
+      else
+	{
+	  HexRun& run = chunk.runs.back();
+	  const char* q = p;
+	  while (true)
+	    {
+	      while (q < eol and isSpace(*q))
+		++q;
+	      if (q == eol)
+		return;  // Blank line or trailing whitespace.
+	      unsigned value = 0;
+	      const char* tokStart = q;
+	      for ( ; q < eol and hexDigitValue[uint8_t(*q)] >= 0; ++q)
+		{
+		  value = (value << 4) | hexDigitValue[uint8_t(*q)];
+		  if (value > 0xff)
+		    return;
+		}
+	      if (q == tokStart or (q < eol and not isSpace(*q)))
+		return;
+	      chunk.bytes.push_back(uint8_t(value));
+	      run.size++;
+	      if (q == eol)
+		break;
+	    }
+	}
+      p = eol + 1;
+    }
+
+  chunk.ok = true;
+}
+
+
 bool
 Memory::loadHexFile(const std::string& fileName)
+{
+  MappedFile file(fileName);
+  if (not file.valid())
+    {
+      std::cerr << "Failed to open hex-file '" << fileName << "' for input\n";
+      return false;
+    }
+
+  // Split the file at @address lines (a chunk must start with one to
+  // be parsed independently) and parse the chunks in parallel.
+  const char* text = reinterpret_cast<const char*>(file.data());
+  size_t size = file.size();
+  size_t minChunkSize = size_t(4) << 20;
+  unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+  threadCount = std::min<size_t>(threadCount, size / minChunkSize + 1);
+
+  std::vector<HexChunk> chunks;
+  const char* begin = text;
+  for (unsigned i = 1; i < threadCount; ++i)
+    {
+      const char* split = text + i * (size / threadCount);
+      if (split <= begin)
+	continue;
+      std::string_view rest(split, text + size - split);
+      size_t pos = rest.find("\n@");
+      if (pos == std::string_view::npos)
+	break;
+      HexChunk chunk;
+      chunk.begin = begin;
+      chunk.end = split + pos + 1;
+      chunks.push_back(std::move(chunk));
+      begin = split + pos + 1;
+    }
+  HexChunk last;
+  last.begin = begin;
+  last.end = text + size;
+  chunks.push_back(std::move(last));
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < chunks.size(); ++i)
+    threads.emplace_back(parseHexChunk, std::ref(chunks.at(i)));
+  parseHexChunk(chunks.front());
+  for (auto& thread : threads)
+    thread.join();
+
+  bool ok = true;
+  for (const auto& chunk : chunks)
+    for (const auto& run : chunk.runs)
+      ok = ok and chunk.ok and run.address <= size_ and
+	run.size <= size_ - run.address;
+
+  // Malformed or out of bounds data: Use the token parser to get the
+  // same partial load and the same error messages.
+  if (not ok)
+    return loadHexFileByToken(fileName);
+
+  size_t overwrites = 0;
+  for (const auto& chunk : chunks)
+    for (const auto& run : chunk.runs)
+      {
+	if (run.size == 0)
+	  continue;
+	overwrites += countNonZero(run.address, run.size);
+	if (writeHooks_)
+	  notePageWrites(run.address, run.size);
+	copyIn(run.address, chunk.bytes.data() + run.offset, run.size);
+      }
+
+  if (overwrites)
+    std::cerr << "File " << fileName << ": Overwrote previously loaded data "
+	      << "changing " << overwrites << " or more bytes\n";
+
+  return true;
+}
+
+
+bool
+Memory::loadHexFileByToken(const std::string& fileName)
 {
   std::ifstream input(fileName);
 
@@ -222,9 +699,9 @@ Memory::loadHexFile(const std::string& fileName)
 	    {
 	      if (not errors)
 		{
-		  if (data_[address] != 0)
+		  if (peekData<uint8_t>(address) != 0)
 		    overwrites++;
-		  data_[address++] = value & 0xff;
+		  pokeData<uint8_t>(address++, value & 0xff);
 		}
 	    }
 	  else
@@ -255,6 +732,67 @@ Memory::loadHexFile(const std::string& fileName)
 }
 
 
+/// Call f(name, address, size) for each named symbol of type
+/// notype, func or object in the given raw symbol table (array of
+/// Elf32_Sym or Elf64_Sym) with the given string table. Stop early
+/// and return true if f returns true.
+template <typename Sym, typename F>
+static bool
+forEachSymbol(const uint8_t* syms, size_t symSize, const char* names,
+	      size_t namesSize, F f)
+{
+  for (size_t offset = 0; offset + sizeof(Sym) <= symSize;
+       offset += sizeof(Sym))
+    {
+      Sym sym;
+      memcpy(&sym, syms + offset, sizeof(sym));
+      unsigned type = ELF_ST_TYPE(sym.st_info);
+      if (type != STT_NOTYPE and type != STT_FUNC and type != STT_OBJECT)
+	continue;
+      if (sym.st_name == 0 or sym.st_name >= namesSize)
+	continue;
+      const char* name = names + sym.st_name;
+      std::string_view sv(name, strnlen(name, namesSize - sym.st_name));
+      if (not sv.empty() and f(sv, size_t(sym.st_value), size_t(sym.st_size)))
+	return true;
+    }
+  return false;
+}
+
+
+/// Same as above but for the given table of a parsed ELF file.
+template <typename F>
+static bool
+forEachSymbol(bool is64, const uint8_t* syms, size_t symSize,
+	      const char* names, size_t namesSize, F f)
+{
+  if (is64)
+    return forEachSymbol<ELFIO::Elf64_Sym>(syms, symSize, names, namesSize, f);
+  return forEachSymbol<ELFIO::Elf32_Sym>(syms, symSize, names, namesSize, f);
+}
+
+
+/// Call f(symData, symSize, names, namesSize) for each symbol table
+/// section of the given ELF view. Stop early and return true if f
+/// returns true.
+template <typename F>
+static bool
+forEachSymbolTable(const ElfView& view, F f)
+{
+  const auto& sections = view.sections();
+  for (const auto& sec : sections)
+    {
+      if (sec.type != SHT_SYMTAB or sec.link >= sections.size())
+	continue;
+      const auto& strSec = sections.at(sec.link);
+      if (f(sec.data, sec.size, reinterpret_cast<const char*>(strSec.data),
+	    strSec.size))
+	return true;
+    }
+  return false;
+}
+
+
 bool
 Memory::loadElfFile(const std::string& fileName, unsigned regWidth,
 		    size_t& entryPoint, size_t& end)
@@ -262,8 +800,6 @@ Memory::loadElfFile(const std::string& fileName, unsigned regWidth,
   entryPoint = 0;
   end = 0;
 
-  ELFIO::elfio reader;
-
   if (regWidth != 32 and regWidth != 64)
     {
       std::cerr << "Error: Memory::loadElfFile called with a unsupported "
@@ -271,14 +807,15 @@ Memory::loadElfFile(const std::string& fileName, unsigned regWidth,
       return false;
     }
 
-  if (not reader.load(fileName))
+  ElfView reader(fileName);
+  if (not reader.valid())
     {
       std::cerr << "Error: Failed to load ELF file " << fileName << '\n';
       return false;
     }
 
-  bool is32 = reader.get_class() == ELFCLASS32;
-  bool is64 = reader.get_class() == ELFCLASS64;
+  bool is32 = reader.elfClass() == ELFCLASS32;
+  bool is64 = reader.elfClass() == ELFCLASS64;
   if (not (is32 or is64))
     {
       std::cerr << "Error: ELF file is neither 32 nor 64-bit. Only 32/64-bit ELFs are currently supported\n";
@@ -300,33 +837,33 @@ Memory::loadElfFile(const std::string& fileName, unsigned regWidth,
       return false;
     }
 
-  if (reader.get_encoding() != ELFDATA2LSB)
+  if (reader.encoding() != ELFDATA2LSB)
     {
       std::cerr << "Only little-endian ELF is currently supported\n";
       return false;
     }
 
-  if (reader.get_machine() != EM_RISCV)
+  if (reader.machine() != EM_RISCV)
     {
       std::cerr << "Warning: non-riscv ELF file\n";
     }
 
-  auto secCount = reader.sections.size();
-
   // Copy loadable ELF segments into memory.
   size_t maxEnd = 0;  // Largest end address of a segment.
   size_t errors = 0, overwrites = 0;
 
   unsigned loadedSegs = 0;
-  for (int segIx = 0; segIx < reader.segments.size(); ++segIx)
+  const auto& segments = reader.segments();
+  for (size_t segIx = 0; segIx < segments.size(); ++segIx)
     {
-      const ELFIO::segment* seg = reader.segments[segIx];
-      ELFIO::Elf64_Addr vaddr = seg->get_virtual_address();
-      ELFIO::Elf_Xword segSize = seg->get_file_size(); // Size in file.
-      const char* segData = seg->get_data();
-      if (seg->get_type() != PT_LOAD)
+      const auto& seg = segments.at(segIx);
+      if (seg.type != PT_LOAD)
 	continue;
 
+      size_t vaddr = seg.vaddr;
+      size_t segSize = seg.fileSize; // Size in file.
+      const uint8_t* segData = seg.data;
+
       if (vaddr + segSize > size_)
 	{
 	  std::cerr << "End of ELF segment " << segIx << " ("
@@ -340,28 +877,49 @@ Memory::loadElfFile(const std::string& fileName, unsigned regWidth,
 	    }
 	}
 
-      size_t unmappedCount = 0;
-      for (size_t i = 0; i < segSize; ++i)
+      if (isPlainBlock(vaddr, segSize))
 	{
-	  if (data_[vaddr + i] != 0)
-	    overwrites++;
-	  if (not writeByteNoAccessCheck(vaddr + i, segData[i]))
+	  // Common case: Copy whole segment straight from the file
+	  // mapping unless it is already in a shared image (keep
+	  // sharing its chunks).
+	  if (not isSharedBlock(vaddr, segData, segSize))
 	    {
-	      if (unmappedCount == 0)
-		std::cerr << "Failed to copy ELF byte at address 0x"
-			  << std::hex << (vaddr + i) << std::dec
-			  << ": corresponding location is not mapped\n";
-	      unmappedCount++;
-	      if (checkUnmappedElf_)
+	      overwrites += countNonZero(vaddr, segSize);
+	      pokeBlock(vaddr, segData, segSize);
+	    }
+	}
+      else
+	{
+	  // Segment overlaps unmapped pages or memory mapped
+	  // registers: Copy byte by byte applying register masks.
+	  size_t unmappedCount = 0;
+	  for (size_t i = 0; i < segSize; ++i)
+	    {
+	      if (vaddr + i < size_ and peekData<uint8_t>(vaddr + i) != 0)
+		overwrites++;
+	      if (not writeByteNoAccessCheck(vaddr + i, segData[i]))
 		{
-		  errors++;
-		  break;
+		  if (unmappedCount == 0)
+		    std::cerr << "Failed to copy ELF byte at address 0x"
+			      << std::hex << (vaddr + i) << std::dec
+			      << ": corresponding location is not mapped\n";
+		  unmappedCount++;
+		  if (checkUnmappedElf_)
+		    {
+		      errors++;
+		      break;
+		    }
 		}
 	    }
 	}
 
       loadedSegs++;
-      maxEnd = std::max(maxEnd, size_t(vaddr) + size_t(segSize));
+      if (seg.flags & PF_X)
+	{
+	  elfCodeSize_ += segSize;
+	  elfCodeSegments_.push_back(std::make_pair(vaddr, segSize));
+	}
+      maxEnd = std::max(maxEnd, vaddr + segSize);
     }
 
   if (loadedSegs == 0)
@@ -375,39 +933,24 @@ Memory::loadElfFile(const std::string& fileName, unsigned regWidth,
   for (unsigned hartId = 0; hartId < reservations_.size(); ++hartId)
     clearLastWriteInfo(hartId);
 
-  // Collect symbols.
-  for (int secIx = 0; secIx < secCount; ++secIx)
-    {
-      auto sec = reader.sections[secIx];
-      if (sec->get_type() != SHT_SYMTAB)
-	continue;
-
-      const ELFIO::symbol_section_accessor symAccesor(reader, sec);
-      ELFIO::Elf64_Addr address = 0;
-      ELFIO::Elf_Xword size = 0;
-      unsigned char bind, type, other;
-      ELFIO::Elf_Half index = 0;
-
-      // Finding symbol by name does not work. Walk all the symbols.
-      ELFIO::Elf_Xword symCount = symAccesor.get_symbols_num();
-      for (ELFIO::Elf_Xword symIx = 0; symIx < symCount; ++symIx)
-	{
-	  std::string name;
-	  if (symAccesor.get_symbol(symIx, name, address, size, bind, type,
-				    index, other))
-	    {
-	      if (name.empty())
-		continue;
-	      if (type == STT_NOTYPE or type == STT_FUNC or type == STT_OBJECT)
-		symbols_[name] = ElfSymbol(address, size);
-	    }
-	}
-    }
+  // Keep a copy of the symbol tables (small compared to the
+  // segments). They are indexed on first use (see indexElfSymbols).
+  std::lock_guard<std::mutex> lock(symbolMutex_);
+  functionsValid_.store(false, std::memory_order_release);
+  forEachSymbolTable(reader, [this, is64] (const uint8_t* syms, size_t symSize,
+					   const char* names, size_t namesSize) {
+    ElfSymbolTable table;
+    table.is64 = is64;
+    table.syms.assign(syms, syms + symSize);
+    table.names.assign(names, names + namesSize);
+    pendingSymbols_.push_back(std::move(table));
+    return false;
+  });
 
   // Get the program entry point.
   if (not errors)
     {
-      entryPoint = reader.get_entry();
+      entryPoint = reader.entry();
       end = maxEnd;
     }
 
@@ -419,13 +962,92 @@ Memory::loadElfFile(const std::string& fileName, unsigned regWidth,
 }
 
 
+void
+Memory::indexElfSymbols() const
+{
+  for (const auto& table : pendingSymbols_)
+    forEachSymbol(table.is64, table.syms.data(), table.syms.size(),
+		  table.names.data(), table.names.size(),
+		  [this] (std::string_view name, size_t addr, size_t size) {
+		    symbols_[std::string(name)] = ElfSymbol(addr, size);
+		    return false;
+		  });
+  pendingSymbols_.clear();
+}
+
+
+void
+Memory::indexElfFunctions() const
+{
+  std::lock_guard<std::mutex> lock(symbolMutex_);
+  if (functionsValid_.load(std::memory_order_relaxed))
+    return;
+
+  indexElfSymbols();
+
+  functions_.clear();
+  for (const auto& kv : symbols_)
+    {
+      const auto& sym = kv.second;
+      if (sym.size_ == 0)
+	continue;  // Contains no address.
+      ElfFunction func;
+      func.start = sym.addr_;
+      func.end = sym.addr_ + sym.size_;
+      func.name = &kv.first;  // Stable: symbols_ is node based.
+      functions_.push_back(func);
+    }
+
+  std::sort(functions_.begin(), functions_.end(),
+	    [] (const ElfFunction& a, const ElfFunction& b) {
+	      if (a.start != b.start)
+		return a.start < b.start;
+	      if (a.end != b.end)
+		return a.end > b.end;
+	      return *a.name < *b.name;
+	    });
+
+  size_t maxEnd = 0;
+  for (auto& func : functions_)
+    {
+      maxEnd = std::max(maxEnd, func.end);
+      func.maxEnd = maxEnd;
+    }
+
+  functionsValid_.store(true, std::memory_order_release);
+}
+
+
 bool
 Memory::findElfSymbol(const std::string& symbol, ElfSymbol& value) const
 {
-  if (not symbols_.count(symbol))
+  std::lock_guard<std::mutex> lock(symbolMutex_);
+
+  // Look in the tables not yet indexed without indexing them: The
+  // few symbols looked up after each load (e.g. tohost) do not
+  // justify building the map. Latest definition wins.
+  for (auto it = pendingSymbols_.rbegin(); it != pendingSymbols_.rend(); ++it)
+    {
+      bool found = false;
+      forEachSymbol(it->is64, it->syms.data(), it->syms.size(),
+		    it->names.data(), it->names.size(),
+		    [&] (std::string_view name, size_t addr, size_t size) {
+		      if (name == symbol)
+			{
+			  value = ElfSymbol(addr, size);
+			  found = true;
+			}
+		      return false;
+		    });
+      if (found)
+	return true;
+    }
+
+  auto iter = symbols_.find(symbol);
+  if (iter == symbols_.end())
     return false;
 
-  value = symbols_.at(symbol);
+  value = iter->second;
   return true;
 }
 
@@ -433,14 +1055,25 @@ Memory::findElfSymbol(const std::string& symbol, ElfSymbol& value) const
 bool
 Memory::findElfFunction(size_t addr, std::string& name, ElfSymbol& value) const
 {
-  for (const auto& kv : symbols_)
+  if (not functionsValid_.load(std::memory_order_acquire))
+    indexElfFunctions();
+
+  // Walk back from the last range starting at or before addr. The
+  // walk stops at the first range containing addr (the innermost one
+  // if ranges are nested) or when no earlier range extends past addr.
+  auto iter = std::upper_bound(functions_.begin(), functions_.end(), addr,
+			       [] (size_t a, const ElfFunction& func) {
+				 return a < func.start;
+			       });
+  while (iter != functions_.begin())
     {
-      auto& sym = kv.second;
-      size_t start = sym.addr_, end = sym.addr_ + sym.size_;
-      if (addr >= start and addr < end)
+      --iter;
+      if (iter->maxEnd <= addr)
+	break;
+      if (addr < iter->end)
 	{
-	  name = kv.first;
-	  value = sym;
+	  name = *iter->name;
+	  value = ElfSymbol(iter->start, iter->end - iter->start);
 	  return true;
 	}
     }
@@ -449,9 +1082,24 @@ Memory::findElfFunction(size_t addr, std::string& name, ElfSymbol& value) const
 }
 
 
+void
+Memory::getElfFunctions(std::vector<std::pair<std::string, ElfSymbol>>& funcs) const
+{
+  if (not functionsValid_.load(std::memory_order_acquire))
+    indexElfFunctions();
+
+  funcs.clear();
+  for (const auto& func : functions_)
+    funcs.emplace_back(*func.name, ElfSymbol(func.start, func.end - func.start));
+}
+
+
 void
 Memory::printElfSymbols(std::ostream& out) const
 {
+  std::lock_guard<std::mutex> lock(symbolMutex_);
+  indexElfSymbols();
+
   out << std::hex;
   for (const auto& kv : symbols_)
     out << kv.first << ' ' << "0x" << kv.second.addr_ << '\n';
@@ -464,9 +1112,9 @@ Memory::getElfFileAddressBounds(const std::string& fileName, size_t& minAddr,
 				size_t& maxAddr)
 
 {
-  ELFIO::elfio reader;
+  ElfView reader(fileName);
 
-  if (not reader.load(fileName))
+  if (not reader.valid())
     {
       std::cerr << "Failed to load ELF file " << fileName << '\n';
       return false;
@@ -476,17 +1124,16 @@ Memory::getElfFileAddressBounds(const std::string& fileName, size_t& minAddr,
   size_t minBound = ~ size_t(0);
   size_t maxBound = 0;
   unsigned validSegs = 0;
-  for (int segIx = 0; segIx < reader.segments.size(); ++segIx)
+  for (const auto& seg : reader.segments())
     {
-      const ELFIO::segment* seg = reader.segments[segIx];
-      if (seg->get_type() != PT_LOAD)
+      if (seg.type != PT_LOAD)
 	continue;
 
-      ELFIO::Elf64_Addr vaddr = seg->get_virtual_address();
-      ELFIO::Elf_Xword size = seg->get_file_size(); // Size in file.
+      size_t vaddr = seg.vaddr;
+      size_t size = seg.fileSize; // Size in file.
 
-      minBound = std::min(minBound, size_t(vaddr));
-      maxBound = std::max(maxBound, size_t(vaddr + size));
+      minBound = std::min(minBound, vaddr);
+      maxBound = std::max(maxBound, vaddr + size);
       validSegs++;
     }
 
@@ -506,14 +1153,14 @@ bool
 Memory::checkElfFile(const std::string& path, bool& is32bit,
 		     bool& is64bit, bool& isRiscv)
 {
-  ELFIO::elfio reader;
+  ElfView reader(path);
 
-  if (not reader.load(path))
+  if (not reader.valid())
     return false;
 
-  is32bit = reader.get_class() == ELFCLASS32;
-  is64bit = reader.get_class() == ELFCLASS64;
-  isRiscv = reader.get_machine() == EM_RISCV;
+  is32bit = reader.elfClass() == ELFCLASS32;
+  is64bit = reader.elfClass() == ELFCLASS64;
+  isRiscv = reader.machine() == EM_RISCV;
 
   return true;
 }
@@ -522,52 +1169,808 @@ Memory::checkElfFile(const std::string& path, bool& is32bit,
 bool
 Memory::isSymbolInElfFile(const std::string& path, const std::string& target)
 {
-  ELFIO::elfio reader;
+  ElfView reader(path);
 
-  if (not reader.load(path))
+  if (not reader.valid())
     return false;
 
-  auto secCount = reader.sections.size();
-  for (int secIx = 0; secIx < secCount; ++secIx)
+  bool is64 = reader.elfClass() == ELFCLASS64;
+  return forEachSymbolTable(reader, [&] (const uint8_t* syms, size_t symSize,
+					 const char* names, size_t namesSize) {
+    return forEachSymbol(is64, syms, symSize, names, namesSize,
+			 [&] (std::string_view name, size_t, size_t) {
+			   return name == target;
+			 });
+  });
+}
+
+
+void
+Memory::copy(const Memory& other)
+{
+  size_t n = std::min(size_, other.size_);
+  if (writeHooks_ and n)
+    notePageWrites(0, n);
+
+#ifdef MEM_SPARSE
+  // Copy only the chunks written in the other memory.
+  for (size_t d = 0; d < other.sparseDir_.size(); ++d)
     {
-      auto sec = reader.sections[secIx];
-      if (sec->get_type() != SHT_SYMTAB)
+      uint8_t** dir = other.sparseDir_[d];
+      if (not dir)
 	continue;
+      for (size_t i = 0; i < sparseChunksPerDir; ++i)
+	{
+	  size_t addr = (d << sparseDirShift) + (i << sparseChunkShift);
+	  if (dir[i] and addr < n)
+	    memcpy(sparseWritePtr(addr), dir[i],
+		   std::min(sparseChunkSize, n - addr));
+	}
+    }
+#else
+  memcpy(data_, other.data_, n);
+#endif
+}
 
-      const ELFIO::symbol_section_accessor symAccesor(reader, sec);
-      ELFIO::Elf64_Addr address = 0;
-      ELFIO::Elf_Xword size = 0;
-      unsigned char bind, type, other;
-      ELFIO::Elf_Half index = 0;
 
-      // Finding symbol by name does not work. Walk all the symbols.
-      ELFIO::Elf_Xword symCount = symAccesor.get_symbols_num();
-      for (ELFIO::Elf_Xword symIx = 0; symIx < symCount; ++symIx)
-	{
-	  std::string name;
-	  if (symAccesor.get_symbol(symIx, name, address, size, bind, type,
-				    index, other))
+bool
+Memory::shareImage(Memory& image)
+{
+#ifdef MEM_SPARSE
+  if (image.size_ != size_)
+    {
+      std::cerr << "Cannot share memory image: Memory size (0x" << std::hex
+		<< size_ << ") differs from that of image (0x" << image.size_
+		<< ")\n" << std::dec;
+      return false;
+    }
+
+  if (&image != this and writeHooks_)
+    notePageWrites(0, size_);
+
+  // Lock both memories: Several memories may share the same image
+  // concurrently.
+  std::unique_lock<std::mutex> imageLock(image.sparseMutex_, std::defer_lock);
+  std::unique_lock<std::mutex> lock(sparseMutex_, std::defer_lock);
+  if (&image == this)
+    lock.lock();
+  else
+    std::lock(imageLock, lock);
+
+  {
+    // Move the private chunks of the image to a new shared image.
+    auto shared = std::make_shared<SharedImage>();
+    for (auto wdir : image.sparseWriteDir_)
+      if (wdir)
+	for (size_t i = 0; i < sparseChunksPerDir; ++i)
+	  if (wdir[i])
 	    {
-	      if (name.empty())
-		continue;
-	      if (type == STT_NOTYPE or type == STT_FUNC or type == STT_OBJECT)
-		if (name == target)
-		  return true;
+	      shared->chunks.push_back(wdir[i]);
+	      wdir[i] = nullptr;
 	    }
+    if (not shared->chunks.empty())
+      {
+	shared->base = image.sharedImage_;
+	image.sharedImage_ = shared;
+      }
+  }
+
+  if (&image == this)
+    return true;
+
+  {
+    // Drop the chunks of this memory and use those of the image.
+    for (auto& wdir : sparseWriteDir_)
+      if (wdir)
+	{
+	  for (size_t i = 0; i < sparseChunksPerDir; ++i)
+	    free(wdir[i]);
+	  free(wdir);
+	  wdir = nullptr;
 	}
+
+    for (size_t d = 0; d < sparseDir_.size(); ++d)
+      {
+	uint8_t** from = image.sparseDir_[d];
+	uint8_t**& dir = sparseDir_[d];
+	if (from)
+	  memcpy(allocSparseDir(dir, sparseChunksPerDir), from,
+		 sparseChunksPerDir * sizeof(uint8_t*));
+	else if (dir)
+	  memset(dir, 0, sparseChunksPerDir * sizeof(uint8_t*));
+      }
+    sharedImage_ = image.sharedImage_;
+  }
+  imageLock.unlock();
+  lock.unlock();
+
+  // Invalidate the decoded instructions of all code pages.
+  for (size_t ix = 0; ix < codeLines_.size(); ++ix)
+    if (codeLines_[ix])
+      bumpCodeGeneration(ix * pageSize_, ix * pageSize_);
+  return true;
+#else
+  (void) image;
+  std::cerr << "Cannot share memory image: Memory storage is not sparse "
+	    << "(build with MEM_SPARSE)\n";
+  return false;
+#endif
+}
+
+
+bool
+Memory::canShareImages()
+{
+#ifdef MEM_SPARSE
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+bool
+Memory::isSharedBlock(size_t addr, const uint8_t* data, size_t n) const
+{
+#ifdef MEM_SPARSE
+  if (not sharedImage_)
+    return false;
+  while (n)
+    {
+      size_t chunkEnd = (addr | (sparseChunkSize - 1)) + 1;
+      size_t len = std::min(n, chunkEnd - addr);
+      size_t dirIx = addr >> sparseDirShift;
+      size_t ix = (addr >> sparseChunkShift) & (sparseChunksPerDir - 1);
+      const uint8_t* const* wdir = sparseWriteDir_.at(dirIx);
+      if ((wdir and wdir[ix]) or not sparseDir_.at(dirIx) or
+	  not sparseDir_.at(dirIx)[ix])
+	return false;  // Private or never written chunk.
+      if (memcmp(sparseReadPtr(addr), data, len) != 0)
+	return false;
+      addr += len; data += len; n -= len;
     }
+  return true;
+#else
+  (void) addr; (void) data; (void) n;
   return false;
+#endif
+}
+
+
+size_t
+Memory::privateDataSize() const
+{
+#ifdef MEM_SPARSE
+  size_t count = 0;
+  for (auto wdir : sparseWriteDir_)
+    if (wdir)
+      count += std::count_if(wdir, wdir + sparseChunksPerDir,
+			     [] (const uint8_t* chunk) { return chunk; });
+  return count * sparseChunkSize;
+#else
+  return size_;
+#endif
 }
 
 
+
 void
-Memory::copy(const Memory& other)
+Memory::copyOut(size_t addr, uint8_t* buf, size_t n) const
+{
+#ifdef MEM_SPARSE
+  while (n)
+    {
+      size_t chunkEnd = (addr | (sparseChunkSize - 1)) + 1;
+      size_t count = std::min(n, chunkEnd - addr);
+      memcpy(buf, sparseReadPtr(addr), count);
+      addr += count; buf += count; n -= count;
+    }
+#else
+  memcpy(buf, data_ + addr, n);
+#endif
+}
+
+
+void
+Memory::copyIn(size_t addr, const uint8_t* buf, size_t n)
+{
+#ifdef MEM_SPARSE
+  while (n)
+    {
+      size_t chunkEnd = (addr | (sparseChunkSize - 1)) + 1;
+      size_t count = std::min(n, chunkEnd - addr);
+      memcpy(sparseWritePtr(addr), buf, count);
+      addr += count; buf += count; n -= count;
+    }
+#else
+  memcpy(data_ + addr, buf, n);
+#endif
+}
+
+
+size_t
+Memory::countNonZero(size_t addr, size_t n) const
 {
+  size_t count = 0;
+#ifdef MEM_SPARSE
+  while (n)
+    {
+      size_t chunkEnd = (addr | (sparseChunkSize - 1)) + 1;
+      size_t len = std::min(n, chunkEnd - addr);
+      const uint8_t* ptr = sparseReadPtr(addr);
+      if (ptr != sparseZero_)
+	count += len - std::count(ptr, ptr + len, 0);
+      addr += len; n -= len;
+    }
+#else
+  count = n - std::count(data_ + addr, data_ + addr + n, 0);
+#endif
+  return count;
+}
+
+
+bool
+Memory::isPlainBlock(size_t addr, size_t n) const
+{
+  if (n == 0)
+    return true;
+  if (addr >= size_ or n > size_ - addr)
+    return false;
+
+  size_t lastIx = getPageIx(addr + n - 1);
+  for (size_t ix = getPageIx(addr); ix <= lastIx; ++ix)
+    {
+      if (ix >= attribs_.size())
+	return false;
+      const PageAttribs& attrib = attribs_[ix];
+      if (not attrib.isMapped() or attrib.isMemMappedReg())
+	return false;
+    }
+  return true;
+}
+
+
+bool
+Memory::peekBlock(size_t addr, uint8_t* buf, size_t n) const
+{
+  if (not isPlainBlock(addr, n))
+    return false;
+  copyOut(addr, buf, n);
+  return true;
+}
+
+
+bool
+Memory::pokeBlock(size_t addr, const uint8_t* buf, size_t n)
+{
+  if (not isPlainBlock(addr, n))
+    return false;
+  if (n == 0)
+    return true;
+
+  if (writeHooks_)
+    notePageWrites(addr, n);
+  copyIn(addr, buf, n);
+  return true;
+}
+
+
+void
+Memory::getMappedRanges(std::vector<MappedRange>& ranges) const
+{
+  ranges.clear();
+
+  for (size_t ix = 0; ix < attribs_.size(); ++ix)
+    {
+      if (not attribs_[ix].isMapped())
+	continue;
+
+      size_t addr = ix * pageSize_;
+      if (addr >= size_)
+	break;
+      size_t size = std::min(pageSize_, size_ - addr);
+
+      if (not ranges.empty() and
+	  ranges.back().addr + ranges.back().size == addr)
+	ranges.back().size += size;
+      else
+	ranges.push_back({addr, size});
+    }
+}
+
+
+bool
+Memory::isZeroBlock(size_t addr, size_t n) const
+{
+#ifdef MEM_SPARSE
+  while (n)
+    {
+      size_t chunkEnd = (addr | (sparseChunkSize - 1)) + 1;
+      size_t len = std::min(n, chunkEnd - addr);
+      const uint8_t* ptr = sparseReadPtr(addr);
+      if (ptr != sparseZero_ and
+	  std::find_if(ptr, ptr + len, [] (uint8_t b) { return b; }) != ptr + len)
+	return false;
+      addr += len; n -= len;
+    }
+  return true;
+#else
+  const uint8_t* ptr = data_ + addr;
+  return std::find_if(ptr, ptr + n, [] (uint8_t b) { return b; }) == ptr + n;
+#endif
+}
+
+
+void
+Memory::clearData()
+{
+  if (writeHooks_)
+    notePageWrites(0, size_);
+
+#ifdef MEM_SPARSE
+  // Zero the private chunks and drop the shared ones.
+  for (size_t d = 0; d < sparseDir_.size(); ++d)
+    {
+      uint8_t** dir = sparseDir_[d];
+      uint8_t** wdir = sparseWriteDir_[d];
+      if (not dir)
+	continue;
+      for (size_t i = 0; i < sparseChunksPerDir; ++i)
+	{
+	  if (wdir and wdir[i])
+	    memset(wdir[i], 0, sparseChunkSize);
+	  else
+	    dir[i] = nullptr;
+	}
+    }
+#elif defined(__MINGW64__)
+  memset(data_, 0, size_);
+#else
+  // Private anonymous mapping: Dropped pages read back as zeros.
+  if (madvise(data_, size_, MADV_DONTNEED) != 0)
+    memset(data_, 0, size_);
+#endif
+
+  // Invalidate the decoded instructions of all code pages.
+  for (size_t ix = 0; ix < codeLines_.size(); ++ix)
+    if (codeLines_[ix])
+      bumpCodeGeneration(ix * pageSize_, ix * pageSize_);
+}
+
+
+/// Header of the memory part of a checkpoint file. It is followed by
+/// pageCount page addresses (uint64_t), padding to a multiple of
+/// pageSize from the start of the file, and the contents of the
+/// pages (the last page of memory may be partial).
+struct MemCheckpointHeader
+{
+  char magic[8] = { 'W', 'H', 'C', 'K', 'P', 'M', 'E', 'M' };
+  uint64_t memSize = 0;
+  uint64_t pageSize = 0;
+  uint64_t pageCount = 0;
+};
+
+
+bool
+Memory::saveCheckpoint(std::ostream& out) const
+{
+  std::vector<uint64_t> pages;
+  for (size_t addr = 0; addr < size_; addr += pageSize_)
+    if (not isZeroBlock(addr, std::min(pageSize_, size_ - addr)))
+      pages.push_back(addr);
+
+  MemCheckpointHeader header;
+  header.memSize = size_;
+  header.pageSize = pageSize_;
+  header.pageCount = pages.size();
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(pages.data()),
+	    pages.size()*sizeof(uint64_t));
+
+  // Align page contents in the file so that they can be copied from
+  // a mapping of the file a page at a time.
+  std::streamoff pos = out.tellp();
+  if (pos < 0)
+    return false;
+  std::vector<char> buffer(pageSize_);
+  out.write(buffer.data(), (pageSize_ - pos % pageSize_) % pageSize_);
+
+  for (auto addr : pages)
+    {
+      size_t count = std::min(pageSize_, size_ - addr);
+      copyOut(addr, reinterpret_cast<uint8_t*>(buffer.data()), count);
+      out.write(buffer.data(), count);
+    }
+
+  return bool(out);
+}
+
+
+bool
+Memory::loadCheckpoint(const std::string& path, size_t offset)
+{
+  MappedFile file(path);
+  if (not file.valid())
+    {
+      std::cerr << "Failed to open checkpoint file '" << path << "'\n";
+      return false;
+    }
+
+  MemCheckpointHeader header, expected;
+  const uint8_t* data = file.data();
+  size_t size = file.size();
+  if (offset > size or size - offset < sizeof(header))
+    {
+      std::cerr << "Checkpoint file '" << path << "': Truncated memory\n";
+      return false;
+    }
+  memcpy(&header, data + offset, sizeof(header));
+  if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 or
+      header.pageSize == 0)
+    {
+      std::cerr << "Checkpoint file '" << path << "': Bad memory header\n";
+      return false;
+    }
+  if (header.memSize != size_)
+    {
+      std::cerr << "Checkpoint file '" << path << "': Memory size (0x"
+		<< std::hex << header.memSize << ") does not match that of "
+		<< "simulated memory (0x" << size_ << ")\n" << std::dec;
+      return false;
+    }
+
+  size_t pageSize = header.pageSize;
+  size_t indexPos = offset + sizeof(header);
+  if (header.pageCount > (size - indexPos) / sizeof(uint64_t))
+    {
+      std::cerr << "Checkpoint file '" << path << "': Truncated memory\n";
+      return false;
+    }
+  size_t dataPos = indexPos + header.pageCount * sizeof(uint64_t);
+  dataPos += (pageSize - dataPos % pageSize) % pageSize;
+
+  // Validate before modifying memory.
+  std::vector<uint64_t> pages(header.pageCount);
+  memcpy(pages.data(), data + indexPos, pages.size()*sizeof(uint64_t));
+  size_t pos = dataPos;
+  for (auto addr : pages)
+    {
+      size_t count = addr < size_ ? std::min(pageSize, size_ - addr) : 0;
+      if (count == 0 or pos > size or size - pos < count)
+	{
+	  std::cerr << "Checkpoint file '" << path << "': Bad or truncated "
+		    << "memory page at address 0x" << std::hex << addr
+		    << '\n' << std::dec;
+	  return false;
+	}
+      pos += count;
+    }
+
+  clearData();
+
+  pos = dataPos;
+  for (auto addr : pages)
+    {
+      size_t count = std::min(pageSize, size_ - addr);
+      copyIn(addr, data + pos, count);
+      pos += count;
+    }
+
+  for (unsigned hartId = 0; hartId < reservations_.size(); ++hartId)
+    {
+      clearLastWriteInfo(hartId);
+      invalidateLr(hartId);
+    }
+
+  return true;
+}
+
+
+void
+Memory::takeSnapshot()
+{
+  snapshotPages_.clear();
+  snapshotSaved_.assign(pageCount_, false);
+  snapshotActive_ = true;
+  writeHooks_ = true;
+}
+
+
+void
+Memory::trackDirtyPages(bool flag)
+{
+  trackDirty_ = flag;
+  writeHooks_ = journalUsers_ or snapshotActive_ or trackDirty_;
+  if (flag)
+    dirtyPages_.assign(pageCount_, 0);
+  else
+    dirtyPages_.clear();
+}
+
+
+void
+Memory::getDirtyPages(std::vector<size_t>& pages) const
+{
+  pages.clear();
+  for (size_t ix = 0; ix < dirtyPages_.size(); ++ix)
+    if (dirtyPages_[ix])
+      pages.push_back(ix * pageSize_);
+}
+
+
+bool
+Memory::copyDirtyPages(const Memory& other)
+{
+  if (not trackDirty_ or not other.trackDirty_ or size_ != other.size_ or
+      pageSize_ != other.pageSize_)
+    return false;
+
+  std::vector<uint8_t> buffer(pageSize_);
+  for (size_t ix = 0; ix < dirtyPages_.size(); ++ix)
+    {
+      if (not dirtyPages_[ix] and not other.dirtyPages_.at(ix))
+	continue;
+      size_t pageAddr = ix * pageSize_;
+      if (pageAddr >= size_)
+	break;
+      size_t count = std::min(pageSize_, size_ - pageAddr);
+      if (snapshotActive_)
+	saveSnapshotPages(pageAddr, count);
+      other.copyOut(pageAddr, buffer.data(), count);
+      copyIn(pageAddr, buffer.data(), count);
+    }
+
+  clearDirtyPages();
+  return true;
+}
+
+
+size_t
+Memory::diffPages(const Memory& other, std::vector<size_t>& pages,
+		  bool dirtyOnly) const
+{
+  pages.clear();
+
   size_t n = std::min(size_, other.size_);
-  memcpy(data_, other.data_, n);
+  bool useDirty = dirtyOnly and trackDirty_ and other.trackDirty_ and
+    pageSize_ == other.pageSize_;
+
+  std::vector<uint8_t> buffer1(pageSize_), buffer2(pageSize_);
+  for (size_t pageAddr = 0; pageAddr < n; pageAddr += pageSize_)
+    {
+      size_t ix = getPageIx(pageAddr);
+      if (useDirty and not dirtyPages_.at(ix) and not other.dirtyPages_.at(ix))
+	continue;
+      size_t count = std::min(pageSize_, n - pageAddr);
+      copyOut(pageAddr, buffer1.data(), count);
+      other.copyOut(pageAddr, buffer2.data(), count);
+      if (memcmp(buffer1.data(), buffer2.data(), count) != 0)
+	pages.push_back(pageAddr);
+    }
+
+  return pages.size();
+}
+
+
+void
+Memory::bumpCodeGeneration(size_t addr, size_t endAddr, uint64_t* seen)
+{
+  std::lock_guard<std::mutex> lock(codeLogMutex_);
+
+  uint64_t epoch = codeEpoch_.load(std::memory_order_relaxed);
+  bool current = seen and *seen == epoch;
+
+  for (size_t ix = getPageIx(addr); ix <= getPageIx(endAddr); ++ix)
+    if (ix < codeGen_.size())
+      {
+	__atomic_fetch_add(&codeGen_[ix], 1, __ATOMIC_RELEASE);
+	codeLog_[epoch % codeLogSize] = ix;
+	codeEpoch_.store(++epoch, std::memory_order_release);
+      }
+
+  if (current)
+    *seen = epoch;
+}
+
+
+void
+Memory::watchPages(size_t addr, size_t endAddr, bool flag)
+{
+  attribGen_++;
+
+  for (size_t ix = getPageIx(addr); ix <= getPageIx(endAddr); ++ix)
+    {
+      if (ix >= attribs_.size())
+	break;
+
+      unsigned& count = watchCounts_[ix];
+      if (flag)
+	count++;
+      else if (count)
+	count--;
+
+      attribs_[ix].setWatch(count > 0);
+      if (count == 0)
+	watchCounts_.erase(ix);
+    }
 }
 
 
+bool
+Memory::codeWritesSince(uint64_t& epoch, std::vector<size_t>& pages)
+{
+  std::lock_guard<std::mutex> lock(codeLogMutex_);
+
+  uint64_t now = codeEpoch_.load(std::memory_order_relaxed);
+  bool ok = now - epoch <= codeLogSize;
+  if (ok)
+    for (uint64_t e = epoch; e < now; ++e)
+      pages.push_back(codeLog_[e % codeLogSize]);
+
+  epoch = now;
+  return ok;
+}
+
+
+void
+Memory::saveSnapshotPages(size_t address, size_t size)
+{
+  if (size == 0)
+    return;
+
+  size_t lastIx = getPageIx(address + size - 1);
+  for (size_t ix = getPageIx(address); ix <= lastIx; ++ix)
+    {
+      if (ix >= snapshotSaved_.size() or snapshotSaved_[ix])
+	continue;
+      snapshotSaved_[ix] = true;
+
+      size_t pageAddr = ix * pageSize_;
+      size_t count = std::min(pageSize_, size_ - pageAddr);
+      std::vector<uint8_t> data(count);
+      copyOut(pageAddr, data.data(), count);
+      snapshotPages_.emplace_back(pageAddr, std::move(data));
+    }
+}
+
+
+size_t
+Memory::beginWriteJournal()
+{
+  ++journalUsers_;
+  writeHooks_ = true;
+  return journal_.size();
+}
+
+
+void
+Memory::journalWrite(size_t address, size_t size)
+{
+  if (size == 0 or address >= size_)
+    return;
+  size = std::min(size, size_ - address);
+
+  size_t offset = journalBytes_.size();
+  journalBytes_.resize(offset + size);
+  copyOut(address, journalBytes_.data() + offset, size);
+  journal_.push_back({address, size, offset});
+}
+
+
+void
+Memory::rollbackWriteJournal(size_t mark)
+{
+  // Restoring writes must not be journaled.
+  unsigned users = journalUsers_;
+  journalUsers_ = 0;
+
+  while (journal_.size() > mark)
+    {
+      const auto& entry = journal_.back();
+      notePageWrites(entry.addr, entry.size);
+      copyIn(entry.addr, journalBytes_.data() + entry.offset, entry.size);
+
+      size_t last = entry.addr + entry.size - 1;
+      if (isCodeWrite(entry.addr, last))
+	bumpCodeGeneration(entry.addr, last);
+
+      journalBytes_.resize(entry.offset);
+      journal_.pop_back();
+    }
+
+  journalUsers_ = users;
+}
+
+
+void
+Memory::endWriteJournal()
+{
+  if (journalUsers_ == 0 or --journalUsers_)
+    return;
+  journal_.clear();
+  journalBytes_.clear();
+  writeHooks_ = snapshotActive_ or trackDirty_;
+}
+
+
+bool
+Memory::restoreSnapshot(std::vector<size_t>& pages)
+{
+  pages.clear();
+  if (not snapshotActive_)
+    return false;
+
+  for (const auto& saved : snapshotPages_)
+    {
+      size_t pageAddr = saved.first;
+      const auto& data = saved.second;
+      copyIn(pageAddr, data.data(), data.size());
+      if (trackDirty_)
+	markDirtyPages(pageAddr, data.size());
+      snapshotSaved_[getPageIx(pageAddr)] = false;
+      pages.push_back(pageAddr);
+
+      // Invalidate decoded instructions of restored code pages.
+      if (isCodeWrite(pageAddr, pageAddr + data.size() - 1))
+	bumpCodeGeneration(pageAddr, pageAddr + data.size() - 1);
+    }
+  snapshotPages_.clear();
+
+  for (auto& lwd : lastWriteData_)
+    lwd = LastWriteData();
+  for (auto& res : reservations_)
+    res.addr_ = noLrAddr;
+
+  return true;
+}
+
+
+#ifdef MEM_SPARSE
+
+const uint8_t Memory::sparseZero_[Memory::sparseChunkSize] = {};
+
+
+uint8_t*
+Memory::allocSparseChunk(size_t address)
+{
+  std::lock_guard<std::mutex> lock(sparseMutex_);
+
+  size_t dirIx = address >> sparseDirShift;
+  uint8_t** dir = allocSparseDir(sparseDir_.at(dirIx), sparseChunksPerDir);
+  uint8_t** wdir = allocSparseDir(sparseWriteDir_.at(dirIx), sparseChunksPerDir);
+
+  size_t ix = (address >> sparseChunkShift) & (sparseChunksPerDir - 1);
+  uint8_t*& chunk = wdir[ix];
+  if (not chunk)
+    {
+      // Privatize shared chunk if any.
+      const uint8_t* shared = dir[ix];
+      if (shared)
+	chunk = static_cast<uint8_t*>(malloc(sparseChunkSize));
+      else
+	chunk = static_cast<uint8_t*>(calloc(sparseChunkSize, 1));
+      if (not chunk)
+	{
+	  std::cerr << "Out of memory\n";
+	  exit(1);
+	}
+      if (shared)
+	memcpy(chunk, shared, sparseChunkSize);
+      dir[ix] = chunk;
+    }
+  return chunk;
+}
+
+
+Memory::SharedImage::~SharedImage()
+{
+  for (auto chunk : chunks)
+    free(chunk);
+}
+
+#endif
+
+
 bool
 Memory::writeByteNoAccessCheck(size_t addr, uint8_t value)
 {
@@ -580,7 +1983,7 @@ Memory::writeByteNoAccessCheck(size_t addr, uint8_t value)
   unsigned byteIx = addr & 3;
   value = value & uint8_t((mask >> (byteIx*8)));
 
-  data_[addr] = value;
+  pokeData<uint8_t>(addr, value);
 
   return true;
 }
@@ -636,6 +2039,8 @@ bool
 Memory::checkCcmOverlap(const std::string& tag, size_t region, size_t offset,
 			size_t size, bool iccm, bool dccm, bool pic)
 {
+  attribGen_++;
+
   // If a region is ever configured, then only the configured parts
   // are available (accessible).
   if (not regionConfigured_.at(region))
@@ -740,13 +2145,20 @@ Memory::defineMemoryMappedRegisterRegion(size_t region, size_t offset,
   size_t count = size / pageSize_;  // page count
   for (size_t i = 0; i < count; ++i)
     {
-      mmrPages_.push_back(pageIx);
-
       auto& attrib = attribs_.at(pageIx++);
       attrib.setRead(true);
       attrib.setWrite(true);
       attrib.setMemMappedReg(true);
     }
+
+  size_t runSize = count * pageSize_;
+  if (runSize == 0)
+    return true;
+  if (not mmrRuns_.empty() and
+      mmrRuns_.back().first + mmrRuns_.back().second == addr)
+    mmrRuns_.back().second += runSize;
+  else
+    mmrRuns_.push_back(std::make_pair(addr, runSize));
   return true;
 }
 
@@ -754,13 +2166,20 @@ Memory::defineMemoryMappedRegisterRegion(size_t region, size_t offset,
 void
 Memory::resetMemoryMappedRegisters()
 {
-  for (auto pageIx : mmrPages_)
+  for (const auto& run : mmrRuns_)
     {
-      size_t addr0 = pageIx * pageSize_;  // page start address
-      size_t addr1 = addr0 + pageSize_ - 1; // last byte in page.
-      size_t hostAddr0 = 0, hostAddr1 = 0;
-      if (getSimMemAddr(addr0, hostAddr0) and getSimMemAddr(addr1, hostAddr1))
-	memset(reinterpret_cast<void*>(hostAddr0), 0, pageSize_);
+      size_t hostAddr = 0;
+      if (getSimMemAddr(run.first, hostAddr, run.second))
+	{
+	  memset(reinterpret_cast<void*>(hostAddr), 0, run.second);
+	  continue;
+	}
+
+      // Run not contiguous in host memory (sparse storage): Page by page.
+      for (size_t addr = run.first; addr < run.first + run.second;
+	   addr += pageSize_)
+	if (getSimMemAddr(addr, hostAddr, pageSize_))
+	  memset(reinterpret_cast<void*>(hostAddr), 0, pageSize_);
     }
 }
 
@@ -824,18 +2243,30 @@ Memory::defineMemoryMappedRegisterWriteMask(size_t region,
       return false;
     }
 
-  if (masks_.empty())
-    masks_.resize(pageCount_);
-
-  size_t pageStart = getPageStartAddr(registerAddr);
-  std::vector<uint32_t>& pageMasks = masks_.at(pageIx);
-  if (pageMasks.empty())
+  // Extend page-to-slot map to cover page.
+  if (mmrSlots_.empty())
+    mmrFirstPage_ = pageIx;
+  else if (pageIx < mmrFirstPage_)
     {
-      size_t wordCount = pageSize_ / 4;
-      pageMasks.resize(wordCount);
+      mmrSlots_.insert(mmrSlots_.begin(), mmrFirstPage_ - pageIx, noMmrSlot);
+      mmrFirstPage_ = pageIx;
     }
-  size_t maskIx = (registerAddr - pageStart) / 4;
-  pageMasks.at(maskIx) = mask;
+  size_t slotIx = pageIx - mmrFirstPage_;
+  if (slotIx >= mmrSlots_.size())
+    mmrSlots_.resize(slotIx + 1, noMmrSlot);
+
+  // First mask in page: Allocate a slot. Words of page without a
+  // defined mask are not writable.
+  size_t wordCount = pageSize_ / 4;
+  uint32_t& slot = mmrSlots_.at(slotIx);
+  if (slot == noMmrSlot)
+    {
+      slot = mmrMasks_.size() / wordCount;
+      mmrMasks_.resize(mmrMasks_.size() + wordCount, 0);
+    }
+
+  size_t wordIx = (registerAddr - getPageStartAddr(registerAddr)) / 4;
+  mmrMasks_.at(slot*wordCount + wordIx) = mask;
 
   return true;
 }
@@ -858,6 +2289,8 @@ Memory::defineMemoryMappedRegisterWriteMask(size_t region,
 void
 Memory::finishCcmConfig()
 {
+  attribGen_++;
+
   for (size_t region = 0; region < regionCount_; ++region)
     {
       if (not regionConfigured_.at(region))
@@ -23,6 +23,8 @@
 #include <vector>
 #include <unordered_map>
 #include <mutex>
+#include <memory>
+#include <atomic>
 #include <type_traits>
 #include <cassert>
 
@@ -37,7 +39,7 @@ namespace WdRiscv
   {
     PageAttribs()
       : read_(false), write_(false), exec_(false),
-	reg_(false), iccm_(false), dccm_(false)
+	reg_(false), iccm_(false), dccm_(false), code_(false), watch_(false)
     { }
 
     /// Set all attributes to given flag.
@@ -75,6 +77,15 @@ namespace WdRiscv
     void setDccm(bool flag)
     { dccm_ = flag; }
 
+    /// Mark/unmark page as holding instructions cached in decoded
+    /// form by some hart.
+    void setCode(bool flag)
+    { code_ = flag; }
+
+    /// Mark/unmark page as holding watchpoint addresses of some hart.
+    void setWatch(bool flag)
+    { watch_ = flag; }
+
     /// Return true if page can be used for instruction fetch. Fetch
     /// will still fail if page is not mapped.
     bool isExec() const
@@ -104,6 +115,14 @@ namespace WdRiscv
     bool isMemMappedReg() const
     { return reg_; }
 
+    /// True if some hart has cached decoded instructions of page.
+    bool isCode() const
+    { return code_; }
+
+    /// True if page holds watchpoint addresses.
+    bool isWatch() const
+    { return watch_; }
+
     /// Return true if page is external to the core.
     bool isExternal() const
     { return not dccm_ and not reg_; }
@@ -118,6 +137,8 @@ namespace WdRiscv
     bool reg_             : 1; // True if page has memory mapped registers.
     bool iccm_            : 1; // True if page is in an ICCM section.
     bool dccm_            : 1; // True if page is in a DCCM section.
+    bool code_            : 1; // True if page has cached decoded insts.
+    bool watch_           : 1; // True if page has watched addresses.
 
     // When page size is small (64-bytes), the number of pages becomes
     // very large. Using packed attribute helps reduce memory usage.
@@ -136,6 +157,14 @@ namespace WdRiscv
   };
 
 
+  /// Range of consecutive mapped pages (see Memory::getMappedRanges).
+  struct MappedRange
+  {
+    size_t addr = 0;
+    size_t size = 0;
+  };
+
+
   /// Model physical memory of system.
   class Memory
   {
@@ -202,7 +231,7 @@ namespace WdRiscv
       else if (attrib.isMemMappedReg())
 	return false;
 
-      value = *(reinterpret_cast<const T*>(data_ + address));
+      value = peekData<T>(address);
       return true;
     }
 
@@ -217,7 +246,7 @@ namespace WdRiscv
       if (attrib.isMemMappedReg())
 	return false; // Only word access allowed to memory mapped regs.
 
-      value = data_[address];
+      value = peekData<uint8_t>(address);
       return true;
     }
 
@@ -259,7 +288,7 @@ namespace WdRiscv
 		}
 	    }
 
-	  value = *(reinterpret_cast<const uint16_t*>(data_ + address));
+	  value = peekData<uint16_t>(address);
 	  return true;
 	}
       return false;
@@ -288,7 +317,7 @@ namespace WdRiscv
 		}
 	    }
 
-	  value = *(reinterpret_cast<const uint32_t*>(data_ + address));
+	  value = peekData<uint32_t>(address);
 	  return true;
 	}
 	return false;
@@ -325,9 +354,12 @@ namespace WdRiscv
       // Memory mapped region accessible only with word-size write.
       if constexpr (sizeof(T) == 4)
         {
-	  if (attrib1.isMemMappedReg() and (address & 3) != 0)
-	    return false;
-	  value = doRegisterMasking(address, value);
+	  if (attrib1.isMemMappedReg())
+	    {
+	      if ((address & 3) != 0)
+		return false;
+	      value = doRegisterMasking(address, value);
+	    }
 	}
       else if (attrib1.isMemMappedReg())
 	return false;
@@ -339,9 +371,12 @@ namespace WdRiscv
     /// starting at the given address. Return true on success. Return
     /// false if any of the target memory bytes are out of bounds or
     /// fall in inaccessible regions or if the write crosses memory
-    /// region of different attributes.
+    /// region of different attributes. If track is false, the write
+    /// is not recorded in the last-write information of the hart
+    /// (used by run loops that never consult it).
     template <typename T>
-    bool write(unsigned localHartId, size_t address, T value)
+    bool write(unsigned localHartId, size_t address, T value,
+	       bool track = true)
     {
       PageAttribs attrib1 = getAttrib(address);
       bool dccm1 = attrib1.isDccm();
@@ -374,16 +409,99 @@ namespace WdRiscv
       else if (attrib1.isMemMappedReg())
 	return false;
 
+      if (not track)
+	{
+	  pokeData<T>(address, value);
+	  return true;
+	}
+
       auto& lwd = lastWriteData_.at(localHartId);
 
-      lwd.prevValue_ = *(reinterpret_cast<T*>(data_ + address));
-      *(reinterpret_cast<T*>(data_ + address)) = value;
+      lwd.prevValue_ = peekData<T>(address);
+      pokeData<T>(address, value);
+      lwd.size_ = sizeof(T);
+      lwd.addr_ = address;
+      lwd.value_ = value;
+      return true;
+    }
+
+    /// Read a value of type T from the given aligned address without
+    /// any check. Caller must make sure that the address is in a
+    /// readable page of plain memory (see isPlainPage).
+    template <typename T>
+    T readUnchecked(size_t address) const
+    { return peekData<T>(address); }
+
+    /// Write a value of type T at the given aligned address without
+    /// any check (except for the last-write information). Caller must
+    /// make sure that the address is in a writable page of plain
+    /// memory (see isPlainPage). See write for track.
+    template <typename T>
+    void writeUnchecked(unsigned localHartId, size_t address, T value,
+			bool track = true)
+    {
+      if (not track)
+	{
+	  pokeData<T>(address, value);
+	  return;
+	}
+      auto& lwd = lastWriteData_[localHartId];
+      lwd.prevValue_ = peekData<T>(address);
+      pokeData<T>(address, value);
       lwd.size_ = sizeof(T);
       lwd.addr_ = address;
       lwd.value_ = value;
+    }
+
+    /// Atomically replace the value of type T at the given naturally
+    /// aligned address with desired if it is equal to expected
+    /// (host compare-and-swap). Return true on success. Otherwise set
+    /// expected to the current value and return false. Caller must
+    /// make sure that the address is in a writable page of plain
+    /// memory (see isPlainPage). See write for track.
+    template <typename T>
+    bool compareExchange(unsigned localHartId, size_t address, T& expected,
+			 T desired, bool track = true)
+    {
+      if (writeHooks_)
+	notePageWrites(address, sizeof(T));
+#ifdef MEM_SPARSE
+      T* ptr = reinterpret_cast<T*>(sparseWritePtr(address));
+#else
+      T* ptr = reinterpret_cast<T*>(data_ + address);
+#endif
+      T prev = expected;
+      if (not __atomic_compare_exchange_n(ptr, &expected, desired, false,
+					  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+	return false;
+      if (track)
+	{
+	  auto& lwd = lastWriteData_[localHartId];
+	  lwd.prevValue_ = prev;
+	  lwd.size_ = sizeof(T);
+	  lwd.addr_ = address;
+	  lwd.value_ = desired;
+	}
       return true;
     }
 
+    /// Return true if the page containing the given address is plain
+    /// memory (not memory mapped registers and not watched) that is
+    /// readable (or writable if write is true).
+    bool isPlainPage(size_t address, bool write) const
+    {
+      PageAttribs attrib = getAttrib(address);
+      if (attrib.isMemMappedReg() or attrib.isWatch())
+	return false;
+      return write ? attrib.isWrite() : attrib.isRead();
+    }
+
+    /// Return the generation of the page attributes: incremented each
+    /// time the attributes of some page change. Used to invalidate
+    /// cached page attributes (e.g. the software TLB of a hart).
+    uint32_t attribGeneration() const
+    { return attribGen_; }
+
     /// Write byte to given address. Return true on success. Return
     /// false if address is out of bounds or is not writable.
     bool writeByte(unsigned localHartId, size_t address, uint8_t value)
@@ -396,9 +514,9 @@ namespace WdRiscv
 	return false;  // Only word access allowed to memory mapped regs.
 
       auto& lwd = lastWriteData_.at(localHartId);
-      lwd.prevValue_ = *(data_ + address);
+      lwd.prevValue_ = peekData<uint8_t>(address);
 
-      data_[address] = value;
+      pokeData<uint8_t>(address, value);
 
       lwd.size_ = 1;
       lwd.addr_ = address;
@@ -430,6 +548,9 @@ namespace WdRiscv
     /// File format: A line either contains @address where address
     /// is a hexadecimal memory address or one or more space separated
     /// tokens each consisting of two hexadecimal digits.
+    /// The file is memory mapped and parsed in parallel chunks (split
+    /// at @address lines); if some line is not well formed, the file
+    /// is reloaded with loadHexFileByToken for error reporting.
     bool loadHexFile(const std::string& file);
 
     /// Load the given ELF file and set memory locations accordingly.
@@ -443,6 +564,16 @@ namespace WdRiscv
     bool loadElfFile(const std::string& file, unsigned registerWidth,
 		     size_t& entryPoint, size_t& end);
 
+    /// Return the total size in bytes of the executable segments of
+    /// the ELF files loaded so far.
+    size_t elfCodeSize() const
+    { return elfCodeSize_; }
+
+    /// Return the address and size of each of the executable segments
+    /// of the ELF files loaded so far.
+    const std::vector<std::pair<size_t, size_t>>& elfCodeSegments() const
+    { return elfCodeSegments_; }
+
     /// Locate the given ELF symbol (symbols are collected for every
     /// loaded ELF file) returning true if symbol is found and false
     /// otherwise. Set value to the corresponding value if symbol is
@@ -452,9 +583,15 @@ namespace WdRiscv
     /// Locate the ELF function cotaining the give address returning true
     /// on success and false on failure.  If successful set name to the
     /// corresponding function name and symbol to the corresponding symbol
-    /// value.
+    /// value. If several symbols contain the address, the one with the
+    /// largest start address is used. Lookup is a binary search in
+    /// an array of symbol ranges built on first use after a load.
     bool findElfFunction(size_t addr, std::string& name, ElfSymbol& value) const;
 
+    /// Set funcs to the name and address range of the ELF functions
+    /// (symbols of non-zero size) in increasing address order.
+    void getElfFunctions(std::vector<std::pair<std::string, ElfSymbol>>& funcs) const;
+
     /// Print the ELF symbols on the given stream. Output format:
     /// <name> <value>
     void printElfSymbols(std::ostream& out) const;
@@ -475,6 +612,111 @@ namespace WdRiscv
     /// zero up to n-1 where n is the minimum of the sizes.
     void copy(const Memory& other);
 
+    /// Make this memory use the contents of the given memory (e.g. a
+    /// memory holding a loaded program image) without copying them:
+    /// The data chunks of the image are shared read-only by all the
+    /// memories using it (including the image memory itself) and a
+    /// memory gets a private copy of a chunk on its first write to
+    /// the chunk (copy on write). The previous contents of this memory
+    /// are discarded. Memories sharing an image may be used by
+    /// concurrent simulations. Return false if the memories differ in
+    /// size or if storage is not sparse (see MEM_SPARSE).
+    bool shareImage(Memory& image);
+
+    /// Return true if this build supports shareImage (sparse storage).
+    static bool canShareImages();
+
+    /// Return the number of bytes of data held privately by this
+    /// memory (not shared with other memories through shareImage).
+    size_t privateDataSize() const;
+
+    /// Make the current contents of this memory the snapshot restored
+    /// by restoreSnapshot. Memory is not copied: subsequent writes
+    /// save the original contents of a page the first time the page
+    /// is written (copy on write). Taking a snapshot discards the
+    /// previous one.
+    void takeSnapshot();
+
+    /// Copy back the original contents of the pages written since the
+    /// most recent takeSnapshot (cost is proportional to the number
+    /// of such pages) keeping the snapshot for further restores. Set
+    /// pages to the start addresses of the restored pages. Return
+    /// false if no snapshot was taken.
+    bool restoreSnapshot(std::vector<size_t>& pages);
+
+    /// Return true if a snapshot is active.
+    bool hasSnapshot() const
+    { return snapshotActive_; }
+
+    /// Start recording in the write journal the previous contents of
+    /// the bytes written to this memory (by harts, system call
+    /// emulation, loaders or block copies) and return the current
+    /// journal position to be passed to rollbackWriteJournal. Cost is
+    /// proportional to the number of bytes written. Recording stops
+    /// when each beginWriteJournal is matched by an endWriteJournal.
+    size_t beginWriteJournal();
+
+    /// Restore, in reverse order, the bytes recorded in the write
+    /// journal after the given position and remove them from the
+    /// journal. Writes of all harts are restored.
+    void rollbackWriteJournal(size_t mark);
+
+    /// Match a beginWriteJournal. The journal is discarded when the
+    /// last recording stops.
+    void endWriteJournal();
+
+    /// Return the number of writes recorded in the write journal.
+    size_t writeJournalSize() const
+    { return journal_.size(); }
+
+    /// Write the non-zero pages of this memory to the given binary
+    /// stream (checkpoint). Return true on success.
+    bool saveCheckpoint(std::ostream& out) const;
+
+    /// Replace the contents of this memory with the pages written by
+    /// saveCheckpoint at the given offset of the given file. The file
+    /// is mapped and copied a page at a time. Return true on success.
+    /// Print an error message and return false, leaving the memory
+    /// unmodified, if the file is truncated or was written for a
+    /// memory of a different size.
+    bool loadCheckpoint(const std::string& path, size_t offset);
+
+    /// Enable/disable dirty page tracking. Enabling clears the dirty
+    /// pages: Subsequent writes (by harts, loaders, system call
+    /// emulation, copy or snapshot restore) mark the pages they
+    /// touch.
+    void trackDirtyPages(bool flag);
+
+    /// Return true if dirty page tracking is enabled.
+    bool isTrackingDirtyPages() const
+    { return trackDirty_; }
+
+    /// Forget the pages written so far.
+    void clearDirtyPages()
+    { std::fill(dirtyPages_.begin(), dirtyPages_.end(), 0); }
+
+    /// Set pages to the start addresses of the pages written since
+    /// dirty page tracking was enabled or last cleared.
+    void getDirtyPages(std::vector<size_t>& pages) const;
+
+    /// Copy from the given memory the pages dirty in this memory or
+    /// in other. If both memories had the same contents when they
+    /// started tracking, this makes them identical at a cost
+    /// proportional to the number of dirty pages (e.g. to reset
+    /// this memory from a pristine copy). Clear the dirty pages of
+    /// this memory. Return false without copying if either memory
+    /// is not tracking dirty pages or if the memories differ in size
+    /// or page size.
+    bool copyDirtyPages(const Memory& other);
+
+    /// Set pages to the start addresses of the pages whose contents
+    /// differ between this memory and other comparing up to the
+    /// smaller of the two sizes. If dirtyOnly is true and both
+    /// memories track dirty pages, only compare pages dirty in either
+    /// memory. Return the number of differing pages.
+    size_t diffPages(const Memory& other, std::vector<size_t>& pages,
+		     bool dirtyOnly = false) const;
+
     /// Return true if given path corresponds to an ELF file and set
     /// the given flags according to the contents of the file.  Return
     /// false leaving the flags unmodified if file does not exist,
@@ -488,6 +730,178 @@ namespace WdRiscv
 
   protected:
 
+#ifdef MEM_SPARSE
+    /// Sparse storage: memory data is kept in fixed size chunks
+    /// allocated (zero filled) on first write and reached through a
+    /// two-level table: directory entry (address >> sparseDirShift)
+    /// points to an array of chunk pointers. Reads from a chunk that
+    /// was never written return zeros.
+    static constexpr unsigned sparseChunkShift = 16;  // 64k chunks.
+    static constexpr unsigned sparseDirShift = 24;    // 256 chunks/entry.
+    static constexpr size_t sparseChunkSize = size_t(1) << sparseChunkShift;
+    static constexpr size_t sparseChunksPerDir =
+      size_t(1) << (sparseDirShift - sparseChunkShift);
+
+    /// Return host address of the byte at the given simulated
+    /// address for reading. Return an address into a zero chunk if
+    /// the chunk of the byte was never written.
+    const uint8_t* sparseReadPtr(size_t address) const
+    {
+      uint8_t** dir = sparseDir_[address >> sparseDirShift];
+      if (dir)
+	{
+	  uint8_t* chunk = dir[(address >> sparseChunkShift) & (sparseChunksPerDir - 1)];
+	  if (chunk)
+	    return chunk + (address & (sparseChunkSize - 1));
+	}
+      return sparseZero_;
+    }
+
+    /// Return host address of the byte at the given simulated
+    /// address for writing allocating its chunk (or privatizing a
+    /// shared chunk) if necessary.
+    uint8_t* sparseWritePtr(size_t address)
+    {
+      uint8_t** dir = sparseWriteDir_[address >> sparseDirShift];
+      if (dir)
+	{
+	  uint8_t* chunk = dir[(address >> sparseChunkShift) & (sparseChunksPerDir - 1)];
+	  if (chunk)
+	    return chunk + (address & (sparseChunkSize - 1));
+	}
+      return allocSparseChunk(address) + (address & (sparseChunkSize - 1));
+    }
+
+    /// Allocate the private chunk containing the given address (and
+    /// its directory entries) if not already allocated. A new chunk is
+    /// a copy of the shared chunk of the address if any and is zero
+    /// filled otherwise. Return host address of the chunk start.
+    uint8_t* allocSparseChunk(size_t address);
+
+    /// Chunks shared read-only by memories (see shareImage): Freed
+    /// with the last memory using them.
+    struct SharedImage
+    {
+      ~SharedImage();
+
+      std::vector<uint8_t*> chunks;
+      std::shared_ptr<const SharedImage> base;  // Older image still used.
+    };
+
+    /// Return true if given address range is within one chunk.
+    static bool inOneSparseChunk(size_t address, size_t size)
+    { return ((address ^ (address + size - 1)) >> sparseChunkShift) == 0; }
+#endif
+
+    /// Return the value of type T stored at the given address. No
+    /// check is done: caller must make sure address is in bounds.
+    template <typename T>
+    T peekData(size_t address) const
+    {
+#ifdef MEM_SPARSE
+      if (inOneSparseChunk(address, sizeof(T)))
+	return *(reinterpret_cast<const T*>(sparseReadPtr(address)));
+      T value = 0;
+      for (unsigned i = 0; i < sizeof(T); ++i)
+	value |= T(*sparseReadPtr(address + i)) << (8*i);
+      return value;
+#else
+      return *(reinterpret_cast<const T*>(data_ + address));
+#endif
+    }
+
+    /// Save the contents of the page(s) of the given address range
+    /// if not already saved since the most recent snapshot.
+    void saveSnapshotPages(size_t address, size_t size);
+
+    /// Mark the page(s) of the given address range as dirty.
+    void markDirtyPages(size_t address, size_t size)
+    {
+      if (size == 0)
+	return;
+      size_t lastIx = getPageIx(address + size - 1);
+      for (size_t ix = getPageIx(address); ix <= lastIx; ++ix)
+	if (ix < dirtyPages_.size())
+	  dirtyPages_[ix] = 1;
+    }
+
+    /// Append the current contents of the given address range to the
+    /// write journal.
+    void journalWrite(size_t address, size_t size);
+
+    /// Called before writing the given address range when writeHooks_
+    /// is set: Record previous bytes in the write journal, save
+    /// snapshot pages and mark dirty pages.
+    void notePageWrites(size_t address, size_t size)
+    {
+      if (journalUsers_)
+	journalWrite(address, size);
+      if (snapshotActive_)
+	saveSnapshotPages(address, size);
+      if (trackDirty_)
+	markDirtyPages(address, size);
+    }
+
+    /// Copy n bytes of simulated memory at addr to buf and vice versa.
+    void copyOut(size_t addr, uint8_t* buf, size_t n) const;
+    void copyIn(size_t addr, const uint8_t* buf, size_t n);
+
+    /// Reference hex file loader (see loadHexFile): Parse the file a
+    /// token at a time writing bytes as they are parsed and reporting
+    /// malformed lines.
+    bool loadHexFileByToken(const std::string& file);
+
+    /// Return true if the n bytes of simulated memory at addr are in
+    /// chunks of an image shared by this memory (see shareImage) and
+    /// are equal to the n bytes of data.
+    bool isSharedBlock(size_t addr, const uint8_t* data, size_t n) const;
+
+    /// Return true if the n bytes of simulated memory at addr are
+    /// all zero.
+    bool isZeroBlock(size_t addr, size_t n) const;
+
+    /// Set all the bytes of this memory to zero.
+    void clearData();
+
+    /// Return the number of non-zero bytes among the n bytes of
+    /// simulated memory at addr.
+    size_t countNonZero(size_t addr, size_t n) const;
+
+    /// Return true if the n bytes at addr are in bounds and in mapped
+    /// pages none of which holds memory-mapped registers.
+    bool isPlainBlock(size_t addr, size_t n) const;
+
+    /// Block version of peek: Copy n bytes of simulated memory at
+    /// addr to buf. Return false, leaving buf unmodified, if the
+    /// bytes are not in a plain block (see isPlainBlock).
+    bool peekBlock(size_t addr, uint8_t* buf, size_t n) const;
+
+    /// Block version of poke: Copy n bytes from buf to simulated
+    /// memory at addr. Return false, leaving memory unmodified, if
+    /// the bytes are not in a plain block (see isPlainBlock). Effects
+    /// are not recorded in last-write info.
+    bool pokeBlock(size_t addr, const uint8_t* buf, size_t n);
+
+    /// Store given value at the given address. No check is done:
+    /// caller must make sure address is in bounds.
+    template <typename T>
+    void pokeData(size_t address, T value)
+    {
+      if (writeHooks_)
+	notePageWrites(address, sizeof(T));
+#ifdef MEM_SPARSE
+      if (inOneSparseChunk(address, sizeof(T)))
+	{
+	  *(reinterpret_cast<T*>(sparseWritePtr(address))) = value;
+	  return;
+	}
+      for (unsigned i = 0; i < sizeof(T); ++i)
+	*sparseWritePtr(address + i) = uint8_t(uint64_t(value) >> (8*i));
+#else
+      *(reinterpret_cast<T*>(data_ + address)) = value;
+#endif
+    }
+
     /// Same as write but effects not recorded in last-write info.
     template <typename T>
     bool poke(size_t address, T value)
@@ -517,7 +931,7 @@ namespace WdRiscv
       else if (attrib.isMemMappedReg())
 	return false;
 
-      *(reinterpret_cast<T*>(data_ + address)) = value;
+      pokeData<T>(address, value);
       return true;
     }
 
@@ -531,7 +945,7 @@ namespace WdRiscv
       if (attrib.isMemMappedReg())
 	return false;  // Only word access allowed to memory mapped regs.
 
-      data_[address] = value;
+      pokeData<uint8_t>(address, value);
       return true;
     }
 
@@ -593,6 +1007,11 @@ namespace WdRiscv
     size_t pageSize() const
     { return pageSize_; }
 
+    /// Fill the given vector with the maximal ranges of consecutive
+    /// mapped pages in increasing address order. The vector is
+    /// cleared first.
+    void getMappedRanges(std::vector<MappedRange>& ranges) const;
+
     /// Return the number of the page containing the given address.
     size_t getPageIx(size_t addr) const
     { return addr >> pageShift_; }
@@ -658,7 +1077,7 @@ namespace WdRiscv
     {
       if ((addr & 3) != 0)
 	return false;  // Address must be workd-aligned.
-      value = *(reinterpret_cast<const uint32_t*>(data_ + addr));
+      value = peekData<uint32_t>(addr);
       return true;
     }
 
@@ -667,18 +1086,17 @@ namespace WdRiscv
     /// memory mapped register.
     uint32_t getMemoryMappedMask(size_t addr) const
     {
-      uint32_t mask = ~ uint32_t(0);
-      if (masks_.empty())
-	return mask;
+      // Index of page in mmrSlots_: Wraps if below first page.
+      size_t slotIx = getPageIx(addr) - mmrFirstPage_;
+      if (slotIx >= mmrSlots_.size())
+	return ~ uint32_t(0);
 
-      size_t pageIx = getPageIx(addr);
-      auto& pageMasks = masks_.at(pageIx);
-      if (pageMasks.empty())
-	return mask;
+      uint32_t slot = mmrSlots_[slotIx];
+      if (slot == noMmrSlot)
+	return ~ uint32_t(0);
 
-      size_t wordIx = (addr - getPageStartAddr(addr)) / 4;
-      mask = pageMasks.at(wordIx);
-      return mask;
+      size_t wordIx = (addr & (pageSize_ - 1)) >> 2;
+      return mmrMasks_[(size_t(slot) << (pageShift_ - 2)) + wordIx];
     }
 
     /// Perform masking for a write to a memory mapped register.
@@ -699,9 +1117,9 @@ namespace WdRiscv
       value = doRegisterMasking(addr, value);
 
       auto& lwd = lastWriteData_.at(localHartId);
-      lwd.prevValue_ = *(reinterpret_cast<uint32_t*>(data_ + addr));
+      lwd.prevValue_ = peekData<uint32_t>(addr);
 
-      *(reinterpret_cast<uint32_t*>(data_ + addr)) = value;
+      pokeData<uint32_t>(addr, value);
 
       lwd.size_ = 4;
       lwd.addr_ = addr;
@@ -744,12 +1162,24 @@ namespace WdRiscv
 
     /// Return the simulator memory address corresponding to the
     /// simulated RISCV memory address. This is useful for Linux
-    /// emulation.
-    bool getSimMemAddr(size_t addr, size_t& simAddr)
+    /// emulation. The size is that of the memory range accessed by
+    /// the host starting at addr: with sparse storage the range must
+    /// not cross a chunk boundary.
+    bool getSimMemAddr(size_t addr, size_t& simAddr, size_t size = 1)
     {
       if (addr >= size_)
 	return false;
+      if (size == 0)
+	size = 1;
+      if (writeHooks_)
+	notePageWrites(addr, size < size_ - addr ? size : size_ - addr);
+#ifdef MEM_SPARSE
+      if (not inOneSparseChunk(addr, size))
+	return false;
+      simAddr = reinterpret_cast<size_t>(sparseWritePtr(addr));
+#else
       simAddr = reinterpret_cast<size_t>(data_ + addr);
+#endif
       return true;
     }
 
@@ -757,6 +1187,7 @@ namespace WdRiscv
     /// to the given flag. No-op if address is out of bounds.
     void setWriteAccess(size_t addr, bool value)
     {
+      attribGen_++;
       size_t ix = getPageIx(addr);
       if (ix >= attribs_.size())
 	return;
@@ -767,6 +1198,7 @@ namespace WdRiscv
     /// to the given flag. No-op if address is out of bounds.
     void setReadAccess(size_t addr, bool value)
     {
+      attribGen_++;
       size_t ix = getPageIx(addr);
       if (ix >= attribs_.size())
 	return;
@@ -777,20 +1209,126 @@ namespace WdRiscv
     /// to the given flag. No-op if address is out of bounds.
     void setExecAccess(size_t addr, bool value)
     {
+      attribGen_++;
       size_t ix = getPageIx(addr);
       if (ix >= attribs_.size())
 	return;
       attribs_[ix].setExec(value);
     }
 
-    /// Track LR instructin resrvations.
+    /// Add a watch (remove one if flag is false) to the pages covering
+    /// the address range [addr, endAddr]. A page is watched while it
+    /// has one or more watches. Loads/stores to a watched page are not
+    /// plain (see isPlainPage) and take the checked path of the harts.
+    void watchPages(size_t addr, size_t endAddr, bool flag);
+
+    /// Return true if the page containing the given address is
+    /// watched (see watchPages).
+    bool isWatchedPage(size_t addr) const
+    { return getAttrib(addr).isWatch(); }
+
+    /// Record that the instructions in the address range [addr,
+    /// endAddr] are held in decoded form by a hart. Stores into
+    /// such a range are reported by isCodeWrite. Each page is
+    /// divided into 64 lines for the purpose of code tracking so that
+    /// data sharing a page with code does not cause spurious
+    /// invalidations.
+    void markCode(size_t addr, size_t endAddr)
+    {
+      for (size_t line = addr >> codeLineShift_;
+	   line <= endAddr >> codeLineShift_; ++line)
+	{
+	  size_t ix = getPageIx(line << codeLineShift_);
+	  if (ix >= attribs_.size())
+	    break;
+	  attribs_[ix].setCode(true);
+	  uint64_t bit = uint64_t(1) << (line & 63);
+	  if (not (codeLines_[ix] & bit))
+	    __atomic_fetch_or(&codeLines_[ix], bit, __ATOMIC_RELAXED);
+	}
+    }
+
+    /// Return true if a write to the address range [addr, endAddr]
+    /// touches instructions held in decoded form by some hart.
+    bool isCodeWrite(size_t addr, size_t endAddr) const
+    {
+      size_t ix = getPageIx(addr), endIx = getPageIx(endAddr);
+      if ((ix >= attribs_.size() or not attribs_[ix].isCode()) and
+	  (endIx >= attribs_.size() or not attribs_[endIx].isCode()))
+	return false;
+      for (size_t line = addr >> codeLineShift_;
+	   line <= endAddr >> codeLineShift_; ++line)
+	{
+	  ix = getPageIx(line << codeLineShift_);
+	  if (ix < codeLines_.size() and
+	      (codeLines_[ix] & (uint64_t(1) << (line & 63))))
+	    return true;
+	}
+      return false;
+    }
+
+    /// Return the code generation of the page containing the given
+    /// address. The generation of a page is incremented each time
+    /// code in the page is written (see bumpCodeGeneration). Decoded
+    /// instructions cached by a hart are valid as long as the
+    /// generation of their page is unchanged. Return 0 if address is
+    /// out of bounds.
+    uint32_t codeGeneration(size_t addr) const
+    {
+      size_t ix = getPageIx(addr);
+      if (ix >= codeGen_.size())
+	return 0;
+      return __atomic_load_n(&codeGen_[ix], __ATOMIC_ACQUIRE);
+    }
+
+    /// Increment the code generation of the page(s) covering the
+    /// address range [addr, endAddr] invalidating the decoded
+    /// instructions of those pages cached by all harts. Each increment
+    /// advances the code epoch and is logged (see codeWritesSince).
+    /// If seen is non-null and equal to the code epoch before the
+    /// increments then it is advanced past them: the caller (a hart
+    /// that has already dropped its own stale decoded instructions)
+    /// need not synchronize for its own write.
+    void bumpCodeGeneration(size_t addr, size_t endAddr,
+			    uint64_t* seen = nullptr);
+
+    /// Return the code epoch: the number of page code generation
+    /// increments so far over all pages.
+    uint64_t codeEpoch() const
+    { return codeEpoch_.load(std::memory_order_acquire); }
+
+    /// Collect in pages the indices of the pages whose code
+    /// generation was incremented since the given epoch and set
+    /// epoch to the current code epoch. Return false if the log no
+    /// longer covers the given epoch in which case the caller must
+    /// assume that all the pages were written.
+    bool codeWritesSince(uint64_t& epoch, std::vector<size_t>& pages);
+
+    /// Address of an invalid LR reservation.
+    static constexpr size_t noLrAddr = ~size_t(0);
+
+    /// Track LR instruction reservations. There is one slot per hart.
+    /// The address and size of a slot are atomic so that a hart can
+    /// invalidate the reservations of the other harts without a lock.
+    /// A slot is invalid if its address is noLrAddr.
     struct Reservation
     {
-      size_t addr_ = 0;
-      unsigned size_ = 0;
-      bool valid_ = false;
+      Reservation() = default;
+
+      Reservation(const Reservation& other)
+	: addr_(other.addr_.load()), size_(other.size_.load()),
+	  value_(other.value_)
+      { }
+
+      std::atomic<size_t> addr_{noLrAddr};
+      std::atomic<unsigned> size_{0};
+      uint64_t value_ = 0;   // Value loaded by the LR (owner only).
     };
-      
+
+    /// Return the number of harts sharing this memory.
+    unsigned hartCount() const
+    { return reservations_.size(); }
+
     /// Invalidate LR reservations matching address of poked/written
     /// bytes and belonging to harts other than the given hart-id. The
     /// memory tracks one reservation per hart indexed by local hart
@@ -798,28 +1336,36 @@ namespace WdRiscv
     void invalidateOtherHartLr(unsigned localHartId, size_t addr,
                                unsigned storeSize)
     {
+      if (reservations_.size() == 1)
+	return;
+
       for (size_t i = 0; i < reservations_.size(); ++i)
         {
           if (i == localHartId) continue;
           auto& res = reservations_[i];
-          if (addr >= res.addr_ and (addr - res.addr_) < res.size_)
-            res.valid_ = false;
-          else if (addr < res.addr_ and (res.addr_ - addr) < storeSize)
-            res.valid_ = false;
+	  size_t resAddr = res.addr_.load(std::memory_order_acquire);
+	  if (resAddr == noLrAddr)
+	    continue;
+	  unsigned resSize = res.size_.load(std::memory_order_relaxed);
+          if ((addr >= resAddr and (addr - resAddr) < resSize) or
+	      (addr < resAddr and (resAddr - addr) < storeSize))
+	    res.addr_.compare_exchange_strong(resAddr, noLrAddr);
         }
     }
 
     /// Invalidate LR reservation corresponding to the given hart.
     void invalidateLr(unsigned localHartId)
-    { reservations_.at(localHartId).valid_ = false; }
+    { reservations_.at(localHartId).addr_.store(noLrAddr, std::memory_order_release); }
 
-    /// Make a LR reservation for the given hart.
-    void makeLr(unsigned localHartId, size_t addr, unsigned size)
+    /// Make a LR reservation for the given hart. Value is the value
+    /// loaded by the LR.
+    void makeLr(unsigned localHartId, size_t addr, unsigned size,
+		uint64_t value = 0)
     {
       auto& res = reservations_.at(localHartId);
-      res.addr_ = addr;
-      res.size_ = size;
-      res.valid_ = true;
+      res.size_.store(size, std::memory_order_relaxed);
+      res.value_ = value;
+      res.addr_.store(addr, std::memory_order_release);
     }
 
     /// Return true if given hart has a valid LR reservation for the
@@ -827,9 +1373,19 @@ namespace WdRiscv
     bool hasLr(unsigned localHartId, size_t addr) const
     {
       auto& res = reservations_.at(localHartId);
-      return res.valid_ and res.addr_ == addr;
+      return res.addr_.load(std::memory_order_acquire) == addr;
     }
 
+    /// Atomically invalidate the LR reservation of the given hart if
+    /// it is valid for the given address. Return true on success and
+    /// false if the reservation was lost.
+    bool consumeLr(unsigned localHartId, size_t addr)
+    { return reservations_.at(localHartId).addr_.compare_exchange_strong(addr, noLrAddr); }
+
+    /// Return the value loaded by the most recent LR of the given hart.
+    uint64_t lrValue(unsigned localHartId) const
+    { return reservations_.at(localHartId).value_; }
+
   private:
 
     /// Information about last write operation by a hart.
@@ -844,6 +1400,16 @@ namespace WdRiscv
     size_t size_;        // Size of memory in bytes.
     uint8_t* data_;      // Pointer to memory data.
 
+#ifdef MEM_SPARSE
+    // Sparse storage directories: The read directory holds the
+    // private and shared chunks, the write directory the private ones.
+    std::vector<uint8_t**> sparseDir_;
+    std::vector<uint8_t**> sparseWriteDir_;
+    std::shared_ptr<const SharedImage> sharedImage_;
+    std::mutex sparseMutex_;            // Serialize chunk allocation.
+    static const uint8_t sparseZero_[sparseChunkSize];
+#endif
+
     // Memory is organized in regions (e.g. 256 Mb). Each region is
     // organized in pages (e.g 4kb). Each page is associated with
     // access attributes. Memory mapped register pages are also
@@ -859,17 +1425,110 @@ namespace WdRiscv
     unsigned regionMask_  = 0xf;       // This should depend on mem size.
 
     std::mutex amoMutex_;
-    std::mutex lrMutex_;
 
     // Attributes are assigned to pages.
     std::vector<PageAttribs> attribs_;      // One entry per page.
-    std::vector<std::vector<uint32_t> > masks_;  // One vector per page.
+    uint32_t attribGen_ = 0;  // Incremented on attribute change.
+    std::unordered_map<size_t, unsigned> watchCounts_;  // Page ix to count.
+
+    // Code tracking (one entry per page): bit i of a code-lines
+    // entry is set if line i of the page holds cached decoded
+    // instructions of some hart.
+    std::vector<uint64_t> codeLines_;
+    std::vector<uint32_t> codeGen_;
+
+    // Recent code generation increments: entry e % codeLogSize holds
+    // the page index of the increment of code epoch e. Harts use it
+    // to drop the decoded instructions of pages written by other
+    // harts without flushing their whole cache.
+    static constexpr unsigned codeLogSize = 64;
+    std::atomic<uint64_t> codeEpoch_{0};
+    size_t codeLog_[codeLogSize] = {};
+    std::mutex codeLogMutex_;        // Protect codeLog_.
+    unsigned codeLineShift_ = 6;  // Log2 of line size (page-size/64).
+
+    // Memory mapped register write masks: One entry per word of each
+    // register page with masks, the page of slot s starting at entry
+    // s*pageSize_/4 (the compact register number is the entry
+    // index). Entry i of mmrSlots_ is the slot of page mmrFirstPage_+i
+    // (noMmrSlot if page has no masks).
+    static constexpr uint32_t noMmrSlot = ~uint32_t(0);
+    std::vector<uint32_t> mmrMasks_;
+    std::vector<uint32_t> mmrSlots_;
+    size_t mmrFirstPage_ = 0;
+
+    // Memory mapped register pages: Runs of consecutive pages (start
+    // address and size).
+    std::vector<std::pair<size_t, size_t>> mmrRuns_;
+
+    // Snapshot (copy on write): original contents of the pages
+    // written since the snapshot was taken. A page is saved at most
+    // once (see snapshotSaved_, one bit per page).
+    bool snapshotActive_ = false;
+    std::vector<bool> snapshotSaved_;
+    std::vector<std::pair<size_t, std::vector<uint8_t>>> snapshotPages_;
+
+    // Dirty page tracking: one entry per page, set when the page is
+    // written while tracking is enabled.
+    bool trackDirty_ = false;
+    std::vector<uint8_t> dirtyPages_;
+
+    // Write journal (see beginWriteJournal): Address and size of each
+    // recorded write with the offset in journalBytes_ of its previous
+    // contents.
+    struct JournalEntry
+    {
+      size_t addr = 0;
+      size_t size = 0;
+      size_t offset = 0;
+    };
+    unsigned journalUsers_ = 0;
+    std::vector<JournalEntry> journal_;
+    std::vector<uint8_t> journalBytes_;
 
-    std::vector<size_t> mmrPages_;  // Memory mapped register pages.
+    // True if writes must be reported to notePageWrites (write
+    // journal, snapshot or dirty tracking active): One test on the
+    // write paths.
+    bool writeHooks_ = false;
 
     bool checkUnmappedElf_ = true;
+    size_t elfCodeSize_ = 0;   // Size of executable ELF segments.
+    std::vector<std::pair<size_t, size_t>> elfCodeSegments_;
+
+    /// Symbol table of a loaded ELF file: raw Elf32_Sym/Elf64_Sym
+    /// entries and associated string table.
+    struct ElfSymbolTable
+    {
+      bool is64 = false;
+      std::vector<uint8_t> syms;
+      std::vector<char> names;
+    };
+
+    /// Address range of a sized ELF symbol.
+    struct ElfFunction
+    {
+      size_t start = 0;
+      size_t end = 0;
+      size_t maxEnd = 0;   // Largest end of this and preceding ranges.
+      const std::string* name = nullptr;  // Key in symbols_.
+    };
 
-    std::unordered_map<std::string, ElfSymbol> symbols_;
+    /// Add the symbols of the pending tables to symbols_. Caller must
+    /// hold symbolMutex_.
+    void indexElfSymbols() const;
+
+    /// Rebuild functions_ (sorted by start address) from the symbols
+    /// if not valid.
+    void indexElfFunctions() const;
+
+    // Symbols are indexed lazily: Tables of loaded files are kept in
+    // pendingSymbols_ until a lookup needs the map. The sorted
+    // ranges back findElfFunction and are rebuilt after a load.
+    mutable std::vector<ElfSymbolTable> pendingSymbols_;
+    mutable std::unordered_map<std::string, ElfSymbol> symbols_;
+    mutable std::vector<ElfFunction> functions_;
+    mutable std::atomic<bool> functionsValid_{false};
+    mutable std::mutex symbolMutex_;
 
     std::vector<Reservation> reservations_;
     std::vector<LastWriteData> lastWriteData_;
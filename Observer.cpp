@@ -0,0 +1,67 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <iostream>
+
+#if not defined(__MINGW64__) and not defined(__EMSCRIPTEN__)
+#include <dlfcn.h>
+#endif
+
+#include "Observer.hpp"
+
+
+using namespace WdRiscv;
+
+
+Observer*
+WdRiscv::loadObserverPlugin(const std::string& path, const std::string& args)
+{
+#if defined(__MINGW64__) or defined(__EMSCRIPTEN__)
+  (void) args;
+  std::cerr << "Failed to load observer plugin " << path << ": Shared "
+	    << "objects are not supported on this host\n";
+  return nullptr;
+#else
+  // The library is never unloaded: the observer code lives in it.
+  void* lib = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (not lib)
+    {
+      std::cerr << "Failed to load observer plugin: " << dlerror() << '\n';
+      return nullptr;
+    }
+
+  auto create = reinterpret_cast<WhisperCreateObserver>(dlsym(lib, "whisperCreateObserver"));
+  if (not create)
+    {
+      std::cerr << "Observer plugin " << path << " does not define "
+		<< "whisperCreateObserver\n";
+      dlclose(lib);
+      return nullptr;
+    }
+
+  Observer* observer = create(WHISPER_OBSERVER_ABI, args.c_str());
+  if (not observer)
+    {
+      std::cerr << "Observer plugin " << path << " failed to initialize "
+		<< "(interface version " << WHISPER_OBSERVER_ABI << ")\n";
+      dlclose(lib);
+      return nullptr;
+    }
+  return observer;
+#endif
+}
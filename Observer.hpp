@@ -0,0 +1,104 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+namespace WdRiscv
+{
+
+  /// Event reported to the instruction observers. Fields not listed
+  /// for a kind are zero.
+  struct ObserverEvent
+  {
+    enum class Kind : uint8_t
+      {
+	Retire,    // Instruction at pc (opcode inst) retired.
+	Load,      // Instruction at pc loaded value (size bytes) from address.
+	Store,     // Instruction at pc stored value (size bytes) at address.
+	Trap,      // Trap taken at pc: address is the cause (most significant
+		   // bit set for interrupts) and value the trap value.
+	CsrWrite   // Instruction at pc wrote value into CSR number address.
+      };
+
+    Kind kind = Kind::Retire;
+    uint8_t size = 0;
+    uint32_t inst = 0;
+    uint64_t tag = 0;       // Instruction count (rank) of the instruction.
+    uint64_t pc = 0;
+    uint64_t address = 0;
+    uint64_t value = 0;
+  };
+
+
+  /// Observer of the instructions executed by the harts (coverage,
+  /// profilers, checkers). Observers are attached to the harts with
+  /// Hart::addObserver. A hart with observers runs with the run loop
+  /// used for tracing (the run loops without tracing are unchanged)
+  /// and hands its events to the observers in batches: at the end of
+  /// each basic block (taken branch, jump or trap), when the batch is
+  /// full and at the end of each run.
+  class Observer
+  {
+  public:
+
+    virtual ~Observer() = default;
+
+    /// Receive the given events of the hart with the given index, in
+    /// execution order. The harts of a multi-threaded run deliver
+    /// their events from their own threads.
+    virtual void events(unsigned hartIx, const ObserverEvent* events,
+			size_t count) = 0;
+
+    /// Called once at the end of the simulation after the last
+    /// events.
+    virtual void finish()
+    { }
+  };
+
+
+  /// Load the observer plugin of the given shared object passing it
+  /// the given argument string. The shared object defines the C
+  /// function whisperCreateObserver (see WhisperCreateObserver)
+  /// returning a new observer. Return null after printing an error
+  /// message on failure (or if the host does not support shared
+  /// objects).
+  Observer* loadObserverPlugin(const std::string& path,
+			       const std::string& args);
+}
+
+
+/// Version of the plugin interface passed to whisperCreateObserver.
+/// Incremented with each incompatible change of ObserverEvent or
+/// Observer.
+#define WHISPER_OBSERVER_ABI 1
+
+/// Entry point of an observer plugin:
+///   extern "C" WdRiscv::Observer*
+///   whisperCreateObserver(unsigned abi, const char* args);
+/// Return null to refuse to load (e.g. if abi differs from the
+/// version the plugin was compiled with).
+extern "C"
+{
+  typedef WdRiscv::Observer* (*WhisperCreateObserver)(unsigned abi,
+						       const char* args);
+}
@@ -27,6 +27,7 @@ PerfRegs::PerfRegs(unsigned numCounters)
 {
   // 29 counters: MHPMCOUNTER3 to MHPMCOUNTER31
   counters_.resize(29);
+  pending_.resize(size_t(EventNumber::_End));
 
   config(numCounters);
 }
@@ -37,6 +38,8 @@ PerfRegs::config(unsigned numCounters)
 {
   assert(numCounters < counters_.size());
 
+  flush();
+
   eventOfCounter_.resize(numCounters);
 
   unsigned numEvents = unsigned(EventNumber::_End);
@@ -54,6 +57,9 @@ PerfRegs::assignEventToCounter(EventNumber event, unsigned counter)
   if (size_t(event) >= countersOfEvent_.size())
     return false;
 
+  // Pending counts of the previous event belong to the counter.
+  flush();
+
   // Disassociate counter from its previous event.
   EventNumber prevEvent = eventOfCounter_.at(counter);
   if (prevEvent != EventNumber::None)
@@ -69,3 +75,27 @@ PerfRegs::assignEventToCounter(EventNumber event, unsigned counter)
   return true;
 }
 
+
+void
+PerfRegs::flushPending() const
+{
+  for (size_t event = 0; event < pending_.size(); ++event)
+    {
+      uint64_t count = pending_[event];
+      if (not count)
+	continue;
+      pending_[event] = 0;
+      if (event < countersOfEvent_.size())
+	for (auto counterIx : countersOfEvent_[event])
+	  counters_.at(counterIx) += count;
+    }
+  hasPending_ = false;
+}
+
+
+void
+PerfRegs::discardPending()
+{
+  pending_.assign(pending_.size(), 0);
+  hasPending_ = false;
+}
@@ -100,7 +100,10 @@ namespace WdRiscv
       BusLoad,           // 55: Bus load instructions committed
       BusStore,          // 56: Bus store instructions committed
 
-      _End               // 57: Non-event serving as count of events
+      DCacheHits,        // 57: Data cache hits (timing model)
+      DCacheMisses,      // 58: Data cache misses (timing model)
+
+      _End               // 59: Non-event serving as count of events
     };
 
 
@@ -146,6 +149,28 @@ namespace WdRiscv
       return true;
     }
 
+    /// Count an occurrence of the given event without updating the
+    /// counters: Pending counts are added to the counters associated
+    /// with their events by flush. This is much cheaper than
+    /// updateCounters in the run loop.
+    void countEvent(EventNumber event)
+    {
+      pending_[size_t(event)]++;
+      hasPending_ = true;
+    }
+
+    /// Add the pending event counts (see countEvent) to the counters
+    /// currently associated with the events. This must be done before
+    /// a counter is observed (read/peek) or changed.
+    void flush() const
+    {
+      if (hasPending_)
+	flushPending();
+    }
+
+    /// Drop the pending event counts.
+    void discardPending();
+
     /// Associate given event number with given counter.
     /// Subsequent calls to updatePerofrmanceCounters(en) will cause
     /// given counter to count up by 1. Return true on success. Return
@@ -173,6 +198,9 @@ namespace WdRiscv
 
   private:
 
+    /// Helper to flush.
+    void flushPending() const;
+
     // Map counter index to event currently associated with counter.
     std::vector<EventNumber> eventOfCounter_;
 
@@ -180,7 +208,13 @@ namespace WdRiscv
     // counters currently associated with that event.
     std::vector< std::vector<unsigned> > countersOfEvent_;
 
-    std::vector<uint64_t> counters_;
+    // Counters are mutable: Adding the pending counts does not change
+    // the observable counter values.
+    mutable std::vector<uint64_t> counters_;
     std::vector<unsigned> modified_;
+
+    // Event counts not yet added to the counters (indexed by event).
+    mutable std::vector<uint64_t> pending_;
+    mutable bool hasPending_ = false;
   };
 }
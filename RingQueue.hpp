@@ -0,0 +1,159 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace WdRiscv
+{
+
+  /// Queue of at most a given number of items kept in insertion order
+  /// in a circular buffer allocated by setCapacity. Items are
+  /// addressed by position: Positions increase with insertion order
+  /// and the positions of the queue are those from begin() to end()
+  /// (exclusive) for which isLive is true. Removing an item from the
+  /// middle leaves a hole reclaimed once it reaches the front: No item
+  /// is moved and nothing is allocated by push_back, pop_front or
+  /// remove. Used for the load queue of imprecise load exceptions.
+  template <typename T>
+  class RingQueue
+  {
+  public:
+
+    /// Set the maximum number of items to the given count (at least
+    /// 1) and empty the queue.
+    void setCapacity(size_t count)
+    {
+      maxSize_ = count ? count : 1;
+
+      // Twice the item count so that compacting holes in a full ring
+      // frees at least maxSize_ slots.
+      size_t ringSize = 1;
+      while (ringSize < 2*maxSize_)
+	ringSize <<= 1;
+      items_.assign(ringSize, T());
+      live_.assign(ringSize, false);
+      mask_ = ringSize - 1;
+      clear();
+    }
+
+    /// Remove all items.
+    void clear()
+    {
+      for (uint64_t pos = head_; pos != tail_; ++pos)
+	live_[pos & mask_] = false;
+      head_ = tail_ = 0;
+      size_ = 0;
+    }
+
+    /// Return the number of items in the queue.
+    size_t size() const
+    { return size_; }
+
+    bool empty() const
+    { return size_ == 0; }
+
+    /// Return true if the queue holds the maximum number of items.
+    bool full() const
+    { return size_ >= maxSize_; }
+
+    /// Append given item. Queue must not be full.
+    void push_back(const T& item)
+    {
+      assert(not full());
+      if (tail_ - head_ > mask_)
+	compact();
+      items_[tail_ & mask_] = item;
+      live_[tail_ & mask_] = true;
+      ++tail_;
+      ++size_;
+    }
+
+    /// Remove the oldest item. Queue must not be empty.
+    void pop_front()
+    {
+      assert(not empty());
+      remove(head_);
+    }
+
+    /// Remove the item at the given live position.
+    void remove(uint64_t pos)
+    {
+      assert(isLive(pos));
+      live_[pos & mask_] = false;
+      --size_;
+      while (head_ != tail_ and not live_[head_ & mask_])
+	++head_;
+    }
+
+    /// Return the position of the oldest item.
+    uint64_t begin() const
+    { return head_; }
+
+    /// Return the position following that of the youngest item.
+    uint64_t end() const
+    { return tail_; }
+
+    /// Return true if there is an item at the given position (which
+    /// must be between begin() and end()).
+    bool isLive(uint64_t pos) const
+    { return live_[pos & mask_]; }
+
+    /// Return the item at the given live position.
+    T& at(uint64_t pos)
+    { return items_[pos & mask_]; }
+
+    const T& at(uint64_t pos) const
+    { return items_[pos & mask_]; }
+
+  private:
+
+    /// Move the live items to the front of the ring closing the holes
+    /// left by remove. Positions of the items change.
+    void compact()
+    {
+      uint64_t dest = head_;
+      for (uint64_t pos = head_; pos != tail_; ++pos)
+	{
+	  if (not live_[pos & mask_])
+	    continue;
+	  if (dest != pos)
+	    {
+	      items_[dest & mask_] = items_[pos & mask_];
+	      live_[dest & mask_] = true;
+	      live_[pos & mask_] = false;
+	    }
+	  ++dest;
+	}
+      tail_ = dest;
+    }
+
+    std::vector<T> items_;
+    std::vector<bool> live_;
+    uint64_t mask_ = 0;
+    uint64_t head_ = 0;     // Position of oldest item.
+    uint64_t tail_ = 0;     // Position of next item.
+    size_t size_ = 0;       // Count of live items.
+    size_t maxSize_ = 0;
+  };
+}
@@ -0,0 +1,83 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <iostream>
+#include <boost/format.hpp>
+#include "SelfProfile.hpp"
+
+
+using namespace WdRiscv;
+
+
+void
+SelfProfile::reset()
+{
+  ticks_.fill(0);
+  decodeHits = decodeMisses = 0;
+  blockHits = blockMisses = 0;
+  codeWrites = invalidations = cacheSyncs = 0;
+  startTicks_ = stamp_ = now();
+  startTime_ = std::chrono::steady_clock::now();
+}
+
+
+/// Print the hit rate of the given hit/miss counts.
+static void
+printCounts(std::ostream& out, const char* tag, uint64_t hits, uint64_t misses)
+{
+  uint64_t total = hits + misses;
+  out << (boost::format("  %-14s %12d hits %12d misses") % tag % hits % misses);
+  if (total)
+    out << (boost::format("  %5.1f%% hit rate") % (100.0 * double(hits) / double(total)));
+  out << '\n';
+}
+
+
+void
+SelfProfile::print(std::ostream& out, unsigned hartIx) const
+{
+  static const char* names[] = { "idle", "execute", "fetch", "decode",
+				 "memcheck", "triggers", "trace", "syscall" };
+  static_assert(sizeof(names)/sizeof(names[0]) == unsigned(Phase::Count));
+
+  // Include the time of the current phase up to now.
+  auto ticks = ticks_;
+  uint64_t t = now();
+  ticks.at(unsigned(current_)) += t - stamp_;
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+						 startTime_).count();
+  double secPerTick = t > startTicks_ ? seconds / double(t - startTicks_) : 0;
+
+  uint64_t runTicks = 0;
+  for (unsigned i = unsigned(Phase::Execute); i < unsigned(Phase::Count); ++i)
+    runTicks += ticks.at(i);
+
+  out << "Self profile of hart " << hartIx << ":\n";
+  for (unsigned i = unsigned(Phase::Execute); i < unsigned(Phase::Count); ++i)
+    {
+      double pct = runTicks ? 100.0 * double(ticks.at(i)) / double(runTicks) : 0;
+      out << (boost::format("  %-14s %12.6fs %6.1f%%\n") % names[i] %
+	      (double(ticks.at(i)) * secPerTick) % pct);
+    }
+
+  printCounts(out, "decode cache", decodeHits, decodeMisses);
+  printCounts(out, "block cache", blockHits, blockMisses);
+  out << (boost::format("  %-14s %12d code writes %12d invalidated %12d syncs\n") %
+	  "invalidation" % codeWrites % invalidations % cacheSyncs);
+}
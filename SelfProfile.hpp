@@ -0,0 +1,150 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+
+#if defined(__x86_64__) and not defined(__EMSCRIPTEN__)
+#include <x86intrin.h>
+#endif
+
+
+namespace WdRiscv
+{
+
+  /// Self profile of the simulator: Time spent by a hart in each
+  /// phase of the run loops and decode/block cache statistics. The
+  /// profile is collected only in builds with SELF_PROFILE defined
+  /// (make SELF_PROFILE=1): Otherwise the SELF_PROFILE_* macros
+  /// below expand to nothing.
+  ///
+  /// Time is measured with the cycle counter of the host (x86) or
+  /// the steady clock. Phases are exclusive: Entering a phase pauses
+  /// the enclosing one, so that, for instance, the time of the memory
+  /// attribute checks of a load is not counted as execute time.
+  class SelfProfile
+  {
+  public:
+
+    enum class Phase : unsigned
+      {
+	Idle,      // Outside the run loops.
+	Execute,   // Run loop and instruction execution.
+	Fetch,     // Instruction fetch.
+	Decode,    // Instruction decode and basic block construction.
+	MemCheck,  // Memory attribute and exception checks of loads/stores.
+	Triggers,  // Trigger evaluation and actions.
+	Trace,     // Trace formatting and flight recorder.
+	Syscall,   // Emulated system calls.
+	Count
+      };
+
+    SelfProfile()
+    { reset(); }
+
+    /// Return the current time stamp in ticks.
+    static uint64_t now()
+    {
+#if defined(__x86_64__) and not defined(__EMSCRIPTEN__)
+      return __rdtsc();
+#else
+      auto t = std::chrono::steady_clock::now().time_since_epoch();
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+#endif
+    }
+
+    /// Charge the time elapsed since the last transition to the
+    /// current phase and make the given phase current. Return the
+    /// previous phase.
+    Phase enter(Phase phase)
+    {
+      uint64_t t = now();
+      ticks_.at(unsigned(current_)) += t - stamp_;
+      stamp_ = t;
+      Phase prev = current_;
+      current_ = phase;
+      return prev;
+    }
+
+    /// Scope in a phase: Enter the phase on construction and return
+    /// to the enclosing one on destruction.
+    class Scope
+    {
+    public:
+      Scope(SelfProfile& profile, Phase phase)
+	: profile_(profile), prev_(profile.enter(phase))
+      { }
+
+      ~Scope()
+      { profile_.enter(prev_); }
+
+    private:
+      SelfProfile& profile_;
+      Phase prev_;
+    };
+
+    /// Clear the times and counts.
+    void reset();
+
+    /// Print the profile to the given stream: Time per phase (in
+    /// seconds and percent of the run loop time) and the counts.
+    void print(std::ostream& out, unsigned hartIx) const;
+
+    // Counts.
+    uint64_t decodeHits = 0;       // Decoded instruction cache hits.
+    uint64_t decodeMisses = 0;     // Decodes of instructions.
+    uint64_t blockHits = 0;        // Basic block cache hits.
+    uint64_t blockMisses = 0;      // Basic blocks (re)built.
+    uint64_t codeWrites = 0;       // Stores into cached code.
+    uint64_t invalidations = 0;    // Invalidated decoded instructions.
+    uint64_t cacheSyncs = 0;       // Decode cache syncs (code written by others).
+
+  private:
+
+    std::array<uint64_t, unsigned(Phase::Count)> ticks_;
+    Phase current_ = Phase::Idle;
+    uint64_t stamp_ = 0;           // Time of last transition.
+
+    // For converting ticks to seconds.
+    uint64_t startTicks_ = 0;
+    std::chrono::steady_clock::time_point startTime_;
+  };
+}
+
+
+#ifdef SELF_PROFILE
+
+/// Time the rest of the enclosing scope as the given phase of the
+/// self profile of the hart.
+#define SELF_PROFILE_PHASE(phase) \
+  WdRiscv::SelfProfile::Scope selfProfileScope_(selfProfile_, \
+						WdRiscv::SelfProfile::Phase::phase)
+
+/// Add the given amount to the given count of the self profile.
+#define SELF_PROFILE_COUNT(counter, amount) (selfProfile_.counter += (amount))
+
+#else
+
+#define SELF_PROFILE_PHASE(phase)
+#define SELF_PROFILE_COUNT(counter, amount)
+
+#endif
@@ -18,7 +18,6 @@
 
 #include <iostream>
 #include <sstream>
-#include <map>
 #include <algorithm>
 #include <boost/format.hpp>
 #include <cstring>
@@ -217,16 +216,11 @@ receiveMessage(int soc, WhisperMessage& msg)
 }
 
 
+/// Send the given bytes on the given socket. Return true on success.
 static bool
-sendMessage(int soc, WhisperMessage& msg)
+sendBytes(int soc, const char* p, size_t size)
 {
-  char buffer[sizeof(msg)];
-
-  serializeMessage(msg, buffer, sizeof(buffer));
-
-  // Send command.
-  ssize_t remain = sizeof(msg);
-  char* p = buffer;
+  ssize_t remain = size;
   while (remain > 0)
     {
       ssize_t l = send(soc, p, remain , 0);
@@ -245,9 +239,75 @@ sendMessage(int soc, WhisperMessage& msg)
 }
 
 
+/// Socket channel: Messages are serialized in network byte order.
+class SocketChannel : public ServerChannel
+{
+public:
+
+  SocketChannel(int soc)
+    : soc_(soc)
+  { }
+
+  bool receiveMessage(WhisperMessage& msg) override
+  { return ::receiveMessage(soc_, msg); }
+
+  bool sendMessage(const WhisperMessage& msg, const uint8_t* payload,
+		   size_t payloadSize) override
+  {
+    // Send message and payload at once to avoid a delayed second
+    // segment.
+    buffer_.resize(sizeof(msg) + payloadSize);
+    serializeMessage(msg, buffer_.data(), sizeof(msg));
+    if (payloadSize)
+      memcpy(buffer_.data() + sizeof(msg), payload, payloadSize);
+    return sendBytes(soc_, buffer_.data(), buffer_.size());
+  }
+
+private:
+
+  int soc_;
+  std::vector<char> buffer_;
+};
+
+
+/// Append the least significant given number of bytes of value to the
+/// given buffer in network byte order (most significant first).
+static
+void
+appendBytes(std::vector<uint8_t>& buffer, uint64_t value, unsigned count)
+{
+  for (unsigned i = count; i > 0; --i)
+    buffer.push_back(uint8_t(value >> (8*(i-1))));
+}
+
+
+/// Append given value to given buffer in unsigned LEB128 form.
+static
+void
+appendUleb(std::vector<uint8_t>& buffer, uint64_t value)
+{
+  while (value >= 0x80)
+    {
+      buffer.push_back(uint8_t(value) | 0x80);
+      value >>= 7;
+    }
+  buffer.push_back(uint8_t(value));
+}
+
+
+/// Append given value to given buffer in zig-zag LEB128 form: Small
+/// magnitudes give short encodings.
+static
+void
+appendSleb(std::vector<uint8_t>& buffer, int64_t value)
+{
+  appendUleb(buffer, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
+
 template <typename URV>
 Server<URV>::Server(std::vector< Hart<URV>* >& harts)
-  : harts_(harts)
+  : harts_(harts), compactPc_(harts.size()), compactMemAddr_(harts.size())
 {
 }
   
@@ -426,6 +486,23 @@ Server<URV>::processStepCahnges(Hart<URV>& hart,
   strncpy(reply.buffer, text.c_str(), sizeof(reply.buffer) - 1);
   reply.buffer[sizeof(reply.buffer) -1] = 0;
 
+  collectStepChanges(hart, pendingChanges);
+
+  // Add count of changes to reply.
+  reply.value = pendingChanges.size();
+
+  // The changes will be retrieved one at a time from the back of the
+  // pendigChanges vector: Put the vector in reverse order. Changes
+  // are retrieved using a Change request (see interactUsingSocket).
+  std::reverse(pendingChanges.begin(), pendingChanges.end());
+}
+
+
+template <typename URV>
+void
+Server<URV>::collectStepChanges(Hart<URV>& hart,
+				std::vector<WhisperMessage>& pendingChanges)
+{
   // Collect integer register change caused by execution of instruction.
   pendingChanges.clear();
   int regIx = hart.lastIntReg();
@@ -459,82 +536,25 @@ Server<URV>::processStepCahnges(Hart<URV>& hart,
 	}
     }
 
-  // Collect CSR and trigger changes.
-  std::vector<CsrNumber> csrs;
-  std::vector<unsigned> triggers;
-  hart.lastCsr(csrs, triggers);
-
-  // Map to keep CSRs in order and to drop duplicate entries.
-  std::map<URV,URV> csrMap;
-
-  // Components of the triggers that changed (if any).
-  std::vector<bool> tdataChanged(3);
-
-  // Collect changed CSRs and their values. Collect components of
-  // changed trigger.
-  for (CsrNumber csr : csrs)
-    {
-      URV value;
-      if (hart.peekCsr(csr, value))
-	{
-	  if (csr >= CsrNumber::TDATA1 and csr <= CsrNumber::TDATA3)
-	    {
-	      size_t ix = size_t(csr) - size_t(CsrNumber::TDATA1);
-	      tdataChanged.at(ix) = true;
-	    }
-	  else
-	    csrMap[URV(csr)] = value;
-	}
-    }
-
-  // Collect changes associated with trigger register.
-  for (unsigned trigger : triggers)
-    {
-      URV data1(0), data2(0), data3(0);
-      if (not hart.peekTrigger(trigger, data1, data2, data3))
-	continue;
-      if (tdataChanged.at(0))
-	{
-	  URV addr = (trigger << 16) | unsigned(CsrNumber::TDATA1);
-	  csrMap[addr] = data1;
-	}
-      if (tdataChanged.at(1))
-	{
-	  URV addr = (trigger << 16) | unsigned(CsrNumber::TDATA2);
-	  csrMap[addr] = data2;
-	}
-      if (tdataChanged.at(2))
-	{
-	  URV addr = (trigger << 16) | unsigned(CsrNumber::TDATA3);
-	  csrMap[addr] = data3;
-	}
-    }
-
-  for (const auto& [key, val] : csrMap)
+  // Collect CSR and trigger changes in ascending key order.
+  hart.lastCsrValues(csrChanges_, true);
+  for (const auto& [key, val] : csrChanges_)
     {
       WhisperMessage msg(0, Change, 'c', key, val);
       pendingChanges.push_back(msg);
     }
 
-  std::vector<size_t> addresses;
-  std::vector<uint32_t> words;
+  InlineVector<size_t, 2> addresses;
+  InlineVector<uint32_t, 2> words;
 
   hart.lastMemory(addresses, words);
   assert(addresses.size() == words.size());
 
   for (size_t i = 0; i < addresses.size(); ++i)
     {
-      WhisperMessage msg(0, Change, 'm', addresses.at(i), words.at(i));
+      WhisperMessage msg(0, Change, 'm', addresses[i], words[i]);
       pendingChanges.push_back(msg);
     }
-
-  // Add count of changes to reply.
-  reply.value = pendingChanges.size();
-
-  // The changes will be retrieved one at a time from the back of the
-  // pendigChanges vector: Put the vector in reverse order. Changes
-  // are retrieved using a Change request (see interactUsingSocket).
-  std::reverse(pendingChanges.begin(), pendingChanges.end());
 }
 
 
@@ -601,6 +621,154 @@ Server<URV>::stepCommand(const WhisperMessage& req,
 }
 
 
+template <typename URV>
+void
+Server<URV>::appendCompactRecord(unsigned hartId, uint64_t pc, uint32_t inst,
+				 uint8_t flags,
+				 const std::vector<WhisperMessage>& changes,
+				 std::vector<uint8_t>& payload)
+{
+  uint64_t& expectedPc = compactPc_.at(hartId);
+  uint64_t& memAddr = compactMemAddr_.at(hartId);
+
+  if (pc != expectedPc)
+    flags |= BatchPcJump;
+  payload.push_back(flags);
+  if (pc != expectedPc)
+    appendSleb(payload, int64_t(pc - expectedPc));
+
+  // Opcode in memory (little-endian) order: First byte gives size.
+  unsigned instSize = instructionSize(inst);
+  for (unsigned i = 0; i < instSize; ++i)
+    payload.push_back(uint8_t(inst >> (8*i)));
+  expectedPc = pc + instSize;
+
+  appendUleb(payload, changes.size());
+  for (const auto& change : changes)
+    {
+      unsigned kind = 0;
+      switch (change.resource)
+	{
+	case 'r': kind = 0; break;
+	case 'f': kind = 1; break;
+	case 'c': kind = 2; break;
+	default:  kind = 3; break;
+	}
+
+      unsigned width = 0;  // Value byte count without leading zeros.
+      for (uint64_t v = change.value; v; v >>= 8)
+	width++;
+
+      payload.push_back(uint8_t(kind | (width << 4)));
+      if (kind <= 1)
+	payload.push_back(uint8_t(change.address));
+      else if (kind == 2)
+	appendUleb(payload, change.address);
+      else
+	{
+	  appendSleb(payload, int64_t(change.address - memAddr));
+	  memAddr = change.address;
+	}
+      appendBytes(payload, change.value, width);
+    }
+}
+
+
+// Server mode step-batch command.
+template <typename URV>
+bool
+Server<URV>::stepBatchCommand(const WhisperMessage& req,
+			      std::vector<uint8_t>& payload,
+			      WhisperMessage& reply,
+			      FILE* traceFile, FILE* commandLog)
+{
+  reply = req;
+  payload.clear();
+
+  uint32_t hartId = req.hart;
+  if (hartId >= harts_.size())
+    {
+      assert(0);
+      reply.type = Invalid;
+      return false;
+    }
+  auto& hart = *(harts_.at(hartId));
+
+  bool stopAtPc = req.flags & BatchStopAtPc;
+  uint64_t count = 0;
+  uint32_t stop = BatchCountReached;
+
+  for ( ; count < req.value; ++count)
+    {
+      // Same conditions as those rejecting a step command.
+      if (not hart.isStarted() or
+	  (hart.inDebugMode() and not hart.inDebugStepMode()))
+	{
+	  stop = BatchHartStopped;
+	  break;
+	}
+
+      if (stopAtPc and count > 0 and hart.peekPc() == req.address)
+	{
+	  stop = BatchPcReached;
+	  break;
+	}
+
+      uint32_t inst = 0;
+      hart.readInst(hart.peekPc(), inst);
+
+      uint64_t interruptCount = hart.getInterruptCount();
+      hart.singleStep(traceFile);
+
+      unsigned preCount = 0, postCount = 0;
+      hart.countTrippedTriggers(preCount, postCount);
+
+      uint8_t flags = 0;
+      if (hart.getInterruptCount() != interruptCount)
+	flags |= BatchInterrupted;
+      if (preCount)
+	flags |= BatchPreTrigger;
+      if (postCount)
+	flags |= BatchPostTrigger;
+
+      collectStepChanges(hart, batchChanges_);
+
+      if (changeFormat_ == ChangeFormatCompact)
+	appendCompactRecord(hartId, hart.lastPc(), inst, flags,
+			    batchChanges_, payload);
+      else
+	{
+	  appendBytes(payload, hart.lastPc(), 8);
+	  appendBytes(payload, inst, 4);
+	  appendBytes(payload, flags, 1);
+	  appendBytes(payload, batchChanges_.size(), 2);
+	  for (const auto& change : batchChanges_)
+	    {
+	      appendBytes(payload, change.resource, 1);
+	      appendBytes(payload, change.address, 8);
+	      appendBytes(payload, change.value, 8);
+	    }
+	}
+
+      hart.clearTraceData();
+
+      if (commandLog)
+	fprintf(commandLog, "hart=%d step #%" PRId64 " # ts=%s\n", hartId,
+		hart.getInstructionCount(), std::to_string(req.rank).c_str());
+    }
+
+  if (stopAtPc and count == req.value and count > 0 and
+      hart.peekPc() == req.address)
+    stop = BatchPcReached;
+
+  reply.type = StepBatch;
+  reply.value = count;
+  reply.flags = stop;
+  reply.address = payload.size();
+  return true;
+}
+
+
 // Server mode exception command.
 template <typename URV>
 bool
@@ -712,8 +880,19 @@ Server<URV>::exceptionCommand(const WhisperMessage& req,
 template <typename URV>
 bool
 Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
+{
+  SocketChannel channel(soc);
+  return interact(channel, traceFile, commandLog);
+}
+
+
+template <typename URV>
+bool
+Server<URV>::interact(ServerChannel& channel, FILE* traceFile,
+		      FILE* commandLog)
 {
   std::vector<WhisperMessage> pendingChanges;
+  std::vector<uint8_t> batchPayload;
 
   auto hexForm = getHexForm<URV>(); // Format string for printing a hex val
 
@@ -724,7 +903,7 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
     {
       WhisperMessage msg;
       WhisperMessage reply;
-      if (not receiveMessage(soc, msg))
+      if (not channel.receiveMessage(msg))
 	return false;
 
       uint32_t hartId = msg.hart;
@@ -739,7 +918,7 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
 	{
 	  auto& hart = *(harts_.at(hartId));
 
-	  if (msg.type == Step or msg.type == Until)
+	  if (msg.type == Step or msg.type == Until or msg.type == StepBatch)
 	    resetMemoryMappedReg = true;
 
 	  switch (msg.type)
@@ -775,6 +954,46 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
                         hartId, hart.getInstructionCount(), timeStamp.c_str());
 	      break;
 
+	    case Until:
+	      {
+		// Steps and runs are not mixed in an undo log.
+		reply = msg;
+		if (hart.hasUndoLog())
+		  {
+		    reply.type = Invalid;
+		    break;
+		  }
+		URV addr = static_cast<URV>(msg.address);
+		uint64_t count = hart.getInstructionCount();
+		pendingChanges.clear();
+		hart.untilAddress(addr, traceFile);
+		reply.value = hart.getInstructionCount() - count;
+		reply.address = hart.peekPc();
+		if (commandLog)
+		  fprintf(commandLog, "hart=%d until 0x%0*" PRIx64 " # ts=%s\n",
+			  hartId, ( (sizeof(URV) == 4) ? 8 : 16 ), uint64_t(addr),
+			  timeStamp.c_str());
+	      }
+	      break;
+
+	    case StepBatch:
+	      pendingChanges.clear();
+	      stepBatchCommand(msg, batchPayload, reply, traceFile,
+			       commandLog);
+	      break;
+
+	    case Format:
+	      reply = msg;
+	      if (msg.value == ChangeFormatFull or msg.value == ChangeFormatCompact)
+		{
+		  changeFormat_ = WhisperChangeFormat(msg.value);
+		  for (unsigned i = 0; i < harts_.size(); ++i)
+		    resetCompactState(i);
+		}
+	      else
+		reply.type = Invalid;
+	      break;
+
 	    case ChangeCount:
 	      reply.type = ChangeCount;
 	      reply.value = pendingChanges.size();
@@ -816,6 +1035,7 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
 		  std::cerr << "Error: Address too large (" << std::hex
 			    << msg.address << ") in reset command.\n" << std::dec;
 		pendingChanges.clear();
+		resetCompactState(hartId);
 		if (msg.value != 0)
 		  hart.defineResetPc(addr);
 		hart.reset(resetMemoryMappedReg);
@@ -859,6 +1079,32 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
 			timeStamp.c_str());
 	      break;
 
+	    case Undo:
+	      {
+		static const char* names[] = { "begin", "rollback", "end" };
+		reply = msg;
+		reply.value = hart.undoLogSize();
+		bool ok = true;
+		if (msg.value == UndoBegin)
+		  hart.beginUndoLog();
+		else if (msg.value == UndoRollback)
+		  ok = hart.rollbackUndoLog();
+		else if (msg.value == UndoEnd and hart.hasUndoLog())
+		  hart.endUndoLog();
+		else
+		  ok = false;
+		if (not ok)
+		  {
+		    reply.type = Invalid;
+		    break;
+		  }
+		pendingChanges.clear();
+		if (commandLog)
+		  fprintf(commandLog, "hart=%d undo %s # ts=%s\n", hartId,
+			  names[msg.value], timeStamp.c_str());
+	      }
+	      break;
+
 	    case LoadFinished:
 	      {
 		URV addr = static_cast<URV>(msg.address);
@@ -886,7 +1132,10 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
 	    }
 	}
 
-      if (not sendMessage(soc, reply))
+      // Packed records of a step-batch follow the reply.
+      bool hasPayload = reply.type == StepBatch;
+      if (not channel.sendMessage(reply, batchPayload.data(),
+				  hasPayload ? batchPayload.size() : 0))
 	return false;
     }
 
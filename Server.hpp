@@ -24,6 +24,26 @@
 namespace WdRiscv
 {
 
+  /// Transport of the messages between the server and its client.
+  class ServerChannel
+  {
+  public:
+
+    virtual ~ServerChannel()
+    { }
+
+    /// Receive a message. Return true on success. A closed connection
+    /// is reported as a Quit message.
+    virtual bool receiveMessage(WhisperMessage& msg) = 0;
+
+    /// Send the given message followed by the given number of payload
+    /// bytes (see StepBatch). Return true on success.
+    virtual bool sendMessage(const WhisperMessage& msg,
+			     const uint8_t* payload = nullptr,
+			     size_t payloadSize = 0) = 0;
+  };
+
+
   /// Manage server mode.
   template <typename URV>
   class Server
@@ -50,6 +70,16 @@ namespace WdRiscv
 		     WhisperMessage& reply,
 		     FILE* traceFile);
 
+    /// Server mode step-batch command: Execute up to req.value
+    /// instructions (see StepBatch in WhisperMessage.h) putting the
+    /// packed change records of the executed instructions in payload.
+    /// Log one step command per executed instruction to commandLog if
+    /// it is not null.
+    bool stepBatchCommand(const WhisperMessage& req,
+			  std::vector<uint8_t>& payload,
+			  WhisperMessage& reply,
+			  FILE* traceFile, FILE* commandLog);
+
     /// Server mode exception command.
     bool exceptionCommand(const WhisperMessage& req, WhisperMessage& reply,
 			  std::string& text);
@@ -59,6 +89,9 @@ namespace WdRiscv
     /// received). Return false otherwise.
     bool interact(int soc, FILE* traceFile, FILE* commandLog);
 
+    /// Same as above but communicate using the given channel.
+    bool interact(ServerChannel& channel, FILE* traceFile, FILE* commandLog);
+
   protected:
 
     /// Process changes of a single-step command. Put the changes in the
@@ -73,9 +106,39 @@ namespace WdRiscv
 			    bool interrupted, bool hasPre, bool hasPost,
 			    WhisperMessage& reply);
 
+    /// Put in changes the change records (in the order of the Change
+    /// replies) of the last instruction executed by the given hart.
+    void collectStepChanges(Hart<URV>&, std::vector<WhisperMessage>& changes);
+
+    /// Append to payload the compact form (see Format in
+    /// WhisperMessage.h) of the record of an instruction with the
+    /// given pc, opcode, flags and changes executed by the given hart.
+    void appendCompactRecord(unsigned hartId, uint64_t pc, uint32_t inst,
+			     uint8_t flags,
+			     const std::vector<WhisperMessage>& changes,
+			     std::vector<uint8_t>& payload);
+
+    /// Reset the state of the compact encoding of the given hart.
+    void resetCompactState(unsigned hartId)
+    {
+      compactPc_.at(hartId) = 0;
+      compactMemAddr_.at(hartId) = 0;
+    }
+
   private:
 
     std::vector< Hart<URV>* >& harts_;
+
+    // Scratch for processStepCahnges/stepBatchCommand: Reused to avoid
+    // allocating on every step.
+    std::vector<std::pair<uint64_t, uint64_t>> csrChanges_;
+    std::vector<WhisperMessage> batchChanges_;
+
+    // Payload encoding of StepBatch replies and per-hart state of the
+    // compact encoding: Expected pc and address of last memory change.
+    WhisperChangeFormat changeFormat_ = ChangeFormatFull;
+    std::vector<uint64_t> compactPc_;
+    std::vector<uint64_t> compactMemAddr_;
   };
 
 }
@@ -0,0 +1,217 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <new>
+#ifndef __MINGW64__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "ShmChannel.hpp"
+
+
+using namespace WdRiscv;
+
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+	      "Shared memory transport requires lock-free 64-bit atomics");
+
+
+/// Number of polls of an empty/full ring before blocking/yielding. No
+/// spinning on a single core host where it would delay the peer.
+static const unsigned spinCount =
+  std::thread::hardware_concurrency() > 1 ? 4096 : 0;
+
+
+/// Block while the given futex word has the given value.
+static void
+waitOn(std::atomic<uint32_t>& word, uint32_t value)
+{
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, value,
+	  nullptr, nullptr, 0);
+#else
+  while (word.load() == value)
+    std::this_thread::yield();
+#endif
+}
+
+
+/// Wake the waiters of the given futex word.
+static void
+wake(std::atomic<uint32_t>& word)
+{
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, 1,
+	  nullptr, nullptr, 0);
+#else
+  (void) word;
+#endif
+}
+
+
+ShmChannel::~ShmChannel()
+{
+#ifndef __MINGW64__
+  if (layout_)
+    munmap(layout_, sizeof(ShmLayout));
+#endif
+}
+
+
+bool
+ShmChannel::create(const std::string& path)
+{
+#ifdef __MINGW64__
+  std::cerr << "Shared memory server transport not supported on this "
+	    << "platform\n";
+  return false;
+#else
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    {
+      std::cerr << "Failed to open file '" << path << "' for output\n";
+      return false;
+    }
+
+  if (ftruncate(fd, sizeof(ShmLayout)) != 0)
+    {
+      std::cerr << "Failed to size shared memory file '" << path << "'\n";
+      close(fd);
+      return false;
+    }
+
+  void* addr = mmap(nullptr, sizeof(ShmLayout), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    {
+      std::cerr << "Failed to map shared memory file '" << path << "'\n";
+      return false;
+    }
+
+  // File is zero-filled: Rings are empty. Publish the header last.
+  layout_ = new (addr) ShmLayout;
+  layout_->version = ShmLayout::versionValue;
+  layout_->ringSize = ShmRing::dataSize;
+  layout_->messageSize = sizeof(WhisperMessage);
+  layout_->magic.store(ShmLayout::magicValue);
+  return true;
+#endif
+}
+
+
+void
+ShmChannel::read(ShmRing& ring, uint8_t* data, size_t size)
+{
+  uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+  while (size)
+    {
+      uint64_t tail = ring.tail.load(std::memory_order_acquire);
+      for (unsigned i = 0; tail == head and i < spinCount; ++i)
+	tail = ring.tail.load(std::memory_order_acquire);
+
+      if (tail == head)
+	{
+	  // Block till producer publishes. Sleeping is set before seq
+	  // is sampled so that the producer cannot miss us.
+	  ring.sleeping.store(1);
+	  uint32_t seq = ring.seq.load();
+	  if (ring.tail.load() == head)
+	    waitOn(ring.seq, seq);
+	  ring.sleeping.store(0);
+	  continue;
+	}
+
+      size_t count = std::min(size_t(tail - head), size);
+      for (size_t i = 0; i < count; ++i)
+	data[i] = ring.data[(head + i) & (ShmRing::dataSize - 1)];
+
+      data += count;
+      size -= count;
+      head += count;
+      ring.head.store(head, std::memory_order_release);
+    }
+}
+
+
+void
+ShmChannel::write(ShmRing& ring, const uint8_t* data, size_t size)
+{
+  uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+
+  while (size)
+    {
+      uint64_t head = ring.head.load(std::memory_order_acquire);
+      for (unsigned i = 0; tail - head == ShmRing::dataSize; ++i)
+	{
+	  // Ring full: Wait for consumer (rare: only for large batches).
+	  if (i >= spinCount)
+	    std::this_thread::yield();
+	  head = ring.head.load(std::memory_order_acquire);
+	}
+
+      size_t room = ShmRing::dataSize - (tail - head);
+      size_t count = std::min(room, size);
+      for (size_t i = 0; i < count; ++i)
+	ring.data[(tail + i) & (ShmRing::dataSize - 1)] = data[i];
+
+      data += count;
+      size -= count;
+      tail += count;
+
+      ring.tail.store(tail);
+      ring.seq.fetch_add(1);
+      if (ring.sleeping.load())
+	wake(ring.seq);
+    }
+}
+
+
+bool
+ShmChannel::receiveMessage(WhisperMessage& msg)
+{
+  if (not layout_)
+    return false;
+  read(layout_->toServer, reinterpret_cast<uint8_t*>(&msg), sizeof(msg));
+  return true;
+}
+
+
+bool
+ShmChannel::sendMessage(const WhisperMessage& msg, const uint8_t* payload,
+			size_t payloadSize)
+{
+  if (not layout_)
+    return false;
+  write(layout_->toClient, reinterpret_cast<const uint8_t*>(&msg),
+	sizeof(msg));
+  if (payloadSize)
+    write(layout_->toClient, payload, payloadSize);
+  return true;
+}
@@ -0,0 +1,104 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "WhisperMessage.h"
+#include "Server.hpp"
+
+
+namespace WdRiscv
+{
+
+  /// Single-producer single-consumer byte ring in shared memory. The
+  /// producer copies bytes at tail and advances it. The consumer
+  /// copies bytes at head and advances it. A consumer finding the
+  /// ring empty spins for a while then blocks (futex on Linux) on
+  /// seq, which the producer bumps on every publish.
+  struct ShmRing
+  {
+    static constexpr uint32_t dataSize = 1024*1024;  // Power of 2.
+
+    alignas(64) std::atomic<uint64_t> head;   // Count of consumed bytes.
+    alignas(64) std::atomic<uint64_t> tail;   // Count of produced bytes.
+    alignas(64) std::atomic<uint32_t> seq;    // Bumped on publish.
+    std::atomic<uint32_t> sleeping;           // Non-zero if consumer blocked.
+    alignas(64) uint8_t data[dataSize];
+  };
+
+
+  /// Layout of the shared memory file of the shared memory server
+  /// transport. The server creates the file, initializes it and sets
+  /// the magic last. A client maps the file, waits for the magic,
+  /// and checks version, ringSize and messageSize. Messages are
+  /// WhisperMessage structures in native byte order. The client sends
+  /// on toServer and receives on toClient, and the server does the
+  /// opposite. Message semantics, including the StepBatch payload,
+  /// are the same as for the socket transport.
+  struct ShmLayout
+  {
+    static constexpr uint32_t magicValue = 0x57485350;  // "WHSP"
+    static constexpr uint32_t versionValue = 1;
+
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t ringSize;      // ShmRing::dataSize
+    uint32_t messageSize;   // sizeof(WhisperMessage)
+    ShmRing toServer;
+    ShmRing toClient;
+  };
+
+
+  /// Server channel using shared memory (see ShmLayout) instead of a
+  /// socket. Used when whisper and its client run on the same host.
+  class ShmChannel : public ServerChannel
+  {
+  public:
+
+    ShmChannel() = default;
+
+    /// Unmap the shared memory.
+    ~ShmChannel();
+
+    /// Create and initialize the shared memory file at the given
+    /// path. Return true on success. Print an error message and
+    /// return false on failure.
+    bool create(const std::string& path);
+
+    bool receiveMessage(WhisperMessage& msg) override;
+
+    bool sendMessage(const WhisperMessage& msg, const uint8_t* payload,
+		     size_t payloadSize) override;
+
+  private:
+
+    /// Copy size bytes from the ring to data waiting as needed.
+    static void read(ShmRing& ring, uint8_t* data, size_t size);
+
+    /// Copy size bytes from data to the ring waiting for room as needed.
+    static void write(ShmRing& ring, const uint8_t* data, size_t size);
+
+    ShmChannel(const ShmChannel&) = delete;
+    void operator=(const ShmChannel&) = delete;
+
+    ShmLayout* layout_ = nullptr;
+  };
+}
@@ -0,0 +1,841 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cstring>
+#include <algorithm>
+#include "SoftFloat.hpp"
+
+// Use the compiler 128-bit integer type if available (including
+// WebAssembly), otherwise boost.
+#ifdef __SIZEOF_INT128__
+  typedef __uint128_t Uint128;
+#else
+  #include <boost/multiprecision/cpp_int.hpp>
+  typedef boost::multiprecision::uint128_t Uint128;
+#endif
+
+
+using namespace WdRiscv;
+
+
+namespace
+{
+  constexpr unsigned inexactFlag = unsigned(FpFlags::Inexact);
+  constexpr unsigned underflowFlag = unsigned(FpFlags::Underflow);
+  constexpr unsigned overflowFlag = unsigned(FpFlags::Overflow);
+  constexpr unsigned divByZeroFlag = unsigned(FpFlags::DivByZero);
+  constexpr unsigned invalidFlag = unsigned(FpFlags::Invalid);
+
+
+  /// Return the index of the most significant set bit of x (x must be
+  /// non-zero).
+  int
+  msb(Uint128 x)
+  {
+    uint64_t hi = static_cast<uint64_t>(x >> 64);
+    if (hi)
+      return 127 - __builtin_clzll(hi);
+    return 63 - __builtin_clzll(static_cast<uint64_t>(x));
+  }
+
+
+  /// Shift x right by n bits oring the shifted out bits into the
+  /// least significant bit of the result (sticky bit).
+  Uint128
+  shiftRightJam(Uint128 x, int n)
+  {
+    if (n <= 0)
+      return x;
+    if (n >= 128)
+      return x != 0 ? 1 : 0;
+    Uint128 lost = x & ((Uint128(1) << n) - 1);
+    return (x >> n) | Uint128(lost != 0 ? 1 : 0);
+  }
+
+
+  /// Return x shifted right by n bits and rounded to an integer using
+  /// the given mode and sign of the number. Set inexact if bits are
+  /// lost. Shift left if n is negative (caller ensures there is
+  /// room).
+  Uint128
+  roundShift(Uint128 x, int n, bool sign, RoundingMode mode, bool& inexact)
+  {
+    if (n <= 0)
+      return x << -n;
+
+    Uint128 quot = 0, rem = x;
+    bool aboveHalf = false, atHalf = false;
+    if (n < 128)
+      {
+	quot = x >> n;
+	rem = x & ((Uint128(1) << n) - 1);
+	Uint128 half = Uint128(1) << (n - 1);
+	aboveHalf = rem > half;
+	atHalf = rem == half;
+      }
+    // For n >= 128, x is less than half of the rounding unit.
+
+    if (rem == 0)
+      return quot;
+    inexact = true;
+
+    bool up = false;
+    switch (mode)
+      {
+      case RoundingMode::NearestEven:
+	up = aboveHalf or (atHalf and (quot & 1) != 0);
+	break;
+      case RoundingMode::NearestMax:
+	up = aboveHalf or atHalf;
+	break;
+      case RoundingMode::Down:
+	up = sign;
+	break;
+      case RoundingMode::Up:
+	up = not sign;
+	break;
+      default:
+	break;
+      }
+    return up ? quot + 1 : quot;
+  }
+
+
+  /// Operations on the bits of an IEEE number of type T (uint32_t for
+  /// single precision and uint64_t for double).
+  template <typename T>
+  struct Fp
+  {
+    static constexpr unsigned width = 8*sizeof(T);
+    static constexpr int fracBits = width == 32 ? 23 : 52;
+    static constexpr int maxExp = (1 << (width - 1 - fracBits)) - 1;
+    static constexpr int bias = maxExp >> 1;
+    static constexpr T fracMask = (T(1) << fracBits) - 1;
+    static constexpr T signMask = T(1) << (width - 1);
+    static constexpr T quietBit = T(1) << (fracBits - 1);
+    static constexpr T infBits = T(maxExp) << fracBits;
+    static constexpr T defaultNan = infBits | quietBit;  // RISCV canonical NaN.
+
+    static bool sign(T x)
+    { return x >> (width - 1); }
+
+    static int exponent(T x)
+    { return int((x >> fracBits) & T(maxExp)); }
+
+    static bool isNan(T x)
+    { return (x & ~signMask) > infBits; }
+
+    static bool isSnan(T x)
+    { return isNan(x) and (x & quietBit) == 0; }
+
+    static bool isInf(T x)
+    { return (x & ~signMask) == infBits; }
+
+    static bool isZero(T x)
+    { return (x & ~signMask) == 0; }
+
+    static T zero(bool sign)
+    { return sign ? signMask : 0; }
+
+    static T infinity(bool sign)
+    { return zero(sign) | infBits; }
+
+    /// Set sig and scale such that the magnitude of the finite
+    /// non-zero x is sig*2^scale.
+    static void unpack(T x, Uint128& sig, int& scale)
+    {
+      int exp = exponent(x);
+      if (exp == 0)
+	{
+	  sig = x & fracMask;
+	  scale = 1 - bias - fracBits;
+	}
+      else
+	{
+	  sig = (x & fracMask) | (T(1) << fracBits);
+	  scale = exp - bias - fracBits;
+	}
+    }
+
+    /// Same as unpack but shift sig so that its most significant bit
+    /// is at the given position.
+    static void unpackNormal(T x, Uint128& sig, int& scale, int pos)
+    {
+      unpack(x, sig, scale);
+      int shift = pos - msb(sig);
+      sig <<= shift;
+      scale -= shift;
+    }
+
+    /// Return the NaN result of an operation with a NaN operand
+    /// setting the invalid flag if a or b is a signaling NaN.
+    static T propagateNan(T a, T b, unsigned& flags)
+    {
+      if (isSnan(a) or isSnan(b))
+	flags |= invalidFlag;
+      return defaultNan;
+    }
+
+    /// Return the number with the given sign and magnitude sig*2^scale
+    /// rounded using the given mode. The bits of sig below the rounding
+    /// position may be jammed (see shiftRightJam).
+    static T roundPack(bool sign, int scale, Uint128 sig, RoundingMode mode,
+		       unsigned& flags);
+
+    static T add(T a, T b, RoundingMode mode, unsigned& flags);
+    static T mul(T a, T b, RoundingMode mode, unsigned& flags);
+    static T div(T a, T b, RoundingMode mode, unsigned& flags);
+    static T sqrt(T a, RoundingMode mode, unsigned& flags);
+    static T mulAdd(T a, T b, T c, RoundingMode mode, unsigned& flags);
+    static uint64_t toInt(T a, unsigned intWidth, bool isSigned,
+			  RoundingMode mode, unsigned& flags);
+
+    /// Return the sum of the two magnitudes with the given signs and
+    /// scales. Used by add and mulAdd.
+    static T addMagnitudes(bool sa, int ea, Uint128 ma, bool sb, int eb,
+			   Uint128 mb, RoundingMode mode, unsigned& flags);
+  };
+
+
+  template <typename T>
+  T
+  Fp<T>::roundPack(bool sign, int scale, Uint128 sig, RoundingMode mode,
+		   unsigned& flags)
+  {
+    if (sig == 0)
+      return zero(sign);
+
+    int top = msb(sig);
+    int exp = top + scale + bias;  // Biased exponent of result.
+    bool inexact = false;
+
+    if (exp >= 1)
+      {
+	Uint128 res = roundShift(sig, top - fracBits, sign, mode, inexact);
+	if ((res >> (fracBits + 1)) != 0)
+	  {
+	    res >>= 1;  // Rounding carried into a new bit.
+	    exp++;
+	  }
+	if (inexact)
+	  flags |= inexactFlag;
+
+	if (exp >= maxExp)
+	  {
+	    flags |= overflowFlag | inexactFlag;
+	    bool toInf = ( mode == RoundingMode::NearestEven or
+			   mode == RoundingMode::NearestMax or
+			   (mode == RoundingMode::Down and sign) or
+			   (mode == RoundingMode::Up and not sign) );
+	    return toInf ? infinity(sign) : zero(sign) | (infBits - 1);
+	  }
+
+	T frac = T(static_cast<uint64_t>(res)) & fracMask;
+	return zero(sign) | (T(exp) << fracBits) | frac;
+      }
+
+    // Tininess is detected after rounding: The result is not tiny if
+    // rounding it to full precision with an unbounded exponent gives
+    // the smallest normal magnitude.
+    bool tiny = true;
+    if (exp == 0)
+      {
+	bool ignore = false;
+	Uint128 res = roundShift(sig, top - fracBits, sign, mode, ignore);
+	tiny = (res >> (fracBits + 1)) == 0;
+      }
+
+    Uint128 res = roundShift(sig, 1 - bias - fracBits - scale, sign, mode,
+			     inexact);
+    if (inexact)
+      {
+	flags |= inexactFlag;
+	if (tiny)
+	  flags |= underflowFlag;
+      }
+
+    // A subnormal rounded up to 2^fracBits is the smallest normal.
+    return zero(sign) | T(static_cast<uint64_t>(res));
+  }
+
+
+  template <typename T>
+  T
+  Fp<T>::addMagnitudes(bool sa, int ea, Uint128 ma, bool sb, int eb,
+		       Uint128 mb, RoundingMode mode, unsigned& flags)
+  {
+    if (ea < eb)
+      {
+	std::swap(sa, sb);
+	std::swap(ea, eb);
+	std::swap(ma, mb);
+      }
+
+    // Shift the operand with the larger scale left (by at most 64 bits
+    // which keeps it within 128 bits) and the other one right with
+    // jamming. The jammed bits are well below the rounding position.
+    int diff = ea - eb;
+    int left = std::min(diff, 64);
+    ma <<= left;
+    ea -= left;
+    mb = shiftRightJam(mb, diff - left);
+
+    Uint128 sum = 0;
+    bool sign = sa;
+    if (sa == sb)
+      sum = ma + mb;
+    else if (ma >= mb)
+      sum = ma - mb;
+    else
+      {
+	sum = mb - ma;
+	sign = sb;
+      }
+
+    if (sum == 0)
+      return zero(mode == RoundingMode::Down);
+
+    return roundPack(sign, ea, sum, mode, flags);
+  }
+
+
+  template <typename T>
+  T
+  Fp<T>::add(T a, T b, RoundingMode mode, unsigned& flags)
+  {
+    if (isNan(a) or isNan(b))
+      return propagateNan(a, b, flags);
+
+    bool sa = sign(a), sb = sign(b);
+    if (isInf(a))
+      {
+	if (isInf(b) and sa != sb)
+	  {
+	    flags |= invalidFlag;
+	    return defaultNan;
+	  }
+	return a;
+      }
+    if (isInf(b))
+      return b;
+
+    if (isZero(a) and isZero(b))
+      return sa == sb ? a : zero(mode == RoundingMode::Down);
+    if (isZero(a))
+      return b;
+    if (isZero(b))
+      return a;
+
+    Uint128 ma = 0, mb = 0;
+    int ea = 0, eb = 0;
+    unpack(a, ma, ea);
+    unpack(b, mb, eb);
+    return addMagnitudes(sa, ea, ma, sb, eb, mb, mode, flags);
+  }
+
+
+  template <typename T>
+  T
+  Fp<T>::mul(T a, T b, RoundingMode mode, unsigned& flags)
+  {
+    if (isNan(a) or isNan(b))
+      return propagateNan(a, b, flags);
+
+    bool sign = Fp<T>::sign(a) != Fp<T>::sign(b);
+    if (isInf(a) or isInf(b))
+      {
+	if (isZero(a) or isZero(b))
+	  {
+	    flags |= invalidFlag;
+	    return defaultNan;
+	  }
+	return infinity(sign);
+      }
+    if (isZero(a) or isZero(b))
+      return zero(sign);
+
+    Uint128 ma = 0, mb = 0;
+    int ea = 0, eb = 0;
+    unpack(a, ma, ea);
+    unpack(b, mb, eb);
+    return roundPack(sign, ea + eb, ma * mb, mode, flags);
+  }
+
+
+  template <typename T>
+  T
+  Fp<T>::div(T a, T b, RoundingMode mode, unsigned& flags)
+  {
+    if (isNan(a) or isNan(b))
+      return propagateNan(a, b, flags);
+
+    bool sign = Fp<T>::sign(a) != Fp<T>::sign(b);
+    if (isInf(a))
+      {
+	if (isInf(b))
+	  {
+	    flags |= invalidFlag;
+	    return defaultNan;
+	  }
+	return infinity(sign);
+      }
+    if (isInf(b))
+      return zero(sign);
+    if (isZero(b))
+      {
+	if (isZero(a))
+	  {
+	    flags |= invalidFlag;
+	    return defaultNan;
+	  }
+	flags |= divByZeroFlag;
+	return infinity(sign);
+      }
+    if (isZero(a))
+      return zero(sign);
+
+    // Quotient of normalized significands with 66 extra bits: At least
+    // 65 significant bits, the remainder goes into the sticky bit.
+    Uint128 ma = 0, mb = 0;
+    int ea = 0, eb = 0;
+    unpackNormal(a, ma, ea, fracBits);
+    unpackNormal(b, mb, eb, fracBits);
+    constexpr int extra = 66;
+    Uint128 num = ma << extra;
+    Uint128 quot = num / mb;
+    if (quot * mb != num)
+      quot |= 1;
+    return roundPack(sign, ea - eb - extra, quot, mode, flags);
+  }
+
+
+  template <typename T>
+  T
+  Fp<T>::sqrt(T a, RoundingMode mode, unsigned& flags)
+  {
+    if (isNan(a))
+      return propagateNan(a, a, flags);
+    if (isZero(a))
+      return a;
+    if (sign(a))
+      {
+	flags |= invalidFlag;
+	return defaultNan;
+      }
+    if (isInf(a))
+      return a;
+
+    // Make the scale even, then take the integer square root of the
+    // significand extended by 64 bits.
+    Uint128 ma = 0;
+    int ea = 0;
+    unpackNormal(a, ma, ea, fracBits);
+    if (ea & 1)
+      {
+	ma <<= 1;
+	ea--;
+      }
+    ma <<= 64;
+    ea -= 64;
+
+    Uint128 root = 0, bit = Uint128(1) << 126;
+    while (bit > ma)
+      bit >>= 2;
+    while (bit != 0)
+      {
+	if (ma >= root + bit)
+	  {
+	    ma -= root + bit;
+	    root = (root >> 1) + bit;
+	  }
+	else
+	  root >>= 1;
+	bit >>= 2;
+      }
+    if (ma != 0)
+      root |= 1;  // Remainder: Inexact root.
+
+    return roundPack(false, ea / 2, root, mode, flags);
+  }
+
+
+  template <typename T>
+  T
+  Fp<T>::mulAdd(T a, T b, T c, RoundingMode mode, unsigned& flags)
+  {
+    if ((isInf(a) and isZero(b)) or (isZero(a) and isInf(b)))
+      {
+	flags |= invalidFlag;
+	return defaultNan;
+      }
+    if (isNan(a) or isNan(b) or isNan(c))
+      {
+	if (isSnan(a) or isSnan(b) or isSnan(c))
+	  flags |= invalidFlag;
+	return defaultNan;
+      }
+
+    bool sp = sign(a) != sign(b), sc = sign(c);
+    if (isInf(a) or isInf(b))
+      {
+	if (isInf(c) and sc != sp)
+	  {
+	    flags |= invalidFlag;
+	    return defaultNan;
+	  }
+	return infinity(sp);
+      }
+    if (isInf(c))
+      return c;
+
+    if (isZero(a) or isZero(b))
+      {
+	if (isZero(c))
+	  return sp == sc ? c : zero(mode == RoundingMode::Down);
+	return c;
+      }
+
+    Uint128 ma = 0, mb = 0;
+    int ea = 0, eb = 0;
+    unpack(a, ma, ea);
+    unpack(b, mb, eb);
+    if (isZero(c))
+      return roundPack(sp, ea + eb, ma * mb, mode, flags);
+
+    // Exact product and addend with their most significant bits at
+    // position 125: Their sum fits in 127 bits and the product has
+    // more than 16 zero low bits so that alignment shifts of up to 16
+    // bits are exact.
+    Uint128 prod = ma * mb;
+    int ep = ea + eb;
+    int shift = 125 - msb(prod);
+    prod <<= shift;
+    ep -= shift;
+
+    Uint128 mc = 0;
+    int ec = 0;
+    unpackNormal(c, mc, ec, 125);
+
+    int diff = ep - ec;
+    if (diff >= 0)
+      mc = shiftRightJam(mc, diff);
+    else
+      prod = shiftRightJam(prod, -diff);
+    int scale = std::max(ep, ec);
+
+    Uint128 sum = 0;
+    bool sign = sp;
+    if (sp == sc)
+      sum = prod + mc;
+    else if (prod >= mc)
+      sum = prod - mc;
+    else
+      {
+	sum = mc - prod;
+	sign = sc;
+      }
+
+    if (sum == 0)
+      return zero(mode == RoundingMode::Down);
+
+    return roundPack(sign, scale, sum, mode, flags);
+  }
+
+
+  template <typename T>
+  uint64_t
+  Fp<T>::toInt(T a, unsigned intWidth, bool isSigned, RoundingMode mode,
+	       unsigned& flags)
+  {
+    uint64_t maxUint = intWidth >= 64 ? ~uint64_t(0) : (uint64_t(1) << intWidth) - 1;
+    uint64_t maxInt = maxUint >> 1;
+
+    bool neg = sign(a);
+    auto invalid = [&flags, isSigned, maxUint, maxInt] (bool negative) {
+      flags |= invalidFlag;
+      if (isSigned)
+	return negative ? maxInt + 1 : maxInt;  // Min or max int.
+      return negative ? uint64_t(0) : maxUint;
+    };
+
+    if (isNan(a))
+      return invalid(false);
+    if (isInf(a))
+      return invalid(neg);
+    if (isZero(a))
+      return 0;
+
+    Uint128 sig = 0;
+    int scale = 0;
+    unpack(a, sig, scale);
+
+    Uint128 mag = 0;
+    bool inexact = false;
+    if (scale >= 0)
+      {
+	if (msb(sig) + scale >= 64)
+	  return invalid(neg);
+	mag = sig << scale;
+      }
+    else
+      mag = roundShift(sig, -scale, neg, mode, inexact);
+
+    uint64_t limit = 0;
+    if (isSigned)
+      limit = neg ? maxInt + 1 : maxInt;
+    else
+      limit = neg ? 0 : maxUint;
+    if (mag > limit)
+      return invalid(neg);
+
+    if (inexact)
+      flags |= inexactFlag;
+
+    uint64_t res = static_cast<uint64_t>(mag);
+    if (neg)
+      res = -res;
+    return res & maxUint;
+  }
+
+
+  uint32_t
+  bitsOf(float x)
+  {
+    uint32_t u = 0;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+  }
+
+
+  uint64_t
+  bitsOf(double x)
+  {
+    uint64_t u = 0;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+  }
+
+
+  float
+  singleOf(uint32_t u)
+  {
+    float x = 0;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+  }
+
+
+  double
+  doubleOf(uint64_t u)
+  {
+    double x = 0;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+  }
+
+
+  /// Convert the number x of type From to type To rounding using the
+  /// given mode.
+  template <typename To, typename From>
+  To
+  convert(From x, RoundingMode mode, unsigned& flags)
+  {
+    typedef Fp<From> FF;
+    typedef Fp<To> TF;
+
+    if (FF::isNan(x))
+      {
+	if (FF::isSnan(x))
+	  flags |= invalidFlag;
+	return TF::defaultNan;
+      }
+    if (FF::isInf(x))
+      return TF::infinity(FF::sign(x));
+    if (FF::isZero(x))
+      return TF::zero(FF::sign(x));
+
+    Uint128 sig = 0;
+    int scale = 0;
+    FF::unpack(x, sig, scale);
+    return TF::roundPack(FF::sign(x), scale, sig, mode, flags);
+  }
+
+
+  /// Convert the integer with the given sign and magnitude to a
+  /// number of type T.
+  template <typename T>
+  T
+  fromInt(bool sign, uint64_t mag, RoundingMode mode, unsigned& flags)
+  {
+    if (mag == 0)
+      return 0;
+    return Fp<T>::roundPack(sign, 0, mag, mode, flags);
+  }
+}
+
+
+float
+SoftFloat::add(float a, float b, RoundingMode mode, unsigned& flags)
+{
+  return singleOf(Fp<uint32_t>::add(bitsOf(a), bitsOf(b), mode, flags));
+}
+
+
+double
+SoftFloat::add(double a, double b, RoundingMode mode, unsigned& flags)
+{
+  return doubleOf(Fp<uint64_t>::add(bitsOf(a), bitsOf(b), mode, flags));
+}
+
+
+float
+SoftFloat::sub(float a, float b, RoundingMode mode, unsigned& flags)
+{
+  uint32_t nb = bitsOf(b) ^ Fp<uint32_t>::signMask;
+  return singleOf(Fp<uint32_t>::add(bitsOf(a), nb, mode, flags));
+}
+
+
+double
+SoftFloat::sub(double a, double b, RoundingMode mode, unsigned& flags)
+{
+  uint64_t nb = bitsOf(b) ^ Fp<uint64_t>::signMask;
+  return doubleOf(Fp<uint64_t>::add(bitsOf(a), nb, mode, flags));
+}
+
+
+float
+SoftFloat::mul(float a, float b, RoundingMode mode, unsigned& flags)
+{
+  return singleOf(Fp<uint32_t>::mul(bitsOf(a), bitsOf(b), mode, flags));
+}
+
+
+double
+SoftFloat::mul(double a, double b, RoundingMode mode, unsigned& flags)
+{
+  return doubleOf(Fp<uint64_t>::mul(bitsOf(a), bitsOf(b), mode, flags));
+}
+
+
+float
+SoftFloat::div(float a, float b, RoundingMode mode, unsigned& flags)
+{
+  return singleOf(Fp<uint32_t>::div(bitsOf(a), bitsOf(b), mode, flags));
+}
+
+
+double
+SoftFloat::div(double a, double b, RoundingMode mode, unsigned& flags)
+{
+  return doubleOf(Fp<uint64_t>::div(bitsOf(a), bitsOf(b), mode, flags));
+}
+
+
+float
+SoftFloat::sqrt(float a, RoundingMode mode, unsigned& flags)
+{
+  return singleOf(Fp<uint32_t>::sqrt(bitsOf(a), mode, flags));
+}
+
+
+double
+SoftFloat::sqrt(double a, RoundingMode mode, unsigned& flags)
+{
+  return doubleOf(Fp<uint64_t>::sqrt(bitsOf(a), mode, flags));
+}
+
+
+float
+SoftFloat::mulAdd(float a, float b, float c, RoundingMode mode,
+		  unsigned& flags)
+{
+  return singleOf(Fp<uint32_t>::mulAdd(bitsOf(a), bitsOf(b), bitsOf(c),
+				       mode, flags));
+}
+
+
+double
+SoftFloat::mulAdd(double a, double b, double c, RoundingMode mode,
+		  unsigned& flags)
+{
+  return doubleOf(Fp<uint64_t>::mulAdd(bitsOf(a), bitsOf(b), bitsOf(c),
+				       mode, flags));
+}
+
+
+double
+SoftFloat::toDouble(float a, unsigned& flags)
+{
+  // Exact: The rounding mode does not matter.
+  return doubleOf(convert<uint64_t>(bitsOf(a), RoundingMode::NearestEven,
+				    flags));
+}
+
+
+float
+SoftFloat::toSingle(double a, RoundingMode mode, unsigned& flags)
+{
+  return singleOf(convert<uint32_t>(bitsOf(a), mode, flags));
+}
+
+
+float
+SoftFloat::i64ToSingle(int64_t x, RoundingMode mode, unsigned& flags)
+{
+  uint64_t mag = x < 0 ? -uint64_t(x) : uint64_t(x);
+  return singleOf(fromInt<uint32_t>(x < 0, mag, mode, flags));
+}
+
+
+float
+SoftFloat::u64ToSingle(uint64_t x, RoundingMode mode, unsigned& flags)
+{
+  return singleOf(fromInt<uint32_t>(false, x, mode, flags));
+}
+
+
+double
+SoftFloat::i64ToDouble(int64_t x, RoundingMode mode, unsigned& flags)
+{
+  uint64_t mag = x < 0 ? -uint64_t(x) : uint64_t(x);
+  return doubleOf(fromInt<uint64_t>(x < 0, mag, mode, flags));
+}
+
+
+double
+SoftFloat::u64ToDouble(uint64_t x, RoundingMode mode, unsigned& flags)
+{
+  return doubleOf(fromInt<uint64_t>(false, x, mode, flags));
+}
+
+
+uint64_t
+SoftFloat::toInt(float a, unsigned width, bool isSigned, RoundingMode mode,
+		 unsigned& flags)
+{
+  return Fp<uint32_t>::toInt(bitsOf(a), width, isSigned, mode, flags);
+}
+
+
+uint64_t
+SoftFloat::toInt(double a, unsigned width, bool isSigned, RoundingMode mode,
+		 unsigned& flags)
+{
+  return Fp<uint64_t>::toInt(bitsOf(a), width, isSigned, mode, flags);
+}
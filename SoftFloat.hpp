@@ -0,0 +1,82 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstdint>
+#include "FpRegs.hpp"
+
+
+namespace WdRiscv
+{
+
+  /// Software implementation of the IEEE-754 single and double
+  /// precision operations of the RISCV F/D extensions. Results do not
+  /// depend on the floating point environment of the host: They are
+  /// bit-identical on all hosts (native and WebAssembly). A NaN result
+  /// is always the RISCV canonical NaN. Each operation rounds using the
+  /// given mode (all 5 RISCV modes are supported) and ors the raised
+  /// exceptions into flags (a mask of FpFlags bits). Used instead of
+  /// the host FP unit when whisper is built with SOFT_FLOAT.
+  class SoftFloat
+  {
+  public:
+
+    static float add(float a, float b, RoundingMode mode, unsigned& flags);
+    static double add(double a, double b, RoundingMode mode, unsigned& flags);
+
+    static float sub(float a, float b, RoundingMode mode, unsigned& flags);
+    static double sub(double a, double b, RoundingMode mode, unsigned& flags);
+
+    static float mul(float a, float b, RoundingMode mode, unsigned& flags);
+    static double mul(double a, double b, RoundingMode mode, unsigned& flags);
+
+    static float div(float a, float b, RoundingMode mode, unsigned& flags);
+    static double div(double a, double b, RoundingMode mode, unsigned& flags);
+
+    static float sqrt(float a, RoundingMode mode, unsigned& flags);
+    static double sqrt(double a, RoundingMode mode, unsigned& flags);
+
+    /// Return a*b + c with a single rounding. Multiplying infinity by
+    /// zero is invalid even if c is a quiet NaN.
+    static float mulAdd(float a, float b, float c, RoundingMode mode,
+			unsigned& flags);
+    static double mulAdd(double a, double b, double c, RoundingMode mode,
+			 unsigned& flags);
+
+    /// Convert between single and double precision.
+    static double toDouble(float a, unsigned& flags);
+    static float toSingle(double a, RoundingMode mode, unsigned& flags);
+
+    /// Convert the given integer to floating point.
+    static float i64ToSingle(int64_t x, RoundingMode mode, unsigned& flags);
+    static float u64ToSingle(uint64_t x, RoundingMode mode, unsigned& flags);
+    static double i64ToDouble(int64_t x, RoundingMode mode, unsigned& flags);
+    static double u64ToDouble(uint64_t x, RoundingMode mode, unsigned& flags);
+
+    /// Convert the given floating point number to an integer of the
+    /// given width (32 or 64) and signedness with the RISCV fcvt
+    /// semantics: NaN and out of range values are invalid and
+    /// saturate. Return the integer in the least significant width
+    /// bits of the result (upper bits are zero).
+    static uint64_t toInt(float a, unsigned width, bool isSigned,
+			  RoundingMode mode, unsigned& flags);
+    static uint64_t toInt(double a, unsigned width, bool isSigned,
+			  RoundingMode mode, unsigned& flags);
+  };
+}
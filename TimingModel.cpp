@@ -0,0 +1,65 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+// 
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+// 
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+// 
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+
+#include "TimingModel.hpp"
+
+
+using namespace WdRiscv;
+
+
+static bool
+isPowerOf2(uint64_t x)
+{
+  return x != 0 and (x & (x - 1)) == 0;
+}
+
+
+bool
+CacheModel::config(uint64_t size, unsigned lineSize, unsigned ways)
+{
+  if (not isPowerOf2(lineSize) or ways == 0 or
+      size % (uint64_t(lineSize) * ways) != 0)
+    return false;
+
+  uint64_t sets = size / lineSize / ways;
+  if (not isPowerOf2(sets))
+    return false;
+
+  lineShift_ = 0;
+  while ((1u << lineShift_) < lineSize)
+    ++lineShift_;
+  setMask_ = sets - 1;
+  ways_ = ways;
+  tags_.assign(sets * ways, 0);
+  return true;
+}
+
+
+bool
+BranchPredictorModel::config(unsigned entries)
+{
+  if (not isPowerOf2(entries))
+    return false;
+
+  counters_.assign(entries, 1);  // Weakly not-taken.
+  targets_.assign(entries, 0);
+  mask_ = entries - 1;
+  return true;
+}
@@ -0,0 +1,208 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+// 
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+// 
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+// 
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+namespace WdRiscv
+{
+
+  /// Tag store of a set associative cache with LRU replacement used
+  /// by the timing model. Data is not modeled: only the hit or miss
+  /// outcome of each access.
+  class CacheModel
+  {
+  public:
+
+    /// Configure a cache of the given size in bytes with the given
+    /// line size in bytes and number of ways. Return false if the
+    /// parameters are invalid: line size and number of sets must be
+    /// powers of 2.
+    bool config(uint64_t size, unsigned lineSize, unsigned ways);
+
+    /// Return true if this cache is configured.
+    bool enabled() const
+    { return ways_ != 0; }
+
+    /// Access the line holding the given address. Return true on a
+    /// hit. On a miss, the line replaces the least recently used line
+    /// of its set.
+    bool access(uint64_t addr)
+    {
+      uint64_t line = addr >> lineShift_;
+      uint64_t tag = (line << 1) | 1;  // Low bit: valid.
+      uint64_t* set = tags_.data() + (line & setMask_) * ways_;
+
+      // Ways of a set are kept in most-recently-used order.
+      unsigned way = 0;
+      while (way < ways_ and set[way] != tag)
+	++way;
+      bool hit = way < ways_;
+      if (not hit)
+	way = ways_ - 1;
+      for ( ; way > 0; --way)
+	set[way] = set[way - 1];
+      set[0] = tag;
+      return hit;
+    }
+
+    /// Invalidate all the lines.
+    void invalidate()
+    { tags_.assign(tags_.size(), 0); }
+
+  private:
+
+    std::vector<uint64_t> tags_;  // Ways of each set, set after set.
+    unsigned lineShift_ = 0;
+    uint64_t setMask_ = 0;
+    unsigned ways_ = 0;
+  };
+
+
+  /// Branch predictor of the timing model: A table of 2-bit
+  /// saturating counters predicts the direction of conditional
+  /// branches and a table of last targets predicts the target of
+  /// indirect jumps. Both are indexed by instruction address.
+  class BranchPredictorModel
+  {
+  public:
+
+    /// Configure the predictor with the given number of entries (a
+    /// power of 2) in each table. Return false if entries is invalid.
+    bool config(unsigned entries);
+
+    /// Return true if this predictor is configured.
+    bool enabled() const
+    { return not counters_.empty(); }
+
+    /// Predict the conditional branch at the given address and update
+    /// the predictor with the actual direction. Return true if the
+    /// prediction was correct.
+    bool predictBranch(uint64_t pc, bool taken)
+    {
+      uint8_t& counter = counters_[(pc >> 1) & mask_];
+      bool correct = (counter >= 2) == taken;
+      if (taken)
+	counter += counter < 3;
+      else
+	counter -= counter > 0;
+      return correct;
+    }
+
+    /// Predict the target of the indirect jump at the given address
+    /// and update the predictor with the actual target. Return true if
+    /// the prediction was correct.
+    bool predictJump(uint64_t pc, uint64_t target)
+    {
+      uint64_t& last = targets_[(pc >> 1) & mask_];
+      bool correct = last == target;
+      last = target;
+      return correct;
+    }
+
+  private:
+
+    std::vector<uint8_t> counters_;
+    std::vector<uint64_t> targets_;
+    uint64_t mask_ = 0;
+  };
+
+
+  /// Optional timing model of a hart: Instruction and data caches, a
+  /// branch predictor and per-instruction latencies. The hart adds the
+  /// stall cycles computed by the model to its cycle count (mcycle).
+  /// A disabled component (default) costs no stall cycles.
+  class TimingModel
+  {
+  public:
+
+    /// Configure the instruction cache (see CacheModel::config) with
+    /// the given miss penalty in cycles. Return false on failure.
+    bool configICache(uint64_t size, unsigned lineSize, unsigned ways,
+		      unsigned missPenalty)
+    {
+      icacheMissPenalty_ = missPenalty;
+      return icache_.config(size, lineSize, ways);
+    }
+
+    /// Configure the data cache (see CacheModel::config) with the
+    /// given miss penalty in cycles. Return false on failure.
+    bool configDCache(uint64_t size, unsigned lineSize, unsigned ways,
+		      unsigned missPenalty)
+    {
+      dcacheMissPenalty_ = missPenalty;
+      return dcache_.config(size, lineSize, ways);
+    }
+
+    /// Configure the branch predictor (see BranchPredictorModel::config)
+    /// with the given misprediction penalty in cycles. Return false on
+    /// failure.
+    bool configBranchPredictor(unsigned entries, unsigned penalty)
+    {
+      mispredictPenalty_ = penalty;
+      return predictor_.config(entries);
+    }
+
+    /// Set the latency in cycles of the instruction with the given id
+    /// (InstId). The default latency is 1.
+    void setLatency(unsigned instId, unsigned cycles)
+    {
+      if (instId >= extraCycles_.size())
+	extraCycles_.resize(instId + 1);
+      extraCycles_.at(instId) = cycles ? cycles - 1 : 0;
+    }
+
+    /// Return the latency in cycles of the instruction with the given
+    /// id minus 1.
+    unsigned extraCycles(unsigned instId) const
+    { return instId < extraCycles_.size() ? extraCycles_[instId] : 0; }
+
+    CacheModel& icache()
+    { return icache_; }
+
+    CacheModel& dcache()
+    { return dcache_; }
+
+    BranchPredictorModel& predictor()
+    { return predictor_; }
+
+    unsigned icacheMissPenalty() const
+    { return icacheMissPenalty_; }
+
+    unsigned dcacheMissPenalty() const
+    { return dcacheMissPenalty_; }
+
+    unsigned mispredictPenalty() const
+    { return mispredictPenalty_; }
+
+  private:
+
+    CacheModel icache_;
+    CacheModel dcache_;
+    BranchPredictorModel predictor_;
+    std::vector<uint32_t> extraCycles_;  // Indexed by instruction id.
+    unsigned icacheMissPenalty_ = 0;
+    unsigned dcacheMissPenalty_ = 0;
+    unsigned mispredictPenalty_ = 0;
+  };
+}
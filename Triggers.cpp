@@ -29,6 +29,7 @@ Triggers<URV>::Triggers(unsigned count)
   // Define each triggers as a single-element chain.
   for (unsigned i = 0; i < count; ++i)
     triggers_.at(i).setChainBounds(i, i+1);
+  defineFilter();
 }
 
 
@@ -85,6 +86,7 @@ Triggers<URV>::writeData1(URV trigIx, bool debugMode, URV value)
   if (prevChain != newChain)
     defineChainBounds();
 
+  defineFilter();
   return true;
 }
 
@@ -96,7 +98,11 @@ Triggers<URV>::writeData2(URV trigger, bool debugMode, URV value)
   if (trigger >= triggers_.size())
     return false;
 
-  return triggers_.at(trigger).writeData2(debugMode, value);
+  if (not triggers_.at(trigger).writeData2(debugMode, value))
+    return false;
+
+  defineFilter();
+  return true;
 }
 
 
@@ -143,10 +149,14 @@ bool
 Triggers<URV>::ldStAddrTriggerHit(URV address, TriggerTiming timing,
 				  bool isLoad, bool interruptEnabled)
 {
+  if (not filterHit(isLoad ? LoadAddr : StoreAddr, timing, address))
+    return false;
+
   bool hit = false;
   for (auto& trigger : triggers_)
     {
-      if (not trigger.isEnterDebugOnHit() and not interruptEnabled)
+      if (not trigger.isEnterDebugOnHit() and not trigger.isTraceAction()
+	  and not interruptEnabled)
 	continue;
 
       if (not trigger.matchLdStAddr(address, timing, isLoad))
@@ -154,7 +164,7 @@ Triggers<URV>::ldStAddrTriggerHit(URV address, TriggerTiming timing,
 
       trigger.setLocalHit(true);
 
-      if (updateChainHitBit(trigger))
+      if (updateChainHitBit(trigger) and isBreakHit(trigger))
 	hit = true;
     }
   return hit;
@@ -166,10 +176,14 @@ bool
 Triggers<URV>::ldStDataTriggerHit(URV value, TriggerTiming timing, bool isLoad,
 				  bool interruptEnabled)
 {
+  if (not filterHit(isLoad ? LoadData : StoreData, timing, value))
+    return false;
+
   bool hit = false;
   for (auto& trigger : triggers_)
     {
-      if (not trigger.isEnterDebugOnHit() and not interruptEnabled)
+      if (not trigger.isEnterDebugOnHit() and not trigger.isTraceAction()
+	  and not interruptEnabled)
 	continue;
 
       if (not trigger.matchLdStData(value, timing, isLoad))
@@ -177,7 +191,7 @@ Triggers<URV>::ldStDataTriggerHit(URV value, TriggerTiming timing, bool isLoad,
 
       trigger.setLocalHit(true);
 
-      if (updateChainHitBit(trigger))
+      if (updateChainHitBit(trigger) and isBreakHit(trigger))
 	hit = true;
     }
 
@@ -190,10 +204,14 @@ bool
 Triggers<URV>::instAddrTriggerHit(URV address, TriggerTiming timing,
 				  bool interruptEnabled)
 {
+  if (not filterHit(InstAddr, timing, address))
+    return false;
+
   bool hit = false;
   for (auto& trigger : triggers_)
     {
-      if (not trigger.isEnterDebugOnHit() and not interruptEnabled)
+      if (not trigger.isEnterDebugOnHit() and not trigger.isTraceAction()
+	  and not interruptEnabled)
 	continue;
 
       if (not trigger.matchInstAddr(address, timing))
@@ -201,7 +219,7 @@ Triggers<URV>::instAddrTriggerHit(URV address, TriggerTiming timing,
 
       trigger.setLocalHit(true);
 
-      if (updateChainHitBit(trigger))
+      if (updateChainHitBit(trigger) and isBreakHit(trigger))
 	hit = true;
     }
   return hit;
@@ -213,10 +231,14 @@ bool
 Triggers<URV>::instOpcodeTriggerHit(URV opcode, TriggerTiming timing,
 				    bool interruptEnabled)
 {
+  if (not filterHit(InstOpcode, timing, opcode))
+    return false;
+
   bool hit = false;
   for (auto& trigger : triggers_)
     {
-      if (not trigger.isEnterDebugOnHit() and not interruptEnabled)
+      if (not trigger.isEnterDebugOnHit() and not trigger.isTraceAction()
+	  and not interruptEnabled)
 	continue;
 
       if (not trigger.matchInstOpcode(opcode, timing))
@@ -224,7 +246,7 @@ Triggers<URV>::instOpcodeTriggerHit(URV opcode, TriggerTiming timing,
 
       trigger.setLocalHit(true);
 
-      if (updateChainHitBit(trigger))
+      if (updateChainHitBit(trigger) and isBreakHit(trigger))
 	hit = true;
     }
 
@@ -240,7 +262,8 @@ Triggers<URV>::icountTriggerHit(bool interruptEnabled)
 
   for (auto& trig : triggers_)
     {
-      if (not trig.isEnterDebugOnHit() and not interruptEnabled)
+      if (not trig.isEnterDebugOnHit() and not trig.isTraceAction()
+	  and not interruptEnabled)
 	continue;
 
       if (trig.isModified())
@@ -249,9 +272,10 @@ Triggers<URV>::icountTriggerHit(bool interruptEnabled)
       if (not trig.instCountdown())
 	continue;
 
-      hit = true;
       trig.setHit(true);
       trig.setLocalHit(true);
+      if (isBreakHit(trig))
+	hit = true;
     }
   return hit;
 }
@@ -273,6 +297,7 @@ Triggers<URV>::config(unsigned trigger, URV reset1, URV reset2, URV reset3,
   triggers_.at(trigger).writeData2(true, reset2);  // Define compare mask.
 
   defineChainBounds();
+  defineFilter();
 
   return true;
 }
@@ -285,6 +310,8 @@ Triggers<URV>::reset()
   for (auto& trigger : triggers_)
     trigger.reset();
   defineChainBounds();
+  defineFilter();
+  traceActionPending_ = false;
 }
 
 
@@ -327,6 +354,7 @@ Triggers<URV>::poke(URV trigger, URV v1, URV v2, URV v3)
   trig.pokeData2(v2);
   trig.pokeData3(v3);
 
+  defineFilter();
   return true;
 }
 
@@ -347,6 +375,7 @@ Triggers<URV>::pokeData1(URV trigger, URV val)
   if (prevChain != newChain)
     defineChainBounds();
 
+  defineFilter();
   return true;
 }
 
@@ -361,6 +390,7 @@ Triggers<URV>::pokeData2(URV trigger, URV val)
   Trigger<URV>& trig = triggers_.at(trigger);
 
   trig.pokeData2(val);
+  defineFilter();
   return true;
 }
 
@@ -379,6 +409,42 @@ Triggers<URV>::pokeData3(URV trigger, URV val)
 }
 
 
+template <typename URV>
+void
+Triggers<URV>::defineFilter()
+{
+  for (auto& kindFilter : filter_)
+    for (auto& timingFilter : kindFilter)
+      timingFilter.clear();
+
+  for (const auto& trig : triggers_)
+    {
+      if (TriggerType(trig.data1_.data1_.type_) != TriggerType::AddrData)
+	continue;
+
+      const Mcontrol<URV>& ctl = trig.data1_.mcontrol_;
+      if (not ctl.m_)
+	continue;
+
+      URV low = 0, high = 0;
+      if (not trig.matchBounds(low, high))
+	continue;
+      auto range = std::make_pair(low, high);
+
+      unsigned timing = unsigned(TriggerTiming(ctl.timing_));
+      using Select = typename Trigger<URV>::Select;
+      bool addr = Select(ctl.select_) == Select::MatchAddress;
+
+      if (ctl.load_)
+	filter_[addr ? LoadAddr : LoadData][timing].push_back(range);
+      if (ctl.store_)
+	filter_[addr ? StoreAddr : StoreData][timing].push_back(range);
+      if (ctl.execute_)
+	filter_[addr ? InstAddr : InstOpcode][timing].push_back(range);
+    }
+}
+
+
 template <typename URV>
 void
 Triggers<URV>::defineChainBounds()
@@ -505,6 +571,43 @@ Trigger<URV>::doMatch(URV item) const
 }
 
 
+template <typename URV>
+bool
+Trigger<URV>::matchBounds(URV& low, URV& high) const
+{
+  low = 0;
+  high = ~URV(0);
+
+  switch (Match(data1_.mcontrol_.match_))
+    {
+    case Match::Equal:
+      low = high = data2_;
+      return true;
+
+    case Match::Masked:
+      low = data2_ & data2CompareMask_;
+      high = low | ~data2CompareMask_;
+      return true;
+
+    case Match::GE:
+      low = data2_;
+      return true;
+
+    case Match::LT:
+      if (data2_ == 0)
+	return false;
+      high = data2_ - 1;
+      return true;
+
+    case Match::MaskHighEqualLow:
+    case Match::MaskLowEqualHigh:
+      return true;
+    }
+
+  return false;
+}
+
+
 template <typename URV>
 bool
 Trigger<URV>::matchInstAddr(URV address, TriggerTiming timing) const
@@ -355,6 +355,11 @@ namespace WdRiscv
     /// according to the match field.
     bool doMatch(URV item) const;
 
+    /// Set low/high to the bounds of an interval containing all the
+    /// items matched by doMatch (the interval may contain items that
+    /// do not match). Return false if doMatch matches no item.
+    bool matchBounds(URV& low, URV& high) const;
+
     /// Set the hit bit of this trigger. For a chained trigger, this
     /// should be called only if all the triggers in the chain have
     /// tripped.
@@ -417,6 +422,15 @@ namespace WdRiscv
       return Action::RaiseBreak;
     }
 
+    /// Return true if the action of this trigger is to start or stop
+    /// the instruction trace instead of raising a breakpoint exception
+    /// or entering debug mode.
+    bool isTraceAction() const
+    {
+      Action action = getAction();
+      return action == Action::StartTrace or action == Action::StopTrace;
+    }
+
   protected:
 
     void updateCompareMask()
@@ -679,6 +693,19 @@ namespace WdRiscv
       return false;
     }
 
+    /// Return true if a trigger with a start-trace or stop-trace
+    /// action tripped since the last call setting start to true if
+    /// the last such trigger starts the trace and false if it stops
+    /// it. Such triggers are not reported by the hit methods.
+    bool takeTraceAction(bool& start)
+    {
+      if (not traceActionPending_)
+	return false;
+      traceActionPending_ = false;
+      start = traceStart_;
+      return true;
+    }
+
     /// Restrict chaining only to pairs of consecutive (even-numbered followed
     /// by odd) triggers.
     void setEvenOddChaining(bool flag)
@@ -698,9 +725,51 @@ namespace WdRiscv
     /// Define the chain bounds of each trigger.
     void defineChainBounds();
 
+    /// Kinds of items checked against the triggers.
+    enum FilterKind { LoadAddr, StoreAddr, LoadData, StoreData, InstAddr,
+		      InstOpcode, FilterKindCount };
+
+    /// Recompute the match pre-filter (filter_) from the enabled
+    /// triggers. Must be called after any trigger change affecting
+    /// matching.
+    void defineFilter();
+
+    /// Return true if the given item of the given kind with the given
+    /// timing may match an enabled trigger. Return false if it
+    /// cannot.
+    bool filterHit(FilterKind kind, TriggerTiming timing, URV item) const
+    {
+      for (const auto& range : filter_[kind][unsigned(timing)])
+	if (item >= range.first and item <= range.second)
+	  return true;
+      return false;
+    }
+
+    /// Helper to the hit methods: Return true if the given tripped
+    /// trigger requires a breakpoint exception or debug mode. Return
+    /// false, remembering its action, if it only starts or stops the
+    /// trace.
+    bool isBreakHit(const Trigger<URV>& trigger)
+    {
+      if (not trigger.isTraceAction())
+	return true;
+      traceStart_ = trigger.getAction() == Trigger<URV>::Action::StartTrace;
+      traceActionPending_ = true;
+      return false;
+    }
+
   private:
 
     std::vector< Trigger<URV> > triggers_;
+
+    // Pre-filter of the hit methods indexed by kind and timing: Each
+    // enabled trigger contributes an interval containing all the items
+    // it matches. The full trigger evaluation runs only for items
+    // falling in one of the intervals.
+    std::vector<std::pair<URV, URV>> filter_[FilterKindCount][2];
+
     bool chainPairs_ = false;
+    bool traceActionPending_ = false; // Start/stop-trace trigger tripped.
+    bool traceStart_ = false;         // Action of that trigger is start.
   };
 }
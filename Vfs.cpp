@@ -0,0 +1,749 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "Vfs.hpp"
+
+
+using namespace WdRiscv;
+
+
+// Linux ABI constants that may not be defined by the host.
+static constexpr int seekSet = 0, seekCur = 1, seekEnd = 2;
+static constexpr int fGetFd = 1, fSetFd = 2, fGetFl = 3, fSetFl = 4;
+static constexpr uint8_t dtDir = 4, dtReg = 8;
+
+
+/// Return true if given path is a prefix of other at a path component
+/// boundary (other is path or is below path).
+static bool
+isUnder(const std::string& path, const std::string& other)
+{
+  if (path == "/")
+    return true;
+  return other.compare(0, path.size(), path) == 0 and
+    (other.size() == path.size() or other.at(path.size()) == '/');
+}
+
+
+/// Return the parent directory of the given normalized absolute path.
+static std::string
+parentOf(const std::string& path)
+{
+  auto ix = path.rfind('/');
+  return ix == 0 ? "/" : path.substr(0, ix);
+}
+
+
+/// Read the given host file into bytes. Return true on success.
+static bool
+readHostFile(const std::string& path, std::vector<uint8_t>& bytes)
+{
+  std::ifstream ifs(path, std::ios::binary);
+  if (not ifs)
+    return false;
+  bytes.assign(std::istreambuf_iterator<char>(ifs),
+	       std::istreambuf_iterator<char>());
+  return not ifs.bad();
+}
+
+
+Vfs::Vfs()
+{
+  addNode("/", true, 0755, 0);
+}
+
+
+Vfs::Vfs(const Vfs& other)
+{
+  std::lock_guard<std::mutex> lock(other.mutex_);
+  for (const auto& kv : other.nodes_)
+    nodes_[kv.first] = std::make_shared<Node>(*kv.second);
+  cwd_ = other.cwd_;
+  nextIno_ = other.nextIno_;
+}
+
+
+bool
+Vfs::load(const std::string& path)
+{
+  std::error_code ec;
+  if (std::filesystem::is_directory(path, ec))
+    return loadDirectory(path);
+
+  std::vector<uint8_t> bytes;
+  if (not readHostFile(path, bytes))
+    {
+      std::cerr << "Failed to read file system image '" << path << "'\n";
+      return false;
+    }
+
+  if (bytes.size() >= 512 and memcmp(&bytes.at(257), "ustar", 5) == 0)
+    return loadTar(path, bytes);
+  return loadManifest(path);
+}
+
+
+bool
+Vfs::loadDirectory(const std::string& path)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::error_code ec;
+  std::filesystem::recursive_directory_iterator iter(path, ec), end;
+  for ( ; not ec and iter != end; iter.increment(ec))
+    {
+      const auto& entry = *iter;
+      std::string rel = entry.path().lexically_relative(path).generic_string();
+      std::string target = "/" + rel;
+
+      if (entry.is_directory(ec))
+	addNode(target, true, 0755, 0);
+      else if (entry.is_regular_file(ec))
+	{
+	  auto node = addNode(target, false, 0644, 0);
+	  if (not readHostFile(entry.path().string(), node->data))
+	    {
+	      std::cerr << "Failed to read file '" << entry.path().string()
+			<< "'\n";
+	      return false;
+	    }
+	}
+    }
+
+  if (ec)
+    {
+      std::cerr << "Failed to load directory '" << path << "': "
+		<< ec.message() << '\n';
+      return false;
+    }
+  return true;
+}
+
+
+/// Return the value of the given octal field of a tar header.
+static uint64_t
+tarNumber(const uint8_t* field, size_t size)
+{
+  uint64_t value = 0;
+  for (size_t i = 0; i < size and field[i]; ++i)
+    if (field[i] >= '0' and field[i] <= '7')
+      value = value*8 + (field[i] - '0');
+  return value;
+}
+
+
+/// Return the string in the given tar header field.
+static std::string
+tarString(const uint8_t* field, size_t size)
+{
+  const char* str = reinterpret_cast<const char*>(field);
+  return std::string(str, strnlen(str, size));
+}
+
+
+bool
+Vfs::loadTar(const std::string& path, const std::vector<uint8_t>& bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::string longName;  // From a GNU long name record.
+  size_t offset = 0;
+  while (offset + 512 <= bytes.size())
+    {
+      const uint8_t* header = &bytes.at(offset);
+      if (header[0] == 0)
+	break;  // End of archive.
+
+      std::string name = tarString(header, 100);
+      std::string prefix = tarString(header + 345, 155);
+      if (not prefix.empty())
+	name = prefix + "/" + name;
+      unsigned mode = tarNumber(header + 100, 8) & 07777;
+      uint64_t size = tarNumber(header + 124, 12);
+      int64_t mtime = tarNumber(header + 136, 12);
+      char type = header[156];
+
+      offset += 512;
+      if (offset + size > bytes.size())
+	{
+	  std::cerr << "Truncated tar file '" << path << "'\n";
+	  return false;
+	}
+
+      if (not longName.empty())
+	{
+	  name = longName;
+	  longName.clear();
+	}
+
+      if (type == 'L')
+	longName = tarString(&bytes.at(offset), size);
+      else
+	{
+	  int error = 0;
+	  std::string target = resolve(atCwd, "/" + name, error);
+	  if (type == '5')
+	    addNode(target, true, mode, mtime);
+	  else if (type == '0' or type == 0 or type == '7')
+	    {
+	      auto node = addNode(target, false, mode, mtime);
+	      node->data.assign(bytes.begin() + offset,
+				bytes.begin() + offset + size);
+	    }
+	  // Other entry types (links, devices) are skipped.
+	}
+
+      offset += (size + 511) / 512 * 512;
+    }
+
+  return true;
+}
+
+
+bool
+Vfs::loadManifest(const std::string& path)
+{
+  std::ifstream ifs(path);
+  if (not ifs)
+    {
+      std::cerr << "Failed to open manifest file '" << path << "'\n";
+      return false;
+    }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::string line;
+  unsigned lineNum = 0;
+  while (std::getline(ifs, line))
+    {
+      lineNum++;
+      std::istringstream iss(line);
+      std::string target, hostFile, extra;
+      if (not (iss >> target) or target.front() == '#')
+	continue;
+      if (not (iss >> hostFile) or (iss >> extra))
+	{
+	  std::cerr << "File " << path << ", line " << lineNum
+		    << ": Expecting: <target-path> <host-file>\n";
+	  return false;
+	}
+
+      int error = 0;
+      auto node = addNode(resolve(atCwd, target, error), false, 0644, 0);
+      if (not readHostFile(hostFile, node->data))
+	{
+	  std::cerr << "File " << path << ", line " << lineNum
+		    << ": Failed to read file '" << hostFile << "'\n";
+	  return false;
+	}
+    }
+
+  return true;
+}
+
+
+std::shared_ptr<Vfs::Node>
+Vfs::addNode(const std::string& path, bool isDir, unsigned mode,
+	     int64_t mtime)
+{
+  if (path != "/")
+    {
+      std::string parent = parentOf(path);
+      if (not nodes_.count(parent))
+	addNode(parent, true, 0755, mtime);
+    }
+
+  auto& node = nodes_[path];
+  if (not node)
+    {
+      node = std::make_shared<Node>();
+      node->ino = nextIno_++;
+    }
+  node->isDir = isDir;
+  node->mode = mode;
+  node->mtime = mtime;
+  return node;
+}
+
+
+std::string
+Vfs::resolve(int dirFd, const std::string& path, int& error) const
+{
+  error = 0;
+  if (path.empty())
+    {
+      error = -ENOENT;
+      return "";
+    }
+
+  std::string base;
+  if (path.front() == '/')
+    base = "/";
+  else if (dirFd == atCwd)
+    base = cwd_;
+  else
+    {
+      size_t ix = dirFd - firstFd;
+      if (dirFd < firstFd or ix >= files_.size() or not files_.at(ix).node)
+	{
+	  error = -EBADF;
+	  return "";
+	}
+      if (not files_.at(ix).node->isDir)
+	{
+	  error = -ENOTDIR;
+	  return "";
+	}
+      base = files_.at(ix).path;
+    }
+
+  // Apply the components of path to those of base.
+  std::vector<std::string> parts;
+  const std::string* strs[] = { &base, &path };
+  for (const std::string* str : strs)
+    {
+      std::istringstream iss(*str);
+      std::string part;
+      while (std::getline(iss, part, '/'))
+	{
+	  if (part.empty() or part == ".")
+	    continue;
+	  if (part == "..")
+	    {
+	      if (not parts.empty())
+		parts.pop_back();
+	    }
+	  else
+	    parts.push_back(part);
+	}
+    }
+
+  std::string result;
+  for (const auto& part : parts)
+    result += "/" + part;
+  return result.empty() ? "/" : result;
+}
+
+
+std::shared_ptr<Vfs::Node>
+Vfs::find(const std::string& path) const
+{
+  auto iter = nodes_.find(path);
+  return iter == nodes_.end() ? nullptr : iter->second;
+}
+
+
+Vfs::OpenFile*
+Vfs::openFile(int fd)
+{
+  size_t ix = fd - firstFd;
+  if (fd < firstFd or ix >= files_.size() or not files_.at(ix).node)
+    return nullptr;
+  return &files_.at(ix);
+}
+
+
+bool
+Vfs::isOpen(int fd) const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t ix = fd - firstFd;
+  return fd >= firstFd and ix < files_.size() and files_.at(ix).node;
+}
+
+
+int
+Vfs::fromNewlibFlags(int flags)
+{
+  int result = flags & AccessMode;
+  if (flags & 0x8)   result |= Append;
+  if (flags & 0x200) result |= Create;
+  if (flags & 0x400) result |= Truncate;
+  if (flags & 0x800) result |= Exclusive;
+  return result;
+}
+
+
+int
+Vfs::open(int dirFd, const std::string& path, int flags, unsigned mode)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  int error = 0;
+  std::string target = resolve(dirFd, path, error);
+  if (error)
+    return error;
+
+  int access = flags & AccessMode;
+  auto node = find(target);
+  if (node)
+    {
+      if ((flags & Create) and (flags & Exclusive))
+	return -EEXIST;
+      if (node->isDir and access != ReadOnly)
+	return -EISDIR;
+      if ((flags & Directory) and not node->isDir)
+	return -ENOTDIR;
+      if ((flags & Truncate) and access != ReadOnly)
+	node->data.clear();
+    }
+  else
+    {
+      if (not (flags & Create))
+	return -ENOENT;
+      auto parent = find(parentOf(target));
+      if (not parent)
+	return -ENOENT;
+      if (not parent->isDir)
+	return -ENOTDIR;
+      node = addNode(target, false, mode & 07777, 0);
+    }
+
+  // Use lowest free descriptor.
+  size_t ix = 0;
+  while (ix < files_.size() and files_.at(ix).node)
+    ix++;
+  if (ix == files_.size())
+    files_.resize(ix + 1);
+
+  OpenFile& file = files_.at(ix);
+  file.node = node;
+  file.path = target;
+  file.offset = 0;
+  file.flags = flags;
+  return int(ix) + firstFd;
+}
+
+
+int
+Vfs::close(int fd)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpenFile* file = openFile(fd);
+  if (not file)
+    return -EBADF;
+  *file = OpenFile();
+  return 0;
+}
+
+
+int64_t
+Vfs::read(int fd, void* data, size_t size)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpenFile* file = openFile(fd);
+  if (not file or (file->flags & AccessMode) == WriteOnly)
+    return -EBADF;
+  if (file->node->isDir)
+    return -EISDIR;
+
+  const auto& bytes = file->node->data;
+  if (file->offset >= bytes.size())
+    return 0;
+  size = std::min(size, size_t(bytes.size() - file->offset));
+  memcpy(data, bytes.data() + file->offset, size);
+  file->offset += size;
+  return size;
+}
+
+
+int64_t
+Vfs::write(int fd, const void* data, size_t size)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpenFile* file = openFile(fd);
+  if (not file or (file->flags & AccessMode) == ReadOnly)
+    return -EBADF;
+
+  auto& bytes = file->node->data;
+  if (file->flags & Append)
+    file->offset = bytes.size();
+  if (file->offset + size > bytes.size())
+    bytes.resize(file->offset + size);
+  memcpy(bytes.data() + file->offset, data, size);
+  file->offset += size;
+  return size;
+}
+
+
+int64_t
+Vfs::lseek(int fd, int64_t offset, int whence)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpenFile* file = openFile(fd);
+  if (not file)
+    return -EBADF;
+
+  int64_t base = 0;
+  if (whence == seekCur)
+    base = file->offset;
+  else if (whence == seekEnd)
+    base = file->node->data.size();
+  else if (whence != seekSet)
+    return -EINVAL;
+
+  if (base + offset < 0)
+    return -EINVAL;
+  file->offset = base + offset;
+  return file->offset;
+}
+
+
+int
+Vfs::ftruncate(int fd, int64_t size)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpenFile* file = openFile(fd);
+  if (not file or (file->flags & AccessMode) == ReadOnly)
+    return -EBADF;
+  if (file->node->isDir or size < 0)
+    return -EINVAL;
+  file->node->data.resize(size);
+  return 0;
+}
+
+
+int
+Vfs::fcntl(int fd, int cmd, int64_t arg)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpenFile* file = openFile(fd);
+  if (not file)
+    return -EBADF;
+
+  if (cmd == fGetFl)
+    return file->flags;
+  if (cmd == fSetFl)
+    {
+      file->flags = (file->flags & ~Append) | (arg & Append);
+      return 0;
+    }
+  if (cmd == fGetFd or cmd == fSetFd)
+    return 0;
+  return -EINVAL;
+}
+
+
+void
+Vfs::fillStat(const Node& node, struct stat& buff) const
+{
+  memset(&buff, 0, sizeof(buff));
+  buff.st_dev = 1;
+  buff.st_ino = node.ino;
+  buff.st_mode = (node.isDir ? S_IFDIR : S_IFREG) | node.mode;
+  buff.st_nlink = node.isDir ? 2 : 1;
+  buff.st_size = node.data.size();
+  buff.st_atime = buff.st_mtime = buff.st_ctime = node.mtime;
+#ifndef __MINGW64__
+  buff.st_blksize = 4096;
+  buff.st_blocks = (node.data.size() + 511) / 512;
+#endif
+}
+
+
+int
+Vfs::fstat(int fd, struct stat& buff)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpenFile* file = openFile(fd);
+  if (not file)
+    return -EBADF;
+  fillStat(*file->node, buff);
+  return 0;
+}
+
+
+int
+Vfs::fstatat(int dirFd, const std::string& path, struct stat& buff,
+	     int flags)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (path.empty() and (flags & atEmptyPath))
+    {
+      OpenFile* file = openFile(dirFd);
+      if (not file)
+	return -EBADF;
+      fillStat(*file->node, buff);
+      return 0;
+    }
+
+  int error = 0;
+  std::string target = resolve(dirFd, path, error);
+  if (error)
+    return error;
+  auto node = find(target);
+  if (not node)
+    return -ENOENT;
+  fillStat(*node, buff);
+  return 0;
+}
+
+
+int
+Vfs::mkdirat(int dirFd, const std::string& path, unsigned mode)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  int error = 0;
+  std::string target = resolve(dirFd, path, error);
+  if (error)
+    return error;
+  if (find(target))
+    return -EEXIST;
+  auto parent = find(parentOf(target));
+  if (not parent)
+    return -ENOENT;
+  if (not parent->isDir)
+    return -ENOTDIR;
+  addNode(target, true, mode & 07777, 0);
+  return 0;
+}
+
+
+int
+Vfs::unlinkat(int dirFd, const std::string& path, int flags)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  int error = 0;
+  std::string target = resolve(dirFd, path, error);
+  if (error)
+    return error;
+  auto iter = nodes_.find(target);
+  if (iter == nodes_.end())
+    return -ENOENT;
+
+  bool isDir = iter->second->isDir;
+  if (flags & atRemoveDir)
+    {
+      if (not isDir)
+	return -ENOTDIR;
+      if (target == "/")
+	return -EBUSY;
+      auto next = nodes_.lower_bound(target + "/");
+      if (next != nodes_.end() and isUnder(target, next->first))
+	return -ENOTEMPTY;
+    }
+  else if (isDir)
+    return -EISDIR;
+
+  // Open files keep their node.
+  nodes_.erase(iter);
+  return 0;
+}
+
+
+int64_t
+Vfs::getdents64(int fd, void* data, size_t size)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  OpenFile* file = openFile(fd);
+  if (not file)
+    return -EBADF;
+  if (not file->node->isDir)
+    return -ENOTDIR;
+
+  // Entries: ".", "..", then the children in name order. The file
+  // offset is the index of the next entry.
+  struct Entry { std::string name; uint64_t ino; uint8_t type; };
+  std::vector<Entry> entries;
+  entries.push_back({ ".", file->node->ino, dtDir });
+  auto parent = find(parentOf(file->path));
+  entries.push_back({ "..", parent ? parent->ino : file->node->ino, dtDir });
+
+  // Paths below dir are contiguous in the map starting at dir + "/".
+  const std::string& dir = file->path;
+  std::string prefix = dir == "/" ? dir : dir + "/";
+  for (auto iter = nodes_.lower_bound(prefix); iter != nodes_.end(); ++iter)
+    {
+      const std::string& path = iter->first;
+      if (path.compare(0, prefix.size(), prefix) != 0)
+	break;
+      std::string name = path.substr(prefix.size());
+      if (not name.empty() and name.find('/') == std::string::npos)
+	entries.push_back({ name, iter->second->ino,
+			    iter->second->isDir ? dtDir : dtReg });
+    }
+
+  uint8_t* out = static_cast<uint8_t*>(data);
+  size_t filled = 0;
+  for (size_t ix = file->offset; ix < entries.size(); ++ix)
+    {
+      // struct linux_dirent64: ino, off, reclen, type, name.
+      const Entry& entry = entries.at(ix);
+      size_t reclen = (19 + entry.name.size() + 1 + 7) / 8 * 8;
+      if (filled + reclen > size)
+	{
+	  if (filled == 0)
+	    return -EINVAL;
+	  break;
+	}
+
+      uint8_t* rec = out + filled;
+      memset(rec, 0, reclen);
+      uint64_t ino = entry.ino;
+      int64_t off = ix + 1;
+      uint16_t len = reclen;
+      memcpy(rec, &ino, 8);
+      memcpy(rec + 8, &off, 8);
+      memcpy(rec + 16, &len, 2);
+      rec[18] = entry.type;
+      memcpy(rec + 19, entry.name.c_str(), entry.name.size());
+
+      filled += reclen;
+      file->offset = ix + 1;
+    }
+
+  return filled;
+}
+
+
+int
+Vfs::chdir(const std::string& path)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  int error = 0;
+  std::string target = resolve(atCwd, path, error);
+  if (error)
+    return error;
+  auto node = find(target);
+  if (not node)
+    return -ENOENT;
+  if (not node->isDir)
+    return -ENOTDIR;
+  cwd_ = target;
+  return 0;
+}
+
+
+std::string
+Vfs::getcwd() const
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cwd_;
+}
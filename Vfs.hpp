@@ -0,0 +1,175 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+
+namespace WdRiscv
+{
+
+  /// In-memory file system used to service the file related system
+  /// calls of the target program (see Hart::emulateSyscall) without
+  /// touching the host file system. It is loaded from a host
+  /// directory, a tar file, or a manifest file, and changes made by
+  /// the target program are discarded at the end of the run.
+  ///
+  /// Flags, whence values and error numbers are those of the RISCV
+  /// Linux ABI. Methods return a non-negative value on success and
+  /// the negative of an error number (e.g. -ENOENT) on failure.
+  class Vfs
+  {
+  public:
+
+    /// Open flags of the RISCV Linux ABI.
+    enum OpenFlags : int
+      {
+	ReadOnly = 0, WriteOnly = 1, ReadWrite = 2, AccessMode = 3,
+	Create = 0100, Exclusive = 0200, Truncate = 01000, Append = 02000,
+	Directory = 0200000
+      };
+
+    /// Directory file descriptor standing for the current directory.
+    static constexpr int atCwd = -100;
+
+    /// Unlinkat flag: remove a directory.
+    static constexpr int atRemoveDir = 0x200;
+
+    /// Fstatat flag: operate on the directory file descriptor if the
+    /// path is empty.
+    static constexpr int atEmptyPath = 0x1000;
+
+    /// Smallest file descriptor allocated by open (0, 1 and 2 remain
+    /// the host standard streams).
+    static constexpr int firstFd = 3;
+
+    /// Construct an empty file system (root directory only).
+    Vfs();
+
+    /// Deep copy: The copy does not share file contents with other.
+    Vfs(const Vfs& other);
+
+    /// Load the given host path: A directory is loaded recursively. A
+    /// file is loaded as a tar archive if it has a ustar header and
+    /// as a manifest otherwise: One "<target-path> <host-file>" pair
+    /// per line, empty lines and lines starting with # are
+    /// ignored. Return true on success. Print an error message and
+    /// return false on failure.
+    bool load(const std::string& path);
+
+    /// Return true if fd is a file descriptor of this file system.
+    bool isOpen(int fd) const;
+
+    /// Convert newlib open flags to those of the Linux ABI.
+    static int fromNewlibFlags(int flags);
+
+    /// Open the file at the given path relative to the given directory
+    /// file descriptor (or atCwd). Return the file descriptor.
+    int open(int dirFd, const std::string& path, int flags, unsigned mode);
+
+    int close(int fd);
+
+    /// Copy up to size bytes from the given file to data. Return the
+    /// number of bytes copied.
+    int64_t read(int fd, void* data, size_t size);
+
+    /// Copy size bytes from data to the given file. Return size.
+    int64_t write(int fd, const void* data, size_t size);
+
+    int64_t lseek(int fd, int64_t offset, int whence);
+
+    int ftruncate(int fd, int64_t size);
+
+    int fcntl(int fd, int cmd, int64_t arg);
+
+    int fstat(int fd, struct stat& buff);
+
+    /// Stat the file at the given path relative to the given
+    /// directory file descriptor (or atCwd).
+    int fstatat(int dirFd, const std::string& path, struct stat& buff,
+		int flags);
+
+    int mkdirat(int dirFd, const std::string& path, unsigned mode);
+
+    int unlinkat(int dirFd, const std::string& path, int flags);
+
+    /// Fill data with up to size bytes of Linux dirent64 records of
+    /// the given directory. Return the number of bytes filled (zero at
+    /// the end of the directory).
+    int64_t getdents64(int fd, void* data, size_t size);
+
+    int chdir(const std::string& path);
+
+    /// Return the current directory.
+    std::string getcwd() const;
+
+  private:
+
+    struct Node
+    {
+      bool isDir = false;
+      unsigned mode = 0;      // Permission bits.
+      uint64_t ino = 0;
+      int64_t mtime = 0;
+      std::vector<uint8_t> data;
+    };
+
+    struct OpenFile
+    {
+      std::shared_ptr<Node> node;  // Null if descriptor is free.
+      std::string path;
+      uint64_t offset = 0;
+      int flags = 0;
+    };
+
+    /// Return the normalized absolute form of the given path relative
+    /// to the given directory file descriptor. Set error to the
+    /// negative of an error number on failure.
+    std::string resolve(int dirFd, const std::string& path, int& error) const;
+
+    /// Return the node at the given absolute path or null.
+    std::shared_ptr<Node> find(const std::string& path) const;
+
+    /// Return the open file of the given descriptor or null.
+    OpenFile* openFile(int fd);
+
+    /// Add a node at the given absolute path creating missing parent
+    /// directories. Return the node.
+    std::shared_ptr<Node> addNode(const std::string& path, bool isDir,
+				  unsigned mode, int64_t mtime);
+
+    void fillStat(const Node& node, struct stat& buff) const;
+
+    bool loadDirectory(const std::string& path);
+    bool loadTar(const std::string& path, const std::vector<uint8_t>& bytes);
+    bool loadManifest(const std::string& path);
+
+    std::map<std::string, std::shared_ptr<Node>> nodes_;  // By absolute path.
+    std::vector<OpenFile> files_;   // Indexed by fd - firstFd.
+    std::string cwd_ = "/";
+    uint64_t nextIno_ = 1;
+    mutable std::mutex mutex_;      // Harts of a system share a Vfs.
+  };
+}
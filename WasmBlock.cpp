@@ -0,0 +1,253 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "WasmBlock.hpp"
+
+
+using namespace WdRiscv;
+
+
+// WebAssembly opcodes used by the generator (i32 form, i64 form).
+namespace
+{
+  enum WasmOp : uint8_t
+    {
+      End = 0x0b,
+      I32Load = 0x28, I64Load = 0x29, I32Store = 0x36, I64Store = 0x37,
+      I32Const = 0x41, I64Const = 0x42,
+      I32LtS = 0x48, I32LtU = 0x49, I64LtS = 0x53, I64LtU = 0x54,
+      I32Add = 0x6a, I32Sub = 0x6b, I32And = 0x71, I32Or = 0x72,
+      I32Xor = 0x73, I32Shl = 0x74, I32ShrS = 0x75, I32ShrU = 0x76,
+      I64Add = 0x7c, I64Sub = 0x7d, I64And = 0x83, I64Or = 0x84,
+      I64Xor = 0x85, I64Shl = 0x86, I64ShrS = 0x87, I64ShrU = 0x88,
+      I64ExtendI32U = 0xad
+    };
+}
+
+
+WasmBlock::WasmBlock(bool rv64, uint32_t regsAddr)
+  : rv64_(rv64), regsAddr_(regsAddr)
+{
+}
+
+
+void
+WasmBlock::appendUleb(std::vector<uint8_t>& vec, uint64_t value)
+{
+  do
+    {
+      uint8_t byte = value & 0x7f;
+      value >>= 7;
+      if (value)
+	byte |= 0x80;
+      vec.push_back(byte);
+    }
+  while (value);
+}
+
+
+void
+WasmBlock::appendSleb(std::vector<uint8_t>& vec, int64_t value)
+{
+  while (true)
+    {
+      uint8_t byte = value & 0x7f;
+      value >>= 7;  // Arithmetic shift.
+      bool done = ((value == 0 and (byte & 0x40) == 0) or
+		   (value == -1 and (byte & 0x40) != 0));
+      if (not done)
+	byte |= 0x80;
+      vec.push_back(byte);
+      if (done)
+	break;
+    }
+}
+
+
+void
+WasmBlock::emitRegRead(unsigned reg)
+{
+  unsigned width = rv64_ ? 8 : 4;
+  body_.push_back(I32Const);
+  appendSleb(body_, int32_t(regsAddr_ + reg*width));
+  emitOp(I32Load, I64Load);
+  body_.push_back(rv64_ ? 3 : 2);  // Alignment (log2).
+  body_.push_back(0);              // Offset.
+}
+
+
+void
+WasmBlock::emitConst(int64_t value)
+{
+  if (rv64_)
+    {
+      body_.push_back(I64Const);
+      appendSleb(body_, value);
+    }
+  else
+    {
+      body_.push_back(I32Const);
+      appendSleb(body_, int32_t(value));
+    }
+}
+
+
+bool
+WasmBlock::add(const DecodedInst& di)
+{
+  InstId id = di.instEntry()->instId();
+  if (not isSupported(id))
+    return false;
+
+  count_++;
+
+  unsigned rd = di.op0();
+  if (rd == 0)
+    return true;   // Writes to x0 have no effect.
+
+  unsigned width = rv64_ ? 8 : 4;
+  body_.push_back(I32Const);  // Address of destination register.
+  appendSleb(body_, int32_t(regsAddr_ + rd*width));
+
+  int64_t imm = di.op2AsInt();   // Sign extended immediate.
+  bool compare = false;          // True if result is an i32 boolean.
+
+  switch (id)
+    {
+    case InstId::lui:
+    case InstId::c_lui:
+      emitConst(int32_t(di.op1()));
+      break;
+
+    case InstId::addi:
+    case InstId::c_addi:
+    case InstId::c_li:
+    case InstId::c_addi16sp:
+    case InstId::c_addi4spn:
+      emitRegRead(di.op1()); emitConst(imm); emitOp(I32Add, I64Add);
+      break;
+
+    case InstId::slti:
+      emitRegRead(di.op1()); emitConst(imm); emitOp(I32LtS, I64LtS);
+      compare = true;
+      break;
+
+    case InstId::sltiu:
+      // Immediate is zero extended from 32 bits as in execSltiu.
+      emitRegRead(di.op1()); emitConst(int64_t(uint64_t(di.op2())));
+      emitOp(I32LtU, I64LtU);
+      compare = true;
+      break;
+
+    case InstId::xori:
+      emitRegRead(di.op1()); emitConst(imm); emitOp(I32Xor, I64Xor);
+      break;
+
+    case InstId::ori:
+      emitRegRead(di.op1()); emitConst(imm); emitOp(I32Or, I64Or);
+      break;
+
+    case InstId::andi:
+    case InstId::c_andi:
+      emitRegRead(di.op1()); emitConst(imm); emitOp(I32And, I64And);
+      break;
+
+    default:
+      // Register-register forms: rd = rs1 op rs2
+      emitRegRead(di.op1());
+      emitRegRead(di.op2());
+      switch (id)
+	{
+	case InstId::add: case InstId::c_add: case InstId::c_mv:
+	  emitOp(I32Add, I64Add); break;
+	case InstId::sub: case InstId::c_sub:
+	  emitOp(I32Sub, I64Sub); break;
+	case InstId::sll: emitOp(I32Shl, I64Shl); break;
+	case InstId::srl: emitOp(I32ShrU, I64ShrU); break;
+	case InstId::sra: emitOp(I32ShrS, I64ShrS); break;
+	case InstId::slt: emitOp(I32LtS, I64LtS); compare = true; break;
+	case InstId::sltu: emitOp(I32LtU, I64LtU); compare = true; break;
+	case InstId::xor_: case InstId::c_xor:
+	  emitOp(I32Xor, I64Xor); break;
+	case InstId::or_: case InstId::c_or:
+	  emitOp(I32Or, I64Or); break;
+	default:  // and, c.and
+	  emitOp(I32And, I64And); break;
+	}
+      break;
+    }
+
+  // Wasm shifts use the shift amount modulo the operand width which
+  // matches the register shift instructions. Comparisons produce an
+  // i32 which must be widened for a 64-bit register.
+  if (compare and rv64_)
+    body_.push_back(I64ExtendI32U);
+
+  emitOp(I32Store, I64Store);
+  body_.push_back(rv64_ ? 3 : 2);  // Alignment (log2).
+  body_.push_back(0);              // Offset.
+  return true;
+}
+
+
+std::vector<uint8_t>
+WasmBlock::module() const
+{
+  std::vector<uint8_t> mod = { 0x00, 0x61, 0x73, 0x6d,   // "\0asm"
+			       0x01, 0x00, 0x00, 0x00 }; // Version 1.
+
+  auto addSection = [&mod](uint8_t id, const std::vector<uint8_t>& content) {
+    mod.push_back(id);
+    appendUleb(mod, content.size());
+    mod.insert(mod.end(), content.begin(), content.end());
+  };
+
+  // Type section: one function type [] -> [].
+  addSection(1, { 0x01, 0x60, 0x00, 0x00 });
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+  // Import section: env.memory, shared (the heap of the build with
+  // threads is a SharedArrayBuffer) with a minimum of 1 page and a
+  // maximum of 65536 pages (a shared memory must have a maximum).
+  addSection(2, { 0x01, 0x03, 'e', 'n', 'v',
+		  0x06, 'm', 'e', 'm', 'o', 'r', 'y', 0x02, 0x03, 0x01,
+		  0x80, 0x80, 0x04 });
+#else
+  // Import section: env.memory with a minimum of 1 page and no maximum.
+  addSection(2, { 0x01, 0x03, 'e', 'n', 'v',
+		  0x06, 'm', 'e', 'm', 'o', 'r', 'y', 0x02, 0x00, 0x01 });
+#endif
+
+  // Function section: one function of type 0.
+  addSection(3, { 0x01, 0x00 });
+
+  // Export section: function 0 as "run".
+  addSection(7, { 0x01, 0x03, 'r', 'u', 'n', 0x00, 0x00 });
+
+  // Code section: one body with no locals.
+  std::vector<uint8_t> func = { 0x00 };  // No locals.
+  func.insert(func.end(), body_.begin(), body_.end());
+  func.push_back(End);
+
+  std::vector<uint8_t> code = { 0x01 };
+  appendUleb(code, func.size());
+  code.insert(code.end(), func.begin(), func.end());
+  addSection(10, code);
+
+  return mod;
+}
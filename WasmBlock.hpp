@@ -0,0 +1,86 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "DecodedInst.hpp"
+#include "BasicBlock.hpp"
+
+
+namespace WdRiscv
+{
+
+  /// Generate a WebAssembly module for a straight-line sequence of
+  /// integer register-to-register instructions (the pure operations
+  /// of a hot basic block). The module imports the memory of the
+  /// simulator ("env" "memory") and exports a function "run" of type
+  /// [] -> [] that updates the integer register file in place.  It is
+  /// used by the Emscripten build where the register file lives in
+  /// the wasm heap.
+  class WasmBlock
+  {
+  public:
+
+    /// Constructor: regsAddr is the heap address of the integer
+    /// register file (an array of 32 4-byte/8-byte registers
+    /// depending on rv64).
+    WasmBlock(bool rv64, uint32_t regsAddr);
+
+    /// Return true if given instruction can be compiled (see
+    /// isCompilableInst).
+    static bool isSupported(InstId id)
+    { return isCompilableInst(id); }
+
+    /// Append the given instruction to the generated function. Return
+    /// false if instruction is not supported.
+    bool add(const DecodedInst& di);
+
+    /// Return the bytes of the module containing the instructions
+    /// added so far.
+    std::vector<uint8_t> module() const;
+
+    /// Return the number of instructions added.
+    unsigned instCount() const
+    { return count_; }
+
+  protected:
+
+    /// Emit a load of the given integer register on the wasm stack.
+    void emitRegRead(unsigned reg);
+
+    /// Emit a constant of the register width.
+    void emitConst(int64_t value);
+
+    /// Emit the i32 or i64 form of an opcode depending on rv64.
+    void emitOp(uint8_t op32, uint8_t op64)
+    { body_.push_back(rv64_ ? op64 : op32); }
+
+    /// Append value to given vector in LEB128 format.
+    static void appendUleb(std::vector<uint8_t>& vec, uint64_t value);
+    static void appendSleb(std::vector<uint8_t>& vec, int64_t value);
+
+  private:
+
+    bool rv64_;
+    uint32_t regsAddr_;
+    unsigned count_ = 0;
+    std::vector<uint8_t> body_;   // Function body instructions.
+  };
+}
@@ -23,7 +23,24 @@
 
 enum WhisperMessageType { Peek, Poke, Step, Until, Change, ChangeCount,
 			  Quit, Invalid, Reset, Exception, EnterDebug,
-			  ExitDebug, LoadFinished };
+			  ExitDebug, LoadFinished, StepBatch, Format, Undo };
+
+// Flags of a StepBatch request.
+enum WhisperStepBatchFlags { BatchStopAtPc = 1 };
+
+// Stop reason (flags field) of a StepBatch reply.
+enum WhisperStepBatchStop { BatchCountReached, BatchPcReached,
+			    BatchHartStopped };
+
+// Flags of an instruction record in a StepBatch reply.
+enum WhisperStepBatchInstFlags { BatchInterrupted = 1, BatchPreTrigger = 2,
+				 BatchPostTrigger = 4, BatchPcJump = 8 };
+
+// Encoding of the StepBatch payload (value field of a Format message).
+enum WhisperChangeFormat { ChangeFormatFull, ChangeFormatCompact };
+
+// Action of an Undo request (value field).
+enum WhisperUndoAction { UndoBegin, UndoRollback, UndoEnd };
 
 // Be careful changing this: test-bench file (defines.svh) needs to be
 // updated.
@@ -39,6 +56,55 @@ enum WhisperExceptionType { InstAccessFault, DataAccessFault,
 /// the program-counter of the last executed instruction, the resource
 /// is set to the opcode of that instruction and the value is set to
 /// the number of change records generated by that instruction.
+///
+/// A StepBatch request executes up to value instructions in one round
+/// trip. If the BatchStopAtPc flag is set, execution also stops once
+/// the next instruction is at address. Execution stops early if the
+/// hart cannot be stepped (not started or in debug halt). The
+/// StepBatch reply has the count of executed instructions in value,
+/// the stop reason (WhisperStepBatchStop) in flags and, in address, the
+/// size in bytes of a packed payload sent right after the reply. The
+/// payload has one record per executed instruction. Each record is a
+/// 64-bit pc, a 32-bit opcode, an 8-bit mask of
+/// WhisperStepBatchInstFlags, and a 16-bit change count. These are
+/// followed by the changes, in the order of the Change replies of a
+/// Step. Each change is an 8-bit resource ('r', 'f', 'c' or 'm'), a
+/// 64-bit address and a 64-bit value. All payload integers are in
+/// network byte order.
+///
+/// A Format request with ChangeFormatCompact in value, sent at
+/// connection setup, selects the compact payload encoding. The reply
+/// echoes the request. An unsupported format gets an Invalid reply and
+/// the format is unchanged. The default is ChangeFormatFull. In
+/// compact form, unsigned and signed (zig-zag) LEB128 varints are
+/// written uleb and sleb. Other integers are big-endian.
+///   Record: an 8-bit mask of WhisperStepBatchInstFlags. If BatchPcJump
+///   is set, the sleb difference between the pc and the expected pc
+///   follows. The expected pc is the address after the previous
+///   record. It is zero after Format and Reset. Then comes the opcode
+///   in memory (little-endian) order: 2 bytes if compressed, 4
+///   otherwise. The size is given by the first byte. Then come the
+///   uleb change count and the changes.
+///   Change: a tag byte holding the resource in bits 0-1 (0 'r',
+///   1 'f', 2 'c', 3 'm') and the value byte count (0 to 8) in bits
+///   4-7. Then the register number (one byte) for 'r' and 'f', the
+///   uleb key for 'c', or, for 'm', the sleb difference from the
+///   address of the previous 'm' change (zero after Format and
+///   Reset). The value follows with its leading zero bytes removed.
+///
+/// An Until request runs the hart until the pc reaches address or the
+/// run stops (to-host write, instruction limit, breakpoint). The
+/// reply echoes the request with the number of executed instructions
+/// in value and the pc in address. It is Invalid while an undo log is
+/// active.
+///
+/// An Undo request with UndoBegin in value starts recording an undo
+/// log for the hart (see Hart::beginUndoLog): subsequent Step and
+/// StepBatch requests may then be undone by an Undo request with
+/// UndoRollback, or kept by one with UndoEnd. The reply echoes the
+/// request with the number of changes recorded before the request in
+/// value. Rollback or end without an active log, or an unknown
+/// action, gets an Invalid reply.
 struct WhisperMessage
 {
 #ifdef __cplusplus
@@ -0,0 +1,301 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cstring>
+#include "X86Block.hpp"
+
+#ifdef X86_BLOCKS
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+using namespace WdRiscv;
+
+
+// x86-64 encodings used by the generator. Host registers: rax (0) and
+// rcx (1) hold operands, rdi (7) holds the address of the register
+// file.
+namespace
+{
+  enum X86Op : uint8_t
+    {
+      AddRm = 0x01, OrRm = 0x09, AndRm = 0x21, SubRm = 0x29, XorRm = 0x31,
+      CmpRm = 0x39,                          // op r/m, r
+      AddAx = 0x05, OrAx = 0x0d, AndAx = 0x25, XorAx = 0x35,
+      CmpAx = 0x3d,                          // op eax/rax, imm32
+      MovRm = 0x89, MovR = 0x8b,             // mov r/m, r  and  mov r, r/m
+      MovEax = 0xb8, MovEcx = 0xb9,          // mov reg, imm32
+      MovImm = 0xc7,                         // mov r/m, imm32
+      ShiftCl = 0xd3,                        // shl/shr/sar r/m, cl
+      TwoByte = 0x0f, SetL = 0x9c, SetB = 0x92, MovzxB = 0xb6,
+      MovAbsRdi = 0xbf, Ret = 0xc3
+    };
+
+  // ModRM bytes of register-direct operands.
+  constexpr uint8_t raxRcx = 0xc8;   // r/m rax, reg rcx.
+  constexpr uint8_t raxRax = 0xc0;   // r/m rax, reg rax.
+  constexpr uint8_t shlRax = 0xe0, shrRax = 0xe8, sarRax = 0xf8;
+}
+
+
+X86Block::X86Block(bool rv64, uintptr_t regsAddr)
+  : rv64_(rv64), regsAddr_(regsAddr)
+{
+}
+
+
+void
+X86Block::emitImm32(uint32_t value)
+{
+  for (unsigned i = 0; i < 4; ++i, value >>= 8)
+    body_.push_back(uint8_t(value));
+}
+
+
+void
+X86Block::emitRegOperand(unsigned field, unsigned reg)
+{
+  unsigned disp = reg * (rv64_ ? 8 : 4);
+  if (disp < 0x80)
+    {
+      body_.push_back(uint8_t(0x40 | (field << 3) | 7));  // [rdi + disp8]
+      body_.push_back(uint8_t(disp));
+    }
+  else
+    {
+      body_.push_back(uint8_t(0x80 | (field << 3) | 7));  // [rdi + disp32]
+      emitImm32(disp);
+    }
+}
+
+
+void
+X86Block::emitRegRead(unsigned host, unsigned reg)
+{
+  if (reg == 0)
+    {
+      // xor host, host: x0 reads as zero.
+      body_.push_back(XorRm);
+      body_.push_back(uint8_t(0xc0 | (host << 3) | host));
+      return;
+    }
+  emitRexW();
+  body_.push_back(MovR);
+  emitRegOperand(host, reg);
+}
+
+
+void
+X86Block::emitRegWrite(unsigned reg)
+{
+  emitRexW();
+  body_.push_back(MovRm);
+  emitRegOperand(0, reg);
+}
+
+
+bool
+X86Block::add(const DecodedInst& di)
+{
+  InstId id = di.instEntry()->instId();
+  if (not isSupported(id))
+    return false;
+
+  count_++;
+
+  unsigned rd = di.op0();
+  if (rd == 0)
+    return true;   // Writes to x0 have no effect.
+
+  uint32_t imm = uint32_t(di.op2AsInt());  // Sign extended by the CPU.
+  uint8_t setcc = 0;   // Set rax to the given condition if non-zero.
+
+  switch (id)
+    {
+    case InstId::lui:
+    case InstId::c_lui:
+      if (rv64_)
+	{
+	  // mov rax, imm32 (sign extended)
+	  emitRexW(); body_.push_back(MovImm); body_.push_back(raxRax);
+	}
+      else
+	body_.push_back(MovEax);
+      emitImm32(di.op1());
+      break;
+
+    case InstId::addi:
+    case InstId::c_addi:
+    case InstId::c_li:
+    case InstId::c_addi16sp:
+    case InstId::c_addi4spn:
+      emitRegRead(0, di.op1()); emitRexW(); body_.push_back(AddAx);
+      emitImm32(imm);
+      break;
+
+    case InstId::slti:
+      emitRegRead(0, di.op1()); emitRexW(); body_.push_back(CmpAx);
+      emitImm32(imm);
+      setcc = SetL;
+      break;
+
+    case InstId::sltiu:
+      // Immediate is zero extended from 32 bits as in execSltiu.
+      emitRegRead(0, di.op1());
+      if (rv64_)
+	{
+	  body_.push_back(MovEcx); emitImm32(di.op2());
+	  emitRexW(); body_.push_back(CmpRm); body_.push_back(raxRcx);
+	}
+      else
+	{
+	  body_.push_back(CmpAx); emitImm32(di.op2());
+	}
+      setcc = SetB;
+      break;
+
+    case InstId::xori:
+      emitRegRead(0, di.op1()); emitRexW(); body_.push_back(XorAx);
+      emitImm32(imm);
+      break;
+
+    case InstId::ori:
+      emitRegRead(0, di.op1()); emitRexW(); body_.push_back(OrAx);
+      emitImm32(imm);
+      break;
+
+    case InstId::andi:
+    case InstId::c_andi:
+      emitRegRead(0, di.op1()); emitRexW(); body_.push_back(AndAx);
+      emitImm32(imm);
+      break;
+
+    default:
+      // Register-register forms: rax = rax op rcx. Host shifts use the
+      // shift amount modulo the operand width which matches the
+      // register shift instructions.
+      emitRegRead(0, di.op1());
+      emitRegRead(1, di.op2());
+      emitRexW();
+      switch (id)
+	{
+	case InstId::add: case InstId::c_add: case InstId::c_mv:
+	  body_.push_back(AddRm); body_.push_back(raxRcx); break;
+	case InstId::sub: case InstId::c_sub:
+	  body_.push_back(SubRm); body_.push_back(raxRcx); break;
+	case InstId::sll:
+	  body_.push_back(ShiftCl); body_.push_back(shlRax); break;
+	case InstId::srl:
+	  body_.push_back(ShiftCl); body_.push_back(shrRax); break;
+	case InstId::sra:
+	  body_.push_back(ShiftCl); body_.push_back(sarRax); break;
+	case InstId::slt:
+	  body_.push_back(CmpRm); body_.push_back(raxRcx); setcc = SetL; break;
+	case InstId::sltu:
+	  body_.push_back(CmpRm); body_.push_back(raxRcx); setcc = SetB; break;
+	case InstId::xor_: case InstId::c_xor:
+	  body_.push_back(XorRm); body_.push_back(raxRcx); break;
+	case InstId::or_: case InstId::c_or:
+	  body_.push_back(OrRm); body_.push_back(raxRcx); break;
+	default:  // and, c.and
+	  body_.push_back(AndRm); body_.push_back(raxRcx); break;
+	}
+      break;
+    }
+
+  if (setcc)
+    {
+      // setcc al; movzx eax, al (clears the upper bits of rax).
+      body_.insert(body_.end(), { TwoByte, setcc, raxRax });
+      body_.insert(body_.end(), { TwoByte, MovzxB, raxRax });
+    }
+
+  emitRegWrite(rd);
+  return true;
+}
+
+
+std::vector<uint8_t>
+X86Block::code() const
+{
+  // movabs rdi, regsAddr
+  std::vector<uint8_t> code = { 0x48, MovAbsRdi };
+  uint64_t addr = regsAddr_;
+  for (unsigned i = 0; i < 8; ++i, addr >>= 8)
+    code.push_back(uint8_t(addr));
+
+  code.insert(code.end(), body_.begin(), body_.end());
+  code.push_back(Ret);
+  return code;
+}
+
+
+uintptr_t
+X86Block::install(const std::vector<uint8_t>& code, uintptr_t slot)
+{
+#ifdef X86_BLOCKS
+  if (code.size() > slotSize)
+    return 0;
+
+  void* page = reinterpret_cast<void*>(slot);
+  if (slot == 0)
+    {
+      // Slots are carved out of arenas shared by all the harts and
+      // are never unmapped: A hart recycles the slots of the blocks it
+      // discards. Slots are whole pages so that each can be switched
+      // between writable and executable on its own: No page is ever
+      // writable and executable at the same time.
+      static std::mutex mutex;
+      static uint8_t* arena = nullptr;
+      static size_t used = 0;
+      static bool failed = (slotSize % size_t(sysconf(_SC_PAGESIZE))) != 0;
+      constexpr size_t arenaSize = 256*slotSize;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (failed)
+	return 0;
+      if (not arena or used == arenaSize)
+	{
+	  void* mem = mmap(nullptr, arenaSize, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	  if (mem == MAP_FAILED)
+	    {
+	      failed = true;
+	      return 0;
+	    }
+	  arena = static_cast<uint8_t*>(mem);
+	  used = 0;
+	}
+      page = arena + used;
+      used += slotSize;
+    }
+  else if (mprotect(page, slotSize, PROT_READ | PROT_WRITE) != 0)
+    return 0;
+
+  memcpy(page, code.data(), code.size());
+  if (mprotect(page, slotSize, PROT_READ | PROT_EXEC) != 0)
+    return 0;
+  return uintptr_t(page);
+#else
+  (void) code;
+  (void) slot;
+  return 0;
+#endif
+}
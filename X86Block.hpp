@@ -0,0 +1,111 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "DecodedInst.hpp"
+#include "BasicBlock.hpp"
+
+
+// Host code for hot blocks is generated on x86-64 hosts with mmap
+// unless NO_X86_BLOCKS is defined (make X86_BLOCKS=0).
+#if defined(__x86_64__) and not defined(__EMSCRIPTEN__) and \
+  not defined(__MINGW64__) and not defined(NO_X86_BLOCKS)
+#define X86_BLOCKS 1
+#endif
+
+
+namespace WdRiscv
+{
+
+  /// Generate x86-64 machine code for a straight-line sequence of
+  /// integer register-to-register instructions (the pure operations
+  /// of a hot basic block). The code is a function of type void()
+  /// that updates the integer register file in place: The address of
+  /// the register file is embedded in the code. This is the native
+  /// counterpart of WasmBlock and supports the same instructions.
+  class X86Block
+  {
+  public:
+
+    /// Constructor: regsAddr is the address of the integer register
+    /// file (an array of 32 4-byte/8-byte registers depending on
+    /// rv64).
+    X86Block(bool rv64, uintptr_t regsAddr);
+
+    /// Return true if given instruction can be compiled (see
+    /// isCompilableInst).
+    static bool isSupported(InstId id)
+    { return isCompilableInst(id); }
+
+    /// Append the given instruction to the generated function. Return
+    /// false if instruction is not supported.
+    bool add(const DecodedInst& di);
+
+    /// Return the bytes of the function containing the instructions
+    /// added so far.
+    std::vector<uint8_t> code() const;
+
+    /// Return the number of instructions added.
+    unsigned instCount() const
+    { return count_; }
+
+    /// Copy the given code to executable memory in the given slot (the
+    /// address returned by a previous install) or in a new slot if
+    /// slot is zero. The slot is writable only while the code is
+    /// copied. Return the address of the installed function. Return 0
+    /// if the code is larger than a slot or if executable memory is
+    /// not available (X86_BLOCKS not defined or the host refuses to
+    /// map or protect the pages).
+    static uintptr_t install(const std::vector<uint8_t>& code, uintptr_t slot);
+
+    /// Size in bytes of an install slot (a multiple of the host page
+    /// size): Enough for a block of BasicBlock::maxInsts instructions.
+    static constexpr size_t slotSize = 4096;
+
+  protected:
+
+    /// Emit a load of the given integer register into the given host
+    /// register (0 for rax, 1 for rcx).
+    void emitRegRead(unsigned host, unsigned reg);
+
+    /// Emit a store of rax into the given integer register.
+    void emitRegWrite(unsigned reg);
+
+    /// Emit the ModRM byte and displacement addressing the given
+    /// integer register relative to rdi (the register file base) with
+    /// the given ModRM reg field.
+    void emitRegOperand(unsigned field, unsigned reg);
+
+    /// Emit the REX.W prefix if rv64 (64-bit operand size).
+    void emitRexW()
+    { if (rv64_) body_.push_back(0x48); }
+
+    /// Emit a 32-bit little-endian immediate.
+    void emitImm32(uint32_t value);
+
+  private:
+
+    bool rv64_;
+    uintptr_t regsAddr_;
+    unsigned count_ = 0;
+    std::vector<uint8_t> body_;   // Function body instructions.
+  };
+}
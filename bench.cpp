@@ -0,0 +1,975 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+// Micro benchmarks of the simulator core: run loops, memory access,
+// decode, CSR access, trace formatting and program loading, and a
+// few guest workloads for RV32 and RV64. Results are written as
+// JSON so that runs of different releases can be compared.
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <filesystem>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <nlohmann/json.hpp>
+#include "elfio/elfio.hpp"
+#include "Hart.hpp"
+
+
+using namespace WdRiscv;
+
+
+namespace
+{
+
+  /// Command line options.
+  struct BenchArgs
+  {
+    std::string outFile;              // JSON results (stdout if empty).
+    std::vector<std::string> filters; // Run benchmarks matching these.
+    std::vector<unsigned> xlens = { 32, 64 };
+    double scale = 1.0;               // Multiplier of the work sizes.
+    bool list = false;
+    bool help = false;
+  };
+
+
+  /// Outcome of a benchmark: count units of work took the given
+  /// number of seconds.
+  struct Result
+  {
+    std::string name;
+    unsigned xlen = 0;
+    std::string unit;
+    uint64_t count = 0;
+    double seconds = 0;
+  };
+
+
+  /// Return the number of seconds elapsed since the given time point.
+  double
+  secondsSince(std::chrono::steady_clock::time_point t0)
+  {
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count();
+  }
+
+
+  // Integer register numbers used by the guest workloads.
+  enum Reg : unsigned
+    {
+      Zero = 0, Ra = 1, T0 = 5, T1 = 6, T2 = 7, S0 = 8, S1 = 9, A0 = 10,
+      A1 = 11, S2 = 18, S3 = 19, T3 = 28, T4 = 29, T5 = 30
+    };
+
+
+  /// Guest program under construction: A sequence of 32-bit
+  /// instructions. Branch and jump targets are instruction indices.
+  class Program
+  {
+  public:
+
+    /// Index of the next instruction.
+    unsigned here() const
+    { return code_.size(); }
+
+    const std::vector<uint32_t>& code() const
+    { return code_; }
+
+    void rType(unsigned op, unsigned f3, unsigned f7, unsigned rd,
+	       unsigned rs1, unsigned rs2)
+    { emit(f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op); }
+
+    void iType(unsigned op, unsigned f3, unsigned rd, unsigned rs1, int imm)
+    { emit((uint32_t(imm) & 0xfff) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op); }
+
+    void sType(unsigned op, unsigned f3, unsigned rs1, unsigned rs2, int imm)
+    {
+      uint32_t u = uint32_t(imm) & 0xfff;
+      emit((u >> 5) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | (u & 0x1f) << 7 | op);
+    }
+
+    /// Conditional branch to the instruction at the given index.
+    void branch(unsigned f3, unsigned rs1, unsigned rs2, unsigned target)
+    {
+      uint32_t u = uint32_t(offset(target)) & 0x1fff;
+      emit(((u >> 12) & 1) << 31 | ((u >> 5) & 0x3f) << 25 | rs2 << 20 |
+	   rs1 << 15 | f3 << 12 | ((u >> 1) & 0xf) << 8 |
+	   ((u >> 11) & 1) << 7 | 0x63);
+    }
+
+    /// Jump and link to the instruction at the given index.
+    void jal(unsigned rd, unsigned target)
+    {
+      uint32_t u = uint32_t(offset(target)) & 0x1fffff;
+      emit(((u >> 20) & 1) << 31 | ((u >> 1) & 0x3ff) << 21 |
+	   ((u >> 11) & 1) << 20 | ((u >> 12) & 0xff) << 12 | rd << 7 | 0x6f);
+    }
+
+    void addi(unsigned rd, unsigned rs1, int imm) { iType(0x13, 0, rd, rs1, imm); }
+    void andi(unsigned rd, unsigned rs1, int imm) { iType(0x13, 7, rd, rs1, imm); }
+    void slli(unsigned rd, unsigned rs1, int sh)  { iType(0x13, 1, rd, rs1, sh); }
+    void srli(unsigned rd, unsigned rs1, int sh)  { iType(0x13, 5, rd, rs1, sh); }
+    void add(unsigned rd, unsigned rs1, unsigned rs2) { rType(0x33, 0, 0, rd, rs1, rs2); }
+    void sub(unsigned rd, unsigned rs1, unsigned rs2) { rType(0x33, 0, 0x20, rd, rs1, rs2); }
+    void xor_(unsigned rd, unsigned rs1, unsigned rs2) { rType(0x33, 4, 0, rd, rs1, rs2); }
+    void mul(unsigned rd, unsigned rs1, unsigned rs2) { rType(0x33, 0, 1, rd, rs1, rs2); }
+    void ret() { iType(0x67, 0, Zero, Ra, 0); }
+
+    /// Integer load/store of the given size in bytes (4 or 8).
+    void load(unsigned size, unsigned rd, unsigned rs1, int imm)
+    { iType(0x03, size == 8 ? 3 : 2, rd, rs1, imm); }
+    void store(unsigned size, unsigned rs2, unsigned rs1, int imm)
+    { sType(0x23, size == 8 ? 3 : 2, rs1, rs2, imm); }
+
+    /// Load the given 32-bit value (sign extended) into rd.
+    void li(unsigned rd, uint32_t value)
+    {
+      uint32_t lo = value & 0xfff, hi = value - (lo >= 0x800 ? lo - 0x1000 : lo);
+      emit(hi | rd << 7 | 0x37);
+      addi(rd, rd, int(lo << 20) >> 20);
+    }
+
+    void csrw(unsigned csr, unsigned rs1) { iType(0x73, 1, Zero, rs1, csr); }
+    void csrr(unsigned rd, unsigned csr)  { iType(0x73, 2, rd, Zero, csr); }
+
+    // FP instructions of the given precision (single if dbl is false).
+    void fload(bool dbl, unsigned fd, unsigned rs1, int imm)
+    { iType(0x07, dbl ? 3 : 2, fd, rs1, imm); }
+    void fstore(bool dbl, unsigned fs2, unsigned rs1, int imm)
+    { sType(0x27, dbl ? 3 : 2, rs1, fs2, imm); }
+    void fop(bool dbl, unsigned f7, unsigned fd, unsigned fs1, unsigned fs2)
+    { rType(0x53, 7, f7 | dbl, fd, fs1, fs2); }
+    void fadd(bool d, unsigned fd, unsigned a, unsigned b) { fop(d, 0x00, fd, a, b); }
+    void fmul(bool d, unsigned fd, unsigned a, unsigned b) { fop(d, 0x08, fd, a, b); }
+    void fdiv(bool d, unsigned fd, unsigned a, unsigned b) { fop(d, 0x0c, fd, a, b); }
+    void fcvtw(bool d, unsigned fd, unsigned rs1) { fop(d, 0x68, fd, rs1, 0); }
+    void fmadd(bool dbl, unsigned fd, unsigned a, unsigned b, unsigned c)
+    { emit(c << 27 | unsigned(dbl) << 25 | b << 20 | a << 15 | 7 << 12 | fd << 7 | 0x43); }
+
+  private:
+
+    void emit(uint32_t inst)
+    { code_.push_back(inst); }
+
+    int offset(unsigned target) const
+    { return (int(target) - int(here())) * 4; }
+
+    std::vector<uint32_t> code_;
+  };
+
+
+  constexpr uint32_t codeAddr = 0x1000;     // Guest code.
+  constexpr uint32_t srcAddr = 0x100000;    // Guest source data.
+  constexpr uint32_t dstAddr = 0x200000;    // Guest destination data.
+  constexpr size_t memSize = size_t(1) << 24;
+
+
+  /// Guest workload: Program and the value of each 32-bit word of its
+  /// source data area.
+  struct Workload
+  {
+    Program prog;
+    unsigned entry = 0;       // Index of the first instruction.
+    uint32_t dataWord = 0;
+    uint32_t dataWord2 = 0;   // Odd words (high half of doubles).
+  };
+
+
+  /// Integer workload in the style of Dhrystone/CoreMark: array
+  /// updates, calls, multiplies and data dependent branches.
+  Workload
+  integerWorkload()
+  {
+    Workload w;
+    Program& p = w.prog;
+
+    unsigned func = p.here();
+    p.xor_(T0, A0, A1);
+    p.slli(T1, A0, 3);
+    p.add(A0, T0, T1);
+    p.ret();
+
+    w.entry = p.here();
+    p.li(S0, srcAddr);
+    p.addi(S1, Zero, 0);
+    p.addi(S2, Zero, 0);
+
+    unsigned loop = p.here();
+    p.andi(T2, S1, 255);
+    p.slli(T2, T2, 2);
+    p.add(T3, S0, T2);
+    p.load(4, T4, T3, 0);
+    p.add(T4, T4, S1);
+    p.store(4, T4, T3, 0);
+    p.addi(A0, T4, 0);
+    p.addi(A1, S1, 0);
+    p.jal(Ra, func);
+    p.add(S2, S2, A0);
+    p.mul(S3, S2, S1);
+    p.xor_(S2, S2, S3);
+    p.andi(T5, S1, 3);
+    p.branch(1, T5, Zero, p.here() + 3);  // bne: skip the next two.
+    p.sub(S2, S2, S1);
+    p.srli(S2, S2, 1);
+    p.addi(S1, S1, 1);
+    p.jal(Zero, loop);
+    return w;
+  }
+
+
+  /// Copy of a 64k buffer with xlen-wide loads and stores, repeated.
+  Workload
+  memcpyWorkload(unsigned xlen)
+  {
+    Workload w;
+    Program& p = w.prog;
+    unsigned size = xlen / 8;
+
+    p.li(S0, srcAddr);
+    p.li(S1, dstAddr);
+    p.li(S2, 0x10000);
+
+    unsigned outer = p.here();
+    p.addi(T0, S0, 0);
+    p.addi(T1, S1, 0);
+    p.add(T2, S0, S2);
+
+    unsigned inner = p.here();
+    p.load(size, T3, T0, 0);
+    p.load(size, T4, T0, size);
+    p.store(size, T3, T1, 0);
+    p.store(size, T4, T1, size);
+    p.addi(T0, T0, 2*size);
+    p.addi(T1, T1, 2*size);
+    p.branch(6, T0, T2, inner);  // bltu
+    p.jal(Zero, outer);
+    return w;
+  }
+
+
+  /// Multiply-add, multiply, add and divide over a 16k buffer of
+  /// single or double precision numbers, repeated.
+  Workload
+  fpWorkload(bool dbl)
+  {
+    Workload w;
+    Program& p = w.prog;
+    unsigned size = dbl ? 8 : 4;
+    w.dataWord = dbl ? 0 : 0x3f800000;   // 1.0
+    w.dataWord2 = dbl ? 0x3ff00000 : w.dataWord;
+
+    p.li(S0, srcAddr);
+    p.li(S1, dstAddr);
+    p.li(S2, 0x4000);
+    p.addi(T0, Zero, 3);
+    p.fcvtw(dbl, 1, T0);
+
+    unsigned outer = p.here();
+    p.addi(T0, S0, 0);
+    p.addi(T1, S1, 0);
+    p.add(T2, S0, S2);
+    p.fcvtw(dbl, 3, Zero);
+
+    unsigned inner = p.here();
+    p.fload(dbl, 2, T0, 0);
+    p.fmadd(dbl, 3, 2, 1, 3);
+    p.fmul(dbl, 4, 2, 1);
+    p.fadd(dbl, 5, 4, 3);
+    p.fdiv(dbl, 6, 5, 1);
+    p.fstore(dbl, 6, T1, 0);
+    p.addi(T0, T0, size);
+    p.addi(T1, T1, size);
+    p.branch(6, T0, T2, inner);  // bltu
+    p.jal(Zero, outer);
+    return w;
+  }
+
+
+  /// Reads and writes of machine CSRs by the guest.
+  Workload
+  csrWorkload()
+  {
+    Workload w;
+    Program& p = w.prog;
+
+    p.addi(S1, Zero, 0);
+    unsigned loop = p.here();
+    p.csrw(unsigned(CsrNumber::MSCRATCH), S1);
+    p.csrr(T0, unsigned(CsrNumber::MSCRATCH));
+    p.csrr(T1, unsigned(CsrNumber::MINSTRET));
+    p.csrr(T2, unsigned(CsrNumber::MCYCLE));
+    p.add(S1, S1, T0);
+    p.addi(S1, S1, 1);
+    p.jal(Zero, loop);
+    return w;
+  }
+
+
+  /// Memory and hart with the imafdc extensions, the FP unit on and
+  /// the given workload (if any) loaded.
+  template <typename URV>
+  struct Machine
+  {
+    Machine(const Workload* work = nullptr)
+      : memory(memSize), hart(0, memory, 32)
+    {
+      URV isa = 0;
+      for (char c : std::string("imafdcsu"))
+	isa |= URV(1) << (c - 'a');
+      URV xlen = sizeof(URV) == 4 ? 1 : 2;
+      isa |= xlen << (8*sizeof(URV) - 2);
+      hart.configCsr("misa", true, isa, 0, 0, false, true);
+      hart.reset();
+
+      URV mstatus = 0;
+      hart.peekCsr(CsrNumber::MSTATUS, mstatus);
+      hart.pokeCsr(CsrNumber::MSTATUS, mstatus | (URV(1) << 13));  // FS
+
+      if (not work)
+	return;
+
+      const auto& code = work->prog.code();
+      for (size_t i = 0; i < code.size(); ++i)
+	hart.pokeMemory(codeAddr + 4*i, code.at(i));
+      if (work->dataWord or work->dataWord2)
+	for (uint32_t addr = srcAddr; addr < dstAddr; addr += 8)
+	  {
+	    hart.pokeMemory(addr, work->dataWord);
+	    hart.pokeMemory(addr + 4, work->dataWord2);
+	  }
+      hart.pokePc(codeAddr + 4*work->entry);
+    }
+
+    Memory memory;
+    Hart<URV> hart;
+  };
+
+
+  /// Runs the benchmarks selected on the command line and collects
+  /// their results.
+  class Bench
+  {
+  public:
+
+    Bench(const BenchArgs& args)
+      : args_(args)
+    { }
+
+    /// Run the benchmarks of the given register width.
+    template <typename URV>
+    void runAll();
+
+    /// Print the names of the benchmarks.
+    void list();
+
+    /// Return the results collected so far as a JSON document.
+    nlohmann::json report() const;
+
+  private:
+
+    /// Return true if the given benchmark is selected.
+    bool selected(const std::string& name) const;
+
+    /// Scale the given work size by the command line scale factor.
+    uint64_t scaled(uint64_t count) const
+    { return std::max(uint64_t(1), uint64_t(double(count) * args_.scale)); }
+
+    /// Run the given benchmark if it is selected. The function returns
+    /// the number of units of work it has done. Only the time spent
+    /// in the function is measured.
+    void measure(const std::string& name, unsigned xlen,
+		 const std::string& unit, std::function<uint64_t()> func);
+
+    /// Run the given workload for count instructions on a fresh hart
+    /// configured by the given function.
+    template <typename URV>
+    void runWorkload(const std::string& name, const Workload& work,
+		     uint64_t count, std::function<FILE*(Hart<URV>&)> config);
+
+    template <typename URV>
+    void runLoops();
+
+    template <typename URV>
+    void guestWorkloads();
+
+    template <typename URV>
+    void memoryAccess();
+
+    template <typename URV>
+    void decoding();
+
+    template <typename URV>
+    void csrAccess();
+
+    template <typename URV>
+    void loading();
+
+    const BenchArgs& args_;
+    std::vector<Result> results_;
+    std::vector<std::string> names_;   // Used by list.
+    bool listOnly_ = false;
+  };
+}
+
+
+bool
+Bench::selected(const std::string& name) const
+{
+  if (args_.filters.empty())
+    return true;
+  for (const auto& filter : args_.filters)
+    if (name.find(filter) != std::string::npos)
+      return true;
+  return false;
+}
+
+
+void
+Bench::measure(const std::string& name, unsigned xlen, const std::string& unit,
+	       std::function<uint64_t()> func)
+{
+  if (not selected(name))
+    return;
+
+  if (listOnly_)
+    {
+      if (xlen == args_.xlens.front())
+	names_.push_back(name);
+      return;
+    }
+
+  auto t0 = std::chrono::steady_clock::now();
+  uint64_t count = func();
+  double seconds = secondsSince(t0);
+
+  Result res;
+  res.name = name;
+  res.xlen = xlen;
+  res.unit = unit;
+  res.count = count;
+  res.seconds = seconds;
+  results_.push_back(res);
+
+  double rate = seconds > 0 ? double(count) / seconds : 0;
+  std::cerr << "rv" << xlen << " " << name << ": " << count << " " << unit
+	    << " in " << seconds << " s (" << rate / 1e6 << " M/s)\n";
+}
+
+
+template <typename URV>
+void
+Bench::runWorkload(const std::string& name, const Workload& work,
+		   uint64_t count, std::function<FILE*(Hart<URV>&)> config)
+{
+  unsigned xlen = 8*sizeof(URV);
+  if (not selected(name))
+    return;
+  if (listOnly_)
+    {
+      measure(name, xlen, "inst", nullptr);
+      return;
+    }
+
+  // Construction of the hart is not measured.
+  auto machine = std::make_unique<Machine<URV>>(&work);
+  auto& hart = machine->hart;
+  FILE* traceFile = config ? config(hart) : nullptr;
+
+  measure(name, xlen, "inst", [&hart, traceFile, count] () {
+      uint64_t start = hart.getInstructionCount();
+      auto status = hart.runSlice(count, traceFile);
+      if (status != Hart<URV>::SliceStatus::Yield)
+	std::cerr << "Warning: guest program stopped early\n";
+      return hart.getInstructionCount() - start;
+    });
+
+  if (traceFile)
+    fclose(traceFile);
+}
+
+
+template <typename URV>
+void
+Bench::runLoops()
+{
+  // Same workload under each run loop configuration: the block loop
+  // (simpleRun) and the untilAddress loop with each of its features.
+  Workload work = integerWorkload();
+  uint64_t count = scaled(20000000);
+  uint64_t traceCount = scaled(2000000);
+
+  runWorkload<URV>("run/simple", work, count, nullptr);
+
+  runWorkload<URV>("run/nohotblocks", work, count, [] (Hart<URV>& hart) {
+      hart.enableHotBlocks(false);
+      return (FILE*) nullptr;
+    });
+
+  runWorkload<URV>("run/opcodefreq", work, count, [] (Hart<URV>& hart) {
+      hart.enableInstructionFrequency(true, InstProfile::Opcodes);
+      return (FILE*) nullptr;
+    });
+
+  runWorkload<URV>("run/until/limit", work, count, [] (Hart<URV>& hart) {
+      hart.setInstructionCountLimit(~uint64_t(0) - 1);
+      return (FILE*) nullptr;
+    });
+
+  runWorkload<URV>("run/until/stopaddr", work, count, [] (Hart<URV>& hart) {
+      hart.setStopAddress(0);  // Never reached.
+      return (FILE*) nullptr;
+    });
+
+  runWorkload<URV>("run/until/counters", work, count, [] (Hart<URV>& hart) {
+      hart.enablePerformanceCounters(true);
+      return (FILE*) nullptr;
+    });
+
+  runWorkload<URV>("run/until/triggers", work, count, [] (Hart<URV>& hart) {
+      hart.enableTriggers(true);
+      return (FILE*) nullptr;
+    });
+
+  runWorkload<URV>("run/until/instfreq", work, count, [] (Hart<URV>& hart) {
+      hart.enableInstructionFrequency(true);
+      return (FILE*) nullptr;
+    });
+
+  // Trace formatting: Text and binary records written to the null
+  // device.
+  runWorkload<URV>("run/until/trace", work, traceCount, [] (Hart<URV>&) {
+      return fopen("/dev/null", "w");
+    });
+
+  runWorkload<URV>("run/until/binarytrace", work, traceCount,
+		   [] (Hart<URV>& hart) {
+      hart.setBinaryTrace(true);
+      return fopen("/dev/null", "w");
+    });
+}
+
+
+template <typename URV>
+void
+Bench::guestWorkloads()
+{
+  unsigned xlen = 8*sizeof(URV);
+  uint64_t count = scaled(20000000);
+
+  runWorkload<URV>("guest/integer", integerWorkload(), count, nullptr);
+  runWorkload<URV>("guest/memcpy", memcpyWorkload(xlen), count, nullptr);
+  runWorkload<URV>("guest/fpsingle", fpWorkload(false), count, nullptr);
+  runWorkload<URV>("guest/fpdouble", fpWorkload(true), count, nullptr);
+  runWorkload<URV>("guest/csr", csrWorkload(), count, nullptr);
+}
+
+
+template <typename URV>
+void
+Bench::memoryAccess()
+{
+  unsigned xlen = 8*sizeof(URV);
+  uint64_t count = scaled(50000000);
+  uint64_t shareCount = scaled(200000);
+  if (not (selected("memory/read") or selected("memory/write") or
+	   selected("memory/share")))
+    return;
+
+  Machine<URV> machine;
+  Memory& memory = machine.memory;
+  constexpr size_t mask = 0xfffff;   // Accesses wrap in 1 MB.
+
+  measure("memory/write", xlen, "access", [&memory, count] () {
+      for (uint64_t i = 0; i < count; ++i)
+	memory.write(0, srcAddr + ((i*4) & mask), uint32_t(i));
+      return count;
+    });
+
+  measure("memory/read", xlen, "access", [&memory, count] () {
+      uint32_t sum = 0;
+      for (uint64_t i = 0; i < count; ++i)
+	{
+	  uint32_t value = 0;
+	  memory.read(srcAddr + ((i*4) & mask), value);
+	  sum += value;
+	}
+      if (sum == 1)
+	std::cerr << ' ';  // Keep the reads.
+      return count;
+    });
+
+  // Share the 1 MB written above (copy on write) and write one word
+  // of it. Runs last: The written memory becomes a shared image.
+  measure("memory/share", xlen, "share", [&memory, shareCount] () {
+      Memory other(memSize);
+      for (uint64_t i = 0; i < shareCount; ++i)
+	{
+	  if (not other.shareImage(memory))
+	    return i;
+	  other.write(0, srcAddr + ((i*4) & mask), uint32_t(i));
+	}
+      return shareCount;
+    });
+}
+
+
+template <typename URV>
+void
+Bench::decoding()
+{
+  unsigned xlen = 8*sizeof(URV);
+  uint64_t count = scaled(20000000);
+  if (not (selected("decode/32") or selected("decode/16")))
+    return;
+
+  Machine<URV> machine;
+  auto& hart = machine.hart;
+
+  std::vector<uint32_t> insts;
+  for (const Workload& work : { integerWorkload(), memcpyWorkload(xlen),
+				fpWorkload(false), fpWorkload(true),
+				csrWorkload() })
+    insts.insert(insts.end(), work.prog.code().begin(),
+		 work.prog.code().end());
+
+  // c.addi, c.li, c.mv, c.add, c.lw, c.sw, c.j, c.beqz, c.slli, c.nop
+  std::vector<uint32_t> insts16 = { 0x0505, 0x4595, 0x862e, 0x952e, 0x4188,
+				    0xc188, 0xa001, 0xc101, 0x050a, 0x0001 };
+
+  auto decodeAll = [&hart, count] (const std::vector<uint32_t>& words) {
+    DecodedInst di;
+    for (uint64_t i = 0; i < count; ++i)
+      hart.decode(codeAddr, words[i % words.size()], di);
+    return count;
+  };
+
+  measure("decode/32", xlen, "inst", [&] () { return decodeAll(insts); });
+  measure("decode/16", xlen, "inst", [&] () { return decodeAll(insts16); });
+}
+
+
+template <typename URV>
+void
+Bench::csrAccess()
+{
+  unsigned xlen = 8*sizeof(URV);
+  uint64_t count = scaled(20000000);
+  if (not (selected("csr/peek") or selected("csr/poke")))
+    return;
+
+  Machine<URV> machine;
+  auto& hart = machine.hart;
+
+  measure("csr/poke", xlen, "access", [&hart, count] () {
+      for (uint64_t i = 0; i < count; ++i)
+	hart.pokeCsr(CsrNumber::MSCRATCH, URV(i));
+      return count;
+    });
+
+  measure("csr/peek", xlen, "access", [&hart, count] () {
+      URV sum = 0;
+      for (uint64_t i = 0; i < count; ++i)
+	{
+	  URV value = 0;
+	  hart.peekCsr(CsrNumber(uint32_t(CsrNumber::MSCRATCH) + (i & 1)),
+		       value);
+	  sum += value;
+	}
+      if (sum == 1)
+	std::cerr << ' ';  // Keep the reads.
+      return count;
+    });
+}
+
+
+/// Write a HEX file with the given number of bytes of data starting
+/// at srcAddr. Return true on success.
+static bool
+writeHexFile(const std::string& path, size_t size)
+{
+  std::ofstream out(path);
+  if (not out)
+    return false;
+
+  char buf[8];
+  out << '@' << std::hex << srcAddr << '\n';
+  for (size_t i = 0; i < size; ++i)
+    {
+      snprintf(buf, sizeof(buf), "%02x", unsigned((i * 131) & 0xff));
+      out << buf << ((i + 1) % 16 and i + 1 < size ? ' ' : '\n');
+    }
+  return bool(out);
+}
+
+
+/// Write an ELF file of the given class with a code segment of the
+/// given size and the given number of symbols. Return true on success.
+static bool
+writeElfFile(const std::string& path, bool is64, size_t size,
+	     unsigned symbols)
+{
+  using namespace ELFIO;
+
+  elfio writer;
+  writer.create(is64 ? ELFCLASS64 : ELFCLASS32, ELFDATA2LSB);
+  writer.set_os_abi(ELFOSABI_NONE);
+  writer.set_type(ET_EXEC);
+  writer.set_machine(EM_RISCV);
+
+  section* text = writer.sections.add(".text");
+  text->set_type(SHT_PROGBITS);
+  text->set_flags(SHF_ALLOC | SHF_EXECINSTR);
+  text->set_addr_align(4);
+  text->set_address(srcAddr);
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; ++i)
+    data[i] = char((i * 131) & 0xff);
+  text->set_data(data);
+
+  segment* seg = writer.segments.add();
+  seg->set_type(PT_LOAD);
+  seg->set_virtual_address(srcAddr);
+  seg->set_physical_address(srcAddr);
+  seg->set_flags(PF_X | PF_R);
+  seg->set_align(0x1000);
+  seg->add_section_index(text->get_index(), text->get_addr_align());
+
+  section* strSec = writer.sections.add(".strtab");
+  strSec->set_type(SHT_STRTAB);
+  section* symSec = writer.sections.add(".symtab");
+  symSec->set_type(SHT_SYMTAB);
+  symSec->set_info(1);
+  symSec->set_addr_align(is64 ? 8 : 4);
+  symSec->set_entry_size(writer.get_default_entry_size(SHT_SYMTAB));
+  symSec->set_link(strSec->get_index());
+
+  string_section_accessor strings(strSec);
+  symbol_section_accessor syms(writer, symSec);
+  for (unsigned i = 0; i < symbols; ++i)
+    {
+      std::string name = "func" + std::to_string(i);
+      syms.add_symbol(strings, name.c_str(), srcAddr + (i*16) % size, 16,
+		      STB_GLOBAL, STT_FUNC, 0, text->get_index());
+    }
+
+  writer.set_entry(srcAddr);
+  return writer.save(path);
+}
+
+
+template <typename URV>
+void
+Bench::loading()
+{
+  unsigned xlen = 8*sizeof(URV);
+  size_t size = scaled(4*1024*1024);
+  if (listOnly_)
+    {
+      measure("load/hex", xlen, "byte", nullptr);
+      measure("load/elf", xlen, "byte", nullptr);
+      return;
+    }
+
+  auto tmp = std::filesystem::temp_directory_path();
+  std::string base = "whisper-bench-" + std::to_string(getpid());
+  std::string hexPath = (tmp / (base + ".hex")).string();
+  std::string elfPath = (tmp / (base + ".elf")).string();
+
+  if (selected("load/hex"))
+    {
+      if (writeHexFile(hexPath, size))
+	{
+	  Machine<URV> machine;
+	  measure("load/hex", xlen, "byte", [&machine, &hexPath, size] () {
+	      return machine.hart.loadHexFile(hexPath) ? size : 0;
+	    });
+	}
+      else
+	std::cerr << "Failed to write HEX file " << hexPath << '\n';
+      remove(hexPath.c_str());
+    }
+
+  if (selected("load/elf"))
+    {
+      if (writeElfFile(elfPath, xlen == 64, size, 10000))
+	{
+	  Machine<URV> machine;
+	  measure("load/elf", xlen, "byte", [&machine, &elfPath, size] () {
+	      size_t entry = 0;
+	      return machine.hart.loadElfFile(elfPath, entry) ? size : 0;
+	    });
+	}
+      else
+	std::cerr << "Failed to write ELF file " << elfPath << '\n';
+      remove(elfPath.c_str());
+    }
+}
+
+
+template <typename URV>
+void
+Bench::runAll()
+{
+  runLoops<URV>();
+  guestWorkloads<URV>();
+  memoryAccess<URV>();
+  decoding<URV>();
+  csrAccess<URV>();
+  loading<URV>();
+}
+
+
+void
+Bench::list()
+{
+  listOnly_ = true;
+  runAll<uint32_t>();
+  listOnly_ = false;
+  for (const auto& name : names_)
+    std::cout << name << '\n';
+}
+
+
+nlohmann::json
+Bench::report() const
+{
+  nlohmann::json doc;
+  doc["version"] = 1;
+  doc["scale"] = args_.scale;
+
+  nlohmann::json items = nlohmann::json::array();
+  for (const auto& res : results_)
+    {
+      nlohmann::json item;
+      item["name"] = res.name;
+      item["xlen"] = res.xlen;
+      item["unit"] = res.unit;
+      item["count"] = res.count;
+      item["seconds"] = res.seconds;
+      item["rate"] = res.seconds > 0 ? double(res.count) / res.seconds : 0.0;
+      items.push_back(item);
+    }
+  doc["benchmarks"] = items;
+  return doc;
+}
+
+
+static bool
+parseCmdLineArgs(int argc, char* argv[], BenchArgs& args)
+{
+  try
+    {
+      namespace po = boost::program_options;
+      po::options_description desc("options");
+      desc.add_options()
+	("help,h", po::bool_switch(&args.help),
+	 "Produce this message.")
+	("output,o", po::value(&args.outFile),
+	 "Write the JSON results to the given file instead of the standard "
+	 "output.")
+	("filter,f", po::value(&args.filters)->multitoken(),
+	 "Run only the benchmarks whose names contain one of the given "
+	 "strings (e.g. --filter run/ decode).")
+	("xlen", po::value(&args.xlens)->multitoken(),
+	 "Register widths to benchmark (32 and/or 64). Default: both.")
+	("scale", po::value(&args.scale),
+	 "Multiply the amount of work of each benchmark by the given factor. "
+	 "Default: 1.")
+	("list", po::bool_switch(&args.list),
+	 "List the benchmark names and exit.");
+
+      po::variables_map varMap;
+      po::store(po::command_line_parser(argc, argv).options(desc).run(), varMap);
+      po::notify(varMap);
+
+      if (args.help)
+	{
+	  std::cout << "Run micro benchmarks of the whisper simulator core and "
+		    << "write the results in JSON.\n"
+		    << "Progress is reported on the standard error.\n"
+		    << desc;
+	  return true;
+	}
+    }
+  catch (std::exception& exp)
+    {
+      std::cerr << "Failed to parse command line args: " << exp.what() << '\n';
+      return false;
+    }
+
+  for (unsigned xlen : args.xlens)
+    if (xlen != 32 and xlen != 64)
+      {
+	std::cerr << "Invalid xlen: " << xlen << " (expecting 32 or 64)\n";
+	return false;
+      }
+  if (args.xlens.empty() or not (args.scale > 0))
+    {
+      std::cerr << "Invalid xlen/scale\n";
+      return false;
+    }
+
+  return true;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  BenchArgs args;
+  if (not parseCmdLineArgs(argc, argv, args))
+    return 1;
+  if (args.help)
+    return 0;
+
+  Bench bench(args);
+  if (args.list)
+    {
+      bench.list();
+      return 0;
+    }
+
+  for (unsigned xlen : args.xlens)
+    {
+      if (xlen == 32)
+	bench.runAll<uint32_t>();
+      else
+	bench.runAll<uint64_t>();
+    }
+
+  std::string text = bench.report().dump(2);
+  if (args.outFile.empty())
+    {
+      std::cout << text << '\n';
+      return 0;
+    }
+
+  std::ofstream out(args.outFile);
+  if (not (out << text << '\n'))
+    {
+      std::cerr << "Failed to write " << args.outFile << '\n';
+      return 1;
+    }
+  return 0;
+}
@@ -1498,5 +1498,28 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::string& str)
 }
 
 
+template <typename URV>
+const std::string&
+Hart<URV>::cachedDisassembly(const DecodedInst& di)
+{
+  if (disasCache_.empty())
+    disasCache_.resize(disasCacheSize_);
+
+  size_t slot = (di.address() >> 1) & (disasCacheSize_ - 1);
+  DisasEntry& entry = disasCache_.at(slot);
+  if (entry.entry != di.instEntry() or entry.addr != di.address() or
+      entry.inst != di.inst() or entry.abiNames != abiNames_)
+    {
+      disassembleInst(di, entry.text);
+      entry.addr = di.address();
+      entry.inst = di.inst();
+      entry.entry = di.instEntry();
+      entry.abiNames = abiNames_;
+    }
+
+  return entry.text;
+}
+
+
 template class WdRiscv::Hart<uint32_t>;
 template class WdRiscv::Hart<uint64_t>;
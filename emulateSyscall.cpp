@@ -35,22 +35,86 @@
 #endif
 
 #include "Hart.hpp"
+#include "Vfs.hpp"
+#include "InputLog.hpp"
 
 #ifdef __EMSCRIPTEN__
 
 #include <emscripten.h>
 
-EM_JS(int, customSyscall, (int a0, int a1, int a2, int a3, int a7), {
-	var value = syscall_emulator.run(a0, a1, a2, a3, a7);
-  return value;
-});
+// The JS system call emulator lives on the main browser thread: Calls
+// are proxied to it in the build with threads (make PTHREADS=1).
 
+static int
+customSyscall(int a0, int a1, int a2, int a3, int a7)
+{
+  return MAIN_THREAD_EM_ASM_INT({
+      return syscall_emulator.run($0, $1, $2, $3, $4);
+    }, a0, a1, a2, a3, a7);
+}
+
+// Hand a flushed target output buffer to the JS side in one call.
+// Return -1 if the JS side does not handle output.
+static int
+writeTargetOutput(int fd, const char* data, int size)
+{
+  return MAIN_THREAD_EM_ASM_INT({
+      if (typeof syscall_emulator === 'undefined' || !syscall_emulator.write)
+        return -1;
+      return syscall_emulator.write($0, HEAPU8.subarray($1, $1 + $2));
+    }, fd, data, size);
+}
+
+
+// Return true if the JS side handles the target output.
+static bool
+jsHandlesOutput()
+{
+  return MAIN_THREAD_EM_ASM_INT({
+      return (typeof syscall_emulator !== 'undefined' &&
+              typeof syscall_emulator.write === 'function') ? 1 : 0;
+    });
+}
+
+#endif
+
+
+/// Return true if the target output going to the given host file
+/// descriptor is to be flushed at each end of line. Not done for
+/// output handed to the JS side which gets whole buffers instead.
+static bool
+isLineOutput(int fd)
+{
+#ifdef __EMSCRIPTEN__
+  if (jsHandlesOutput())
+    return false;
 #endif
+  return isatty(fd);
+}
+
+
+/// Write the given console output to the given stream. In the browser
+/// build, console output to the standard output goes to the JS side
+/// in a single call.
+static void
+writeConsoleOutput(FILE* out, const char* data, size_t size)
+{
+#ifdef __EMSCRIPTEN__
+  if (out == stdout and writeTargetOutput(fileno(out), data, int(size)) >= 0)
+    return;
+#endif
+  fwrite(data, 1, size, out);
+  fflush(out);
+}
 
 
 using namespace WdRiscv;
 
 
+// Number of bytes written by copyStatBufferToRiscv32/64.
+static constexpr size_t rvStatSize = 96;
+
+
 // Copy x86 stat buffer to riscv kernel_stat buffer (32-bit version).
 static void
 copyStatBufferToRiscv32(const struct stat& buff, void* rvBuff)
@@ -189,6 +253,328 @@ copyTimezoneToRiscv(const struct timezone& buff, void* rvBuff)
 }
 
 
+template <typename URV>
+void
+Hart<URV>::setConsoleOutput(FILE* out)
+{
+  flushTargetOutput();
+  consoleOut_ = out;
+  consoleTty_ = out and isLineOutput(fileno(out));
+}
+
+
+template <typename URV>
+void
+Hart<URV>::writeOutput(int fd, const char* data, size_t size)
+{
+#ifdef __EMSCRIPTEN__
+  if (writeTargetOutput(fd, data, size) >= 0)
+    return;
+#endif
+
+  while (size)
+    {
+      errno = 0;
+      auto rc = write(fd, data, size);
+      if (rc < 0 and errno == EINTR)
+	continue;
+      if (rc <= 0)
+	break;  // Error is lost as with buffered C library output.
+      data += rc;
+      size -= rc;
+    }
+}
+
+
+template <typename URV>
+void
+Hart<URV>::flushTargetOutput()
+{
+  if (not outputPending_)
+    return;
+  outputPending_ = false;
+
+  if (not consoleBuffer_.empty())
+    {
+      if (consoleOut_)
+	writeConsoleOutput(consoleOut_, consoleBuffer_.data(), consoleBuffer_.size());
+      consoleBuffer_.clear();
+    }
+
+  for (auto& kv : outBuffers_)
+    {
+      auto& data = kv.second.data;
+      if (not data.empty())
+	writeOutput(kv.first, data.data(), data.size());
+      data.clear();
+    }
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::isOutputBuffered(int fd)
+{
+#ifdef __MINGW64__
+  (void) fd;
+  return false;
+#else
+  if (not outputBuffering_)
+    return false;
+  if (outBuffers_.count(fd))
+    return true;
+
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 or (flags & O_ACCMODE) == O_RDONLY)
+    return false;
+
+  auto& buffer = outBuffers_[fd];
+  buffer.tty = isLineOutput(fd);
+  buffer.data.reserve(outBufferSize);
+  return true;
+#endif
+}
+
+
+template <typename URV>
+void
+Hart<URV>::bufferOutput(int fd, const char* data, size_t size)
+{
+  auto& buffer = outBuffers_[fd];
+  if (buffer.data.size() + size > outBufferSize)
+    {
+      flushTargetOutput();
+      if (size >= outBufferSize)
+	{
+	  writeOutput(fd, data, size);
+	  return;
+	}
+    }
+
+  buffer.data.insert(buffer.data.end(), data, data + size);
+  outputPending_ = true;
+
+  if (buffer.tty and memchr(data, '\n', size))
+    flushTargetOutput();
+}
+
+
+template <typename URV>
+URV
+Hart<URV>::emulateVfsSyscall(URV num, bool& handled)
+{
+  handled = true;
+
+  URV a0 = intRegs_.read(RegA0);
+  URV a1 = intRegs_.read(RegA1);
+  URV a2 = intRegs_.read(RegA2);
+  URV a3 = intRegs_.read(RegA3);
+
+  Vfs& vfs = *vfs_;
+
+  // Standard streams (0, 1 and 2) remain those of the host.
+  int fd = SRV(a0);
+  bool stdFd = fd >= 0 and fd < Vfs::firstFd;
+
+  // Path argument of a system call.
+  size_t pathAddr = 0;
+  auto getPath = [this, &pathAddr] (URV addr) -> bool {
+    return memory_.getSimMemAddr(addr, pathAddr);
+  };
+
+  struct stat buff;
+
+  switch (num)
+    {
+    case 17:       // getcwd
+      {
+	std::string cwd = vfs.getcwd();
+	size_t size = a1;
+	size_t buffAddr = 0;
+	if (not memory_.getSimMemAddr(a0, buffAddr, size))
+	  return SRV(-EINVAL);
+	if (cwd.size() + 1 > size)
+	  return SRV(-ERANGE);
+	memcpy((char*) buffAddr, cwd.c_str(), cwd.size() + 1);
+	return cwd.size() + 1;
+      }
+
+    case 25:       // fcntl
+      if (stdFd)
+	break;
+      return SRV(vfs.fcntl(fd, SRV(a1), SRV(a2)));
+
+    case 29:       // ioctl
+      if (stdFd)
+	break;
+      return SRV(vfs.isOpen(fd) ? -ENOTTY : -EBADF);
+
+    case 34:       // mkdirat
+      if (not getPath(a1))
+	return SRV(-EINVAL);
+      return SRV(vfs.mkdirat(SRV(a0), (const char*) pathAddr, a2));
+
+    case 35:       // unlinkat
+      if (not getPath(a1))
+	return SRV(-EINVAL);
+      return SRV(vfs.unlinkat(SRV(a0), (const char*) pathAddr, SRV(a2)));
+
+    case 46:       // ftruncate
+      if (stdFd)
+	break;
+      return SRV(vfs.ftruncate(fd, SRV(a1)));
+
+    case 49:       // chdir
+      if (not getPath(a0))
+	return SRV(-EINVAL);
+      return SRV(vfs.chdir((const char*) pathAddr));
+
+    case 56:       // openat
+      {
+	if (not getPath(a1))
+	  return SRV(-EINVAL);
+	int flags = linux_ ? SRV(a2) : Vfs::fromNewlibFlags(a2);
+	return SRV(vfs.open(SRV(a0), (const char*) pathAddr, flags, a3));
+      }
+
+    case 57:       // close
+      if (stdFd)
+	break;
+      return SRV(vfs.close(fd));
+
+    case 61:       // getdents64
+      {
+	if (stdFd)
+	  break;
+	size_t buffAddr = 0;
+	if (not memory_.getSimMemAddr(a1, buffAddr, a2))
+	  return SRV(-EINVAL);
+	return SRV(vfs.getdents64(fd, (void*) buffAddr, a2));
+      }
+
+    case 62:       // lseek
+      if (stdFd)
+	break;
+      return SRV(vfs.lseek(fd, SRV(a1), SRV(a2)));
+
+    case 63:       // read
+      {
+	if (stdFd)
+	  break;
+	// Copied straight from the file contents to simulated memory.
+	size_t buffAddr = 0;
+	if (not memory_.getSimMemAddr(a1, buffAddr, a2))
+	  return SRV(-EINVAL);
+	return SRV(vfs.read(fd, (void*) buffAddr, a2));
+      }
+
+    case 64:       // write
+      {
+	if (stdFd)
+	  break;
+	size_t buffAddr = 0;
+	if (not memory_.getSimMemAddr(a1, buffAddr, a2))
+	  return SRV(-EINVAL);
+	return SRV(vfs.write(fd, (const void*) buffAddr, a2));
+      }
+
+    case 66:       // writev
+      {
+	if (stdFd)
+	  break;
+	size_t iovAddr = 0;
+	int count = a2;
+	if (not memory_.getSimMemAddr(a1, iovAddr, count*2*sizeof(URV)))
+	  return SRV(-EINVAL);
+	int64_t total = 0;
+	const URV* vec = (const URV*) iovAddr;
+	for (int i = 0; i < count; ++i)
+	  {
+	    URV base = vec[i*2], len = vec[i*2+1];
+	    size_t addr = 0;
+	    if (not memory_.getSimMemAddr(base, addr, len))
+	      return SRV(-EINVAL);
+	    int64_t rc = vfs.write(fd, (const void*) addr, len);
+	    if (rc < 0)
+	      return SRV(rc);
+	    total += rc;
+	  }
+	return SRV(total);
+      }
+
+    case 78:       // readlinkat: No symbolic links.
+      {
+	if (not getPath(a1))
+	  return SRV(-EINVAL);
+	int rc = vfs.fstatat(SRV(a0), (const char*) pathAddr, buff, 0);
+	return SRV(rc < 0 ? rc : -EINVAL);
+      }
+
+    case 79:       // fstatat
+    case 80:       // fstat
+    case 1038:     // stat
+      {
+	int rc = 0;
+	URV rvAddr = a1;
+	if (num == 80)
+	  {
+	    if (stdFd)
+	      break;
+	    rc = vfs.fstat(fd, buff);
+	  }
+	else if (num == 79)
+	  {
+	    if (not getPath(a1))
+	      return SRV(-EINVAL);
+	    rc = vfs.fstatat(SRV(a0), (const char*) pathAddr, buff, SRV(a3));
+	    rvAddr = a2;
+	  }
+	else
+	  {
+	    if (not getPath(a0))
+	      return SRV(-EINVAL);
+	    rc = vfs.fstatat(Vfs::atCwd, (const char*) pathAddr, buff, 0);
+	  }
+	if (rc < 0)
+	  return SRV(rc);
+
+	size_t rvBuff = 0;
+	if (not memory_.getSimMemAddr(rvAddr, rvBuff, rvStatSize))
+	  return SRV(-EINVAL);
+	if (sizeof(URV) == 4)
+	  copyStatBufferToRiscv32(buff, (void*) rvBuff);
+	else
+	  copyStatBufferToRiscv64(buff, (void*) rvBuff);
+	return 0;
+      }
+
+    case 82:       // fsync
+      if (stdFd)
+	break;
+      return SRV(vfs.isOpen(fd) ? 0 : -EBADF);
+
+    case 1024:     // open
+      {
+	if (not getPath(a0))
+	  return SRV(-EINVAL);
+	int flags = linux_ ? SRV(a1) : Vfs::fromNewlibFlags(a1);
+	return SRV(vfs.open(Vfs::atCwd, (const char*) pathAddr, flags, a2));
+      }
+
+    case 1026:     // unlink
+      if (not getPath(a0))
+	return SRV(-EINVAL);
+      return SRV(vfs.unlinkat(Vfs::atCwd, (const char*) pathAddr, 0));
+
+    default:
+      break;
+    }
+
+  handled = false;
+  return 0;
+}
+
+
 template <typename URV>
 URV
 Hart<URV>::emulateSyscall()
@@ -208,6 +594,19 @@ Hart<URV>::emulateSyscall()
 
   URV num = intRegs_.read(RegA7);
 
+  // Keep the order of the target program output with respect to its
+  // other system calls (e.g. a prompt followed by a read).
+  if (outputPending_ and num != 64 and num != 66)
+    flushTargetOutput();
+
+  if (vfs_)
+    {
+      bool handled = false;
+      URV rc = emulateVfsSyscall(num, handled);
+      if (handled)
+	return rc;
+    }
+
   switch (num)
     {
 #ifndef __MINGW64__
@@ -215,7 +614,7 @@ Hart<URV>::emulateSyscall()
       {
 	size_t size = a1;
 	size_t buffAddr = 0;
-	if (not memory_.getSimMemAddr(a0, buffAddr))
+	if (not memory_.getSimMemAddr(a0, buffAddr, size))
 	  return SRV(-EINVAL);
 	errno = 0;
 	if (not getcwd((char*) buffAddr, size))
@@ -227,7 +626,7 @@ Hart<URV>::emulateSyscall()
 
     case 25:       // fcntl
       {
-	int fd = SRV(a0);
+	int fd = hostFd(SRV(a0));
 	int cmd = SRV(a1);
 	void* arg = (void*) size_t(a2);
 	switch (cmd)
@@ -237,7 +636,7 @@ Hart<URV>::emulateSyscall()
 	  case F_SETLKW:
 	    {
 	      size_t addr = 0;
-	      if (not memory_.getSimMemAddr(a2, addr))
+	      if (not memory_.getSimMemAddr(a2, addr, sizeof(struct flock)))
 		return SRV(-EINVAL);
 	      arg = (void*) addr;
 	    }
@@ -248,7 +647,7 @@ Hart<URV>::emulateSyscall()
 
     case 29:       // ioctl
       {
-	int fd = SRV(a0);
+	int fd = hostFd(SRV(a0));
 	int req = SRV(a1);
 	size_t addr = 0;
 	if (a2 != 0)
@@ -322,7 +721,7 @@ Hart<URV>::emulateSyscall()
 	// in x86 and RISCV 32/64.
 	unsigned fd = a0;
 	size_t buffAddr = 0;
-	if (not memory_.getSimMemAddr(a1, buffAddr))
+	if (not memory_.getSimMemAddr(a1, buffAddr, a2))
 	  return SRV(-EINVAL);
 	size_t count = a2;
 	off64_t base = 0;
@@ -338,7 +737,7 @@ Hart<URV>::emulateSyscall()
 
     case 62:       // lseek
       {
-	int fd = a0;
+	int fd = hostFd(a0);
 	size_t offset = a1;
 	int whence = a2;
 
@@ -349,13 +748,12 @@ Hart<URV>::emulateSyscall()
 
     case 66:       // writev
       {
-	int fd = a0;
+	int fd = hostFd(a0);
 
 	size_t iovAddr = 0;
-	if (not memory_.getSimMemAddr(a1, iovAddr))
-	  return SRV(-EINVAL);
-
 	int count = a2;
+	if (not memory_.getSimMemAddr(a1, iovAddr, count*2*sizeof(URV)))
+	  return SRV(-EINVAL);
 
 	unsigned errors = 0;
 	struct iovec* iov = new struct iovec [count];
@@ -365,7 +763,7 @@ Hart<URV>::emulateSyscall()
 	    URV base = vec[i*2];
 	    URV len = vec[i*2+1];
 	    size_t addr = 0;
-	    if (not memory_.getSimMemAddr(base, addr))
+	    if (not memory_.getSimMemAddr(base, addr, len))
 	      {
 		errors++;
 		break;
@@ -374,7 +772,16 @@ Hart<URV>::emulateSyscall()
 	    iov[i].iov_len = len;
 	  }
 	ssize_t rc = -EINVAL;
-	if (not errors)
+	if (not errors and isOutputBuffered(fd))
+	  {
+	    rc = 0;
+	    for (int i = 0; i < count; ++i)
+	      {
+		bufferOutput(fd, (const char*) iov[i].iov_base, iov[i].iov_len);
+		rc += iov[i].iov_len;
+	      }
+	  }
+	else if (not errors)
 	  {
 	    errno = 0;
 	    rc = writev(fd, iov, count);
@@ -397,7 +804,7 @@ Hart<URV>::emulateSyscall()
 	  return SRV(-EINVAL);
 
 	size_t bufAddr = 0;
-	if (not memory_.getSimMemAddr(buf, bufAddr))
+	if (not memory_.getSimMemAddr(buf, bufAddr, bufSize))
 	  return SRV(-EINVAL);
 
 	errno = 0;
@@ -415,7 +822,7 @@ Hart<URV>::emulateSyscall()
           return SRV(-1);
 
         size_t rvBuff = 0;
-        if (not memory_.getSimMemAddr(a2, rvBuff))
+        if (not memory_.getSimMemAddr(a2, rvBuff, rvStatSize))
           return SRV(-1);
 
         int flags = a3;
@@ -437,9 +844,9 @@ Hart<URV>::emulateSyscall()
 
     case 80:       // fstat
       {
-	int fd = a0;
+	int fd = hostFd(a0);
 	size_t rvBuff = 0;
-	if (not memory_.getSimMemAddr(a1, rvBuff))
+	if (not memory_.getSimMemAddr(a1, rvBuff, rvStatSize))
 	  return SRV(-1);
 	struct stat buff;
 
@@ -456,6 +863,15 @@ Hart<URV>::emulateSyscall()
 	return rc;
       }
 
+#ifndef __MINGW64__
+    case 82: // fsync
+      {
+	errno = 0;
+	int rc = fsync(hostFd(a0));
+	return rc < 0 ? SRV(-errno) : rc;
+      }
+#endif
+
     case 214: // brk
       {
         if (a0 < progBreak_)
@@ -470,6 +886,7 @@ Hart<URV>::emulateSyscall()
 	int rc = 0;
 	if (fd > 2)
 	  {
+	    outBuffers_.erase(fd);
 	    errno = 0;
 	    rc = close(fd);
 	    rc = rc < 0? -errno : rc;
@@ -479,9 +896,9 @@ Hart<URV>::emulateSyscall()
 
     case 63: // read
       {
-	int fd = a0;
+	int fd = hostFd(a0);
 	size_t buffAddr = 0;
-	if (not memory_.getSimMemAddr(a1, buffAddr))
+	if (not memory_.getSimMemAddr(a1, buffAddr, a2))
 	  return SRV(-1);
 	size_t count = a2;
 
@@ -492,46 +909,33 @@ Hart<URV>::emulateSyscall()
 
     case 64: // write
       {
-	int fd = a0;
+	int fd = hostFd(a0);
 	size_t buffAddr = 0;
-	if (not memory_.getSimMemAddr(a1, buffAddr))
+	if (not memory_.getSimMemAddr(a1, buffAddr, a2))
 	  return SRV(-1);
 	size_t count = a2;
 
+	if (isOutputBuffered(fd))
+	  {
+	    bufferOutput(fd, (const char*) buffAddr, count);
+	    return count;
+	  }
+
 	errno = 0;
 	auto rc = write(fd, (void*) buffAddr, count);
 	return rc < 0 ? SRV(-errno) : rc;
       }
 
     case 93:  // exit
-      {
-#ifndef DISABLE_EXCEPTIONS
-        throw CoreException(CoreException::Exit, "", 0, a0);
-#else
-			std::cerr << "Target program exited with code " << a0 << '\n';
-      setTargetProgramFinished(true);
-				// userOk = false is set in Core.cpp
-#endif
-        return 0;
-      }
-
     case 94:  // exit_group
-      {
-#ifndef DISABLE_EXCEPTIONS
-        throw CoreException(CoreException::Exit, "", 0, a0);
-#else
-				std::cerr << "Target program exited with code " << a0 << '\n';
-      	setTargetProgramFinished(true);
-				// userOk = false is set in Core.cpp
-#endif
-        return 0;
-      }
+      requestStop(CoreException::Exit, "", 0, a0);
+      return a0;  // Exit code stays in a0.
 
 #ifndef __MINGW64__
     case 153: // times
       {
 	size_t buffAddr = 0;
-	if (not memory_.getSimMemAddr(a0, buffAddr))
+	if (not memory_.getSimMemAddr(a0, buffAddr, 4*sizeof(URV)))
 	  return SRV(-1);
 
 	errno = 0;
@@ -553,7 +957,7 @@ Hart<URV>::emulateSyscall()
       {
 	// Assumes that x86 and rv Linux have same layout for struct utsname.
 	size_t buffAddr = 0;
-	if (not memory_.getSimMemAddr(a0, buffAddr))
+	if (not memory_.getSimMemAddr(a0, buffAddr, sizeof(struct utsname)))
 	  return SRV(-1);
 	struct utsname* uts = (struct utsname*) buffAddr;
 
@@ -566,11 +970,11 @@ Hart<URV>::emulateSyscall()
     case 169: // gettimeofday
       {
 	size_t tvAddr = 0;  // Address of riscv timeval
-	if (not memory_.getSimMemAddr(a0, tvAddr))
+	if (not memory_.getSimMemAddr(a0, tvAddr, sizeof(URV) == 4 ? 12 : 16))
 	  return SRV(-EINVAL);
 
 	size_t tzAddr = 0;  // Address of rsicv timezone
-	if (not memory_.getSimMemAddr(a1, tzAddr))
+	if (not memory_.getSimMemAddr(a1, tzAddr, 8))
 	  return SRV(-EINVAL);
 
 	struct timeval tv0;
@@ -713,5 +1117,89 @@ Hart<URV>::emulateSyscall()
 }
 
 
+template <typename URV>
+URV
+Hart<URV>::emulateLoggedSyscall()
+{
+  URV num = intRegs_.read(RegA7);
+  URV a0 = intRegs_.read(RegA0);
+  URV a1 = intRegs_.read(RegA1);
+
+  // Calls with nondeterministic results. Those of the in-memory file
+  // system are reproducible.
+  bool logged = ( (num == 63 and not (vfs_ and vfs_->isOpen(int(a0)))) or
+		  num == 153 or num == 169 );
+#ifdef __EMSCRIPTEN__
+  logged = logged or num > 2000;
+#endif
+  if (not logged)
+    return emulateSyscall();
+
+  // Memory areas written by the call given its result: the buffer of
+  // read, the tms struct of times, the timeval and timezone structs
+  // of gettimeofday.
+  auto getAreas = [this, num, a0, a1] (URV rc) {
+    std::vector<std::pair<URV, size_t>> areas;
+    if (SRV(rc) < 0)
+      return areas;
+    if (num == 63)
+      {
+	if (rc)
+	  areas.emplace_back(a1, rc);
+      }
+    else if (num == 153)
+      areas.emplace_back(a0, 4*sizeof(URV));
+    else if (num == 169)
+      {
+	if (a0)
+	  areas.emplace_back(a0, sizeof(URV) == 4 ? 12 : 16);
+	if (a1)
+	  areas.emplace_back(a1, 8);
+      }
+    return areas;
+  };
+
+  typedef InputLog::Kind Kind;
+
+  if (inputLog_->isReplaying())
+    {
+      const auto* rec = inputLog_->replay(localHartId_, Kind::Syscall,
+					  retiredInsts_);
+      if (not rec)
+	return emulateSyscall();
+
+      if (outputPending_)
+	flushTargetOutput();
+
+      URV rc = URV(rec->value);
+      size_t offset = 0;
+      for (const auto& [addr, size] : getAreas(rc))
+	{
+	  size_t buffAddr = 0;
+	  if (offset + size <= rec->data.size() and
+	      memory_.getSimMemAddr(addr, buffAddr, size))
+	    memcpy((void*) buffAddr, rec->data.data() + offset, size);
+	  offset += size;
+	}
+      return rc;
+    }
+
+  URV rc = emulateSyscall();
+
+  std::vector<uint8_t> data;
+  for (const auto& [addr, size] : getAreas(rc))
+    {
+      size_t buffAddr = 0;
+      if (not memory_.getSimMemAddr(addr, buffAddr, size))
+	break;
+      auto ptr = (const uint8_t*) buffAddr;
+      data.insert(data.end(), ptr, ptr + size);
+    }
+  inputLog_->record(localHartId_, Kind::Syscall, retiredInsts_, rc,
+		    data.data(), data.size());
+  return rc;
+}
+
+
 template class WdRiscv::Hart<uint32_t>;
 template class WdRiscv::Hart<uint64_t>;
@@ -20,6 +20,7 @@
 #include <csignal>
 #include <iostream>
 #include <sstream>
+#include <vector>
 #include <boost/format.hpp>
 #include "Hart.hpp"
 
@@ -122,26 +123,48 @@ getStringComponents(const std::string& str, char delim1, char delim2,
 
 #include <emscripten.h>
 
-EM_JS(const char *, readFromGDB, (), {
-	var jsString = getDebugMsg();
-  var lengthBytes = lengthBytesUTF8(jsString)+1;
-  var stringOnWasmHeap = _malloc(lengthBytes);
-  stringToUTF8(jsString, stringOnWasmHeap, lengthBytes);
-  return stringOnWasmHeap;
-});
+// The gdb connection lives on the main browser thread: Calls are
+// proxied to it in the build with threads (make PTHREADS=1).
 
-EM_JS(void, writeToGDB, (const char * str), {
-	var jsString = UTF8ToString(str);
-	sendDebugMsg(jsString);
-});
+// Copy the next message from gdb into the given buffer of the given
+// size. Return the message length. If the buffer is too small, keep
+// the message and return minus the required buffer size.
+static int
+readFromGDB(char* buffer, int size)
+{
+  return MAIN_THREAD_EM_ASM_INT({
+      if (!Module.gdbPendingMsg)
+        Module.gdbPendingMsg = getDebugMsg();
+      var lengthBytes = lengthBytesUTF8(Module.gdbPendingMsg) + 1;
+      if (lengthBytes > $1)
+        return -lengthBytes;
+      stringToUTF8(Module.gdbPendingMsg, $0, $1);
+      Module.gdbPendingMsg = null;
+      return lengthBytes - 1;
+    }, buffer, size);
+}
+
+static void
+writeToGDB(const char* str)
+{
+  MAIN_THREAD_EM_ASM({ sendDebugMsg(UTF8ToString($0)); }, str);
+}
 
+// Receive a packet from gdb into data. Messages are copied into a
+// buffer reused (and grown as needed) across packets.
 static
-std::string
-receivePacketFromGdb(){
-	const char* dataC = readFromGDB();
-	std::string data(dataC);
-	free((char *)dataC);
-	return data;
+void
+receivePacketFromGdb(std::string& data)
+{
+  static std::vector<char> buffer(4096);
+
+  int len = readFromGDB(buffer.data(), int(buffer.size()));
+  if (len < 0)
+    {
+      buffer.resize(-len);
+      len = readFromGDB(buffer.data(), int(buffer.size()));
+    }
+  data.assign(buffer.data(), len);
 }
 
 static void
@@ -152,14 +175,12 @@ sendPacketToGdb(const std::string& data)
 
 
 #else
-// Receive a packet from gdb. Request a retransmit from gdb if packet
-// checksum is incorrect. Return succesfully received packet.
+// Receive a packet from gdb into data (reusing its storage). Request a
+// retransmit from gdb if packet checksum is incorrect.
 static
-std::string
-receivePacketFromGdb()
+void
+receivePacketFromGdb(std::string& data)
 {
-  std::string data;  // Data part of packet.
-
   unsigned char ch = ' '; // Anything besides $ will do.
 
   while (1)
@@ -167,6 +188,8 @@ receivePacketFromGdb()
       while (ch != '$')
 	ch = getDebugChar();
 
+      data.clear();  // Data part of packet.
+
       uint8_t sum = 0;  // checksum
       while (1)
 	{
@@ -207,18 +230,16 @@ receivePacketFromGdb()
 		{
 		  putDebugChar(data.at(0));
 		  putDebugChar(data.at(1));
-		  data = data.substr(3);
+		  data.erase(0, 3);
 		}
 #if 0
 	      std::cerr << "Received from gdb: $" << data << "#"
 			<< (boost::format("%02x") % unsigned(pacSum)) << '\n';
 #endif
-	      return data;
+	      return;
 	    }
 	}
     }
-
-  return data; // Passify compiler
 }
 
 
@@ -233,16 +254,14 @@ sendPacketToGdb(const std::string& data)
 {
   const char hexDigit[] = "0123456789abcdef";
 
+  unsigned char checksum = 0;
+  for (unsigned char c : data)
+    checksum = static_cast<uint8_t>(checksum + c);
+
   while (true)
     {
       putDebugChar('$');
-      unsigned char checksum = 0;
-      for (unsigned char c : data)
-	{
-	  putDebugChar(c);
-	  checksum = static_cast<uint8_t>(checksum + c);
-	}
-
+      fwrite(data.data(), 1, data.size(), stdout);
       putDebugChar('#');
       putDebugChar(hexDigit[checksum >> 4]);
       putDebugChar(hexDigit[checksum & 0xf]);
@@ -338,6 +357,90 @@ hexToInt(const std::string& str, T& value)
 }
 
 
+/// Size (in bytes) of the largest packet accepted from gdb, reported
+/// in the reply to qSupported. Large packets let gdb load a program
+/// image with few round trips.
+static const size_t gdbPacketSize = 0x20000;
+
+
+/// Append to the given string the hexadecimal representation (two
+/// digits per byte) of the given bytes.
+static
+void
+appendHexBytes(std::string& str, const uint8_t* data, size_t size)
+{
+  const char hexDigit[] = "0123456789abcdef";
+  for (size_t i = 0; i < size; ++i)
+    {
+      str.push_back(hexDigit[data[i] >> 4]);
+      str.push_back(hexDigit[data[i] & 0xf]);
+    }
+}
+
+
+/// Decode the given hexadecimal string (two digits per byte) into
+/// bytes. Return false if the string contains fewer than 2*count
+/// digits or a non-hexadecimal character.
+static
+bool
+hexToBytes(const std::string& str, size_t count, std::vector<uint8_t>& bytes)
+{
+  if (str.size() < 2*count)
+    return false;
+
+  bytes.resize(count);
+  for (size_t i = 0; i < count; ++i)
+    {
+      int high = hexCharToInt(str[2*i]), low = hexCharToInt(str[2*i + 1]);
+      if (high < 0 or low < 0)
+	return false;
+      bytes[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+  return true;
+}
+
+
+/// Decode the binary data of an X packet starting at the given
+/// index of the given packet: A 0x7d byte escapes the following
+/// byte which is xor-ed with 0x20.
+static
+void
+unescapeBinary(const std::string& packet, size_t ix, std::vector<uint8_t>& bytes)
+{
+  bytes.clear();
+  for ( ; ix < packet.size(); ++ix)
+    {
+      uint8_t byte = static_cast<uint8_t>(packet[ix]);
+      if (byte == 0x7d and ix + 1 < packet.size())
+	byte = static_cast<uint8_t>(packet[++ix]) ^ 0x20;
+      bytes.push_back(byte);
+    }
+}
+
+
+/// Return the gdb memory map (XML) of the mapped memory of the given
+/// hart. Debugger writes are pokes (which ignore write protection):
+/// All the mapped memory is reported as ram.
+template <typename URV>
+std::string
+memoryMapForGdb(const WdRiscv::Hart<URV>& hart)
+{
+  std::vector<WdRiscv::MappedRange> ranges;
+  hart.getMappedRanges(ranges);
+
+  std::ostringstream oss;
+  oss << "<?xml version=\"1.0\"?>\n"
+      << "<!DOCTYPE memory-map PUBLIC \"+//IDN gnu.org//DTD GDB Memory Map V1.0//EN\""
+      << " \"http://sourceware.org/gdb/gdb-memory-map.dtd\">\n"
+      << "<memory-map>\n";
+  for (const auto& range : ranges)
+    oss << "  <memory type=\"ram\" start=\"0x" << std::hex << range.addr
+	<< "\" length=\"0x" << range.size << std::dec << "\"/>\n";
+  oss << "</memory-map>\n";
+  return oss.str();
+}
+
+
 template <typename URV>
 void
 handlePeekRegisterForGdb(WdRiscv::Hart<URV>& hart, unsigned regNum,
@@ -404,6 +507,10 @@ notifyGdbAfterStop(WdRiscv::Hart<URV>& hart)
 
   reply << "T" << (boost::format("%02x") % signalNum);
 
+  URV stopAddr = 0;
+  if (hart.stopReason(stopAddr) == WdRiscv::Hart<URV>::StopReason::Watchpoint)
+    reply << "watch:" << std::hex << stopAddr << std::dec << ';';
+
   URV spVal = 0;
   unsigned spNum = WdRiscv::RegSp;
   hart.peekIntReg(spNum, spVal);
@@ -426,13 +533,14 @@ handleExceptionForGdb(WdRiscv::Hart<URV>& hart)
   bool gotQuit = false;
 
   std::ostringstream reply;
+  std::string packet;
 
   while (1)
     {
       reply.str("");
       reply.clear();
 
-      std::string packet = receivePacketFromGdb();
+      receivePacketFromGdb(packet);
       if (packet.empty())
 	continue;
 
@@ -514,12 +622,16 @@ handleExceptionForGdb(WdRiscv::Hart<URV>& hart)
 		  reply << "E02";
 		else
 		  {
-		    for (URV ix = 0; ix < len; ++ix)
-		      {
-			uint8_t byte = 0;
-			hart.peekMemory(addr++, byte);
-			reply << (boost::format("%02x") % unsigned(byte));
-		      }
+		    // Copy the whole block at once. Fall back on byte
+		    // peeks for unmapped locations and memory-mapped
+		    // registers.
+		    std::vector<uint8_t> bytes(len);
+		    if (not hart.peekMemoryBlock(addr, bytes.data(), len))
+		      for (URV ix = 0; ix < len; ++ix)
+			hart.peekMemory(addr + ix, bytes.at(ix));
+		    std::string hex;
+		    appendHexBytes(hex, bytes.data(), bytes.size());
+		    reply << hex;
 		  }
 	      }
 	  }
@@ -538,16 +650,14 @@ handleExceptionForGdb(WdRiscv::Hart<URV>& hart)
 		  reply << "E02";
 		else
 		  {
-		    if (data.size() < len*2)
+		    std::vector<uint8_t> bytes;
+		    if (not hexToBytes(data, len, bytes))
 		      reply << "E03";
 		    else
 		      {
-			for (URV ix = 0; ix < len; ++ix)
-			  {
-			    int bb = hexCharToInt(data.at(2*ix));
-			    bb = (bb << 4) | hexCharToInt(data.at(2*ix+1));
-			    hart.pokeMemory(addr++, static_cast<uint8_t>(bb));
-			  }
+			if (not hart.pokeMemoryBlock(addr, bytes.data(), len))
+			  for (URV ix = 0; ix < len; ++ix)
+			    hart.pokeMemory(addr + ix, bytes.at(ix));
 			reply << "OK";
 		      }
 		  }
@@ -555,6 +665,39 @@ handleExceptionForGdb(WdRiscv::Hart<URV>& hart)
 	  }
 	  break;
 
+	case 'X': // XAA..AA,LLLL:<binary>  Write LLLL bytes at address AA..AA
+	  {
+#ifdef __EMSCRIPTEN__
+	    // Packets are passed as UTF-8 strings: No binary data.
+	    reply << "";
+#else
+	    auto commaIx = packet.find(',');
+	    auto colonIx = packet.find(':', commaIx);
+	    URV addr = 0, len = 0;
+	    if (commaIx == std::string::npos or colonIx == std::string::npos)
+	      reply << "E01";
+	    else if (not hexToInt(packet.substr(1, commaIx - 1), addr) or
+		     not hexToInt(packet.substr(commaIx + 1,
+						colonIx - commaIx - 1), len))
+	      reply << "E02";
+	    else
+	      {
+		std::vector<uint8_t> bytes;
+		unescapeBinary(packet, colonIx + 1, bytes);
+		if (bytes.size() != len)
+		  reply << "E03";
+		else
+		  {
+		    if (not hart.pokeMemoryBlock(addr, bytes.data(), len))
+		      for (URV ix = 0; ix < len; ++ix)
+			hart.pokeMemory(addr + ix, bytes.at(ix));
+		    reply << "OK";
+		  }
+	      }
+#endif
+	  }
+	  break;
+
 	case 'c':  // cAA..AA    Continue at address AA..AA(optional)
 	  {
 	    if (packet.size() == 1)
@@ -619,6 +762,43 @@ handleExceptionForGdb(WdRiscv::Hart<URV>& hart)
 	  continue;
 	  break;
 
+	case 'Z':  // Ztype,addr,kind    Insert breakpoint/watchpoint
+	case 'z':  // ztype,addr,kind    Remove breakpoint/watchpoint
+	  {
+	    bool insert = packet.at(0) == 'Z';
+	    auto c1 = packet.find(',');
+	    auto c2 = packet.find(',', c1 == std::string::npos? c1 : c1 + 1);
+	    unsigned type = 0, kind = 0;
+	    URV addr = 0;
+	    if (c1 == std::string::npos or c2 == std::string::npos or
+		not hexToInt(packet.substr(1, c1 - 1), type) or
+		not hexToInt(packet.substr(c1 + 1, c2 - c1 - 1), addr) or
+		not hexToInt(packet.substr(c2 + 1), kind) or type > 4)
+	      {
+		reply << "E01";
+		break;
+	      }
+
+	    bool ok = false;
+	    if (type <= 1)  // Software or hardware breakpoint.
+	      ok = insert? hart.addBreakpoint(addr) : hart.removeBreakpoint(addr);
+	    else
+	      {
+		using WatchType = typename WdRiscv::Hart<URV>::WatchType;
+		WatchType wt = WatchType::Write;
+		if (type == 3)
+		  wt = WatchType::Read;
+		else if (type == 4)
+		  wt = WatchType::Access;
+		if (insert)
+		  ok = hart.addWatchpoint(addr, kind, wt);
+		else
+		  ok = hart.removeWatchpoint(addr, kind, wt);
+	      }
+	    reply << (ok? "OK" : "E01");
+	  }
+	  break;
+
 	case 'k':  // kill
 	  reply << "OK";
 	  gotQuit = true;
@@ -639,6 +819,31 @@ handleExceptionForGdb(WdRiscv::Hart<URV>& hart)
 	    reply << "l";
 	  else if (packet == "qTStatus")
 	    reply << "T0;tnotrun:0";
+	  else if (packet.find("qSupported") == 0)
+	    reply << "PacketSize=" << std::hex << gdbPacketSize << std::dec
+		  << ";qXfer:memory-map:read+";
+	  else if (packet.find("qXfer:memory-map:read::") == 0)
+	    {
+	      // qXfer:memory-map:read::offset,length
+	      std::string offsetStr, lenStr;
+	      size_t offset = 0, len = 0;
+	      if (not getStringComponents(packet.substr(23), ',', offsetStr,
+					  lenStr) or
+		  not hexToInt(offsetStr, offset) or not hexToInt(lenStr, len))
+		reply << "E01";
+	      else
+		{
+		  std::string map = memoryMapForGdb(hart);
+		  if (offset >= map.size())
+		    reply << "l";
+		  else
+		    {
+		      std::string chunk = map.substr(offset, len);
+		      bool last = offset + chunk.size() >= map.size();
+		      reply << (last? "l" : "m") << chunk;
+		    }
+		}
+	    }
 	  else
 	    {
 	      std::cerr << "Unhandled gdb request: " << packet << '\n';
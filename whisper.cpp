@@ -17,9 +17,19 @@
 //
 
 #include <iostream>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <thread>
+#include <atomic>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
@@ -34,13 +44,19 @@ typedef int socklen_t;
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <unistd.h>
 #endif
 
 #include <csignal>
+#include <sys/time.h>
+#include <nlohmann/json.hpp>
 #include "HartConfig.hpp"
 #include "WhisperMessage.h"
 #include "Hart.hpp"
 #include "Server.hpp"
+#include "ShmChannel.hpp"
+#include "Vfs.hpp"
+#include "InputLog.hpp"
 #include "Interactive.hpp"
 
 
@@ -125,11 +141,40 @@ struct Args
 {
   StringVec   hexFiles;        // Hex files to be loaded into simulator memory.
   std::string traceFile;       // Log of state change after each instruction.
+  std::string logFormat;       // Format of trace file: text or binary.
+  std::string decodeLogFile;   // Binary trace file to convert to text.
+  std::string branchLogFile;   // Control flow (branch) trace file.
+  std::string decodeBranchLogFile; // Branch trace file to expand to text.
   std::string commandLogFile;  // Log of interactive or socket commands.
   std::string consoleOutFile;  // Console io output file.
   std::string serverFile;      // File in which to write server host and port.
+  std::string shmServerFile;   // Shared memory file of server mode.
   std::string instFreqFile;    // Instruction frequency file.
+  std::string instFreqParts;   // Collected parts of instruction profile.
+  std::string statsFile;       // Machine readable statistics file.
+  std::string statsFormat;     // Format of statsFile: json or cbor.
+  std::string pcProfileFile;   // Per-pc/function hotspot report file.
+  std::string flameFile;       // Function profile in collapsed format.
+  std::string callProfileFile; // Call graph (per-function) profile file.
+  std::string callStackFile;   // Call graph profile in collapsed format.
+  std::string sampleFile;      // Sampling profile (per-function) file.
+  std::string sampleStackFile; // Sampled call paths in collapsed format.
   std::string configFile;      // Configuration (JSON) file.
+  std::string configCache;     // Directory of parsed config files.
+  std::string jobsFile;        // File of independent simulation jobs.
+  std::string stdinFile;       // Target program standard input (jobs).
+  std::string stdoutFile;      // Target program standard output (jobs).
+  std::string vfsPath;         // In-memory file system image.
+  std::string loadCheckpoint;  // Checkpoint file to start from.
+  std::string saveCheckpoint;  // Checkpoint file written at end of run.
+  std::string recordInputs;    // Input log file written by the run.
+  std::string replayInputs;    // Input log file replayed by the run.
+  std::vector<std::string> observers;  // Observer plugins with arguments.
+  std::string coverageFile;    // Coverage bitmaps written at end of run.
+  std::string coverageReport;  // Per-function coverage summary.
+  StringVec   coverageMerge;   // Coverage files of previous runs.
+  const Vfs*  vfsImage = nullptr;  // Preloaded vfsPath image (jobs).
+  Memory*     memoryImage = nullptr;  // Preloaded program image (jobs).
   std::string isa;
   StringVec   zisa;
   StringVec   regInits;        // Initial values of regs
@@ -147,11 +192,29 @@ struct Args
   std::optional<uint64_t> endPc;
   std::optional<uint64_t> toHost;
   std::optional<uint64_t> consoleIo;
+  std::optional<uint64_t> clint;  // Base address of clint.
   std::optional<uint64_t> instCountLim;
+  std::optional<uint64_t> decodeCacheSize;
+  std::optional<uint64_t> quantum;  // Instructions per hart time slice.
+  std::optional<uint64_t> samplingInterval;  // Instructions between samples.
+  std::optional<uint64_t> samplingLength;    // Instructions per sample.
+  std::optional<uint64_t> traceFromInst;  // Trace window instruction range.
+  std::optional<uint64_t> traceToInst;
+  std::string traceFrom;       // Address/symbol opening the trace window.
+  std::string traceTo;         // Address/symbol closing the trace window.
+  std::string flightLogFile;   // Flight recorder dump file.
+  StringVec   breakpoints;     // Breakpoint addresses/symbols.
+  StringVec   watchpoints;     // Watchpoints: addr[:size[:r|w|a]].
   
   unsigned regWidth = 32;
   unsigned harts = 1;
   unsigned pageSize = 4*1024;
+  unsigned preDecode = 0;  // Pre-decode thread count (0: no pre-decode).
+  unsigned jobThreads = 0; // Job thread count (0: one per host core).
+  unsigned quantumThreads = 1; // Threads sharing the harts with --quantum.
+  unsigned samplingThreads = 0; // Sample thread count (0: one per host core).
+  unsigned flightRecorder = 0; // Flight recorder size (0: no recorder).
+  unsigned samplePeriod = 10000; // Mean instructions between pc samples.
 
   bool help = false;
   bool hasRegWidth = false;
@@ -160,6 +223,10 @@ struct Args
   bool verbose = false;
   bool version = false;
   bool traceLoad = false;  // Trace load address if true.
+  bool binaryLog = false;  // Binary trace format if true.
+  bool syncTrace = false;  // Write trace on simulation thread if true.
+  bool compressLog = false; // Compress trace and command log if true.
+  bool traceTriggers = false; // Trace off until a start-trace trigger.
   bool triggers = false;   // Enable debug triggers when true.
   bool counters = false;   // Enable performance counters when true.
   bool gdb = false;        // Enable gdb mode when true.
@@ -169,9 +236,16 @@ struct Args
   bool raw = false;       // True if bare-metal program (no linux no newlib).
   bool fastExt = false;    // True if fast external interrupt dispatch enabled.
   bool unmappedElfOk = false;
+  bool noFusion = false;   // Disable macro-op fusion when true.
+  bool noHotBlocks = false; // Disable hot block translation when true.
 
   // Expand each target program string into program name and args.
   void expandTargets();
+
+  // True if one of the coverage options is used.
+  bool hasCoverage() const
+  { return ( not coverageFile.empty() or not coverageReport.empty() or
+	     not coverageMerge.empty() ); }
 };
 
 
@@ -235,6 +309,13 @@ collectCommandLineValues(const boost::program_options::variables_map& varMap,
 	ok = false;
     }
 
+  if (varMap.count("clint"))
+    {
+      auto numStr = varMap["clint"].as<std::string>();
+      if (not parseCmdLineNumber("clint", numStr, args.clint))
+	ok = false;
+    }
+
   if (varMap.count("maxinst"))
     {
       auto numStr = varMap["maxinst"].as<std::string>();
@@ -242,12 +323,91 @@ collectCommandLineValues(const boost::program_options::variables_map& varMap,
 	ok = false;
     }
 
+  if (varMap.count("decodecache"))
+    {
+      auto numStr = varMap["decodecache"].as<std::string>();
+      if (not parseCmdLineNumber("decodecache", numStr, args.decodeCacheSize))
+	ok = false;
+    }
+
+  if (varMap.count("quantum"))
+    {
+      auto numStr = varMap["quantum"].as<std::string>();
+      if (not parseCmdLineNumber("quantum", numStr, args.quantum))
+	ok = false;
+      else if (*args.quantum == 0)
+	{
+	  std::cerr << "Invalid quantum: 0\n";
+	  ok = false;
+	}
+    }
+
+  if (varMap.count("samplinginterval"))
+    {
+      auto numStr = varMap["samplinginterval"].as<std::string>();
+      if (not parseCmdLineNumber("samplinginterval", numStr,
+			      args.samplingInterval))
+	ok = false;
+      else if (*args.samplingInterval == 0)
+	{
+	  std::cerr << "Invalid sampling interval: 0\n";
+	  ok = false;
+	}
+    }
+
+  if (varMap.count("samplinglength"))
+    {
+      auto numStr = varMap["samplinglength"].as<std::string>();
+      if (not parseCmdLineNumber("samplinglength", numStr,
+			      args.samplingLength))
+	ok = false;
+      else if (*args.samplingLength == 0)
+	{
+	  std::cerr << "Invalid sampling length: 0\n";
+	  ok = false;
+	}
+    }
+
+  if (varMap.count("tracewindow"))
+    {
+      auto window = varMap["tracewindow"].as<std::string>();
+      auto colon = window.find(':');
+      auto fromStr = window.substr(0, colon);
+      auto toStr = colon == std::string::npos? "" : window.substr(colon + 1);
+      if (colon == std::string::npos)
+	{
+	  std::cerr << "Invalid tracewindow: " << window
+		    << " -- expecting <from>:<to>\n";
+	  ok = false;
+	}
+      else if (not fromStr.empty() and
+	       not parseCmdLineNumber("tracewindow", fromStr, args.traceFromInst))
+	ok = false;
+      else if (not toStr.empty() and
+	       not parseCmdLineNumber("tracewindow", toStr, args.traceToInst))
+	ok = false;
+    }
+
   if (varMap.count("tohostsymbol"))
     args.toHostSym = varMap["tohostsymbol"].as<std::string>();
 
   if (varMap.count("xlen"))
     args.hasRegWidth = true;
 
+  if (args.logFormat == "binary")
+    args.binaryLog = true;
+  else if (args.logFormat.empty())
+    args.binaryLog = (boost::ends_with(args.traceFile, ".bin") or
+		      boost::ends_with(args.traceFile, ".bin.gz"));
+  else if (args.logFormat != "text")
+    {
+      std::cerr << "Invalid log format: " << args.logFormat
+		<< " -- expecting text or binary\n";
+      ok = false;
+    }
+  if (not args.decodeLogFile.empty() or not args.decodeBranchLogFile.empty())
+    args.binaryLog = false;  // Decoded output is text.
+
   if (args.interactive)
     args.trace = true;  // Enable instruction tracing in interactive mode.
 
@@ -293,12 +453,70 @@ parseCmdLineArgs(int argc, char* argv[], Args& args)
 	 "HEX file to load into simulator memory.")
 	("logfile,f", po::value(&args.traceFile),
 	 "Enable tracing to given file of executed instructions.")
+	("logformat", po::value(&args.logFormat),
+	 "Format of the instruction trace: text or binary. The binary format "
+	 "is much smaller and faster to write; it is converted to text with "
+	 "--decodelog. Default: binary if the log file name ends with .bin, "
+	 "text otherwise.")
+	("synctrace", po::bool_switch(&args.syncTrace),
+	 "Write the instruction trace on the simulation thread(s) instead of "
+	 "a background writer thread.")
+	("compresslog", po::bool_switch(&args.compressLog),
+	 "Gzip compress the trace and command log files. Implied for a file "
+	 "whose name ends with .gz.")
+	("tracewindow", po::value<std::string>(),
+	 "Trace only the instructions of the given instruction count range "
+	 "<from>:<to> (either bound may be omitted). The instructions before "
+	 "the window run at untraced speed.")
+	("tracefrom", po::value(&args.traceFrom),
+	 "Start tracing when the program counter reaches the given address or "
+	 "ELF symbol. The trace restarts every time the address is reached "
+	 "again after a --traceto stop.")
+	("traceto", po::value(&args.traceTo),
+	 "Stop tracing when the program counter reaches the given address or "
+	 "ELF symbol.")
+	("breakpoint", po::value(&args.breakpoints)->multitoken(),
+	 "Stop the run before executing the instruction at the given address "
+	 "or ELF symbol. May be repeated.")
+	("watch", po::value(&args.watchpoints)->multitoken(),
+	 "Stop the run after a load/store accessing the given data bytes. "
+	 "Argument is address[:size[:type]] where address is a number or an "
+	 "ELF symbol, size defaults to 4 and type is w (write, default), r "
+	 "(read) or a (access). May be repeated.")
+	("tracetriggers", po::bool_switch(&args.traceTriggers),
+	 "Start with the trace off: Debug triggers with a start-trace/stop-trace "
+	 "action turn it on/off (requires --triggers).")
+	("flightrecorder", po::value(&args.flightRecorder),
+	 "Keep the last given number of executed instructions in memory and "
+	 "print them in the trace format if the run fails (to-host value other "
+	 "than 1, illegal instruction storm), on control-c or with the "
+	 "interactive flight command. Much cheaper than --logfile.")
+	("flightlog", po::value(&args.flightLogFile),
+	 "Append the flight recorder output to the given file instead of the "
+	 "standard error.")
+	("branchlog", po::value(&args.branchLogFile),
+	 "Record only the control flow (taken branches, jumps and traps) of "
+	 "the run to the given file. Expanded to an instruction trace with "
+	 "--decodebranchlog.")
+	("decodebranchlog", po::value(&args.decodeBranchLogFile),
+	 "Reconstruct the executed instructions from the given branch trace "
+	 "and the target program, write them in the text trace format to the "
+	 "file of --logfile (default: standard output) and exit. Register and "
+	 "memory values are not available: they are shown as x0 writes.")
+	("decodelog", po::value(&args.decodeLogFile),
+	 "Convert the given binary instruction trace to text written to the "
+	 "file of --logfile (default: standard output) and exit. Use the "
+	 "configuration options (isa, abinames, traceload ...) of the traced "
+	 "run.")
 	("consoleoutfile", po::value(&args.consoleOutFile),
 	 "Redirect console output to given file.")
 	("commandlog", po::value(&args.commandLogFile),
 	 "Enable logging of interactive/socket commands to the given file.")
 	("server", po::value(&args.serverFile),
 	 "Interactive server mode. Put server hostname and port in file.")
+	("shmserver", po::value(&args.shmServerFile),
+	 "Interactive server mode communicating through the given shared "
+	 "memory file instead of a socket (client must be on the same host).")
 	("startpc,s", po::value<std::string>(),
 	 "Set program entry point. If not specified, use entry point of the "
 	 "most recently loaded ELF file.")
@@ -314,6 +532,13 @@ parseCmdLineArgs(int argc, char* argv[], Args& args)
 	("consoleio", po::value<std::string>(),
 	 "Memory address corresponding to console io. Reading/writing a byte "
 	 "(lb/sb) from given address reads/writes a byte from the console.")
+	("clint", po::value<std::string>(),
+	 "Base address of a core local interruptor (clint) shared by the "
+	 "harts: msip registers at offset 0, mtimecmp registers at offset "
+	 "0x4000 and mtime at offset 0xbff8. The timer of a hart is its "
+	 "cycle count and its timer and software interrupts are taken at "
+	 "basic block boundaries without polling. Instruction wfi skips to "
+	 "the next timer event.")
 	("maxinst,m", po::value<std::string>(),
 	 "Limit executed instruction count to limit.")
 	("interactive,i", po::bool_switch(&args.interactive),
@@ -328,24 +553,148 @@ parseCmdLineArgs(int argc, char* argv[], Args& args)
 	 "Run in gdb mode enabling remote debugging from gdb.")
 	("profileinst", po::value(&args.instFreqFile),
 	 "Report instruction frequency to file.")
+	("profileinstparts", po::value(&args.instFreqParts),
+	 "Comma separated parts of the --profileinst report to collect: "
+	 "opcodes (execution counts, always collected), registers (operand "
+	 "register use), values (operand value histograms) or all. An "
+	 "opcodes-only profile does not slow down the run. Default: all.")
+	("statsfile", po::value(&args.statsFile),
+	 "Write the statistics of the run (instruction, cycle and trap counts, "
+	 "simulation rate, performance counters and the --profileinst "
+	 "profile) of each hart to the given file as a single JSON document "
+	 "(see --statsformat).")
+	("statsformat", po::value(&args.statsFormat),
+	 "Format of the --statsfile document: json (text) or cbor (compact "
+	 "binary encoding of the same document). Default: json.")
+	("profilepc", po::value(&args.pcProfileFile),
+	 "Count the executions of each instruction address and report the "
+	 "hottest ELF functions and instructions to the given file.")
+	("profileflame", po::value(&args.flameFile),
+	 "Count the executions of each instruction address and write the "
+	 "executed instruction count of each ELF function to the given file "
+	 "in the collapsed stack format of flamegraph tools.")
+	("profilecalls", po::value(&args.callProfileFile),
+	 "Track the calls and returns of the target program in a shadow call "
+	 "stack and report the call count and the inclusive and exclusive "
+	 "instruction and cycle counts of each ELF function to the given "
+	 "file.")
+	("profilecallstacks", po::value(&args.callStackFile),
+	 "Track the calls and returns of the target program and write the "
+	 "instructions executed in each call path to the given file in the "
+	 "collapsed stack format of flamegraph tools.")
+	("profilesample", po::value(&args.sampleFile),
+	 "Sample the program counter (see --sampleperiod) and report the "
+	 "sample count of each ELF function and the most sampled addresses to "
+	 "the given file. Cheaper but less precise than --profilepc.")
+	("profilesamplestacks", po::value(&args.sampleStackFile),
+	 "Sample the program counter and the call stack of the target program "
+	 "(see --profilecalls) and write the sample count of each call path to "
+	 "the given file in the collapsed stack format of flamegraph tools.")
+	("sampleperiod", po::value(&args.samplePeriod),
+	 "Mean number of executed instructions between two samples of "
+	 "--profilesample and --profilesamplestacks. The interval is "
+	 "randomized. Default: 10000.")
 	("setreg", po::value(&args.regInits)->multitoken(),
 	 "Initialize registers. Apply to all harts unless specific prefix "
 	 "present (hart is 1 in 1:x3=0xabc). Example: --setreg x1=4 x2=0xff "
 	 "1:x3=0xabc")
 	("configfile", po::value(&args.configFile),
 	 "Configuration file (JSON file defining system features).")
+	("configcache", po::value(&args.configCache),
+	 "Directory where parsed configuration files are cached in binary "
+	 "form, keyed by a hash of their contents, to speed up startup.")
 	("abinames", po::bool_switch(&args.abiNames),
 	 "Use ABI register names (e.g. sp instead of x2) in instruction disassembly.")
 	("newlib", po::bool_switch(&args.newlib),
 	 "Emulate (some) newlib system calls.")
 	("linux", po::bool_switch(&args.linux),
 	 "Emulate (some) Linux system calls.")
+	("vfs", po::value(&args.vfsPath),
+	 "Service the file system calls of the target program (newlib/linux) "
+	 "with an in-memory file system loaded from the given host directory, "
+	 "tar file or manifest file (one \"<target-path> <host-file>\" per "
+	 "line). Host files are not modified.")
+	("loadcheckpoint", po::value(&args.loadCheckpoint),
+	 "Start from the state (harts and memory) saved in the given "
+	 "checkpoint file by --savecheckpoint. The configuration must be "
+	 "that of the run that saved the checkpoint.")
+	("savecheckpoint", po::value(&args.saveCheckpoint),
+	 "Save the state of the harts and of the memory in the given "
+	 "checkpoint file at the end of the run (e.g. once --maxinst "
+	 "instructions are executed).")
+	("recordinputs", po::value(&args.recordInputs),
+	 "Record the nondeterministic inputs of the run (results of the "
+	 "system calls reading host files, the standard input or the host "
+	 "clock, console and MMIO reads, external interrupts) in the given "
+	 "file for --replayinputs.")
+	("replayinputs", po::value(&args.replayInputs),
+	 "Replay the inputs recorded in the given file by --recordinputs "
+	 "reproducing the recorded run, e.g. with tracing on.")
+	("observer", po::value(&args.observers)->multitoken(),
+	 "Load the given observer plugin (shared object) and attach it to "
+	 "all the harts. The plugin path may be followed by a space and an "
+	 "argument string passed to the plugin (e.g. --observer "
+	 "\"./cov.so out=cov.txt\"). May be repeated.")
+	("coverage", po::value(&args.coverageFile),
+	 "Record the instruction coverage (executed instruction addresses) "
+	 "and the branch coverage (taken and not-taken conditional "
+	 "branches) of the run and save them in the given file at the end "
+	 "of the run.")
+	("coveragemerge", po::value(&args.coverageMerge)->multitoken(),
+	 "Merge the coverage saved by --coverage in the given file(s) by "
+	 "previous runs into the coverage of this run (use with --maxinst 0 "
+	 "to only merge files). Implies coverage recording.")
+	("coveragereport", po::value(&args.coverageReport),
+	 "Write a summary of the coverage of each ELF function to the given "
+	 "file: instruction count, executed instructions, conditional "
+	 "branches, branches taken and not taken. Implies coverage "
+	 "recording.")
 	("raw", po::bool_switch(&args.raw),
 	 "Bare metal mode (no linux/newlib system call emulation).")
 	("fastext", po::bool_switch(&args.fastExt),
 	 "Enable fast external interrupt dispatch.")
 	("unmappedelfok", po::bool_switch(&args.unmappedElfOk),
 	 "Enable checking fast external interrupt dispatch.")
+	("nofusion", po::bool_switch(&args.noFusion),
+	 "Disable macro-op fusion of common instruction pairs (e.g. lui/addi).")
+	("nohotblocks", po::bool_switch(&args.noHotBlocks),
+	 "Disable the translation of frequently executed basic blocks and the "
+	 "compilation of their integer operations to host code.")
+	("decodecache", po::value<std::string>(),
+	 "Number of entries of the decoded instruction cache (rounded up to a "
+	 "power of 2). Zero sizes the cache from the code of the loaded ELF "
+	 "files.")
+	("predecode", po::value(&args.preDecode),
+	 "Decode the code of the loaded ELF files into the decoded instruction "
+	 "cache before running using the given number of threads.")
+	("quantum", po::value<std::string>(),
+	 "Run the harts of a multi-hart system interleaved round-robin in time "
+	 "slices of the given number of instructions instead of running each "
+	 "hart in its own thread. Results are reproducible with a single "
+	 "thread (see --quantumthreads).")
+	("quantumthreads", po::value(&args.quantumThreads),
+	 "Number of threads sharing the harts in --quantum mode (default 1).")
+	("samplinginterval", po::value<std::string>(),
+	 "Sampled simulation: Fast-forward the run saving a checkpoint every "
+	 "given number of instructions and run a sample from each checkpoint "
+	 "on a pool of threads. Tracing and profiling options apply to the "
+	 "samples. Their statistics and profiles are added up.")
+	("samplinglength", po::value<std::string>(),
+	 "Number of instructions of each sample of --samplinginterval "
+	 "(default 100000).")
+	("samplingthreads", po::value(&args.samplingThreads),
+	 "Number of threads running the samples of --samplinginterval "
+	 "(default: one per host core).")
+	("jobs", po::value(&args.jobsFile),
+	 "Run the independent simulation jobs listed in the given file (one "
+	 "job per line) on a pool of threads. A line consists of optional "
+	 "config=<file>, stdin=<file>, stdout=<file> and vfs=<path> items "
+	 "followed by the "
+	 "target program and its arguments. Other command line options apply "
+	 "to all the jobs.")
+	("jobthreads", po::value(&args.jobThreads),
+	 "Number of threads running the jobs of --jobs (default: one per "
+	 "host core).")
 	("verbose,v", po::bool_switch(&args.verbose),
 	 "Be verbose.")
 	("version", po::bool_switch(&args.version),
@@ -664,6 +1013,34 @@ sanitizeStackPointer(Hart<URV>& hart, bool verbose)
 }
 
 
+/// Set address to the value of the given command line string: A
+/// number or the name of a symbol of the loaded ELF files. Leave
+/// address unmodified if the string is empty. Return true on success
+/// and false on failure.
+template<typename URV>
+static
+bool
+parseAddressOrSymbol(const Hart<URV>& hart, const std::string& option,
+		     const std::string& str, URV& address)
+{
+  if (str.empty())
+    return true;
+
+  if (std::isdigit(static_cast<unsigned char>(str.front())))
+    return parseCmdLineNumber(option, str, address);
+
+  ElfSymbol sym;
+  if (not hart.findElfSymbol(str, sym))
+    {
+      std::cerr << "Invalid command line " << option << " value: " << str
+		<< " -- no such ELF symbol\n";
+      return false;
+    }
+  address = URV(sym.addr_);
+  return true;
+}
+
+
 /// Apply command line arguments: Load ELF and HEX files, set
 /// start/end/tohost. Return true on success and false on failure.
 template<typename URV>
@@ -693,6 +1070,10 @@ applyCmdLineArgs(const Args& args, Hart<URV>& hart)
   if (args.toHostSym)
     hart.setTohostSymbol(*args.toHostSym);
 
+  // Decode cache size must be known before loading ELF files.
+  if (args.decodeCacheSize)
+    hart.setDecodeCacheSize(*args.decodeCacheSize);
+
   // Load ELF files.
   for (const auto& target : args.expandedTargets)
     {
@@ -715,8 +1096,57 @@ applyCmdLineArgs(const Args& args, Hart<URV>& hart)
 	errors++;
     }
 
+  if (args.preDecode)
+    hart.preDecode(args.preDecode);
+
   if (not args.instFreqFile.empty())
-    hart.enableInstructionFrequency(true);
+    {
+      unsigned parts = 0;
+      if (args.instFreqParts.empty())
+	parts = InstProfile::AllParts;
+      std::vector<std::string> tokens;
+      boost::split(tokens, args.instFreqParts, boost::is_any_of(","),
+		   boost::token_compress_on);
+      for (const auto& token : tokens)
+	{
+	  if (token == "all")
+	    parts |= InstProfile::AllParts;
+	  else if (token == "registers")
+	    parts |= InstProfile::Registers;
+	  else if (token == "values")
+	    parts |= InstProfile::Values;
+	  else if (token != "opcodes" and not token.empty())
+	    {
+	      std::cerr << "Invalid --profileinstparts item: " << token << '\n';
+	      return false;
+	    }
+	}
+      hart.enableInstructionFrequency(true, parts);
+    }
+
+  if (not args.pcProfileFile.empty() or not args.flameFile.empty())
+    hart.enablePcProfile(true);
+
+  if (not args.callProfileFile.empty() or not args.callStackFile.empty())
+    hart.enableCallProfile(true);
+
+  if (not args.statsFormat.empty() and args.statsFormat != "json" and
+      args.statsFormat != "cbor")
+    {
+      std::cerr << "Invalid stats format: " << args.statsFormat
+		<< " -- expecting json or cbor\n";
+      return false;
+    }
+
+  if (not args.sampleFile.empty() or not args.sampleStackFile.empty())
+    {
+      if (args.samplePeriod == 0)
+	{
+	  std::cerr << "Invalid sample period: 0\n";
+	  return false;
+	}
+      hart.enableSampling(args.samplePeriod, not args.sampleStackFile.empty());
+    }
 
   // Command line to-host overrides that of ELF and config file.
   if (args.toHost)
@@ -730,6 +1160,60 @@ applyCmdLineArgs(const Args& args, Hart<URV>& hart)
   if (args.endPc)
     hart.setStopAddress(URV(*args.endPc));
 
+  // Limit the trace to a window.
+  if (args.traceFromInst or args.traceToInst or not args.traceFrom.empty() or
+      not args.traceTo.empty())
+    {
+      URV fromPc = ~URV(0), toPc = ~URV(0);
+      if (not parseAddressOrSymbol(hart, "tracefrom", args.traceFrom, fromPc) or
+	  not parseAddressOrSymbol(hart, "traceto", args.traceTo, toPc))
+	errors++;
+      hart.setTraceWindow(args.traceFromInst.value_or(0),
+			  args.traceToInst.value_or(~uint64_t(0)),
+			  fromPc, toPc);
+    }
+  hart.setTraceOn(not args.traceTriggers);
+
+  for (const auto& str : args.breakpoints)
+    {
+      URV addr = 0;
+      if (parseAddressOrSymbol(hart, "breakpoint", str, addr))
+	hart.addBreakpoint(addr);
+      else
+	errors++;
+    }
+
+  for (const auto& str : args.watchpoints)
+    {
+      StringVec tokens;
+      boost::split(tokens, str, boost::is_any_of(":"), boost::token_compress_on);
+      URV addr = 0;
+      unsigned size = 4;
+      using WatchType = typename Hart<URV>::WatchType;
+      WatchType type = WatchType::Write;
+      bool ok = ( tokens.size() <= 3 and
+		  parseAddressOrSymbol(hart, "watch", tokens.at(0), addr) );
+      if (ok and tokens.size() > 1)
+	ok = parseCmdLineNumber("watch size", tokens.at(1), size);
+      if (ok and tokens.size() > 2)
+	{
+	  if (tokens.at(2) == "r")
+	    type = WatchType::Read;
+	  else if (tokens.at(2) == "a")
+	    type = WatchType::Access;
+	  else if (tokens.at(2) != "w")
+	    ok = false;
+	}
+      if (not ok or not hart.addWatchpoint(addr, size, type))
+	{
+	  std::cerr << "Invalid command line watch value: " << str << '\n';
+	  errors++;
+	}
+    }
+
+  if (args.flightRecorder)
+    hart.enableFlightRecorder(args.flightRecorder, args.flightLogFile);
+
   // Command-line console io address overrides config file.
   if (args.consoleIo)
     hart.setConsoleIo(URV(*args.consoleIo));
@@ -740,11 +1224,14 @@ applyCmdLineArgs(const Args& args, Hart<URV>& hart)
 
   // Print load-instruction data-address when tracing instructions.
   hart.setTraceLoad(args.traceLoad);
+  hart.setBinaryTrace(args.binaryLog);
 
   hart.enableTriggers(args.triggers);
   hart.enableGdb(args.gdb);
   hart.enablePerformanceCounters(args.counters);
   hart.enableAbiNames(args.abiNames);
+  hart.enableMacroOpFusion(not args.noFusion);
+  hart.enableHotBlocks(not args.noHotBlocks);
 
   if (args.fastExt)
     hart.enableFastInterrupts(args.fastExt);
@@ -880,6 +1367,35 @@ runServer(std::vector<Hart<URV>*>& harts, const std::string& serverFile,
 }
 
 
+/// Create the given shared memory file and service the client using
+/// it till a quit command is received. Return true on success and
+/// false on failure.
+template <typename URV>
+static
+bool
+runShmServer(std::vector<Hart<URV>*>& harts, const std::string& shmFile,
+	     FILE* traceFile, FILE* commandLog)
+{
+  ShmChannel channel;
+  if (not channel.create(shmFile))
+    return false;
+
+  bool ok = true;
+
+  try
+    {
+      Server<URV> server(harts);
+      ok = server.interact(channel, traceFile, commandLog);
+    }
+  catch(...)
+    {
+      ok = false;
+    }
+
+  return ok;
+}
+
+
 template <typename URV>
 static
 bool
@@ -898,130 +1414,1073 @@ reportInstructionFrequency(Hart<URV>& hart, const std::string& outPath)
 }
 
 
-/// Open the trace-file, command-log and console-output files
-/// specified on the command line. Return true if successful or false
-/// if any specified file fails to open.
+/// Write the statistics of the given harts, and those of the samples
+/// of a sampled run if samples is not null, to the file of
+/// --statsfile as a JSON document or its CBOR encoding. Return true
+/// on success.
+template <typename URV>
 static
 bool
-openUserFiles(const Args& args, FILE*& traceFile, FILE*& commandLog,
-	      FILE*& consoleOut)
+reportStats(std::vector<Hart<URV>*>& harts, const Args& args,
+	    const nlohmann::json* samples = nullptr)
 {
-  if (not args.traceFile.empty())
+  bool cbor = args.statsFormat == "cbor";
+
+  nlohmann::json doc;
+  doc["version"] = 1;
+  doc["harts"] = nlohmann::json::array();
+  for (auto hartPtr : harts)
     {
-      traceFile = fopen(args.traceFile.c_str(), "w");
-      if (not traceFile)
-	{
-	  std::cerr << "Failed to open trace file '" << args.traceFile
-		    << "' for output\n";
-	  return false;
-	}
+      nlohmann::json stats;
+      hartPtr->getStats(stats);
+      doc["harts"].push_back(stats);
     }
+  if (samples)
+    doc["samples"] = *samples;
 
-  if (args.trace and traceFile == NULL)
-    traceFile = stdout;
-  if (traceFile)
-    setlinebuf(traceFile);  // Make line-buffered.
-
-  if (not args.commandLogFile.empty())
+  std::ofstream out(args.statsFile, cbor? std::ios::binary : std::ios::out);
+  if (not out)
     {
-      commandLog = fopen(args.commandLogFile.c_str(), "w");
-      if (not commandLog)
-	{
-	  std::cerr << "Failed to open command log file '"
-		    << args.commandLogFile << "' for output\n";
-	  return false;
-	}
-      setlinebuf(commandLog);  // Make line-buffered.
+      std::cerr << "Failed to open stats file '" << args.statsFile
+		<< "' for output.\n";
+      return false;
     }
 
-  if (not args.consoleOutFile.empty())
+  if (cbor)
     {
-      consoleOut = fopen(args.consoleOutFile.c_str(), "w");
-      if (not consoleOut)
-	{
-	  std::cerr << "Failed to open console output file '"
-		    << args.consoleOutFile << "' for output\n";
-	  return false;
-	}
+      std::vector<uint8_t> bytes = nlohmann::json::to_cbor(doc);
+      out.write(reinterpret_cast<const char*>(bytes.data()),
+		std::streamsize(bytes.size()));
     }
+  else
+    out << doc.dump() << '\n';
 
+  if (not out)
+    {
+      std::cerr << "Failed to write stats file '" << args.statsFile << "'\n";
+      return false;
+    }
   return true;
 }
 
 
-/// Counterpart to openUserFiles: Close any open user file.
+/// Write the per-pc profile of the given harts to the files of
+/// --profilepc and --profileflame. Return true on success.
+template <typename URV>
 static
-void
-closeUserFiles(FILE*& traceFile, FILE*& commandLog, FILE*& consoleOut)
+bool
+reportPcProfile(std::vector<Hart<URV>*>& harts, const Args& args)
 {
-  if (consoleOut and consoleOut != stdout)
-    fclose(consoleOut);
-  consoleOut = nullptr;
-
-  if (traceFile and traceFile != stdout)
-    fclose(traceFile);
-  traceFile = nullptr;
+  bool ok = true;
 
-  if (commandLog and commandLog != stdout)
-    fclose(commandLog);
-  commandLog = nullptr;
-}
+  if (not args.pcProfileFile.empty())
+    {
+      FILE* file = fopen(args.pcProfileFile.c_str(), "w");
+      if (file)
+	{
+	  for (auto hartPtr : harts)
+	    {
+	      if (hartPtr != harts.front())
+		fprintf(file, "\n");
+	      hartPtr->reportPcProfile(file, 100);
+	    }
+	  fclose(file);
+	}
+      else
+	{
+	  std::cerr << "Failed to open pc profile file '" << args.pcProfileFile
+		    << "' for output.\n";
+	  ok = false;
+	}
+    }
 
+  // Flamegraph tools add up the counts of identical lines: The lines
+  // of the harts are simply concatenated.
+  if (not args.flameFile.empty())
+    {
+      FILE* file = fopen(args.flameFile.c_str(), "w");
+      if (file)
+	{
+	  for (auto hartPtr : harts)
+	    hartPtr->reportPcProfileFolded(file);
+	  fclose(file);
+	}
+      else
+	{
+	  std::cerr << "Failed to open flamegraph file '" << args.flameFile
+		    << "' for output.\n";
+	  ok = false;
+	}
+    }
 
-// In interactive mode, keyboard interrupts (typically control-c) are
-// ignored.
-static void
-kbdInterruptHandler(int)
-{
-  std::cerr << "keyboard interrupt\n";
+  return ok;
 }
 
 
+/// Merge the coverage of the given harts with that of the files of
+/// --coveragemerge then save it in the file of --coverage and
+/// summarize it in the file of --coveragereport. Return true on
+/// success.
 template <typename URV>
-static bool
-batchRun(std::vector<Hart<URV>*>& harts, FILE* traceFile)
+static
+bool
+reportCoverage(std::vector<Hart<URV>*>& harts,
+	       const std::vector<std::unique_ptr<Coverage>>& coverages,
+	       const Args& args)
 {
-  if (harts.empty())
-    return true;
+  Coverage& merged = *coverages.front();
+  for (size_t i = 1; i < coverages.size(); ++i)
+    merged.merge(*coverages.at(i));
 
-  if (harts.size() == 1)
-    return harts.front()->run(traceFile);
+  bool ok = true;
+  for (const auto& path : args.coverageMerge)
+    ok = merged.load(path) and ok;
 
-  // Run each hart in its own thread.
+  if (not args.coverageFile.empty())
+    ok = merged.save(args.coverageFile) and ok;
 
-  std::vector<std::thread> threadVec;
+  if (not args.coverageReport.empty())
+    {
+      FILE* file = fopen(args.coverageReport.c_str(), "w");
+      if (file)
+	{
+	  harts.front()->reportCoverage(file, merged);
+	  fclose(file);
+	}
+      else
+	{
+	  std::cerr << "Failed to open coverage report file '"
+		    << args.coverageReport << "' for output.\n";
+	  ok = false;
+	}
+    }
 
-  bool result = true;
+  return ok;
+}
 
-  auto threadFunc = [&traceFile, &result] (Hart<URV>* hart) {
-		      bool r = hart->run(traceFile);
-		      result = result and r;
-		    };
 
-  for (auto hartPtr : harts)
-    threadVec.emplace_back(std::thread(threadFunc, hartPtr));
+/// Write the call graph profile of the given harts to the files of
+/// --profilecalls and --profilecallstacks. Return true on success.
+template <typename URV>
+static
+bool
+reportCallProfile(std::vector<Hart<URV>*>& harts, const Args& args)
+{
+  bool ok = true;
 
-  for (auto& t : threadVec)
-    t.join();
+  if (not args.callProfileFile.empty())
+    {
+      FILE* file = fopen(args.callProfileFile.c_str(), "w");
+      if (file)
+	{
+	  for (auto hartPtr : harts)
+	    hartPtr->reportCallProfile(file);
+	  fclose(file);
+	}
+      else
+	{
+	  std::cerr << "Failed to open call profile file '"
+		    << args.callProfileFile << "' for output.\n";
+	  ok = false;
+	}
+    }
 
-  return result;
+  if (not args.callStackFile.empty())
+    {
+      FILE* file = fopen(args.callStackFile.c_str(), "w");
+      if (file)
+	{
+	  for (auto hartPtr : harts)
+	    hartPtr->reportCallProfileFolded(file);
+	  fclose(file);
+	}
+      else
+	{
+	  std::cerr << "Failed to open call stack file '"
+		    << args.callStackFile << "' for output.\n";
+	  ok = false;
+	}
+    }
+
+  return ok;
 }
 
 
-/// Depending on command line args, start a server, run in interactive
-/// mode, or initiate a batch run.
+/// Write the sampling profile of the given harts to the files of
+/// --profilesample and --profilesamplestacks. Return true on success.
 template <typename URV>
 static
 bool
-sessionRun(std::vector<Hart<URV>*>& harts, const Args& args, FILE* traceFile,
-	   FILE* commandLog)
+reportSamples(std::vector<Hart<URV>*>& harts, const Args& args)
 {
-  for (auto hartPtr : harts)
-    if (not applyCmdLineArgs(args, *hartPtr))
+  bool ok = true;
+
+  if (not args.sampleFile.empty())
+    {
+      FILE* file = fopen(args.sampleFile.c_str(), "w");
+      if (file)
+	{
+	  for (auto hartPtr : harts)
+	    {
+	      if (hartPtr != harts.front())
+		fprintf(file, "\n");
+	      hartPtr->reportSamples(file, 20);
+	    }
+	  fclose(file);
+	}
+      else
+	{
+	  std::cerr << "Failed to open sample profile file '"
+		    << args.sampleFile << "' for output.\n";
+	  ok = false;
+	}
+    }
+
+  if (not args.sampleStackFile.empty())
+    {
+      FILE* file = fopen(args.sampleStackFile.c_str(), "w");
+      if (file)
+	{
+	  for (auto hartPtr : harts)
+	    hartPtr->reportSampleStacks(file);
+	  fclose(file);
+	}
+      else
+	{
+	  std::cerr << "Failed to open sample stack file '"
+		    << args.sampleStackFile << "' for output.\n";
+	  ok = false;
+	}
+    }
+
+  return ok;
+}
+
+
+/// Return true if the given trace/command-log file is to be written
+/// compressed.
+static
+bool
+isCompressedOutput(const Args& args, const std::string& path)
+{
+  return args.compressLog or CompressedFile::isCompressedName(path);
+}
+
+
+/// Open the given trace/command-log file for writing compressing its
+/// contents if so requested. Return null on failure.
+static
+FILE*
+openOutputFile(const Args& args, const std::string& path)
+{
+  if (not isCompressedOutput(args, path))
+    return fopen(path.c_str(), "w");
+
+  if (not CompressedFile::supported())
+    {
+      std::cerr << "This build does not support compressed log files\n";
+      return nullptr;
+    }
+  return CompressedFile::openWrite(path);
+}
+
+
+/// Open the trace-file, command-log and console-output files
+/// specified on the command line. Return true if successful or false
+/// if any specified file fails to open.
+static
+bool
+openUserFiles(const Args& args, FILE*& traceFile, FILE*& commandLog,
+	      FILE*& consoleOut)
+{
+  if (not args.traceFile.empty())
+    {
+      traceFile = openOutputFile(args, args.traceFile);
+      if (not traceFile)
+	{
+	  std::cerr << "Failed to open trace file '" << args.traceFile
+		    << "' for output\n";
+	  return false;
+	}
+    }
+
+  bool chunked = false;
+  if (args.trace and traceFile == NULL)
+    {
+      // In the browser build, the trace goes to the JS side in large
+      // chunks rather than line by line through the standard output.
+      traceFile = JsTraceStream::open();
+      chunked = traceFile != nullptr;
+      if (not traceFile)
+	traceFile = stdout;
+    }
+  if (traceFile and not chunked)
+    {
+      if (args.binaryLog or isCompressedOutput(args, args.traceFile))
+	setvbuf(traceFile, nullptr, _IOFBF, 1024*1024);
+      else
+	setlinebuf(traceFile);  // Make line-buffered.
+    }
+
+  if (not args.commandLogFile.empty())
+    {
+      commandLog = openOutputFile(args, args.commandLogFile);
+      if (not commandLog)
+	{
+	  std::cerr << "Failed to open command log file '"
+		    << args.commandLogFile << "' for output\n";
+	  return false;
+	}
+      if (not isCompressedOutput(args, args.commandLogFile))
+	setlinebuf(commandLog);  // Make line-buffered.
+    }
+
+  if (not args.consoleOutFile.empty())
+    {
+      consoleOut = fopen(args.consoleOutFile.c_str(), "w");
+      if (not consoleOut)
+	{
+	  std::cerr << "Failed to open console output file '"
+		    << args.consoleOutFile << "' for output\n";
+	  return false;
+	}
+    }
+
+  return true;
+}
+
+
+/// Counterpart to openUserFiles: Close any open user file.
+static
+void
+closeUserFiles(FILE*& traceFile, FILE*& commandLog, FILE*& consoleOut)
+{
+  if (consoleOut and consoleOut != stdout)
+    fclose(consoleOut);
+  consoleOut = nullptr;
+
+  if (traceFile and traceFile != stdout)
+    fclose(traceFile);
+  traceFile = nullptr;
+
+  if (commandLog and commandLog != stdout)
+    fclose(commandLog);
+  commandLog = nullptr;
+}
+
+
+// In interactive mode, keyboard interrupts (typically control-c) are
+// ignored.
+static void
+kbdInterruptHandler(int)
+{
+  std::cerr << "keyboard interrupt\n";
+}
+
+
+template <typename URV>
+static bool
+batchRun(std::vector<Hart<URV>*>& harts, FILE* traceFile)
+{
+  if (harts.empty())
+    return true;
+
+  if (harts.size() == 1)
+    return harts.front()->run(traceFile);
+
+  // Run each hart in its own thread.
+
+  std::vector<std::thread> threadVec;
+
+  bool result = true;
+
+  auto threadFunc = [&traceFile, &result] (Hart<URV>* hart) {
+		      bool r = hart->run(traceFile);
+		      result = result and r;
+		    };
+
+  for (auto hartPtr : harts)
+    threadVec.emplace_back(std::thread(threadFunc, hartPtr));
+
+  for (auto& t : threadVec)
+    t.join();
+
+  return result;
+}
+
+
+/// Run each of the given active harts for a time slice of up to
+/// quantum instructions (see Hart::runSlice) removing from active the
+/// harts that stop. Return false if some hart failed.
+template <typename URV>
+static bool
+runSliceRound(std::vector<Hart<URV>*>& active, FILE* traceFile,
+	      uint64_t quantum)
+{
+  typedef typename Hart<URV>::SliceStatus SliceStatus;
+
+  bool ok = true;
+  for (size_t i = 0; i < active.size(); )
+    {
+      SliceStatus status = active.at(i)->runSlice(quantum, traceFile);
+      if (status == SliceStatus::Yield)
+	{
+	  ++i;
+	  continue;
+	}
+      if (status == SliceStatus::Failed)
+	ok = false;
+      active.erase(active.begin() + i);
+    }
+  return ok;
+}
+
+
+/// Report the number of instructions retired by the given harts since
+/// their combined instruction count was counter0 at time t0.
+template <typename URV>
+static void
+reportRetired(const std::vector<Hart<URV>*>& harts, uint64_t counter0,
+	      const struct timeval& t0)
+{
+  struct timeval t1;
+  gettimeofday(&t1, nullptr);
+  double elapsed = (double(t1.tv_sec - t0.tv_sec) +
+		    double(t1.tv_usec - t0.tv_usec)*1e-6);
+
+  uint64_t numInsts = 0;
+  for (auto hartPtr : harts)
+    numInsts += hartPtr->getInstructionCount();
+  numInsts -= counter0;
+
+  std::cout.flush();
+  std::cerr << "Retired " << numInsts << " instruction"
+	    << (numInsts > 1? "s" : "") << " in "
+	    << (boost::format("%.2fs") % elapsed);
+  if (elapsed > 0)
+    std::cerr << "  " << size_t(double(numInsts)/elapsed) << " inst/s";
+  std::cerr << '\n';
+}
+
+
+/// Run the given harts interleaved in time slices of quantum
+/// instructions. The harts are distributed among threadCount threads,
+/// each running its harts round-robin until they all stop. With one
+/// thread, the interleaving (and the results) of a multi-hart run do
+/// not depend on the host scheduling.
+template <typename URV>
+static bool
+quantumRun(std::vector<Hart<URV>*>& harts, FILE* traceFile, uint64_t quantum,
+	   unsigned threadCount)
+{
+  if (harts.empty())
+    return true;
+
+  threadCount = std::max(1u, std::min(threadCount, unsigned(harts.size())));
+
+  struct timeval t0;
+  gettimeofday(&t0, nullptr);
+
+  uint64_t counter0 = 0;
+  for (auto hartPtr : harts)
+    counter0 += hartPtr->getInstructionCount();
+
+  std::atomic<bool> result = true;
+
+  auto threadFunc = [&harts, &result, traceFile, quantum, threadCount] (unsigned ix) {
+    std::vector<Hart<URV>*> active;
+    for (size_t i = ix; i < harts.size(); i += threadCount)
+      active.push_back(harts.at(i));
+
+    while (not active.empty())
+      if (not runSliceRound(active, traceFile, quantum))
+	result = false;
+  };
+
+  if (threadCount == 1)
+    threadFunc(0);
+  else
+    {
+      std::vector<std::thread> threadVec;
+      for (unsigned i = 0; i < threadCount; ++i)
+	threadVec.emplace_back(std::thread(threadFunc, i));
+      for (auto& t : threadVec)
+	t.join();
+    }
+
+  reportRetired(harts, counter0, t0);
+  return result;
+}
+
+
+/// Header of a checkpoint file. It is followed by the state of each
+/// hart (see Hart::saveCheckpoint) and by the memory (see
+/// Memory::saveCheckpoint).
+struct CheckpointHeader
+{
+  char magic[8] = { 'W', 'H', 'I', 'S', 'P', 'C', 'K', 'P' };
+  uint32_t version = 1;
+  uint32_t xlen = 0;
+  uint32_t hartCount = 0;
+  uint32_t reserved = 0;
+};
+
+
+/// Save the state of the given harts and of their memory in the given
+/// checkpoint file. Return true on success.
+template <typename URV>
+static
+bool
+saveCheckpoint(std::vector<Hart<URV>*>& harts, const std::string& path)
+{
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (not out)
+    {
+      std::cerr << "Failed to open checkpoint file '" << path
+		<< "' for output\n";
+      return false;
+    }
+
+  CheckpointHeader header;
+  header.xlen = 8*sizeof(URV);
+  header.hartCount = harts.size();
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  bool ok = true;
+  for (auto hartPtr : harts)
+    ok = hartPtr->saveCheckpoint(out) and ok;
+  ok = ok and harts.front()->saveMemoryCheckpoint(out);
+
+  out.close();
+  if (not ok or not out)
+    {
+      std::cerr << "Failed to write checkpoint file '" << path << "'\n";
+      return false;
+    }
+  return true;
+}
+
+
+/// Restore the state of the given harts and of their memory from the
+/// given checkpoint file. Return true on success.
+template <typename URV>
+static
+bool
+loadCheckpoint(std::vector<Hart<URV>*>& harts, const std::string& path)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (not in)
+    {
+      std::cerr << "Failed to open checkpoint file '" << path << "'\n";
+      return false;
+    }
+
+  CheckpointHeader header, expected;
+  in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (not in or memcmp(header.magic, expected.magic, sizeof(header.magic)) or
+      header.version != expected.version)
+    {
+      std::cerr << "File '" << path << "' is not a checkpoint file\n";
+      return false;
+    }
+
+  if (header.xlen != 8*sizeof(URV) or header.hartCount != harts.size())
+    {
+      std::cerr << "Checkpoint file '" << path << "' was saved by a run "
+		<< "with " << header.hartCount << " hart(s) of "
+		<< header.xlen << " bits\n";
+      return false;
+    }
+
+  for (auto hartPtr : harts)
+    if (not hartPtr->loadCheckpoint(in))
+      return false;
+
+  std::streamoff offset = in.tellg();
+  if (offset < 0)
+    return false;
+  return harts.front()->loadMemoryCheckpoint(path, offset);
+}
+
+
+/// Add the numbers of the given statistics (see Hart::getStats) to
+/// those of total or subtract them if subtract is true. Objects and
+/// arrays are combined item by item. Identifying items (hart, xlen,
+/// csr and event) are copied.
+static
+void
+accumulateStats(nlohmann::json& total, const nlohmann::json& stats,
+		bool subtract = false)
+{
+  if (total.is_object() and stats.is_object())
+    {
+      for (auto iter = stats.begin(); iter != stats.end(); ++iter)
+	{
+	  const std::string& key = iter.key();
+	  if (key == "hart" or key == "xlen" or key == "csr" or key == "event")
+	    total[key] = *iter;
+	  else if (total.find(key) != total.end())
+	    accumulateStats(total[key], *iter, subtract);
+	  else if (not subtract)
+	    total[key] = *iter;
+	}
+    }
+  else if (total.is_array() and stats.is_array())
+    {
+      for (size_t i = 0; i < stats.size(); ++i)
+	{
+	  if (i < total.size())
+	    accumulateStats(total[i], stats[i], subtract);
+	  else if (not subtract)
+	    total.push_back(stats[i]);
+	}
+    }
+  else if (total.is_number_unsigned() and stats.is_number_unsigned())
+    {
+      uint64_t x = total.get<uint64_t>(), y = stats.get<uint64_t>();
+      total = subtract ? x - std::min(x, y) : x + y;
+    }
+  else if (total.is_number() and stats.is_number())
+    {
+      double x = total.get<double>(), y = stats.get<double>();
+      total = subtract ? x - y : x + y;
+    }
+}
+
+
+/// Return the given output file path with the given sample index
+/// inserted before its compression suffix (if any).
+static
+std::string
+samplePath(const std::string& path, unsigned index)
+{
+  std::string suffix = "." + std::to_string(index);
+  if (not CompressedFile::isCompressedName(path))
+    return path + suffix;
+  size_t dot = path.rfind('.');
+  return path.substr(0, dot) + suffix + path.substr(dot);
+}
+
+
+template <typename URV>
+class SampledRun;
+
+template <typename URV>
+static
+bool
+session(const Args& args, const HartConfig& config,
+	SampledRun<URV>* sampler = nullptr);
+
+
+/// Driver of a sampled run (see --samplinginterval): The harts of the
+/// main run fast-forward saving a checkpoint every interval
+/// instructions. A pool of threads runs a sample from each
+/// checkpoint: a session with the tracing and profiling options of
+/// the command line starting from the checkpoint and stopping after
+/// the sampling length. The statistics and per-pc profiles of the
+/// samples are added up.
+template <typename URV>
+class SampledRun
+{
+public:
+
+  SampledRun(const Args& args, const HartConfig& config)
+    : args_(args), config_(config)
+  { }
+
+  /// Return true if the given command line arguments are valid for a
+  /// sampled run. Print an error message and return false otherwise.
+  static bool checkArgs(const Args& args);
+
+  /// Return the arguments of the main run: those of the command line
+  /// without the tracing and profiling options.
+  Args mainArgs() const;
+
+  /// Fast-forward the given harts (those of the main run) till they
+  /// stop submitting a sample at every interval. Return true on
+  /// success of the main run and of all the samples.
+  bool run(std::vector<Hart<URV>*>& harts);
+
+  /// Run the given harts (those of a sample) till they stop and add
+  /// their statistics and profiles to those of the samples. Return
+  /// true on success.
+  bool runSample(std::vector<Hart<URV>*>& harts, FILE* traceFile);
+
+  /// Add the per-pc profiles of the samples to those of the given
+  /// harts.
+  void addPcProfiles(std::vector<Hart<URV>*>& harts) const;
+
+  /// Set the given JSON object to the statistics of the samples.
+  void getStats(nlohmann::json& doc) const;
+
+private:
+
+  /// Run the given harts interleaved until the instruction count of
+  /// each reaches the given limit. Remove the harts that stop from
+  /// the vector. Return false if a hart fails.
+  bool advance(std::vector<Hart<URV>*>& active, uint64_t limit,
+	       FILE* traceFile) const;
+
+  /// Run the sample of the given index from the given checkpoint
+  /// file saved at the given instruction count. Remove the file.
+  void sample(unsigned index, uint64_t start, const std::string& path);
+
+  uint64_t length() const
+  { return args_.samplingLength.value_or(100000); }
+
+  const Args& args_;
+  const HartConfig& config_;
+  std::mutex mutex_;
+  std::vector<nlohmann::json> stats_;              // Per hart.
+  std::vector<std::map<URV, uint64_t>> pcCounts_;  // Per hart.
+  unsigned count_ = 0;       // Completed samples.
+  bool failed_ = false;      // True if a sample failed.
+};
+
+
+template <typename URV>
+bool
+SampledRun<URV>::checkArgs(const Args& args)
+{
+  if (args.interactive or args.gdb or not args.serverFile.empty() or
+      not args.shmServerFile.empty() or args.flightRecorder or
+      (args.trace and args.traceFile.empty()) or
+      not args.instFreqFile.empty() or
+      not args.callProfileFile.empty() or not args.callStackFile.empty() or
+      not args.sampleFile.empty() or not args.sampleStackFile.empty() or
+      not args.recordInputs.empty() or not args.replayInputs.empty() or
+      not args.observers.empty() or args.hasCoverage() or args.clint)
+    {
+      std::cerr << "Option --samplinginterval cannot be used with "
+		<< "interactive, server, gdb, flight recorder, call profile, "
+		<< "pc sampling, instruction profile file, input "
+		<< "record/replay, observer, coverage or clint options or "
+		<< "with tracing to the standard output\n";
+      return false;
+    }
+  return true;
+}
+
+
+template <typename URV>
+Args
+SampledRun<URV>::mainArgs() const
+{
+  Args args = args_;
+  args.trace = false;
+  args.traceFile.clear();
+  args.branchLogFile.clear();
+  args.pcProfileFile.clear();
+  args.flameFile.clear();
+  args.statsFile.clear();
+  return args;
+}
+
+
+template <typename URV>
+bool
+SampledRun<URV>::advance(std::vector<Hart<URV>*>& active, uint64_t limit,
+			 FILE* traceFile) const
+{
+  typedef typename Hart<URV>::SliceStatus SliceStatus;
+
+  uint64_t quantum = args_.quantum.value_or(*args_.samplingInterval);
+  bool ok = true, pending = true;
+
+  while (pending)
+    {
+      pending = false;
+      for (size_t i = 0; i < active.size(); )
+	{
+	  Hart<URV>* hart = active.at(i);
+	  uint64_t count = hart->getInstructionCount();
+	  if (count >= limit)
+	    {
+	      ++i;
+	      continue;
+	    }
+	  SliceStatus status = hart->runSlice(std::min(quantum, limit - count),
+					      traceFile);
+	  if (status == SliceStatus::Yield)
+	    {
+	      pending = pending or hart->getInstructionCount() < limit;
+	      ++i;
+	      continue;
+	    }
+	  if (status == SliceStatus::Failed)
+	    ok = false;
+	  active.erase(active.begin() + i);
+	}
+    }
+
+  return ok;
+}
+
+
+template <typename URV>
+bool
+SampledRun<URV>::run(std::vector<Hart<URV>*>& harts)
+{
+  uint64_t interval = *args_.samplingInterval;
+  unsigned threadCount = args_.samplingThreads;
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  stats_.resize(harts.size());
+  pcCounts_.resize(harts.size());
+
+  std::error_code ec;
+  auto dir = std::filesystem::temp_directory_path(ec);
+  std::string prefix = ( (dir / "whisper-").string() +
+			 std::to_string(getpid()) + "-" );
+
+  // Checkpoints wait in the queue for a sample thread. The main run
+  // blocks while the queue is full to bound the space they use.
+  struct Job
+  {
+    unsigned index;
+    uint64_t start;
+    std::string path;
+  };
+  std::deque<Job> queue;
+  std::condition_variable cond;
+  bool done = false;
+
+  auto worker = [this, &queue, &cond, &done] () {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+      {
+	cond.wait(lock, [&queue, &done] { return done or not queue.empty(); });
+	if (queue.empty())
+	  break;
+	Job job = queue.front();
+	queue.pop_front();
+	cond.notify_all();
+	lock.unlock();
+	sample(job.index, job.start, job.path);
+	lock.lock();
+      }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < threadCount; ++i)
+    threads.emplace_back(worker);
+
+  struct timeval t0;
+  gettimeofday(&t0, nullptr);
+
+  uint64_t counter0 = 0;
+  for (auto hartPtr : harts)
+    counter0 += hartPtr->getInstructionCount();
+
+  bool ok = true;
+  std::vector<Hart<URV>*> active = harts;
+  uint64_t start = harts.front()->getInstructionCount();
+  for (unsigned index = 0; ok and not active.empty(); ++index)
+    {
+      std::string path = prefix + std::to_string(index) + ".ckp";
+      if (not saveCheckpoint(harts, path))
+	{
+	  ok = false;
+	  break;
+	}
+
+      {
+	std::unique_lock<std::mutex> lock(mutex_);
+	cond.wait(lock, [&queue, threadCount] {
+			  return queue.size() < 2*threadCount; });
+	queue.push_back(Job{index, start, path});
+      }
+      cond.notify_all();
+
+      start += interval;
+      ok = advance(active, start, nullptr);
+    }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done = true;
+  }
+  cond.notify_all();
+  for (auto& t : threads)
+    t.join();
+
+  struct timeval t1;
+  gettimeofday(&t1, nullptr);
+  double elapsed = (double(t1.tv_sec - t0.tv_sec) +
+		    double(t1.tv_usec - t0.tv_usec)*1e-6);
+
+  uint64_t numInsts = 0;
+  for (auto hartPtr : harts)
+    numInsts += hartPtr->getInstructionCount();
+  numInsts -= counter0;
+
+  std::cout.flush();
+  std::cerr << "Retired " << numInsts << " instruction"
+	    << (numInsts > 1? "s" : "") << " in "
+	    << (boost::format("%.2fs") % elapsed)
+	    << " with " << count_ << " sample" << (count_ > 1? "s" : "")
+	    << " of " << length() << " instructions\n";
+
+  return ok and not failed_;
+}
+
+
+template <typename URV>
+void
+SampledRun<URV>::sample(unsigned index, uint64_t start,
+			const std::string& path)
+{
+  Args args = args_;
+  args.samplingInterval.reset();
+  args.loadCheckpoint = path;
+  args.saveCheckpoint.clear();
+  args.commandLogFile.clear();
+
+  uint64_t stop = start + std::min(length(), ~start);
+  args.instCountLim = std::min(stop, args_.instCountLim.value_or(stop));
+
+  if (not args.traceFile.empty())
+    args.traceFile = samplePath(args.traceFile, index);
+  if (not args.branchLogFile.empty())
+    args.branchLogFile = samplePath(args.branchLogFile, index);
+
+  // The input and output of the target program are those of the
+  // main run.
+  args.stdinFile = "/dev/null";
+  args.stdoutFile = "/dev/null";
+  args.consoleOutFile = "/dev/null";
+
+  // The stats file has the instruction profile of the samples.
+  if (not args.statsFile.empty())
+    args.instFreqFile = args.statsFile;
+
+  bool ok = false;
+  try
+    {
+      ok = session<URV>(args, config_, this);
+    }
+  catch (std::exception& e)
+    {
+      std::cerr << e.what() << '\n';
+    }
+  std::remove(path.c_str());
+
+  if (not ok)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::cerr << "Sample " << index << " (instruction " << start
+		<< ") failed\n";
+      failed_ = true;
+    }
+}
+
+
+template <typename URV>
+bool
+SampledRun<URV>::runSample(std::vector<Hart<URV>*>& harts, FILE* traceFile)
+{
+  // Statistics of the sample are the differences with those saved in
+  // the checkpoint.
+  std::vector<nlohmann::json> initial(harts.size());
+  for (size_t i = 0; i < harts.size(); ++i)
+    harts.at(i)->getStats(initial.at(i));
+
+  std::vector<Hart<URV>*> active = harts;
+  bool ok = advance(active, ~uint64_t(0), traceFile);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < harts.size() and i < stats_.size(); ++i)
+    {
+      nlohmann::json stats;
+      harts.at(i)->getStats(stats);
+      accumulateStats(stats, initial.at(i), true);
+      if (stats_.at(i).is_null())
+	stats_.at(i) = stats;
+      else
+	accumulateStats(stats_.at(i), stats);
+
+      std::map<URV, uint64_t> counts;
+      harts.at(i)->getPcProfile(counts);
+      for (const auto& [pc, count] : counts)
+	pcCounts_.at(i)[pc] += count;
+    }
+  count_++;
+
+  return ok;
+}
+
+
+template <typename URV>
+void
+SampledRun<URV>::addPcProfiles(std::vector<Hart<URV>*>& harts) const
+{
+  for (size_t i = 0; i < harts.size() and i < pcCounts_.size(); ++i)
+    harts.at(i)->addPcProfile(pcCounts_.at(i));
+}
+
+
+template <typename URV>
+void
+SampledRun<URV>::getStats(nlohmann::json& doc) const
+{
+  doc = nlohmann::json::object();
+  doc["count"] = count_;
+  doc["interval"] = *args_.samplingInterval;
+  doc["length"] = length();
+  doc["harts"] = nlohmann::json::array();
+  for (auto stats : stats_)
+    {
+      // Rate of the samples.
+      if (stats.is_object())
+	{
+	  uint64_t insts = stats.value("instructions", uint64_t(0));
+	  double time = stats.value("runTime", 0.0);
+	  stats["mips"] = time > 0 ? double(insts) / time * 1e-6 : 0.0;
+	}
+      doc["harts"].push_back(stats);
+    }
+}
+
+
+/// Apply the command line arguments to the given harts (this loads
+/// the target programs) and restore the checkpoint of the arguments,
+/// if any. Return true on success.
+template <typename URV>
+static
+bool
+prepareRun(std::vector<Hart<URV>*>& harts, const Args& args)
+{
+  for (auto hartPtr : harts)
+    if (not applyCmdLineArgs(args, *hartPtr))
       if (not args.interactive)
 	return false;
 
-  bool serverMode = not args.serverFile.empty();
+  if (not args.loadCheckpoint.empty())
+    if (not loadCheckpoint(harts, args.loadCheckpoint))
+      return false;
+
+  return true;
+}
+
+
+/// Depending on command line args, start a server, run in interactive
+/// mode, or initiate a batch run. A non-null sampler is the driver of
+/// a sampled run: It runs the harts if args has a sampling interval
+/// and collects their results otherwise (the harts are those of a
+/// sample).
+template <typename URV>
+static
+bool
+sessionRun(std::vector<Hart<URV>*>& harts, const Args& args, FILE* traceFile,
+	   FILE* commandLog, SampledRun<URV>* sampler)
+{
+  if (not prepareRun(harts, args))
+    return false;
+
+  bool ok = true;
+  bool serverMode = not args.serverFile.empty() or
+    not args.shmServerFile.empty();
   if (serverMode or args.interactive)
     for (auto hartPtr : harts)
       {
@@ -1029,6 +2488,9 @@ sessionRun(std::vector<Hart<URV>*>& harts, const Args& args, FILE* traceFile,
 	hartPtr->enablePerformanceCounters(true);
       }
 
+  if (not args.shmServerFile.empty())
+    return runShmServer(harts, args.shmServerFile, traceFile, commandLog);
+
   if (serverMode)
     return runServer(harts, args.serverFile, traceFile, commandLog);
 
@@ -1050,97 +2512,701 @@ sessionRun(std::vector<Hart<URV>*>& harts, const Args& args, FILE* traceFile,
       return interactive.interact(traceFile, commandLog);
     }
 
-  return batchRun(harts, traceFile);
+  if (sampler and not args.samplingInterval)
+    ok = sampler->runSample(harts, traceFile);
+  else if (sampler)
+    ok = sampler->run(harts);
+#if defined(__EMSCRIPTEN__) and not defined(__EMSCRIPTEN_PTHREADS__)
+  // Browser build without threads (see make PTHREADS=1): The harts
+  // share the main thread in time slices.
+  else if (args.quantum or harts.size() > 1)
+    ok = quantumRun(harts, traceFile, args.quantum.value_or(10000), 1);
+  else
+    ok = batchRun(harts, traceFile);
+#else
+  else if (args.quantum)
+    ok = quantumRun(harts, traceFile, *args.quantum, args.quantumThreads);
+  else
+    ok = batchRun(harts, traceFile);
+#endif
+
+  if (not args.saveCheckpoint.empty())
+    ok = saveCheckpoint(harts, args.saveCheckpoint) and ok;
+
+  return ok;
+}
+
+
+/// Convert the binary trace file of --decodelog to text using the
+/// given harts to disassemble the traced instructions. Return true on
+/// success.
+template <typename URV>
+static
+bool
+decodeBinaryLog(std::vector<Hart<URV>*>& harts, const Args& args)
+{
+  // Disassembly depends on isa and other command line options.
+  for (auto hartPtr : harts)
+    if (not applyCmdLineArgs(args, *hartPtr))
+      return false;
+
+  FILE* in = CompressedFile::openRead(args.decodeLogFile);
+  if (not in)
+    {
+      std::cerr << "Failed to open binary trace file '" << args.decodeLogFile
+		<< "' for input\n";
+      return false;
+    }
+
+  unsigned xlen = 0;
+  if (not BinaryTrace::readHeader(in, xlen))
+    {
+      std::cerr << "File '" << args.decodeLogFile << "' is not a binary trace\n";
+      fclose(in);
+      return false;
+    }
+  if (xlen != 8*sizeof(URV))
+    {
+      std::cerr << "Binary trace is for " << xlen << "-bit harts: use --xlen "
+		<< xlen << '\n';
+      fclose(in);
+      return false;
+    }
+
+  FILE* out = stdout;
+  if (not args.traceFile.empty())
+    {
+      out = openOutputFile(args, args.traceFile);
+      if (not out)
+	{
+	  std::cerr << "Failed to open trace file '" << args.traceFile
+		    << "' for output\n";
+	  fclose(in);
+	  return false;
+	}
+    }
+
+  std::vector<BinaryTrace::HartState> states;
+  TraceRecord rec;
+  std::string tmp;
+  bool error = false, ok = true;
+  while (BinaryTrace::decode(in, states, rec, error))
+    {
+      if (rec.hartId >= harts.size())
+	{
+	  std::cerr << "Binary trace has records of hart " << rec.hartId
+		    << ": use --harts " << (rec.hartId + 1) << '\n';
+	  ok = false;
+	  break;
+	}
+      harts.at(rec.hartId)->printTraceRecord(rec, tmp, out);
+    }
+
+  if (error)
+    {
+      std::cerr << "Binary trace file '" << args.decodeLogFile
+		<< "' is truncated or corrupt\n";
+      ok = false;
+    }
+
+  if (out != stdout)
+    fclose(out);
+  fclose(in);
+  return ok;
+}
+
+
+/// Reconstruct the instructions executed by the run recorded in the
+/// branch trace file of --decodebranchlog using the target program
+/// loaded into the given harts. Write them in the text trace format.
+/// Return true on success.
+template <typename URV>
+static
+bool
+decodeBranchLog(std::vector<Hart<URV>*>& harts, const Args& args)
+{
+  if (args.hexFiles.empty() and args.expandedTargets.empty())
+    {
+      std::cerr << "No program file specified: --decodebranchlog requires "
+		<< "the traced program.\n";
+      return false;
+    }
+
+  for (auto hartPtr : harts)
+    if (not applyCmdLineArgs(args, *hartPtr))
+      return false;
+
+  const std::string& path = args.decodeBranchLogFile;
+  FILE* in = CompressedFile::openRead(path);
+  if (not in)
+    {
+      std::cerr << "Failed to open branch trace file '" << path
+		<< "' for input\n";
+      return false;
+    }
+
+  unsigned xlen = 0;
+  if (not BranchTrace::readHeader(in, xlen))
+    {
+      std::cerr << "File '" << path << "' is not a branch trace\n";
+      fclose(in);
+      return false;
+    }
+  if (xlen != 8*sizeof(URV))
+    {
+      std::cerr << "Branch trace is for " << xlen << "-bit harts: use --xlen "
+		<< xlen << '\n';
+      fclose(in);
+      return false;
+    }
+
+  FILE* out = stdout;
+  if (not args.traceFile.empty())
+    {
+      out = openOutputFile(args, args.traceFile);
+      if (not out)
+	{
+	  std::cerr << "Failed to open trace file '" << args.traceFile
+		    << "' for output\n";
+	  fclose(in);
+	  return false;
+	}
+    }
+
+  // Address of next instruction and tag of last instruction of each
+  // hart.
+  std::vector<std::pair<URV, uint64_t>> cursors(harts.size());
+
+  std::vector<BranchTrace::HartState> states;
+  BranchEvent event;
+  TraceRecord rec;
+  std::string tmp;
+  bool error = false, ok = true;
+  while (ok and BranchTrace::decode(in, states, event, error))
+    {
+      if (event.hartId >= harts.size())
+	{
+	  std::cerr << "Branch trace has events of hart " << event.hartId
+		    << ": use --harts " << (event.hartId + 1) << '\n';
+	  ok = false;
+	  break;
+	}
+
+      auto& hart = *harts.at(event.hartId);
+      auto& [pc, tag] = cursors.at(event.hartId);
+      if (event.kind == BranchEvent::Start)
+	{
+	  pc = event.to;
+	  tag = event.tag;
+	  continue;
+	}
+
+      // Instructions since the previous event are sequential.
+      URV lastPc = pc;
+      for ( ; tag < event.tag; ++tag)
+	{
+	  uint32_t inst = 0;
+	  if (not hart.readInst(pc, inst))
+	    {
+	      // Only the instruction of a fetch exception may be missing.
+	      if (event.kind != BranchEvent::Exception or tag + 1 != event.tag)
+		{
+		  std::cerr << "Branch trace: No instruction at address 0x"
+			    << std::hex << pc << std::dec << " (tag "
+			    << (tag + 1) << ") in target program\n";
+		  ok = false;
+		  break;
+		}
+	    }
+
+	  rec = TraceRecord();
+	  rec.tag = tag + 1;
+	  rec.hartId = event.hartId;
+	  rec.pc = rec.decodePc = pc;
+	  rec.inst = inst;
+	  hart.printTraceRecord(rec, tmp, out);
+	  lastPc = pc;
+	  pc += rec.instSize();
+	}
+      if (not ok)
+	break;
+
+      // Check that the program agrees with the recorded source.
+      bool atSource = ( event.kind == BranchEvent::Jump or
+			event.kind == BranchEvent::Exception ) ?
+	lastPc == event.from : pc == event.from;
+      if (not atSource)
+	{
+	  std::cerr << "Branch trace does not match target program at tag "
+		    << event.tag << '\n';
+	  ok = false;
+	  break;
+	}
+
+      pc = event.to;
+    }
+
+  if (error)
+    {
+      std::cerr << "Branch trace file '" << path
+		<< "' is truncated or corrupt\n";
+      ok = false;
+    }
+
+  if (out != stdout)
+    fclose(out);
+  fclose(in);
+  return ok;
+}
+
+
+/// Set memorySize and pageSize to the simulated memory size and page
+/// size defined by the given arguments and configuration.
+static
+void
+getMemoryGeometry(const Args& args, const HartConfig& config,
+		  size_t& memorySize, size_t& pageSize)
+{
+  // Determine simulated memory size. Default to 4 gigs.
+  // If running a 32-bit machine (pointer size = 32 bits), try 2 gigs.
+  memorySize = size_t(1) << 27;  // 4 gigs
+  if (memorySize == 0)
+    memorySize = size_t(1) << 31;  // 2 gigs
+  config.getMemorySize(memorySize);
+
+  pageSize = 4*1024;
+  if (not config.getPageSize(pageSize))
+    pageSize = args.pageSize;
+}
+
+
+/// A simulation session: The memory and harts of a system configured
+/// by the command line arguments and the configuration together with
+/// the files, devices and observers of the run. The session function
+/// runs it to completion. The browser build may instead run it one
+/// slice at a time from the browser event loop (see
+/// whisperCreateSession).
+template <typename URV>
+class Session
+{
+public:
+
+  Session(const Args& args, const HartConfig& config,
+	  SampledRun<URV>* sampler)
+    : args_(args), config_(config), sampler_(sampler)
+  { }
+
+  /// Detach the devices and files of the session from its harts and
+  /// close the files.
+  ~Session();
+
+  /// Create and configure the memory and the harts. Return true on
+  /// success.
+  bool createSystem();
+
+  /// Open the files and create the devices and observers of the run
+  /// and attach them to the harts. Return true on success.
+  bool open();
+
+  /// Collect the results (statistics, profiles, coverage) of a run
+  /// that succeeded if result is true. Return false if result is
+  /// false or if some report fails.
+  bool finish(bool result);
+
+  /// Harts of this session.
+  std::vector<Hart<URV>*>& harts()
+  { return harts_; }
+
+  /// Arguments of the run: Those of the session without the tracing
+  /// and profiling options of the samples in a sampled run.
+  const Args& runArgs() const
+  { return sampledRun_ ? mainArgs_ : args_; }
+
+  /// Driver of a sampled run, if any, or sampler of this session.
+  SampledRun<URV>* sampler() const
+  { return sampler_; }
+
+  FILE* traceFile() const
+  { return traceFile_; }
+
+  FILE* commandLog() const
+  { return commandLog_; }
+
+private:
+
+  const Args& args_;
+  const HartConfig& config_;
+  SampledRun<URV>* sampler_ = nullptr;
+
+  std::unique_ptr<SampledRun<URV>> sampledRun_;
+  Args mainArgs_;
+  bool isSample_ = false;
+
+  FILE* traceFile_ = nullptr;
+  FILE* commandLog_ = nullptr;
+  FILE* consoleOut_ = stdout;
+  FILE* branchFile_ = nullptr;
+  FILE* stdinFile_ = nullptr;
+  FILE* stdoutFile_ = nullptr;
+
+  std::unique_ptr<Memory> memory_;
+  std::unique_ptr<Vfs> vfs_;
+  std::unique_ptr<InputLog> inputLog_;
+  std::vector<std::unique_ptr<Observer>> observers_;
+  std::unique_ptr<Clint> clint_;
+  std::vector<std::unique_ptr<Coverage>> coverages_;
+
+  // Deleted before the memory and the devices they use.
+  std::vector<std::unique_ptr<Hart<URV>>> autoDeleteHarts_;
+  std::vector<Hart<URV>*> harts_;
+
+  std::unique_ptr<TraceWriter> traceWriter_;
+};
+
+
+template <typename URV>
+Session<URV>::~Session()
+{
+  if (traceWriter_)
+    {
+      for (auto hartPtr : harts_)
+	hartPtr->setTraceWriter(nullptr);
+      traceWriter_.reset();
+    }
+
+  if (branchFile_)
+    {
+      for (auto hartPtr : harts_)
+	hartPtr->setBranchTrace(nullptr);
+      fclose(branchFile_);
+    }
+
+  if (consoleOut_ == stdoutFile_)
+    consoleOut_ = stdout;
+  closeUserFiles(traceFile_, commandLog_, consoleOut_);
+  if (stdoutFile_)
+    fclose(stdoutFile_);
+  if (stdinFile_)
+    fclose(stdinFile_);
+}
+
+
+template <typename URV>
+bool
+Session<URV>::createSystem()
+{
+  unsigned registerCount = 32;
+  unsigned hartCount = args_.harts;
+  if (hartCount == 0 or hartCount > 64)
+    {
+      std::cerr << "Unreasonable hart count: " << hartCount << '\n';
+      return false;
+    }
+
+  size_t memorySize = 0, pageSize = 0;
+  getMemoryGeometry(args_, config_, memorySize, pageSize);
+
+  memory_ = std::make_unique<Memory>(memorySize, pageSize);
+  Memory& memory = *memory_;
+
+  // Start from the preloaded program image: Loading the program then
+  // keeps the pages of the image shared (copy on write).
+  if (args_.memoryImage)
+    memory.shareImage(*args_.memoryImage);
+
+  memory.setHartCount(hartCount);
+  memory.checkUnmappedElf(not args_.unmappedElfOk);
+
+  // Create and configure harts.
+  for (unsigned i = 0; i < hartCount; ++i)
+    {
+      auto hart = new Hart<URV>(i, memory, registerCount);
+      harts_.push_back(hart);
+      autoDeleteHarts_.push_back(std::unique_ptr<Hart<URV>>(hart));
+    }
+
+  // Configure harts.
+  for (auto hartPtr : harts_)
+    if (not config_.applyConfig(*hartPtr, args_.verbose))
+      if (not args_.interactive)
+	return false;
+  config_.finalizeCsrConfig(harts_);
+
+  // Configure memory.
+  if (not config_.applyMemoryConfig(*(harts_.at(0)), args_.verbose))
+    return false;
+  for (unsigned i = 1; i < hartCount; ++i)
+    harts_.at(i)->copyMemRegionConfig(*harts_.at(0));
+
+  return true;
+}
+
+
+template <typename URV>
+bool
+Session<URV>::open()
+{
+  const Args& args = args_;
+  auto& harts = harts_;
+
+  if (args.hexFiles.empty() and args.expandedTargets.empty()
+      and not args.interactive)
+    {
+      std::cerr << "No program file specified.\n";
+      return false;
+    }
+
+  // Tracing and profiling options of a sampled run apply to its
+  // samples: The main run only fast-forwards between them.
+  if (args.samplingInterval)
+    {
+      if (not SampledRun<URV>::checkArgs(args))
+	return false;
+      sampledRun_ = std::make_unique<SampledRun<URV>>(args, config_);
+      sampler_ = sampledRun_.get();
+      mainArgs_ = sampledRun_->mainArgs();
+    }
+  const Args& runArgs = this->runArgs();
+  isSample_ = sampler_ and not sampledRun_;
+
+  if (not openUserFiles(runArgs, traceFile_, commandLog_, consoleOut_))
+    return false;
+
+  if (traceFile_ and args.binaryLog)
+    BinaryTrace::writeHeader(traceFile_, 8*sizeof(URV));
+
+  // Control flow trace (see --branchlog).
+  if (not runArgs.branchLogFile.empty())
+    {
+      branchFile_ = openOutputFile(args, runArgs.branchLogFile);
+      if (not branchFile_)
+	{
+	  std::cerr << "Failed to open branch trace file '"
+		    << args.branchLogFile << "' for output\n";
+	  return false;
+	}
+      setvbuf(branchFile_, nullptr, _IOFBF, 1024*1024);
+      BranchTrace::writeHeader(branchFile_, 8*sizeof(URV));
+    }
+
+  // Standard input/output of the target program (jobs mode).
+  if (not args.stdinFile.empty())
+    {
+      stdinFile_ = fopen(args.stdinFile.c_str(), "r");
+      if (not stdinFile_)
+	{
+	  std::cerr << "Failed to open input file '" << args.stdinFile << "'\n";
+	  return false;
+	}
+    }
+  if (not args.stdoutFile.empty())
+    {
+      stdoutFile_ = fopen(args.stdoutFile.c_str(), "w");
+      if (not stdoutFile_)
+	{
+	  std::cerr << "Failed to open output file '" << args.stdoutFile << "'\n";
+	  return false;
+	}
+      if (consoleOut_ == stdout)
+	consoleOut_ = stdoutFile_;
+    }
+
+  bool serverMode = not args.serverFile.empty() or
+    not args.shmServerFile.empty();
+  bool storeExceptions = args.interactive or serverMode;
+
+  // In-memory file system shared by the harts.
+  if (args.vfsImage)
+    vfs_ = std::make_unique<Vfs>(*args.vfsImage);
+  else if (not args.vfsPath.empty())
+    {
+      vfs_ = std::make_unique<Vfs>();
+      if (not vfs_->load(args.vfsPath))
+	return false;
+    }
+
+  // Log of the nondeterministic inputs (see --recordinputs).
+  if (not args.recordInputs.empty() or not args.replayInputs.empty())
+    {
+      inputLog_ = std::make_unique<InputLog>();
+      bool ok = false;
+      if (not args.recordInputs.empty() and not args.replayInputs.empty())
+	std::cerr << "Options --recordinputs and --replayinputs cannot be "
+		  << "used together\n";
+      else if (not args.recordInputs.empty())
+	ok = inputLog_->openRecord(args.recordInputs);
+      else
+	ok = inputLog_->openReplay(args.replayInputs);
+      if (not ok)
+	return false;
+    }
+
+  // Observer plugins (see --observer). The plugin code is never
+  // unloaded.
+  for (const auto& spec : args.observers)
+    {
+      size_t space = spec.find(' ');
+      std::string path = spec.substr(0, space);
+      std::string pluginArgs;
+      if (space != std::string::npos)
+	pluginArgs = spec.substr(space + 1);
+      Observer* observer = loadObserverPlugin(path, pluginArgs);
+      if (not observer)
+	return false;
+      observers_.emplace_back(observer);
+    }
+
+  // Core local interruptor (see --clint) shared by the harts.
+  if (args.clint)
+    {
+      clint_ = std::make_unique<Clint>(*args.clint, unsigned(harts.size()));
+      for (unsigned i = 0; i < harts.size(); ++i)
+	harts.at(i)->attachClint(clint_.get(), i);
+    }
+
+  // Coverage (see --coverage): One object per hart (harts may run
+  // in parallel) merged at the end of the run.
+  for (auto hartPtr : harts)
+    {
+      hartPtr->setVfs(vfs_.get());
+      for (auto& observer : observers_)
+	hartPtr->addObserver(observer.get());
+      if (args.hasCoverage())
+	{
+	  coverages_.push_back(std::make_unique<Coverage>());
+	  hartPtr->setCoverage(coverages_.back().get());
+	}
+      hartPtr->setInputLog(inputLog_.get());
+      if (stdinFile_)
+	hartPtr->redirectStdFd(0, fileno(stdinFile_));
+      if (stdoutFile_)
+	{
+	  fflush(stdoutFile_);
+	  hartPtr->redirectStdFd(1, fileno(stdoutFile_));
+	}
+      hartPtr->setConsoleOutput(consoleOut_);
+      hartPtr->enableLoadExceptions(storeExceptions);
+      hartPtr->setBranchTrace(branchFile_);
+      hartPtr->reset();
+    }
+
+  // Trace records of batch runs are formatted and written by a
+  // background thread. Not done for the standard output where the
+  // trace interleaves with the output of the target program nor on a
+  // single core host where the writer would compete with the harts.
+#ifndef __EMSCRIPTEN__
+  if (traceFile_ and traceFile_ != stdout and not args.syncTrace and
+      not args.interactive and args.serverFile.empty() and
+      args.shmServerFile.empty() and not args.gdb and
+      std::thread::hardware_concurrency() > 1)
+    {
+      TraceWriter::Formatter formatter;
+      if (not args.binaryLog)
+	formatter = [&harts, tmp = std::string()] (const TraceRecord& rec,
+						   FILE* out) mutable {
+		      harts.at(rec.hartId)->printTraceRecord(rec, tmp, out); };
+      traceWriter_ = std::make_unique<TraceWriter>(traceFile_,
+						   unsigned(harts.size()),
+						   formatter);
+      for (auto hartPtr : harts)
+	hartPtr->setTraceWriter(traceWriter_.get());
+    }
+#endif
+
+  return true;
 }
 
 
 template <typename URV>
-static
 bool
-session(const Args& args, const HartConfig& config)
+Session<URV>::finish(bool result)
 {
-  unsigned registerCount = 32;
-  unsigned hartCount = args.harts;
-  if (hartCount == 0 or hartCount > 64)
+  const Args& args = args_;
+  auto& harts = harts_;
+
+  if (not observers_.empty())
     {
-      std::cerr << "Unreasonable hart count: " << hartCount << '\n';
-      return false;
+      for (auto hartPtr : harts)
+	hartPtr->flushObserverEvents();
+      for (auto& observer : observers_)
+	observer->finish();
     }
 
-  // Determine simulated memory size. Default to 4 gigs.
-  // If running a 32-bit machine (pointer size = 32 bits), try 2 gigs.
-  size_t memorySize = size_t(1) << 27;  // 4 gigs
-  if (memorySize == 0)
-    memorySize = size_t(1) << 31;  // 2 gigs
-  config.getMemorySize(memorySize);
+  if (traceWriter_)
+    {
+      for (auto hartPtr : harts)
+	hartPtr->setTraceWriter(nullptr);
+      traceWriter_.reset();
+    }
 
-  size_t pageSize = 4*1024;
-  if (not config.getPageSize(pageSize))
-    pageSize = args.pageSize;
+  // Results of a sample are collected by the sampler.
+  if (not isSample_)
+    {
+      if (not args.instFreqFile.empty())
+	{
+	  Hart<URV>& hart0 = *harts.front();
+	  result = ( reportInstructionFrequency(hart0, args.instFreqFile) and
+		     result );
+	}
 
-  Memory memory(memorySize, pageSize);
-  memory.setHartCount(hartCount);
-  memory.checkUnmappedElf(not args.unmappedElfOk);
+      nlohmann::json samples;
+      if (sampledRun_)
+	{
+	  sampledRun_->addPcProfiles(harts);
+	  sampledRun_->getStats(samples);
+	}
 
-  // Make sure harts get deleted on exit of this scope.
-  std::vector<std::unique_ptr<Hart<URV>>> autoDeleteHarts;
+      if (not args.statsFile.empty())
+	result = ( reportStats(harts, args, sampledRun_ ? &samples : nullptr)
+		   and result );
 
-  // Create and configure harts.
-  std::vector<Hart<URV>*> harts;
-  for (unsigned i = 0; i < hartCount; ++i)
-    {
-      auto hart = new Hart<URV>(i, memory, registerCount);
-      harts.push_back(hart);
-      autoDeleteHarts.push_back(std::unique_ptr<Hart<URV>>(hart));
-    }
+      if (not args.pcProfileFile.empty() or not args.flameFile.empty())
+	result = reportPcProfile(harts, args) and result;
 
-  // Configure harts.
-  for (auto hartPtr : harts)
-    if (not config.applyConfig(*hartPtr, args.verbose))
-      if (not args.interactive)
-	return false;
-  config.finalizeCsrConfig(harts);
+      if (not args.callProfileFile.empty() or not args.callStackFile.empty())
+	result = reportCallProfile(harts, args) and result;
 
-  // Configure memory.
-  if (not config.applyMemoryConfig(*(harts.at(0)), args.verbose))
-    return false;
-  for (unsigned i = 1; i < hartCount; ++i)
-    harts.at(i)->copyMemRegionConfig(*harts.at(0));
+      if (not args.sampleFile.empty() or not args.sampleStackFile.empty())
+	result = reportSamples(harts, args) and result;
+    }
 
-  if (args.hexFiles.empty() and args.expandedTargets.empty()
-      and not args.interactive)
+  if (clint_)
+    for (auto hartPtr : harts)
+      hartPtr->attachClint(nullptr, 0);
+
+  if (not coverages_.empty())
     {
-      std::cerr << "No program file specified.\n";
-      return false;
+      result = reportCoverage(harts, coverages_, args) and result;
+      for (auto hartPtr : harts)
+	hartPtr->setCoverage(nullptr);
     }
 
-  FILE* traceFile = nullptr;
-  FILE* commandLog = nullptr;
-  FILE* consoleOut = stdout;
-  if (not openUserFiles(args, traceFile, commandLog, consoleOut))
-    return false;
+  return result;
+}
 
-  bool serverMode = not args.serverFile.empty();
-  bool storeExceptions = args.interactive or serverMode;
 
-  for (auto hartPtr : harts)
-    {
-      hartPtr->setConsoleOutput(consoleOut);
-      hartPtr->enableLoadExceptions(storeExceptions);
-      hartPtr->reset();
-    }
+template <typename URV>
+static
+bool
+session(const Args& args, const HartConfig& config, SampledRun<URV>* sampler)
+{
+  Session<URV> session(args, config, sampler);
+  if (not session.createSystem())
+    return false;
 
-  bool result = sessionRun(harts, args, traceFile, commandLog);
+  if (not args.decodeLogFile.empty())
+    return decodeBinaryLog(session.harts(), args);
 
-  if (not args.instFreqFile.empty())
-    {
-      Hart<URV>& hart0 = *harts.front();
-      result = reportInstructionFrequency(hart0, args.instFreqFile) and result;
-    }
+  if (not args.decodeBranchLogFile.empty())
+    return decodeBranchLog(session.harts(), args);
 
-  closeUserFiles(traceFile, commandLog, consoleOut);
+  if (not session.open())
+    return false;
 
-  return result;
+  bool result = sessionRun(session.harts(), session.runArgs(),
+			   session.traceFile(), session.commandLog(),
+			   session.sampler());
+  return session.finish(result);
 }
 
 
@@ -1190,12 +3256,519 @@ determineRegisterWidth(const Args& args, const HartConfig& config)
   unsigned width = 32;
   if (args.hasRegWidth)
     width = args.regWidth;
+  else if (not args.decodeLogFile.empty())
+    {
+      // Use width recorded in binary trace.
+      FILE* in = CompressedFile::openRead(args.decodeLogFile);
+      if (in)
+	{
+	  BinaryTrace::readHeader(in, width);
+	  fclose(in);
+	}
+    }
   else if (not config.getXlen(width))
     getXlenFromElfFile(args, width);
   return width;
 }
 
 
+/// Run a session for the given arguments and configuration using
+/// the register width of the configuration or the target program.
+static
+bool
+sessionAnyWidth(const Args& args, const HartConfig& config)
+{
+  unsigned regWidth = determineRegisterWidth(args, config);
+
+  if (regWidth == 32)
+    return session<uint32_t>(args, config);
+  if (regWidth == 64)
+    return session<uint64_t>(args, config);
+
+  std::cerr << "Invalid register width: " << regWidth;
+  std::cerr << " -- expecting 32 or 64\n";
+  return false;
+}
+
+
+/// A simulation job of the jobs file (see --jobs).
+struct Job
+{
+  std::string target;       // Target program and its arguments.
+  std::string configFile;
+  std::string stdinFile;
+  std::string stdoutFile;
+  std::string vfsPath;
+};
+
+
+/// Read the jobs of the given file into the given vector. Return true
+/// on success and false on failure.
+static
+bool
+readJobsFile(const std::string& path, std::vector<Job>& jobs)
+{
+  std::ifstream ifs(path);
+  if (not ifs)
+    {
+      std::cerr << "Failed to open jobs file '" << path << "'\n";
+      return false;
+    }
+
+  std::string line;
+  unsigned lineNum = 0;
+  bool ok = true;
+  while (std::getline(ifs, line))
+    {
+      lineNum++;
+      boost::trim(line);
+      if (line.empty() or line.front() == '#')
+	continue;
+
+      std::vector<std::string> tokens;
+      boost::split(tokens, line, boost::is_any_of(" \t"),
+		   boost::token_compress_on);
+
+      Job job;
+      size_t ix = 0;
+      for ( ; ix < tokens.size(); ++ix)
+	{
+	  const auto& tok = tokens.at(ix);
+	  if (boost::starts_with(tok, "config="))
+	    job.configFile = tok.substr(7);
+	  else if (boost::starts_with(tok, "stdin="))
+	    job.stdinFile = tok.substr(6);
+	  else if (boost::starts_with(tok, "stdout="))
+	    job.stdoutFile = tok.substr(7);
+	  else if (boost::starts_with(tok, "vfs="))
+	    job.vfsPath = tok.substr(4);
+	  else
+	    break;
+	}
+
+      std::vector<std::string> target(tokens.begin() + ix, tokens.end());
+      if (target.empty())
+	{
+	  std::cerr << "File " << path << ", line " << lineNum
+		    << ": Missing target program\n";
+	  ok = false;
+	  continue;
+	}
+      job.target = boost::join(target, " ");
+      jobs.push_back(job);
+    }
+
+  return ok;
+}
+
+
+/// Run the jobs of the jobs file of the given arguments on a pool of
+/// threads. Each job is an independent system (memory and harts)
+/// configured by the command line arguments and by its own or the
+/// default configuration. Configuration files are parsed once and
+/// shared (read-only) by all the jobs using them. Return true if all
+/// the jobs succeed.
+static
+bool
+runJobs(const Args& args, const HartConfig& defaultConfig)
+{
+  if (args.interactive or args.gdb or not args.serverFile.empty() or
+      not args.shmServerFile.empty() or
+      args.trace or not args.traceFile.empty() or
+      not args.instFreqFile.empty() or not args.consoleOutFile.empty() or
+      not args.pcProfileFile.empty() or not args.flameFile.empty() or
+      not args.callProfileFile.empty() or not args.callStackFile.empty() or
+      not args.sampleFile.empty() or not args.sampleStackFile.empty() or
+      not args.branchLogFile.empty() or not args.statsFile.empty() or
+      args.samplingInterval or not args.recordInputs.empty() or
+      not args.replayInputs.empty())
+    {
+      std::cerr << "Option --jobs cannot be used with interactive, server, "
+		<< "gdb, tracing, profiling, sampling, input record/replay or "
+		<< "console output file options\n";
+      return false;
+    }
+
+  std::vector<Job> jobs;
+  if (not readJobsFile(args.jobsFile, jobs))
+    return false;
+
+  // Parse each configuration file once.
+  std::map<std::string, std::unique_ptr<HartConfig>> configs;
+  for (const auto& job : jobs)
+    {
+      if (job.configFile.empty() or configs.count(job.configFile))
+	continue;
+      auto config = std::make_unique<HartConfig>();
+      if (not config->loadConfigFile(job.configFile, args.configCache))
+	return false;
+      configs[job.configFile] = std::move(config);
+    }
+
+  // Load each file system image once: Jobs run on copies.
+  std::map<std::string, std::unique_ptr<Vfs>> vfsImages;
+  for (const auto& job : jobs)
+    {
+      const std::string& path = ( job.vfsPath.empty() ? args.vfsPath :
+				  job.vfsPath );
+      if (path.empty() or vfsImages.count(path))
+	continue;
+      auto vfs = std::make_unique<Vfs>();
+      if (not vfs->load(path))
+	return false;
+      vfsImages[path] = std::move(vfs);
+    }
+
+  // Arguments of a job.
+  auto makeJobArgs = [&args] (const Job& job) {
+    Args jobArgs = args;
+    jobArgs.jobsFile.clear();
+    jobArgs.targets = { job.target };
+    jobArgs.targetSep = " ";
+    jobArgs.expandTargets();
+    jobArgs.stdinFile = job.stdinFile;
+    jobArgs.stdoutFile = job.stdoutFile;
+    if (not job.vfsPath.empty())
+      jobArgs.vfsPath = job.vfsPath;
+    return jobArgs;
+  };
+
+  // Load each program once (per memory geometry) into an image whose
+  // pages are shared copy-on-write by the memories of the jobs running
+  // the program (see Memory::shareImage): A job then holds only the
+  // pages it writes.
+  typedef std::tuple<std::string, size_t, size_t> ImageKey;
+  std::map<ImageKey, std::unique_ptr<Memory>> images;
+  std::vector<Memory*> jobImages(jobs.size());
+  if (not Memory::canShareImages())
+    {
+      if (args.verbose)
+	std::cerr << "Program images are not shared by the jobs: Memory "
+		  << "storage is not sparse (see MEM_SPARSE)\n";
+    }
+  else
+    for (size_t ix = 0; ix < jobs.size(); ++ix)
+      {
+	const Job& job = jobs.at(ix);
+	Args jobArgs = makeJobArgs(job);
+	const HartConfig& config = ( job.configFile.empty() ? defaultConfig :
+				     *configs.at(job.configFile) );
+	ImageKey key;
+	std::get<0>(key) = jobArgs.expandedTargets.front().front();
+	getMemoryGeometry(jobArgs, config, std::get<1>(key), std::get<2>(key));
+
+	auto iter = images.find(key);
+	if (iter == images.end())
+	  {
+	    // Jobs failing to load the program report the error.
+	    bool is32 = false, is64 = false, isRiscv = false;
+	    if (not Memory::checkElfFile(std::get<0>(key), is32, is64, isRiscv))
+	      continue;
+	    auto image = std::make_unique<Memory>(std::get<1>(key),
+						  std::get<2>(key));
+	    image->checkUnmappedElf(false);
+	    size_t entry = 0, end = 0;
+	    if (not image->loadElfFile(std::get<0>(key), is32 ? 32 : 64,
+				       entry, end))
+	      continue;
+	    image->shareImage(*image);  // Make the loaded pages shared.
+	    iter = images.emplace(key, std::move(image)).first;
+	  }
+	jobImages.at(ix) = iter->second.get();
+      }
+
+  unsigned threadCount = args.jobThreads;
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  threadCount = std::min(threadCount, unsigned(jobs.size()));
+
+  // Threads pick the jobs in order: A job is much longer than the
+  // fetch of the next job index.
+  std::atomic<size_t> nextJob = 0;
+  std::vector<char> results(jobs.size(), false);
+  unsigned kbdInterrupts = Hart<uint32_t>::keyboardInterruptCount();
+
+  auto worker = [&] () {
+    while (true)
+      {
+	size_t ix = nextJob++;
+	if (ix >= jobs.size() or
+	    Hart<uint32_t>::keyboardInterruptCount() != kbdInterrupts)
+	  break;
+
+	const Job& job = jobs.at(ix);
+	Args jobArgs = makeJobArgs(job);
+	if (not jobArgs.vfsPath.empty())
+	  jobArgs.vfsImage = vfsImages.at(jobArgs.vfsPath).get();
+	jobArgs.memoryImage = jobImages.at(ix);
+
+	const HartConfig& config = ( job.configFile.empty() ? defaultConfig :
+				     *configs.at(job.configFile) );
+	bool ok = false;
+	try
+	  {
+	    ok = sessionAnyWidth(jobArgs, config);
+	  }
+	catch (std::exception& e)
+	  {
+	    std::cerr << e.what() << '\n';
+	  }
+	results.at(ix) = ok;
+      }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < threadCount; ++i)
+    threads.emplace_back(worker);
+  for (auto& t : threads)
+    t.join();
+
+  unsigned failed = 0;
+  for (size_t ix = 0; ix < jobs.size(); ++ix)
+    if (not results.at(ix))
+      {
+	std::cerr << "Job " << (ix + 1) << " failed: " << jobs.at(ix).target
+		  << '\n';
+	failed++;
+      }
+  std::cerr << "Jobs: " << jobs.size() << " run, " << failed << " failed\n";
+
+  return failed == 0;
+}
+
+
+#if defined(__EMSCRIPTEN__) and not defined(__EMSCRIPTEN_PTHREADS__)
+
+#include <emscripten.h>
+
+// Browser build without threads: A plain run is driven by the browser
+// event loop one slice at a time (see whisperCreateSession) instead of
+// blocking the main browser thread until the target programs stop.
+
+
+/// Return true if the given arguments ask for a plain run of the target
+/// programs: One that can be run in slices.
+static
+bool
+isSlicedRun(const Args& args)
+{
+  return ( not args.interactive and not args.gdb and
+	   args.serverFile.empty() and args.shmServerFile.empty() and
+	   args.jobsFile.empty() and not args.samplingInterval and
+	   args.decodeLogFile.empty() and args.decodeBranchLogFile.empty() );
+}
+
+
+/// Outcome of whisperRunSlice (same values as Hart::SliceStatus).
+enum WhisperSliceStatus { WhisperSliceYield, WhisperSliceStopped,
+			  WhisperSliceFailed };
+
+
+/// Run of a session one slice at a time: Interface independent of
+/// the register width.
+class SlicedRun
+{
+public:
+
+  virtual ~SlicedRun() = default;
+
+  /// Run each running hart for up to count instructions.
+  virtual WhisperSliceStatus runSlice(uint64_t count) = 0;
+
+  /// Collect the results of the run. Return true on success.
+  virtual bool finish() = 0;
+};
+
+
+template <typename URV>
+class SlicedRunOf : public SlicedRun
+{
+public:
+
+  SlicedRunOf(const Args& args, const HartConfig& config)
+    : args_(args), session_(args, config, nullptr)
+  { }
+
+  /// Create the system and load the target programs. Return true on
+  /// success.
+  bool start()
+  {
+    if (not session_.createSystem() or not session_.open() or
+	not prepareRun(session_.harts(), args_))
+      return false;
+    active_ = session_.harts();
+    for (auto hartPtr : active_)
+      counter0_ += hartPtr->getInstructionCount();
+    gettimeofday(&t0_, nullptr);
+    return true;
+  }
+
+  WhisperSliceStatus runSlice(uint64_t count) override
+  {
+    if (not active_.empty() and
+	not runSliceRound(active_, session_.traceFile(), count))
+      ok_ = false;
+    if (not active_.empty())
+      return WhisperSliceYield;
+    return ok_ ? WhisperSliceStopped : WhisperSliceFailed;
+  }
+
+  bool finish() override
+  {
+    reportRetired(session_.harts(), counter0_, t0_);
+    bool ok = ok_;
+    if (not args_.saveCheckpoint.empty())
+      ok = saveCheckpoint(session_.harts(), args_.saveCheckpoint) and ok;
+    return session_.finish(ok);
+  }
+
+private:
+
+  const Args& args_;
+  Session<URV> session_;
+  std::vector<Hart<URV>*> active_;  // Harts that have not stopped.
+  uint64_t counter0_ = 0;
+  struct timeval t0_ = {};
+  bool ok_ = true;
+};
+
+
+/// Session created by whisperCreateSession.
+struct BrowserSession
+{
+  Args args;
+  HartConfig config;
+  std::unique_ptr<SlicedRun> run;  // Last: Refers to args and config.
+};
+
+
+template <typename URV>
+static
+bool
+startSlicedRun(BrowserSession& session)
+{
+  auto run = std::make_unique<SlicedRunOf<URV>>(session.args, session.config);
+  if (not run->start())
+    return false;
+  session.run = std::move(run);
+  return true;
+}
+
+
+/// Create a session for the given arguments (with expanded targets)
+/// and load its target programs. Return null on failure.
+static
+BrowserSession*
+createBrowserSession(const Args& args)
+{
+  auto session = std::make_unique<BrowserSession>();
+  session->args = args;
+
+  if (not args.configFile.empty())
+    if (not session->config.loadConfigFile(args.configFile, args.configCache))
+      return nullptr;
+
+  unsigned regWidth = determineRegisterWidth(session->args, session->config);
+  bool ok = false;
+  if (regWidth == 32)
+    ok = startSlicedRun<uint32_t>(*session);
+  else if (regWidth == 64)
+    ok = startSlicedRun<uint64_t>(*session);
+  else
+    std::cerr << "Invalid register width: " << regWidth
+	      << " -- expecting 32 or 64\n";
+
+  return ok ? session.release() : nullptr;
+}
+
+
+extern "C" {
+
+/// Browser API: Create a simulation session for the given command
+/// line (as passed to main) and load its target programs. Return a
+/// handle for whisperRunSlice and whisperDestroySession. Return null
+/// on failure (messages are written to the standard error) or if the
+/// command line does not ask for a plain run (interactive, server,
+/// gdb, jobs, sampled run or log decoding: use main).
+EMSCRIPTEN_KEEPALIVE
+void*
+whisperCreateSession(int argc, char* argv[])
+{
+  Args args;
+  if (not parseCmdLineArgs(argc, argv, args) or args.help)
+    return nullptr;
+
+  if (not isSlicedRun(args))
+    {
+      std::cerr << "Error: Session command line must be that of a plain "
+		<< "run (no interactive, server, gdb, jobs, sampling or "
+		<< "decoding option)\n";
+      return nullptr;
+    }
+
+  args.expandTargets();
+  return createBrowserSession(args);
+}
+
+
+/// Browser API: Run each running hart of the given session for up to
+/// count instructions then return a WhisperSliceStatus: Yield if some
+/// hart can continue, Stopped if all the harts stopped, Failed if
+/// some hart stopped with an error. The caller (the browser event
+/// loop) schedules the next slice.
+EMSCRIPTEN_KEEPALIVE
+int
+whisperRunSlice(void* session, unsigned count)
+{
+  auto browserSession = static_cast<BrowserSession*>(session);
+  return browserSession->run->runSlice(count);
+}
+
+
+/// Browser API: Collect the results of the run of the given session
+/// (statistics, profiles), close its files and delete it. Return the
+/// exit status of the run: 0 on success and 1 on failure.
+EMSCRIPTEN_KEEPALIVE
+int
+whisperDestroySession(void* session)
+{
+  auto browserSession = static_cast<BrowserSession*>(session);
+  bool ok = browserSession->run->finish();
+  delete browserSession;
+  return ok ? 0 : 1;
+}
+
+}
+
+
+/// Main loop callback (see emscripten_set_main_loop_arg) of a plain
+/// run: Run slices of the given session (a BrowserSession) for about
+/// 10 milliseconds then return to the browser. Exit when the harts
+/// stop.
+static
+void
+browserMainLoop(void* session)
+{
+  auto browserSession = static_cast<BrowserSession*>(session);
+  unsigned quantum = unsigned(std::min(browserSession->args.quantum.value_or(10000),
+				       uint64_t(~0u)));
+
+  double end = emscripten_get_now() + 10;
+  int status = WhisperSliceYield;
+  do
+    status = whisperRunSlice(session, quantum);
+  while (status == WhisperSliceYield and emscripten_get_now() < end);
+
+  if (status == WhisperSliceYield)
+    return;
+
+  emscripten_cancel_main_loop();
+  emscripten_force_exit(whisperDestroySession(session));
+}
+
+#endif
+
+
 int
 main(int argc, char* argv[])
 {
@@ -1212,28 +3785,35 @@ main(int argc, char* argv[])
   // Expand each target program string into program name and args.
   args.expandTargets();
 
+#if defined(__EMSCRIPTEN__) and not defined(__EMSCRIPTEN_PTHREADS__)
+  // Browser build: A plain run is driven by the browser event loop so
+  // that the page stays responsive (see whisperCreateSession).
+  if (isSlicedRun(args))
+    {
+      BrowserSession* session = createBrowserSession(args);
+      if (not session)
+	return 1;
+      // Does not return: The stack of main is unwound and the loop
+      // runs from the browser event loop.
+      emscripten_set_main_loop_arg(browserMainLoop, session, 0, true);
+      return 0;
+    }
+#endif
+
   // Load configuration file.
   HartConfig config;
   if (not args.configFile.empty())
-    if (not config.loadConfigFile(args.configFile))
+    if (not config.loadConfigFile(args.configFile, args.configCache))
       return 1;
 
-  unsigned regWidth = determineRegisterWidth(args, config);
-
   bool ok = true;
 
   try
     {
-      if (regWidth == 32)
-	ok = session<uint32_t>(args, config);
-      else if (regWidth == 64)
-	ok = session<uint64_t>(args, config);
+      if (not args.jobsFile.empty())
+	ok = runJobs(args, config);
       else
-	{
-	  std::cerr << "Invalid register width: " << regWidth;
-	  std::cerr << " -- expecting 32 or 64\n";
-	  ok = false;
-	}
+	ok = sessionAnyWidth(args, config);
     }
   catch (std::exception& e)
     {